@@ -0,0 +1,402 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2011, 2012, 2013, 2014, 2015 Olaf Bergmann (TZI) and others.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v. 1.0 which accompanies this distribution.
+ *
+ * The Eclipse Public License is available at http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Olaf Bergmann  - initial API and implementation
+ *
+ *******************************************************************************/
+
+/**
+ * @file aes_hw.c
+ * @brief AES block encryption using AES-NI or ARMv8 Crypto Extensions
+ */
+
+#include "aes_hw.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define AES_HW_X86 1
+#include <wmmintrin.h>
+#include <immintrin.h>
+#define AES_HW_TARGET __attribute__((target("sse2,aes")))
+#define AES_HW_VAES_TARGET __attribute__((target("avx512f,vaes")))
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__linux__)
+#define AES_HW_ARM 1
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#include <arm_neon.h>
+#ifdef __clang__
+#define AES_HW_TARGET __attribute__((target("crypto")))
+#else
+#define AES_HW_TARGET __attribute__((target("+crypto")))
+#endif
+#endif
+
+#if defined(AES_HW_X86) || defined(AES_HW_ARM)
+
+/* number of blocks processed side by side in aes_hw_encrypt_blocks() */
+#define AES_HW_LANES 4
+
+/* The result of the CPU check: -1 if not done yet, 1 if AES
+ * instructions can be used, 0 otherwise. */
+static int aes_hw = -1;
+
+int
+aes_hw_available(void) {
+  if (aes_hw < 0) {
+#ifdef AES_HW_X86
+    __builtin_cpu_init();
+    aes_hw = __builtin_cpu_supports("aes") ? 1 : 0;
+#else
+    aes_hw = (getauxval(AT_HWCAP) & HWCAP_AES) ? 1 : 0;
+#endif
+  }
+  return aes_hw;
+}
+
+#ifdef AES_HW_X86
+/* The result of the check for VAES on 512-bit registers, like
+ * aes_hw. */
+static int aes_hw_vaes = -1;
+
+static int
+aes_hw_vaes_check(void) {
+  if (aes_hw_vaes < 0)
+    aes_hw_vaes = (aes_hw_available() && __builtin_cpu_supports("avx512f")
+		   && __builtin_cpu_supports("vaes")) ? 1 : 0;
+  return aes_hw_vaes;
+}
+#endif /* AES_HW_X86 */
+
+int
+aes_hw_setup(aes_u32 rk[/*4*(Nr + 1)*/], int Nr) {
+  aes_u8 *p = (aes_u8 *)rk;
+  aes_u32 w;
+  int i;
+
+  if (!aes_hw_available())
+    return 0;
+
+  /* rijndaelKeySetupEnc() stores each word with the first key byte
+   * in the most significant position, the instructions expect the
+   * round keys as plain byte strings. */
+  for (i = 0; i < 4 * (Nr + 1); i++) {
+    w = rk[i];
+    p[4 * i]     = (aes_u8)(w >> 24);
+    p[4 * i + 1] = (aes_u8)(w >> 16);
+    p[4 * i + 2] = (aes_u8)(w >> 8);
+    p[4 * i + 3] = (aes_u8)w;
+  }
+  return 1;
+}
+
+#ifdef AES_HW_X86
+AES_HW_TARGET void
+aes_hw_encrypt(const aes_u32 rk[/*4*(Nr + 1)*/], int Nr,
+	       const aes_u8 pt[16], aes_u8 ct[16]) {
+  const __m128i *k = (const __m128i *)rk;
+  __m128i s;
+  int r;
+
+  s = _mm_xor_si128(_mm_loadu_si128((const __m128i *)pt),
+		    _mm_loadu_si128(k));
+  for (r = 1; r < Nr; r++)
+    s = _mm_aesenc_si128(s, _mm_loadu_si128(k + r));
+  s = _mm_aesenclast_si128(s, _mm_loadu_si128(k + Nr));
+  _mm_storeu_si128((__m128i *)ct, s);
+}
+
+/* Encrypts groups of sixteen blocks with VAES, i.e. four blocks in
+ * each 512-bit register, and returns the number of blocks that are
+ * left. */
+static AES_HW_VAES_TARGET size_t
+aes_vaes_encrypt_blocks(const aes_u32 rk[/*4*(Nr + 1)*/], int Nr,
+			const aes_u8 *in, aes_u8 *out, size_t n) {
+  const __m128i *k = (const __m128i *)rk;
+  __m512i s0, s1, s2, s3, kr;
+  int r;
+
+  for (; n >= 4 * AES_HW_LANES; n -= 4 * AES_HW_LANES,
+	 in += 256, out += 256) {
+    kr = _mm512_broadcast_i32x4(_mm_loadu_si128(k));
+    s0 = _mm512_xor_si512(_mm512_loadu_si512(in), kr);
+    s1 = _mm512_xor_si512(_mm512_loadu_si512(in + 64), kr);
+    s2 = _mm512_xor_si512(_mm512_loadu_si512(in + 128), kr);
+    s3 = _mm512_xor_si512(_mm512_loadu_si512(in + 192), kr);
+    for (r = 1; r < Nr; r++) {
+      kr = _mm512_broadcast_i32x4(_mm_loadu_si128(k + r));
+      s0 = _mm512_aesenc_epi128(s0, kr);
+      s1 = _mm512_aesenc_epi128(s1, kr);
+      s2 = _mm512_aesenc_epi128(s2, kr);
+      s3 = _mm512_aesenc_epi128(s3, kr);
+    }
+    kr = _mm512_broadcast_i32x4(_mm_loadu_si128(k + Nr));
+    _mm512_storeu_si512(out, _mm512_aesenclast_epi128(s0, kr));
+    _mm512_storeu_si512(out + 64, _mm512_aesenclast_epi128(s1, kr));
+    _mm512_storeu_si512(out + 128, _mm512_aesenclast_epi128(s2, kr));
+    _mm512_storeu_si512(out + 192, _mm512_aesenclast_epi128(s3, kr));
+  }
+  return n;
+}
+
+AES_HW_TARGET void
+aes_hw_encrypt_blocks(const aes_u32 rk[/*4*(Nr + 1)*/], int Nr,
+		      const aes_u8 *in, aes_u8 *out, size_t n) {
+  const __m128i *k = (const __m128i *)rk;
+  const __m128i *src = (const __m128i *)in;
+  __m128i *dst = (__m128i *)out;
+  __m128i s0, s1, s2, s3, kr;
+  size_t done;
+  int r;
+
+  if (n >= 4 * AES_HW_LANES && aes_hw_vaes_check()) {
+    done = n - aes_vaes_encrypt_blocks(rk, Nr, in, out, n);
+    src += done;
+    dst += done;
+    n -= done;
+  }
+
+  for (; n >= AES_HW_LANES; n -= AES_HW_LANES, src += 4, dst += 4) {
+    kr = _mm_loadu_si128(k);
+    s0 = _mm_xor_si128(_mm_loadu_si128(src), kr);
+    s1 = _mm_xor_si128(_mm_loadu_si128(src + 1), kr);
+    s2 = _mm_xor_si128(_mm_loadu_si128(src + 2), kr);
+    s3 = _mm_xor_si128(_mm_loadu_si128(src + 3), kr);
+    for (r = 1; r < Nr; r++) {
+      kr = _mm_loadu_si128(k + r);
+      s0 = _mm_aesenc_si128(s0, kr);
+      s1 = _mm_aesenc_si128(s1, kr);
+      s2 = _mm_aesenc_si128(s2, kr);
+      s3 = _mm_aesenc_si128(s3, kr);
+    }
+    kr = _mm_loadu_si128(k + Nr);
+    _mm_storeu_si128(dst, _mm_aesenclast_si128(s0, kr));
+    _mm_storeu_si128(dst + 1, _mm_aesenclast_si128(s1, kr));
+    _mm_storeu_si128(dst + 2, _mm_aesenclast_si128(s2, kr));
+    _mm_storeu_si128(dst + 3, _mm_aesenclast_si128(s3, kr));
+  }
+
+  for (; n >= 2; n -= 2, src += 2, dst += 2) {
+    kr = _mm_loadu_si128(k);
+    s0 = _mm_xor_si128(_mm_loadu_si128(src), kr);
+    s1 = _mm_xor_si128(_mm_loadu_si128(src + 1), kr);
+    for (r = 1; r < Nr; r++) {
+      kr = _mm_loadu_si128(k + r);
+      s0 = _mm_aesenc_si128(s0, kr);
+      s1 = _mm_aesenc_si128(s1, kr);
+    }
+    kr = _mm_loadu_si128(k + Nr);
+    _mm_storeu_si128(dst, _mm_aesenclast_si128(s0, kr));
+    _mm_storeu_si128(dst + 1, _mm_aesenclast_si128(s1, kr));
+  }
+
+  if (n)
+    aes_hw_encrypt(rk, Nr, (const aes_u8 *)src, (aes_u8 *)dst);
+}
+
+AES_HW_TARGET void
+aes_hw_encrypt_multi(const aes_u32 *rk[], int Nr,
+		     const aes_u8 *in, aes_u8 *out, size_t n) {
+  const __m128i *k0, *k1, *k2, *k3;
+  __m128i s0, s1, s2, s3;
+  int r;
+
+  for (; n >= AES_HW_LANES; n -= AES_HW_LANES, rk += 4,
+	 in += 64, out += 64) {
+    k0 = (const __m128i *)rk[0];
+    k1 = (const __m128i *)rk[1];
+    k2 = (const __m128i *)rk[2];
+    k3 = (const __m128i *)rk[3];
+    s0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)in),
+		       _mm_loadu_si128(k0));
+    s1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)in + 1),
+		       _mm_loadu_si128(k1));
+    s2 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)in + 2),
+		       _mm_loadu_si128(k2));
+    s3 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)in + 3),
+		       _mm_loadu_si128(k3));
+    for (r = 1; r < Nr; r++) {
+      s0 = _mm_aesenc_si128(s0, _mm_loadu_si128(k0 + r));
+      s1 = _mm_aesenc_si128(s1, _mm_loadu_si128(k1 + r));
+      s2 = _mm_aesenc_si128(s2, _mm_loadu_si128(k2 + r));
+      s3 = _mm_aesenc_si128(s3, _mm_loadu_si128(k3 + r));
+    }
+    _mm_storeu_si128((__m128i *)out,
+		     _mm_aesenclast_si128(s0, _mm_loadu_si128(k0 + Nr)));
+    _mm_storeu_si128((__m128i *)out + 1,
+		     _mm_aesenclast_si128(s1, _mm_loadu_si128(k1 + Nr)));
+    _mm_storeu_si128((__m128i *)out + 2,
+		     _mm_aesenclast_si128(s2, _mm_loadu_si128(k2 + Nr)));
+    _mm_storeu_si128((__m128i *)out + 3,
+		     _mm_aesenclast_si128(s3, _mm_loadu_si128(k3 + Nr)));
+  }
+
+  for (; n >= 2; n -= 2, rk += 2, in += 32, out += 32) {
+    k0 = (const __m128i *)rk[0];
+    k1 = (const __m128i *)rk[1];
+    s0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)in),
+		       _mm_loadu_si128(k0));
+    s1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)in + 1),
+		       _mm_loadu_si128(k1));
+    for (r = 1; r < Nr; r++) {
+      s0 = _mm_aesenc_si128(s0, _mm_loadu_si128(k0 + r));
+      s1 = _mm_aesenc_si128(s1, _mm_loadu_si128(k1 + r));
+    }
+    _mm_storeu_si128((__m128i *)out,
+		     _mm_aesenclast_si128(s0, _mm_loadu_si128(k0 + Nr)));
+    _mm_storeu_si128((__m128i *)out + 1,
+		     _mm_aesenclast_si128(s1, _mm_loadu_si128(k1 + Nr)));
+  }
+
+  if (n)
+    aes_hw_encrypt(rk[0], Nr, in, out);
+}
+#else /* AES_HW_ARM */
+AES_HW_TARGET void
+aes_hw_encrypt(const aes_u32 rk[/*4*(Nr + 1)*/], int Nr,
+	       const aes_u8 pt[16], aes_u8 ct[16]) {
+  const aes_u8 *k = (const aes_u8 *)rk;
+  uint8x16_t s = vld1q_u8(pt);
+  int r;
+
+  /* AESE includes the AddRoundKey step, so the last round key is
+   * added separately after the final round. */
+  for (r = 0; r < Nr - 1; r++)
+    s = vaesmcq_u8(vaeseq_u8(s, vld1q_u8(k + 16 * r)));
+  s = vaeseq_u8(s, vld1q_u8(k + 16 * (Nr - 1)));
+  s = veorq_u8(s, vld1q_u8(k + 16 * Nr));
+  vst1q_u8(ct, s);
+}
+
+AES_HW_TARGET void
+aes_hw_encrypt_blocks(const aes_u32 rk[/*4*(Nr + 1)*/], int Nr,
+		      const aes_u8 *in, aes_u8 *out, size_t n) {
+  const aes_u8 *k = (const aes_u8 *)rk;
+  uint8x16_t s0, s1, s2, s3, kr;
+  int r;
+
+  for (; n >= AES_HW_LANES; n -= AES_HW_LANES, in += 64, out += 64) {
+    s0 = vld1q_u8(in);
+    s1 = vld1q_u8(in + 16);
+    s2 = vld1q_u8(in + 32);
+    s3 = vld1q_u8(in + 48);
+    for (r = 0; r < Nr - 1; r++) {
+      kr = vld1q_u8(k + 16 * r);
+      s0 = vaesmcq_u8(vaeseq_u8(s0, kr));
+      s1 = vaesmcq_u8(vaeseq_u8(s1, kr));
+      s2 = vaesmcq_u8(vaeseq_u8(s2, kr));
+      s3 = vaesmcq_u8(vaeseq_u8(s3, kr));
+    }
+    kr = vld1q_u8(k + 16 * (Nr - 1));
+    s0 = vaeseq_u8(s0, kr);
+    s1 = vaeseq_u8(s1, kr);
+    s2 = vaeseq_u8(s2, kr);
+    s3 = vaeseq_u8(s3, kr);
+    kr = vld1q_u8(k + 16 * Nr);
+    vst1q_u8(out, veorq_u8(s0, kr));
+    vst1q_u8(out + 16, veorq_u8(s1, kr));
+    vst1q_u8(out + 32, veorq_u8(s2, kr));
+    vst1q_u8(out + 48, veorq_u8(s3, kr));
+  }
+
+  for (; n >= 2; n -= 2, in += 32, out += 32) {
+    s0 = vld1q_u8(in);
+    s1 = vld1q_u8(in + 16);
+    for (r = 0; r < Nr - 1; r++) {
+      kr = vld1q_u8(k + 16 * r);
+      s0 = vaesmcq_u8(vaeseq_u8(s0, kr));
+      s1 = vaesmcq_u8(vaeseq_u8(s1, kr));
+    }
+    kr = vld1q_u8(k + 16 * (Nr - 1));
+    s0 = vaeseq_u8(s0, kr);
+    s1 = vaeseq_u8(s1, kr);
+    kr = vld1q_u8(k + 16 * Nr);
+    vst1q_u8(out, veorq_u8(s0, kr));
+    vst1q_u8(out + 16, veorq_u8(s1, kr));
+  }
+
+  if (n)
+    aes_hw_encrypt(rk, Nr, in, out);
+}
+
+AES_HW_TARGET void
+aes_hw_encrypt_multi(const aes_u32 *rk[], int Nr,
+		     const aes_u8 *in, aes_u8 *out, size_t n) {
+  const aes_u8 *k0, *k1, *k2, *k3;
+  uint8x16_t s0, s1, s2, s3;
+  int r;
+
+  for (; n >= AES_HW_LANES; n -= AES_HW_LANES, rk += 4,
+	 in += 64, out += 64) {
+    k0 = (const aes_u8 *)rk[0];
+    k1 = (const aes_u8 *)rk[1];
+    k2 = (const aes_u8 *)rk[2];
+    k3 = (const aes_u8 *)rk[3];
+    s0 = vld1q_u8(in);
+    s1 = vld1q_u8(in + 16);
+    s2 = vld1q_u8(in + 32);
+    s3 = vld1q_u8(in + 48);
+    for (r = 0; r < Nr - 1; r++) {
+      s0 = vaesmcq_u8(vaeseq_u8(s0, vld1q_u8(k0 + 16 * r)));
+      s1 = vaesmcq_u8(vaeseq_u8(s1, vld1q_u8(k1 + 16 * r)));
+      s2 = vaesmcq_u8(vaeseq_u8(s2, vld1q_u8(k2 + 16 * r)));
+      s3 = vaesmcq_u8(vaeseq_u8(s3, vld1q_u8(k3 + 16 * r)));
+    }
+    r = 16 * (Nr - 1);
+    s0 = veorq_u8(vaeseq_u8(s0, vld1q_u8(k0 + r)), vld1q_u8(k0 + r + 16));
+    s1 = veorq_u8(vaeseq_u8(s1, vld1q_u8(k1 + r)), vld1q_u8(k1 + r + 16));
+    s2 = veorq_u8(vaeseq_u8(s2, vld1q_u8(k2 + r)), vld1q_u8(k2 + r + 16));
+    s3 = veorq_u8(vaeseq_u8(s3, vld1q_u8(k3 + r)), vld1q_u8(k3 + r + 16));
+    vst1q_u8(out, s0);
+    vst1q_u8(out + 16, s1);
+    vst1q_u8(out + 32, s2);
+    vst1q_u8(out + 48, s3);
+  }
+
+  for (; n; n--, rk++, in += 16, out += 16)
+    aes_hw_encrypt(rk[0], Nr, in, out);
+}
+#endif /* AES_HW_X86 */
+
+#else /* no AES instructions for this platform */
+
+int
+aes_hw_available(void) {
+  return 0;
+}
+
+int
+aes_hw_setup(aes_u32 rk[/*4*(Nr + 1)*/], int Nr) {
+  (void)rk;
+  (void)Nr;
+  return 0;
+}
+
+void
+aes_hw_encrypt(const aes_u32 rk[/*4*(Nr + 1)*/], int Nr,
+	       const aes_u8 pt[16], aes_u8 ct[16]) {
+  rijndaelEncrypt(rk, Nr, pt, ct);
+}
+
+void
+aes_hw_encrypt_blocks(const aes_u32 rk[/*4*(Nr + 1)*/], int Nr,
+		      const aes_u8 *in, aes_u8 *out, size_t n) {
+  for (; n; n--, in += 16, out += 16)
+    rijndaelEncrypt(rk, Nr, in, out);
+}
+
+void
+aes_hw_encrypt_multi(const aes_u32 *rk[], int Nr,
+		     const aes_u8 *in, aes_u8 *out, size_t n) {
+  for (; n; n--, rk++, in += 16, out += 16)
+    rijndaelEncrypt(rk[0], Nr, in, out);
+}
+
+#endif /* AES_HW_X86 || AES_HW_ARM */
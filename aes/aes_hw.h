@@ -0,0 +1,77 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2011, 2012, 2013, 2014, 2015 Olaf Bergmann (TZI) and others.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v. 1.0 which accompanies this distribution.
+ *
+ * The Eclipse Public License is available at http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Olaf Bergmann  - initial API and implementation
+ *
+ *******************************************************************************/
+
+/**
+ * @file aes_hw.h
+ * @brief AES block encryption using CPU instructions
+ *
+ * This backend is used by rijndael_encrypt() when the library is
+ * built with WITH_AES_HW and the CPU provides AES-NI (x86) or the
+ * ARMv8 Cryptography Extensions (aarch64). Availability is detected
+ * at runtime, rijndael.c remains the fallback otherwise.
+ */
+
+#ifndef _AES_HW_H_
+#define _AES_HW_H_
+
+#include <stddef.h>
+
+#include "rijndael.h"
+
+/**
+ * Returns @c 1 if the CPU supports AES instructions, @c 0 otherwise.
+ */
+int aes_hw_available(void);
+
+/**
+ * Checks if the CPU supports AES instructions and, if so, converts
+ * the key schedule @p rk that was set up by rijndaelKeySetupEnc() in
+ * place into the byte order used by aes_hw_encrypt().
+ *
+ * @param rk  The expanded encryption key.
+ * @param Nr  The number of rounds for @p rk.
+ * @return @c 1 if @p rk has been converted for aes_hw_encrypt(),
+ *         @c 0 if the portable implementation must be used.
+ */
+int aes_hw_setup(aes_u32 rk[/*4*(Nr + 1)*/], int Nr);
+
+/**
+ * Encrypts the block @p pt into @p ct using a key schedule that has
+ * been converted by aes_hw_setup().
+ */
+void aes_hw_encrypt(const aes_u32 rk[/*4*(Nr + 1)*/], int Nr,
+		    const aes_u8 pt[16], aes_u8 ct[16]);
+
+/**
+ * Encrypts @p n independent blocks from @p in to @p out. The blocks
+ * are processed in interleaved groups to keep several AES pipelines
+ * of the CPU busy at the same time. CPUs with VAES and AVX-512
+ * encrypt four blocks with each instruction.
+ */
+void aes_hw_encrypt_blocks(const aes_u32 rk[/*4*(Nr + 1)*/], int Nr,
+			   const aes_u8 *in, aes_u8 *out, size_t n);
+
+/**
+ * Encrypts @p n independent blocks from @p in to @p out, the block
+ * @p in + 16 * i with the key schedule @p rk[i]. All key schedules
+ * must have been converted by aes_hw_setup() and use @p Nr rounds.
+ * This interleaves the blocks of different keys like
+ * aes_hw_encrypt_blocks() does for a single key.
+ */
+void aes_hw_encrypt_multi(const aes_u32 *rk[], int Nr,
+			  const aes_u8 *in, aes_u8 *out, size_t n);
+
+#endif /* _AES_HW_H_ */
@@ -0,0 +1,240 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2011, 2012, 2013, 2014, 2015 Olaf Bergmann (TZI) and others.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v. 1.0 which accompanies this distribution.
+ *
+ * The Eclipse Public License is available at http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Olaf Bergmann  - initial API and implementation
+ *
+ *******************************************************************************/
+
+/**
+ * @file ghash_hw.c
+ * @brief GHASH using PCLMULQDQ or ARMv8 PMULL
+ */
+
+#include "ghash_hw.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GHASH_HW_X86 1
+#include <immintrin.h>
+#define GHASH_HW_TARGET __attribute__((target("sse2,ssse3,pclmul")))
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__linux__)
+#define GHASH_HW_ARM 1
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#include <arm_neon.h>
+#ifdef __clang__
+#define GHASH_HW_TARGET __attribute__((target("crypto")))
+#else
+#define GHASH_HW_TARGET __attribute__((target("+crypto")))
+#endif
+#endif
+
+#if defined(GHASH_HW_X86) || defined(GHASH_HW_ARM)
+
+/* The result of the CPU check: -1 if not done yet, 1 if carry-less
+ * multiplication can be used, 0 otherwise. */
+static int ghash_hw = -1;
+
+int
+ghash_hw_available(void) {
+  if (ghash_hw < 0) {
+#ifdef GHASH_HW_X86
+    __builtin_cpu_init();
+    ghash_hw = (__builtin_cpu_supports("pclmul")
+		&& __builtin_cpu_supports("ssse3")) ? 1 : 0;
+#else
+    ghash_hw = (getauxval(AT_HWCAP) & HWCAP_PMULL) ? 1 : 0;
+#endif
+  }
+  return ghash_hw;
+}
+
+#ifdef GHASH_HW_X86
+/* The bits of GCM are reflected, so the blocks are byte-swapped and
+ * the products are shifted by one bit before they are reduced modulo
+ * x^128 + x^7 + x^2 + x + 1, see the Intel white paper "Intel
+ * Carry-Less Multiplication Instruction and its Usage for Computing
+ * the GCM Mode", algorithms 1 and 5. */
+
+static GHASH_HW_TARGET inline __m128i
+ghash_load(const unsigned char *p) {
+  const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+				     8, 9, 10, 11, 12, 13, 14, 15);
+  return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p), bswap);
+}
+
+/* Adds the 256-bit product of @p a and @p b to @p lo, @p mid and
+ * @p hi, where @p mid overlaps the other two halves by 64 bits. */
+static GHASH_HW_TARGET inline void
+ghash_clmul(__m128i a, __m128i b, __m128i *lo, __m128i *mid, __m128i *hi) {
+  *lo = _mm_xor_si128(*lo, _mm_clmulepi64_si128(a, b, 0x00));
+  *hi = _mm_xor_si128(*hi, _mm_clmulepi64_si128(a, b, 0x11));
+  *mid = _mm_xor_si128(*mid,
+		       _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x10),
+				     _mm_clmulepi64_si128(a, b, 0x01)));
+}
+
+static GHASH_HW_TARGET inline __m128i
+ghash_reduce(__m128i lo, __m128i mid, __m128i hi) {
+  __m128i t1, t2, t3;
+
+  lo = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+  hi = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+
+  /* shift the 256-bit product left by one bit */
+  t1 = _mm_srli_epi32(lo, 31);
+  t2 = _mm_srli_epi32(hi, 31);
+  lo = _mm_slli_epi32(lo, 1);
+  hi = _mm_slli_epi32(hi, 1);
+  t3 = _mm_srli_si128(t1, 12);
+  t2 = _mm_slli_si128(t2, 4);
+  t1 = _mm_slli_si128(t1, 4);
+  lo = _mm_or_si128(lo, t1);
+  hi = _mm_or_si128(hi, t2);
+  hi = _mm_or_si128(hi, t3);
+
+  /* first phase of the reduction */
+  t1 = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(lo, 31),
+				   _mm_slli_epi32(lo, 30)),
+		     _mm_slli_epi32(lo, 25));
+  t2 = _mm_srli_si128(t1, 4);
+  lo = _mm_xor_si128(lo, _mm_slli_si128(t1, 12));
+
+  /* second phase */
+  t1 = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi32(lo, 1),
+				   _mm_srli_epi32(lo, 2)),
+		     _mm_srli_epi32(lo, 7));
+  t1 = _mm_xor_si128(t1, t2);
+  lo = _mm_xor_si128(lo, t1);
+  return _mm_xor_si128(hi, lo);
+}
+
+GHASH_HW_TARGET void
+ghash_hw_update(const unsigned char hpow[4][16], unsigned char x[16],
+		const unsigned char *in, size_t n) {
+  const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+				     8, 9, 10, 11, 12, 13, 14, 15);
+  __m128i h1 = ghash_load(hpow[0]), h2 = ghash_load(hpow[1]);
+  __m128i h3 = ghash_load(hpow[2]), h4 = ghash_load(hpow[3]);
+  __m128i acc = ghash_load(x), lo, mid, hi;
+
+  /* (((X + B0) H + B1) H + B2) H + B3) H
+   *   = (X + B0) H^4 + B1 H^3 + B2 H^2 + B3 H */
+  for (; n >= 4; n -= 4, in += 64) {
+    lo = mid = hi = _mm_setzero_si128();
+    ghash_clmul(_mm_xor_si128(acc, ghash_load(in)), h4, &lo, &mid, &hi);
+    ghash_clmul(ghash_load(in + 16), h3, &lo, &mid, &hi);
+    ghash_clmul(ghash_load(in + 32), h2, &lo, &mid, &hi);
+    ghash_clmul(ghash_load(in + 48), h1, &lo, &mid, &hi);
+    acc = ghash_reduce(lo, mid, hi);
+  }
+
+  for (; n; n--, in += 16) {
+    lo = mid = hi = _mm_setzero_si128();
+    ghash_clmul(_mm_xor_si128(acc, ghash_load(in)), h1, &lo, &mid, &hi);
+    acc = ghash_reduce(lo, mid, hi);
+  }
+
+  _mm_storeu_si128((__m128i *)x, _mm_shuffle_epi8(acc, bswap));
+}
+#else /* GHASH_HW_ARM */
+/* Reversing the bits of each byte turns a GCM block into a plain
+ * polynomial with coefficient i in bit i of the little-endian 128-bit
+ * value, so the products can be reduced modulo x^128 + x^7 + x^2 +
+ * x + 1 by multiplying the upper half with 0x87. */
+
+static GHASH_HW_TARGET inline uint64x2_t
+ghash_load(const unsigned char *p) {
+  return vreinterpretq_u64_u8(vrbitq_u8(vld1q_u8(p)));
+}
+
+static GHASH_HW_TARGET inline uint64x2_t
+ghash_pmull(uint64_t a, uint64_t b) {
+  return vreinterpretq_u64_p128(vmull_p64((poly64_t)a, (poly64_t)b));
+}
+
+/* Adds the 256-bit product of @p a and @p b to @p lo, @p mid and
+ * @p hi, where @p mid overlaps the other two halves by 64 bits. */
+static GHASH_HW_TARGET inline void
+ghash_clmul(uint64x2_t a, uint64x2_t b,
+	    uint64x2_t *lo, uint64x2_t *mid, uint64x2_t *hi) {
+  uint64_t a0 = vgetq_lane_u64(a, 0), a1 = vgetq_lane_u64(a, 1);
+  uint64_t b0 = vgetq_lane_u64(b, 0), b1 = vgetq_lane_u64(b, 1);
+
+  *lo = veorq_u64(*lo, ghash_pmull(a0, b0));
+  *hi = veorq_u64(*hi, ghash_pmull(a1, b1));
+  *mid = veorq_u64(*mid, veorq_u64(ghash_pmull(a0, b1),
+				   ghash_pmull(a1, b0)));
+}
+
+static GHASH_HW_TARGET inline uint64x2_t
+ghash_reduce(uint64x2_t lo, uint64x2_t mid, uint64x2_t hi) {
+  const uint64x2_t zero = vdupq_n_u64(0);
+  uint64x2_t t;
+
+  lo = veorq_u64(lo, vextq_u64(zero, mid, 1));
+  hi = veorq_u64(hi, vextq_u64(mid, zero, 1));
+
+  /* x^192 is x^64 (x^7 + x^2 + x + 1), the carry lands in the lower
+   * half of hi again */
+  t = ghash_pmull(vgetq_lane_u64(hi, 1), 0x87);
+  lo = veorq_u64(lo, vextq_u64(zero, t, 1));
+  hi = veorq_u64(hi, vextq_u64(t, zero, 1));
+
+  t = ghash_pmull(vgetq_lane_u64(hi, 0), 0x87);
+  return veorq_u64(lo, t);
+}
+
+GHASH_HW_TARGET void
+ghash_hw_update(const unsigned char hpow[4][16], unsigned char x[16],
+		const unsigned char *in, size_t n) {
+  uint64x2_t h1 = ghash_load(hpow[0]), h2 = ghash_load(hpow[1]);
+  uint64x2_t h3 = ghash_load(hpow[2]), h4 = ghash_load(hpow[3]);
+  uint64x2_t acc = ghash_load(x), lo, mid, hi;
+
+  /* (((X + B0) H + B1) H + B2) H + B3) H
+   *   = (X + B0) H^4 + B1 H^3 + B2 H^2 + B3 H */
+  for (; n >= 4; n -= 4, in += 64) {
+    lo = mid = hi = vdupq_n_u64(0);
+    ghash_clmul(veorq_u64(acc, ghash_load(in)), h4, &lo, &mid, &hi);
+    ghash_clmul(ghash_load(in + 16), h3, &lo, &mid, &hi);
+    ghash_clmul(ghash_load(in + 32), h2, &lo, &mid, &hi);
+    ghash_clmul(ghash_load(in + 48), h1, &lo, &mid, &hi);
+    acc = ghash_reduce(lo, mid, hi);
+  }
+
+  for (; n; n--, in += 16) {
+    lo = mid = hi = vdupq_n_u64(0);
+    ghash_clmul(veorq_u64(acc, ghash_load(in)), h1, &lo, &mid, &hi);
+    acc = ghash_reduce(lo, mid, hi);
+  }
+
+  vst1q_u8(x, vrbitq_u8(vreinterpretq_u8_u64(acc)));
+}
+#endif /* GHASH_HW_X86 */
+
+#else /* no carry-less multiplication for this platform */
+
+int
+ghash_hw_available(void) {
+  return 0;
+}
+
+void
+ghash_hw_update(const unsigned char hpow[4][16], unsigned char x[16],
+		const unsigned char *in, size_t n) {
+  (void)hpow;
+  (void)x;
+  (void)in;
+  (void)n;
+}
+
+#endif /* GHASH_HW_X86 || GHASH_HW_ARM */
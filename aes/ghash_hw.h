@@ -0,0 +1,53 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2011, 2012, 2013, 2014, 2015 Olaf Bergmann (TZI) and others.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v. 1.0 which accompanies this distribution.
+ *
+ * The Eclipse Public License is available at http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Olaf Bergmann  - initial API and implementation
+ *
+ *******************************************************************************/
+
+/**
+ * @file ghash_hw.h
+ * @brief GHASH using carry-less multiplication instructions
+ *
+ * This backend is used by gcm.c when the library is built with
+ * WITH_AES_HW and the CPU provides PCLMULQDQ (x86) or PMULL from the
+ * ARMv8 Cryptography Extensions (aarch64). Availability is detected
+ * at runtime, the table-driven multiplication of gcm.c remains the
+ * fallback otherwise.
+ */
+
+#ifndef _GHASH_HW_H_
+#define _GHASH_HW_H_
+
+#include <stddef.h>
+
+/**
+ * Checks if the CPU supports carry-less multiplication.
+ *
+ * @return @c 1 if ghash_hw_update() can be used, @c 0 otherwise.
+ */
+int ghash_hw_available(void);
+
+/**
+ * Adds the @p n blocks at @p in to the GHASH state @p x, i.e. sets
+ * @p x to (@p x ^ @p in[i]) * H for each block. Four blocks at a time
+ * are multiplied by the powers of H and reduced once.
+ *
+ * @param hpow  H, H^2, H^3 and H^4 in the byte order of GCM.
+ * @param x     The GHASH state.
+ * @param in    The input blocks.
+ * @param n     The number of blocks at @p in.
+ */
+void ghash_hw_update(const unsigned char hpow[4][16], unsigned char x[16],
+		     const unsigned char *in, size_t n);
+
+#endif /* _GHASH_HW_H_ */
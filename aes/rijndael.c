@@ -30,6 +30,9 @@
 /* #include <sys/systm.h> */
 
 #include "rijndael.h"
+#ifdef WITH_AES_HW
+#include "aes_hw.h"
+#endif
 
 #undef FULL_UNROLL
 
@@ -1243,6 +1246,9 @@ rijndael_set_key_enc_only(rijndael_ctx *ctx, const u_char *key, int bits)
 #ifdef WITH_AES_DECRYPT
 	ctx->enc_only = 1;
 #endif
+#ifdef WITH_AES_HW
+	ctx->hw = aes_hw_setup(ctx->ek, rounds);
+#endif
 
 	return 0;
 }
@@ -1262,6 +1268,9 @@ rijndael_set_key(rijndael_ctx *ctx, const u_char *key, int bits)
 
 	ctx->Nr = rounds;
 	ctx->enc_only = 0;
+#ifdef WITH_AES_HW
+	ctx->hw = aes_hw_setup(ctx->ek, rounds);
+#endif
 
 	return 0;
 }
@@ -1276,5 +1285,65 @@ rijndael_decrypt(rijndael_ctx *ctx, const u_char *src, u_char *dst)
 void
 rijndael_encrypt(rijndael_ctx *ctx, const u_char *src, u_char *dst)
 {
+#ifdef WITH_AES_HW
+	if (ctx->hw) {
+		aes_hw_encrypt(ctx->ek, ctx->Nr, src, dst);
+		return;
+	}
+#endif
 	rijndaelEncrypt(ctx->ek, ctx->Nr, src, dst);
 }
+
+/* encrypt n independent blocks, e.g. the CTR and CBC-MAC inputs of CCM */
+void
+rijndael_encrypt_blocks(rijndael_ctx *ctx, const u_char *src, u_char *dst,
+    size_t n)
+{
+#ifdef WITH_AES_HW
+	if (ctx->hw) {
+		aes_hw_encrypt_blocks(ctx->ek, ctx->Nr, src, dst, n);
+		return;
+	}
+#endif
+	for (; n; n--, src += 16, dst += 16)
+		rijndaelEncrypt(ctx->ek, ctx->Nr, src, dst);
+}
+
+/* encrypt n independent blocks, block i with ctx[i], e.g. the CBC-MAC
+ * inputs of CCM records for different peers */
+void
+rijndael_encrypt_multi(rijndael_ctx *ctx[], const u_char *src, u_char *dst,
+    size_t n)
+{
+#ifdef WITH_AES_HW
+	const aes_u32 *rk[16];
+	size_t k;
+#endif
+	size_t i;
+
+	if (!n)
+		return;
+	for (i = 1; i < n && ctx[i] == ctx[0]; i++)
+		;
+	if (i == n) {
+		rijndael_encrypt_blocks(ctx[0], src, dst, n);
+		return;
+	}
+
+#ifdef WITH_AES_HW
+	for (; n; n -= k, src += 16 * k, dst += 16 * k, ctx += k) {
+		for (k = 0; k < n && k < 16 && ctx[k]->hw &&
+		    ctx[k]->Nr == ctx[0]->Nr; k++)
+			rk[k] = ctx[k]->ek;
+		if (k) {
+			aes_hw_encrypt_multi(rk, ctx[0]->Nr, src, dst, k);
+		} else {
+			rijndaelEncrypt(ctx[0]->ek, ctx[0]->Nr, src, dst);
+			k = 1;
+		}
+	}
+#else
+	for (i = 0; i < n; i++, src += 16, dst += 16)
+		rijndaelEncrypt(ctx[i]->ek, ctx[i]->Nr, src, dst);
+#endif
+}
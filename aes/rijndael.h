@@ -28,6 +28,7 @@
 #ifndef __RIJNDAEL_H
 #define __RIJNDAEL_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define AES_MAXKEYBITS	(256)
@@ -48,6 +49,9 @@ typedef struct {
 	int	enc_only;		/* context contains only encrypt schedule */
 #endif
 	int	Nr;			/* key-length-dependent number of rounds */
+#ifdef WITH_AES_HW
+	int	hw;			/* ek is laid out for aes_hw_encrypt() */
+#endif
 	aes_u32	ek[4*(AES_MAXROUNDS + 1)];	/* encrypt key schedule */
 #ifdef WITH_AES_DECRYPT
 	aes_u32	dk[4*(AES_MAXROUNDS + 1)];	/* decrypt key schedule */
@@ -58,6 +62,10 @@ int	 rijndael_set_key(rijndael_ctx *, const u_char *, int);
 int	 rijndael_set_key_enc_only(rijndael_ctx *, const u_char *, int);
 void	 rijndael_decrypt(rijndael_ctx *, const u_char *, u_char *);
 void	 rijndael_encrypt(rijndael_ctx *, const u_char *, u_char *);
+void	 rijndael_encrypt_blocks(rijndael_ctx *, const u_char *, u_char *,
+	    size_t);
+void	 rijndael_encrypt_multi(rijndael_ctx *[], const u_char *, u_char *,
+	    size_t);
 
 int	rijndaelKeySetupEnc(aes_u32 rk[/*4*(Nr + 1)*/], const aes_u8 cipherKey[], int keyBits);
 int	rijndaelKeySetupDec(aes_u32 rk[/*4*(Nr + 1)*/], const aes_u8 cipherKey[], int keyBits);
@@ -65,11 +65,11 @@ block0(size_t M,       /* number of auth bytes */
  * \param ctx  The crypto context for the AES encryption.
  * \param msg  The message starting with the additional authentication data.
  * \param la   The number of additional authentication bytes in \p msg.
- * \param B    The input buffer for crypto operations. When this function
- *             is called, \p B must be initialized with \c B0 (the first
- *             authentication block.
+ * \param B    The input buffer for crypto operations.
  * \param X    The output buffer where the result of the CBC calculation
- *             is placed.
+ *             is placed. When this function is called, \p X must
+ *             contain the encrypted \c B0 (the first authentication
+ *             block).
  * \return     The result is written to \p X.
  */
 static void
@@ -78,8 +78,6 @@ add_auth_data(rijndael_ctx *ctx, const unsigned char *msg, size_t la,
 	      unsigned char X[DTLS_CCM_BLOCKSIZE]) {
   size_t i,j; 
 
-  rijndael_encrypt(ctx, B, X);
-
   memset(B, 0, DTLS_CCM_BLOCKSIZE);
 
   if (!la)
@@ -121,8 +119,9 @@ add_auth_data(rijndael_ctx *ctx, const unsigned char *msg, size_t la,
   rijndael_encrypt(ctx, B, X);
   
   while (la > DTLS_CCM_BLOCKSIZE) {
-    for (i = 0; i < DTLS_CCM_BLOCKSIZE; ++i)
-      B[i] = X[i] ^ *msg++;
+    memcpy(B, X, DTLS_CCM_BLOCKSIZE);
+    memxor(B, msg, DTLS_CCM_BLOCKSIZE);
+    msg += DTLS_CCM_BLOCKSIZE;
     la -= DTLS_CCM_BLOCKSIZE;
 
     rijndael_encrypt(ctx, B, X);
@@ -137,31 +136,34 @@ add_auth_data(rijndael_ctx *ctx, const unsigned char *msg, size_t la,
   } 
 }
 
+/* The CBC-MAC is a chain where each AES call depends on the previous
+ * one, while the CTR keystream blocks are independent. Both loops
+ * below therefore hand one block of each kind to a single
+ * rijndael_encrypt_blocks() call, so that the keystream is computed
+ * in the shadow of the MAC chain. The two blocks are kept next to
+ * each other in the arrays in[] and out[]. */
+#define CCM_B(in) (in)				     /**< CBC-MAC input B_i */
+#define CCM_A(in) ((in) + DTLS_CCM_BLOCKSIZE)	     /**< CTR input A_i */
+#define CCM_X(out) (out)			     /**< CBC-MAC state X_i */
+#define CCM_S(out) ((out) + DTLS_CCM_BLOCKSIZE)	     /**< keystream S_i */
+
+/* Increments the L-byte big-endian counter at the end of block A. */
 static inline void
-encrypt(rijndael_ctx *ctx, size_t L, unsigned long counter,
-	unsigned char *msg, size_t len,
-	unsigned char A[DTLS_CCM_BLOCKSIZE],
-	unsigned char S[DTLS_CCM_BLOCKSIZE]) {
+inc_counter(unsigned char A[DTLS_CCM_BLOCKSIZE], size_t L) {
+  size_t i = DTLS_CCM_BLOCKSIZE;
 
-  static unsigned long counter_tmp;
-
-  SET_COUNTER(A, L, counter, counter_tmp);    
-  rijndael_encrypt(ctx, A, S);
-  memxor(msg, S, len);
+  while (L-- && ++A[--i] == 0)
+    ;
 }
 
+/* Sets B to X ^ msg for the first len bytes of msg and to X for the
+ * remaining bytes of the block, i.e. msg is padded with zeroes. */
 static inline void
-mac(rijndael_ctx *ctx, 
-    unsigned char *msg, size_t len,
-    unsigned char B[DTLS_CCM_BLOCKSIZE],
-    unsigned char X[DTLS_CCM_BLOCKSIZE]) {
-  size_t i;
-
-  for (i = 0; i < len; ++i)
-    B[i] = X[i] ^ msg[i];
-
-  rijndael_encrypt(ctx, B, X);
-
+mac_input(const unsigned char *msg, size_t len,
+	  unsigned char B[DTLS_CCM_BLOCKSIZE],
+	  const unsigned char X[DTLS_CCM_BLOCKSIZE]) {
+  memcpy(B, X, DTLS_CCM_BLOCKSIZE);
+  memxor(B, msg, len);
 }
 
 long int
@@ -169,61 +171,48 @@ dtls_ccm_encrypt_message(rijndael_ctx *ctx, size_t M, size_t L,
 			 unsigned char nonce[DTLS_CCM_BLOCKSIZE], 
 			 unsigned char *msg, size_t lm, 
 			 const unsigned char *aad, size_t la) {
-  size_t i, len;
+  size_t len, n;
   unsigned long counter_tmp;
-  unsigned long counter = 1; /* \bug does not work correctly on ia32 when
-			             lm >= 2^16 */
-  unsigned char A[DTLS_CCM_BLOCKSIZE]; /* A_i blocks for encryption input */
-  unsigned char B[DTLS_CCM_BLOCKSIZE]; /* B_i blocks for CBC-MAC input */
-  unsigned char S[DTLS_CCM_BLOCKSIZE]; /* S_i = encrypted A_i blocks */
-  unsigned char X[DTLS_CCM_BLOCKSIZE]; /* X_i = encrypted B_i blocks */
+  unsigned char in[2 * DTLS_CCM_BLOCKSIZE];  /* B_i and A_i */
+  unsigned char out[2 * DTLS_CCM_BLOCKSIZE]; /* X_i and S_i */
+  unsigned char S0[DTLS_CCM_BLOCKSIZE];	     /* S_0 to encrypt the MAC */
 
   len = lm;			/* save original length */
-  /* create the initial authentication block B0 */
-  block0(M, L, la, lm, nonce, B);
-  add_auth_data(ctx, aad, la, B, X);
 
   /* initialize block template */
-  A[0] = L-1;
+  CCM_A(in)[0] = L-1;
 
   /* copy the nonce */
-  memcpy(A + 1, nonce, DTLS_CCM_BLOCKSIZE - L - 1);
-  
-  while (lm >= DTLS_CCM_BLOCKSIZE) {
-    /* calculate MAC */
-    mac(ctx, msg, DTLS_CCM_BLOCKSIZE, B, X);
+  memcpy(CCM_A(in) + 1, nonce, DTLS_CCM_BLOCKSIZE - L - 1);
 
-    /* encrypt */
-    encrypt(ctx, L, counter, msg, DTLS_CCM_BLOCKSIZE, A, S);
+  /* create the initial authentication block B0 and calculate S_0
+   * along with it */
+  block0(M, L, la, lm, nonce, CCM_B(in));
+  SET_COUNTER(CCM_A(in), L, 0, counter_tmp);
+  rijndael_encrypt_blocks(ctx, in, out, 2);
+  memcpy(S0, CCM_S(out), DTLS_CCM_BLOCKSIZE);
 
-    /* update local pointers */
-    lm -= DTLS_CCM_BLOCKSIZE;
-    msg += DTLS_CCM_BLOCKSIZE;
-    counter++;
-  }
+  add_auth_data(ctx, aad, la, CCM_B(in), CCM_X(out));
 
-  if (lm) {
-    /* Calculate MAC. The remainder of B must be padded with zeroes, so
-     * B is constructed to contain X ^ msg for the first lm bytes (done in
-     * mac() and X ^ 0 for the remaining DTLS_CCM_BLOCKSIZE - lm bytes
-     * (i.e., we can use memcpy() here).
-     */
-    memcpy(B + lm, X + lm, DTLS_CCM_BLOCKSIZE - lm);
-    mac(ctx, msg, lm, B, X);
+  while (lm) {
+    n = min(lm, DTLS_CCM_BLOCKSIZE);
+
+    /* B_i is known from the plaintext, so X_i and S_i are
+     * calculated in one go */
+    mac_input(msg, n, CCM_B(in), CCM_X(out));
+    inc_counter(CCM_A(in), L);
+    rijndael_encrypt_blocks(ctx, in, out, 2);
 
     /* encrypt */
-    encrypt(ctx, L, counter, msg, lm, A, S);
+    memxor(msg, CCM_S(out), n);
 
     /* update local pointers */
-    msg += lm;
+    lm -= n;
+    msg += n;
   }
-  
-  /* calculate S_0 */  
-  SET_COUNTER(A, L, 0, counter_tmp);
-  rijndael_encrypt(ctx, A, S);
 
-  for (i = 0; i < M; ++i)
-    *msg++ = X[i] ^ S[i];
+  memcpy(msg, CCM_X(out), M);
+  memxor(msg, S0, M);
 
   return len + M;
 }
@@ -234,14 +223,11 @@ dtls_ccm_decrypt_message(rijndael_ctx *ctx, size_t M, size_t L,
 			 unsigned char *msg, size_t lm, 
 			 const unsigned char *aad, size_t la) {
   
-  size_t len;
+  size_t len, n;
   unsigned long counter_tmp;
-  unsigned long counter = 1; /* \bug does not work correctly on ia32 when
-			             lm >= 2^16 */
-  unsigned char A[DTLS_CCM_BLOCKSIZE]; /* A_i blocks for encryption input */
-  unsigned char B[DTLS_CCM_BLOCKSIZE]; /* B_i blocks for CBC-MAC input */
-  unsigned char S[DTLS_CCM_BLOCKSIZE]; /* S_i = encrypted A_i blocks */
-  unsigned char X[DTLS_CCM_BLOCKSIZE]; /* X_i = encrypted B_i blocks */
+  unsigned char in[2 * DTLS_CCM_BLOCKSIZE];  /* B_i and A_i */
+  unsigned char out[2 * DTLS_CCM_BLOCKSIZE]; /* X_i and S_i */
+  unsigned char S0[DTLS_CCM_BLOCKSIZE];	     /* S_0 to decrypt the MAC */
 
   if (lm < M)
     goto error;
@@ -249,55 +235,268 @@ dtls_ccm_decrypt_message(rijndael_ctx *ctx, size_t M, size_t L,
   len = lm;	      /* save original length */
   lm -= M;	      /* detract MAC size*/
 
-  /* create the initial authentication block B0 */
-  block0(M, L, la, lm, nonce, B);
-  add_auth_data(ctx, aad, la, B, X);
-
   /* initialize block template */
-  A[0] = L-1;
+  CCM_A(in)[0] = L-1;
 
   /* copy the nonce */
-  memcpy(A + 1, nonce, DTLS_CCM_BLOCKSIZE - L - 1);
-  
-  while (lm >= DTLS_CCM_BLOCKSIZE) {
-    /* decrypt */
-    encrypt(ctx, L, counter, msg, DTLS_CCM_BLOCKSIZE, A, S);
-    
-    /* calculate MAC */
-    mac(ctx, msg, DTLS_CCM_BLOCKSIZE, B, X);
+  memcpy(CCM_A(in) + 1, nonce, DTLS_CCM_BLOCKSIZE - L - 1);
 
-    /* update local pointers */
-    lm -= DTLS_CCM_BLOCKSIZE;
-    msg += DTLS_CCM_BLOCKSIZE;
-    counter++;
-  }
+  /* create the initial authentication block B0 and calculate S_0
+   * along with it */
+  block0(M, L, la, lm, nonce, CCM_B(in));
+  SET_COUNTER(CCM_A(in), L, 0, counter_tmp);
+  rijndael_encrypt_blocks(ctx, in, out, 2);
+  memcpy(S0, CCM_S(out), DTLS_CCM_BLOCKSIZE);
+
+  add_auth_data(ctx, aad, la, CCM_B(in), CCM_X(out));
 
+  /* B_i needs the plaintext of block i, so S_i is calculated one
+   * block ahead of the MAC */
   if (lm) {
+    inc_counter(CCM_A(in), L);
+    rijndael_encrypt(ctx, CCM_A(in), CCM_S(out));
+  }
+
+  while (lm) {
+    n = min(lm, DTLS_CCM_BLOCKSIZE);
+
     /* decrypt */
-    encrypt(ctx, L, counter, msg, lm, A, S);
+    memxor(msg, CCM_S(out), n);
 
-    /* Calculate MAC. Note that msg ends in the MAC so we must
-     * construct B to contain X ^ msg for the first lm bytes (done in
-     * mac() and X ^ 0 for the remaining DTLS_CCM_BLOCKSIZE - lm bytes
-     * (i.e., we can use memcpy() here).
-     */
-    memcpy(B + lm, X + lm, DTLS_CCM_BLOCKSIZE - lm);
-    mac(ctx, msg, lm, B, X); 
+    /* calculate MAC and the next keystream block */
+    mac_input(msg, n, CCM_B(in), CCM_X(out));
+    if (lm > n) {
+      inc_counter(CCM_A(in), L);
+      rijndael_encrypt_blocks(ctx, in, out, 2);
+    } else {
+      rijndael_encrypt(ctx, CCM_B(in), CCM_X(out));
+    }
 
     /* update local pointers */
-    msg += lm;
+    lm -= n;
+    msg += n;
   }
-  
-  /* calculate S_0 */  
-  SET_COUNTER(A, L, 0, counter_tmp);
-  rijndael_encrypt(ctx, A, S);
 
-  memxor(msg, S, M);
+  memxor(msg, S0, M);
 
   /* return length if MAC is valid, otherwise continue with error handling */
-  if (equals(X, msg, M))
+  if (equals(CCM_X(out), msg, M))
     return len - M;
   
  error:
   return -1;
 }
+
+/* Number of keystream blocks that are computed at once for
+ * dtls_ccm_encrypt_messages() and dtls_ccm_decrypt_messages(). */
+#define CCM_CTR_BLOCKS 16
+
+/* The CBC-MAC input of a record in ccm_mac_records(). */
+struct ccm_lane {
+  const unsigned char *aad;	/* remaining additional data */
+  size_t la;
+  const unsigned char *msg;	/* remaining cleartext */
+  size_t lm;
+  int prefix;			/* l(a) must still be encoded */
+};
+
+/* Sets B to the next CBC-MAC input block of lane xor X. Returns 0 if
+ * the lane has no more input. This produces the same blocks as
+ * add_auth_data() for la < 0xFF00 followed by the cleartext. */
+static int
+ccm_next_block(struct ccm_lane *lane, unsigned char B[DTLS_CCM_BLOCKSIZE],
+	       const unsigned char X[DTLS_CCM_BLOCKSIZE]) {
+  size_t j = 0, n;
+
+  memset(B, 0, DTLS_CCM_BLOCKSIZE);
+  if (lane->la) {
+    if (lane->prefix) {
+      dtls_int_to_uint16(B, lane->la);
+      lane->prefix = 0;
+      j = 2;
+    }
+    n = min(DTLS_CCM_BLOCKSIZE - j, lane->la);
+    memcpy(B + j, lane->aad, n);
+    lane->aad += n;
+    lane->la -= n;
+  } else if (lane->lm) {
+    n = min(DTLS_CCM_BLOCKSIZE, lane->lm);
+    memcpy(B, lane->msg, n);
+    lane->msg += n;
+    lane->lm -= n;
+  } else {
+    return 0;
+  }
+
+  memxor(B, X, DTLS_CCM_BLOCKSIZE);
+  return 1;
+}
+
+/* Calculates the CBC-MAC X[i] over the first rec[i]->lm - tail bytes
+ * of the cleartext in rec[i]->msg for n <= DTLS_CCM_LANES records.
+ * Each step encrypts the next block of all records that have input
+ * left with one rijndael_encrypt_multi() call. */
+static void
+ccm_mac_records(size_t M, size_t L, dtls_ccm_record_t *rec[], size_t n,
+		size_t tail, unsigned char X[][DTLS_CCM_BLOCKSIZE]) {
+  struct ccm_lane lane[DTLS_CCM_LANES];
+  rijndael_ctx *ctx[DTLS_CCM_LANES];
+  unsigned char B[DTLS_CCM_LANES][DTLS_CCM_BLOCKSIZE];
+  unsigned char Y[DTLS_CCM_LANES][DTLS_CCM_BLOCKSIZE];
+  size_t active[DTLS_CCM_LANES];
+  size_t i, k;
+
+  for (i = 0; i < n; i++) {
+    lane[i].aad = rec[i]->aad;
+    lane[i].la = rec[i]->la;
+    lane[i].msg = rec[i]->msg;
+    lane[i].lm = rec[i]->lm - tail;
+    lane[i].prefix = 1;
+    block0(M, L, lane[i].la, lane[i].lm, rec[i]->nonce, B[i]);
+    ctx[i] = rec[i]->ctx;
+  }
+  rijndael_encrypt_multi(ctx, B[0], X[0], n);
+
+  for (;;) {
+    for (i = k = 0; i < n; i++) {
+      if (ccm_next_block(&lane[i], B[k], X[i])) {
+	ctx[k] = rec[i]->ctx;
+	active[k++] = i;
+      }
+    }
+    if (!k)
+      break;
+
+    rijndael_encrypt_multi(ctx, B[0], Y[0], k);
+    for (i = 0; i < k; i++)
+      memcpy(X[active[i]], Y[i], DTLS_CCM_BLOCKSIZE);
+  }
+}
+
+/* Keystream blocks A_i of several records that wait for encryption,
+ * and where S_i has to be applied to. */
+struct ccm_ctr {
+  rijndael_ctx *ctx[CCM_CTR_BLOCKS];
+  unsigned char A[CCM_CTR_BLOCKS][DTLS_CCM_BLOCKSIZE];
+  unsigned char S[CCM_CTR_BLOCKS][DTLS_CCM_BLOCKSIZE];
+  unsigned char *dst[CCM_CTR_BLOCKS];
+  size_t len[CCM_CTR_BLOCKS];
+  size_t n;
+};
+
+static void
+ccm_ctr_flush(struct ccm_ctr *ctr) {
+  size_t i;
+
+  rijndael_encrypt_multi(ctr->ctx, ctr->A[0], ctr->S[0], ctr->n);
+  for (i = 0; i < ctr->n; i++)
+    memxor(ctr->dst[i], ctr->S[i], ctr->len[i]);
+  ctr->n = 0;
+}
+
+/* Queues the keystream of rec: S_0 for the M bytes at msg + lm, and
+ * S_1, S_2, ... for the lm bytes of msg. The blocks of a record are
+ * kept together if possible, so that long records are encrypted with
+ * the single key path of rijndael_encrypt_multi(). */
+static void
+ccm_ctr_record(struct ccm_ctr *ctr, size_t M, size_t L,
+	       dtls_ccm_record_t *rec, size_t lm) {
+  unsigned char A[DTLS_CCM_BLOCKSIZE];
+  size_t blocks = 1 + (lm + DTLS_CCM_BLOCKSIZE - 1) / DTLS_CCM_BLOCKSIZE;
+  size_t i;
+
+  A[0] = L-1;
+  memcpy(A + 1, rec->nonce, DTLS_CCM_BLOCKSIZE - L - 1);
+  memset(A + DTLS_CCM_BLOCKSIZE - L, 0, L);
+
+  if (ctr->n + blocks > CCM_CTR_BLOCKS && ctr->n)
+    ccm_ctr_flush(ctr);
+
+  for (i = 0; i < blocks; i++) {
+    if (ctr->n == CCM_CTR_BLOCKS)
+      ccm_ctr_flush(ctr);
+
+    memcpy(ctr->A[ctr->n], A, DTLS_CCM_BLOCKSIZE);
+    ctr->ctx[ctr->n] = rec->ctx;
+    if (i) {
+      ctr->dst[ctr->n] = rec->msg + (i - 1) * DTLS_CCM_BLOCKSIZE;
+      ctr->len[ctr->n] = min(DTLS_CCM_BLOCKSIZE,
+			     lm - (i - 1) * DTLS_CCM_BLOCKSIZE);
+    } else {
+      ctr->dst[ctr->n] = rec->msg + lm;
+      ctr->len[ctr->n] = M;
+    }
+    ctr->n++;
+    inc_counter(A, L);
+  }
+}
+
+void
+dtls_ccm_encrypt_messages(size_t M, size_t L,
+			  dtls_ccm_record_t *records, size_t count) {
+  dtls_ccm_record_t *rec[DTLS_CCM_LANES];
+  unsigned char X[DTLS_CCM_LANES][DTLS_CCM_BLOCKSIZE];
+  struct ccm_ctr ctr;
+  size_t i, n;
+
+  ctr.n = 0;
+  while (count) {
+    for (n = 0; count && n < DTLS_CCM_LANES; records++, count--) {
+      if (records->la >= 0xFF00)
+	records->result =
+	  dtls_ccm_encrypt_message(records->ctx, M, L, records->nonce,
+				   records->msg, records->lm,
+				   records->aad, records->la);
+      else
+	rec[n++] = records;
+    }
+
+    /* the MAC is calculated over the cleartext, so the keystream of
+     * these records is applied afterwards */
+    ccm_mac_records(M, L, rec, n, 0, X);
+    for (i = 0; i < n; i++) {
+      memcpy(rec[i]->msg + rec[i]->lm, X[i], M);
+      ccm_ctr_record(&ctr, M, L, rec[i], rec[i]->lm);
+      rec[i]->result = rec[i]->lm + M;
+    }
+  }
+  ccm_ctr_flush(&ctr);
+}
+
+void
+dtls_ccm_decrypt_messages(size_t M, size_t L,
+			  dtls_ccm_record_t *records, size_t count) {
+  dtls_ccm_record_t *rec[DTLS_CCM_LANES];
+  unsigned char X[DTLS_CCM_LANES][DTLS_CCM_BLOCKSIZE];
+  struct ccm_ctr ctr;
+  size_t i, n;
+
+  ctr.n = 0;
+  while (count) {
+    for (n = 0; count && n < DTLS_CCM_LANES; records++, count--) {
+      if (records->lm < M)
+	records->result = -1;
+      else if (records->la >= 0xFF00)
+	records->result =
+	  dtls_ccm_decrypt_message(records->ctx, M, L, records->nonce,
+				   records->msg, records->lm,
+				   records->aad, records->la);
+      else
+	rec[n++] = records;
+    }
+
+    /* decrypt the message and the MAC first, the MAC is verified on
+     * the cleartext */
+    for (i = 0; i < n; i++)
+      ccm_ctr_record(&ctr, M, L, rec[i], rec[i]->lm - M);
+    ccm_ctr_flush(&ctr);
+
+    ccm_mac_records(M, L, rec, n, M, X);
+    for (i = 0; i < n; i++) {
+      if (equals(X[i], rec[i]->msg + rec[i]->lm - M, M))
+	rec[i]->result = rec[i]->lm - M;
+      else
+	rec[i]->result = -1;
+    }
+  }
+}
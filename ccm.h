@@ -25,6 +25,7 @@
 #define DTLS_CCM_BLOCKSIZE  16	/**< size of hmac blocks */
 #define DTLS_CCM_MAX        16	/**< max number of bytes in digest */
 #define DTLS_CCM_NONCE_SIZE 12	/**< size of nonce */
+#define DTLS_CCM_LANES      8	/**< records per dtls_ccm_encrypt_messages() step */
 
 /** 
  * Authenticates and encrypts a message using AES in CCM mode. Please
@@ -58,4 +59,36 @@ dtls_ccm_decrypt_message(rijndael_ctx *ctx, size_t M, size_t L,
 			 unsigned char *msg, size_t lm, 
 			 const unsigned char *aad, size_t la);
 
+/**
+ * A record for dtls_ccm_encrypt_messages() and
+ * dtls_ccm_decrypt_messages(). The members have the meaning of the
+ * parameters of dtls_ccm_encrypt_message().
+ */
+typedef struct {
+  rijndael_ctx *ctx;		/**< the AES key for this record */
+  unsigned char *nonce;		/**< DTLS_CCM_BLOCKSIZE nonce octets */
+  unsigned char *msg;		/**< the message, modified in place */
+  size_t lm;			/**< the actual length of @p msg */
+  const unsigned char *aad;	/**< the additional authentication data */
+  size_t la;			/**< the length of @p aad */
+  long int result;		/**< set to the result for this record */
+} dtls_ccm_record_t;
+
+/**
+ * Authenticates and encrypts @p count records like
+ * dtls_ccm_encrypt_message(), but advances the CBC-MAC chains of up
+ * to DTLS_CCM_LANES records side by side and computes the keystream
+ * of all records in large batches. The records may use different
+ * keys. The result of each record is stored in its @c result member.
+ */
+void dtls_ccm_encrypt_messages(size_t M, size_t L,
+			       dtls_ccm_record_t *records, size_t count);
+
+/**
+ * Decrypts and verifies @p count records like
+ * dtls_ccm_decrypt_message(), see dtls_ccm_encrypt_messages().
+ */
+void dtls_ccm_decrypt_messages(size_t M, size_t L,
+			       dtls_ccm_record_t *records, size_t count);
+
 #endif /* _DTLS_CCM_H_ */
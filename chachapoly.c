@@ -0,0 +1,462 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2011, 2012, 2013, 2014, 2015 Olaf Bergmann (TZI) and others.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v. 1.0 which accompanies this distribution.
+ *
+ * The Eclipse Public License is available at http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Olaf Bergmann  - initial API and implementation
+ *
+ *******************************************************************************/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "tinydtls.h"
+#include "global.h"
+#include "chachapoly.h"
+
+#define CHACHA_BLOCKSIZE 64
+#define POLY_BLOCKSIZE   16
+
+#if !defined(DTLS_CHACHAPOLY_PORTABLE) && defined(__GNUC__) \
+  && (defined(__SSE2__) || defined(__ARM_NEON))
+/* The vector extension of GCC and clang becomes SSE2 or NEON code,
+ * so that four blocks of keystream are computed side by side. */
+#define CHACHA_LANES 4
+typedef uint32_t chacha_vec_t __attribute__((vector_size(16)));
+#endif
+
+#if !defined(DTLS_CHACHAPOLY_PORTABLE) && defined(__SIZEOF_INT128__)
+/* Poly1305 with three limbs of 44 bits and 128-bit products */
+#define POLY_LIMBS64 1
+#endif
+
+static inline uint32_t
+get32_le(const unsigned char *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8)
+    | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void
+put32_le(unsigned char *p, uint32_t v) {
+  p[0] = (unsigned char)v;
+  p[1] = (unsigned char)(v >> 8);
+  p[2] = (unsigned char)(v >> 16);
+  p[3] = (unsigned char)(v >> 24);
+}
+
+static inline void
+put64_le(unsigned char *p, uint64_t v) {
+  put32_le(p, (uint32_t)v);
+  put32_le(p + 4, (uint32_t)(v >> 32));
+}
+
+/* The rotation and the quarter round are written for both uint32_t
+ * and chacha_vec_t. */
+#define CHACHA_ROTL(V, N) (((V) << (N)) | ((V) >> (32 - (N))))
+
+#define CHACHA_QR(A, B, C, D)				\
+  do {							\
+    A += B; D ^= A; D = CHACHA_ROTL(D, 16);		\
+    C += D; B ^= C; B = CHACHA_ROTL(B, 12);		\
+    A += B; D ^= A; D = CHACHA_ROTL(D, 8);		\
+    C += D; B ^= C; B = CHACHA_ROTL(B, 7);		\
+  } while (0)
+
+#define CHACHA_DOUBLEROUND(X)				\
+  do {							\
+    CHACHA_QR(X[0], X[4], X[8], X[12]);			\
+    CHACHA_QR(X[1], X[5], X[9], X[13]);			\
+    CHACHA_QR(X[2], X[6], X[10], X[14]);		\
+    CHACHA_QR(X[3], X[7], X[11], X[15]);		\
+    CHACHA_QR(X[0], X[5], X[10], X[15]);		\
+    CHACHA_QR(X[1], X[6], X[11], X[12]);		\
+    CHACHA_QR(X[2], X[7], X[8], X[13]);			\
+    CHACHA_QR(X[3], X[4], X[9], X[14]);			\
+  } while (0)
+
+/* Sets up the ChaCha20 state @p s for @p key and @p nonce, the block
+ * counter is set later. */
+static void
+chacha20_init(uint32_t s[16], const unsigned char key[DTLS_CHACHAPOLY_KEY_SIZE],
+	      const unsigned char nonce[DTLS_CHACHAPOLY_NONCE_SIZE]) {
+  int i;
+
+  s[0] = 0x61707865;		/* "expand 32-byte k" */
+  s[1] = 0x3320646e;
+  s[2] = 0x79622d32;
+  s[3] = 0x6b206574;
+  for (i = 0; i < 8; i++)
+    s[4 + i] = get32_le(key + 4 * i);
+  s[12] = 0;
+  for (i = 0; i < 3; i++)
+    s[13 + i] = get32_le(nonce + 4 * i);
+}
+
+/* Computes the block of keystream for the state @p s into @p out. */
+static void
+chacha20_block(const uint32_t s[16], unsigned char out[CHACHA_BLOCKSIZE]) {
+  uint32_t x[16];
+  int i;
+
+  memcpy(x, s, sizeof(x));
+  for (i = 0; i < 10; i++)
+    CHACHA_DOUBLEROUND(x);
+  for (i = 0; i < 16; i++)
+    put32_le(out + 4 * i, x[i] + s[i]);
+}
+
+#ifdef CHACHA_LANES
+/* Computes the blocks @p s[12] to @p s[12] + 3 of keystream. */
+static void
+chacha20_blocks(const uint32_t s[16],
+		unsigned char out[CHACHA_LANES * CHACHA_BLOCKSIZE]) {
+  const chacha_vec_t lane = { 0, 1, 2, 3 };
+  chacha_vec_t x[16], in[16];
+  int i, j;
+
+  for (i = 0; i < 16; i++) {
+    chacha_vec_t v = { s[i], s[i], s[i], s[i] };
+    in[i] = v;
+  }
+  in[12] += lane;
+
+  memcpy(x, in, sizeof(x));
+  for (i = 0; i < 10; i++)
+    CHACHA_DOUBLEROUND(x);
+  for (i = 0; i < 16; i++)
+    x[i] += in[i];
+
+  for (j = 0; j < CHACHA_LANES; j++)
+    for (i = 0; i < 16; i++)
+      put32_le(out + j * CHACHA_BLOCKSIZE + 4 * i, x[i][j]);
+}
+#endif /* CHACHA_LANES */
+
+/* Encrypts or decrypts @p lm bytes at @p msg in place with the
+ * keystream that starts with block 1, block 0 is the Poly1305 key. */
+static void
+chacha20_xor(const unsigned char key[DTLS_CHACHAPOLY_KEY_SIZE],
+	     const unsigned char nonce[DTLS_CHACHAPOLY_NONCE_SIZE],
+	     unsigned char *msg, size_t lm) {
+#ifdef CHACHA_LANES
+  unsigned char ks[CHACHA_LANES * CHACHA_BLOCKSIZE];
+#else /* CHACHA_LANES */
+  unsigned char ks[CHACHA_BLOCKSIZE];
+#endif /* CHACHA_LANES */
+  uint32_t s[16];
+  size_t i, len;
+
+  chacha20_init(s, key, nonce);
+  s[12] = 1;
+
+  while (lm) {
+#ifdef CHACHA_LANES
+    /* a single block is cheaper without vectors */
+    if (lm > 2 * CHACHA_BLOCKSIZE) {
+      chacha20_blocks(s, ks);
+      s[12] += CHACHA_LANES;
+      len = lm < sizeof(ks) ? lm : sizeof(ks);
+    } else
+#endif /* CHACHA_LANES */
+    {
+      chacha20_block(s, ks);
+      s[12]++;
+      len = lm < CHACHA_BLOCKSIZE ? lm : CHACHA_BLOCKSIZE;
+    }
+
+    for (i = 0; i < len; i++)
+      msg[i] ^= ks[i];
+    msg += len;
+    lm -= len;
+  }
+  memset(ks, 0, sizeof(ks));
+  memset(s, 0, sizeof(s));
+}
+
+/* The state of Poly1305: the clamped key r, the accumulator h and the
+ * second half of the one-time key that is added at the end. */
+typedef struct {
+#ifdef POLY_LIMBS64
+  uint64_t r[3], h[3];
+#else /* POLY_LIMBS64 */
+  uint32_t r[5], h[5];
+#endif /* POLY_LIMBS64 */
+  unsigned char pad[16];
+} poly1305_t;
+
+#ifdef POLY_LIMBS64
+__extension__ typedef unsigned __int128 poly_u128;
+
+static inline uint64_t
+get64_le(const unsigned char *p) {
+  return (uint64_t)get32_le(p) | ((uint64_t)get32_le(p + 4) << 32);
+}
+
+static void
+poly1305_init(poly1305_t *st, const unsigned char key[32]) {
+  uint64_t t0 = get64_le(key), t1 = get64_le(key + 8);
+
+  st->r[0] = t0 & 0xffc0fffffffULL;
+  st->r[1] = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffffULL;
+  st->r[2] = (t1 >> 24) & 0x00ffffffc0fULL;
+  st->h[0] = st->h[1] = st->h[2] = 0;
+  memcpy(st->pad, key + 16, 16);
+}
+
+/* Adds the @p n blocks at @p m to the accumulator. */
+static void
+poly1305_blocks(poly1305_t *st, const unsigned char *m, size_t n) {
+  const uint64_t r0 = st->r[0], r1 = st->r[1], r2 = st->r[2];
+  const uint64_t s1 = r1 * (5 << 2), s2 = r2 * (5 << 2);
+  uint64_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2], t0, t1, c;
+  poly_u128 d0, d1, d2;
+
+  for (; n; n--, m += POLY_BLOCKSIZE) {
+    t0 = get64_le(m);
+    t1 = get64_le(m + 8);
+    h0 += t0 & 0xfffffffffffULL;
+    h1 += ((t0 >> 44) | (t1 << 20)) & 0xfffffffffffULL;
+    h2 += ((t1 >> 24) & 0x3ffffffffffULL) | (1ULL << 40);
+
+    d0 = (poly_u128)h0 * r0 + (poly_u128)h1 * s2 + (poly_u128)h2 * s1;
+    d1 = (poly_u128)h0 * r1 + (poly_u128)h1 * r0 + (poly_u128)h2 * s2;
+    d2 = (poly_u128)h0 * r2 + (poly_u128)h1 * r1 + (poly_u128)h2 * r0;
+
+    c = (uint64_t)(d0 >> 44);
+    h0 = (uint64_t)d0 & 0xfffffffffffULL;
+    d1 += c;
+    c = (uint64_t)(d1 >> 44);
+    h1 = (uint64_t)d1 & 0xfffffffffffULL;
+    d2 += c;
+    c = (uint64_t)(d2 >> 42);
+    h2 = (uint64_t)d2 & 0x3ffffffffffULL;
+    h0 += c * 5;
+    c = h0 >> 44;
+    h0 &= 0xfffffffffffULL;
+    h1 += c;
+  }
+
+  st->h[0] = h0;
+  st->h[1] = h1;
+  st->h[2] = h2;
+}
+
+static void
+poly1305_finish(poly1305_t *st, unsigned char mac[16]) {
+  uint64_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2];
+  uint64_t g0, g1, g2, c, t0, t1;
+
+  /* carry h completely */
+  c = h1 >> 44; h1 &= 0xfffffffffffULL; h2 += c;
+  c = h2 >> 42; h2 &= 0x3ffffffffffULL; h0 += c * 5;
+  c = h0 >> 44; h0 &= 0xfffffffffffULL; h1 += c;
+  c = h1 >> 44; h1 &= 0xfffffffffffULL; h2 += c;
+  c = h2 >> 42; h2 &= 0x3ffffffffffULL; h0 += c * 5;
+  c = h0 >> 44; h0 &= 0xfffffffffffULL; h1 += c;
+
+  /* h - p, taken if it is not negative */
+  g0 = h0 + 5; c = g0 >> 44; g0 &= 0xfffffffffffULL;
+  g1 = h1 + c; c = g1 >> 44; g1 &= 0xfffffffffffULL;
+  g2 = h2 + c - (1ULL << 42);
+
+  c = (g2 >> 63) - 1;
+  h0 = (h0 & ~c) | (g0 & c);
+  h1 = (h1 & ~c) | (g1 & c);
+  h2 = (h2 & ~c) | (g2 & c);
+
+  /* h + pad mod 2^128 */
+  t0 = get64_le(st->pad);
+  t1 = get64_le(st->pad + 8);
+  h0 += t0 & 0xfffffffffffULL;
+  c = h0 >> 44; h0 &= 0xfffffffffffULL;
+  h1 += (((t0 >> 44) | (t1 << 20)) & 0xfffffffffffULL) + c;
+  c = h1 >> 44; h1 &= 0xfffffffffffULL;
+  h2 += ((t1 >> 24) & 0x3ffffffffffULL) + c;
+
+  put64_le(mac, h0 | (h1 << 44));
+  put64_le(mac + 8, (h1 >> 20) | (h2 << 24));
+}
+#else /* POLY_LIMBS64 */
+static void
+poly1305_init(poly1305_t *st, const unsigned char key[32]) {
+  st->r[0] = get32_le(key) & 0x3ffffff;
+  st->r[1] = (get32_le(key + 3) >> 2) & 0x3ffff03;
+  st->r[2] = (get32_le(key + 6) >> 4) & 0x3ffc0ff;
+  st->r[3] = (get32_le(key + 9) >> 6) & 0x3f03fff;
+  st->r[4] = (get32_le(key + 12) >> 8) & 0x00fffff;
+  memset(st->h, 0, sizeof(st->h));
+  memcpy(st->pad, key + 16, 16);
+}
+
+/* Adds the @p n blocks at @p m to the accumulator. */
+static void
+poly1305_blocks(poly1305_t *st, const unsigned char *m, size_t n) {
+  const uint32_t r0 = st->r[0], r1 = st->r[1], r2 = st->r[2];
+  const uint32_t r3 = st->r[3], r4 = st->r[4];
+  const uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+  uint32_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2];
+  uint32_t h3 = st->h[3], h4 = st->h[4], c;
+  uint64_t d0, d1, d2, d3, d4;
+
+  for (; n; n--, m += POLY_BLOCKSIZE) {
+    h0 += get32_le(m) & 0x3ffffff;
+    h1 += (get32_le(m + 3) >> 2) & 0x3ffffff;
+    h2 += (get32_le(m + 6) >> 4) & 0x3ffffff;
+    h3 += (get32_le(m + 9) >> 6) & 0x3ffffff;
+    h4 += (get32_le(m + 12) >> 8) | (1UL << 24);
+
+    d0 = (uint64_t)h0 * r0 + (uint64_t)h1 * s4 + (uint64_t)h2 * s3
+      + (uint64_t)h3 * s2 + (uint64_t)h4 * s1;
+    d1 = (uint64_t)h0 * r1 + (uint64_t)h1 * r0 + (uint64_t)h2 * s4
+      + (uint64_t)h3 * s3 + (uint64_t)h4 * s2;
+    d2 = (uint64_t)h0 * r2 + (uint64_t)h1 * r1 + (uint64_t)h2 * r0
+      + (uint64_t)h3 * s4 + (uint64_t)h4 * s3;
+    d3 = (uint64_t)h0 * r3 + (uint64_t)h1 * r2 + (uint64_t)h2 * r1
+      + (uint64_t)h3 * r0 + (uint64_t)h4 * s4;
+    d4 = (uint64_t)h0 * r4 + (uint64_t)h1 * r3 + (uint64_t)h2 * r2
+      + (uint64_t)h3 * r1 + (uint64_t)h4 * r0;
+
+    c = (uint32_t)(d0 >> 26); h0 = (uint32_t)d0 & 0x3ffffff;
+    d1 += c; c = (uint32_t)(d1 >> 26); h1 = (uint32_t)d1 & 0x3ffffff;
+    d2 += c; c = (uint32_t)(d2 >> 26); h2 = (uint32_t)d2 & 0x3ffffff;
+    d3 += c; c = (uint32_t)(d3 >> 26); h3 = (uint32_t)d3 & 0x3ffffff;
+    d4 += c; c = (uint32_t)(d4 >> 26); h4 = (uint32_t)d4 & 0x3ffffff;
+    h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+    h1 += c;
+  }
+
+  st->h[0] = h0;
+  st->h[1] = h1;
+  st->h[2] = h2;
+  st->h[3] = h3;
+  st->h[4] = h4;
+}
+
+static void
+poly1305_finish(poly1305_t *st, unsigned char mac[16]) {
+  uint32_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2];
+  uint32_t h3 = st->h[3], h4 = st->h[4];
+  uint32_t g0, g1, g2, g3, g4, c, mask;
+  uint64_t f;
+
+  /* carry h completely */
+  c = h1 >> 26; h1 &= 0x3ffffff; h2 += c;
+  c = h2 >> 26; h2 &= 0x3ffffff; h3 += c;
+  c = h3 >> 26; h3 &= 0x3ffffff; h4 += c;
+  c = h4 >> 26; h4 &= 0x3ffffff; h0 += c * 5;
+  c = h0 >> 26; h0 &= 0x3ffffff; h1 += c;
+
+  /* h - p, taken if it is not negative */
+  g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3ffffff;
+  g1 = h1 + c; c = g1 >> 26; g1 &= 0x3ffffff;
+  g2 = h2 + c; c = g2 >> 26; g2 &= 0x3ffffff;
+  g3 = h3 + c; c = g3 >> 26; g3 &= 0x3ffffff;
+  g4 = h4 + c - (1UL << 26);
+
+  mask = (g4 >> 31) - 1;
+  h0 = (h0 & ~mask) | (g0 & mask);
+  h1 = (h1 & ~mask) | (g1 & mask);
+  h2 = (h2 & ~mask) | (g2 & mask);
+  h3 = (h3 & ~mask) | (g3 & mask);
+  h4 = (h4 & ~mask) | (g4 & mask);
+
+  /* h + pad mod 2^128 */
+  h0 = h0 | (h1 << 26);
+  h1 = (h1 >> 6) | (h2 << 20);
+  h2 = (h2 >> 12) | (h3 << 14);
+  h3 = (h3 >> 18) | (h4 << 8);
+
+  f = (uint64_t)h0 + get32_le(st->pad);
+  put32_le(mac, (uint32_t)f);
+  f = (uint64_t)h1 + get32_le(st->pad + 4) + (f >> 32);
+  put32_le(mac + 4, (uint32_t)f);
+  f = (uint64_t)h2 + get32_le(st->pad + 8) + (f >> 32);
+  put32_le(mac + 8, (uint32_t)f);
+  f = (uint64_t)h3 + get32_le(st->pad + 12) + (f >> 32);
+  put32_le(mac + 12, (uint32_t)f);
+}
+#endif /* POLY_LIMBS64 */
+
+/* Adds @p len bytes of @p data to the accumulator, padded with zeros
+ * to a multiple of the block size as RFC 8439 does for the AEAD. */
+static void
+poly1305_update_padded(poly1305_t *st, const unsigned char *data,
+		       size_t len) {
+  unsigned char last[POLY_BLOCKSIZE];
+  size_t n = len / POLY_BLOCKSIZE, rest = len % POLY_BLOCKSIZE;
+
+  if (n)
+    poly1305_blocks(st, data, n);
+  if (rest) {
+    memset(last, 0, sizeof(last));
+    memcpy(last, data + n * POLY_BLOCKSIZE, rest);
+    poly1305_blocks(st, last, 1);
+  }
+}
+
+/* Calculates the tag of the ciphertext @p c into @p tag. */
+static void
+chachapoly_tag(const unsigned char key[DTLS_CHACHAPOLY_KEY_SIZE],
+	       const unsigned char nonce[DTLS_CHACHAPOLY_NONCE_SIZE],
+	       const unsigned char *c, size_t lc,
+	       const unsigned char *aad, size_t la,
+	       unsigned char tag[DTLS_CHACHAPOLY_TAG_LENGTH]) {
+  unsigned char block[CHACHA_BLOCKSIZE];
+  uint32_t s[16];
+  poly1305_t st;
+
+  /* the one-time key is the first half of keystream block 0 */
+  chacha20_init(s, key, nonce);
+  chacha20_block(s, block);
+  poly1305_init(&st, block);
+
+  if (la)
+    poly1305_update_padded(&st, aad, la);
+  poly1305_update_padded(&st, c, lc);
+
+  put64_le(block, (uint64_t)la);
+  put64_le(block + 8, (uint64_t)lc);
+  poly1305_blocks(&st, block, 1);
+  poly1305_finish(&st, tag);
+
+  memset(block, 0, sizeof(block));
+  memset(&st, 0, sizeof(st));
+  memset(s, 0, sizeof(s));
+}
+
+long int
+dtls_chachapoly_encrypt_message(const unsigned char key[DTLS_CHACHAPOLY_KEY_SIZE],
+				const unsigned char nonce[DTLS_CHACHAPOLY_NONCE_SIZE],
+				unsigned char *msg, size_t lm,
+				const unsigned char *aad, size_t la) {
+  chacha20_xor(key, nonce, msg, lm);
+  chachapoly_tag(key, nonce, msg, lm, aad, la, msg + lm);
+  return lm + DTLS_CHACHAPOLY_TAG_LENGTH;
+}
+
+long int
+dtls_chachapoly_decrypt_message(const unsigned char key[DTLS_CHACHAPOLY_KEY_SIZE],
+				const unsigned char nonce[DTLS_CHACHAPOLY_NONCE_SIZE],
+				unsigned char *msg, size_t lm,
+				const unsigned char *aad, size_t la) {
+  unsigned char tag[DTLS_CHACHAPOLY_TAG_LENGTH];
+
+  if (lm < DTLS_CHACHAPOLY_TAG_LENGTH)
+    return -1;
+  lm -= DTLS_CHACHAPOLY_TAG_LENGTH;
+
+  /* the ciphertext is only decrypted when it is authentic */
+  chachapoly_tag(key, nonce, msg, lm, aad, la, tag);
+  if (!equals(tag, msg + lm, DTLS_CHACHAPOLY_TAG_LENGTH))
+    return -1;
+
+  chacha20_xor(key, nonce, msg, lm);
+  return lm;
+}
@@ -0,0 +1,66 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2011, 2012, 2013, 2014, 2015 Olaf Bergmann (TZI) and others.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v. 1.0 which accompanies this distribution.
+ *
+ * The Eclipse Public License is available at http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Olaf Bergmann  - initial API and implementation
+ *
+ *******************************************************************************/
+
+#ifndef _DTLS_CHACHAPOLY_H_
+#define _DTLS_CHACHAPOLY_H_
+
+#include <stddef.h>
+
+/* implementation of the ChaCha20-Poly1305 AEAD, RFC 8439 */
+
+#define DTLS_CHACHAPOLY_KEY_SIZE   32 /**< size of the key */
+#define DTLS_CHACHAPOLY_NONCE_SIZE 12 /**< size of the nonce */
+#define DTLS_CHACHAPOLY_TAG_LENGTH 16 /**< size of the authentication tag */
+
+/**
+ * Authenticates and encrypts a message with ChaCha20-Poly1305. The
+ * portable implementation only needs 32-bit arithmetic. If the
+ * compiler targets SSE2 or NEON, four ChaCha20 blocks are computed at
+ * a time, and Poly1305 uses 64-bit limbs where 128-bit products are
+ * available. Define DTLS_CHACHAPOLY_PORTABLE to use neither.
+ *
+ * \param key   The DTLS_CHACHAPOLY_KEY_SIZE bytes of key.
+ * \param nonce The DTLS_CHACHAPOLY_NONCE_SIZE bytes of nonce.
+ * \param msg   The message to encrypt in place. The buffer must have
+ *              room for DTLS_CHACHAPOLY_TAG_LENGTH more bytes for the
+ *              tag.
+ * \param lm    The actual length of \p msg.
+ * \param aad   The additional authentication data (can be \c NULL if
+ *              \p la is zero).
+ * \param la    The number of additional authentication octets.
+ * \return The length of the encrypted message including the tag.
+ */
+long int
+dtls_chachapoly_encrypt_message(const unsigned char key[DTLS_CHACHAPOLY_KEY_SIZE],
+				const unsigned char nonce[DTLS_CHACHAPOLY_NONCE_SIZE],
+				unsigned char *msg, size_t lm,
+				const unsigned char *aad, size_t la);
+
+/**
+ * Verifies and decrypts a message that has been encrypted by
+ * dtls_chachapoly_encrypt_message(). The parameters have the same
+ * meaning, but \p lm includes the tag at the end of \p msg.
+ *
+ * \return The length of the decrypted message, or \c -1 if \p msg is
+ *         too short or has been modified.
+ */
+long int
+dtls_chachapoly_decrypt_message(const unsigned char key[DTLS_CHACHAPOLY_KEY_SIZE],
+				const unsigned char nonce[DTLS_CHACHAPOLY_NONCE_SIZE],
+				unsigned char *msg, size_t lm,
+				const unsigned char *aad, size_t la);
+
+#endif /* _DTLS_CHACHAPOLY_H_ */
@@ -31,69 +31,69 @@
 #include "dtls.h"
 #include "crypto.h"
 #include "ccm.h"
+#ifdef WITH_AES_HW
+#include "aes/aes_hw.h"
+#endif /* WITH_AES_HW */
 #include "ecc/ecc.h"
 #include "prng.h"
 #include "netq.h"
 
-#ifndef WITH_CONTIKI
-#include <pthread.h>
-#endif
-
 #define HMAC_UPDATE_SEED(Context,Seed,Length)		\
   if (Seed) dtls_hmac_update(Context, (Seed), (Length))
 
-static struct dtls_cipher_context_t cipher_context;
 #ifndef WITH_CONTIKI
-static pthread_mutex_t cipher_context_mutex = PTHREAD_MUTEX_INITIALIZER;
-#endif
-
-static struct dtls_cipher_context_t *dtls_cipher_context_get(void)
+void crypto_init(void)
 {
-#ifndef WITH_CONTIKI
-  pthread_mutex_lock(&cipher_context_mutex);
-#endif
-  return &cipher_context;
 }
 
-static void dtls_cipher_context_release(void)
-{
-#ifndef WITH_CONTIKI
-  pthread_mutex_unlock(&cipher_context_mutex);
-#endif
+/* the pools fall back to malloc() when they have no storage */
+static dtls_handshake_parameters_t *dtls_handshake_malloc(dtls_pools_t *pools) {
+  return dtls_pool_alloc(pools ? &pools->handshakes : NULL,
+			 sizeof(dtls_handshake_parameters_t));
 }
 
-#ifndef WITH_CONTIKI
-void crypto_init(void)
-{
+static void dtls_handshake_dealloc(dtls_handshake_parameters_t *handshake) {
+  dtls_pool_free(handshake);
 }
 
-static dtls_handshake_parameters_t *dtls_handshake_malloc(void) {
-  return malloc(sizeof(dtls_handshake_parameters_t));
+static dtls_security_parameters_t *dtls_security_malloc(dtls_pools_t *pools) {
+  return dtls_pool_alloc(pools ? &pools->security : NULL,
+			 sizeof(dtls_security_parameters_t));
 }
 
-static void dtls_handshake_dealloc(dtls_handshake_parameters_t *handshake) {
-  free(handshake);
+static void dtls_security_dealloc(dtls_security_parameters_t *security) {
+  dtls_pool_free(security);
 }
 
-static dtls_security_parameters_t *dtls_security_malloc(void) {
-  return malloc(sizeof(dtls_security_parameters_t));
+#ifdef DTLS_ECC
+static dtls_ecc_job_t *dtls_ecc_job_malloc(dtls_pools_t *pools) {
+  return dtls_pool_alloc(pools ? &pools->ecc_jobs : NULL,
+			 sizeof(dtls_ecc_job_t));
 }
 
-static void dtls_security_dealloc(dtls_security_parameters_t *security) {
-  free(security);
+static void dtls_ecc_job_dealloc(dtls_ecc_job_t *job) {
+  dtls_pool_free(job);
 }
+#endif /* DTLS_ECC */
 #else /* WITH_CONTIKI */
 
 #include "memb.h"
 MEMB(handshake_storage, dtls_handshake_parameters_t, DTLS_HANDSHAKE_MAX);
 MEMB(security_storage, dtls_security_parameters_t, DTLS_SECURITY_MAX);
+#ifdef DTLS_ECC
+MEMB(ecc_job_storage, dtls_ecc_job_t, DTLS_HANDSHAKE_MAX);
+#endif /* DTLS_ECC */
 
 void crypto_init(void) {
   memb_init(&handshake_storage);
   memb_init(&security_storage);
+#ifdef DTLS_ECC
+  memb_init(&ecc_job_storage);
+#endif /* DTLS_ECC */
 }
 
-static dtls_handshake_parameters_t *dtls_handshake_malloc(void) {
+static dtls_handshake_parameters_t *dtls_handshake_malloc(dtls_pools_t *pools) {
+  (void)pools;
   return memb_alloc(&handshake_storage);
 }
 
@@ -101,26 +101,40 @@ static void dtls_handshake_dealloc(dtls_handshake_parameters_t *handshake) {
   memb_free(&handshake_storage, handshake);
 }
 
-static dtls_security_parameters_t *dtls_security_malloc(void) {
+static dtls_security_parameters_t *dtls_security_malloc(dtls_pools_t *pools) {
+  (void)pools;
   return memb_alloc(&security_storage);
 }
 
 static void dtls_security_dealloc(dtls_security_parameters_t *security) {
   memb_free(&security_storage, security);
 }
+
+#ifdef DTLS_ECC
+static dtls_ecc_job_t *dtls_ecc_job_malloc(dtls_pools_t *pools) {
+  (void)pools;
+  return memb_alloc(&ecc_job_storage);
+}
+
+static void dtls_ecc_job_dealloc(dtls_ecc_job_t *job) {
+  memb_free(&ecc_job_storage, job);
+}
+#endif /* DTLS_ECC */
 #endif /* WITH_CONTIKI */
 
-dtls_handshake_parameters_t *dtls_handshake_new(void)
+dtls_handshake_parameters_t *
+dtls_handshake_new(dtls_pools_t *pools, const dtls_crypto_provider_t *crypto)
 {
   dtls_handshake_parameters_t *handshake;
 
-  handshake = dtls_handshake_malloc();
+  handshake = dtls_handshake_malloc(pools);
   if (!handshake) {
     dtls_crit("can not allocate a handshake struct\n");
     return NULL;
   }
 
   memset(handshake, 0, sizeof(*handshake));
+  handshake->crypto = crypto ? crypto : &dtls_crypto_software;
 
   if (handshake) {
     /* initialize the handshake hash wrt. the hard-coded DTLS version */
@@ -128,7 +142,7 @@ dtls_handshake_parameters_t *dtls_handshake_new(void)
     /* TLS 1.2:  PRF(secret, label, seed) = P_<hash>(secret, label + seed) */
     /* FIXME: we use the default SHA256 here, might need to support other 
               hash functions as well */
-    dtls_hash_init(&handshake->hs_state.hs_hash);
+    handshake->crypto->hash_init(&handshake->hs_state.hs_hash);
   }
   return handshake;
 }
@@ -139,14 +153,19 @@ void dtls_handshake_free(dtls_handshake_parameters_t *handshake)
     return;
 
   netq_delete_all(&handshake->reorder_queue);
+#ifdef DTLS_ECC
+  /* A job that is still pending belongs to the application until it
+   * is completed, dtls_ecc_job_complete() releases it then. */
+  netq_delete_all(&handshake->deferred);
+#endif /* DTLS_ECC */
   dtls_handshake_dealloc(handshake);
 }
 
-dtls_security_parameters_t *dtls_security_new(void)
+dtls_security_parameters_t *dtls_security_new(dtls_pools_t *pools)
 {
   dtls_security_parameters_t *security;
 
-  security = dtls_security_malloc();
+  security = dtls_security_malloc(pools);
   if (!security) {
     dtls_crit("can not allocate a security struct\n");
     return NULL;
@@ -157,6 +176,7 @@ dtls_security_parameters_t *dtls_security_new(void)
   if (security) {
     security->cipher = TLS_NULL_WITH_NULL_NULL;
     security->compression = TLS_COMPRESSION_NULL;
+    security->crypto = &dtls_crypto_software;
   }
   return security;
 }
@@ -166,6 +186,8 @@ void dtls_security_free(dtls_security_parameters_t *security)
   if (!security)
     return;
 
+  /* do not leave the expanded keys behind in released memory */
+  memset(security, 0, sizeof(*security));
   dtls_security_dealloc(security);
 }
 
@@ -176,7 +198,9 @@ dtls_p_hash(dtls_hashfunc_t h,
 	    const unsigned char *random1, size_t random1len,
 	    const unsigned char *random2, size_t random2len,
 	    unsigned char *buf, size_t buflen) {
-  dtls_hmac_context_t *hmac_a, *hmac_p;
+  /* the contexts are only needed during this call, the key is hashed
+   * once into hmac_key and cloned for each HMAC */
+  dtls_hmac_context_t hmac_key, hmac;
 
   unsigned char A[DTLS_HMAC_DIGEST_SIZE];
   unsigned char tmp[DTLS_HMAC_DIGEST_SIZE];
@@ -184,54 +208,49 @@ dtls_p_hash(dtls_hashfunc_t h,
   size_t len = 0;			/* result length */
   (void)h;
 
-  hmac_a = dtls_hmac_new(key, keylen);
-  if (!hmac_a)
-    return 0;
+  dtls_hmac_init(&hmac_key, key, keylen);
 
   /* calculate A(1) from A(0) == seed */
-  HMAC_UPDATE_SEED(hmac_a, label, labellen);
-  HMAC_UPDATE_SEED(hmac_a, random1, random1len);
-  HMAC_UPDATE_SEED(hmac_a, random2, random2len);
-
-  dlen = dtls_hmac_finalize(hmac_a, A);
+  dtls_hmac_clone(&hmac, &hmac_key);
+  HMAC_UPDATE_SEED(&hmac, label, labellen);
+  HMAC_UPDATE_SEED(&hmac, random1, random1len);
+  HMAC_UPDATE_SEED(&hmac, random2, random2len);
 
-  hmac_p = dtls_hmac_new(key, keylen);
-  if (!hmac_p)
-    goto error;
+  dlen = dtls_hmac_finalize(&hmac, A);
 
   while (len + dlen < buflen) {
+    dtls_hmac_clone(&hmac, &hmac_key);
+    dtls_hmac_update(&hmac, A, dlen);
 
-    /* FIXME: rewrite loop to avoid superflous call to dtls_hmac_init() */
-    dtls_hmac_init(hmac_p, key, keylen);
-    dtls_hmac_update(hmac_p, A, dlen);
+    HMAC_UPDATE_SEED(&hmac, label, labellen);
+    HMAC_UPDATE_SEED(&hmac, random1, random1len);
+    HMAC_UPDATE_SEED(&hmac, random2, random2len);
 
-    HMAC_UPDATE_SEED(hmac_p, label, labellen);
-    HMAC_UPDATE_SEED(hmac_p, random1, random1len);
-    HMAC_UPDATE_SEED(hmac_p, random2, random2len);
-
-    len += dtls_hmac_finalize(hmac_p, tmp);
+    len += dtls_hmac_finalize(&hmac, tmp);
     memcpy(buf, tmp, dlen);
     buf += dlen;
 
     /* calculate A(i+1) */
-    dtls_hmac_init(hmac_a, key, keylen);
-    dtls_hmac_update(hmac_a, A, dlen);
-    dtls_hmac_finalize(hmac_a, A);
+    dtls_hmac_clone(&hmac, &hmac_key);
+    dtls_hmac_update(&hmac, A, dlen);
+    dtls_hmac_finalize(&hmac, A);
   }
 
-  dtls_hmac_init(hmac_p, key, keylen);
-  dtls_hmac_update(hmac_p, A, dlen);
+  dtls_hmac_clone(&hmac, &hmac_key);
+  dtls_hmac_update(&hmac, A, dlen);
   
-  HMAC_UPDATE_SEED(hmac_p, label, labellen);
-  HMAC_UPDATE_SEED(hmac_p, random1, random1len);
-  HMAC_UPDATE_SEED(hmac_p, random2, random2len);
+  HMAC_UPDATE_SEED(&hmac, label, labellen);
+  HMAC_UPDATE_SEED(&hmac, random1, random1len);
+  HMAC_UPDATE_SEED(&hmac, random2, random2len);
   
-  dtls_hmac_finalize(hmac_p, tmp);
+  dtls_hmac_finalize(&hmac, tmp);
   memcpy(buf, tmp, buflen - len);
 
- error:
-  dtls_hmac_free(hmac_a);
-  dtls_hmac_free(hmac_p);
+  /* the contexts are derived from the secret */
+  memset(&hmac_key, 0, sizeof(hmac_key));
+  memset(&hmac, 0, sizeof(hmac));
+  memset(A, 0, sizeof(A));
+  memset(tmp, 0, sizeof(tmp));
 
   return buflen;
 }
@@ -359,7 +378,7 @@ int dtls_ec_key_from_uint32_asn1(const uint32_t *key, size_t key_size,
   int first = 1; 
 
   for (i = (key_size / sizeof(uint32_t)) - 1; i >= 0 ; i--) {
-    if (key[i] == 0)
+    if (first && key[i] == 0)
       continue;
     /* the first bit has to be set to zero, to indicate a poritive integer */
     if (first && key[i] & 0x80000000) {
@@ -414,7 +433,7 @@ int dtls_ecdh_pre_master_secret(unsigned char *priv_key,
   return key_size;
 }
 
-void
+int
 dtls_ecdsa_generate_key(unsigned char *priv_key,
 			unsigned char *pub_key_x,
 			unsigned char *pub_key_y,
@@ -424,7 +443,10 @@ dtls_ecdsa_generate_key(unsigned char *priv_key,
   uint32_t pub_y[8];
 
   do {
-    dtls_prng((unsigned char *)priv, key_size);
+    if (!dtls_prng((unsigned char *)priv, key_size)) {
+      dtls_crit("cannot generate an ephemeral key\n");
+      return -1;
+    }
   } while (!ecc_is_valid_key(priv));
 
   ecc_gen_pub_key(priv, pub_x, pub_y);
@@ -432,10 +454,12 @@ dtls_ecdsa_generate_key(unsigned char *priv_key,
   dtls_ec_key_from_uint32(priv, key_size, priv_key);
   dtls_ec_key_from_uint32(pub_x, key_size, pub_key_x);
   dtls_ec_key_from_uint32(pub_y, key_size, pub_key_y);
+  memset(priv, 0, sizeof(priv));
+  return 0;
 }
 
 /* rfc4492#section-5.4 */
-void
+int
 dtls_ecdsa_create_sig_hash(const unsigned char *priv_key, size_t key_size,
 			   const unsigned char *sign_hash, size_t sign_hash_size,
 			   uint32_t point_r[9], uint32_t point_s[9]) {
@@ -447,12 +471,63 @@ dtls_ecdsa_create_sig_hash(const unsigned char *priv_key, size_t key_size,
   dtls_ec_key_to_uint32(priv_key, key_size, priv);
   dtls_ec_key_to_uint32(sign_hash, sign_hash_size, hash);
   do {
-    dtls_prng((unsigned char *)rand, key_size);
+    /* signing twice with the same k reveals the private key */
+    if (!dtls_prng((unsigned char *)rand, key_size)) {
+      dtls_crit("cannot generate an ECDSA nonce\n");
+      ret = -1;
+      break;
+    }
     ret = ecc_ecdsa_sign(priv, hash, rand, point_r, point_s);
   } while (ret);
+
+  memset(rand, 0, sizeof(rand));
+  memset(priv, 0, sizeof(priv));
+  return ret;
 }
 
-void
+int
+dtls_ecdsa_precompute_nonce(dtls_ecdsa_nonce_t *nonce) {
+  uint32_t rand[8];
+
+  do {
+    if (!dtls_prng((unsigned char *)rand, sizeof(rand))) {
+      dtls_crit("cannot generate an ECDSA nonce\n");
+      return -1;
+    }
+  } while (ecc_ecdsa_precompute(rand, nonce->r, nonce->k_inv));
+
+  memset(rand, 0, sizeof(rand));
+  return 0;
+}
+
+int
+dtls_ecdsa_create_sig_hash_nonce(const unsigned char *priv_key,
+				 size_t key_size,
+				 const unsigned char *sign_hash,
+				 size_t sign_hash_size,
+				 dtls_ecdsa_nonce_t *nonce,
+				 uint32_t point_r[9], uint32_t point_s[9]) {
+  uint32_t priv[8];
+  uint32_t hash[8];
+  int ret;
+
+  dtls_ec_key_to_uint32(priv_key, key_size, priv);
+  dtls_ec_key_to_uint32(sign_hash, sign_hash_size, hash);
+  ret = ecc_ecdsa_sign_precomputed(priv, hash, nonce->r, nonce->k_inv,
+				   point_s);
+  memcpy(point_r, nonce->r, sizeof(nonce->r));
+  memset(nonce, 0, sizeof(*nonce));
+  memset(priv, 0, sizeof(priv));
+
+  /* s = 0, start over with a fresh nonce */
+  if (ret)
+    return dtls_ecdsa_create_sig_hash(priv_key, key_size,
+				      sign_hash, sign_hash_size,
+				      point_r, point_s);
+  return 0;
+}
+
+int
 dtls_ecdsa_create_sig(const unsigned char *priv_key, size_t key_size,
 		      const unsigned char *client_random, size_t client_random_size,
 		      const unsigned char *server_random, size_t server_random_size,
@@ -467,8 +542,8 @@ dtls_ecdsa_create_sig(const unsigned char *priv_key, size_t key_size,
   dtls_hash_update(&data, keyx_params, keyx_params_size);
   dtls_hash_finalize(sha256hash, &data);
   
-  dtls_ecdsa_create_sig_hash(priv_key, key_size, sha256hash,
-			     sizeof(sha256hash), point_r, point_s);
+  return dtls_ecdsa_create_sig_hash(priv_key, key_size, sha256hash,
+				    sizeof(sha256hash), point_r, point_s);
 }
 
 /* rfc4492#section-5.4 */
@@ -511,57 +586,276 @@ dtls_ecdsa_verify_sig(const unsigned char *pub_key_x,
   return dtls_ecdsa_verify_sig_hash(pub_key_x, pub_key_y, key_size, sha256hash,
 				    sizeof(sha256hash), result_r, result_s);
 }
+
+void
+dtls_ecc_job_run(dtls_ecc_job_t *job) {
+  const dtls_crypto_provider_t *crypto = &job->crypto;
+  int res;
+
+  switch (job->type) {
+  case DTLS_ECC_JOB_SIGN:
+    if (job->has_nonce)
+      res = dtls_ecdsa_create_sig_hash_nonce(job->priv_key,
+					     sizeof(job->priv_key),
+					     job->hash, sizeof(job->hash),
+					     &job->nonce,
+					     job->point_r, job->point_s);
+    else
+      res = crypto->ecdsa_sign(job->priv_key, sizeof(job->priv_key),
+			       job->hash, sizeof(job->hash),
+			       job->point_r, job->point_s);
+    job->result = res < 0 ? res : 0;
+    break;
+  case DTLS_ECC_JOB_VERIFY:
+    job->result = crypto->ecdsa_verify(job->pub_x, job->pub_y,
+				       sizeof(job->pub_x),
+				       job->hash, sizeof(job->hash),
+				       job->sig_r, job->sig_s);
+    break;
+  case DTLS_ECC_JOB_ECDH:
+    res = crypto->ecdh(job->priv_key, job->pub_x, job->pub_y,
+		       sizeof(job->priv_key),
+		       job->secret, sizeof(job->secret));
+    job->result = res < 0 ? res : 0;
+    break;
+  default:
+    job->result = -1;
+  }
+}
+
+dtls_ecc_job_t *
+dtls_ecc_job_new(dtls_pools_t *pools) {
+  dtls_ecc_job_t *job;
+
+  job = dtls_ecc_job_malloc(pools);
+  if (!job) {
+    dtls_crit("can not allocate an ecc job\n");
+    return NULL;
+  }
+
+  memset(job, 0, sizeof(*job));
+  return job;
+}
+
+void
+dtls_ecc_job_free(dtls_ecc_job_t *job) {
+  if (job) {
+    /* the job holds private keys, the nonce and the ECDH secret */
+    memset(job, 0, sizeof(*job));
+    dtls_ecc_job_dealloc(job);
+  }
+}
 #endif /* DTLS_ECC */
 
-int 
-dtls_encrypt(const unsigned char *src, size_t length,
-	     unsigned char *buf,
-	     unsigned char *nounce,
-	     unsigned char *key, size_t keylen,
-	     const unsigned char *aad, size_t la)
+int
+dtls_aes_accelerated(void) {
+#ifdef WITH_AES_HW
+  return aes_hw_available();
+#else /* WITH_AES_HW */
+  return 0;
+#endif /* WITH_AES_HW */
+}
+
+int
+dtls_cipher_set_key(aes128_ccm_t *ctx,
+		    const unsigned char *key, size_t keylen)
 {
   int ret;
-  struct dtls_cipher_context_t *ctx = dtls_cipher_context_get();
 
-  ret = rijndael_set_key_enc_only(&ctx->data.ctx, key, 8 * keylen);
+  ret = rijndael_set_key_enc_only(&ctx->ctx, key, 8 * keylen);
   if (ret < 0) {
-    /* cleanup everything in case the key has the wrong size */
     dtls_warn("cannot set rijndael key\n");
-    goto error;
+    return ret;
   }
+  return 0;
+}
 
+int 
+dtls_encrypt(aes128_ccm_t *ctx,
+	     const unsigned char *src, size_t length,
+	     unsigned char *buf,
+	     unsigned char *nounce,
+	     const unsigned char *aad, size_t la)
+{
   if (src != buf)
     memmove(buf, src, length);
-  ret = dtls_ccm_encrypt(&ctx->data, src, length, buf, nounce, aad, la);
 
-error:
-  dtls_cipher_context_release();
-  return ret;
+  return dtls_ccm_encrypt(ctx, src, length, buf, nounce, aad, la);
 }
 
 int 
-dtls_decrypt(const unsigned char *src, size_t length,
+dtls_decrypt(aes128_ccm_t *ctx,
+	     const unsigned char *src, size_t length,
 	     unsigned char *buf,
 	     unsigned char *nounce,
-	     unsigned char *key, size_t keylen,
 	     const unsigned char *aad, size_t la)
+{
+  if (src != buf)
+    memmove(buf, src, length);
+
+  return dtls_ccm_decrypt(ctx, src, length, buf, nounce, aad, la);
+}
+
+#if DTLS_GCM
+int
+dtls_cipher_set_key_gcm(aes128_ccm_t *ctx,
+			const unsigned char *key, size_t keylen)
 {
   int ret;
-  struct dtls_cipher_context_t *ctx = dtls_cipher_context_get();
 
-  ret = rijndael_set_key_enc_only(&ctx->data.ctx, key, 8 * keylen);
-  if (ret < 0) {
-    /* cleanup everything in case the key has the wrong size */
-    dtls_warn("cannot set rijndael key\n");
-    goto error;
+  ret = dtls_cipher_set_key(ctx, key, keylen);
+  if (ret < 0)
+    return ret;
+  dtls_gcm_set_key(&ctx->ctx, &ctx->aead.ghash);
+  return 0;
+}
+
+int
+dtls_encrypt_gcm(aes128_ccm_t *ctx,
+		 const unsigned char *src, size_t length,
+		 unsigned char *buf,
+		 unsigned char *nonce,
+		 const unsigned char *aad, size_t la)
+{
+  if (src != buf)
+    memmove(buf, src, length);
+
+  return dtls_gcm_encrypt_message(&ctx->ctx, &ctx->aead.ghash, nonce,
+				  buf, length, aad, la);
+}
+
+int
+dtls_decrypt_gcm(aes128_ccm_t *ctx,
+		 const unsigned char *src, size_t length,
+		 unsigned char *buf,
+		 unsigned char *nonce,
+		 const unsigned char *aad, size_t la)
+{
+  if (src != buf)
+    memmove(buf, src, length);
+
+  return dtls_gcm_decrypt_message(&ctx->ctx, &ctx->aead.ghash, nonce,
+				  buf, length, aad, la);
+}
+#endif /* DTLS_GCM */
+
+#if DTLS_CHACHA20
+int
+dtls_cipher_set_key_chacha20(aes128_ccm_t *ctx,
+			     const unsigned char *key, size_t keylen)
+{
+  if (keylen != sizeof(ctx->aead.chacha20)) {
+    dtls_warn("cannot set chacha20 key\n");
+    return -1;
   }
+  memcpy(ctx->aead.chacha20, key, keylen);
+  return 0;
+}
 
+int
+dtls_encrypt_chacha20(aes128_ccm_t *ctx,
+		      const unsigned char *src, size_t length,
+		      unsigned char *buf,
+		      unsigned char *nonce,
+		      const unsigned char *aad, size_t la)
+{
   if (src != buf)
     memmove(buf, src, length);
-  ret = dtls_ccm_decrypt(&ctx->data, src, length, buf, nounce, aad, la);
 
-error:
-  dtls_cipher_context_release();
-  return ret;
+  return dtls_chachapoly_encrypt_message(ctx->aead.chacha20, nonce,
+					 buf, length, aad, la);
 }
 
+int
+dtls_decrypt_chacha20(aes128_ccm_t *ctx,
+		      const unsigned char *src, size_t length,
+		      unsigned char *buf,
+		      unsigned char *nonce,
+		      const unsigned char *aad, size_t la)
+{
+  if (src != buf)
+    memmove(buf, src, length);
+
+  return dtls_chachapoly_decrypt_message(ctx->aead.chacha20, nonce,
+					 buf, length, aad, la);
+}
+#endif /* DTLS_CHACHA20 */
+
+/* Passes the jobs to dtls_ccm_encrypt_messages() or
+ * dtls_ccm_decrypt_messages() in groups of DTLS_CCM_LANES records. */
+static void
+dtls_ccm_jobs(dtls_ccm_job_t *jobs, size_t count,
+	      void (*crypt)(size_t M, size_t L,
+			    dtls_ccm_record_t *records, size_t count)) {
+  dtls_ccm_record_t rec[DTLS_CCM_LANES];
+  size_t i, n;
+
+  for (; count; jobs += n, count -= n) {
+    n = min(count, DTLS_CCM_LANES);
+    for (i = 0; i < n; i++) {
+      rec[i].ctx = &jobs[i].ctx->ctx;
+      rec[i].nonce = jobs[i].nonce;
+      rec[i].msg = jobs[i].buf;
+      rec[i].lm = jobs[i].length;
+      rec[i].aad = jobs[i].aad;
+      rec[i].la = jobs[i].aad_length;
+    }
+    crypt(8 /* M */, max(2, 15 - DTLS_CCM_NONCE_SIZE), rec, n);
+    for (i = 0; i < n; i++)
+      jobs[i].result = rec[i].result;
+  }
+}
+
+void
+dtls_encrypt_multi(dtls_ccm_job_t *jobs, size_t count) {
+  dtls_ccm_jobs(jobs, count, dtls_ccm_encrypt_messages);
+}
+
+void
+dtls_decrypt_multi(dtls_ccm_job_t *jobs, size_t count) {
+  dtls_ccm_jobs(jobs, count, dtls_ccm_decrypt_messages);
+}
+
+static void
+dtls_software_hash_init(dtls_hash_ctx *ctx) {
+  dtls_hash_init(ctx);
+}
+
+static void
+dtls_software_hash_update(dtls_hash_ctx *ctx,
+			  const unsigned char *input, size_t len) {
+  dtls_hash_update(ctx, input, len);
+}
+
+static size_t
+dtls_software_hash_finalize(unsigned char *buf, dtls_hash_ctx *ctx) {
+  return dtls_hash_finalize(buf, ctx);
+}
+
+const dtls_crypto_provider_t dtls_crypto_software = {
+  dtls_cipher_set_key,
+  dtls_encrypt,
+  dtls_decrypt,
+  dtls_software_hash_init,
+  dtls_software_hash_update,
+  dtls_software_hash_finalize,
+#ifdef DTLS_ECC
+  dtls_ecdsa_generate_key,
+  dtls_ecdh_pre_master_secret,
+  dtls_ecdsa_create_sig_hash,
+  dtls_ecdsa_verify_sig_hash,
+#endif /* DTLS_ECC */
+  dtls_encrypt_multi,
+  dtls_decrypt_multi,
+#if DTLS_GCM
+  dtls_cipher_set_key_gcm,
+  dtls_encrypt_gcm,
+  dtls_decrypt_gcm,
+#endif /* DTLS_GCM */
+#if DTLS_CHACHA20
+  dtls_cipher_set_key_chacha20,
+  dtls_encrypt_chacha20,
+  dtls_decrypt_chacha20,
+#endif /* DTLS_CHACHA20 */
+};
+
@@ -29,6 +29,12 @@
 #include "numeric.h"
 #include "hmac.h"
 #include "ccm.h"
+#include "gcm.h"
+#include "chachapoly.h"
+#include "session.h"
+#include "pool.h"
+#include "replay.h"
+#include "dtls_time.h"
 
 /* TLS_PSK_WITH_AES_128_CCM_8 */
 #define DTLS_MAC_KEY_LENGTH    0
@@ -37,17 +43,64 @@
 #define DTLS_MAC_LENGTH        DTLS_HMAC_DIGEST_SIZE
 #define DTLS_IV_LENGTH         4  /* length of nonce_explicit */
 
+/* TLS_PSK_WITH_CHACHA20_POLY1305_SHA256, the IV is the whole nonce */
+#define DTLS_CHACHA20_KEY_LENGTH DTLS_CHACHAPOLY_KEY_SIZE
+#define DTLS_CHACHA20_IV_LENGTH  DTLS_CHACHAPOLY_NONCE_SIZE
+
+/** returns true if the records of the cipher use ChaCha20-Poly1305 */
+#define dtls_cipher_is_chacha20(Cipher)					\
+  (DTLS_CHACHA20 &&							\
+   ((Cipher) == TLS_PSK_WITH_CHACHA20_POLY1305_SHA256 ||		\
+    (Cipher) == TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256))
+
 /** 
  * Maximum size of the generated keyblock. Note that MAX_KEYBLOCK_LENGTH must 
  * be large enough to hold the pre_master_secret, i.e. twice the length of the 
  * pre-shared key + 1.
  */
+#if DTLS_CHACHA20
+#define MAX_KEYBLOCK_LENGTH  \
+  (2 * DTLS_MAC_KEY_LENGTH + 2 * DTLS_CHACHA20_KEY_LENGTH +		\
+   2 * DTLS_CHACHA20_IV_LENGTH)
+#else /* DTLS_CHACHA20 */
 #define MAX_KEYBLOCK_LENGTH  \
   (2 * DTLS_MAC_KEY_LENGTH + 2 * DTLS_KEY_LENGTH + 2 * DTLS_IV_LENGTH)
+#endif /* DTLS_CHACHA20 */
 
 /** Length of DTLS master_secret */
 #define DTLS_MASTER_SECRET_LENGTH 48
 #define DTLS_RANDOM_LENGTH 32
+/** Maximum length of a session id */
+#define DTLS_SESSION_ID_LENGTH 32
+
+#ifndef DTLS_CID_MAX_LENGTH
+/**
+ * Maximum length of a connection ID (RFC 9146) that a peer may ask
+ * us to put in our records. A value of @c 0 disables the connection
+ * ID extension.
+ */
+#define DTLS_CID_MAX_LENGTH 16
+#endif /* DTLS_CID_MAX_LENGTH */
+
+#ifndef DTLS_CID_LENGTH
+#ifdef WITH_CONTIKI
+#define DTLS_CID_LENGTH 0
+#else /* WITH_CONTIKI */
+/**
+ * Length of the connection IDs that a server assigns to its peers.
+ * The records of a peer carry its connection ID, so that the peer is
+ * still found when its address changes, e.g. after NAT rebinding. A
+ * value of @c 0 disables the lookup by connection ID, but we still
+ * put the peer's connection ID in our records if it asks for one.
+ */
+#define DTLS_CID_LENGTH 6
+#endif /* WITH_CONTIKI */
+#endif /* DTLS_CID_LENGTH */
+
+#if DTLS_CID_MAX_LENGTH == 0
+#undef DTLS_CID_LENGTH
+#define DTLS_CID_LENGTH 0
+#endif /* DTLS_CID_MAX_LENGTH == 0 */
 
 typedef enum { AES128=0 
 } dtls_crypto_alg;
@@ -56,9 +109,25 @@ typedef enum {
   DTLS_ECDH_CURVE_SECP256R1
 } dtls_ecdh_curve;
 
-/** Crypto context for TLS_PSK_WITH_AES_128_CCM_8 cipher suite. */
+/**
+ * Crypto context for the record protection. The GHASH key is only
+ * set up by dtls_cipher_set_key_gcm() for the GCM suites, the
+ * ChaCha20 key only by dtls_cipher_set_key_chacha20(), which leaves
+ * @c ctx unused.
+ */
 typedef struct {
   rijndael_ctx ctx;		       /**< AES-128 encryption context */
+#if DTLS_GCM || DTLS_CHACHA20
+  union {
+#if DTLS_GCM
+    dtls_ghash_key_t ghash;	       /**< GHASH key for AES-GCM */
+#endif /* DTLS_GCM */
+#if DTLS_CHACHA20
+    /** key for ChaCha20-Poly1305 */
+    unsigned char chacha20[DTLS_CHACHA20_KEY_LENGTH];
+#endif /* DTLS_CHACHA20 */
+  } aead;
+#endif /* DTLS_GCM || DTLS_CHACHA20 */
 } aes128_ccm_t;
 
 typedef struct dtls_cipher_context_t {
@@ -68,6 +137,8 @@ typedef struct dtls_cipher_context_t {
 
 typedef struct {
   uint8 own_eph_priv[32];
+  uint8 own_eph_pub_x[32];
+  uint8 own_eph_pub_y[32];
   uint8 other_eph_pub_x[32];
   uint8 other_eph_pub_y[32];
   uint8 other_pub_x[32];
@@ -86,16 +157,10 @@ typedef struct {
   unsigned char identity[DTLS_PSK_MAX_CLIENT_IDENTITY_LEN];
 } dtls_handshake_parameters_psk_t;
 
-typedef struct {
-    uint64_t cseq;
-    uint64_t bitfield;
-} seqnum_t;
-
 typedef struct {
   dtls_compression_t compression;	/**< compression method */
 
   dtls_cipher_t cipher;		/**< cipher type */
-  uint16_t epoch;	     /**< counter for cipher state changes*/
   uint64_t rseq;	     /**< sequence number of last record sent */
 
   /** 
@@ -105,11 +170,31 @@ typedef struct {
    * access the components of the key block.
    */
   uint8 key_block[MAX_KEYBLOCK_LENGTH];
+
+  /**
+   * Expanded AES key schedules for the local and remote write keys
+   * from key_block. These are set up once with dtls_cipher_set_key()
+   * when the key block is calculated and used for every record of
+   * this epoch afterwards.
+   */
+  aes128_ccm_t write_ctx;	/**< context for the local write key */
+  aes128_ccm_t read_ctx;	/**< context for the remote write key */
+  /** the provider that has set up @c write_ctx and @c read_ctx */
+  const struct dtls_crypto_provider_t *crypto;
   
-  seqnum_t cseq;        /**<sequence number of last record received*/
+  seqnum_t cseq;        /**< the records received, see replay.h */
+  uint16_t epoch;	     /**< counter for cipher state changes*/
+
+#if DTLS_CID_MAX_LENGTH > 0
+  /** the peer's connection ID for our records of this epoch */
+  uint8 write_cid[DTLS_CID_MAX_LENGTH];
+  uint8 write_cid_length;	/**< 0 if records are sent without ID */
+#endif /* DTLS_CID_MAX_LENGTH > 0 */
 } dtls_security_parameters_t;
 
 struct netq_t;
+struct dtls_ecc_job_t;
+struct dtls_crypto_provider_t;
 
 typedef struct {
   union {
@@ -126,6 +211,20 @@ typedef struct {
   dtls_compression_t compression;		/**< compression method */
   dtls_cipher_t cipher;		/**< cipher type */
   unsigned int do_client_auth:1;
+  unsigned int resumed:1;	/**< abbreviated handshake of a cached session */
+  unsigned int ticket:1;	/**< NewSessionTicket is sent in this handshake */
+  uint16_t srtt;		/**< smoothed round-trip time, @c 0 if unknown */
+  uint16_t rttvar;		/**< variation of the round-trip time */
+#if DTLS_STATS
+  dtls_tick_t started;		/**< when the handshake has been started */
+#endif /* DTLS_STATS */
+  uint8 session_id_length;	/**< 0 if the session cannot be resumed */
+  uint8 session_id[DTLS_SESSION_ID_LENGTH]; /**< offered or assigned id */
+#if DTLS_CID_MAX_LENGTH > 0
+  unsigned int cid:1;		/**< connection IDs are used after this handshake */
+  uint8 peer_cid_length;	/**< length of @c peer_cid */
+  uint8 peer_cid[DTLS_CID_MAX_LENGTH]; /**< the ID the peer wants to receive */
+#endif /* DTLS_CID_MAX_LENGTH > 0 */
   union {
 #ifdef DTLS_ECC
     dtls_handshake_parameters_ecdsa_t ecdsa;
@@ -133,7 +232,15 @@ typedef struct {
 #ifdef DTLS_PSK
     dtls_handshake_parameters_psk_t psk;
 #endif /* DTLS_PSK */
+    /** the master secret of a resumed session */
+    uint8 master_secret[DTLS_MASTER_SECRET_LENGTH];
   } keyx;
+  /** the provider for hs_hash, the key exchange and the new keys */
+  const struct dtls_crypto_provider_t *crypto;
+#ifdef DTLS_ECC
+  struct dtls_ecc_job_t *ecc_job; /**< the ECC job the handshake waits for */
+  struct netq_t *deferred;	/**< datagrams received while ecc_job is pending */
+#endif /* DTLS_ECC */
 } dtls_handshake_parameters_t;
 
 /* The following macros provide access to the components of the
@@ -143,40 +250,44 @@ typedef struct {
 #define dtls_kb_server_mac_secret(Param, Role)				\
   (dtls_kb_client_mac_secret(Param, Role) + DTLS_MAC_KEY_LENGTH)
 #define dtls_kb_remote_mac_secret(Param, Role)				\
-  ((Role) == DTLS_SERVER						\
+  (!dtls_role_is_client(Role)						\
    ? dtls_kb_client_mac_secret(Param, Role)				\
    : dtls_kb_server_mac_secret(Param, Role))
 #define dtls_kb_local_mac_secret(Param, Role)				\
-  ((Role) == DTLS_CLIENT						\
+  (dtls_role_is_client(Role)						\
    ? dtls_kb_client_mac_secret(Param, Role)				\
    : dtls_kb_server_mac_secret(Param, Role))
 #define dtls_kb_mac_secret_size(Param, Role) DTLS_MAC_KEY_LENGTH
 #define dtls_kb_client_write_key(Param, Role)				\
   (dtls_kb_server_mac_secret(Param, Role) + DTLS_MAC_KEY_LENGTH)
 #define dtls_kb_server_write_key(Param, Role)				\
-  (dtls_kb_client_write_key(Param, Role) + DTLS_KEY_LENGTH)
+  (dtls_kb_client_write_key(Param, Role) + dtls_kb_key_size(Param, Role))
 #define dtls_kb_remote_write_key(Param, Role)				\
-  ((Role) == DTLS_SERVER						\
+  (!dtls_role_is_client(Role)						\
    ? dtls_kb_client_write_key(Param, Role)				\
    : dtls_kb_server_write_key(Param, Role))
 #define dtls_kb_local_write_key(Param, Role)				\
-  ((Role) == DTLS_CLIENT						\
+  (dtls_role_is_client(Role)						\
    ? dtls_kb_client_write_key(Param, Role)				\
    : dtls_kb_server_write_key(Param, Role))
-#define dtls_kb_key_size(Param, Role) DTLS_KEY_LENGTH
+#define dtls_kb_key_size(Param, Role)					\
+  (dtls_cipher_is_chacha20((Param)->cipher)				\
+   ? DTLS_CHACHA20_KEY_LENGTH : DTLS_KEY_LENGTH)
 #define dtls_kb_client_iv(Param, Role)					\
-  (dtls_kb_server_write_key(Param, Role) + DTLS_KEY_LENGTH)
+  (dtls_kb_server_write_key(Param, Role) + dtls_kb_key_size(Param, Role))
 #define dtls_kb_server_iv(Param, Role)					\
-  (dtls_kb_client_iv(Param, Role) + DTLS_IV_LENGTH)
+  (dtls_kb_client_iv(Param, Role) + dtls_kb_iv_size(Param, Role))
 #define dtls_kb_remote_iv(Param, Role)					\
-  ((Role) == DTLS_SERVER						\
+  (!dtls_role_is_client(Role)						\
    ? dtls_kb_client_iv(Param, Role)					\
    : dtls_kb_server_iv(Param, Role))
 #define dtls_kb_local_iv(Param, Role)					\
-  ((Role) == DTLS_CLIENT						\
+  (dtls_role_is_client(Role)						\
    ? dtls_kb_client_iv(Param, Role)					\
    : dtls_kb_server_iv(Param, Role))
-#define dtls_kb_iv_size(Param, Role) DTLS_IV_LENGTH
+#define dtls_kb_iv_size(Param, Role)					\
+  (dtls_cipher_is_chacha20((Param)->cipher)				\
+   ? DTLS_CHACHA20_IV_LENGTH : DTLS_IV_LENGTH)
 
 #define dtls_kb_size(Param, Role)					\
   (2 * (dtls_kb_mac_secret_size(Param, Role) +				\
@@ -240,6 +351,26 @@ void dtls_mac(dtls_hmac_context_t *hmac_ctx,
 	      const unsigned char *packet, size_t length,
 	      unsigned char *buf);
 
+/**
+ * Returns @c 1 if the software AES of rijndael.c runs on AES
+ * instructions of the CPU, @c 0 if it uses the portable code.
+ */
+int dtls_aes_accelerated(void);
+
+/**
+ * Expands the AES key schedule for the given \p key and stores it in
+ * \p ctx for use with dtls_encrypt() and dtls_decrypt(). This
+ * function returns a value less than zero if \p keylen is not a
+ * valid key size.
+ *
+ * \param ctx    The cipher context to initialize.
+ * \param key    The AES key.
+ * \param keylen The actual size of \p key in bytes.
+ * \return \c 0 on success, less than zero otherwise.
+ */
+int dtls_cipher_set_key(aes128_ccm_t *ctx,
+			const unsigned char *key, size_t keylen);
+
 /** 
  * Encrypts the specified \p src of given \p length, writing the
  * result to \p buf. The cipher implementation may add more data to
@@ -250,7 +381,8 @@ void dtls_mac(dtls_hmac_context_t *hmac_ctx,
  * function returns a value less than zero on error or otherwise the
  * number of bytes written.
  *
- * \param ctx    The cipher context to use.
+ * \param ctx    The cipher context to use, as set up by
+ *               dtls_cipher_set_key().
  * \param src    The data to encrypt.
  * \param length The actual size of of \p src.
  * \param buf    The result buffer. \p src and \p buf must not 
@@ -260,10 +392,10 @@ void dtls_mac(dtls_hmac_context_t *hmac_ctx,
  * \return The number of encrypted bytes on success, less than zero
  *         otherwise. 
  */
-int dtls_encrypt(const unsigned char *src, size_t length,
+int dtls_encrypt(aes128_ccm_t *ctx,
+		 const unsigned char *src, size_t length,
 		 unsigned char *buf,
 		 unsigned char *nounce,
-		 unsigned char *key, size_t keylen,
 		 const unsigned char *aad, size_t aad_length);
 
 /** 
@@ -275,7 +407,8 @@ int dtls_encrypt(const unsigned char *src, size_t length,
  * block have been processed. Unlike dtls_encrypt(), the source
  * and destination of dtls_decrypt() may overlap. 
  * 
- * \param ctx     The cipher context to use.
+ * \param ctx     The cipher context to use, as set up by
+ *                dtls_cipher_set_key().
  * \param src     The buffer to decrypt.
  * \param length  The length of the input buffer. 
  * \param buf     The result buffer.
@@ -284,12 +417,100 @@ int dtls_encrypt(const unsigned char *src, size_t length,
  * \return Less than zero on error, the number of decrypted bytes 
  *         otherwise.
  */
-int dtls_decrypt(const unsigned char *src, size_t length,
+int dtls_decrypt(aes128_ccm_t *ctx,
+		 const unsigned char *src, size_t length,
 		 unsigned char *buf,
 		 unsigned char *nounce,
-		 unsigned char *key, size_t keylen,
 		 const unsigned char *a_data, size_t a_data_length);
 
+#if DTLS_GCM
+/**
+ * Expands the AES key schedule like dtls_cipher_set_key() and derives
+ * the GHASH key for use with dtls_encrypt_gcm() and dtls_decrypt_gcm().
+ */
+int dtls_cipher_set_key_gcm(aes128_ccm_t *ctx,
+			    const unsigned char *key, size_t keylen);
+
+/**
+ * Encrypts \p src with AES-128-GCM like dtls_encrypt() does with
+ * AES-CCM-8, but appends a tag of DTLS_GCM_TAG_LENGTH bytes. The
+ * first DTLS_GCM_NONCE_SIZE bytes of \p nonce are used.
+ */
+int dtls_encrypt_gcm(aes128_ccm_t *ctx,
+		     const unsigned char *src, size_t length,
+		     unsigned char *buf,
+		     unsigned char *nonce,
+		     const unsigned char *aad, size_t aad_length);
+
+/**
+ * Verifies and decrypts \p src with AES-128-GCM, see dtls_decrypt().
+ */
+int dtls_decrypt_gcm(aes128_ccm_t *ctx,
+		     const unsigned char *src, size_t length,
+		     unsigned char *buf,
+		     unsigned char *nonce,
+		     const unsigned char *aad, size_t aad_length);
+#endif /* DTLS_GCM */
+
+#if DTLS_CHACHA20
+/**
+ * Stores the ChaCha20 \p key of DTLS_CHACHA20_KEY_LENGTH bytes in
+ * \p ctx for use with dtls_encrypt_chacha20() and
+ * dtls_decrypt_chacha20().
+ */
+int dtls_cipher_set_key_chacha20(aes128_ccm_t *ctx,
+				 const unsigned char *key, size_t keylen);
+
+/**
+ * Encrypts \p src with ChaCha20-Poly1305 like dtls_encrypt() does with
+ * AES-CCM-8, but appends a tag of DTLS_CHACHAPOLY_TAG_LENGTH bytes.
+ * The \p nonce has DTLS_CHACHA20_IV_LENGTH bytes.
+ */
+int dtls_encrypt_chacha20(aes128_ccm_t *ctx,
+			  const unsigned char *src, size_t length,
+			  unsigned char *buf,
+			  unsigned char *nonce,
+			  const unsigned char *aad, size_t aad_length);
+
+/**
+ * Verifies and decrypts \p src with ChaCha20-Poly1305, see
+ * dtls_decrypt().
+ */
+int dtls_decrypt_chacha20(aes128_ccm_t *ctx,
+			  const unsigned char *src, size_t length,
+			  unsigned char *buf,
+			  unsigned char *nonce,
+			  const unsigned char *aad, size_t aad_length);
+#endif /* DTLS_CHACHA20 */
+
+/**
+ * A record that is encrypted or decrypted in place together with
+ * others by dtls_encrypt_multi() or dtls_decrypt_multi(). The members
+ * have the meaning of the parameters of dtls_encrypt().
+ */
+typedef struct {
+  aes128_ccm_t *ctx;		/**< the cipher context of this record */
+  unsigned char *buf;		/**< the payload, replaced by the result */
+  size_t length;		/**< the actual size of @p buf */
+  unsigned char *nonce;		/**< DTLS_CCM_BLOCKSIZE nonce octets */
+  unsigned char *aad;		/**< the additional authentication data */
+  size_t aad_length;		/**< the actual size of @p aad */
+  int result;			/**< set to the result for this record */
+} dtls_ccm_job_t;
+
+/**
+ * Encrypts the @p count records in @p jobs like dtls_encrypt() does
+ * for each of them, but lets dtls_ccm_encrypt_messages() interleave
+ * the AES operations of different records and keys.
+ */
+void dtls_encrypt_multi(dtls_ccm_job_t *jobs, size_t count);
+
+/**
+ * Decrypts the @p count records in @p jobs like dtls_decrypt(), see
+ * dtls_encrypt_multi().
+ */
+void dtls_decrypt_multi(dtls_ccm_job_t *jobs, size_t count);
+
 /* helper functions */
 
 /** 
@@ -314,20 +535,34 @@ int dtls_ecdh_pre_master_secret(unsigned char *priv_key,
                                 unsigned char *result,
                                 size_t result_len);
 
-void dtls_ecdsa_generate_key(unsigned char *priv_key,
-			     unsigned char *pub_key_x,
-			     unsigned char *pub_key_y,
-			     size_t key_size);
+/**
+ * Generates a random key pair. The private key is taken from
+ * dtls_prng().
+ *
+ * @return @c 0 on success, a value less than zero if dtls_prng()
+ *         has failed.
+ */
+int dtls_ecdsa_generate_key(unsigned char *priv_key,
+			    unsigned char *pub_key_x,
+			    unsigned char *pub_key_y,
+			    size_t key_size);
 
-void dtls_ecdsa_create_sig_hash(const unsigned char *priv_key, size_t key_size,
-				const unsigned char *sign_hash, size_t sign_hash_size,
-				uint32_t point_r[9], uint32_t point_s[9]);
+/**
+ * Signs @p sign_hash with a random nonce from dtls_prng().
+ *
+ * @return @c 0 on success, a value less than zero if dtls_prng()
+ *         has failed. @p point_r and @p point_s must not be used then.
+ */
+int dtls_ecdsa_create_sig_hash(const unsigned char *priv_key, size_t key_size,
+			       const unsigned char *sign_hash, size_t sign_hash_size,
+			       uint32_t point_r[9], uint32_t point_s[9]);
 
-void dtls_ecdsa_create_sig(const unsigned char *priv_key, size_t key_size,
-			   const unsigned char *client_random, size_t client_random_size,
-			   const unsigned char *server_random, size_t server_random_size,
-			   const unsigned char *keyx_params, size_t keyx_params_size,
-			   uint32_t point_r[9], uint32_t point_s[9]);
+/** Like dtls_ecdsa_create_sig_hash() for the hash of the parameters. */
+int dtls_ecdsa_create_sig(const unsigned char *priv_key, size_t key_size,
+			  const unsigned char *client_random, size_t client_random_size,
+			  const unsigned char *server_random, size_t server_random_size,
+			  const unsigned char *keyx_params, size_t keyx_params_size,
+			  uint32_t point_r[9], uint32_t point_s[9]);
 
 int dtls_ecdsa_verify_sig_hash(const unsigned char *pub_key_x,
 			       const unsigned char *pub_key_y, size_t key_size,
@@ -344,12 +579,207 @@ int dtls_ecdsa_verify_sig(const unsigned char *pub_key_x,
 int dtls_ec_key_from_uint32_asn1(const uint32_t *key, size_t key_size,
 				 unsigned char *buf);
 
+/** An ephemeral key pair from dtls_ecdsa_generate_key(). */
+typedef struct {
+  uint8 priv_key[DTLS_EC_KEY_SIZE];
+  uint8 pub_x[DTLS_EC_KEY_SIZE];
+  uint8 pub_y[DTLS_EC_KEY_SIZE];
+} dtls_ecdh_key_pair_t;
 
-dtls_handshake_parameters_t *dtls_handshake_new(void);
+/**
+ * The part of an ECDSA signature that does not depend on the key and
+ * the hash. It must be used for one signature only.
+ */
+typedef struct {
+  uint32_t r[9];		/**< the r value of the signature */
+  uint32_t k_inv[8];		/**< the inverse of the random nonce k */
+} dtls_ecdsa_nonce_t;
+
+/**
+ * Creates a random @p nonce for dtls_ecdsa_create_sig_hash_nonce().
+ *
+ * @return @c 0 on success, a value less than zero if dtls_prng()
+ *         has failed.
+ */
+int dtls_ecdsa_precompute_nonce(dtls_ecdsa_nonce_t *nonce);
+
+/**
+ * Like dtls_ecdsa_create_sig_hash() but uses the precomputed @p nonce
+ * instead of drawing a new one. @p nonce is cleared afterwards.
+ */
+int dtls_ecdsa_create_sig_hash_nonce(const unsigned char *priv_key,
+				      size_t key_size,
+				      const unsigned char *sign_hash,
+				      size_t sign_hash_size,
+				      dtls_ecdsa_nonce_t *nonce,
+				      uint32_t point_r[9], uint32_t point_s[9]);
+
+/**
+ * The cryptographic primitives that are used for a DTLS context. The
+ * members have the same semantics as the software implementations
+ * they are named after, see dtls_crypto_software. An implementation
+ * for a hardware accelerator or secure element may use the storage
+ * of @c aes128_ccm_t and @c dtls_hash_ctx as it likes, as long as
+ * the state remains valid when copied with memcpy().
+ */
+typedef struct dtls_crypto_provider_t {
+  /** see dtls_cipher_set_key() */
+  int (*ccm_set_key)(aes128_ccm_t *ctx,
+		     const unsigned char *key, size_t keylen);
+  /** AES-CCM-8 encryption, see dtls_encrypt() */
+  int (*ccm_seal)(aes128_ccm_t *ctx,
+		  const unsigned char *src, size_t length,
+		  unsigned char *buf, unsigned char *nonce,
+		  const unsigned char *aad, size_t aad_length);
+  /** AES-CCM-8 decryption, see dtls_decrypt() */
+  int (*ccm_open)(aes128_ccm_t *ctx,
+		  const unsigned char *src, size_t length,
+		  unsigned char *buf, unsigned char *nonce,
+		  const unsigned char *aad, size_t aad_length);
+
+  /** SHA-256 for the handshake hash and signatures, see dtls_hash_init() */
+  void (*hash_init)(dtls_hash_ctx *ctx);
+  void (*hash_update)(dtls_hash_ctx *ctx,
+		      const unsigned char *input, size_t len);
+  size_t (*hash_finalize)(unsigned char *buf, dtls_hash_ctx *ctx);
+
+#ifdef DTLS_ECC
+  /** see dtls_ecdsa_generate_key() */
+  int (*ecdsa_generate_key)(unsigned char *priv_key,
+			    unsigned char *pub_key_x,
+			    unsigned char *pub_key_y,
+			    size_t key_size);
+  /** see dtls_ecdh_pre_master_secret() */
+  int (*ecdh)(unsigned char *priv_key,
+	      unsigned char *pub_key_x, unsigned char *pub_key_y,
+	      size_t key_size,
+	      unsigned char *result, size_t result_len);
+  /** see dtls_ecdsa_create_sig_hash() */
+  int (*ecdsa_sign)(const unsigned char *priv_key, size_t key_size,
+		    const unsigned char *sign_hash, size_t sign_hash_size,
+		    uint32_t point_r[9], uint32_t point_s[9]);
+  /** see dtls_ecdsa_verify_sig_hash() */
+  int (*ecdsa_verify)(const unsigned char *pub_key_x,
+		      const unsigned char *pub_key_y, size_t key_size,
+		      const unsigned char *sign_hash, size_t sign_hash_size,
+		      unsigned char *result_r, unsigned char *result_s);
+#endif /* DTLS_ECC */
+
+  /**
+   * Encrypts several records at once, see dtls_encrypt_multi(). If
+   * this is @c NULL, ccm_seal is called for each record.
+   */
+  void (*ccm_seal_multi)(dtls_ccm_job_t *jobs, size_t count);
+  /** Decrypts several records at once, see dtls_decrypt_multi(). */
+  void (*ccm_open_multi)(dtls_ccm_job_t *jobs, size_t count);
+
+#if DTLS_GCM
+  /**
+   * see dtls_cipher_set_key_gcm(). The AES_128_GCM_SHA256 suites are
+   * only offered and accepted if this, gcm_seal and gcm_open are set.
+   */
+  int (*gcm_set_key)(aes128_ccm_t *ctx,
+		     const unsigned char *key, size_t keylen);
+  /** AES-128-GCM encryption, see dtls_encrypt_gcm() */
+  int (*gcm_seal)(aes128_ccm_t *ctx,
+		  const unsigned char *src, size_t length,
+		  unsigned char *buf, unsigned char *nonce,
+		  const unsigned char *aad, size_t aad_length);
+  /** AES-128-GCM decryption, see dtls_decrypt_gcm() */
+  int (*gcm_open)(aes128_ccm_t *ctx,
+		  const unsigned char *src, size_t length,
+		  unsigned char *buf, unsigned char *nonce,
+		  const unsigned char *aad, size_t aad_length);
+#endif /* DTLS_GCM */
+
+#if DTLS_CHACHA20
+  /**
+   * see dtls_cipher_set_key_chacha20(). The CHACHA20_POLY1305_SHA256
+   * suites are only offered and accepted if this, chacha20_seal and
+   * chacha20_open are set.
+   */
+  int (*chacha20_set_key)(aes128_ccm_t *ctx,
+			  const unsigned char *key, size_t keylen);
+  /** ChaCha20-Poly1305 encryption, see dtls_encrypt_chacha20() */
+  int (*chacha20_seal)(aes128_ccm_t *ctx,
+		       const unsigned char *src, size_t length,
+		       unsigned char *buf, unsigned char *nonce,
+		       const unsigned char *aad, size_t aad_length);
+  /** ChaCha20-Poly1305 decryption, see dtls_decrypt_chacha20() */
+  int (*chacha20_open)(aes128_ccm_t *ctx,
+		       const unsigned char *src, size_t length,
+		       unsigned char *buf, unsigned char *nonce,
+		       const unsigned char *aad, size_t aad_length);
+#endif /* DTLS_CHACHA20 */
+} dtls_crypto_provider_t;
+
+/**
+ * The default provider with the software implementations of
+ * rijndael.c, ccm.c, sha2/sha2.c and ecc/ecc.c.
+ */
+extern const dtls_crypto_provider_t dtls_crypto_software;
+
+/** The ECC operations that a handshake can hand out as a job. */
+typedef enum {
+  DTLS_ECC_JOB_SIGN,		/**< sign @c hash with @c priv_key */
+  DTLS_ECC_JOB_VERIFY,		/**< verify @c sig_r, @c sig_s over @c hash
+				 *   with @c pub_x, @c pub_y */
+  DTLS_ECC_JOB_ECDH		/**< shared secret of @c priv_key and
+				 *   @c pub_x, @c pub_y */
+} dtls_ecc_job_type_t;
+
+/**
+ * An ECDSA or ECDH operation of a handshake. The job carries copies
+ * of all inputs, so dtls_ecc_job_run() can be called for it in any
+ * thread while the DTLS context is in use.
+ */
+typedef struct dtls_ecc_job_t {
+  dtls_ecc_job_type_t type;	/**< the operation to execute */
+  dtls_crypto_provider_t crypto; /**< copy of the provider of the context */
+  session_t session;		/**< the peer that waits for the result */
+  uint8 priv_key[DTLS_EC_KEY_SIZE];
+  uint8 pub_x[DTLS_EC_KEY_SIZE];
+  uint8 pub_y[DTLS_EC_KEY_SIZE];
+  uint8 hash[DTLS_HMAC_DIGEST_SIZE];
+  uint8 sig_r[DTLS_EC_KEY_SIZE]; /**< signature to verify */
+  uint8 sig_s[DTLS_EC_KEY_SIZE];
+  uint32_t point_r[9];		/**< signature created by a SIGN job */
+  uint32_t point_s[9];
+  dtls_ecdsa_nonce_t nonce;	/**< precomputed nonce for a SIGN job */
+  int has_nonce;		/**< @c 1 if @c nonce is to be used */
+  uint8 secret[DTLS_EC_KEY_SIZE]; /**< result of an ECDH job */
+  int result;			/**< @c 0 on success, less than zero on error */
+  int step;			/**< internal: how the handshake continues */
+} dtls_ecc_job_t;
+
+/** Executes @p job and stores its outcome in @p job->result. */
+void dtls_ecc_job_run(dtls_ecc_job_t *job);
+
+/**
+ * Allocates a job from @p pools, or with malloc() if @p pools is
+ * @c NULL.
+ */
+dtls_ecc_job_t *dtls_ecc_job_new(dtls_pools_t *pools);
+
+/** Clears @p job, which holds key material, and releases it. */
+void dtls_ecc_job_free(dtls_ecc_job_t *job);
+
+
+/**
+ * Creates new handshake parameters from @p pools that use @p crypto
+ * for the handshake hash and the key exchange. If @p pools is
+ * @c NULL, the parameters are allocated with malloc().
+ */
+dtls_handshake_parameters_t *
+dtls_handshake_new(dtls_pools_t *pools, const dtls_crypto_provider_t *crypto);
 
 void dtls_handshake_free(dtls_handshake_parameters_t *handshake);
 
-dtls_security_parameters_t *dtls_security_new(void);
+/**
+ * Creates new security parameters from @p pools, or with malloc() if
+ * @p pools is @c NULL.
+ */
+dtls_security_parameters_t *dtls_security_new(dtls_pools_t *pools);
 
 void dtls_security_free(dtls_security_parameters_t *security);
 void crypto_init(void);
@@ -27,6 +27,7 @@
 #endif
 #ifndef WITH_CONTIKI
 #include <stdlib.h>
+#include <unistd.h>
 #include "global.h"
 #endif /* WITH_CONTIKI */
 #ifdef HAVE_INTTYPES_H
@@ -69,13 +70,14 @@
 #define dtls_get_sequence_number(H) dtls_uint48_to_ulong((H)->sequence_number)
 #define dtls_get_fragment_length(H) dtls_uint24_to_int((H)->fragment_length)
 
+/* Peers are looked up by their dtls_peer_key_t, see dtls_session_key(). */
 #ifdef DTLS_PEERS_NOHASH
-#define FIND_PEER(head,sess,out)                                \
+#define FIND_PEER(head,key,hashv,out)                           \
   do {                                                          \
     dtls_peer_t * tmp;                                          \
     (out) = NULL;                                               \
     LL_FOREACH((head), tmp) {                                   \
-      if (dtls_session_equals(&tmp->session, (sess))) {         \
+      if (memcmp(&tmp->key, (key), sizeof(dtls_peer_key_t)) == 0) { \
         (out) = tmp;                                            \
         break;                                                  \
       }                                                         \
@@ -85,28 +87,36 @@
   if ((head) != NULL && (delptr) != NULL) {	\
     LL_DELETE(head,delptr);                     \
   }
-#define ADD_PEER(head,sess,add)                 \
-  LL_PREPEND(ctx->peers, peer);
+#define ADD_PEER(head,add)                      \
+  LL_PREPEND(head, add);
+#define PEER_HASH(head,key) 0
 #else /* DTLS_PEERS_NOHASH */
-#define FIND_PEER(head,sess,out)		\
-  HASH_FIND(hh,head,sess,sizeof(session_t),out)
-#define ADD_PEER(head,sess,add)                 \
-  HASH_ADD(hh,head,sess,sizeof(session_t),add)
+#define FIND_PEER(head,key,hashv,out)		\
+  (out) = dtls_peer_table_find(&(head),(key),(hashv))
 #define DEL_PEER(head,delptr)                   \
-  if ((head) != NULL && (delptr) != NULL) {	\
-    HASH_DELETE(hh,head,delptr);		\
+  if ((delptr) != NULL) {			\
+    dtls_peer_table_remove(&(head),(delptr));	\
+  }
+#define ADD_PEER(head,add)			\
+  if (dtls_peer_table_add(&(head),(add)) < 0) {	\
+    dtls_warn("peer table is full\n");		\
+    return -1;					\
   }
+#define PEER_HASH(head,key) dtls_peer_key_hash((key),(head).secret)
 #endif /* DTLS_PEERS_NOHASH */
 
 #define DTLS_RH_LENGTH sizeof(dtls_record_header_t)
 #define DTLS_HS_LENGTH sizeof(dtls_handshake_header_t)
 #define DTLS_CH_LENGTH sizeof(dtls_client_hello_t) /* no variable length fields! */
 #define DTLS_COOKIE_LENGTH_MAX 32
-#define DTLS_CH_LENGTH_MAX sizeof(dtls_client_hello_t) + DTLS_COOKIE_LENGTH_MAX + 12 + 26
+#define DTLS_CH_LENGTH_MAX sizeof(dtls_client_hello_t) + DTLS_SESSION_ID_LENGTH + DTLS_COOKIE_LENGTH_MAX + 12 + 26
 #define DTLS_HV_LENGTH sizeof(dtls_hello_verify_t)
-#define DTLS_SH_LENGTH (2 + DTLS_RANDOM_LENGTH + 1 + 2 + 1)
+#define DTLS_SH_LENGTH (2 + DTLS_RANDOM_LENGTH + 1 + DTLS_SESSION_ID_LENGTH + 2 + 1)
 #define DTLS_CE_LENGTH (3 + 3 + 27 + DTLS_EC_KEY_SIZE + DTLS_EC_KEY_SIZE)
 #define DTLS_SKEXEC_LENGTH (1 + 2 + 1 + 1 + DTLS_EC_KEY_SIZE + DTLS_EC_KEY_SIZE + 1 + 1 + 2 + 70)
+/* DER shortens signature integers with leading zero bytes */
+#define DTLS_ECDSA_SIG_LENGTH_MIN (1 + 1 + 2 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1)
+#define DTLS_SKEXEC_LENGTH_MIN (1 + 2 + 1 + 1 + DTLS_EC_KEY_SIZE + DTLS_EC_KEY_SIZE + DTLS_ECDSA_SIG_LENGTH_MIN)
 #define DTLS_SKEXECPSK_LENGTH_MIN 2
 #define DTLS_SKEXECPSK_LENGTH_MAX 2 + DTLS_PSK_MAX_CLIENT_IDENTITY_LEN
 #define DTLS_CKXPSK_LENGTH_MIN 2
@@ -180,12 +190,12 @@ free_context(dtls_context_t *context) {
 
 static inline dtls_context_t *
 malloc_context(void) {
-  return (dtls_context_t *)malloc(sizeof(dtls_context_t));
+  return (dtls_context_t *)dtls_pool_alloc(NULL, sizeof(dtls_context_t));
 }
 
 static inline void
 free_context(dtls_context_t *context) {
-  free(context);
+  dtls_pool_free(context);
 }
 #endif
 
@@ -207,6 +217,22 @@ dtls_init(void) {
    ? (Context)->h->which((Context), ##__VA_ARGS__)			\
    : -1)
 
+#if DTLS_STATS
+#define DTLS_STATS_ADD(Context, Counter, N) ((Context)->stats.Counter += (N))
+#else /* DTLS_STATS */
+#define DTLS_STATS_ADD(Context, Counter, N) ((void)0)
+#endif /* DTLS_STATS */
+
+#if DTLS_TRACE
+#define dtls_trace(Context, Point, End)					\
+  do {									\
+    if ((Context)->h && (Context)->h->trace)				\
+      (Context)->h->trace((Context), (Point), (End));			\
+  } while (0)
+#else /* DTLS_TRACE */
+#define dtls_trace(Context, Point, End) ((void)0)
+#endif /* DTLS_TRACE */
+
 static int
 dtls_send_multi(dtls_context_t *ctx, dtls_peer_t *peer,
 		dtls_security_parameters_t *security , session_t *session,
@@ -230,7 +256,10 @@ dtls_send_multi(dtls_context_t *ctx, dtls_peer_t *peer,
 static int
 dtls_send(dtls_context_t *ctx, dtls_peer_t *peer, unsigned char type,
 	  uint8 *buf, size_t buflen) {
-  return dtls_send_multi(ctx, peer, dtls_security_params(peer), &peer->session,
+  session_t session;
+
+  return dtls_send_multi(ctx, peer, dtls_security_params(peer),
+			 dtls_peer_session(peer, &session),
 			 type, &buf, &buflen, 1);
 }
 
@@ -238,12 +267,402 @@ dtls_send(dtls_context_t *ctx, dtls_peer_t *peer, unsigned char type,
  * Stops ongoing retransmissions of handshake messages for @p peer.
  */
 static void dtls_stop_retransmission(dtls_context_t *context, dtls_peer_t *peer);
+static clock_time_t dtls_retransmit_timeout(dtls_context_t *context,
+					    dtls_peer_t *peer);
+static void dtls_update_rtt(dtls_peer_t *peer);
+
+#ifdef DTLS_ECC
+/** The handshake steps that are continued after an ECC job. */
+enum {
+  DTLS_ECC_STEP_SERVER_KEY_EXCHANGE, /**< sign the ServerKeyExchange */
+  DTLS_ECC_STEP_CERTIFICATE_VERIFY,  /**< sign the client's CertificateVerify */
+  DTLS_ECC_STEP_VERIFY,		     /**< check a signature of the other peer */
+  DTLS_ECC_STEP_KEY_BLOCK	     /**< ECDH for the pre-master secret */
+};
+
+static int dtls_ecc_job_finish(dtls_context_t *ctx, dtls_peer_t *peer,
+			       dtls_ecc_job_t *job, int resumed);
+
+/** Returns @c 1 if the handshake of @p peer waits for an ECC job. */
+static inline int
+dtls_ecc_pending(const dtls_peer_t *peer) {
+  return peer && peer->handshake_params && peer->handshake_params->ecc_job;
+}
+
+#if DTLS_ECC_POOL_SIZE > 0
+/**
+ * Discards the precomputed keys and nonces of @p ctx in the child
+ * after fork(). Parent and child would otherwise sign with the same
+ * nonce, which reveals the private key.
+ */
+static void
+dtls_ecc_pool_check(dtls_context_t *ctx) {
+#ifndef WITH_CONTIKI
+  pid_t pid = getpid();
+
+  if (ctx->ecc_pid != pid) {
+    memset(ctx->ecc_keys, 0, sizeof(ctx->ecc_keys));
+    memset(ctx->ecc_nonces, 0, sizeof(ctx->ecc_nonces));
+    ctx->ecc_keys_len = ctx->ecc_nonces_len = 0;
+    ctx->ecc_pid = pid;
+  }
+#else /* WITH_CONTIKI */
+  (void)ctx;
+#endif /* WITH_CONTIKI */
+}
+#endif /* DTLS_ECC_POOL_SIZE > 0 */
+
+/**
+ * Returns an empty job of @p type for @p peer. When an ecc_job
+ * handler is set, the job is allocated so that it can outlive the
+ * current call, otherwise @p local is used.
+ */
+static dtls_ecc_job_t *
+dtls_ecc_job_start(dtls_context_t *ctx, dtls_peer_t *peer,
+		   dtls_ecc_job_t *local, dtls_ecc_job_type_t type, int step) {
+  dtls_ecc_job_t *job = NULL;
+
+  if (ctx->h && ctx->h->ecc_job)
+    job = dtls_ecc_job_new(&ctx->pools);
+  if (!job) {
+    job = local;
+    memset(job, 0, sizeof(*job));
+  }
+
+  job->type = type;
+  job->step = step;
+  job->crypto = *peer->handshake_params->crypto;
+  dtls_peer_session(peer, &job->session);
+
+#if DTLS_ECC_POOL_SIZE > 0
+  dtls_ecc_pool_check(ctx);
+  if (type == DTLS_ECC_JOB_SIGN && ctx->ecc_nonces_len &&
+      job->crypto.ecdsa_sign == dtls_ecdsa_create_sig_hash) {
+    ctx->ecc_nonces_len--;
+    job->nonce = ctx->ecc_nonces[ctx->ecc_nonces_len];
+    memset(&ctx->ecc_nonces[ctx->ecc_nonces_len], 0, sizeof(dtls_ecdsa_nonce_t));
+    job->has_nonce = 1;
+  }
+#endif /* DTLS_ECC_POOL_SIZE > 0 */
+  return job;
+}
+
+/**
+ * Sets the ephemeral key of @p handshake from the pool of @p ctx
+ * or generates a new one and copies the public key to @p pub_x and
+ * @p pub_y.
+ *
+ * @return @c 0 on success, a value less than zero if no key could be
+ *         generated.
+ */
+static int
+dtls_ecc_generate_key(dtls_context_t *ctx,
+		      dtls_handshake_parameters_t *handshake,
+		      uint8 *pub_x, uint8 *pub_y) {
+  int res;
+#if DTLS_ECC_POOL_SIZE > 0
+  dtls_ecdh_key_pair_t *key;
+
+  dtls_ecc_pool_check(ctx);
+  if (ctx->ecc_keys_len) {
+    key = &ctx->ecc_keys[--ctx->ecc_keys_len];
+    memcpy(handshake->keyx.ecdsa.own_eph_priv, key->priv_key, DTLS_EC_KEY_SIZE);
+    memcpy(pub_x, key->pub_x, DTLS_EC_KEY_SIZE);
+    memcpy(pub_y, key->pub_y, DTLS_EC_KEY_SIZE);
+    memset(key, 0, sizeof(*key));
+    return 0;
+  }
+#else /* DTLS_ECC_POOL_SIZE > 0 */
+  (void)ctx;
+#endif /* DTLS_ECC_POOL_SIZE > 0 */
+
+  dtls_trace(ctx, DTLS_TRACE_ECC, 0);
+  res = handshake->crypto->ecdsa_generate_key(handshake->keyx.ecdsa.own_eph_priv,
+					      pub_x, pub_y, DTLS_EC_KEY_SIZE);
+  dtls_trace(ctx, DTLS_TRACE_ECC, 1);
+  return res;
+}
+
+int
+dtls_ecc_precompute(dtls_context_t *ctx, int max) {
+#if DTLS_ECC_POOL_SIZE > 0
+  dtls_ecdh_key_pair_t *key;
+  int nonces;
+
+  /* nonces are only of use for the software implementation */
+  nonces = ctx->crypto.ecdsa_sign == dtls_ecdsa_create_sig_hash;
+  dtls_ecc_pool_check(ctx);
+
+  for (; max > 0; max--) {
+    if (ctx->ecc_keys_len < DTLS_ECC_POOL_SIZE &&
+	(!nonces || ctx->ecc_keys_len <= ctx->ecc_nonces_len ||
+	 ctx->ecc_nonces_len == DTLS_ECC_POOL_SIZE)) {
+      key = &ctx->ecc_keys[ctx->ecc_keys_len];
+      if (ctx->crypto.ecdsa_generate_key(key->priv_key, key->pub_x,
+					 key->pub_y, DTLS_EC_KEY_SIZE) < 0)
+	break;
+      ctx->ecc_keys_len++;
+    } else if (nonces && ctx->ecc_nonces_len < DTLS_ECC_POOL_SIZE) {
+      if (dtls_ecdsa_precompute_nonce(&ctx->ecc_nonces[ctx->ecc_nonces_len]) < 0)
+	break;
+      ctx->ecc_nonces_len++;
+    } else {
+      break;
+    }
+  }
+
+  return (DTLS_ECC_POOL_SIZE - ctx->ecc_keys_len) +
+    (nonces ? DTLS_ECC_POOL_SIZE - ctx->ecc_nonces_len : 0);
+#else /* DTLS_ECC_POOL_SIZE > 0 */
+  (void)ctx;
+  (void)max;
+  return 0;
+#endif /* DTLS_ECC_POOL_SIZE > 0 */
+}
+
+/**
+ * Hands @p job to the ecc_job handler. If there is no handler or the
+ * job is refused, it is executed and finished right away. The result
+ * is the outcome of dtls_ecc_job_finish() in this case or @c 0 if the
+ * handshake has to wait for dtls_ecc_job_complete(). A finished job
+ * is cleared, also when it is @p local.
+ */
+static int
+dtls_ecc_job_dispatch(dtls_context_t *ctx, dtls_peer_t *peer,
+		      dtls_ecc_job_t *job, dtls_ecc_job_t *local) {
+  int res;
+
+  if (job != local) {
+    peer->handshake_params->ecc_job = job;
+    if (ctx->h->ecc_job(ctx, job) >= 0)
+      return 0;
+    peer->handshake_params->ecc_job = NULL;
+  }
+
+  dtls_trace(ctx, DTLS_TRACE_ECC, 0);
+  dtls_ecc_job_run(job);
+  dtls_trace(ctx, DTLS_TRACE_ECC, 1);
+  res = dtls_ecc_job_finish(ctx, peer, job, 0);
+  if (job != local)
+    dtls_ecc_job_free(job);
+  else
+    memset(local, 0, sizeof(*local));
+  return res;
+}
+
+/** The number of datagrams that are queued for a pending ECC job. */
+#ifndef DTLS_ECC_MAX_DEFERRED
+#define DTLS_ECC_MAX_DEFERRED 4
+#endif
+
+/**
+ * Queues the remaining records @p msg of a datagram from @p peer
+ * until its ECC job is completed. Datagrams beyond
+ * DTLS_ECC_MAX_DEFERRED are dropped, the peer will retransmit them.
+ */
+static int
+dtls_ecc_defer(dtls_peer_t *peer, uint8 *msg, int msglen) {
+  dtls_handshake_parameters_t *handshake = peer->handshake_params;
+  netq_t *node;
+  int count = 0;
+
+  for (node = netq_head(&handshake->deferred); node; node = netq_next(node))
+    count++;
+
+  if (count >= DTLS_ECC_MAX_DEFERRED) {
+    dtls_warn("too many records while waiting for an ecc job, drop\n");
+    return 0;
+  }
+
+  node = netq_node_new(peer->pools, msglen);
+  if (!node) {
+    dtls_warn("cannot queue record while waiting for an ecc job\n");
+    return 0;
+  }
+
+  memcpy(node->data, msg, msglen);
+  node->length = msglen;
+  node->peer = peer;
+  netq_insert_node(&handshake->deferred, node);
+  return 0;
+}
+#else /* DTLS_ECC */
+#define dtls_ecc_pending(peer) 0
+#endif /* DTLS_ECC */
+
+/**
+ * Returns the peer with the normalized address @p key from
+ * dtls_session_key() and its hash value @p hash from PEER_HASH(), or
+ * @c NULL if not found.
+ */
+static inline dtls_peer_t *
+dtls_get_peer_by_key(const dtls_context_t *ctx,
+		     const dtls_peer_key_t *key, uint64_t hash) {
+  dtls_peer_t *p;
+  (void)hash;
+  FIND_PEER(ctx->peers, key, hash, p);
+  return p;
+}
 
 dtls_peer_t *
 dtls_get_peer(const dtls_context_t *ctx, const session_t *session) {
+  dtls_peer_key_t key;
+  uint64_t hash;
+
+  dtls_session_key(session, &key);
+  hash = PEER_HASH(ctx->peers, &key);
+  return dtls_get_peer_by_key(ctx, &key, hash);
+}
+
+#if DTLS_CID_LENGTH > 0
+/**
+ * Returns the peer that we have assigned the connection ID @p cid of
+ * DTLS_CID_LENGTH bytes to, or @c NULL if not found.
+ */
+static dtls_peer_t *
+dtls_get_peer_by_cid(const dtls_context_t *ctx, const uint8 *cid) {
+#ifdef DTLS_PEERS_NOHASH
   dtls_peer_t *p;
-  FIND_PEER(ctx->peers, session, p);
-  return p;
+
+  LL_FOREACH(ctx->peers, p) {
+    if (p->has_cid && memcmp(p->cid, cid, DTLS_CID_LENGTH) == 0)
+      return p;
+  }
+  return NULL;
+#else /* DTLS_PEERS_NOHASH */
+  return dtls_peer_table_find(&ctx->cid_peers, cid,
+			      dtls_cid_hash(cid, ctx->cid_peers.secret));
+#endif /* DTLS_PEERS_NOHASH */
+}
+
+/**
+ * Assigns a random connection ID to @p peer that is not used by any
+ * other peer. This function returns @c 0 on success, or a negative
+ * value if no connection ID could be assigned.
+ */
+static int
+dtls_assign_cid(dtls_context_t *ctx, dtls_peer_t *peer) {
+  int tries;
+
+  if (peer->has_cid)
+    return 0;
+
+  for (tries = 0; tries < 8; tries++) {
+    if (!dtls_prng(peer->cid, DTLS_CID_LENGTH))
+      return -1;
+    if (ctx->cid_prefix >= 0)
+      peer->cid[0] = ctx->cid_prefix;
+    if (!dtls_get_peer_by_cid(ctx, peer->cid)) {
+#ifndef DTLS_PEERS_NOHASH
+      if (dtls_peer_table_add(&ctx->cid_peers, peer) < 0)
+	return -1;
+#endif /* DTLS_PEERS_NOHASH */
+      peer->has_cid = 1;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/** Checks if @p session is the current address of @p peer. */
+static inline int
+dtls_peer_has_session(const dtls_peer_t *peer, const session_t *session) {
+  dtls_peer_key_t key;
+
+  dtls_session_key(session, &key);
+  return memcmp(&key, &peer->key, sizeof(dtls_peer_key_t)) == 0;
+}
+
+/**
+ * Moves @p peer to the address of @p session after an authenticated
+ * record with connection ID has been received from there. The peer
+ * keeps its address if another peer uses the new one.
+ */
+static void
+dtls_migrate_peer(dtls_context_t *ctx, dtls_peer_t *peer,
+		  const session_t *session) {
+  dtls_peer_key_t key;
+  uint64_t hash;
+
+  dtls_session_key(session, &key);
+  hash = PEER_HASH(ctx->peers, &key);
+  if (dtls_get_peer_by_key(ctx, &key, hash))
+    return;
+
+  DEL_PEER(ctx->peers, peer);
+  ctx->peer_gen++;
+  dtls_peer_set_session(peer, session);
+  /* cannot fail as the entry for the old address has been freed */
+#ifdef DTLS_PEERS_NOHASH
+  ADD_PEER(ctx->peers, peer);
+#else /* DTLS_PEERS_NOHASH */
+  dtls_peer_table_add(&ctx->peers, peer);
+#endif /* DTLS_PEERS_NOHASH */
+  dtls_dsrv_log_addr(DTLS_LOG_DEBUG, "peer moved to", session);
+}
+#endif /* DTLS_CID_LENGTH > 0 */
+
+/** Removes @p peer from its list of active peers in @p ctx. */
+static inline void
+dtls_lru_remove(dtls_context_t *ctx, dtls_peer_t *peer) {
+  if (peer->lru_prev) {
+    DL_DELETE2(ctx->lru[peer->half_open], peer, lru_prev, lru_next);
+    ctx->lru_count[peer->half_open]--;
+    peer->lru_prev = peer->lru_next = NULL;
+  }
+}
+
+/**
+ * Records that @p peer is active and moves it to the front of the
+ * list of @p ctx that matches its state.
+ */
+static void
+dtls_peer_touch(dtls_context_t *ctx, dtls_peer_t *peer) {
+  dtls_tick_t now;
+
+  dtls_ticks(&now);
+  peer->last_seen = now;
+
+  dtls_lru_remove(ctx, peer);
+  peer->half_open = peer->state != DTLS_STATE_CONNECTED;
+  DL_PREPEND2(ctx->lru[peer->half_open], peer, lru_prev, lru_next);
+  ctx->lru_count[peer->half_open]++;
+}
+
+/**
+ * Removes @p peer from the lookup structures of @p ctx.
+ */
+static void
+dtls_unlink_peer(dtls_context_t *ctx, dtls_peer_t *peer) {
+  if (peer)
+    dtls_lru_remove(ctx, peer);
+  DEL_PEER(ctx->peers, peer);
+  ctx->peer_gen++;
+#if DTLS_CID_LENGTH > 0 && !defined(DTLS_PEERS_NOHASH)
+  if (peer && peer->has_cid)
+    dtls_peer_table_remove(&ctx->cid_peers, peer);
+#endif /* DTLS_CID_LENGTH > 0 && !DTLS_PEERS_NOHASH */
+}
+
+/** Returns the maximum size of datagrams that are sent to @p peer. */
+static inline size_t
+dtls_peer_pmtu(const dtls_peer_t *peer) {
+  return peer ? peer->pmtu : DTLS_DEFAULT_PMTU;
+}
+
+int
+dtls_set_pmtu(dtls_context_t *ctx, const session_t *session, size_t pmtu) {
+  dtls_peer_t *peer = dtls_get_peer(ctx, session);
+
+  /* there must be room for at least one byte of a handshake fragment,
+   * also in records with the longest connection ID */
+  if (!peer || pmtu > DTLS_MAX_BUF ||
+      pmtu <= DTLS_RECORD_HEADROOM + DTLS_RECORD_CID_ROOM
+	      + DTLS_RECORD_TAILROOM + DTLS_HS_LENGTH)
+    return -1;
+
+  peer->pmtu = pmtu;
+  return 0;
 }
 
 /**
@@ -253,7 +672,9 @@ dtls_get_peer(const dtls_context_t *ctx, const session_t *session) {
  */
 static int
 dtls_add_peer(dtls_context_t *ctx, dtls_peer_t *peer) {
-  ADD_PEER(ctx->peers, session, peer);
+  ADD_PEER(ctx->peers, peer);
+  ctx->peer_gen++;
+  dtls_peer_touch(ctx, peer);
   return 0;
 }
 
@@ -277,7 +698,9 @@ dtls_write(struct dtls_context_t *ctx,
     if (peer->state != DTLS_STATE_CONNECTED) {
       return 0;
     } else {
-      return dtls_send(ctx, peer, DTLS_CT_APPLICATION_DATA, buf, len);
+      int res = dtls_send(ctx, peer, DTLS_CT_APPLICATION_DATA, buf, len);
+      dtls_flush(ctx);
+      return res;
     }
   }
 }
@@ -307,13 +730,95 @@ dtls_get_cookie(uint8 *msg, size_t msglen, uint8 **cookie) {
   return dtls_alert_fatal_create(DTLS_ALERT_HANDSHAKE_FAILURE);
 }
 
+/**
+ * Replaces the cookie secret of @p ctx with a random value at @p now.
+ * The HMAC state of the previous secret is kept to accept the
+ * cookies that have been created shortly before.
+ *
+ * @return @c 0 on success, a value less than zero on error.
+ */
+static int
+dtls_rotate_cookie_secret(dtls_context_t *ctx, clock_time_t now) {
+  unsigned char secret[DTLS_COOKIE_SECRET_LENGTH];
+
+  if (!dtls_prng(secret, sizeof(secret)))
+    return -1;
+
+  ctx->cookie_hmac[1] = ctx->cookie_hmac[0];
+  dtls_hmac_init(&ctx->cookie_hmac[0], secret, sizeof(secret));
+  memset(secret, 0, sizeof(secret));
+  ctx->cookie_secret_age = now;
+  return 0;
+}
+
+/**
+ * Checks the cookie secret of @p ctx and replaces it when it is older
+ * than DTLS_COOKIE_SECRET_LIFETIME.
+ */
+static void
+dtls_check_cookie_secret(dtls_context_t *ctx) {
+  dtls_tick_t now;
+
+  dtls_ticks(&now);
+  if (now - ctx->cookie_secret_age
+      >= (clock_time_t)DTLS_COOKIE_SECRET_LIFETIME * CLOCK_SECOND
+      && dtls_rotate_cookie_secret(ctx, now) < 0)
+    dtls_warn("cannot renew the cookie secret\n");
+}
+
+/**
+ * Locates the parts of the Client Hello @p msg that are covered by
+ * its cookie: the first @p head bytes after the handshake header,
+ * which end with the session id, and the bytes from offset @p tail
+ * to the end of the message, which follow the cookie.
+ *
+ * @return The length of the message body, or a value less than zero
+ *         if @p msg is malformed.
+ */
+static int
+dtls_cookie_parts(uint8 *msg, size_t msglen, size_t *head, size_t *tail) {
+  size_t len, e;
+
+  if (msglen < DTLS_HS_LENGTH)
+    return dtls_alert_fatal_create(DTLS_ALERT_HANDSHAKE_FAILURE);
+  len = dtls_get_fragment_length(DTLS_HANDSHAKE_HEADER(msg));
+  if (len > msglen - DTLS_HS_LENGTH)
+    return dtls_alert_fatal_create(DTLS_ALERT_HANDSHAKE_FAILURE);
+
+  /* the beginning of the Client Hello up to and including the
+     session id */
+  e = sizeof(dtls_client_hello_t);
+  if (e >= len)
+    return dtls_alert_fatal_create(DTLS_ALERT_HANDSHAKE_FAILURE);
+  e += (*(msg + DTLS_HS_LENGTH + e) & 0xff) + sizeof(uint8);
+  if (e >= len)
+    return dtls_alert_fatal_create(DTLS_ALERT_HANDSHAKE_FAILURE);
+  *head = e;
+
+  /* skip cookie bytes and length byte */
+  e += *(uint8 *)(msg + DTLS_HS_LENGTH + e) & 0xff;
+  e += sizeof(uint8);
+  if (e > len)
+    return dtls_alert_fatal_create(DTLS_ALERT_HANDSHAKE_FAILURE);
+  *tail = e;
+  return len;
+}
+
+/**
+ * Creates the cookie for the Client Hello @p msg from @p session,
+ * continuing the HMAC state @p key that has been initialized with a
+ * cookie secret. As @p key already holds the padded secret, only the
+ * session and the Client Hello are hashed. The session is hashed in
+ * the form of dtls_session_key(), which leaves out the padding of
+ * the socket address.
+ */
 static int
-dtls_create_cookie(dtls_context_t *ctx, 
+dtls_create_cookie(const dtls_hmac_context_t *key,
 		   session_t *session,
 		   uint8 *msg, size_t msglen,
 		   uint8 *cookie, int *clen) {
   unsigned char buf[DTLS_HMAC_MAX];
-  size_t e;
+  size_t head, tail;
   int len;
 
   /* create cookie with HMAC-SHA256 over:
@@ -328,34 +833,22 @@ dtls_create_cookie(dtls_context_t *ctx,
 
   /* We use our own buffer as hmac_context instead of a dynamic buffer
    * created by dtls_hmac_new() to separate storage space for cookie
-   * creation from storage that is used in real sessions. Note that
-   * the buffer size must fit with the default hash algorithm (see
-   * implementation of dtls_hmac_context_new()). */
+   * creation from storage that is used in real sessions, and so that
+   * nothing is allocated before a valid cookie has been received. */
 
   dtls_hmac_context_t hmac_context;
-  dtls_hmac_init(&hmac_context, ctx->cookie_secret, DTLS_COOKIE_SECRET_LENGTH);
+  dtls_peer_key_t addr;
 
-  dtls_hmac_update(&hmac_context, 
-		   (unsigned char *)&session->addr, session->size);
-
-  /* feed in the beginning of the Client Hello up to and including the
-     session id */
-  e = sizeof(dtls_client_hello_t);
-  e += (*(msg + DTLS_HS_LENGTH + e) & 0xff) + sizeof(uint8);
-  if (e + DTLS_HS_LENGTH > msglen)
-    return dtls_alert_fatal_create(DTLS_ALERT_HANDSHAKE_FAILURE);
+  len = dtls_cookie_parts(msg, msglen, &head, &tail);
+  if (len < 0)
+    return len;
 
-  dtls_hmac_update(&hmac_context, msg + DTLS_HS_LENGTH, e);
-  
-  /* skip cookie bytes and length byte */
-  e += *(uint8 *)(msg + DTLS_HS_LENGTH + e) & 0xff;
-  e += sizeof(uint8);
-  if (e + DTLS_HS_LENGTH > msglen)
-    return dtls_alert_fatal_create(DTLS_ALERT_HANDSHAKE_FAILURE);
+  dtls_hmac_clone(&hmac_context, key);
 
-  dtls_hmac_update(&hmac_context, 
-		   msg + DTLS_HS_LENGTH + e,
-		   dtls_get_fragment_length(DTLS_HANDSHAKE_HEADER(msg)) - e);
+  dtls_session_key(session, &addr);
+  dtls_hmac_update(&hmac_context, (unsigned char *)&addr, sizeof(addr));
+  dtls_hmac_update(&hmac_context, msg + DTLS_HS_LENGTH, head);
+  dtls_hmac_update(&hmac_context, msg + DTLS_HS_LENGTH + tail, len - tail);
 
   len = dtls_hmac_finalize(&hmac_context, buf);
 
@@ -368,6 +861,43 @@ dtls_create_cookie(dtls_context_t *ctx,
   return 0;
 }
 
+#if DTLS_COOKIE_BATCH_SIZE > 0
+/**
+ * The cookies that dtls_handle_messages() has computed in advance
+ * for the Client Hellos of a burst, see dtls_prepare_cookies().
+ */
+typedef struct dtls_cookie_batch_t {
+  clock_time_t secret_age;	/**< the secret the cookies were made with */
+  size_t count;			/**< number of cookies */
+  const uint8 *hello[DTLS_MESSAGE_BATCH_SIZE]; /**< the Client Hellos */
+  uint8 cookie[DTLS_MESSAGE_BATCH_SIZE][DTLS_COOKIE_LENGTH];
+} dtls_cookie_batch_t;
+
+/**
+ * Copies the cookie that has been computed in advance for the Client
+ * Hello @p msg to @p cookie.
+ *
+ * @return @c 1 if the cookie has been found, @c 0 otherwise.
+ */
+static int
+dtls_cookie_from_batch(const dtls_context_t *ctx, const uint8 *msg,
+		       uint8 *cookie) {
+  const dtls_cookie_batch_t *batch = ctx->cookies;
+  size_t i;
+
+  if (!batch || batch->secret_age != ctx->cookie_secret_age)
+    return 0;
+
+  for (i = 0; i < batch->count; i++) {
+    if (batch->hello[i] == msg) {
+      memcpy(cookie, batch->cookie[i], DTLS_COOKIE_LENGTH);
+      return 1;
+    }
+  }
+  return 0;
+}
+#endif /* DTLS_COOKIE_BATCH_SIZE > 0 */
+
 #ifdef DTLS_CHECK_CONTENTTYPE
 /* used to check if a received datagram contains a DTLS message */
 static char const content_types[] = { 
@@ -375,10 +905,96 @@ static char const content_types[] = {
   DTLS_CT_ALERT,
   DTLS_CT_HANDSHAKE,
   DTLS_CT_APPLICATION_DATA,
+#if DTLS_CID_LENGTH > 0
+  DTLS_CT_TLS12_CID,
+#endif /* DTLS_CID_LENGTH > 0 */
   0 				/* end marker */
 };
 #endif
 
+/**
+ * Returns the length of the header of the record @p msg. Records with
+ * a connection ID carry one of the IDs we have assigned, which all
+ * have the length DTLS_CID_LENGTH.
+ */
+static inline size_t
+dtls_record_header_length(const uint8 *msg) {
+#if DTLS_CID_LENGTH > 0
+  if (msg[0] == DTLS_CT_TLS12_CID)
+    return DTLS_RH_LENGTH + DTLS_CID_LENGTH;
+#else /* DTLS_CID_LENGTH > 0 */
+  (void)msg;
+#endif /* DTLS_CID_LENGTH > 0 */
+  return DTLS_RH_LENGTH;
+}
+
+#if DTLS_CID_MAX_LENGTH > 0
+/** Additional bytes of the AEAD additional data for records with CID. */
+#define DTLS_CID_AAD_EXTRA (10 + DTLS_CID_MAX_LENGTH)
+
+/**
+ * Creates the additional data for the AEAD cipher of the record @p rec
+ * that carries a connection ID of @p cid_length bytes, according to
+ * RFC 9146, Section 5:
+ *
+ * additional_data = seq_num_placeholder + tls12_cid + cid_length +
+ *                   tls12_cid + DTLSCiphertext.version + epoch +
+ *                   sequence_number + cid + length_of_DTLSInnerPlaintext;
+ *
+ * @return The number of bytes written to @p buf.
+ */
+static size_t
+dtls_cid_additional_data(uint8 *buf, const uint8 *rec, size_t cid_length,
+			 size_t inner_length) {
+  memset(buf, 0xff, 8);
+  buf[8] = DTLS_CT_TLS12_CID;
+  buf[9] = cid_length;
+  buf[10] = DTLS_CT_TLS12_CID;
+  memcpy(buf + 11, rec + 1, 10); /* version, epoch and seq_num */
+  memcpy(buf + 21, rec + 11, cid_length);
+  dtls_int_to_uint16(buf + 21 + cid_length, inner_length);
+  return 23 + cid_length;
+}
+#else /* DTLS_CID_MAX_LENGTH > 0 */
+#define DTLS_CID_AAD_EXTRA 0
+#endif /* DTLS_CID_MAX_LENGTH > 0 */
+
+/**
+ * Maximum size of the additional data for the AEAD cipher, i.e.
+ * seq_num(2+6) + type(1) + version(2) + length(2) for records
+ * without CID.
+ */
+#define DTLS_A_DATA_MAX (13 + DTLS_CID_AAD_EXTRA)
+
+#if DTLS_CID_LENGTH > 0
+/**
+ * Removes the padding and the real content type from the decrypted
+ * payload @p data of @p length bytes of the record @p rec with
+ * connection ID. The record header is rewritten without the
+ * connection ID at @p rec + DTLS_CID_LENGTH, so that the record can
+ * be handled like any other.
+ *
+ * @return The length of the content or less than zero if the record
+ *   has no content type.
+ */
+static int
+dtls_cid_inner_plaintext(uint8 *rec, const uint8 *data, int length) {
+  while (length > 0 && data[length - 1] == 0)
+    length--;
+  if (length == 0) {
+    dtls_warn("record with connection ID has no content type\n");
+    return -1;
+  }
+  length--;
+
+  /* version, epoch and seq_num */
+  memmove(rec + DTLS_CID_LENGTH + 1, rec + 1, 10);
+  rec[DTLS_CID_LENGTH] = data[length];
+  dtls_int_to_uint16(rec + DTLS_CID_LENGTH + 11, length);
+  return length;
+}
+#endif /* DTLS_CID_LENGTH > 0 */
+
 /**
  * Checks if \p msg points to a valid DTLS record. If
  * 
@@ -386,6 +1002,7 @@ static char const content_types[] = {
 static unsigned int
 is_record(uint8 *msg, size_t msglen) {
   unsigned int rlen = 0;
+  size_t hlen;
 
   if (msglen >= DTLS_RH_LENGTH	/* FIXME allow empty records? */
 #ifdef DTLS_CHECK_CONTENTTYPE
@@ -394,8 +1011,12 @@ is_record(uint8 *msg, size_t msglen) {
       && msg[1] == HIGH(DTLS_VERSION)
       && msg[2] == LOW(DTLS_VERSION)) 
     {
-      rlen = DTLS_RH_LENGTH + 
-	dtls_uint16_to_int(DTLS_RECORD_HEADER(msg)->length);
+      /* the length field follows the connection ID, if any */
+      hlen = dtls_record_header_length(msg);
+      if (hlen > msglen)
+	return 0;
+
+      rlen = hlen + dtls_uint16_to_int(msg + hlen - sizeof(uint16));
       
       /* we do not accept wrong length field in record header */
       if (rlen > msglen)	
@@ -440,6 +1061,17 @@ dtls_set_record_header(uint8 type, dtls_security_parameters_t *security,
   return buf + sizeof(uint16);
 }
 
+/**
+ * Sets the sequence number of the record \p buf that has been created
+ * with dtls_set_record_header() to the next one of \p security.
+ */
+static inline void
+dtls_set_record_seq(dtls_security_parameters_t *security, uint8 *buf) {
+  if (security)
+    dtls_int_to_uint48(DTLS_RECORD_HEADER(buf)->sequence_number,
+		       security->rseq++);
+}
+
 /**
  * Initializes \p buf as handshake header. The caller must ensure that \p
  * buf is capable of holding at least \c sizeof(dtls_handshake_header_t)
@@ -483,33 +1115,177 @@ static uint8 compression_methods[] = {
   TLS_COMPRESSION_NULL
 };
 
-/** returns true if the cipher matches TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8 */
-static inline int is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(dtls_cipher_t cipher)
+/** returns true if the cipher uses the ECDHE_ECDSA key exchange */
+static inline int is_tls_ecdhe_ecdsa(dtls_cipher_t cipher)
 {
 #ifdef DTLS_ECC
-  return cipher == TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8;
+  return cipher == TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8 ||
+    (DTLS_GCM && cipher == TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256) ||
+    (DTLS_CHACHA20 &&
+     cipher == TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256);
 #else
   (void)cipher;
   return 0;
 #endif /* DTLS_ECC */
 }
 
-/** returns true if the cipher matches TLS_PSK_WITH_AES_128_CCM_8 */
-static inline int is_tls_psk_with_aes_128_ccm_8(dtls_cipher_t cipher)
+/** returns true if the cipher uses the PSK key exchange */
+static inline int is_tls_psk(dtls_cipher_t cipher)
 {
 #ifdef DTLS_PSK
-  return cipher == TLS_PSK_WITH_AES_128_CCM_8;
+  return cipher == TLS_PSK_WITH_AES_128_CCM_8 ||
+    (DTLS_GCM && cipher == TLS_PSK_WITH_AES_128_GCM_SHA256) ||
+    (DTLS_CHACHA20 && cipher == TLS_PSK_WITH_CHACHA20_POLY1305_SHA256);
 #else
   return 0;
 #endif /* DTLS_PSK */
 }
 
-/** returns true if the application is configured for psk */
-static inline int is_psk_supported(dtls_context_t *ctx)
+/** returns true if the records of the cipher are protected with AES-128-GCM */
+static inline int is_tls_aes_128_gcm(dtls_cipher_t cipher)
 {
-#ifdef DTLS_PSK
-  return ctx && ctx->h && ctx->h->get_psk_info;
-#else
+  return DTLS_GCM && (cipher == TLS_PSK_WITH_AES_128_GCM_SHA256 ||
+		      cipher == TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256);
+}
+
+/** returns true if the records of the cipher are protected with ChaCha20-Poly1305 */
+static inline int is_tls_chacha20_poly1305(dtls_cipher_t cipher)
+{
+  return dtls_cipher_is_chacha20(cipher);
+}
+
+/** returns true if the records of the cipher are protected with AES-128-CCM-8 */
+static inline int is_tls_aes_128_ccm_8(dtls_cipher_t cipher)
+{
+  return cipher == TLS_PSK_WITH_AES_128_CCM_8 ||
+    cipher == TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8;
+}
+
+/** Returns the name of @p cipher for debug messages. */
+static inline const char *
+dtls_cipher_name(dtls_cipher_t cipher) {
+  switch (cipher) {
+  case TLS_PSK_WITH_AES_128_CCM_8:
+    return "TLS_PSK_WITH_AES_128_CCM_8";
+  case TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8:
+    return "TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8";
+  case TLS_PSK_WITH_AES_128_GCM_SHA256:
+    return "TLS_PSK_WITH_AES_128_GCM_SHA256";
+  case TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256:
+    return "TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256";
+  case TLS_PSK_WITH_CHACHA20_POLY1305_SHA256:
+    return "TLS_PSK_WITH_CHACHA20_POLY1305_SHA256";
+  case TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256:
+    return "TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256";
+  case TLS_NULL_WITH_NULL_NULL:
+  default:
+    return "unknown cipher";
+  }
+}
+
+/** Returns the size of the MAC that the AEAD of @p cipher appends. */
+static inline size_t
+dtls_aead_mac_length(dtls_cipher_t cipher) {
+  if (is_tls_aes_128_gcm(cipher))
+    return DTLS_GCM_TAG_LENGTH;
+  if (is_tls_chacha20_poly1305(cipher))
+    return DTLS_CHACHAPOLY_TAG_LENGTH;
+  return 8;
+}
+
+/**
+ * Returns the size of the explicit nonce that precedes the payload of
+ * the records of @p cipher. ChaCha20-Poly1305 derives the whole nonce
+ * from the sequence number (RFC 7905, section 2).
+ */
+static inline size_t
+dtls_aead_explicit_nonce_length(dtls_cipher_t cipher) {
+  return is_tls_chacha20_poly1305(cipher) ? 0 : 8;
+}
+
+/**
+ * Completes the @p nonce of a record protected with @p security that
+ * already holds the write IV with the 8 bytes of epoch and sequence
+ * number at @p seq. They follow the 4 bytes of IV of the AES suites,
+ * ChaCha20-Poly1305 XORs them into the end of its 12 bytes of IV.
+ */
+static inline void
+dtls_aead_nonce_seq(unsigned char *nonce,
+		    const dtls_security_parameters_t *security,
+		    const uint8 *seq) {
+  int i;
+
+  if (!is_tls_chacha20_poly1305(security->cipher)) {
+    memcpy(nonce + DTLS_IV_LENGTH, seq, 8);
+    return;
+  }
+  for (i = 0; i < 8; i++)
+    nonce[DTLS_CHACHA20_IV_LENGTH - 8 + i] ^= seq[i];
+}
+
+/**
+ * Allocates the parameters of a new handshake for @p ctx and counts
+ * the start of the handshake.
+ */
+static dtls_handshake_parameters_t *
+dtls_handshake_start(dtls_context_t *ctx) {
+  dtls_handshake_parameters_t *handshake;
+
+  handshake = dtls_handshake_new(&ctx->pools, &ctx->crypto);
+#if DTLS_STATS
+  if (handshake) {
+    ctx->stats.handshakes_started++;
+    dtls_ticks(&handshake->started);
+  }
+#endif /* DTLS_STATS */
+  return handshake;
+}
+
+#if DTLS_STATS
+/**
+ * Counts the end of @p handshake in the statistics of @p ctx. When
+ * @p completed is set, its duration is added to the histogram.
+ */
+static void
+dtls_stats_handshake_end(dtls_context_t *ctx,
+			 const dtls_handshake_parameters_t *handshake,
+			 int completed) {
+  dtls_stats_suite_t suite = DTLS_STATS_SUITE_NONE;
+  unsigned long ms;
+  dtls_tick_t now;
+  int bucket;
+
+  if (is_tls_psk(handshake->cipher))
+    suite = DTLS_STATS_SUITE_PSK;
+  else if (is_tls_ecdhe_ecdsa(handshake->cipher))
+    suite = DTLS_STATS_SUITE_ECDHE_ECDSA;
+
+  if (!completed) {
+    ctx->stats.handshakes_failed[suite]++;
+    return;
+  }
+
+  ctx->stats.handshakes_completed[suite]++;
+  if (handshake->resumed)
+    ctx->stats.handshakes_resumed++;
+  dtls_ticks(&now);
+  ms = (unsigned long)(now - handshake->started) * 1000
+    / DTLS_TICKS_PER_SECOND;
+  bucket = ms ? dtls_fls(ms) : 0;
+  if (bucket >= DTLS_STATS_HANDSHAKE_BUCKETS)
+    bucket = DTLS_STATS_HANDSHAKE_BUCKETS - 1;
+  ctx->stats.handshake_ms[bucket]++;
+}
+#else /* DTLS_STATS */
+#define dtls_stats_handshake_end(Context, Handshake, Completed) ((void)0)
+#endif /* DTLS_STATS */
+
+/** returns true if the application is configured for psk */
+static inline int is_psk_supported(dtls_context_t *ctx)
+{
+#ifdef DTLS_PSK
+  return ctx && ctx->h && ctx->h->get_psk_info;
+#else
   return 0;
 #endif /* DTLS_PSK */
 }
@@ -527,6 +1303,65 @@ static inline int is_ecdsa_supported(dtls_context_t *ctx, int is_client)
 #endif /* DTLS_ECC */
 }
 
+/** returns true if the crypto provider of the context implements AES-GCM */
+static inline int is_gcm_supported(dtls_context_t *ctx)
+{
+#if DTLS_GCM
+  return ctx && ctx->crypto.gcm_set_key && ctx->crypto.gcm_seal
+    && ctx->crypto.gcm_open;
+#else
+  (void)ctx;
+  return 0;
+#endif /* DTLS_GCM */
+}
+
+/** returns true if the crypto provider of the context implements ChaCha20-Poly1305 */
+static inline int is_chacha20_supported(dtls_context_t *ctx)
+{
+#if DTLS_CHACHA20
+  return ctx && ctx->crypto.chacha20_set_key && ctx->crypto.chacha20_seal
+    && ctx->crypto.chacha20_open;
+#else
+  (void)ctx;
+  return 0;
+#endif /* DTLS_CHACHA20 */
+}
+
+/**
+ * Returns true if the ChaCha20-Poly1305 suites should be preferred
+ * over the AES ones, i.e. if the provider implements ChaCha20, or if
+ * AES is neither implemented by the provider nor accelerated by the
+ * CPU.
+ */
+static inline int is_chacha20_preferred(dtls_context_t *ctx)
+{
+#if DTLS_CHACHA20
+  return is_chacha20_supported(ctx) &&
+    (ctx->crypto.chacha20_seal != dtls_crypto_software.chacha20_seal ||
+     (ctx->crypto.ccm_seal == dtls_crypto_software.ccm_seal &&
+      !dtls_aes_accelerated()));
+#else
+  (void)ctx;
+  return 0;
+#endif /* DTLS_CHACHA20 */
+}
+
+/**
+ * Returns true if the GCM suites should be offered before the CCM_8
+ * ones, i.e. if GHASH is accelerated by the CPU or the provider.
+ */
+static inline int is_gcm_preferred(dtls_context_t *ctx)
+{
+#if DTLS_GCM
+  return is_gcm_supported(ctx) &&
+    (ctx->crypto.gcm_seal != dtls_crypto_software.gcm_seal ||
+     dtls_gcm_accelerated());
+#else
+  (void)ctx;
+  return 0;
+#endif /* DTLS_GCM */
+}
+
 /** Returns true if the application is configured for ecdhe_ecdsa with
   * client authentication */
 static inline int is_ecdsa_client_auth_supported(dtls_context_t *ctx)
@@ -553,10 +1388,15 @@ known_cipher(dtls_context_t *ctx, dtls_cipher_t code, int is_client) {
   int psk;
   int ecdsa;
 
+  if (is_tls_aes_128_gcm(code) && !is_gcm_supported(ctx))
+    return 0;
+  if (is_tls_chacha20_poly1305(code) && !is_chacha20_supported(ctx))
+    return 0;
+
   psk = is_psk_supported(ctx);
   ecdsa = is_ecdsa_supported(ctx, is_client);
-  return (psk && is_tls_psk_with_aes_128_ccm_8(code)) ||
-	 (ecdsa && is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(code));
+  return (psk && is_tls_psk(code)) ||
+	 (ecdsa && is_tls_ecdhe_ecdsa(code));
 }
 
 /**
@@ -646,6 +1486,8 @@ static char *dtls_handshake_type_to_name(int type)
     return "certificate_verify";
   case DTLS_HT_CLIENT_KEY_EXCHANGE:
     return "client_key_exchange";
+  case DTLS_HT_NEW_SESSION_TICKET:
+    return "new_session_ticket";
   case DTLS_HT_FINISHED:
     return "finished";
   default:
@@ -653,8 +1495,20 @@ static char *dtls_handshake_type_to_name(int type)
   }
 }
 
+static int dtls_derive_key_block(dtls_handshake_parameters_t *handshake,
+				 dtls_security_parameters_t *security,
+				 const unsigned char *pre_master_secret,
+				 int pre_master_len,
+				 dtls_peer_type role);
+static int dtls_expand_key_block(dtls_handshake_parameters_t *handshake,
+				 dtls_security_parameters_t *security,
+				 const uint8 *master_secret,
+				 dtls_peer_type role);
+
 /**
- * Calculate the pre master secret and after that calculate the master-secret.
+ * Calculate the pre master secret and after that calculate the
+ * master-secret. For ECDHE_ECDSA, the handshake may wait for an ECC
+ * job afterwards, see dtls_ecc_pending().
  */
 static int
 calculate_key_block(dtls_context_t *ctx, 
@@ -663,10 +1517,8 @@ calculate_key_block(dtls_context_t *ctx,
 		    session_t *session,
 		    dtls_peer_type role) {
   unsigned char *pre_master_secret;
-  int pre_master_len = 0;
+  int pre_master_len = 0, res;
   dtls_security_parameters_t *security = dtls_security_params_next(peer);
-  uint8 master_secret[DTLS_MASTER_SECRET_LENGTH];
-  (void)role; /* The macro dtls_kb_size() does not use role. */
 
   if (!security) {
     return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
@@ -676,7 +1528,14 @@ calculate_key_block(dtls_context_t *ctx,
 
   switch (handshake->cipher) {
 #ifdef DTLS_PSK
-  case TLS_PSK_WITH_AES_128_CCM_8: {
+  case TLS_PSK_WITH_AES_128_CCM_8:
+#if DTLS_GCM
+  case TLS_PSK_WITH_AES_128_GCM_SHA256:
+#endif /* DTLS_GCM */
+#if DTLS_CHACHA20
+  case TLS_PSK_WITH_CHACHA20_POLY1305_SHA256:
+#endif /* DTLS_CHACHA20 */
+  {
     unsigned char psk[DTLS_PSK_MAX_KEY_LEN];
     int len;
 
@@ -705,18 +1564,23 @@ calculate_key_block(dtls_context_t *ctx,
   }
 #endif /* DTLS_PSK */
 #ifdef DTLS_ECC
-  case TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8: {
-    pre_master_len = dtls_ecdh_pre_master_secret(handshake->keyx.ecdsa.own_eph_priv,
-						 handshake->keyx.ecdsa.other_eph_pub_x,
-						 handshake->keyx.ecdsa.other_eph_pub_y,
-						 sizeof(handshake->keyx.ecdsa.own_eph_priv),
-						 pre_master_secret,
-						 MAX_KEYBLOCK_LENGTH);
-    if (pre_master_len < 0) {
-      dtls_crit("the curve was too long, for the pre master secret\n");
-      return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
-    }
-    break;
+  case TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8:
+#if DTLS_GCM
+  case TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256:
+#endif /* DTLS_GCM */
+#if DTLS_CHACHA20
+  case TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256:
+#endif /* DTLS_CHACHA20 */
+  {
+    dtls_ecc_job_t local, *job;
+
+    /* the key block is derived in dtls_ecc_job_finish() */
+    job = dtls_ecc_job_start(ctx, peer, &local, DTLS_ECC_JOB_ECDH,
+			     DTLS_ECC_STEP_KEY_BLOCK);
+    memcpy(job->priv_key, handshake->keyx.ecdsa.own_eph_priv, DTLS_EC_KEY_SIZE);
+    memcpy(job->pub_x, handshake->keyx.ecdsa.other_eph_pub_x, DTLS_EC_KEY_SIZE);
+    memcpy(job->pub_y, handshake->keyx.ecdsa.other_eph_pub_y, DTLS_EC_KEY_SIZE);
+    return dtls_ecc_job_dispatch(ctx, peer, job, &local);
   }
 #endif /* DTLS_ECC */
   case TLS_NULL_WITH_NULL_NULL:
@@ -731,17 +1595,52 @@ calculate_key_block(dtls_context_t *ctx,
   case TLS_PSK_WITH_AES_128_CCM_8:
     /* fall through to default */
 #endif /* !DTLS_PSK */
+#if !defined(DTLS_PSK) || !DTLS_GCM
+  case TLS_PSK_WITH_AES_128_GCM_SHA256:
+    /* fall through to default */
+#endif /* !DTLS_PSK || !DTLS_GCM */
+#if !defined(DTLS_PSK) || !DTLS_CHACHA20
+  case TLS_PSK_WITH_CHACHA20_POLY1305_SHA256:
+    /* fall through to default */
+#endif /* !DTLS_PSK || !DTLS_CHACHA20 */
 
 #ifndef DTLS_ECC
   case TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8:
     /* fall through to default */
 #endif /* !DTLS_ECC */
+#if !defined(DTLS_ECC) || !DTLS_GCM
+  case TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256:
+    /* fall through to default */
+#endif /* !DTLS_ECC || !DTLS_GCM */
+#if !defined(DTLS_ECC) || !DTLS_CHACHA20
+  case TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256:
+    /* fall through to default */
+#endif /* !DTLS_ECC || !DTLS_CHACHA20 */
 
   default:
     dtls_crit("calculate_key_block: unknown cipher %x04 \n", handshake->cipher);
     return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
   }
 
+  dtls_trace(ctx, DTLS_TRACE_PRF, 0);
+  res = dtls_derive_key_block(handshake, security,
+			      pre_master_secret, pre_master_len, role);
+  dtls_trace(ctx, DTLS_TRACE_PRF, 1);
+  return res;
+}
+
+/**
+ * Derives the master secret and the key block of @p security from
+ * the pre-master secret and sets up the cipher contexts.
+ */
+static int
+dtls_derive_key_block(dtls_handshake_parameters_t *handshake,
+		      dtls_security_parameters_t *security,
+		      const unsigned char *pre_master_secret,
+		      int pre_master_len,
+		      dtls_peer_type role) {
+  uint8 master_secret[DTLS_MASTER_SECRET_LENGTH];
+
   dtls_debug_dump("client_random", handshake->tmp.random.client, DTLS_RANDOM_LENGTH);
   dtls_debug_dump("server_random", handshake->tmp.random.server, DTLS_RANDOM_LENGTH);
   dtls_debug_dump("pre_master_secret", pre_master_secret, pre_master_len);
@@ -755,6 +1654,24 @@ calculate_key_block(dtls_context_t *ctx,
 
   dtls_debug_dump("master_secret", master_secret, DTLS_MASTER_SECRET_LENGTH);
 
+  return dtls_expand_key_block(handshake, security, master_secret, role);
+}
+
+/**
+ * Creates the key block of @p security from @p master_secret and the
+ * randoms of @p handshake and sets up the cipher contexts. The
+ * randoms are replaced by the master secret afterwards.
+ */
+static int
+dtls_expand_key_block(dtls_handshake_parameters_t *handshake,
+		      dtls_security_parameters_t *security,
+		      const uint8 *master_secret,
+		      dtls_peer_type role) {
+  int (*set_key)(aes128_ccm_t *ctx, const unsigned char *key, size_t keylen);
+
+  /* the size of the key block depends on the cipher */
+  security->cipher = handshake->cipher;
+
   /* create key_block from master_secret
    * key_block = PRF(master_secret,
                     "key expansion" + tmp.random.server + tmp.random.client) */
@@ -770,13 +1687,318 @@ calculate_key_block(dtls_context_t *ctx,
   memcpy(handshake->tmp.master_secret, master_secret, DTLS_MASTER_SECRET_LENGTH);
   dtls_debug_keyblock(security);
 
-  security->cipher = handshake->cipher;
+  /* expand the AES key schedules once for the lifetime of this epoch */
+  security->crypto = handshake->crypto;
+  set_key = security->crypto->ccm_set_key;
+#if DTLS_GCM
+  if (is_tls_aes_128_gcm(handshake->cipher))
+    set_key = security->crypto->gcm_set_key;
+#endif /* DTLS_GCM */
+#if DTLS_CHACHA20
+  if (is_tls_chacha20_poly1305(handshake->cipher))
+    set_key = security->crypto->chacha20_set_key;
+#endif /* DTLS_CHACHA20 */
+  if (set_key(&security->write_ctx,
+	      dtls_kb_local_write_key(security, role),
+	      dtls_kb_key_size(security, role)) < 0 ||
+      set_key(&security->read_ctx,
+	      dtls_kb_remote_write_key(security, role),
+	      dtls_kb_key_size(security, role)) < 0) {
+    return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+  }
+
   security->compression = handshake->compression;
   security->rseq = 0;
+#if DTLS_CID_MAX_LENGTH > 0
+  /* records to the peer carry the connection ID it has asked for */
+  security->write_cid_length = handshake->cid ? handshake->peer_cid_length : 0;
+  memcpy(security->write_cid, handshake->peer_cid, security->write_cid_length);
+#endif /* DTLS_CID_MAX_LENGTH > 0 */
 
   return 0;
 }
 
+#if DTLS_SESSION_CACHE_SIZE > 0
+/**
+ * Looks up a cached session of @p ctx that has been established in
+ * @p role. When @p session is not @c NULL, the entry must belong to
+ * this remote address, when @p id_length is not @c 0, it must have
+ * the session id @p id. Entries that have exceeded
+ * DTLS_SESSION_LIFETIME are released on the way.
+ *
+ * @return The matching entry or @c NULL if not found.
+ */
+static dtls_session_cache_entry_t *
+dtls_session_cache_find(dtls_context_t *ctx, dtls_peer_type role,
+			const session_t *session,
+			const uint8 *id, size_t id_length) {
+  dtls_session_cache_entry_t *entry;
+  dtls_tick_t now;
+
+  dtls_ticks(&now);
+  for (entry = ctx->sessions;
+       entry < ctx->sessions + DTLS_SESSION_CACHE_SIZE; entry++) {
+    if (entry->cipher == TLS_NULL_WITH_NULL_NULL || entry->role != role)
+      continue;
+
+    if (now - entry->created > DTLS_SESSION_LIFETIME * CLOCK_SECOND) {
+      memset(entry, 0, sizeof(*entry));
+      continue;
+    }
+
+    if ((session && !dtls_session_equals(&entry->session, session)) ||
+	(id_length && (entry->id_length != id_length ||
+		       memcmp(entry->id, id, id_length) != 0)))
+      continue;
+
+    entry->last_used = now;
+    return entry;
+  }
+  return NULL;
+}
+
+/**
+ * Stores the session that @p peer has established, together with the
+ * session @p ticket that a client has received. A client replaces its
+ * previous session with the same server, otherwise a free or the
+ * least recently used entry is taken.
+ */
+static void
+dtls_session_cache_add(dtls_context_t *ctx, dtls_peer_t *peer,
+		       const uint8 *ticket, size_t ticket_length) {
+  dtls_handshake_parameters_t *handshake = peer->handshake_params;
+  dtls_session_cache_entry_t *entry, *victim;
+  session_t session;
+  dtls_tick_t now;
+
+#if DTLS_SESSION_TICKET_MAX_LENGTH > 0
+  if (ticket_length > DTLS_SESSION_TICKET_MAX_LENGTH) {
+    dtls_warn("session ticket is too long to be stored\n");
+    ticket_length = 0;
+  }
+#else /* DTLS_SESSION_TICKET_MAX_LENGTH > 0 */
+  (void)ticket;
+  ticket_length = 0;
+#endif /* DTLS_SESSION_TICKET_MAX_LENGTH > 0 */
+
+  if (!handshake->session_id_length && !ticket_length)
+    return;
+
+  dtls_peer_session(peer, &session);
+  if (dtls_role_is_client(peer->role))
+    victim = dtls_session_cache_find(ctx, DTLS_CLIENT, &session, NULL, 0);
+  else
+    victim = dtls_session_cache_find(ctx, DTLS_SERVER, NULL,
+				     handshake->session_id,
+				     handshake->session_id_length);
+
+  dtls_ticks(&now);
+  for (entry = ctx->sessions;
+       !victim && entry < ctx->sessions + DTLS_SESSION_CACHE_SIZE; entry++)
+    if (entry->cipher == TLS_NULL_WITH_NULL_NULL)
+      victim = entry;
+
+  if (!victim) {		/* cache is full, replace the LRU entry */
+    victim = ctx->sessions;
+    for (entry = ctx->sessions + 1;
+	 entry < ctx->sessions + DTLS_SESSION_CACHE_SIZE; entry++)
+      if (now - entry->last_used > now - victim->last_used)
+	victim = entry;
+  }
+
+  memset(victim, 0, sizeof(*victim));
+  if (dtls_role_is_client(peer->role))
+    memcpy(&victim->session, &session, sizeof(session_t));
+  victim->role = peer->role;
+  victim->id_length = handshake->session_id_length;
+  memcpy(victim->id, handshake->session_id, handshake->session_id_length);
+  victim->cipher = handshake->cipher;
+  memcpy(victim->master_secret, handshake->tmp.master_secret,
+	 DTLS_MASTER_SECRET_LENGTH);
+  victim->created = victim->last_used = now;
+#if DTLS_SESSION_TICKET_MAX_LENGTH > 0
+  victim->ticket_length = ticket_length;
+  if (ticket_length)
+    memcpy(victim->ticket, ticket, ticket_length);
+#endif /* DTLS_SESSION_TICKET_MAX_LENGTH > 0 */
+}
+
+/**
+ * Removes the cached session of @p peer. This is done when the
+ * connection fails, as required in RFC 5246, section 7.2.2.
+ */
+static void
+dtls_session_cache_remove(dtls_context_t *ctx, dtls_peer_t *peer) {
+  dtls_handshake_parameters_t *handshake = peer->handshake_params;
+  dtls_session_cache_entry_t *entry = NULL;
+  session_t session;
+
+  if (dtls_role_is_client(peer->role))
+    entry = dtls_session_cache_find(ctx, DTLS_CLIENT,
+				    dtls_peer_session(peer, &session), NULL, 0);
+  else if (handshake && handshake->session_id_length)
+    entry = dtls_session_cache_find(ctx, DTLS_SERVER, NULL,
+				    handshake->session_id,
+				    handshake->session_id_length);
+
+  if (entry)
+    memset(entry, 0, sizeof(*entry));
+}
+#else /* DTLS_SESSION_CACHE_SIZE > 0 */
+#define dtls_session_cache_add(Ctx, Peer, Ticket, Length) ((void)0)
+#define dtls_session_cache_remove(Ctx, Peer) ((void)0)
+#endif /* DTLS_SESSION_CACHE_SIZE > 0 */
+
+#if DTLS_SESSION_TICKET_KEYS > 0
+/** Length of the state in our tickets: cipher, time and master secret. */
+#define DTLS_TICKET_STATE_LENGTH \
+  (sizeof(uint16) + sizeof(uint32) + DTLS_MASTER_SECRET_LENGTH)
+
+/** Length of the tickets issued by dtls_ticket_seal(). */
+#define DTLS_TICKET_LENGTH						\
+  (DTLS_TICKET_KEY_NAME_LENGTH + DTLS_CCM_NONCE_SIZE +			\
+   DTLS_TICKET_STATE_LENGTH + 8 /* MAC */)
+
+/**
+ * Returns the time in seconds that is recorded in tickets. Where
+ * available, this is the wall clock, so that servers sharing a
+ * ticket key agree on the age of a ticket, unless the time is
+ * simulated with dtls_ticks_set().
+ */
+static uint32_t
+dtls_ticket_time(void) {
+  dtls_tick_t now;
+
+#if !defined(WITH_CONTIKI) && defined(HAVE_TIME_H)
+  if (!dtls_ticks_simulated())
+    return (uint32_t)time(NULL);
+#endif
+  dtls_ticks(&now);
+  return now / CLOCK_SECOND;
+}
+
+/**
+ * Writes a session ticket for the session that is negotiated in
+ * @p handshake to @p ticket, which must provide DTLS_TICKET_LENGTH
+ * bytes. The ticket consists of the name of the current ticket key,
+ * a random nonce and the session state, which is encrypted and
+ * authenticated with AES-CCM-8 using the key name as additional data.
+ *
+ * @return The length of the ticket or a value less than zero on error.
+ */
+static int
+dtls_ticket_seal(dtls_context_t *ctx,
+		 dtls_handshake_parameters_t *handshake, uint8 *ticket) {
+  uint8 state[DTLS_TICKET_STATE_LENGTH];
+  unsigned char nonce[DTLS_CCM_BLOCKSIZE];
+  dtls_ticket_key_t *key = ctx->ticket_keys;
+  dtls_tick_t now;
+  uint8 *p = ticket;
+  int res;
+
+  dtls_ticks(&now);
+  if (ctx->ticket_key_rotate &&
+      now - key->created > DTLS_SESSION_LIFETIME * CLOCK_SECOND)
+    dtls_set_ticket_key(ctx, NULL);
+
+  dtls_int_to_uint16(state, handshake->cipher);
+  dtls_int_to_uint32(state + sizeof(uint16), dtls_ticket_time());
+  memcpy(state + sizeof(uint16) + sizeof(uint32),
+	 handshake->tmp.master_secret, DTLS_MASTER_SECRET_LENGTH);
+
+  memcpy(p, key->name, DTLS_TICKET_KEY_NAME_LENGTH);
+  p += DTLS_TICKET_KEY_NAME_LENGTH;
+
+  memset(nonce, 0, sizeof(nonce));
+  /* a nonce must not repeat under the same ticket key */
+  if (!dtls_prng(nonce, DTLS_CCM_NONCE_SIZE)) {
+    memset(state, 0, sizeof(state));
+    return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+  }
+  memcpy(p, nonce, DTLS_CCM_NONCE_SIZE);
+  p += DTLS_CCM_NONCE_SIZE;
+
+  res = dtls_encrypt(&key->ccm, state, sizeof(state), p, nonce,
+		     ticket, DTLS_TICKET_KEY_NAME_LENGTH);
+  memset(state, 0, sizeof(state));
+  if (res < 0)
+    return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+
+  return (p - ticket) + res;
+}
+
+/**
+ * Decrypts a session ticket of @p length bytes that has been issued
+ * by dtls_ticket_seal() and stores the cipher suite and the master
+ * secret in @p session.
+ *
+ * @return @c 0 if the ticket is valid, a value less than zero if it
+ *         is corrupted, expired or its key is no longer available.
+ */
+static int
+dtls_ticket_open(dtls_context_t *ctx, const uint8 *ticket, size_t length,
+		 dtls_session_cache_entry_t *session) {
+  uint8 state[DTLS_TICKET_STATE_LENGTH + 8 /* MAC */];
+  unsigned char nonce[DTLS_CCM_BLOCKSIZE];
+  dtls_ticket_key_t *key;
+  int res = -1;
+
+  if (length != DTLS_TICKET_LENGTH)
+    return -1;
+
+  for (key = ctx->ticket_keys; key < ctx->ticket_keys + ctx->ticket_keys_len; key++)
+    if (memcmp(key->name, ticket, DTLS_TICKET_KEY_NAME_LENGTH) == 0)
+      break;
+
+  if (key == ctx->ticket_keys + ctx->ticket_keys_len) {
+    dtls_info("session ticket key not found\n");
+    return -1;
+  }
+
+  memset(nonce, 0, sizeof(nonce));
+  memcpy(nonce, ticket + DTLS_TICKET_KEY_NAME_LENGTH, DTLS_CCM_NONCE_SIZE);
+
+  if (dtls_decrypt(&key->ccm,
+		   ticket + DTLS_TICKET_KEY_NAME_LENGTH + DTLS_CCM_NONCE_SIZE,
+		   sizeof(state), state, nonce,
+		   ticket, DTLS_TICKET_KEY_NAME_LENGTH) != DTLS_TICKET_STATE_LENGTH) {
+    dtls_info("invalid session ticket\n");
+  } else if (dtls_ticket_time() - dtls_uint32_to_int(state + sizeof(uint16))
+	     > DTLS_SESSION_LIFETIME) {
+    dtls_info("session ticket has expired\n");
+  } else {
+    session->cipher = dtls_uint16_to_int(state);
+    memcpy(session->master_secret, state + sizeof(uint16) + sizeof(uint32),
+	   DTLS_MASTER_SECRET_LENGTH);
+    res = 0;
+  }
+
+  memset(state, 0, sizeof(state));
+  return res;
+}
+#endif /* DTLS_SESSION_TICKET_KEYS > 0 */
+
+/**
+ * Creates the key block for the abbreviated handshake of @p peer from
+ * the master secret of the session that is resumed.
+ */
+static int
+dtls_resume_key_block(dtls_peer_t *peer) {
+  dtls_handshake_parameters_t *handshake = peer->handshake_params;
+  dtls_security_parameters_t *security;
+  int res;
+
+  security = dtls_security_params_next(peer);
+  if (!security)
+    return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+
+  dtls_debug("resume session\n");
+  res = dtls_expand_key_block(handshake, security,
+			      handshake->keyx.master_secret, peer->role);
+  memset(handshake->keyx.master_secret, 0, DTLS_MASTER_SECRET_LENGTH);
+  return res;
+}
+
 /* TODO: add a generic method which iterates over a list and searches for a specific key */
 static int verify_ext_eliptic_curves(uint8 *data, size_t data_length) {
   int i, curve_name;
@@ -866,7 +2088,7 @@ dtls_check_tls_extension(dtls_peer_t *peer,
 
   if (data_length < sizeof(uint16)) { 
     /* no tls extensions specified */
-    if (is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(handshake->cipher)) {
+    if (is_tls_ecdhe_ecdsa(handshake->cipher)) {
       goto error;
     }
     return 0;
@@ -935,6 +2157,28 @@ dtls_check_tls_extension(dtls_peer_t *peer,
 	 */
 	dtls_info("skipped encrypt-then-mac extension\n");
 	break;
+      case TLS_EXT_SESSION_TICKET:
+	/* The client supports tickets, or the server will send one.
+	 * A ticket in a ClientHello is read by dtls_server_resume(). */
+	handshake->ticket = 1;
+	break;
+#if DTLS_CID_MAX_LENGTH > 0
+      case TLS_EXT_CONNECTION_ID:
+	/* the connection ID that the sender wants to receive */
+	if (j < sizeof(uint8) || j != dtls_uint8_to_int(data) + sizeof(uint8))
+	  goto error;
+	if (j - sizeof(uint8) > DTLS_CID_MAX_LENGTH) {
+	  if (!client_hello)
+	    goto error;
+	  dtls_info("ignored connection ID of %d bytes\n", j - 1);
+	  break;
+	}
+	handshake->cid = 1;
+	handshake->peer_cid_length = j - sizeof(uint8);
+	memcpy(handshake->peer_cid, data + sizeof(uint8),
+	       handshake->peer_cid_length);
+	break;
+#endif /* DTLS_CID_MAX_LENGTH > 0 */
       default:
         dtls_warn("unsupported tls extension: %i\n", i);
         break;
@@ -942,13 +2186,13 @@ dtls_check_tls_extension(dtls_peer_t *peer,
     data += j;
     data_length -= j;
   }
-  if (is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(handshake->cipher) && client_hello) {
+  if (is_tls_ecdhe_ecdsa(handshake->cipher) && client_hello) {
     if (!ext_elliptic_curve || !ext_client_cert_type || !ext_server_cert_type
 	|| !ext_ec_point_formats) {
       dtls_warn("not all required tls extensions found in client hello\n");
       goto error;
     }
-  } else if (is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(handshake->cipher) && !client_hello) {
+  } else if (is_tls_ecdhe_ecdsa(handshake->cipher) && !client_hello) {
     if (!ext_client_cert_type || !ext_server_cert_type) {
       dtls_warn("not all required tls extensions found in server hello\n");
       goto error;
@@ -964,6 +2208,135 @@ error:
   }
 }
 
+#if DTLS_SESSION_TICKET_KEYS > 0
+/**
+ * Returns the data of the extension @p type in the list of TLS
+ * extensions @p data that has been checked by
+ * dtls_check_tls_extension(), or @c NULL if it is not present.
+ */
+static uint8 *
+dtls_get_tls_extension(uint8 *data, size_t data_length, uint16_t type,
+		       size_t *length) {
+  size_t j;
+
+  if (data_length < sizeof(uint16))
+    return NULL;
+  data += sizeof(uint16);
+  data_length -= sizeof(uint16);
+
+  while (data_length >= 2 * sizeof(uint16)) {
+    j = dtls_uint16_to_int(data + sizeof(uint16));
+    if (data_length < 2 * sizeof(uint16) + j)
+      break;
+    if (dtls_uint16_to_int(data) == type) {
+      *length = j;
+      return data + 2 * sizeof(uint16);
+    }
+    data += 2 * sizeof(uint16) + j;
+    data_length -= 2 * sizeof(uint16) + j;
+  }
+  return NULL;
+}
+#endif /* DTLS_SESSION_TICKET_KEYS > 0 */
+
+/**
+ * Decides if the ClientHello that updates the handshake of @p peer
+ * resumes a session, either from the session ticket in the TLS
+ * extensions @p ext or from the session cache by the session @p id.
+ * The cipher suite of the session must be in the list of @p ciphers
+ * offered by the client. Also decides if a new session ticket is
+ * issued in a full handshake.
+ */
+static void
+dtls_server_resume(dtls_context_t *ctx, dtls_peer_t *peer,
+		   const uint8 *id, size_t id_length,
+		   const uint8 *ciphers, size_t ciphers_length,
+		   uint8 *ext, size_t ext_length) {
+  dtls_handshake_parameters_t *handshake = peer->handshake_params;
+  dtls_session_cache_entry_t *cached = NULL;
+  size_t i;
+#if DTLS_SESSION_TICKET_KEYS > 0
+  dtls_session_cache_entry_t from_ticket;
+  uint8 *ticket;
+  size_t ticket_length = 0;
+
+  /* dtls_check_tls_extension() has seen the SessionTicket extension */
+  if (handshake->ticket && ctx->ticket_keys_len > 0) {
+    ticket = dtls_get_tls_extension(ext, ext_length, TLS_EXT_SESSION_TICKET,
+				    &ticket_length);
+    if (ticket && ticket_length &&
+	dtls_ticket_open(ctx, ticket, ticket_length, &from_ticket) == 0)
+      cached = &from_ticket;
+  } else {
+    handshake->ticket = 0;
+  }
+#else /* DTLS_SESSION_TICKET_KEYS > 0 */
+  (void)ext;
+  (void)ext_length;
+  handshake->ticket = 0;
+#endif /* DTLS_SESSION_TICKET_KEYS > 0 */
+
+  /* the session id must be echoed to confirm the resumption */
+  if (id_length == 0 || id_length > DTLS_SESSION_ID_LENGTH)
+    goto finish;
+
+#if DTLS_SESSION_CACHE_SIZE > 0
+  if (!cached)
+    cached = dtls_session_cache_find(ctx, DTLS_SERVER, NULL, id, id_length);
+#endif /* DTLS_SESSION_CACHE_SIZE > 0 */
+
+  if (!cached || !known_cipher(ctx, cached->cipher, 0))
+    goto finish;
+
+  /* the client must still offer the cipher suite of the session */
+  for (i = 0; i + sizeof(uint16) <= ciphers_length; i += sizeof(uint16)) {
+    if (dtls_uint16_to_int(ciphers + i) == cached->cipher) {
+      handshake->cipher = cached->cipher;
+      handshake->session_id_length = id_length;
+      memcpy(handshake->session_id, id, id_length);
+      memcpy(handshake->keyx.master_secret, cached->master_secret,
+	     DTLS_MASTER_SECRET_LENGTH);
+      handshake->resumed = 1;
+      /* the client keeps its ticket */
+      handshake->ticket = 0;
+      break;
+    }
+  }
+
+ finish:
+#if DTLS_SESSION_TICKET_KEYS > 0
+  if (cached == &from_ticket)
+    memset(&from_ticket, 0, sizeof(from_ticket));
+#endif /* DTLS_SESSION_TICKET_KEYS > 0 */
+  return;
+}
+
+/**
+ * Returns the ChaCha20-Poly1305 suite with the key exchange of @p
+ * cipher if the client offers it in its @p length bytes of @p ciphers
+ * and we support it, @p cipher otherwise. A server that does AES in
+ * software uses this to pick the cheaper suite even if the client
+ * lists it after the AES ones.
+ */
+static dtls_cipher_t
+dtls_prefer_chacha20(dtls_context_t *ctx, dtls_cipher_t cipher,
+		     const uint8 *ciphers, size_t length) {
+  dtls_cipher_t chacha20;
+  size_t i;
+
+  if (is_tls_chacha20_poly1305(cipher))
+    return cipher;
+
+  chacha20 = is_tls_psk(cipher) ? TLS_PSK_WITH_CHACHA20_POLY1305_SHA256
+    : TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256;
+  for (i = 0; i + sizeof(uint16) <= length; i += sizeof(uint16)) {
+    if (dtls_uint16_to_int(ciphers + i) == chacha20
+	&& known_cipher(ctx, chacha20, 0))
+      return chacha20;
+  }
+  return cipher;
+}
+
 /**
  * Parses the ClientHello from the client and updates the internal handshake
  * parameters with the new data for the given \p peer. When the ClientHello
@@ -985,6 +2358,8 @@ dtls_update_parameters(dtls_context_t *ctx,
   int ok;
   dtls_handshake_parameters_t *config = peer->handshake_params;
   dtls_security_parameters_t *security = dtls_security_params(peer);
+  uint8 *session_id, *ciphers;
+  size_t session_id_length, ciphers_length;
 
   assert(config);
   assert(data_length > DTLS_HS_LENGTH + DTLS_CH_LENGTH);
@@ -998,6 +2373,14 @@ dtls_update_parameters(dtls_context_t *ctx,
   data += DTLS_RANDOM_LENGTH;
   data_length -= DTLS_RANDOM_LENGTH;
 
+  config->resumed = 0;
+  config->ticket = 0;
+  config->session_id_length = 0;
+
+  /* remember the session id the client wants to resume */
+  session_id = data + sizeof(uint8);
+  session_id_length = dtls_uint8_to_int(data);
+
   /* Caution: SKIP_VAR_FIELD may jump to error: */
   SKIP_VAR_FIELD(data, data_length, uint8);	/* skip session id */
   SKIP_VAR_FIELD(data, data_length, uint8);	/* skip cookie */
@@ -1019,6 +2402,9 @@ dtls_update_parameters(dtls_context_t *ctx,
   data += sizeof(uint16);
   data_length -= sizeof(uint16) + i;
 
+  ciphers = data;
+  ciphers_length = i;
+
   ok = 0;
   while (i && !ok) {
     config->cipher = dtls_uint16_to_int(data);
@@ -1037,6 +2423,10 @@ dtls_update_parameters(dtls_context_t *ctx,
     goto error;
   }
 
+  if (is_chacha20_preferred(ctx))
+    config->cipher = dtls_prefer_chacha20(ctx, config->cipher,
+					  ciphers, ciphers_length);
+
   if (data_length < sizeof(uint8)) { 
     /* no compression specified, take the current compression method */
     if (security)
@@ -1069,7 +2459,16 @@ dtls_update_parameters(dtls_context_t *ctx,
     goto error;
   }
   
-  return dtls_check_tls_extension(peer, data, data_length, 1);
+#if DTLS_CID_MAX_LENGTH > 0
+  config->cid = 0;
+#endif /* DTLS_CID_MAX_LENGTH > 0 */
+  ok = dtls_check_tls_extension(peer, data, data_length, 1);
+  if (ok < 0)
+    return ok;
+
+  dtls_server_resume(ctx, peer, session_id, session_id_length,
+		     ciphers, ciphers_length, data, data_length);
+  return 0;
 error:
   if (peer->state == DTLS_STATE_CONNECTED) {
     return dtls_alert_create(DTLS_ALERT_LEVEL_WARNING, DTLS_ALERT_NO_RENEGOTIATION);
@@ -1088,7 +2487,7 @@ check_client_keyexchange(dtls_context_t *ctx,
 			 uint8 *data, size_t length) {
   (void)ctx;
 #ifdef DTLS_ECC
-  if (is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(handshake->cipher)) {
+  if (is_tls_ecdhe_ecdsa(handshake->cipher)) {
 
     if (length < DTLS_HS_LENGTH + DTLS_CKXEC_LENGTH) {
       dtls_debug("The client key exchange is too short\n");
@@ -1118,7 +2517,7 @@ check_client_keyexchange(dtls_context_t *ctx,
   }
 #endif /* DTLS_ECC */
 #ifdef DTLS_PSK
-  if (is_tls_psk_with_aes_128_ccm_8(handshake->cipher)) {
+  if (is_tls_psk(handshake->cipher)) {
     int id_length;
 
     if (length < DTLS_HS_LENGTH + DTLS_CKXPSK_LENGTH_MIN) {
@@ -1150,7 +2549,8 @@ check_client_keyexchange(dtls_context_t *ctx,
 static inline void
 update_hs_hash(dtls_peer_t *peer, uint8 *data, size_t length) {
   dtls_debug_dump("add MAC data", data, length);
-  dtls_hash_update(&peer->handshake_params->hs_state.hs_hash, data, length);
+  peer->handshake_params->crypto->hash_update(&peer->handshake_params->hs_state.hs_hash,
+					      data, length);
 }
 
 static void
@@ -1161,14 +2561,15 @@ copy_hs_hash(dtls_peer_t *peer, dtls_hash_ctx *hs_hash) {
 
 static inline size_t
 finalize_hs_hash(dtls_peer_t *peer, uint8 *buf) {
-  return dtls_hash_finalize(buf, &peer->handshake_params->hs_state.hs_hash);
+  return peer->handshake_params->crypto->hash_finalize(buf,
+			&peer->handshake_params->hs_state.hs_hash);
 }
 
 static inline void
 clear_hs_hash(dtls_peer_t *peer) {
   assert(peer);
   dtls_debug("clear MAC\n");
-  dtls_hash_init(&peer->handshake_params->hs_state.hs_hash);
+  peer->handshake_params->crypto->hash_init(&peer->handshake_params->hs_state.hs_hash);
 }
 
 /** 
@@ -1210,7 +2611,7 @@ check_finished(dtls_context_t *ctx, dtls_peer_t *peer,
   /* restore hash status */
   memcpy(&peer->handshake_params->hs_state.hs_hash, b.statebuf, DTLS_HASH_CTX_SIZE);
 
-  if (peer->role == DTLS_CLIENT) {
+  if (dtls_role_is_client(peer->role)) {
     label = PRF_LABEL(server);
     label_size = PRF_LABEL_SIZE(server);
   } else { /* server */
@@ -1218,12 +2619,14 @@ check_finished(dtls_context_t *ctx, dtls_peer_t *peer,
     label_size = PRF_LABEL_SIZE(client);
   }
 
+  dtls_trace(ctx, DTLS_TRACE_PRF, 0);
   dtls_prf(peer->handshake_params->tmp.master_secret,
 	   DTLS_MASTER_SECRET_LENGTH,
 	   label, label_size,
 	   PRF_LABEL(finished), PRF_LABEL_SIZE(finished),
 	   buf, digest_length,
 	   b.verify_data, sizeof(b.verify_data));
+  dtls_trace(ctx, DTLS_TRACE_PRF, 1);
 
   dtls_debug_dump("d:", data + DTLS_HS_LENGTH, sizeof(b.verify_data));
   dtls_debug_dump("v:", b.verify_data, sizeof(b.verify_data));
@@ -1235,78 +2638,145 @@ check_finished(dtls_context_t *ctx, dtls_peer_t *peer,
 }
 
 /**
- * Prepares the payload given in \p data for sending with
- * dtls_send(). The \p data is encrypted and compressed according to
- * the current security parameters of \p peer.  The result of this
- * operation is put into \p sendbuf with a prepended record header of
- * type \p type ready for sending. As some cipher suites add a MAC
- * before encryption, \p data must be large enough to hold this data
- * as well (usually \c dtls_kb_digest_size(CURRENT_CONFIG(peer)).
- *
- * \param peer    The remote peer the packet will be sent to.
- * \param security  The encryption paramater used to encrypt
- * \param type    The content type of this record.
- * \param data_array Array with payloads in correct order.
- * \param data_len_array sizes of the payloads in correct order.
- * \param data_array_len The number of payloads given.
- * \param sendbuf The output buffer where the encrypted record
- *                will be placed.
- * \param rlen    This parameter must be initialized with the 
- *                maximum size of \p sendbuf and will be updated
- *                to hold the actual size of the stored packet
- *                on success. On error, the value of \p rlen is
- *                undefined. 
- * \return Less than zero on error, or greater than zero success.
+ * Returns the length of the peer's connection ID in the records that
+ * are protected with @p security, or @c 0 if records without ID are
+ * sent.
+ */
+static inline size_t
+dtls_record_cid_length(const dtls_security_parameters_t *security) {
+#if DTLS_CID_MAX_LENGTH > 0
+  if (security && security->cipher != TLS_NULL_WITH_NULL_NULL)
+    return security->write_cid_length;
+#else /* DTLS_CID_MAX_LENGTH > 0 */
+  (void)security;
+#endif /* DTLS_CID_MAX_LENGTH > 0 */
+  return 0;
+}
+
+/**
+ * Returns the number of bytes that precede the payload of a record
+ * protected with @p security, i.e. the record header with the
+ * connection ID and, for the AEAD cipher suites, the explicit part
+ * of the nonce.
+ */
+static inline size_t
+dtls_record_headroom(const dtls_security_parameters_t *security) {
+  if (!security || security->cipher == TLS_NULL_WITH_NULL_NULL)
+    return DTLS_RH_LENGTH;
+  return DTLS_RH_LENGTH + dtls_aead_explicit_nonce_length(security->cipher)
+    + dtls_record_cid_length(security);
+}
+
+/**
+ * Returns the number of bytes that follow the payload of a record
+ * protected with @p security, i.e. the real content type of records
+ * with connection ID and the MAC of the AEAD cipher suites.
+ */
+static inline size_t
+dtls_record_tailroom(const dtls_security_parameters_t *security) {
+  if (!security || security->cipher == TLS_NULL_WITH_NULL_NULL)
+    return 0;
+  return dtls_aead_mac_length(security->cipher)
+    + (dtls_record_cid_length(security) ? 1 : 0);
+}
+
+/**
+ * Encrypts (\p seal is set) or decrypts the record of \p job in place
+ * with the AEAD of the cipher suite of \p security.
+ *
+ * \return The result of the ccm_seal, ccm_open, gcm_seal, gcm_open,
+ *         chacha20_seal or chacha20_open operation of the crypto
+ *         provider.
  */
 static int
-dtls_prepare_record(dtls_peer_t *peer, dtls_security_parameters_t *security,
-		    unsigned char type,
-		    uint8 *data_array[], size_t data_len_array[],
-		    size_t data_array_len,
-		    uint8 *sendbuf, size_t *rlen) {
-  uint8 *p, *start;
+dtls_aead_crypt(const dtls_security_parameters_t *security,
+		const dtls_ccm_job_t *job, int seal) {
+  const dtls_crypto_provider_t *crypto = security->crypto;
+  int (*crypt)(aes128_ccm_t *ctx,
+	       const unsigned char *src, size_t length,
+	       unsigned char *buf, unsigned char *nonce,
+	       const unsigned char *aad, size_t aad_length);
+
+  crypt = seal ? crypto->ccm_seal : crypto->ccm_open;
+#if DTLS_GCM
+  if (is_tls_aes_128_gcm(security->cipher))
+    crypt = seal ? crypto->gcm_seal : crypto->gcm_open;
+#endif /* DTLS_GCM */
+#if DTLS_CHACHA20
+  if (is_tls_chacha20_poly1305(security->cipher))
+    crypt = seal ? crypto->chacha20_seal : crypto->chacha20_open;
+#endif /* DTLS_CHACHA20 */
+  return crypt(job->ctx, job->buf, job->length, job->buf,
+	       job->nonce, job->aad, job->aad_length);
+}
+
+/**
+ * Turns the payload in \p sendbuf into a record of type \p type that
+ * is to be protected according to \p security, but leaves the AEAD
+ * encryption to the caller. The \p length bytes of payload must have
+ * been placed in \p sendbuf after dtls_record_headroom() bytes that
+ * are left for the record header and the explicit nonce. If the
+ * record must be encrypted, \p job is set up to encrypt the payload
+ * in place with dtls_aead_crypt(), otherwise
+ * \p job->ctx is set to \c NULL. The caller must point \p job->nonce
+ * and \p job->aad to DTLS_CCM_BLOCKSIZE and DTLS_A_DATA_MAX bytes.
+ * The record is completed with dtls_seal_finish().
+ *
+ * \param peer    The remote peer the packet will be sent to.
+ * \param security  The encryption paramater used to encrypt
+ * \param type    The content type of this record.
+ * \param sendbuf The buffer holding the payload where the record is
+ *                built.
+ * \param length  The length of the payload in \p sendbuf.
+ * \param rlen    The maximum size of \p sendbuf.
+ * \param job     The encryption that remains to be done.
+ * \return Less than zero on error, or the length of the record's
+ *         fragment without the MAC.
+ */
+static int
+dtls_seal_prepare(dtls_peer_t *peer, dtls_security_parameters_t *security,
+		  unsigned char type, uint8 *sendbuf, size_t length,
+		  size_t rlen, dtls_ccm_job_t *job) {
+  uint8 *start;
+  size_t cid_length = dtls_record_cid_length(security);
   int res;
-  unsigned int i;
-  
-  if (*rlen < DTLS_RH_LENGTH) {
-    dtls_alert("The sendbuf (%zu bytes) is too small\n", *rlen);
+
+  job->ctx = NULL;
+  if (rlen < dtls_record_headroom(security) + length
+      + dtls_record_tailroom(security)) {
+    dtls_debug("dtls_seal_record: send buffer too small\n");
     return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
   }
 
-  p = dtls_set_record_header(type, security, sendbuf);
-  start = p;
+#if DTLS_CID_MAX_LENGTH > 0
+  if (cid_length) {
+    /* RFC 9146: the connection ID precedes the length field and the
+     * real content type is appended to the payload */
+    start = dtls_set_record_header(DTLS_CT_TLS12_CID, security, sendbuf);
+    memcpy(start - sizeof(uint16), security->write_cid, cid_length);
+    start += cid_length;
+    sendbuf[dtls_record_headroom(security) + length] = type;
+    length++;
+  } else
+#endif /* DTLS_CID_MAX_LENGTH > 0 */
+  start = dtls_set_record_header(type, security, sendbuf);
 
   if (!security || security->cipher == TLS_NULL_WITH_NULL_NULL) {
     /* no cipher suite */
-
-    res = 0;
-    for (i = 0; i < data_array_len; i++) {
-      /* check the minimum that we need for packets that are not encrypted */
-      if (*rlen < res + DTLS_RH_LENGTH + data_len_array[i]) {
-        dtls_debug("dtls_prepare_record: send buffer too small\n");
-        return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
-      }
-
-      memcpy(p, data_array[i], data_len_array[i]);
-      p += data_len_array[i];
-      res += data_len_array[i];
-    }
-  } else { /* TLS_PSK_WITH_AES_128_CCM_8 or TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8 */   
+    res = length;
+  } else { /* one of the AEAD cipher suites */
     /** 
      * length of additional_data for the AEAD cipher which consists of
      * seq_num(2+6) + type(1) + version(2) + length(2)
      */
 #define A_DATA_LEN 13
-    unsigned char nonce[DTLS_CCM_BLOCKSIZE];
-    unsigned char A_DATA[A_DATA_LEN];
+    unsigned char *nonce = job->nonce;
+    unsigned char *A_DATA = job->aad;
+    size_t la = A_DATA_LEN;
+    size_t explicit_length = dtls_aead_explicit_nonce_length(security->cipher);
 
-    if (is_tls_psk_with_aes_128_ccm_8(security->cipher)) {
-      dtls_debug("dtls_prepare_record(): encrypt using TLS_PSK_WITH_AES_128_CCM_8\n");
-    } else if (is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(security->cipher)) {
-      dtls_debug("dtls_prepare_record(): encrypt using TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8\n");
-    } else {
-      dtls_debug("dtls_prepare_record(): encrypt using unknown cipher\n");
-    }
+    dtls_debug("dtls_seal_record(): encrypt using %s\n",
+	       dtls_cipher_name(security->cipher));
 
     /* set nonce       
        from RFC 6655:
@@ -1348,26 +2818,13 @@ dtls_prepare_record(dtls_peer_t *peer, dtls_security_parameters_t *security,
    	            } CCMNonceExample;
     */
 
-    memcpy(p, &DTLS_RECORD_HEADER(sendbuf)->epoch, 8);
-    p += 8;
-    res = 8;
-
-    for (i = 0; i < data_array_len; i++) {
-      /* check the minimum that we need for packets that are not encrypted */
-      if (*rlen < res + DTLS_RH_LENGTH + data_len_array[i]) {
-        dtls_debug("dtls_prepare_record: send buffer too small\n");
-        return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
-      }
-
-      memcpy(p, data_array[i], data_len_array[i]);
-      p += data_len_array[i];
-      res += data_len_array[i];
-    }
+    memcpy(start, &DTLS_RECORD_HEADER(sendbuf)->epoch, explicit_length);
+    res = explicit_length + length;
 
     memset(nonce, 0, DTLS_CCM_BLOCKSIZE);
     memcpy(nonce, dtls_kb_local_iv(security, peer->role),
 	   dtls_kb_iv_size(security, peer->role));
-    memcpy(nonce + dtls_kb_iv_size(security, peer->role), start, 8); /* epoch + seq_num */
+    dtls_aead_nonce_seq(nonce, security, DTLS_RECORD_HEADER(sendbuf)->epoch);
 
     dtls_debug_dump("nonce:", nonce, DTLS_CCM_BLOCKSIZE);
     dtls_debug_dump("key:", dtls_kb_local_write_key(security, peer->role),
@@ -1378,29 +2835,577 @@ dtls_prepare_record(dtls_peer_t *peer, dtls_security_parameters_t *security,
      * additional_data = seq_num + TLSCompressed.type +
      *                   TLSCompressed.version + TLSCompressed.length;
      */
-    memcpy(A_DATA, &DTLS_RECORD_HEADER(sendbuf)->epoch, 8); /* epoch and seq_num */
-    memcpy(A_DATA + 8,  &DTLS_RECORD_HEADER(sendbuf)->content_type, 3); /* type and version */
-    dtls_int_to_uint16(A_DATA + 11, res - 8); /* length */
+#if DTLS_CID_MAX_LENGTH > 0
+    if (cid_length) {
+      la = dtls_cid_additional_data(A_DATA, sendbuf, cid_length,
+				    length);
+    } else
+#endif /* DTLS_CID_MAX_LENGTH > 0 */
+    {
+      memcpy(A_DATA, &DTLS_RECORD_HEADER(sendbuf)->epoch, 8); /* epoch and seq_num */
+      memcpy(A_DATA + 8,  &DTLS_RECORD_HEADER(sendbuf)->content_type, 3); /* type and version */
+      dtls_int_to_uint16(A_DATA + 11, length); /* length */
+    }
     
-    res = dtls_encrypt(start + 8, res - 8, start + 8, nonce,
-		       dtls_kb_local_write_key(security, peer->role),
-		       dtls_kb_key_size(security, peer->role),
-		       A_DATA, A_DATA_LEN);
+    job->ctx = &security->write_ctx;
+    job->buf = start + explicit_length;
+    job->length = length;
+    job->aad_length = la;
+  }
+
+  return res;
+}
+
+/**
+ * Completes the record in \p sendbuf after dtls_seal_prepare() and
+ * the encryption of its payload. \p res is the length of the
+ * record's fragment, \p rlen is set to the length of the record.
+ */
+static void
+dtls_seal_finish(dtls_security_parameters_t *security, uint8 *sendbuf,
+		 int res, size_t *rlen) {
+  size_t cid_length = dtls_record_cid_length(security);
 
+  /* fix length of fragment in sendbuf */
+  dtls_int_to_uint16(sendbuf + 11 + cid_length, res);
+  *rlen = DTLS_RH_LENGTH + cid_length + res;
+}
+
+/**
+ * Turns the payload in \p sendbuf into a record of type \p type that
+ * is protected according to \p security. The \p length bytes of
+ * payload must have been placed in \p sendbuf after
+ * dtls_record_headroom() bytes that are left for the record header
+ * and the explicit nonce. The payload is encrypted in place and the
+ * MAC is appended, so \p sendbuf must provide dtls_record_tailroom()
+ * more bytes after the payload.
+ *
+ * \param peer    The remote peer the packet will be sent to.
+ * \param security  The encryption paramater used to encrypt
+ * \param type    The content type of this record.
+ * \param sendbuf The buffer holding the payload where the record is
+ *                built.
+ * \param length  The length of the payload in \p sendbuf.
+ * \param rlen    This parameter must be initialized with the 
+ *                maximum size of \p sendbuf and will be updated
+ *                to hold the actual size of the stored packet
+ *                on success. On error, the value of \p rlen is
+ *                undefined. 
+ * \return Less than zero on error, or greater than zero success.
+ */
+static int
+dtls_seal_record(dtls_peer_t *peer, dtls_security_parameters_t *security,
+		 unsigned char type, uint8 *sendbuf, size_t length,
+		 size_t *rlen) {
+  unsigned char nonce[DTLS_CCM_BLOCKSIZE];
+  unsigned char A_DATA[DTLS_A_DATA_MAX];
+  dtls_ccm_job_t job;
+  int res;
+
+  job.nonce = nonce;
+  job.aad = A_DATA;
+  res = dtls_seal_prepare(peer, security, type, sendbuf, length, *rlen, &job);
+  if (res < 0)
+    return res;
+
+  if (job.ctx) {
+    res = dtls_aead_crypt(security, &job, 1);
     if (res < 0)
       return res;
 
-    res += 8;			/* increment res by size of nonce_explicit */
-    dtls_debug_dump("message:", start, res);
+    /* increment res by size of nonce_explicit */
+    res += dtls_aead_explicit_nonce_length(security->cipher);
+    dtls_debug_dump("message:", job.buf
+		    - dtls_aead_explicit_nonce_length(security->cipher), res);
   }
 
-  /* fix length of fragment in sendbuf */
-  dtls_int_to_uint16(sendbuf + 11, res);
-  
-  *rlen = DTLS_RH_LENGTH + res;
+  dtls_seal_finish(security, sendbuf, res, rlen);
   return 0;
 }
 
+/**
+ * Prepares the payload given in \p data for sending with
+ * dtls_send(). The \p data is encrypted and compressed according to
+ * the current security parameters of \p peer.  The result of this
+ * operation is put into \p sendbuf with a prepended record header of
+ * type \p type ready for sending. The payloads are copied once into
+ * \p sendbuf and then protected in place by dtls_seal_record().
+ *
+ * \param peer    The remote peer the packet will be sent to.
+ * \param security  The encryption paramater used to encrypt
+ * \param type    The content type of this record.
+ * \param data_array Array with payloads in correct order.
+ * \param data_len_array sizes of the payloads in correct order.
+ * \param data_array_len The number of payloads given.
+ * \param sendbuf The output buffer where the encrypted record
+ *                will be placed.
+ * \param rlen    This parameter must be initialized with the 
+ *                maximum size of \p sendbuf and will be updated
+ *                to hold the actual size of the stored packet
+ *                on success. On error, the value of \p rlen is
+ *                undefined. 
+ * \return Less than zero on error, or greater than zero success.
+ */
+static int
+dtls_prepare_record(dtls_peer_t *peer, dtls_security_parameters_t *security,
+		    unsigned char type,
+		    uint8 *data_array[], size_t data_len_array[],
+		    size_t data_array_len,
+		    uint8 *sendbuf, size_t *rlen) {
+  uint8 *p;
+  size_t length = 0;
+  unsigned int i;
+  
+  p = sendbuf + dtls_record_headroom(security);
+  for (i = 0; i < data_array_len; i++) {
+    if (*rlen < dtls_record_headroom(security) + length + data_len_array[i]
+	+ dtls_record_tailroom(security)) {
+      dtls_debug("dtls_prepare_record: send buffer too small\n");
+      return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+    }
+
+    memcpy(p, data_array[i], data_len_array[i]);
+    p += data_len_array[i];
+    length += data_len_array[i];
+  }
+
+  return dtls_seal_record(peer, security, type, sendbuf, length, rlen);
+}
+
+#if DTLS_WRITE_BATCH_SIZE > 0
+/** Passes all queued datagrams to the write_batch handler. */
+static void
+dtls_writeq_flush(dtls_context_t *ctx) {
+  if (ctx->writeq_len) {
+    (void)CALL(ctx, write_batch, ctx->writeq, ctx->writeq_len);
+    ctx->writeq_len = 0;
+  }
+}
+
+/**
+ * Returns the buffer where the next outgoing datagram should be
+ * assembled, or NULL if datagrams are passed directly to the write
+ * handler. A full queue is flushed first.
+ */
+static inline unsigned char *
+dtls_writeq_buffer(dtls_context_t *ctx) {
+  if (!ctx->h || !ctx->h->write_batch)
+    return NULL;
+
+  if (ctx->writeq_len == DTLS_WRITE_BATCH_SIZE)
+    dtls_writeq_flush(ctx);
+  return ctx->writebuf[ctx->writeq_len];
+}
+#else /* DTLS_WRITE_BATCH_SIZE > 0 */
+#define dtls_writeq_flush(Context)
+#define dtls_writeq_buffer(Context) NULL
+#endif /* DTLS_WRITE_BATCH_SIZE > 0 */
+
+/**
+ * Sends the datagram @p buf of length @p len to @p session. Datagrams
+ * that have been assembled in the buffer returned by
+ * dtls_writeq_buffer() are queued for the write_batch handler, all
+ * others are sent immediately after anything that is still pending.
+ *
+ * @return The number of bytes sent or queued, or a value less than
+ *   zero on error.
+ */
+static int
+dtls_write_record(dtls_context_t *ctx, session_t *session,
+		  unsigned char *buf, size_t len) {
+#if DTLS_WRITE_BATCH_SIZE > 0
+  dtls_message_t *m;
+#endif /* DTLS_WRITE_BATCH_SIZE > 0 */
+
+  DTLS_STATS_ADD(ctx, bytes_out, len);
+#if DTLS_WRITE_BATCH_SIZE > 0
+
+  if (buf == dtls_writeq_buffer(ctx)) {
+    m = &ctx->writeq[ctx->writeq_len++];
+    m->session = *session;
+    m->msg = buf;
+    m->length = len;
+    m->result = 0;
+    return len;
+  }
+#endif /* DTLS_WRITE_BATCH_SIZE > 0 */
+
+  /* keep the order of datagrams that are still pending */
+  dtls_flush(ctx);
+  return CALL(ctx, write, session, buf, len);
+}
+
+/**
+ * Returns the datagram that collects the records of the current
+ * flight. It is assembled directly in the write queue if possible.
+ */
+static inline unsigned char *
+dtls_flight_datagram(dtls_context_t *ctx) {
+  unsigned char *buf = dtls_writeq_buffer(ctx);
+  return buf ? buf : ctx->flightbuf;
+}
+
+/** Sends the records that have been packed into the flight datagram. */
+static void
+dtls_flight_flush(dtls_context_t *ctx) {
+  size_t len = ctx->flight_len;
+
+  if (len) {
+    ctx->flight_len = 0;
+    (void)dtls_write_record(ctx, &ctx->flight_session,
+			    dtls_flight_datagram(ctx), len);
+  }
+}
+
+/**
+ * Returns the position in the flight datagram where the next record
+ * of at most @p need bytes for @p session should be placed and sets
+ * @p len to the space that is left. The datagram is sent first if it
+ * belongs to another session or would grow beyond @p pmtu bytes.
+ */
+static unsigned char *
+dtls_flight_buffer(dtls_context_t *ctx, session_t *session,
+		   size_t need, size_t pmtu, size_t *len) {
+  if (ctx->flight_len &&
+      (ctx->flight_len + need > pmtu
+       || !dtls_session_equals(&ctx->flight_session, session)))
+    dtls_flight_flush(ctx);
+
+  if (!ctx->flight_len)
+    ctx->flight_session = *session;
+
+  *len = DTLS_MAX_BUF - ctx->flight_len;
+  return dtls_flight_datagram(ctx) + ctx->flight_len;
+}
+
+void
+dtls_flush(dtls_context_t *ctx) {
+  dtls_flight_flush(ctx);
+  dtls_writeq_flush(ctx);
+}
+
+int
+dtls_write_inplace(struct dtls_context_t *ctx, session_t *dst,
+		   uint8 *buf, size_t size, size_t len) {
+  dtls_peer_t *peer = dtls_get_peer(ctx, dst);
+  dtls_security_parameters_t *security;
+  size_t rlen = size;
+  int res;
+
+  if (!peer) {
+    res = dtls_connect(ctx, dst);
+    return (res >= 0) ? 0 : res;
+  }
+
+  if (peer->state != DTLS_STATE_CONNECTED)
+    return 0;
+
+  security = dtls_security_params(peer);
+
+  if (size < DTLS_RECORD_HEADROOM + len + DTLS_RECORD_TAILROOM ||
+      size < dtls_record_headroom(security) + len
+	     + dtls_record_tailroom(security))
+    return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+
+  /* without a cipher, the payload directly follows the record header,
+   * with a connection ID, the header is longer */
+  if (dtls_record_headroom(security) != DTLS_RECORD_HEADROOM)
+    memmove(buf + dtls_record_headroom(security),
+	    buf + DTLS_RECORD_HEADROOM, len);
+
+  dtls_trace(ctx, DTLS_TRACE_CCM, 0);
+  res = dtls_seal_record(peer, security, DTLS_CT_APPLICATION_DATA,
+			 buf, len, &rlen);
+  dtls_trace(ctx, DTLS_TRACE_CCM, 1);
+  if (res < 0)
+    return res;
+  DTLS_STATS_ADD(ctx, records_out, 1);
+
+  res = dtls_write_record(ctx, dst, buf, rlen);
+  return res <= 0 ? res : (int)(len - (rlen - (unsigned int)res));
+}
+
+#if DTLS_RECORD_BATCH_SIZE > 0
+/**
+ * Seals or opens the records of the @p count jobs that have been set
+ * up by dtls_seal_prepare() or dtls_open_prepare(), where @p job[i]
+ * belongs to @p security[i]. The records of each provider with batch
+ * operations are passed to it together, the others are processed one
+ * by one. Jobs without cipher context are skipped.
+ */
+static void
+dtls_ccm_run(dtls_security_parameters_t *security[], dtls_ccm_job_t job[],
+	     size_t count, int seal) {
+  dtls_ccm_job_t batch[DTLS_RECORD_BATCH_SIZE];
+  size_t index[DTLS_RECORD_BATCH_SIZE];
+  unsigned char done[DTLS_RECORD_BATCH_SIZE];
+  void (*multi)(dtls_ccm_job_t *, size_t);
+  const dtls_crypto_provider_t *crypto;
+  size_t i, j, n;
+
+  for (i = 0; i < count; i++)
+    done[i] = !job[i].ctx;
+
+  for (i = 0; i < count; i++) {
+    if (done[i])
+      continue;
+
+    crypto = security[i]->crypto;
+    multi = seal ? crypto->ccm_seal_multi : crypto->ccm_open_multi;
+    if (!multi || !is_tls_aes_128_ccm_8(security[i]->cipher)) {
+      job[i].result = dtls_aead_crypt(security[i], &job[i], seal);
+      continue;
+    }
+
+    for (j = i, n = 0; j < count; j++) {
+      if (!done[j] && security[j]->crypto == crypto
+	  && is_tls_aes_128_ccm_8(security[j]->cipher)) {
+	batch[n] = job[j];
+	index[n++] = j;
+	done[j] = 1;
+      }
+    }
+    multi(batch, n);
+    for (j = 0; j < n; j++)
+      job[index[j]].result = batch[j].result;
+  }
+}
+
+/**
+ * Sends the @c length bytes at @c msg of each of the @p n messages in
+ * @p msgs to @p peer[i], where @p n must not exceed
+ * DTLS_RECORD_BATCH_SIZE. The records for connected peers are
+ * encrypted together. The @c result field of each message is set like
+ * by dtls_write(), it is @c 0 if @p peer[i] is NULL or not connected.
+ */
+static void
+dtls_seal_messages(dtls_context_t *ctx, dtls_message_t *msgs,
+		   dtls_peer_t *peer[], size_t n) {
+  unsigned char nonce[DTLS_RECORD_BATCH_SIZE][DTLS_CCM_BLOCKSIZE];
+  unsigned char aad[DTLS_RECORD_BATCH_SIZE][DTLS_A_DATA_MAX];
+  dtls_ccm_job_t job[DTLS_RECORD_BATCH_SIZE];
+  dtls_security_parameters_t *security[DTLS_RECORD_BATCH_SIZE];
+  size_t index[DTLS_RECORD_BATCH_SIZE];
+  int fragment[DTLS_RECORD_BATCH_SIZE];
+  uint8 *buf;
+  size_t i, k, sealed, rlen;
+  int res;
+
+  /* The records are built in the buffers of the write queue, in the
+   * order in which they are queued afterwards. */
+  dtls_flush(ctx);
+  for (i = sealed = 0; i < n; i++) {
+    msgs[i].result = 0;
+    if (!peer[i] || peer[i]->state != DTLS_STATE_CONNECTED)
+      continue;
+
+    security[sealed] = dtls_security_params(peer[i]);
+    if (msgs[i].length < 0 ||
+	DTLS_MAX_BUF < dtls_record_headroom(security[sealed])
+	+ msgs[i].length + dtls_record_tailroom(security[sealed])) {
+      msgs[i].result = dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+      continue;
+    }
+
+    buf = ctx->writebuf[sealed];
+    memcpy(buf + dtls_record_headroom(security[sealed]), msgs[i].msg,
+	   msgs[i].length);
+    job[sealed].nonce = nonce[sealed];
+    job[sealed].aad = aad[sealed];
+    res = dtls_seal_prepare(peer[i], security[sealed],
+			    DTLS_CT_APPLICATION_DATA, buf, msgs[i].length,
+			    DTLS_MAX_BUF, &job[sealed]);
+    if (res < 0) {
+      msgs[i].result = res;
+      continue;
+    }
+    fragment[sealed] = res;
+    index[sealed++] = i;
+  }
+
+  dtls_trace(ctx, DTLS_TRACE_CCM, 0);
+  dtls_ccm_run(security, job, sealed, 1);
+  dtls_trace(ctx, DTLS_TRACE_CCM, 1);
+
+  for (k = 0; k < sealed; k++) {
+    i = index[k];
+    res = fragment[k];
+    if (job[k].ctx) {
+      if (job[k].result < 0) {
+	msgs[i].result = job[k].result;
+	continue;
+      }
+      /* and the size of nonce_explicit */
+      res = job[k].result
+	+ dtls_aead_explicit_nonce_length(security[k]->cipher);
+    }
+
+    dtls_seal_finish(security[k], ctx->writebuf[k], res, &rlen);
+    DTLS_STATS_ADD(ctx, records_out, 1);
+    res = dtls_write_record(ctx, &msgs[i].session, ctx->writebuf[k], rlen);
+    msgs[i].result = res <= 0 ? res
+      : (int)(msgs[i].length - (rlen - (unsigned int)res));
+  }
+}
+
+int
+dtls_write_messages(dtls_context_t *ctx, dtls_message_t *msgs, size_t count) {
+  dtls_peer_t *peer[DTLS_RECORD_BATCH_SIZE];
+  size_t i, n;
+  int res, failed = 0;
+
+  for (; count; msgs += n, count -= n) {
+    n = min(count, DTLS_RECORD_BATCH_SIZE);
+    for (i = 0; i < n; i++)
+      peer[i] = dtls_get_peer(ctx, &msgs[i].session);
+
+    dtls_seal_messages(ctx, msgs, peer, n);
+
+    /* like dtls_write(), start a handshake for unknown peers */
+    for (i = 0; i < n; i++) {
+      if (!peer[i] && !dtls_get_peer(ctx, &msgs[i].session)) {
+	res = dtls_connect(ctx, &msgs[i].session);
+	msgs[i].result = (res >= 0) ? 0 : res;
+      }
+      if (msgs[i].result < 0)
+	failed++;
+    }
+  }
+
+  dtls_flush(ctx);
+  return failed;
+}
+
+int
+dtls_write_peers(dtls_context_t *ctx, dtls_peer_t *peers[], size_t count,
+		 uint8 *buf, size_t len) {
+  dtls_message_t msgs[DTLS_RECORD_BATCH_SIZE];
+  size_t i, n;
+  int failed = 0;
+
+  if (len > DTLS_MAX_BUF)
+    return count;
+
+  for (; count; peers += n, count -= n) {
+    n = min(count, DTLS_RECORD_BATCH_SIZE);
+    for (i = 0; i < n; i++) {
+      dtls_peer_session(peers[i], &msgs[i].session);
+      msgs[i].msg = buf;
+      msgs[i].length = len;
+    }
+
+    dtls_seal_messages(ctx, msgs, peers, n);
+    for (i = 0; i < n; i++)
+      if (msgs[i].result < 0)
+	failed++;
+  }
+
+  dtls_flush(ctx);
+  return failed;
+}
+#else /* DTLS_RECORD_BATCH_SIZE > 0 */
+int
+dtls_write_messages(dtls_context_t *ctx, dtls_message_t *msgs, size_t count) {
+  int failed = 0;
+
+  for (; count; msgs++, count--) {
+    msgs->result = msgs->length < 0 ? -1
+      : dtls_write(ctx, &msgs->session, msgs->msg, msgs->length);
+    if (msgs->result < 0)
+      failed++;
+  }
+  return failed;
+}
+
+int
+dtls_write_peers(dtls_context_t *ctx, dtls_peer_t *peers[], size_t count,
+		 uint8 *buf, size_t len) {
+  session_t session;
+  int failed = 0;
+
+  for (; count; peers++, count--) {
+    if (peers[0]->state == DTLS_STATE_CONNECTED &&
+	dtls_write(ctx, dtls_peer_session(peers[0], &session), buf, len) < 0)
+      failed++;
+  }
+  return failed;
+}
+#endif /* DTLS_RECORD_BATCH_SIZE > 0 */
+
+/** Number of peers that dtls_write_broadcast() passes to dtls_write_peers(). */
+#define DTLS_BROADCAST_CHUNK \
+  (DTLS_RECORD_BATCH_SIZE > 0 ? DTLS_RECORD_BATCH_SIZE : 1)
+
+int
+dtls_write_broadcast(dtls_context_t *ctx,
+		     int (*select)(dtls_context_t *ctx,
+				   const dtls_peer_t *peer, void *arg),
+		     void *arg, uint8 *buf, size_t len) {
+  dtls_peer_t *peers[DTLS_BROADCAST_CHUNK];
+  dtls_peer_t *peer;
+  size_t n = 0;
+  int failed = 0;
+
+  for (peer = ctx->lru[0]; peer; peer = peer->lru_next) {
+    if (peer->state != DTLS_STATE_CONNECTED
+	|| (select && !select(ctx, peer, arg)))
+      continue;
+
+    peers[n++] = peer;
+    if (n == DTLS_BROADCAST_CHUNK) {
+      failed += dtls_write_peers(ctx, peers, n, buf, len);
+      n = 0;
+    }
+  }
+  if (n)
+    failed += dtls_write_peers(ctx, peers, n, buf, len);
+  return failed;
+}
+
+/**
+ * Sends the handshake message with the header @p header and the body
+ * @p data as a sequence of fragments of at most @p frag_max bytes,
+ * each in its own record.
+ *
+ * @return Less than zero on error, the number of bytes of @p data
+ *   that have been sent otherwise.
+ */
+static int
+dtls_send_handshake_fragments(dtls_context_t *ctx, dtls_peer_t *peer,
+			      dtls_security_parameters_t *security,
+			      session_t *session, const uint8 *header,
+			      uint8 *data, size_t data_length,
+			      size_t frag_max) {
+  uint8 buf[DTLS_HS_LENGTH];
+  dtls_handshake_header_t *hs_header = DTLS_HANDSHAKE_HEADER(buf);
+  uint8 *data_array[2];
+  size_t data_len_array[2];
+  size_t offset, n;
+  int res;
+
+  /* all fragments share type, length and message_seq of the message */
+  memcpy(buf, header, sizeof(buf));
+  data_array[0] = buf;
+  data_len_array[0] = sizeof(buf);
+
+  for (offset = 0; offset < data_length; offset += n) {
+    n = min(data_length - offset, frag_max);
+    dtls_int_to_uint24(hs_header->fragment_offset, offset);
+    dtls_int_to_uint24(hs_header->fragment_length, n);
+    data_array[1] = data + offset;
+    data_len_array[1] = n;
+
+    dtls_debug("send handshake fragment %zu+%zu of %zu bytes\n",
+	       offset, n, data_length);
+    res = dtls_send_multi(ctx, peer, security, session, DTLS_CT_HANDSHAKE,
+			  data_array, data_len_array, 2);
+    if (res < 0)
+      return res;
+  }
+
+  return data_length;
+}
+
 static int
 dtls_send_handshake_msg_hash(dtls_context_t *ctx,
 			     dtls_peer_t *peer,
@@ -1414,10 +3419,23 @@ dtls_send_handshake_msg_hash(dtls_context_t *ctx,
   size_t data_len_array[2];
   int i = 0;
   dtls_security_parameters_t *security = peer ? dtls_security_params(peer) : NULL;
+  size_t frag_max = dtls_peer_pmtu(peer) - dtls_record_headroom(security)
+    - dtls_record_tailroom(security) - DTLS_HS_LENGTH;
 
   dtls_set_handshake_header(header_type, peer, data_length, 0,
 			    data_length, buf);
 
+  /* A server cannot reassemble a ClientHello before it has verified
+   * the cookie and created the handshake state. */
+  if (data_length > frag_max && header_type != DTLS_HT_CLIENT_HELLO) {
+    if (add_hash) {
+      update_hs_hash(peer, buf, sizeof(buf));
+      update_hs_hash(peer, data, data_length);
+    }
+    return dtls_send_handshake_fragments(ctx, peer, security, session,
+					 buf, data, data_length, frag_max);
+  }
+
   if (add_hash) {
     update_hs_hash(peer, buf, sizeof(buf));
   }
@@ -1445,7 +3463,10 @@ dtls_send_handshake_msg(dtls_context_t *ctx,
 			uint8 header_type,
 			uint8 *data, size_t data_length)
 {
-  return dtls_send_handshake_msg_hash(ctx, peer, &peer->session,
+  session_t session;
+
+  return dtls_send_handshake_msg_hash(ctx, peer,
+				      dtls_peer_session(peer, &session),
 				      header_type, data, data_length, 1);
 }
 
@@ -1491,71 +3512,96 @@ dtls_send_multi(dtls_context_t *ctx, dtls_peer_t *peer,
 		unsigned char type, uint8 *buf_array[],
 		size_t buf_len_array[], size_t buf_array_len)
 {
-  /* We cannot use ctx->sendbuf here as it is reserved for collecting
-   * the input for this function, i.e. buf == ctx->sendbuf.
-   *
-   * TODO: check if we can use the receive buf here. This would mean
-   * that we might not be able to handle multiple records stuffed in
-   * one UDP datagram */
-  unsigned char sendbuf[DTLS_MAX_BUF];
-  size_t len = sizeof(sendbuf);
+  unsigned char *sendbuf;
+  size_t len = DTLS_MAX_BUF;
   int res;
   unsigned int i;
   size_t overall_len = 0;
 
+  for (i = 0; i < buf_array_len; i++)
+    overall_len += buf_len_array[i];
+
+  if (type == DTLS_CT_APPLICATION_DATA) {
+    /* application data is sent right away to report errors from the
+     * write handler to the caller, the flight datagram is free then */
+    dtls_flight_flush(ctx);
+    sendbuf = dtls_writeq_buffer(ctx);
+    if (!sendbuf)
+      sendbuf = ctx->flightbuf;
+  } else {
+    /* all other records are packed into as few datagrams as possible */
+    sendbuf = dtls_flight_buffer(ctx, session,
+				 dtls_record_headroom(security) + overall_len
+				 + dtls_record_tailroom(security),
+				 dtls_peer_pmtu(peer), &len);
+  }
+
+  dtls_trace(ctx, DTLS_TRACE_CCM, 0);
   res = dtls_prepare_record(peer, security, type, buf_array, buf_len_array, buf_array_len, sendbuf, &len);
+  dtls_trace(ctx, DTLS_TRACE_CCM, 1);
 
   if (res < 0)
     return res;
+  DTLS_STATS_ADD(ctx, records_out, 1);
 
   /* if (peer && MUST_HASH(peer, type, buf, buflen)) */
   /*   update_hs_hash(peer, buf, buflen); */
 
   dtls_debug_hexdump("send header", sendbuf, sizeof(dtls_record_header_t));
-  for (i = 0; i < buf_array_len; i++) {
+  for (i = 0; i < buf_array_len; i++)
     dtls_debug_hexdump("send unencrypted", buf_array[i], buf_len_array[i]);
-    overall_len += buf_len_array[i];
-  }
 
   if ((type == DTLS_CT_HANDSHAKE && buf_array[0][0] != DTLS_HT_HELLO_VERIFY_REQUEST) ||
       type == DTLS_CT_CHANGE_CIPHER_SPEC) {
     /* copy handshake messages other than HelloVerify into retransmit buffer */
-    netq_t *n = netq_node_new(overall_len);
+    int sealed = 0;
+    netq_t *n;
+
+#if DTLS_RETRANSMIT_SEALED
+    /* keep records without a cipher, only their sequence number changes */
+    sealed = !security || security->cipher == TLS_NULL_WITH_NULL_NULL;
+#endif /* DTLS_RETRANSMIT_SEALED */
+    n = netq_node_new(&ctx->pools, sealed ? len : overall_len);
     if (n) {
       dtls_tick_t now;
       dtls_ticks(&now);
-      n->t = now + 2 * CLOCK_SECOND;
+      n->timeout = dtls_retransmit_timeout(ctx, peer);
+      n->t = now + n->timeout;
       n->retransmit_cnt = 0;
-      n->timeout = 2 * CLOCK_SECOND;
       n->peer = peer;
       n->epoch = (security) ? security->epoch : 0;
       n->type = type;
       n->length = 0;
+      if (sealed) {
+	n->sealed = 1;
+	memcpy(n->data, sendbuf, len);
+	n->length = len;
+      } else
       for (i = 0; i < buf_array_len; i++) {
         memcpy(n->data + n->length, buf_array[i], buf_len_array[i]);
         n->length += buf_len_array[i];
       }
 
-      if (!netq_insert_node(&ctx->sendqueue, n)) {
-	dtls_warn("cannot add packet to retransmit buffer\n");
-	netq_node_free(n);
+      netq_wheel_insert(&ctx->sendqueue, n);
 #ifdef WITH_CONTIKI
-      } else {
-	/* must set timer within the context of the retransmit process */
-	PROCESS_CONTEXT_BEGIN(&dtls_retransmit_process);
-	etimer_set(&ctx->retransmit_timer, n->timeout);
-	PROCESS_CONTEXT_END(&dtls_retransmit_process);
+      /* must set timer within the context of the retransmit process */
+      PROCESS_CONTEXT_BEGIN(&dtls_retransmit_process);
+      etimer_set(&ctx->retransmit_timer, n->timeout);
+      PROCESS_CONTEXT_END(&dtls_retransmit_process);
 #else /* WITH_CONTIKI */
-	dtls_debug("copied to sendqueue\n");
+      dtls_debug("copied to sendqueue\n");
 #endif /* WITH_CONTIKI */
-      }
     } else 
       dtls_warn("retransmit buffer full\n");
   }
 
-  /* FIXME: copy to peer's sendqueue (after fragmentation if
-   * necessary) and initialize retransmit timer */
-  res = CALL(ctx, write, session, sendbuf, len);
+  if (type != DTLS_CT_APPLICATION_DATA) {
+    /* sent with the next dtls_flush() */
+    ctx->flight_len += len;
+    return overall_len;
+  }
+
+  res = dtls_write_record(ctx, session, sendbuf, len);
 
   /* Guess number of bytes application data actually sent:
    * dtls_prepare_record() tells us in len the number of bytes to
@@ -1572,30 +3618,113 @@ dtls_send_alert(dtls_context_t *ctx, dtls_peer_t *peer, dtls_alert_level_t level
   return 0;
 }
 
-int 
-dtls_close(dtls_context_t *ctx, const session_t *remote) {
-  int res = -1;
+int 
+dtls_close(dtls_context_t *ctx, const session_t *remote) {
+  int res = -1;
+  dtls_peer_t *peer;
+
+  peer = dtls_get_peer(ctx, remote);
+
+  if (peer) {
+    res = dtls_send_alert(ctx, peer, DTLS_ALERT_LEVEL_FATAL, DTLS_ALERT_CLOSE_NOTIFY);
+    /* indicate tear down */
+    peer->state = DTLS_STATE_CLOSING;
+    dtls_flush(ctx);
+  }
+  return res;
+}
+
+static void dtls_destroy_peer(dtls_context_t *ctx, dtls_peer_t *peer, int unlink)
+{
+  session_t session;
+
+  dtls_peer_session(peer, &session);
+  if (peer->state != DTLS_STATE_CLOSED && peer->state != DTLS_STATE_CLOSING)
+    dtls_close(ctx, &session);
+  if (unlink) {
+    dtls_unlink_peer(ctx, peer);
+    dtls_dsrv_log_addr(DTLS_LOG_DEBUG, "removed peer", &session);
+  }
+  if (peer->handshake_params)
+    dtls_stats_handshake_end(ctx, peer->handshake_params, 0);
+  dtls_stop_retransmission(ctx, peer);
+  dtls_free_peer(peer);
+}
+
+/**
+ * Removes @p peer from @p ctx to make room for another peer or because
+ * it has been idle. Handshakes are dropped silently, connected peers
+ * are sent a close_notify alert.
+ */
+static void
+dtls_evict_peer(dtls_context_t *ctx, dtls_peer_t *peer) {
+  session_t session;
+
+  dtls_dsrv_log_addr(DTLS_LOG_INFO, "evicting peer",
+		     dtls_peer_session(peer, &session));
+  if (peer->state != DTLS_STATE_CONNECTED)
+    peer->state = DTLS_STATE_CLOSED;
+  dtls_destroy_peer(ctx, peer, 1);
+}
+
+/** Returns the least recently active peer of list @p i in @p ctx. */
+#define dtls_lru_last(ctx, i) ((ctx)->lru[i] ? (ctx)->lru[i]->lru_prev : NULL)
+
+/**
+ * Makes room for a new peer in @p ctx when it has reached the maximum
+ * number of handshakes or peers. The least recently active handshake
+ * is removed first, a connected peer only if there is no handshake.
+ *
+ * @return @c 0 if a new peer can be added, a value less than zero
+ *   if no peer can be removed.
+ */
+static int
+dtls_make_room(dtls_context_t *ctx) {
+  dtls_peer_t *peer = NULL;
+
+  if (ctx->lru_count[1] >= ctx->handshake_max
+      || ctx->lru_count[0] + ctx->lru_count[1] >= ctx->peer_max) {
+    peer = dtls_lru_last(ctx, 1);
+    if (!peer)
+      peer = dtls_lru_last(ctx, 0);
+    if (!peer)
+      return -1;
+    dtls_evict_peer(ctx, peer);
+  }
+  return 0;
+}
+
+/**
+ * Removes at most DTLS_PEER_EXPIRE_BATCH peers of @p ctx that have not
+ * been active within the idle timeout at @p now.
+ *
+ * @return The time when the next peer becomes idle, or @c 0 if there
+ *   is none.
+ */
+static clock_time_t
+dtls_expire_peers(dtls_context_t *ctx, clock_time_t now) {
   dtls_peer_t *peer;
+  clock_time_t next = 0;
+  unsigned int count = 0;
+  int i;
 
-  peer = dtls_get_peer(ctx, remote);
-
-  if (peer) {
-    res = dtls_send_alert(ctx, peer, DTLS_ALERT_LEVEL_FATAL, DTLS_ALERT_CLOSE_NOTIFY);
-    /* indicate tear down */
-    peer->state = DTLS_STATE_CLOSING;
-  }
-  return res;
-}
+  if (!ctx->idle_timeout)
+    return 0;
 
-static void dtls_destroy_peer(dtls_context_t *ctx, dtls_peer_t *peer, int unlink)
-{
-  if (peer->state != DTLS_STATE_CLOSED && peer->state != DTLS_STATE_CLOSING)
-    dtls_close(ctx, &peer->session);
-  if (unlink) {
-    DEL_PEER(ctx->peers, peer);
-    dtls_dsrv_log_addr(DTLS_LOG_DEBUG, "removed peer", &peer->session);
+  for (i = 0; i < 2; i++) {
+    while ((peer = dtls_lru_last(ctx, i))) {
+      if (peer->last_seen + ctx->idle_timeout > now) {
+	if (!next || peer->last_seen + ctx->idle_timeout < next)
+	  next = peer->last_seen + ctx->idle_timeout;
+	break;
+      }
+      if (count == DTLS_PEER_EXPIRE_BATCH)
+	return now;
+      dtls_evict_peer(ctx, peer);
+      count++;
+    }
   }
-  dtls_free_peer(peer);
+  return next;
 }
 
 /**
@@ -1622,15 +3751,22 @@ dtls_verify_peer(dtls_context_t *ctx,
 		 uint8 *data, size_t data_length)
 {
   uint8 buf[DTLS_HV_LENGTH + DTLS_COOKIE_LENGTH];
+  uint8 previous[DTLS_COOKIE_LENGTH];
   uint8 *p = buf;
   int len = DTLS_COOKIE_LENGTH;
   uint8 *cookie = NULL;
-  int err;
+  int err = 0;
 #undef mycookie
 #define mycookie (buf + DTLS_HV_LENGTH)
 
+  dtls_check_cookie_secret(ctx);
+
   /* Store cookie where we can reuse it for the HelloVerify request. */
-  err = dtls_create_cookie(ctx, session, data, data_length, mycookie, &len);
+#if DTLS_COOKIE_BATCH_SIZE > 0
+  if (!dtls_cookie_from_batch(ctx, data, mycookie))
+#endif /* DTLS_COOKIE_BATCH_SIZE > 0 */
+    err = dtls_create_cookie(&ctx->cookie_hmac[0], session, data, data_length,
+			     mycookie, &len);
   if (err < 0)
     return err;
 
@@ -1648,8 +3784,19 @@ dtls_verify_peer(dtls_context_t *ctx,
   dtls_debug_dump("compare with cookie", cookie, len);
 
   /* check if cookies match */
-  if (len == DTLS_COOKIE_LENGTH && memcmp(cookie, mycookie, len) == 0) {
+  if (len == DTLS_COOKIE_LENGTH && equals(cookie, mycookie, len)) {
     dtls_debug("found matching cookie\n");
+    DTLS_STATS_ADD(ctx, cookies_verified, 1);
+    return 0;
+  }
+
+  /* the cookie may have been created before the last rotation */
+  if (len == DTLS_COOKIE_LENGTH
+      && dtls_create_cookie(&ctx->cookie_hmac[1], session, data, data_length,
+			    previous, &len) == 0
+      && equals(cookie, previous, len)) {
+    dtls_debug("found cookie of the previous secret\n");
+    DTLS_STATS_ADD(ctx, cookies_verified, 1);
     return 0;
   }
 
@@ -1681,6 +3828,8 @@ dtls_verify_peer(dtls_context_t *ctx,
 		     buf, p - buf, 0);
   if (err < 0) {
     dtls_warn("cannot send HelloVerify request\n");
+  } else {
+    DTLS_STATS_ADD(ctx, cookies_issued, 1);
   }
   return err; /* HelloVerify is sent, now we cannot do anything but wait */
 
@@ -1688,11 +3837,39 @@ dtls_verify_peer(dtls_context_t *ctx,
 }
 
 #ifdef DTLS_ECC
+/**
+ * Copies the ASN.1 integer of @p length bytes at @p data to the
+ * DTLS_EC_KEY_SIZE bytes at @p result. DER adds a zero byte to values
+ * with the highest bit set, and shortens values that start with zero
+ * bytes. An integer has at least one byte.
+ */
+static int
+dtls_ecdsa_signature_int(const uint8 *data, size_t length,
+			 unsigned char *result) {
+  if (!length) {
+    dtls_alert("empty signature integer\n");
+    return dtls_alert_fatal_create(DTLS_ALERT_DECODE_ERROR);
+  }
+  while (length > DTLS_EC_KEY_SIZE && *data == 0) {
+    data++;
+    length--;
+  }
+  if (length > DTLS_EC_KEY_SIZE) {
+    dtls_alert("signature integer too long\n");
+    return dtls_alert_fatal_create(DTLS_ALERT_DECODE_ERROR);
+  }
+
+  memset(result, 0, DTLS_EC_KEY_SIZE - length);
+  memcpy(result + DTLS_EC_KEY_SIZE - length, data, length);
+  return 0;
+}
+
 static int
 dtls_check_ecdsa_signature_elem(uint8 *data, size_t data_length,
-				unsigned char **result_r,
-				unsigned char **result_s)
+				unsigned char *result_r,
+				unsigned char *result_s)
 {
+  int err;
   int i;
   uint8 *data_orig = data;
 
@@ -1742,12 +3919,20 @@ dtls_check_ecdsa_signature_elem(uint8 *data, size_t data_length,
   data += sizeof(uint8);
   data_length -= sizeof(uint8);
 
-  /* Sometimes these values have a leeding 0 byte */
-  *result_r = data + i - DTLS_EC_KEY_SIZE;
+  if (data_length < (size_t)i) {
+    dtls_alert("signature length wrong\n");
+    return dtls_alert_fatal_create(DTLS_ALERT_DECODE_ERROR);
+  }
+  if ((err = dtls_ecdsa_signature_int(data, i, result_r)) < 0)
+    return err;
 
   data += i;
   data_length -= i;
 
+  if (data_length < 2) {
+    dtls_alert("signature length wrong\n");
+    return dtls_alert_fatal_create(DTLS_ALERT_DECODE_ERROR);
+  }
   if (dtls_uint8_to_int(data) != 0x02) {
     dtls_alert("wrong ASN.1 struct, expected Integer\n");
     return dtls_alert_fatal_create(DTLS_ALERT_DECODE_ERROR);
@@ -1759,8 +3944,12 @@ dtls_check_ecdsa_signature_elem(uint8 *data, size_t data_length,
   data += sizeof(uint8);
   data_length -= sizeof(uint8);
 
-  /* Sometimes these values have a leeding 0 byte */
-  *result_s = data + i - DTLS_EC_KEY_SIZE;
+  if (data_length < (size_t)i) {
+    dtls_alert("signature length wrong\n");
+    return dtls_alert_fatal_create(DTLS_ALERT_DECODE_ERROR);
+  }
+  if ((err = dtls_ecdsa_signature_int(data, i, result_s)) < 0)
+    return err;
 
   data += i;
   data_length -= i;
@@ -1775,41 +3964,40 @@ check_client_certificate_verify(dtls_context_t *ctx,
 {
   dtls_handshake_parameters_t *config = peer->handshake_params;
   int ret;
-  unsigned char *result_r;
-  unsigned char *result_s;
+  unsigned char result_r[DTLS_EC_KEY_SIZE];
+  unsigned char result_s[DTLS_EC_KEY_SIZE];
   dtls_hash_ctx hs_hash;
-  unsigned char sha256hash[DTLS_HMAC_DIGEST_SIZE];
+  dtls_ecc_job_t local, *job;
 
-  assert(is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(config->cipher));
+  assert(is_tls_ecdhe_ecdsa(config->cipher));
 
   data += DTLS_HS_LENGTH;
 
-  if (data_length < DTLS_HS_LENGTH + DTLS_CV_LENGTH) {
+  if (data_length < DTLS_HS_LENGTH + DTLS_ECDSA_SIG_LENGTH_MIN) {
     dtls_alert("the packet length does not match the expected\n");
     return dtls_alert_fatal_create(DTLS_ALERT_DECODE_ERROR);
   }
+  data_length -= DTLS_HS_LENGTH;
 
-  ret = dtls_check_ecdsa_signature_elem(data, data_length, &result_r, &result_s);
+  ret = dtls_check_ecdsa_signature_elem(data, data_length, result_r, result_s);
   if (ret < 0) {
     return ret;
   }
   data += ret;
   data_length -= ret;
 
-  copy_hs_hash(peer, &hs_hash);
+  job = dtls_ecc_job_start(ctx, peer, &local, DTLS_ECC_JOB_VERIFY,
+			   DTLS_ECC_STEP_VERIFY);
+  memcpy(job->pub_x, config->keyx.ecdsa.other_pub_x, DTLS_EC_KEY_SIZE);
+  memcpy(job->pub_y, config->keyx.ecdsa.other_pub_y, DTLS_EC_KEY_SIZE);
+  memcpy(job->sig_r, result_r, DTLS_EC_KEY_SIZE);
+  memcpy(job->sig_s, result_s, DTLS_EC_KEY_SIZE);
 
-  dtls_hash_finalize(sha256hash, &hs_hash);
+  copy_hs_hash(peer, &hs_hash);
 
-  ret = dtls_ecdsa_verify_sig_hash(config->keyx.ecdsa.other_pub_x, config->keyx.ecdsa.other_pub_y,
-			    sizeof(config->keyx.ecdsa.other_pub_x),
-			    sha256hash, sizeof(sha256hash),
-			    result_r, result_s);
+  peer->handshake_params->crypto->hash_finalize(job->hash, &hs_hash);
 
-  if (ret < 0) {
-    dtls_alert("wrong signature err: %i\n", ret);
-    return dtls_alert_fatal_create(DTLS_ALERT_HANDSHAKE_FAILURE);
-  }
-  return 0;
+  return dtls_ecc_job_dispatch(ctx, peer, job, &local);
 }
 #endif /* DTLS_ECC */
 
@@ -1819,16 +4007,34 @@ dtls_send_server_hello(dtls_context_t *ctx, dtls_peer_t *peer)
   /* Ensure that the largest message to create fits in our source
    * buffer. (The size of the destination buffer is checked by the
    * encoding function, so we do not need to guess.) */
-  uint8 buf[DTLS_SH_LENGTH + 2 + 5 + 5 + 8 + 6];
+  uint8 buf[DTLS_SH_LENGTH + 2 + 5 + 5 + 8 + 6 + 4 + 5 + DTLS_CID_LENGTH];
   uint8 *p;
   int ecdsa;
   uint8 extension_size;
   dtls_handshake_parameters_t *handshake = peer->handshake_params;
   dtls_tick_t now;
-
-  ecdsa = is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(handshake->cipher);
-
-  extension_size = (ecdsa) ? 2 + 5 + 5 + 6 : 0;
+#if DTLS_CID_MAX_LENGTH > 0
+  uint8 cid_length = 0;
+#endif /* DTLS_CID_MAX_LENGTH > 0 */
+
+  ecdsa = is_tls_ecdhe_ecdsa(handshake->cipher);
+
+  extension_size = (ecdsa) ? 5 + 5 + 6 : 0;
+  if (handshake->ticket)
+    extension_size += 4;
+#if DTLS_CID_MAX_LENGTH > 0
+  if (handshake->cid) {
+#if DTLS_CID_LENGTH > 0
+    /* without a connection ID, the client's records are matched by
+     * their address as usual */
+    if (dtls_assign_cid(ctx, peer) == 0)
+      cid_length = DTLS_CID_LENGTH;
+#endif /* DTLS_CID_LENGTH > 0 */
+    extension_size += 5 + cid_length;
+  }
+#endif /* DTLS_CID_MAX_LENGTH > 0 */
+  if (extension_size)
+    extension_size += 2;
 
   /* Handshake header */
   p = buf;
@@ -1841,12 +4047,30 @@ dtls_send_server_hello(dtls_context_t *ctx, dtls_peer_t *peer)
    * followed by 28 bytes of generate random data. */
   dtls_ticks(&now);
   dtls_int_to_uint32(handshake->tmp.random.server, now / CLOCK_SECOND);
-  dtls_prng(handshake->tmp.random.server + 4, 28);
+  if (!dtls_prng(handshake->tmp.random.server + 4, 28)) {
+    dtls_crit("cannot generate the server random\n");
+    return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+  }
 
   memcpy(p, handshake->tmp.random.server, DTLS_RANDOM_LENGTH);
   p += DTLS_RANDOM_LENGTH;
 
-  *p++ = 0;			/* no session id */
+#if DTLS_SESSION_CACHE_SIZE > 0
+  /* Assign a new session id unless a session is resumed. When a
+   * ticket is issued, the session is not cached. */
+  if (!handshake->resumed && !handshake->ticket) {
+    handshake->session_id_length = DTLS_SESSION_ID_LENGTH;
+    if (!dtls_prng(handshake->session_id, DTLS_SESSION_ID_LENGTH)) {
+      dtls_crit("cannot generate a session id\n");
+      return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+    }
+  }
+#endif /* DTLS_SESSION_CACHE_SIZE > 0 */
+
+  dtls_int_to_uint8(p, handshake->session_id_length);
+  p += sizeof(uint8);
+  memcpy(p, handshake->session_id, handshake->session_id_length);
+  p += handshake->session_id_length;
 
   if (handshake->cipher != TLS_NULL_WITH_NULL_NULL) {
     /* selected cipher suite */
@@ -1902,6 +4126,34 @@ dtls_send_server_hello(dtls_context_t *ctx, dtls_peer_t *peer)
     p += sizeof(uint8);
   }
 
+  if (handshake->ticket) {
+    /* empty session ticket extension, a NewSessionTicket follows */
+    dtls_int_to_uint16(p, TLS_EXT_SESSION_TICKET);
+    p += sizeof(uint16);
+
+    dtls_int_to_uint16(p, 0);
+    p += sizeof(uint16);
+  }
+
+#if DTLS_CID_MAX_LENGTH > 0
+  if (handshake->cid) {
+    /* the connection ID that the client must use */
+    dtls_int_to_uint16(p, TLS_EXT_CONNECTION_ID);
+    p += sizeof(uint16);
+
+    dtls_int_to_uint16(p, cid_length + 1);
+    p += sizeof(uint16);
+
+    dtls_int_to_uint8(p, cid_length);
+    p += sizeof(uint8);
+
+#if DTLS_CID_LENGTH > 0
+    memcpy(p, peer->cid, cid_length);
+    p += cid_length;
+#endif /* DTLS_CID_LENGTH > 0 */
+  }
+#endif /* DTLS_CID_MAX_LENGTH > 0 */
+
   assert((buf <= p) && ((unsigned int)(p - buf) <= sizeof(buf)));
 
   /* TODO use the same record sequence number as in the ClientHello,
@@ -2001,27 +4253,13 @@ dtls_add_ecdsa_signature_elem(uint8 *p, uint32_t *point_r, uint32_t *point_s)
   return p;
 }
 
-static int
-dtls_send_server_key_exchange_ecdh(dtls_context_t *ctx, dtls_peer_t *peer,
-				   const dtls_ecdsa_key_t *key)
+/**
+ * Writes the ServerECDHParams with the ephemeral public key of
+ * @p config to @p p and returns a pointer behind them.
+ */
+static uint8 *
+dtls_add_ecdh_params(uint8 *p, const dtls_handshake_parameters_t *config)
 {
-  /* The ASN.1 Integer representation of an 32 byte unsigned int could be
-   * 33 bytes long add space for that */
-  uint8 buf[DTLS_SKEXEC_LENGTH + 2];
-  uint8 *p;
-  uint8 *key_params;
-  uint8 *ephemeral_pub_x;
-  uint8 *ephemeral_pub_y;
-  uint32_t point_r[9];
-  uint32_t point_s[9];
-  dtls_handshake_parameters_t *config = peer->handshake_params;
-
-  /* ServerKeyExchange 
-   *
-   * Start message construction at beginning of buffer. */
-  p = buf;
-
-  key_params = p;
   /* ECCurveType curve_type: named_curve */
   dtls_int_to_uint8(p, 3);
   p += sizeof(uint8);
@@ -2037,25 +4275,29 @@ dtls_send_server_key_exchange_ecdh(dtls_context_t *ctx, dtls_peer_t *peer,
   dtls_int_to_uint8(p, 4);
   p += sizeof(uint8);
 
-  /* store the pointer to the x component of the pub key and make space */
-  ephemeral_pub_x = p;
+  memcpy(p, config->keyx.ecdsa.own_eph_pub_x, DTLS_EC_KEY_SIZE);
   p += DTLS_EC_KEY_SIZE;
 
-  /* store the pointer to the y component of the pub key and make space */
-  ephemeral_pub_y = p;
+  memcpy(p, config->keyx.ecdsa.own_eph_pub_y, DTLS_EC_KEY_SIZE);
   p += DTLS_EC_KEY_SIZE;
 
-  dtls_ecdsa_generate_key(config->keyx.ecdsa.own_eph_priv,
-			  ephemeral_pub_x, ephemeral_pub_y,
-			  DTLS_EC_KEY_SIZE);
+  return p;
+}
 
-  /* sign the ephemeral and its paramaters */
-  dtls_ecdsa_create_sig(key->priv_key, DTLS_EC_KEY_SIZE,
-		       config->tmp.random.client, DTLS_RANDOM_LENGTH,
-		       config->tmp.random.server, DTLS_RANDOM_LENGTH,
-		       key_params, p - key_params,
-		       point_r, point_s);
+/** Sends the ServerKeyExchange with the signature @p point_r, @p point_s. */
+static int
+dtls_write_server_key_exchange_ecdh(dtls_context_t *ctx, dtls_peer_t *peer,
+				    uint32_t *point_r, uint32_t *point_s)
+{
+  /* The ASN.1 Integer representation of an 32 byte unsigned int could be
+   * 33 bytes long add space for that */
+  uint8 buf[DTLS_SKEXEC_LENGTH + 2];
+  uint8 *p;
 
+  /* ServerKeyExchange 
+   *
+   * Start message construction at beginning of buffer. */
+  p = dtls_add_ecdh_params(buf, peer->handshake_params);
   p = dtls_add_ecdsa_signature_elem(p, point_r, point_s);
 
   assert(p - buf <= sizeof(buf));
@@ -2063,6 +4305,36 @@ dtls_send_server_key_exchange_ecdh(dtls_context_t *ctx, dtls_peer_t *peer,
   return dtls_send_handshake_msg(ctx, peer, DTLS_HT_SERVER_KEY_EXCHANGE,
 				 buf, p - buf);
 }
+
+static int
+dtls_send_server_key_exchange_ecdh(dtls_context_t *ctx, dtls_peer_t *peer,
+				   const dtls_ecdsa_key_t *key)
+{
+  uint8 key_params[DTLS_SKEXEC_LENGTH];
+  size_t key_params_len;
+  dtls_hash_ctx data;
+  dtls_ecc_job_t local, *job;
+  dtls_handshake_parameters_t *config = peer->handshake_params;
+
+  if (dtls_ecc_generate_key(ctx, config, config->keyx.ecdsa.own_eph_pub_x,
+			    config->keyx.ecdsa.own_eph_pub_y) < 0)
+    return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+
+  /* sign the ephemeral and its paramaters */
+  key_params_len = dtls_add_ecdh_params(key_params, config) - key_params;
+
+  job = dtls_ecc_job_start(ctx, peer, &local, DTLS_ECC_JOB_SIGN,
+			   DTLS_ECC_STEP_SERVER_KEY_EXCHANGE);
+  memcpy(job->priv_key, key->priv_key, DTLS_EC_KEY_SIZE);
+
+  config->crypto->hash_init(&data);
+  config->crypto->hash_update(&data, config->tmp.random.client, DTLS_RANDOM_LENGTH);
+  config->crypto->hash_update(&data, config->tmp.random.server, DTLS_RANDOM_LENGTH);
+  config->crypto->hash_update(&data, key_params, key_params_len);
+  config->crypto->hash_finalize(job->hash, &data);
+
+  return dtls_ecc_job_dispatch(ctx, peer, job, &local);
+}
 #endif /* DTLS_ECC */
 
 #ifdef DTLS_PSK
@@ -2150,6 +4422,37 @@ dtls_send_server_hello_done(dtls_context_t *ctx, dtls_peer_t *peer)
 				 NULL, 0);
 }
 
+/**
+ * Sends the messages of the server's flight that follow the
+ * ServerKeyExchange: the optional CertificateRequest and the
+ * ServerHelloDone.
+ */
+static int
+dtls_send_server_hello_done_msgs(dtls_context_t *ctx, dtls_peer_t *peer)
+{
+  int res;
+
+#ifdef DTLS_ECC
+  if (is_tls_ecdhe_ecdsa(peer->handshake_params->cipher) &&
+      is_ecdsa_client_auth_supported(ctx)) {
+    res = dtls_send_server_certificate_request(ctx, peer);
+
+    if (res < 0) {
+      dtls_debug("dtls_server_hello: cannot prepare certificate Request record\n");
+      return res;
+    }
+  }
+#endif /* DTLS_ECC */
+
+  res = dtls_send_server_hello_done(ctx, peer);
+
+  if (res < 0) {
+    dtls_debug("dtls_server_hello: cannot prepare ServerHelloDone record\n");
+    return res;
+  }
+  return 0;
+}
+
 static int
 dtls_send_server_hello_msgs(dtls_context_t *ctx, dtls_peer_t *peer)
 {
@@ -2163,10 +4466,12 @@ dtls_send_server_hello_msgs(dtls_context_t *ctx, dtls_peer_t *peer)
   }
 
 #ifdef DTLS_ECC
-  if (is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(peer->handshake_params->cipher)) {
+  if (is_tls_ecdhe_ecdsa(peer->handshake_params->cipher)) {
     const dtls_ecdsa_key_t *ecdsa_key;
+    session_t session;
 
-    res = CALL(ctx, get_ecdsa_key, &peer->session, &ecdsa_key);
+    res = CALL(ctx, get_ecdsa_key, dtls_peer_session(peer, &session),
+	       &ecdsa_key);
     if (res < 0) {
       dtls_crit("no ecdsa certificate to send in certificate\n");
       return res;
@@ -2186,26 +4491,22 @@ dtls_send_server_hello_msgs(dtls_context_t *ctx, dtls_peer_t *peer)
       return res;
     }
 
-    if (is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(peer->handshake_params->cipher) &&
-	is_ecdsa_client_auth_supported(ctx)) {
-      res = dtls_send_server_certificate_request(ctx, peer);
-
-      if (res < 0) {
-        dtls_debug("dtls_server_hello: cannot prepare certificate Request record\n");
-        return res;
-      }
-    }
+    /* the rest of the flight follows the signature */
+    if (dtls_ecc_pending(peer))
+      return 0;
   }
 #endif /* DTLS_ECC */
 
 #ifdef DTLS_PSK
-  if (is_tls_psk_with_aes_128_ccm_8(peer->handshake_params->cipher)) {
+  if (is_tls_psk(peer->handshake_params->cipher)) {
     unsigned char psk_hint[DTLS_PSK_MAX_CLIENT_IDENTITY_LEN];
+    session_t session;
     int len;
 
     /* The identity hint is optional, therefore we ignore the result
      * and check psk only. */
-    len = CALL(ctx, get_psk_info, &peer->session, DTLS_PSK_HINT,
+    len = CALL(ctx, get_psk_info, dtls_peer_session(peer, &session),
+	       DTLS_PSK_HINT,
 	       NULL, 0, psk_hint, DTLS_PSK_MAX_CLIENT_IDENTITY_LEN);
 
     if (len < 0) {
@@ -2224,13 +4525,7 @@ dtls_send_server_hello_msgs(dtls_context_t *ctx, dtls_peer_t *peer)
   }
 #endif /* DTLS_PSK */
 
-  res = dtls_send_server_hello_done(ctx, peer);
-
-  if (res < 0) {
-    dtls_debug("dtls_server_hello: cannot prepare ServerHelloDone record\n");
-    return res;
-  }
-  return 0;
+  return dtls_send_server_hello_done_msgs(ctx, peer);
 }
 
 static inline int 
@@ -2252,10 +4547,19 @@ dtls_send_client_key_exchange(dtls_context_t *ctx, dtls_peer_t *peer)
 
   switch (handshake->cipher) {
 #ifdef DTLS_PSK
-  case TLS_PSK_WITH_AES_128_CCM_8: {
+  case TLS_PSK_WITH_AES_128_CCM_8:
+#if DTLS_GCM
+  case TLS_PSK_WITH_AES_128_GCM_SHA256:
+#endif /* DTLS_GCM */
+#if DTLS_CHACHA20
+  case TLS_PSK_WITH_CHACHA20_POLY1305_SHA256:
+#endif /* DTLS_CHACHA20 */
+  {
+    session_t session;
     int len;
 
-    len = CALL(ctx, get_psk_info, &peer->session, DTLS_PSK_IDENTITY,
+    len = CALL(ctx, get_psk_info, dtls_peer_session(peer, &session),
+	       DTLS_PSK_IDENTITY,
 	       handshake->keyx.psk.identity, handshake->keyx.psk.id_length,
 	       buf + sizeof(uint16),
 	       min(sizeof(buf) - sizeof(uint16),
@@ -2283,7 +4587,14 @@ dtls_send_client_key_exchange(dtls_context_t *ctx, dtls_peer_t *peer)
   }
 #endif /* DTLS_PSK */
 #ifdef DTLS_ECC
-  case TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8: {
+  case TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8:
+#if DTLS_GCM
+  case TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256:
+#endif /* DTLS_GCM */
+#if DTLS_CHACHA20
+  case TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256:
+#endif /* DTLS_CHACHA20 */
+  {
     uint8 *ephemeral_pub_x;
     uint8 *ephemeral_pub_y;
 
@@ -2299,9 +4610,9 @@ dtls_send_client_key_exchange(dtls_context_t *ctx, dtls_peer_t *peer)
     ephemeral_pub_y = p;
     p += DTLS_EC_KEY_SIZE;
 
-    dtls_ecdsa_generate_key(peer->handshake_params->keyx.ecdsa.own_eph_priv,
-    			    ephemeral_pub_x, ephemeral_pub_y,
-    			    DTLS_EC_KEY_SIZE);
+    if (dtls_ecc_generate_key(ctx, peer->handshake_params,
+			      ephemeral_pub_x, ephemeral_pub_y) < 0)
+      return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
 
     break;
   }
@@ -2319,11 +4630,27 @@ dtls_send_client_key_exchange(dtls_context_t *ctx, dtls_peer_t *peer)
   case TLS_PSK_WITH_AES_128_CCM_8:
     /* fall through to default */
 #endif /* !DTLS_PSK */
+#if !defined(DTLS_PSK) || !DTLS_GCM
+  case TLS_PSK_WITH_AES_128_GCM_SHA256:
+    /* fall through to default */
+#endif /* !DTLS_PSK || !DTLS_GCM */
+#if !defined(DTLS_PSK) || !DTLS_CHACHA20
+  case TLS_PSK_WITH_CHACHA20_POLY1305_SHA256:
+    /* fall through to default */
+#endif /* !DTLS_PSK || !DTLS_CHACHA20 */
 
 #ifndef DTLS_ECC
   case TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8:
     /* fall through to default */
 #endif /* !DTLS_ECC */
+#if !defined(DTLS_ECC) || !DTLS_GCM
+  case TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256:
+    /* fall through to default */
+#endif /* !DTLS_ECC || !DTLS_GCM */
+#if !defined(DTLS_ECC) || !DTLS_CHACHA20
+  case TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256:
+    /* fall through to default */
+#endif /* !DTLS_ECC || !DTLS_CHACHA20 */
 
   default:
     dtls_crit("cipher %x04 not supported\n", handshake->cipher);
@@ -2337,90 +4664,236 @@ dtls_send_client_key_exchange(dtls_context_t *ctx, dtls_peer_t *peer)
 }
 
 #ifdef DTLS_ECC
+/** Sends the CertificateVerify with the signature @p point_r, @p point_s. */
 static int
-dtls_send_certificate_verify_ecdh(dtls_context_t *ctx, dtls_peer_t *peer,
-				   const dtls_ecdsa_key_t *key)
+dtls_write_certificate_verify_ecdh(dtls_context_t *ctx, dtls_peer_t *peer,
+				   uint32_t *point_r, uint32_t *point_s)
 {
   /* The ASN.1 Integer representation of an 32 byte unsigned int could be
    * 33 bytes long add space for that */
   uint8 buf[DTLS_CV_LENGTH + 2];
   uint8 *p;
-  uint32_t point_r[9];
-  uint32_t point_s[9];
-  dtls_hash_ctx hs_hash;
-  unsigned char sha256hash[DTLS_HMAC_DIGEST_SIZE];
 
   /* ServerKeyExchange 
    *
    * Start message construction at beginning of buffer. */
   p = buf;
 
+  p = dtls_add_ecdsa_signature_elem(p, point_r, point_s);
+
+  assert(p - buf <= sizeof(buf));
+
+  return dtls_send_handshake_msg(ctx, peer, DTLS_HT_CERTIFICATE_VERIFY,
+				 buf, p - buf);
+}
+
+static int
+dtls_send_certificate_verify_ecdh(dtls_context_t *ctx, dtls_peer_t *peer,
+				   const dtls_ecdsa_key_t *key)
+{
+  dtls_hash_ctx hs_hash;
+  dtls_ecc_job_t local, *job;
+
+  job = dtls_ecc_job_start(ctx, peer, &local, DTLS_ECC_JOB_SIGN,
+			   DTLS_ECC_STEP_CERTIFICATE_VERIFY);
+  memcpy(job->priv_key, key->priv_key, DTLS_EC_KEY_SIZE);
+
   copy_hs_hash(peer, &hs_hash);
 
-  dtls_hash_finalize(sha256hash, &hs_hash);
+  peer->handshake_params->crypto->hash_finalize(job->hash, &hs_hash);
 
-  /* sign the ephemeral and its paramaters */
-  dtls_ecdsa_create_sig_hash(key->priv_key, DTLS_EC_KEY_SIZE,
-			     sha256hash, sizeof(sha256hash),
-			     point_r, point_s);
+  return dtls_ecc_job_dispatch(ctx, peer, job, &local);
+}
+#endif /* DTLS_ECC */
 
-  p = dtls_add_ecdsa_signature_elem(p, point_r, point_s);
+static int
+dtls_send_finished(dtls_context_t *ctx, dtls_peer_t *peer,
+		   const unsigned char *label, size_t labellen)
+{
+  int length;
+  uint8 hash[DTLS_HMAC_MAX];
+  uint8 buf[DTLS_FIN_LENGTH];
+  dtls_hash_ctx hs_hash;
+  uint8 *p = buf;
 
-  assert(p - buf <= sizeof(buf));
+  copy_hs_hash(peer, &hs_hash);
 
-  return dtls_send_handshake_msg(ctx, peer, DTLS_HT_CERTIFICATE_VERIFY,
+  length = peer->handshake_params->crypto->hash_finalize(hash, &hs_hash);
+
+  dtls_trace(ctx, DTLS_TRACE_PRF, 0);
+  dtls_prf(peer->handshake_params->tmp.master_secret,
+	   DTLS_MASTER_SECRET_LENGTH,
+	   label, labellen,
+	   PRF_LABEL(finished), PRF_LABEL_SIZE(finished), 
+	   hash, length,
+	   p, DTLS_FIN_LENGTH);
+  dtls_trace(ctx, DTLS_TRACE_PRF, 1);
+
+  dtls_debug_dump("server finished MAC", p, DTLS_FIN_LENGTH);
+
+  p += DTLS_FIN_LENGTH;
+
+  assert((buf <= p) && ((unsigned int)(p - buf) <= sizeof(buf)));
+
+  return dtls_send_handshake_msg(ctx, peer, DTLS_HT_FINISHED,
+				 buf, p - buf);
+}
+
+#if DTLS_SESSION_TICKET_KEYS > 0
+/**
+ * Sends a NewSessionTicket message that carries the state of the
+ * current session sealed with the context's newest ticket key.
+ */
+static int
+dtls_send_new_session_ticket(dtls_context_t *ctx, dtls_peer_t *peer)
+{
+  uint8 buf[sizeof(uint32) + sizeof(uint16) + DTLS_TICKET_LENGTH];
+  uint8 *p = buf;
+
+  /* ticket_lifetime_hint */
+  dtls_int_to_uint32(p, DTLS_SESSION_LIFETIME);
+  p += sizeof(uint32);
+
+  dtls_int_to_uint16(p, DTLS_TICKET_LENGTH);
+  p += sizeof(uint16);
+
+  if (dtls_ticket_seal(ctx, peer->handshake_params, p) < 0) {
+    dtls_warn("cannot create session ticket\n");
+    return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+  }
+  p += DTLS_TICKET_LENGTH;
+
+  return dtls_send_handshake_msg(ctx, peer, DTLS_HT_NEW_SESSION_TICKET,
 				 buf, p - buf);
 }
-#endif /* DTLS_ECC */
+#endif /* DTLS_SESSION_TICKET_KEYS > 0 */
+
+/**
+ * Sends ChangeCipherSpec and our Finished message and switches to
+ * the new security parameters in between. A server that has agreed
+ * to issue a ticket sends the NewSessionTicket message first.
+ */
+static int
+dtls_send_finished_flight(dtls_context_t *ctx, dtls_peer_t *peer)
+{
+  int res;
+
+#if DTLS_SESSION_TICKET_KEYS > 0
+  if (!dtls_role_is_client(peer->role) && peer->handshake_params->ticket) {
+    res = dtls_send_new_session_ticket(ctx, peer);
+    if (res < 0)
+      return res;
+  }
+#endif /* DTLS_SESSION_TICKET_KEYS > 0 */
+
+  res = dtls_send_ccs(ctx, peer);
+  if (res < 0) {
+    dtls_debug("cannot send CCS message\n");
+    return res;
+  }
+
+  /* and switch cipher suite */
+  dtls_security_params_switch(peer);
+
+  if (!dtls_role_is_client(peer->role))
+    return dtls_send_finished(ctx, peer, PRF_LABEL(server), PRF_LABEL_SIZE(server));
+  else
+    return dtls_send_finished(ctx, peer, PRF_LABEL(client), PRF_LABEL_SIZE(client));
+}
 
+/**
+ * Sends the flight of an abbreviated handshake that resumes a cached
+ * session: ServerHello, ChangeCipherSpec and Finished.
+ */
 static int
-dtls_send_finished(dtls_context_t *ctx, dtls_peer_t *peer,
-		   const unsigned char *label, size_t labellen)
+dtls_send_server_resume_msgs(dtls_context_t *ctx, dtls_peer_t *peer)
 {
-  int length;
-  uint8 hash[DTLS_HMAC_MAX];
-  uint8 buf[DTLS_FIN_LENGTH];
-  dtls_hash_ctx hs_hash;
-  uint8 *p = buf;
-
-  copy_hs_hash(peer, &hs_hash);
-
-  length = dtls_hash_finalize(hash, &hs_hash);
+  int res;
 
-  dtls_prf(peer->handshake_params->tmp.master_secret,
-	   DTLS_MASTER_SECRET_LENGTH,
-	   label, labellen,
-	   PRF_LABEL(finished), PRF_LABEL_SIZE(finished), 
-	   hash, length,
-	   p, DTLS_FIN_LENGTH);
+  res = dtls_send_server_hello(ctx, peer);
+  if (res < 0) {
+    dtls_debug("dtls_server_hello: cannot prepare ServerHello record\n");
+    return res;
+  }
 
-  dtls_debug_dump("server finished MAC", p, DTLS_FIN_LENGTH);
+  dtls_trace(ctx, DTLS_TRACE_PRF, 0);
+  res = dtls_resume_key_block(peer);
+  dtls_trace(ctx, DTLS_TRACE_PRF, 1);
+  if (res < 0)
+    return res;
 
-  p += DTLS_FIN_LENGTH;
+  return dtls_send_finished_flight(ctx, peer);
+}
 
-  assert((buf <= p) && ((unsigned int)(p - buf) <= sizeof(buf)));
+/** The AEADs of the cipher suites, the indices of ecdsa_suites and psk_suites */
+enum { AEAD_CCM_8, AEAD_GCM, AEAD_CHACHA20 };
 
-  return dtls_send_handshake_msg(ctx, peer, DTLS_HT_FINISHED,
-				 buf, p - buf);
-}
+/** The cipher suites offered by the client for each AEAD. */
+static const dtls_cipher_t ecdsa_suites[] = {
+  TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8,
+  TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256,
+  TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256
+};
+static const dtls_cipher_t psk_suites[] = {
+  TLS_PSK_WITH_AES_128_CCM_8,
+  TLS_PSK_WITH_AES_128_GCM_SHA256,
+  TLS_PSK_WITH_CHACHA20_POLY1305_SHA256
+};
 
 static int
 dtls_send_client_hello(dtls_context_t *ctx, dtls_peer_t *peer,
                        uint8 cookie[], size_t cookie_length) {
-  uint8 buf[DTLS_CH_LENGTH_MAX];
+  uint8 buf[DTLS_CH_LENGTH_MAX + 4 + DTLS_SESSION_TICKET_MAX_LENGTH + 5
+	    + 2 * sizeof(uint16) /* GCM suites */
+	    + 2 * sizeof(uint16) /* ChaCha20-Poly1305 suites */];
   uint8 *p = buf;
   uint8_t cipher_size;
-  uint8_t extension_size;
+  size_t extension_size;
   int psk;
   int ecdsa;
+  int aead[3], n, i;
   dtls_handshake_parameters_t *handshake = peer->handshake_params;
+  session_t session;
   dtls_tick_t now;
+#if DTLS_SESSION_CACHE_SIZE > 0
+  dtls_session_cache_entry_t *cached = NULL;
+
+  /* offer the last session with this server in the initial handshake */
+  if (dtls_security_params(peer)->cipher == TLS_NULL_WITH_NULL_NULL)
+    cached = dtls_session_cache_find(ctx, DTLS_CLIENT,
+				     dtls_peer_session(peer, &session), NULL, 0);
+#endif /* DTLS_SESSION_CACHE_SIZE > 0 */
 
   psk = is_psk_supported(ctx);
   ecdsa = is_ecdsa_supported(ctx, 1);
 
-  cipher_size = 2 + ((ecdsa) ? 2 : 0) + ((psk) ? 2 : 0);
-  extension_size = (ecdsa) ? 2 + 6 + 6 + 8 + 6: 0;
+  /* The server picks the first suite it supports, so the AEADs are
+   * listed from the fastest one: ChaCha20-Poly1305 where AES is done
+   * in software, then GCM where GHASH is accelerated, else CCM_8. */
+  n = 0;
+  if (is_chacha20_preferred(ctx))
+    aead[n++] = AEAD_CHACHA20;
+  if (is_gcm_preferred(ctx))
+    aead[n++] = AEAD_GCM;
+  aead[n++] = AEAD_CCM_8;
+  if (is_gcm_supported(ctx) && !is_gcm_preferred(ctx))
+    aead[n++] = AEAD_GCM;
+  if (is_chacha20_supported(ctx) && !is_chacha20_preferred(ctx))
+    aead[n++] = AEAD_CHACHA20;
+
+  /* the same key exchanges with each AEAD */
+  cipher_size = 2 + n * (((ecdsa) ? 2 : 0) + ((psk) ? 2 : 0));
+  extension_size = (ecdsa) ? 6 + 6 + 8 + 6: 0;
+#if DTLS_SESSION_TICKET_MAX_LENGTH > 0
+  /* session ticket extension, empty to ask for a new ticket */
+  extension_size += 4 + (cached ? cached->ticket_length : 0);
+#endif /* DTLS_SESSION_TICKET_MAX_LENGTH > 0 */
+#if DTLS_CID_MAX_LENGTH > 0
+  /* connection ID extension, empty as only the server uses one */
+  extension_size += 5;
+#endif /* DTLS_CID_MAX_LENGTH > 0 */
+  if (extension_size)
+    extension_size += 2;
 
   if (cipher_size == 0) {
     dtls_crit("no cipher callbacks implemented\n");
@@ -2439,16 +4912,41 @@ dtls_send_client_hello(dtls_context_t *ctx, dtls_peer_t *peer,
      * followed by 28 bytes of generate random data. */
     dtls_ticks(&now);
     dtls_int_to_uint32(handshake->tmp.random.client, now / CLOCK_SECOND);
-    dtls_prng(handshake->tmp.random.client + sizeof(uint32),
-         DTLS_RANDOM_LENGTH - sizeof(uint32));
+    if (!dtls_prng(handshake->tmp.random.client + sizeof(uint32),
+		   DTLS_RANDOM_LENGTH - sizeof(uint32))) {
+      dtls_crit("cannot generate the client random\n");
+      return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+    }
   }
   /* we must use the same Client Random as for the previous request */
   memcpy(p, handshake->tmp.random.client, DTLS_RANDOM_LENGTH);
   p += DTLS_RANDOM_LENGTH;
 
-  /* session id (length 0) */
-  dtls_int_to_uint8(p, 0);
+#if DTLS_SESSION_CACHE_SIZE > 0
+  if (cookie_length == 0 && cached) {
+#if DTLS_SESSION_TICKET_MAX_LENGTH > 0
+    if (cached->ticket_length) {
+      /* A random id tells us if the server accepts the ticket, as
+       * it is echoed in that case (RFC 5077, section 3.4). */
+      handshake->session_id_length = DTLS_SESSION_ID_LENGTH;
+      if (!dtls_prng(handshake->session_id, DTLS_SESSION_ID_LENGTH)) {
+	dtls_crit("cannot generate a session id\n");
+	return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+      }
+    } else
+#endif /* DTLS_SESSION_TICKET_MAX_LENGTH > 0 */
+    {
+      handshake->session_id_length = cached->id_length;
+      memcpy(handshake->session_id, cached->id, cached->id_length);
+    }
+  }
+#endif /* DTLS_SESSION_CACHE_SIZE > 0 */
+
+  /* session id */
+  dtls_int_to_uint8(p, handshake->session_id_length);
   p += sizeof(uint8);
+  memcpy(p, handshake->session_id, handshake->session_id_length);
+  p += handshake->session_id_length;
 
   /* cookie */
   dtls_int_to_uint8(p, cookie_length);
@@ -2462,13 +4960,15 @@ dtls_send_client_hello(dtls_context_t *ctx, dtls_peer_t *peer,
   dtls_int_to_uint16(p, cipher_size - 2);
   p += sizeof(uint16);
 
-  if (ecdsa) {
-    dtls_int_to_uint16(p, TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8);
-    p += sizeof(uint16);
-  }
-  if (psk) {
-    dtls_int_to_uint16(p, TLS_PSK_WITH_AES_128_CCM_8);
-    p += sizeof(uint16);
+  for (i = 0; i < n; i++) {
+    if (ecdsa) {
+      dtls_int_to_uint16(p, ecdsa_suites[aead[i]]);
+      p += sizeof(uint16);
+    }
+    if (psk) {
+      dtls_int_to_uint16(p, psk_suites[aead[i]]);
+      p += sizeof(uint16);
+    }
   }
 
   /* compression method */
@@ -2546,12 +5046,39 @@ dtls_send_client_hello(dtls_context_t *ctx, dtls_peer_t *peer,
     p += sizeof(uint8);
   }
 
+#if DTLS_SESSION_TICKET_MAX_LENGTH > 0
+  /* session ticket */
+  dtls_int_to_uint16(p, TLS_EXT_SESSION_TICKET);
+  p += sizeof(uint16);
+
+  dtls_int_to_uint16(p, cached ? cached->ticket_length : 0);
+  p += sizeof(uint16);
+
+  if (cached && cached->ticket_length) {
+    memcpy(p, cached->ticket, cached->ticket_length);
+    p += cached->ticket_length;
+  }
+#endif /* DTLS_SESSION_TICKET_MAX_LENGTH > 0 */
+
+#if DTLS_CID_MAX_LENGTH > 0
+  dtls_int_to_uint16(p, TLS_EXT_CONNECTION_ID);
+  p += sizeof(uint16);
+
+  dtls_int_to_uint16(p, 1);
+  p += sizeof(uint16);
+
+  /* we do not need a connection ID to find the server */
+  dtls_int_to_uint8(p, 0);
+  p += sizeof(uint8);
+#endif /* DTLS_CID_MAX_LENGTH > 0 */
+
   assert((buf <= p) && ((unsigned int)(p - buf) <= sizeof(buf)));
 
   if (cookie_length != 0)
     clear_hs_hash(peer);
 
-  return dtls_send_handshake_msg_hash(ctx, peer, &peer->session,
+  return dtls_send_handshake_msg_hash(ctx, peer,
+				      dtls_peer_session(peer, &session),
 				      DTLS_HT_CLIENT_HELLO,
 				      buf, p - buf, cookie_length != 0);
 }
@@ -2562,6 +5089,7 @@ check_server_hello(dtls_context_t *ctx,
 		      uint8 *data, size_t data_length)
 {
   dtls_handshake_parameters_t *handshake = peer->handshake_params;
+  size_t id_length;
 
   /* This function is called when we expect a ServerHello (i.e. we
    * have sent a ClientHello).  We might instead receive a HelloVerify
@@ -2598,7 +5126,19 @@ check_server_hello(dtls_context_t *ctx,
   data += DTLS_RANDOM_LENGTH;
   data_length -= DTLS_RANDOM_LENGTH;
 
+  /* The server resumes the session if it returns the id we have
+   * offered, otherwise the id is kept for the new session. */
+  id_length = dtls_uint8_to_int(data);
+  if (id_length > DTLS_SESSION_ID_LENGTH)
+    goto error;
+  handshake->resumed = id_length > 0 &&
+    sizeof(uint8) + id_length <= data_length &&
+    id_length == handshake->session_id_length &&
+    memcmp(data + sizeof(uint8), handshake->session_id, id_length) == 0;
+
   SKIP_VAR_FIELD(data, data_length, uint8); /* skip session id */
+  handshake->session_id_length = id_length;
+  memcpy(handshake->session_id, data - id_length, id_length);
     
   /* Check cipher suite. As we offer all we have, it is sufficient
    * to check if the cipher suite selected by the server is in our
@@ -2620,6 +5160,27 @@ check_server_hello(dtls_context_t *ctx,
   data += sizeof(uint8);
   data_length -= sizeof(uint8);
 
+  if (handshake->resumed) {
+#if DTLS_SESSION_CACHE_SIZE > 0
+    dtls_session_cache_entry_t *cached;
+    session_t session;
+
+    cached = dtls_session_cache_find(ctx, DTLS_CLIENT,
+				     dtls_peer_session(peer, &session), NULL, 0);
+    if (!cached || cached->cipher != handshake->cipher) {
+      dtls_alert("server resumes a session with different parameters\n");
+      return dtls_alert_fatal_create(DTLS_ALERT_ILLEGAL_PARAMETER);
+    }
+    memcpy(handshake->keyx.master_secret, cached->master_secret,
+	   DTLS_MASTER_SECRET_LENGTH);
+#endif /* DTLS_SESSION_CACHE_SIZE > 0 */
+  }
+
+  /* set again if the server will send a NewSessionTicket */
+  handshake->ticket = 0;
+#if DTLS_CID_MAX_LENGTH > 0
+  handshake->cid = 0;
+#endif /* DTLS_CID_MAX_LENGTH > 0 */
   return dtls_check_tls_extension(peer, data, data_length, 0);
 
 error:
@@ -2655,10 +5216,11 @@ check_server_certificate(dtls_context_t *ctx,
 {
   int err;
   dtls_handshake_parameters_t *config = peer->handshake_params;
+  session_t session;
 
   update_hs_hash(peer, data, data_length);
 
-  assert(is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(config->cipher));
+  assert(is_tls_ecdhe_ecdsa(config->cipher));
 
   data += DTLS_HS_LENGTH;
 
@@ -2683,7 +5245,7 @@ check_server_certificate(dtls_context_t *ctx,
 	 sizeof(config->keyx.ecdsa.other_pub_y));
   data += sizeof(config->keyx.ecdsa.other_pub_y);
 
-  err = CALL(ctx, verify_ecdsa_key, &peer->session,
+  err = CALL(ctx, verify_ecdsa_key, dtls_peer_session(peer, &session),
 	     config->keyx.ecdsa.other_pub_x,
 	     config->keyx.ecdsa.other_pub_y,
 	     sizeof(config->keyx.ecdsa.other_pub_x));
@@ -2702,20 +5264,23 @@ check_server_key_exchange_ecdsa(dtls_context_t *ctx,
 {
   dtls_handshake_parameters_t *config = peer->handshake_params;
   int ret;
-  unsigned char *result_r;
-  unsigned char *result_s;
+  unsigned char result_r[DTLS_EC_KEY_SIZE];
+  unsigned char result_s[DTLS_EC_KEY_SIZE];
   unsigned char *key_params;
+  dtls_hash_ctx params_hash;
+  dtls_ecc_job_t local, *job;
 
   update_hs_hash(peer, data, data_length);
 
-  assert(is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(config->cipher));
+  assert(is_tls_ecdhe_ecdsa(config->cipher));
 
   data += DTLS_HS_LENGTH;
 
-  if (data_length < DTLS_HS_LENGTH + DTLS_SKEXEC_LENGTH) {
+  if (data_length < DTLS_HS_LENGTH + DTLS_SKEXEC_LENGTH_MIN) {
     dtls_alert("the packet length does not match the expected\n");
     return dtls_alert_fatal_create(DTLS_ALERT_DECODE_ERROR);
   }
+  data_length -= DTLS_HS_LENGTH;
   key_params = data;
 
   if (dtls_uint8_to_int(data) != TLS_EC_CURVE_TYPE_NAMED_CURVE) {
@@ -2754,26 +5319,28 @@ check_server_key_exchange_ecdsa(dtls_context_t *ctx,
   data += sizeof(config->keyx.ecdsa.other_eph_pub_y);
   data_length -= sizeof(config->keyx.ecdsa.other_eph_pub_y);
 
-  ret = dtls_check_ecdsa_signature_elem(data, data_length, &result_r, &result_s);
+  ret = dtls_check_ecdsa_signature_elem(data, data_length, result_r, result_s);
   if (ret < 0) {
     return ret;
   }
   data += ret;
   data_length -= ret;
 
-  ret = dtls_ecdsa_verify_sig(config->keyx.ecdsa.other_pub_x, config->keyx.ecdsa.other_pub_y,
-			    sizeof(config->keyx.ecdsa.other_pub_x),
-			    config->tmp.random.client, DTLS_RANDOM_LENGTH,
-			    config->tmp.random.server, DTLS_RANDOM_LENGTH,
-			    key_params,
-			    1 + 2 + 1 + 1 + (2 * DTLS_EC_KEY_SIZE),
-			    result_r, result_s);
-
-  if (ret < 0) {
-    dtls_alert("wrong signature\n");
-    return dtls_alert_fatal_create(DTLS_ALERT_HANDSHAKE_FAILURE);
-  }
-  return 0;
+  job = dtls_ecc_job_start(ctx, peer, &local, DTLS_ECC_JOB_VERIFY,
+			   DTLS_ECC_STEP_VERIFY);
+  memcpy(job->pub_x, config->keyx.ecdsa.other_pub_x, DTLS_EC_KEY_SIZE);
+  memcpy(job->pub_y, config->keyx.ecdsa.other_pub_y, DTLS_EC_KEY_SIZE);
+  memcpy(job->sig_r, result_r, DTLS_EC_KEY_SIZE);
+  memcpy(job->sig_s, result_s, DTLS_EC_KEY_SIZE);
+
+  config->crypto->hash_init(&params_hash);
+  config->crypto->hash_update(&params_hash, config->tmp.random.client, DTLS_RANDOM_LENGTH);
+  config->crypto->hash_update(&params_hash, config->tmp.random.server, DTLS_RANDOM_LENGTH);
+  config->crypto->hash_update(&params_hash, key_params,
+			      1 + 2 + 1 + 1 + (2 * DTLS_EC_KEY_SIZE));
+  config->crypto->hash_finalize(job->hash, &params_hash);
+
+  return dtls_ecc_job_dispatch(ctx, peer, job, &local);
 }
 #endif /* DTLS_ECC */
 
@@ -2789,7 +5356,7 @@ check_server_key_exchange_psk(dtls_context_t *ctx,
 
   update_hs_hash(peer, data, data_length);
 
-  assert(is_tls_psk_with_aes_128_ccm_8(config->cipher));
+  assert(is_tls_psk(config->cipher));
 
   data += DTLS_HS_LENGTH;
 
@@ -2831,7 +5398,7 @@ check_certificate_request(dtls_context_t *ctx,
 
   update_hs_hash(peer, data, data_length);
 
-  assert(is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(peer->handshake_params->cipher));
+  assert(is_tls_ecdhe_ecdsa(peer->handshake_params->cipher));
 
   data += DTLS_HS_LENGTH;
 
@@ -2905,6 +5472,43 @@ check_certificate_request(dtls_context_t *ctx,
   return 0;
 }
 
+/**
+ * Parses the NewSessionTicket from the server and stores the ticket
+ * with the session that is established. This message is part of the
+ * handshake, but not of the key exchange.
+ */
+static int
+check_new_session_ticket(dtls_context_t *ctx,
+			 dtls_peer_t *peer,
+			 uint8 *data, size_t data_length)
+{
+  size_t ticket_length;
+
+  update_hs_hash(peer, data, data_length);
+
+  data += DTLS_HS_LENGTH;
+  data_length -= DTLS_HS_LENGTH;
+
+  /* the lifetime hint is ignored, we stick to DTLS_SESSION_LIFETIME */
+  if (data_length < sizeof(uint32) + sizeof(uint16))
+    return dtls_alert_fatal_create(DTLS_ALERT_DECODE_ERROR);
+  data += sizeof(uint32);
+  data_length -= sizeof(uint32);
+
+  ticket_length = dtls_uint16_to_int(data);
+  data += sizeof(uint16);
+  data_length -= sizeof(uint16);
+  if (ticket_length > data_length)
+    return dtls_alert_fatal_create(DTLS_ALERT_DECODE_ERROR);
+
+  /* An empty ticket means that the server will not issue one after
+   * all (RFC 5077, section 3.3). The session id is empty as well. */
+  dtls_session_cache_add(ctx, peer, data, ticket_length);
+  return 0;
+}
+
+static int dtls_client_key_block(dtls_context_t *ctx, dtls_peer_t *peer);
+
 static int
 check_server_hellodone(dtls_context_t *ctx, 
 		      dtls_peer_t *peer,
@@ -2913,9 +5517,9 @@ check_server_hellodone(dtls_context_t *ctx,
   int res;
 #ifdef DTLS_ECC
   const dtls_ecdsa_key_t *ecdsa_key;
-#endif /* DTLS_ECC */
-
   dtls_handshake_parameters_t *handshake = peer->handshake_params;
+  session_t session;
+#endif /* DTLS_ECC */
 
   /* calculate master key, send CCS */
 
@@ -2924,7 +5528,8 @@ check_server_hellodone(dtls_context_t *ctx,
 #ifdef DTLS_ECC
   if (handshake->do_client_auth) {
 
-    res = CALL(ctx, get_ecdsa_key, &peer->session, &ecdsa_key);
+    res = CALL(ctx, get_ecdsa_key, dtls_peer_session(peer, &session),
+	       &ecdsa_key);
     if (res < 0) {
       dtls_crit("no ecdsa certificate to send in certificate\n");
       return res;
@@ -2956,38 +5561,161 @@ check_server_hellodone(dtls_context_t *ctx,
       dtls_debug("dtls_server_hello: cannot prepare Certificate record\n");
       return res;
     }
+
+    /* the rest of the flight follows the signature */
+    if (dtls_ecc_pending(peer))
+      return 0;
   }
 #endif /* DTLS_ECC */
 
-  res = calculate_key_block(ctx, handshake, peer,
-			    &peer->session, peer->role);
-  if (res < 0) {
+  return dtls_client_key_block(ctx, peer);
+}
+
+/**
+ * Calculates the key block of the client and sends the final flight
+ * unless the key exchange has been handed to an ECC job.
+ */
+static int
+dtls_client_key_block(dtls_context_t *ctx, dtls_peer_t *peer)
+{
+  session_t session;
+  int res;
+
+  res = calculate_key_block(ctx, peer->handshake_params, peer,
+			    dtls_peer_session(peer, &session), peer->role);
+  if (res < 0 || dtls_ecc_pending(peer)) {
     return res;
   }
 
-  res = dtls_send_ccs(ctx, peer);
-  if (res < 0) {
-    dtls_debug("cannot send CCS message\n");
-    return res;
+  return dtls_send_finished_flight(ctx, peer);
+}
+
+/**
+ * Sets up @p job to decrypt the record @p packet of @p length bytes
+ * in place with dtls_aead_crypt(). The caller
+ * must point @p job->nonce and @p job->aad to DTLS_CCM_BLOCKSIZE and
+ * DTLS_A_DATA_MAX bytes.
+ *
+ * @return @c 0 on success, @c -1 if the record is too short.
+ */
+static int
+dtls_open_prepare(dtls_peer_t *peer, dtls_security_parameters_t *security,
+		  uint8 *packet, size_t length, dtls_ccm_job_t *job) {
+  /**
+   * length of additional_data for the AEAD cipher which consists of
+   * seq_num(2+6) + type(1) + version(2) + length(2)
+   */
+#define A_DATA_LEN 13
+  size_t hlen = dtls_record_header_length(packet);
+  uint8 *cleartext = packet + hlen;
+  int clen = length - hlen;
+  size_t la = A_DATA_LEN;
+  int mac_length = dtls_aead_mac_length(security->cipher);
+  int explicit_length = dtls_aead_explicit_nonce_length(security->cipher);
+
+  if (clen < explicit_length + mac_length) /* need at least IV and MAC */
+    return -1;
+
+  memset(job->nonce, 0, DTLS_CCM_BLOCKSIZE);
+  memcpy(job->nonce, dtls_kb_remote_iv(security, peer->role),
+	 dtls_kb_iv_size(security, peer->role));
+
+  /* read epoch and seq_num from message */
+  dtls_aead_nonce_seq(job->nonce, security,
+		      explicit_length ? cleartext
+		      : DTLS_RECORD_HEADER(packet)->epoch);
+  cleartext += explicit_length;
+  clen -= explicit_length;
+
+  dtls_debug_dump("nonce", job->nonce, DTLS_CCM_BLOCKSIZE);
+  dtls_debug_dump("key", dtls_kb_remote_write_key(security, peer->role),
+		  dtls_kb_key_size(security, peer->role));
+  dtls_debug_dump("ciphertext", cleartext, clen);
+
+  /* re-use N to create additional data according to RFC 5246, Section 6.2.3.3:
+   * 
+   * additional_data = seq_num + TLSCompressed.type +
+   *                   TLSCompressed.version + TLSCompressed.length;
+   */
+#if DTLS_CID_LENGTH > 0
+  if (hlen != DTLS_RH_LENGTH) {
+    la = dtls_cid_additional_data(job->aad, packet, DTLS_CID_LENGTH,
+				  clen - mac_length);
+  } else
+#endif /* DTLS_CID_LENGTH > 0 */
+  {
+    memcpy(job->aad, &DTLS_RECORD_HEADER(packet)->epoch, 8); /* epoch and seq_num */
+    memcpy(job->aad + 8,  &DTLS_RECORD_HEADER(packet)->content_type, 3); /* type and version */
+    dtls_int_to_uint16(job->aad + 11, clen - mac_length); /* length without nonce_explicit */
+  }
+
+  job->ctx = &security->read_ctx;
+  job->buf = cleartext;
+  job->length = clen;
+  job->aad_length = la;
+  return 0;
+}
+
+#if DTLS_RECORD_BATCH_SIZE > 0
+/** Records that dtls_handle_messages() has decrypted in advance. */
+typedef struct dtls_record_batch_t {
+  size_t count;			/**< number of records */
+  const uint8 *record[DTLS_MESSAGE_BATCH_SIZE]; /**< the records */
+  /** the security parameters used for each record */
+  const dtls_security_parameters_t *security[DTLS_MESSAGE_BATCH_SIZE];
+  int result[DTLS_MESSAGE_BATCH_SIZE]; /**< the results of ccm_open */
+} dtls_record_batch_t;
+
+/**
+ * Looks up the record @p packet among the records that have been
+ * decrypted in advance with @p security, and sets @p result to the
+ * outcome of ccm_open.
+ *
+ * @return @c 1 if the record has been found, @c 0 otherwise.
+ */
+static int
+dtls_record_from_batch(const dtls_context_t *ctx, const uint8 *packet,
+		       const dtls_security_parameters_t *security,
+		       int *result) {
+  const dtls_record_batch_t *batch = ctx->records;
+  size_t i;
+
+  if (!batch)
+    return 0;
+
+  for (i = 0; i < batch->count; i++) {
+    if (batch->record[i] == packet && batch->security[i] == security) {
+      *result = batch->result[i];
+      return 1;
+    }
   }
+  return 0;
+}
 
-  /* and switch cipher suite */
-  dtls_security_params_switch(peer);
+/** Returns @c 1 if @p packet has been decrypted in advance. */
+static inline int
+dtls_record_opened(const dtls_context_t *ctx, const uint8 *packet) {
+  const dtls_record_batch_t *batch = ctx->records;
+  size_t i;
 
-  /* Client Finished */
-  return dtls_send_finished(ctx, peer, PRF_LABEL(client), PRF_LABEL_SIZE(client));
+  for (i = 0; batch && i < batch->count; i++)
+    if (batch->record[i] == packet)
+      return 1;
+  return 0;
 }
+#endif /* DTLS_RECORD_BATCH_SIZE > 0 */
 
 static int
-decrypt_verify(dtls_peer_t *peer, uint8 *packet, size_t length,
-	       uint8 **cleartext)
+decrypt_verify(dtls_context_t *ctx, dtls_peer_t *peer, uint8 *packet,
+	       size_t length, uint8 **cleartext)
 {
   dtls_record_header_t *header = DTLS_RECORD_HEADER(packet);
   dtls_security_parameters_t *security = dtls_security_params_epoch(peer, dtls_get_epoch(header));
+  size_t hlen = dtls_record_header_length(packet);
   int clen;
   
-  *cleartext = (uint8 *)packet + sizeof(dtls_record_header_t);
-  clen = length - sizeof(dtls_record_header_t);
+  *cleartext = (uint8 *)packet + hlen;
+  clen = length - hlen;
 
   if (!security) {
     dtls_alert("No security context for epoch: %i\n", dtls_get_epoch(header));
@@ -2995,54 +5723,41 @@ decrypt_verify(dtls_peer_t *peer, uint8 *packet, size_t length,
   }
 
   if (security->cipher == TLS_NULL_WITH_NULL_NULL) {
-    /* no cipher suite selected */
+    /* no cipher suite selected, records with CID must be protected */
+    if (hlen != DTLS_RH_LENGTH)
+      return -1;
     return clen;
-  } else { /* TLS_PSK_WITH_AES_128_CCM_8 or TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8 */
-    /** 
-     * length of additional_data for the AEAD cipher which consists of
-     * seq_num(2+6) + type(1) + version(2) + length(2)
-     */
-#define A_DATA_LEN 13
+  } else { /* one of the AEAD cipher suites */
     unsigned char nonce[DTLS_CCM_BLOCKSIZE];
-    unsigned char A_DATA[A_DATA_LEN];
+    unsigned char A_DATA[DTLS_A_DATA_MAX];
+    dtls_ccm_job_t job;
 
-    if (clen < 16)		/* need at least IV and MAC */
+    job.nonce = nonce;
+    job.aad = A_DATA;
+    if (dtls_open_prepare(peer, security, packet, length, &job) < 0)
       return -1;
+    *cleartext = job.buf;
 
-    memset(nonce, 0, DTLS_CCM_BLOCKSIZE);
-    memcpy(nonce, dtls_kb_remote_iv(security, peer->role),
-	   dtls_kb_iv_size(security, peer->role));
-
-    /* read epoch and seq_num from message */
-    memcpy(nonce + dtls_kb_iv_size(security, peer->role), *cleartext, 8);
-    *cleartext += 8;
-    clen -= 8;
-
-    dtls_debug_dump("nonce", nonce, DTLS_CCM_BLOCKSIZE);
-    dtls_debug_dump("key", dtls_kb_remote_write_key(security, peer->role),
-		    dtls_kb_key_size(security, peer->role));
-    dtls_debug_dump("ciphertext", *cleartext, clen);
-
-    /* re-use N to create additional data according to RFC 5246, Section 6.2.3.3:
-     * 
-     * additional_data = seq_num + TLSCompressed.type +
-     *                   TLSCompressed.version + TLSCompressed.length;
-     */
-    memcpy(A_DATA, &DTLS_RECORD_HEADER(packet)->epoch, 8); /* epoch and seq_num */
-    memcpy(A_DATA + 8,  &DTLS_RECORD_HEADER(packet)->content_type, 3); /* type and version */
-    dtls_int_to_uint16(A_DATA + 11, clen - 8); /* length without nonce_explicit */
-
-    clen = dtls_decrypt(*cleartext, clen, *cleartext, nonce,
-		       dtls_kb_remote_write_key(security, peer->role),
-		       dtls_kb_key_size(security, peer->role),
-		       A_DATA, A_DATA_LEN);
+#if DTLS_RECORD_BATCH_SIZE > 0
+    if (!dtls_record_from_batch(ctx, packet, security, &clen))
+#endif /* DTLS_RECORD_BATCH_SIZE > 0 */
+    {
+      dtls_trace(ctx, DTLS_TRACE_CCM, 0);
+      clen = dtls_aead_crypt(security, &job, 0);
+      dtls_trace(ctx, DTLS_TRACE_CCM, 1);
+    }
+#if DTLS_CID_LENGTH > 0
+    if (clen >= 0 && hlen != DTLS_RH_LENGTH)
+      clen = dtls_cid_inner_plaintext(packet, *cleartext, clen);
+#endif /* DTLS_CID_LENGTH > 0 */
     if (clen < 0)
       dtls_warn("decryption failed\n");
     else {
-#ifndef NDEBUG
-      printf("decrypt_verify(): found %i bytes cleartext\n", clen);
-#endif
-      dtls_security_params_free_other(peer);
+      dtls_debug("decrypt_verify(): found %i bytes cleartext\n", clen);
+      /* The caller still updates the replay state of security, so
+       * drop the previous epoch only once the current one is in use. */
+      if (security == dtls_security_params(peer))
+        dtls_security_params_free_other(peer);
       dtls_debug_dump("cleartext", *cleartext, clen);
     }
   }
@@ -3052,7 +5767,10 @@ decrypt_verify(dtls_peer_t *peer, uint8 *packet, size_t length,
 static int
 dtls_send_hello_request(dtls_context_t *ctx, dtls_peer_t *peer)
 {
-  return dtls_send_handshake_msg_hash(ctx, peer, &peer->session,
+  session_t session;
+
+  return dtls_send_handshake_msg_hash(ctx, peer,
+				      dtls_peer_session(peer, &session),
 				      DTLS_HT_HELLO_REQUEST,
 				      NULL, 0, 0);
 }
@@ -3071,26 +5789,25 @@ dtls_renegotiate(dtls_context_t *ctx, const session_t *dst)
   if (peer->state != DTLS_STATE_CONNECTED)
     return -1;
 
-  peer->handshake_params = dtls_handshake_new();
+  peer->handshake_params = dtls_handshake_start(ctx);
   if (!peer->handshake_params)
     return -1;
 
   peer->handshake_params->hs_state.mseq_r = 0;
   peer->handshake_params->hs_state.mseq_s = 0;
 
-  if (peer->role == DTLS_CLIENT) {
+  if (dtls_role_is_client(peer->role)) {
     /* send ClientHello with empty Cookie */
     err = dtls_send_client_hello(ctx, peer, NULL, 0);
     if (err < 0)
       dtls_warn("cannot send ClientHello\n");
     else
       peer->state = DTLS_STATE_CLIENTHELLO;
-    return err;
-  } else if (peer->role == DTLS_SERVER) {
-    return dtls_send_hello_request(ctx, peer);
+  } else {
+    err = dtls_send_hello_request(ctx, peer);
   }
-
-  return -1;
+  dtls_flush(ctx);
+  return err;
 }
 
 static int
@@ -3106,6 +5823,7 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
    * we do everything accordingly to the DTLS 1.2 standard this should
    * not be a problem. */
   if (peer) {
+    dtls_update_rtt(peer);
     dtls_stop_retransmission(ctx, peer);
   }
 
@@ -3122,7 +5840,7 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
    ************************************************************************/
   case DTLS_HT_HELLO_VERIFY_REQUEST:
 
-    if (state != DTLS_STATE_CLIENTHELLO) {
+    if (!DTLS_CLIENT_SUPPORT || state != DTLS_STATE_CLIENTHELLO) {
       return dtls_alert_fatal_create(DTLS_ALERT_UNEXPECTED_MESSAGE);
     }
 
@@ -3135,7 +5853,7 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
     break;
   case DTLS_HT_SERVER_HELLO:
 
-    if (state != DTLS_STATE_CLIENTHELLO) {
+    if (!DTLS_CLIENT_SUPPORT || state != DTLS_STATE_CLIENTHELLO) {
       return dtls_alert_fatal_create(DTLS_ALERT_UNEXPECTED_MESSAGE);
     }
 
@@ -3144,7 +5862,15 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
       dtls_warn("error in check_server_hello err: %i\n", err);
       return err;
     }
-    if (is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(peer->handshake_params->cipher))
+    if (peer->handshake_params->resumed) {
+      /* abbreviated handshake, the server continues with its Finished */
+      dtls_trace(ctx, DTLS_TRACE_PRF, 0);
+      err = dtls_resume_key_block(peer);
+      dtls_trace(ctx, DTLS_TRACE_PRF, 1);
+      if (err < 0)
+	return err;
+      peer->state = DTLS_STATE_WAIT_CHANGECIPHERSPEC;
+    } else if (is_tls_ecdhe_ecdsa(peer->handshake_params->cipher))
       peer->state = DTLS_STATE_WAIT_SERVERCERTIFICATE;
     else
       peer->state = DTLS_STATE_WAIT_SERVERHELLODONE;
@@ -3155,8 +5881,9 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
 #ifdef DTLS_ECC
   case DTLS_HT_CERTIFICATE:
 
-    if ((role == DTLS_CLIENT && state != DTLS_STATE_WAIT_SERVERCERTIFICATE) ||
-        (role == DTLS_SERVER && state != DTLS_STATE_WAIT_CLIENTCERTIFICATE)) {
+    if (dtls_role_is_client(role)
+        ? state != DTLS_STATE_WAIT_SERVERCERTIFICATE
+        : state != DTLS_STATE_WAIT_CLIENTCERTIFICATE) {
       return dtls_alert_fatal_create(DTLS_ALERT_UNEXPECTED_MESSAGE);
     }
     err = check_server_certificate(ctx, peer, data, data_length);
@@ -3164,9 +5891,9 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
       dtls_warn("error in check_server_certificate err: %i\n", err);
       return err;
     }
-    if (role == DTLS_CLIENT) {
+    if (dtls_role_is_client(role)) {
       peer->state = DTLS_STATE_WAIT_SERVERKEYEXCHANGE;
-    } else if (role == DTLS_SERVER){
+    } else {
       peer->state = DTLS_STATE_WAIT_CLIENTKEYEXCHANGE;
     }
     /* update_hs_hash(peer, data, data_length); */
@@ -3176,8 +5903,12 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
 
   case DTLS_HT_SERVER_KEY_EXCHANGE:
 
+    if (!DTLS_CLIENT_SUPPORT) {
+      return dtls_alert_fatal_create(DTLS_ALERT_UNEXPECTED_MESSAGE);
+    }
+
 #ifdef DTLS_ECC
-    if (is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(peer->handshake_params->cipher)) {
+    if (is_tls_ecdhe_ecdsa(peer->handshake_params->cipher)) {
       if (state != DTLS_STATE_WAIT_SERVERKEYEXCHANGE) {
         return dtls_alert_fatal_create(DTLS_ALERT_UNEXPECTED_MESSAGE);
       }
@@ -3185,7 +5916,7 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
     }
 #endif /* DTLS_ECC */
 #ifdef DTLS_PSK
-    if (is_tls_psk_with_aes_128_ccm_8(peer->handshake_params->cipher)) {
+    if (is_tls_psk(peer->handshake_params->cipher)) {
       if (state != DTLS_STATE_WAIT_SERVERHELLODONE) {
         return dtls_alert_fatal_create(DTLS_ALERT_UNEXPECTED_MESSAGE);
       }
@@ -3204,7 +5935,7 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
 
   case DTLS_HT_SERVER_HELLO_DONE:
 
-    if (state != DTLS_STATE_WAIT_SERVERHELLODONE) {
+    if (!DTLS_CLIENT_SUPPORT || state != DTLS_STATE_WAIT_SERVERHELLODONE) {
       return dtls_alert_fatal_create(DTLS_ALERT_UNEXPECTED_MESSAGE);
     }
 
@@ -3218,9 +5949,25 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
 
     break;
 
+  case DTLS_HT_NEW_SESSION_TICKET:
+
+    if (!dtls_role_is_client(peer->role)
+	|| state != DTLS_STATE_WAIT_CHANGECIPHERSPEC
+	|| !peer->handshake_params->ticket) {
+      return dtls_alert_fatal_create(DTLS_ALERT_UNEXPECTED_MESSAGE);
+    }
+
+    err = check_new_session_ticket(ctx, peer, data, data_length);
+    if (err < 0) {
+      dtls_warn("error in check_new_session_ticket err: %i\n", err);
+      return err;
+    }
+
+    break;
+
   case DTLS_HT_CERTIFICATE_REQUEST:
 
-    if (state != DTLS_STATE_WAIT_SERVERHELLODONE) {
+    if (!DTLS_CLIENT_SUPPORT || state != DTLS_STATE_WAIT_SERVERHELLODONE) {
       return dtls_alert_fatal_create(DTLS_ALERT_UNEXPECTED_MESSAGE);
     }
 
@@ -3244,25 +5991,22 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
       dtls_warn("error in check_finished err: %i\n", err);
       return err;
     }
-    if (role == DTLS_SERVER) {
-      /* send ServerFinished */
+    /* In a full handshake, the server sends its Finished last, in an
+     * abbreviated handshake the client does. */
+    if ((!dtls_role_is_client(role)) != peer->handshake_params->resumed) {
       update_hs_hash(peer, data, data_length);
 
       /* send change cipher spec message and switch to new configuration */
-      err = dtls_send_ccs(ctx, peer);
-      if (err < 0) {
-        dtls_warn("cannot send CCS message\n");
-        return err;
-      }
-
-      dtls_security_params_switch(peer);
-
-      err = dtls_send_finished(ctx, peer, PRF_LABEL(server), PRF_LABEL_SIZE(server));
+      err = dtls_send_finished_flight(ctx, peer);
       if (err < 0) {
-        dtls_warn("sending server Finished failed\n");
+        dtls_warn("sending Finished failed\n");
         return err;
       }
     }
+    /* sessions with tickets are stored when the ticket arrives */
+    if (!peer->handshake_params->resumed && !peer->handshake_params->ticket)
+      dtls_session_cache_add(ctx, peer, NULL, 0);
+    dtls_stats_handshake_end(ctx, peer->handshake_params, 1);
     dtls_handshake_free(peer->handshake_params);
     peer->handshake_params = NULL;
     dtls_debug("Handshake complete\n");
@@ -3279,7 +6023,7 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
   case DTLS_HT_CLIENT_KEY_EXCHANGE:
     /* handle ClientHello, update msg and msglen and goto next if not finished */
 
-    if (state != DTLS_STATE_WAIT_CLIENTKEYEXCHANGE) {
+    if (!DTLS_SERVER_SUPPORT || state != DTLS_STATE_WAIT_CLIENTKEYEXCHANGE) {
       return dtls_alert_fatal_create(DTLS_ALERT_UNEXPECTED_MESSAGE);
     }
 
@@ -3290,7 +6034,7 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
     }
     update_hs_hash(peer, data, data_length);
 
-    if (is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(peer->handshake_params->cipher) &&
+    if (is_tls_ecdhe_ecdsa(peer->handshake_params->cipher) &&
 	is_ecdsa_client_auth_supported(ctx))
       peer->state = DTLS_STATE_WAIT_CERTIFICATEVERIFY;
     else
@@ -3300,7 +6044,7 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
 #ifdef DTLS_ECC
   case DTLS_HT_CERTIFICATE_VERIFY:
 
-    if (state != DTLS_STATE_WAIT_CERTIFICATEVERIFY) {
+    if (!DTLS_SERVER_SUPPORT || state != DTLS_STATE_WAIT_CERTIFICATEVERIFY) {
       return dtls_alert_fatal_create(DTLS_ALERT_UNEXPECTED_MESSAGE);
     }
 
@@ -3317,7 +6061,8 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
 
   case DTLS_HT_CLIENT_HELLO:
 
-    if ((peer && state != DTLS_STATE_CONNECTED && state != DTLS_STATE_WAIT_CLIENTHELLO) ||
+    if (!DTLS_SERVER_SUPPORT ||
+	(peer && state != DTLS_STATE_CONNECTED && state != DTLS_STATE_WAIT_CLIENTHELLO) ||
 	(!peer && state != DTLS_STATE_WAIT_CLIENTHELLO)) {
       return dtls_alert_fatal_create(DTLS_ALERT_UNEXPECTED_MESSAGE);
     }
@@ -3350,8 +6095,9 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
       * the cookie exchange */
     if (peer && state == DTLS_STATE_WAIT_CLIENTHELLO) {
        dtls_debug("removing the peer\n");
-       DEL_PEER(ctx->peers, peer);
+       dtls_unlink_peer(ctx, peer);
 
+       dtls_stop_retransmission(ctx, peer);
        dtls_free_peer(peer);
        peer = NULL;
     }
@@ -3362,7 +6108,11 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
       /* msg contains a Client Hello with a valid cookie, so we can
        * safely create the server state machine and continue with
        * the handshake. */
-      peer = dtls_new_peer(session);
+      if (dtls_make_room(ctx) < 0) {
+        dtls_warn("too many peers\n");
+        return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+      }
+      peer = dtls_new_peer(&ctx->pools, session);
       if (!peer) {
         dtls_alert("cannot create peer\n");
         return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
@@ -3384,7 +6134,7 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
     if (peer && !peer->handshake_params) {
       dtls_handshake_header_t *hs_header = DTLS_HANDSHAKE_HEADER(data);
 
-      peer->handshake_params = dtls_handshake_new();
+      peer->handshake_params = dtls_handshake_start(ctx);
       if (!peer->handshake_params)
         return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
 
@@ -3409,11 +6159,19 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
     /* update finish MAC */
     update_hs_hash(peer, data, data_length);
 
+    if (peer->handshake_params->resumed) {
+      err = dtls_send_server_resume_msgs(ctx, peer);
+      if (err < 0)
+	return err;
+      peer->state = DTLS_STATE_WAIT_CHANGECIPHERSPEC;
+      break;
+    }
+
     err = dtls_send_server_hello_msgs(ctx, peer);
     if (err < 0) {
       return err;
     }
-    if (is_tls_ecdhe_ecdsa_with_aes_128_ccm_8(peer->handshake_params->cipher) &&
+    if (is_tls_ecdhe_ecdsa(peer->handshake_params->cipher) &&
 	is_ecdsa_client_auth_supported(ctx))
       peer->state = DTLS_STATE_WAIT_CLIENTCERTIFICATE;
     else
@@ -3428,13 +6186,13 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
 
   case DTLS_HT_HELLO_REQUEST:
 
-    if (state != DTLS_STATE_CONNECTED) {
+    if (!DTLS_CLIENT_SUPPORT || state != DTLS_STATE_CONNECTED) {
       /* we should just ignore such packets when in handshake */
       return 0;
     }
 
     if (peer && !peer->handshake_params) {
-      peer->handshake_params = dtls_handshake_new();
+      peer->handshake_params = dtls_handshake_start(ctx);
       if (!peer->handshake_params)
         return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
 
@@ -3456,20 +6214,149 @@ handle_handshake_msg(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
     return dtls_alert_fatal_create(DTLS_ALERT_UNEXPECTED_MESSAGE);
   }
 
-  if (peer && peer->handshake_params && err >= 0) {
-    peer->handshake_params->hs_state.mseq_r++;
+  if (peer && peer->handshake_params && err >= 0) {
+    peer->handshake_params->hs_state.mseq_r++;
+  }
+
+  return err;
+}
+      
+/** Returns @c 1 if @p hs_header describes only a part of a message. */
+static inline int
+dtls_handshake_fragmented(const dtls_handshake_header_t *hs_header) {
+  return dtls_uint24_to_int(hs_header->fragment_offset) != 0
+    || dtls_get_fragment_length(hs_header) != dtls_uint24_to_int(hs_header->length);
+}
+
+/**
+ * Returns @c 1 if all fragments of the message in the reorder queue
+ * node @p node have been received. The node's length counts the
+ * bytes that are already present.
+ */
+static inline int
+dtls_reassembly_complete(const netq_t *node) {
+  return node->length ==
+    DTLS_HS_LENGTH + dtls_uint24_to_int(DTLS_HANDSHAKE_HEADER(node->data)->length);
+}
+
+/**
+ * Adds the handshake message or fragment @p data to the reorder queue
+ * of @p peer. Fragments of the same message are collected in a single
+ * node that holds the message as if it had been sent unfragmented,
+ * followed by a bitmap of the bytes that have been received.
+ *
+ * @param peer        The peer the fragment was received from.
+ * @param data        The handshake header and fragment data.
+ * @param complete    Set to the node holding the message when the
+ *                    message is complete, left untouched otherwise.
+ * @return @c 0 if the fragment was stored or dropped, or less than
+ *         zero if it is malformed.
+ */
+static int
+dtls_reassemble(dtls_peer_t *peer, uint8 *data, netq_t **complete) {
+  dtls_handshake_header_t *hs_header = DTLS_HANDSHAKE_HEADER(data);
+  dtls_handshake_header_t *node_header;
+  size_t length = dtls_uint24_to_int(hs_header->length);
+  size_t offset = dtls_uint24_to_int(hs_header->fragment_offset);
+  size_t frag_length = dtls_get_fragment_length(hs_header);
+  uint8 *bitmap;
+  netq_t *node;
+  size_t i;
+  int count = 0;
+
+  if (offset + frag_length > length) {
+    dtls_warn("handshake fragment exceeds message\n");
+    return dtls_alert_fatal_create(DTLS_ALERT_DECODE_ERROR);
+  }
+
+  for (node = netq_head(&peer->handshake_params->reorder_queue);
+       node; node = netq_next(node), count++) {
+    node_header = DTLS_HANDSHAKE_HEADER(node->data);
+    if (dtls_uint16_to_int(node_header->message_seq) ==
+	dtls_uint16_to_int(hs_header->message_seq))
+      break;
+  }
+
+  if (!node) {
+    /* TODO: only add packet that are not too new. */
+    if (length > DTLS_MAX_HS_LENGTH || count >= NETQ_MAXCNT) {
+      dtls_warn("the packet is too big to buffer for reoder\n");
+      return 0;
+    }
+
+    node = netq_node_new(peer->pools, DTLS_HS_LENGTH + length + (length + 7) / 8);
+    if (!node) {
+      dtls_warn("no space in reoder buffer\n");
+      return 0;
+    }
+
+    node->peer = peer;
+    node->length = DTLS_HS_LENGTH;
+    memcpy(node->data, data, DTLS_HS_LENGTH);
+    node_header = DTLS_HANDSHAKE_HEADER(node->data);
+    dtls_int_to_uint24(node_header->fragment_offset, 0);
+    dtls_int_to_uint24(node_header->fragment_length, length);
+    memset(node->data + DTLS_HS_LENGTH + length, 0, (length + 7) / 8);
+
+    if (!netq_insert_node(&peer->handshake_params->reorder_queue, node)) {
+      dtls_warn("cannot add packet to reoder buffer\n");
+      netq_node_free(node);
+      return 0;
+    }
+    dtls_info("Added packet for reordering\n");
+  } else if (node_header->msg_type != hs_header->msg_type ||
+	     dtls_uint24_to_int(node_header->length) != length) {
+    dtls_warn("handshake fragment does not match message\n");
+    return 0;
+  }
+
+  if (dtls_reassembly_complete(node)) {
+    dtls_debug("a packet with this sequence number is already stored\n");
+  } else {
+    memcpy(node->data + DTLS_HS_LENGTH + offset, data + DTLS_HS_LENGTH,
+	   frag_length);
+
+    bitmap = node->data + DTLS_HS_LENGTH + length;
+    for (i = offset; i < offset + frag_length; i++) {
+      if (!(bitmap[i / 8] & (1 << (i % 8)))) {
+	bitmap[i / 8] |= 1 << (i % 8);
+	node->length++;
+      }
+    }
+  }
+
+  if (dtls_reassembly_complete(node))
+    *complete = node;
+  return 0;
+}
+
+/** Frees the fragments of message @p seq that @p peer has buffered. */
+static void
+dtls_reassembly_drop(dtls_peer_t *peer, int seq) {
+  netq_t *node;
+
+  for (node = netq_head(&peer->handshake_params->reorder_queue);
+       node; node = netq_next(node)) {
+    if (dtls_uint16_to_int(DTLS_HANDSHAKE_HEADER(node->data)->message_seq)
+	== seq) {
+      netq_remove(&peer->handshake_params->reorder_queue, node);
+      netq_node_free(node);
+      return;
+    }
   }
-
-  return err;
 }
-      
+
+static int handle_reordered(dtls_context_t *ctx, dtls_peer_t *peer,
+			    session_t *session, const dtls_peer_type role);
+
 static int
 handle_handshake(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
 		 const dtls_peer_type role, const dtls_state_t state,
 		 uint8 *data, size_t data_length)
 {
   dtls_handshake_header_t *hs_header;
-  int res;
+  netq_t *node;
+  int seq, res;
 
   if (data_length < DTLS_HS_LENGTH) {
     dtls_warn("handshake message too short\n");
@@ -3477,6 +6364,11 @@ handle_handshake(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
   }
   hs_header = DTLS_HANDSHAKE_HEADER(data);
 
+  if (dtls_get_fragment_length(hs_header) > data_length - DTLS_HS_LENGTH) {
+    dtls_warn("handshake fragment exceeds record\n");
+    return dtls_alert_fatal_create(DTLS_ALERT_DECODE_ERROR);
+  }
+
   dtls_debug("received handshake packet of type: %s (%i)\n",
 	     dtls_handshake_type_to_name(hs_header->msg_type), hs_header->msg_type);
 
@@ -3487,6 +6379,14 @@ handle_handshake(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
       return dtls_alert_fatal_create(DTLS_ALERT_HANDSHAKE_FAILURE);
     }
 
+    /* Without handshake state, there is nothing to reassemble
+     * fragments in. The peer will resend the message. */
+    if (dtls_handshake_fragmented(hs_header)) {
+      dtls_warn("ignore fragmented %s\n",
+		dtls_handshake_type_to_name(hs_header->msg_type));
+      return 0;
+    }
+
     /* This is a ClientHello or Hello Request send when doing TLS renegotiation */
     if (hs_header->msg_type == DTLS_HT_CLIENT_HELLO ||
 	hs_header->msg_type == DTLS_HT_HELLO_REQUEST) {
@@ -3498,79 +6398,71 @@ handle_handshake(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
     }
   }
 
-  if (dtls_uint16_to_int(hs_header->message_seq) < peer->handshake_params->hs_state.mseq_r) {
+  seq = dtls_uint16_to_int(hs_header->message_seq);
+  if (seq < peer->handshake_params->hs_state.mseq_r) {
     dtls_warn("The message sequence number is too small, expected %i, got: %i\n",
-	      peer->handshake_params->hs_state.mseq_r, dtls_uint16_to_int(hs_header->message_seq));
+	      peer->handshake_params->hs_state.mseq_r, seq);
     return 0;
-  } else if (dtls_uint16_to_int(hs_header->message_seq) > peer->handshake_params->hs_state.mseq_r) {
-    /* A packet in between is missing, buffer this packet. */
-    netq_t *n;
-
-    /* TODO: only add packet that are not too new. */
-    if (data_length > DTLS_MAX_BUF) {
-      dtls_warn("the packet is too big to buffer for reoder\n");
+  } else if (seq > peer->handshake_params->hs_state.mseq_r ||
+	     dtls_handshake_fragmented(hs_header)) {
+    /* A packet in between is missing or this is only a fragment,
+     * buffer it until the message can be handled. */
+    node = NULL;
+    res = dtls_reassemble(peer, data, &node);
+    if (res < 0)
+      return res;
+    if (!node || seq > peer->handshake_params->hs_state.mseq_r)
       return 0;
-    }
 
-    netq_t *node = netq_head(&peer->handshake_params->reorder_queue);
-    while (node) {
-      dtls_handshake_header_t *node_header = DTLS_HANDSHAKE_HEADER(node->data);
-      if (dtls_uint16_to_int(node_header->message_seq) == dtls_uint16_to_int(hs_header->message_seq)) {
-        dtls_warn("a packet with this sequence number is already stored\n");
-        return 0;
-      }
-      node = netq_next(node);
-    }
+    netq_remove(&peer->handshake_params->reorder_queue, node);
+    res = handle_handshake_msg(ctx, peer, session, role, state,
+			       node->data, node->length);
+    netq_node_free(node);
+  } else {
+    /* Found the expected packet, fragments of an earlier copy are
+     * no longer needed */
+    dtls_reassembly_drop(peer, seq);
+    res = handle_handshake_msg(ctx, peer, session, role, state, data, data_length);
+  }
+  if (res < 0)
+    return res;
 
-    n = netq_node_new(data_length);
-    if (!n) {
-      dtls_warn("no space in reoder buffer\n");
-      return 0;
-    }
+  return handle_reordered(ctx, peer, session, role);
+}
 
-    n->peer = peer;
-    n->length = data_length;
-    memcpy(n->data, data, data_length);
+/**
+ * Handles all buffered handshake messages of @p peer that are
+ * complete and in sequence. This stops when the handshake has to
+ * wait for an ECC job.
+ */
+static int
+handle_reordered(dtls_context_t *ctx, dtls_peer_t *peer, session_t *session,
+		 const dtls_peer_type role)
+{
+  netq_t *node;
+  int res = 0;
+
+  /* Use all buffered packets that are complete and in sequence. We do
+   * not know in which order they are in the list, so search the list
+   * for every packet. */
+  while (peer->handshake_params && !dtls_ecc_pending(peer)) {
+    node = netq_head(&peer->handshake_params->reorder_queue);
+    while (node && !(dtls_reassembly_complete(node) &&
+		     dtls_uint16_to_int(DTLS_HANDSHAKE_HEADER(node->data)->message_seq)
+		     == peer->handshake_params->hs_state.mseq_r))
+      node = netq_next(node);
 
-    if (!netq_insert_node(&peer->handshake_params->reorder_queue, n)) {
-      dtls_warn("cannot add packet to reoder buffer\n");
-      netq_node_free(n);
-    }
-    dtls_info("Added packet for reordering\n");
-    return 0;
-  } else if (dtls_uint16_to_int(hs_header->message_seq) == peer->handshake_params->hs_state.mseq_r) {
-    /* Found the expected packet, use this and all the buffered packet */
-    int next = 1;
+    if (!node)
+      break;
 
-    res = handle_handshake_msg(ctx, peer, session, role, state, data, data_length);
+    netq_remove(&peer->handshake_params->reorder_queue, node);
+    res = handle_handshake_msg(ctx, peer, session, role, peer->state,
+			       node->data, node->length);
+    netq_node_free(node);
     if (res < 0)
       return res;
-
-    /* We do not know in which order the packet are in the list just search the list for every packet. */
-    while (next && peer->handshake_params) {
-      next = 0;
-      netq_t *node = netq_head(&peer->handshake_params->reorder_queue);
-      while (node) {
-        dtls_handshake_header_t *node_header = DTLS_HANDSHAKE_HEADER(node->data);
-
-        if (dtls_uint16_to_int(node_header->message_seq) == peer->handshake_params->hs_state.mseq_r) {
-          netq_remove(&peer->handshake_params->reorder_queue, node);
-          next = 1;
-          res = handle_handshake_msg(ctx, peer, session, role, peer->state, node->data, node->length);
-          if (res < 0) {
-            return res;
-          }
-
-          break;
-        } else {
-          node = netq_next(node);
-        }
-      }
-    }
-    return res;
   }
-  assert(0);
-  return 0;
+  return res;
 }
 
 static int
@@ -3595,10 +6487,13 @@ handle_ccs(dtls_context_t *ctx, dtls_peer_t *peer,
   if (data_length < 1 || data[0] != 1)
     return dtls_alert_fatal_create(DTLS_ALERT_DECODE_ERROR);
 
-  /* Just change the cipher when we are on the same epoch */
-  if (peer->role == DTLS_SERVER) {
+  /* Just change the cipher when we are on the same epoch. The keys of
+   * an abbreviated handshake have been created with the ServerHello. */
+  if (!dtls_role_is_client(peer->role) && !handshake->resumed) {
+    session_t session;
+
     err = calculate_key_block(ctx, handshake, peer,
-			      &peer->session, peer->role);
+			      dtls_peer_session(peer, &session), peer->role);
     if (err < 0) {
       return err;
     }
@@ -3617,6 +6512,7 @@ static int
 handle_alert(dtls_context_t *ctx, dtls_peer_t *peer, 
 	     uint8 *record_header, uint8 *data, size_t data_length) {
   int free_peer = 0;		/* indicates whether to free peer */
+  session_t session;
   (void)record_header;
 
   if (data_length < 2)
@@ -3628,6 +6524,7 @@ handle_alert(dtls_context_t *ctx, dtls_peer_t *peer,
     dtls_warn("got an alert for an unknown peer, we probably already removed it, ignore it\n");
     return 0;
   }
+  dtls_peer_session(peer, &session);
 
   /* The peer object is invalidated for FATAL alerts and close
    * notifies. This is done in two steps.: First, remove the object
@@ -3637,14 +6534,17 @@ handle_alert(dtls_context_t *ctx, dtls_peer_t *peer,
    */
   if (data[0] == DTLS_ALERT_LEVEL_FATAL || data[1] == DTLS_ALERT_CLOSE_NOTIFY) {
     dtls_alert("%d invalidate peer\n", data[1]);
+
+    if (data[1] != DTLS_ALERT_CLOSE_NOTIFY)
+      dtls_session_cache_remove(ctx, peer);
     
-    DEL_PEER(ctx->peers, peer);
+    dtls_unlink_peer(ctx, peer);
 
 #ifdef WITH_CONTIKI
 #ifndef NDEBUG
     PRINTF("removed peer [");
-    PRINT6ADDR(&peer->session.addr);
-    PRINTF("]:%d\n", uip_ntohs(peer->session.port));
+    PRINT6ADDR(&session.addr);
+    PRINTF("]:%d\n", uip_ntohs(session.port));
 #endif
 #endif /* WITH_CONTIKI */
 
@@ -3652,7 +6552,7 @@ handle_alert(dtls_context_t *ctx, dtls_peer_t *peer,
 
   }
 
-  (void)CALL(ctx, event, &peer->session, 
+  (void)CALL(ctx, event, &session, 
 	     (dtls_alert_level_t)data[0], (unsigned short)data[1]);
   switch (data[1]) {
   case DTLS_ALERT_CLOSE_NOTIFY:
@@ -3689,6 +6589,8 @@ static int dtls_alert_send_from_err(dtls_context_t *ctx, dtls_peer_t *peer,
       peer = dtls_get_peer(ctx, session);
     }
     if (peer) {
+      if (level == DTLS_ALERT_LEVEL_FATAL)
+	dtls_session_cache_remove(ctx, peer);
       peer->state = DTLS_STATE_CLOSING;
       return dtls_send_alert(ctx, peer, level, desc);
     }
@@ -3697,6 +6599,7 @@ static int dtls_alert_send_from_err(dtls_context_t *ctx, dtls_peer_t *peer,
       peer = dtls_get_peer(ctx, session);
     }
     if (peer) {
+      dtls_session_cache_remove(ctx, peer);
       peer->state = DTLS_STATE_CLOSING;
       return dtls_send_alert(ctx, peer, DTLS_ALERT_LEVEL_FATAL, DTLS_ALERT_INTERNAL_ERROR);
     }
@@ -3704,22 +6607,71 @@ static int dtls_alert_send_from_err(dtls_context_t *ctx, dtls_peer_t *peer,
   return -1;
 }
 
+/**
+ * Checks the record @p msg of @p rlen bytes from @p peer against
+ * everything that is known without decrypting it: the epoch, the
+ * length that the cipher of the epoch requires, whether the content
+ * type must be protected, and the replay window.
+ *
+ * @return The dtls_drop_reason_t to drop the record for, or @c -1 if
+ *   the record must be decrypted.
+ */
+static int
+dtls_record_check(dtls_peer_t *peer, uint8 *msg, size_t rlen) {
+  dtls_record_header_t *header = DTLS_RECORD_HEADER(msg);
+  dtls_security_parameters_t *security =
+    dtls_security_params_epoch(peer, dtls_get_epoch(header));
+  size_t clen = rlen - dtls_record_header_length(msg);
+
+  if (clen > DTLS_MAX_BUF)
+    return DTLS_DROP_LENGTH;
+
+  /* a connected client that has lost its state starts over */
+  if (!security)
+    return hs_attempt_with_existing_peer(msg, rlen, peer)
+      ? -1 : DTLS_DROP_EPOCH;
+
+  if (security->cipher == TLS_NULL_WITH_NULL_NULL) {
+    if (msg[0] == DTLS_CT_APPLICATION_DATA || msg[0] == DTLS_CT_TLS12_CID)
+      return DTLS_DROP_CONTENTTYPE;
+  } else if (clen < 16) {	/* need at least IV and MAC */
+    return DTLS_DROP_LENGTH;
+  }
+
+  if (!dtls_replay_check(&security->cseq,
+			 dtls_uint48_to_int(header->sequence_number)))
+    return DTLS_DROP_REPLAY;
+  return -1;
+}
+
+/** Counts a record that is dropped for @p reason without decryption. */
+static inline void
+dtls_record_drop(dtls_context_t *ctx, int reason) {
+  dtls_info("dropped record before decryption (reason %d)\n", reason);
+  ctx->drops[reason]++;
+}
+
 /** 
- * Handles incoming data as DTLS message from given peer.
+ * Handles incoming data as DTLS message from given peer. The caller
+ * has looked up @p peer for @p session already. @p peer may have
+ * been released or replaced when this function returns, the caller
+ * must look it up again if ctx->peer_gen has changed.
  */
-int
-dtls_handle_message(dtls_context_t *ctx, 
-		    session_t *session,
-		    uint8 *msg, int msglen) {
-  dtls_peer_t *peer = NULL;
+static int
+dtls_handle_message_peer(dtls_context_t *ctx, 
+			 session_t *session, dtls_peer_t *peer,
+			 uint8 *msg, int msglen) {
+  session_t peer_session;	/* the address of peer */
   unsigned int rlen;		/* record length */
   uint8 *data; 			/* (decrypted) payload */
   int data_length;		/* length of decrypted payload 
 				   (without MAC and padding) */
+  unsigned int gen;		/* ctx->peer_gen before the handshake */
   int err;
-
-  /* check if we have DTLS state for addr/port/ifindex */
-  peer = dtls_get_peer(ctx, session);
+#if DTLS_CID_LENGTH > 0
+  uint8 cid[DTLS_CID_LENGTH];	/* the connection ID that peer was found by */
+  int by_cid;
+#endif /* DTLS_CID_LENGTH > 0 */
 
   if (!peer) {
     dtls_debug("dtls_handle_message: PEER NOT FOUND\n");
@@ -3731,8 +6683,53 @@ dtls_handle_message(dtls_context_t *ctx,
   while ((rlen = is_record(msg,msglen))) {
     dtls_peer_type role;
     dtls_state_t state;
+    uint8 *record = msg;	/* record header without connection ID */
+
+#if DTLS_CID_LENGTH > 0
+    by_cid = msg[0] == DTLS_CT_TLS12_CID;
+    if (by_cid) {
+      /* the connection ID identifies the peer, not the address */
+      dtls_peer_t *owner =
+	dtls_get_peer_by_cid(ctx, msg + DTLS_RH_LENGTH - sizeof(uint16));
+      if (!owner) {
+	dtls_info("dropped record with unknown connection ID\n");
+	ctx->drops[DTLS_DROP_CID]++;
+	msg += rlen;
+	msglen -= rlen;
+	continue;
+      }
+      peer = owner;
+      /* decrypt_verify() overwrites the connection ID in msg */
+      memcpy(cid, peer->cid, DTLS_CID_LENGTH);
+    }
+#endif /* DTLS_CID_LENGTH > 0 */
+
+#ifdef DTLS_ECC
+    /* The records following a message that started an ECC job can
+     * only be handled with the job's result. */
+    if (dtls_ecc_pending(peer)) {
+#if DTLS_RECORD_BATCH_SIZE > 0
+      /* a record that has been decrypted in advance cannot be
+       * handled again later */
+      if (dtls_record_opened(ctx, msg)) {
+	dtls_info("dropped record that arrived during an ECC job\n");
+	msg += rlen;
+	msglen -= rlen;
+	continue;
+      }
+#endif /* DTLS_RECORD_BATCH_SIZE > 0 */
+      return dtls_ecc_defer(peer, msg, msglen);
+    }
+#endif /* DTLS_ECC */
 
     dtls_debug("got packet %d (%d bytes)\n", msg[0], rlen);
+    if (peer && (err = dtls_record_check(peer, msg, rlen)) >= 0) {
+      dtls_record_drop(ctx, err);
+      msg += rlen;
+      msglen -= rlen;
+      continue;
+    }
+
     if (peer) {
       dtls_record_header_t *header = DTLS_RECORD_HEADER(msg);
       
@@ -3741,42 +6738,17 @@ dtls_handle_message(dtls_context_t *ctx,
         dtls_alert("No security context for epoch: %i\n", dtls_get_epoch(header));
         data_length = -1;
       } else {
+        /* dtls_record_check() has checked the replay window */
         uint64_t pkt_seq_nr = dtls_uint48_to_int(header->sequence_number);
-        if(pkt_seq_nr == 0 && security->cseq.cseq == 0) {
-          data_length = decrypt_verify(peer, msg, rlen, &data);
-          if (data_length) {
-            security->cseq.cseq = 0;
-            security->cseq.bitfield = -1;
-          }
-        } else if (pkt_seq_nr == security->cseq.cseq) {
-          dtls_info("Duplicate packet arrived (cseq=%" PRIu64 ")\n", security->cseq.cseq);
-          return 0;
-        } else if ((int64_t)(security->cseq.cseq-pkt_seq_nr) > 0) { /* pkt_seq_nr < security->cseq.cseq */
-          if (((security->cseq.cseq-1)-pkt_seq_nr) < 64) {
-              if(security->cseq.bitfield & (1<<((security->cseq.cseq-1)-pkt_seq_nr))) {
-                dtls_info("Duplicate packet arrived (bitfield)\n");
-                /* seen it */
-                  return 0;
-              } else {
-                dtls_info("Packet arrived out of order\n");
-                data_length = decrypt_verify(peer, msg, rlen, &data);
-                if(data_length > 0) {
-                  security->cseq.bitfield |= (1<<((security->cseq.cseq-1)-pkt_seq_nr));
-                }
-              }
-          } else {
-            dtls_info("Packet from before the bitfield arrived\n");
-              return 0;
-          }
-        } else { /* pkt_seq_nr > security->cseq.cseq */
-          data_length = decrypt_verify(peer, msg, rlen, &data);
-          if(data_length > 0) {
-            security->cseq.bitfield <<= (pkt_seq_nr-security->cseq.cseq);
-            security->cseq.bitfield |= 1<<((pkt_seq_nr-security->cseq.cseq)-1);
-            security->cseq.cseq = pkt_seq_nr;
-            dtls_debug("new packet arrived with seq_nr: %" PRIu64 "\n", pkt_seq_nr);
-            dtls_debug("new bitfield is               : %" PRIx64 "\n", security->cseq.bitfield);
-          }
+        if (pkt_seq_nr < security->cseq.cseq)
+          dtls_info("Packet arrived out of order\n");
+        data_length = decrypt_verify(ctx, peer, msg, rlen, &data);
+        if (data_length >= 0) {
+          dtls_replay_update(&security->cseq, pkt_seq_nr);
+          DTLS_STATS_ADD(ctx, records_in, 1);
+          dtls_debug("new packet arrived with seq_nr: %" PRIu64 "\n", pkt_seq_nr);
+        } else {
+          DTLS_STATS_ADD(ctx, decrypt_failures, 1);
         }
       }
       if (data_length < 0) {
@@ -3789,7 +6761,8 @@ dtls_handle_message(dtls_context_t *ctx,
 	  err =  dtls_alert_fatal_create(DTLS_ALERT_DECRYPT_ERROR);
           dtls_info("decrypt_verify() failed\n");
 	  if (peer->state < DTLS_STATE_CONNECTED) {
-	    dtls_alert_send_from_err(ctx, peer, &peer->session, err);
+	    dtls_alert_send_from_err(ctx, peer,
+				     dtls_peer_session(peer, &peer_session), err);
 	    peer->state = DTLS_STATE_CLOSED;
 	    dtls_stop_retransmission(ctx, peer);
 	    dtls_destroy_peer(ctx, peer, 1);
@@ -3799,6 +6772,7 @@ dtls_handle_message(dtls_context_t *ctx,
       } else {
         role = peer->role;
         state = peer->state;
+        dtls_peer_touch(ctx, peer);
       }
     } else {
       /* is_record() ensures that msg contains at least a record header */
@@ -3808,7 +6782,20 @@ dtls_handle_message(dtls_context_t *ctx,
       role = DTLS_SERVER;
     }
 
-    dtls_debug_hexdump("receive header", msg, sizeof(dtls_record_header_t));
+#if DTLS_CID_LENGTH > 0
+    if (msg[0] == DTLS_CT_TLS12_CID) {
+      /* decrypt_verify() has moved the header behind the connection
+       * ID. The peer follows an address change with the newest
+       * authenticated record only, see RFC 9146, Section 6. */
+      record = msg + DTLS_CID_LENGTH;
+      if (dtls_uint48_to_int(DTLS_RECORD_HEADER(record)->sequence_number) ==
+	  dtls_security_params_epoch(peer, dtls_get_epoch(DTLS_RECORD_HEADER(record)))->cseq.cseq &&
+	  !dtls_peer_has_session(peer, session))
+	dtls_migrate_peer(ctx, peer, session);
+    }
+#endif /* DTLS_CID_LENGTH > 0 */
+
+    dtls_debug_hexdump("receive header", record, sizeof(dtls_record_header_t));
     dtls_debug_hexdump("receive unencrypted", data, data_length);
 
     /* Handle received record according to the first byte of the
@@ -3816,101 +6803,500 @@ dtls_handle_message(dtls_context_t *ctx,
      * combining multiple fragments of one type into a single
      * record. */
 
-    switch (msg[0]) {
+    switch (record[0]) {
+
+    case DTLS_CT_CHANGE_CIPHER_SPEC:
+      if (peer) {
+        dtls_update_rtt(peer);
+        dtls_stop_retransmission(ctx, peer);
+      }
+      err = handle_ccs(ctx, peer, record, data, data_length);
+      if (err < 0) {
+	dtls_warn("error while handling ChangeCipherSpec message\n");
+	dtls_alert_send_from_err(ctx, peer, session, err);
+
+	/* invalidate peer */
+	dtls_destroy_peer(ctx, peer, 1);
+	peer = NULL;
+
+	return err;
+      }
+      break;
+
+    case DTLS_CT_ALERT:
+      if (peer) {
+        dtls_stop_retransmission(ctx, peer);
+      }
+      err = handle_alert(ctx, peer, record, data, data_length);
+      if (err < 0 || err == 1) {
+         dtls_warn("received alert, peer has been invalidated\n");
+         /* handle alert has invalidated peer */
+         peer = NULL;
+         return err < 0 ?err:-1;
+      }
+      break;
+
+    case DTLS_CT_HANDSHAKE:
+      /* Handshake messages other than Finish must use the current
+       * epoch, Finish has epoch + 1. */
+
+      if (peer) {
+	uint16_t expected_epoch = dtls_security_params(peer)->epoch;
+	uint16_t msg_epoch = 
+	  dtls_uint16_to_int(DTLS_RECORD_HEADER(record)->epoch);
+
+	/* The new security parameters must be used for all messages
+	 * that are sent after the ChangeCipherSpec message. This
+	 * means that the client's Finished message uses epoch + 1
+	 * while the server is still in the old epoch. In abbreviated
+	 * handshakes, this applies to the server's Finished.
+	 */
+	if (state == DTLS_STATE_WAIT_FINISHED && peer->handshake_params &&
+	    (!dtls_role_is_client(role)) != peer->handshake_params->resumed) {
+	  expected_epoch++;
+	}
+
+	/* A NewSessionTicket is sent before the server's
+	 * ChangeCipherSpec, when the client already uses the new
+	 * security parameters. */
+	if (state == DTLS_STATE_WAIT_CHANGECIPHERSPEC && dtls_role_is_client(role) &&
+	    peer->handshake_params && peer->handshake_params->ticket &&
+	    !peer->handshake_params->resumed && expected_epoch > 0) {
+	  expected_epoch--;
+	}
+
+	if (expected_epoch != msg_epoch) {
+          if (hs_attempt_with_existing_peer(record, rlen, peer)) {
+            state = DTLS_STATE_WAIT_CLIENTHELLO;
+            role = DTLS_SERVER;
+          } else {
+	    dtls_warn("Wrong epoch, expected %i, got: %i\n",
+		    expected_epoch, msg_epoch);
+	    break;
+	  }
+	}
+      }
+
+      gen = ctx->peer_gen;
+      err = handle_handshake(ctx, peer, session, role, state, data, data_length);
+      if (err < 0) {
+	dtls_warn("error while handling handshake packet\n");
+	dtls_alert_send_from_err(ctx, peer, session, err);
+	return err;
+      }
+      /* a Client Hello for a new handshake replaces the peer, which
+       * is looked up again by the key the record has been routed by */
+      if (ctx->peer_gen != gen) {
+#if DTLS_CID_LENGTH > 0
+	if (by_cid)
+	  peer = dtls_get_peer_by_cid(ctx, cid);
+	else
+#endif /* DTLS_CID_LENGTH > 0 */
+	  peer = dtls_get_peer(ctx, session);
+      }
+      if (peer && peer->state == DTLS_STATE_CONNECTED) {
+	/* stop retransmissions */
+	dtls_stop_retransmission(ctx, peer);
+	dtls_peer_touch(ctx, peer);
+	CALL(ctx, event, dtls_peer_session(peer, &peer_session), 0,
+	     DTLS_EVENT_CONNECTED);
+      }
+      break;
+
+    case DTLS_CT_APPLICATION_DATA:
+      dtls_info("** application data:\n");
+      if (!peer) {
+        dtls_warn("no peer available, send an alert\n");
+        // TODO: should we send a alert here?
+        return -1;
+      }
+      dtls_stop_retransmission(ctx, peer);
+      CALL(ctx, read, dtls_peer_session(peer, &peer_session),
+	   data, data_length);
+      break;
+    default:
+      dtls_info("dropped unknown message of type %d\n",record[0]);
+    }
+
+    /* advance msg by length of ciphertext */
+    msg += rlen;
+    msglen -= rlen;
+  }
+
+  if (msglen > 0) {
+    dtls_info("dropped %d bytes that do not form a record\n", msglen);
+    ctx->drops[DTLS_DROP_MALFORMED]++;
+  }
+  return 0;
+}
+
+#ifdef DTLS_ECC
+/**
+ * Continues the handshake of @p peer with the result of @p job.
+ * @p resumed is set if the job has been completed asynchronously, in
+ * this case also the remaining messages of the current flight are
+ * sent.
+ */
+static int
+dtls_ecc_job_finish(dtls_context_t *ctx, dtls_peer_t *peer,
+		    dtls_ecc_job_t *job, int resumed) {
+  int res;
+
+  switch (job->step) {
+  case DTLS_ECC_STEP_SERVER_KEY_EXCHANGE:
+    if (job->result < 0)
+      return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+    res = dtls_write_server_key_exchange_ecdh(ctx, peer,
+					      job->point_r, job->point_s);
+    if (res < 0) {
+      dtls_debug("dtls_server_hello: cannot prepare Server Key Exchange record\n");
+      return res;
+    }
+    return resumed ? dtls_send_server_hello_done_msgs(ctx, peer) : 0;
+
+  case DTLS_ECC_STEP_CERTIFICATE_VERIFY:
+    if (job->result < 0)
+      return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+    res = dtls_write_certificate_verify_ecdh(ctx, peer,
+					     job->point_r, job->point_s);
+    if (res < 0) {
+      dtls_debug("dtls_server_hello: cannot prepare Certificate record\n");
+      return res;
+    }
+    return resumed ? dtls_client_key_block(ctx, peer) : 0;
+
+  case DTLS_ECC_STEP_VERIFY:
+    if (job->result < 0) {
+      dtls_alert("wrong signature err: %i\n", job->result);
+      return dtls_alert_fatal_create(DTLS_ALERT_HANDSHAKE_FAILURE);
+    }
+    return 0;
+
+  case DTLS_ECC_STEP_KEY_BLOCK:
+    if (job->result < 0 || !peer->security_params[1]) {
+      dtls_crit("cannot calculate the pre master secret\n");
+      return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+    }
+    dtls_trace(ctx, DTLS_TRACE_PRF, 0);
+    res = dtls_derive_key_block(peer->handshake_params,
+				peer->security_params[1],
+				job->secret, sizeof(job->secret), peer->role);
+    dtls_trace(ctx, DTLS_TRACE_PRF, 1);
+    if (res < 0 || !resumed || !dtls_role_is_client(peer->role))
+      return res;
+    return dtls_send_finished_flight(ctx, peer);
+
+  default:
+    return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+  }
+}
+
+/**
+ * Handles the datagrams that have been queued for @p session while
+ * its handshake waited for an ECC job. When another job is started
+ * in between, the rest is queued again.
+ */
+static int
+dtls_ecc_replay(dtls_context_t *ctx, session_t *session, netq_t *queue) {
+  dtls_peer_t *peer;
+  netq_t *node;
+  int res = 0;
+
+  while ((node = netq_pop_first(&queue))) {
+    peer = dtls_get_peer(ctx, session);
+    if (res < 0 || !peer) {
+      netq_node_free(node);
+    } else if (dtls_ecc_pending(peer)) {
+      netq_insert_node(&peer->handshake_params->deferred, node);
+    } else {
+      res = dtls_handle_message_peer(ctx, session, peer,
+				     node->data, node->length);
+      netq_node_free(node);
+    }
+  }
+  return res;
+}
+
+int
+dtls_ecc_job_complete(dtls_context_t *ctx, dtls_ecc_job_t *job) {
+  dtls_peer_t *peer;
+  netq_t *queue;
+  session_t session;
+  int res;
+
+  if (!job)
+    return 0;
+
+  peer = dtls_get_peer(ctx, &job->session);
+  if (!peer || !peer->handshake_params ||
+      peer->handshake_params->ecc_job != job) {
+    dtls_debug("handshake for ecc job is gone\n");
+    dtls_ecc_job_free(job);
+    return 0;
+  }
+
+  dtls_peer_session(peer, &session);
+  peer->handshake_params->ecc_job = NULL;
+  res = dtls_ecc_job_finish(ctx, peer, job, 1);
+  dtls_ecc_job_free(job);
+
+  if (res >= 0 && !dtls_ecc_pending(peer)) {
+    res = handle_reordered(ctx, peer, &session, peer->role);
+    if (res >= 0 && peer->state == DTLS_STATE_CONNECTED) {
+      dtls_stop_retransmission(ctx, peer);
+      dtls_peer_touch(ctx, peer);
+      CALL(ctx, event, &session, 0, DTLS_EVENT_CONNECTED);
+    }
+  }
+
+  if (res < 0) {
+    dtls_warn("error while continuing the handshake\n");
+    dtls_alert_send_from_err(ctx, peer, &session, res);
+  } else if (peer->handshake_params && !dtls_ecc_pending(peer)) {
+    queue = peer->handshake_params->deferred;
+    peer->handshake_params->deferred = NULL;
+    res = dtls_ecc_replay(ctx, &session, queue);
+  }
+
+  dtls_flush(ctx);
+  return res;
+}
+#endif /* DTLS_ECC */
+
+int
+dtls_handle_message(dtls_context_t *ctx, 
+		    session_t *session,
+		    uint8 *msg, int msglen) {
+  int res;
+
+  if (msglen > 0)
+    DTLS_STATS_ADD(ctx, bytes_in, msglen);
 
-    case DTLS_CT_CHANGE_CIPHER_SPEC:
-      if (peer) {
-        dtls_stop_retransmission(ctx, peer);
-      }
-      err = handle_ccs(ctx, peer, msg, data, data_length);
-      if (err < 0) {
-	dtls_warn("error while handling ChangeCipherSpec message\n");
-	dtls_alert_send_from_err(ctx, peer, session, err);
+  /* check if we have DTLS state for addr/port/ifindex */
+  res = dtls_handle_message_peer(ctx, session, dtls_get_peer(ctx, session),
+				 msg, msglen);
+  dtls_flush(ctx);
+  return res;
+}
 
-	/* invalidate peer */
-	dtls_destroy_peer(ctx, peer, 1);
-	peer = NULL;
+#if DTLS_COOKIE_BATCH_SIZE > 0
+/**
+ * Copies the input of the cookie HMAC for the datagram @p msg, i.e.
+ * what dtls_create_cookie() hashes, to @p buf if @p msg starts with
+ * an unprotected Client Hello.
+ *
+ * @return The number of bytes written to @p buf, or @c 0 if @p msg
+ *         is no Client Hello or its input exceeds @p buflen.
+ */
+static size_t
+dtls_cookie_input(const dtls_message_t *msg, uint8 *buf, size_t buflen) {
+  uint8 *data = msg->msg + DTLS_RH_LENGTH;
+  size_t rlen = is_record(msg->msg, msg->length);
+  dtls_peer_key_t key;
+  size_t head, tail;
+  int len;
 
-	return err;
-      }
-      break;
+  if (rlen < DTLS_RH_LENGTH + DTLS_HS_LENGTH
+      || msg->msg[0] != DTLS_CT_HANDSHAKE
+      || dtls_get_epoch(DTLS_RECORD_HEADER(msg->msg)) != 0
+      || DTLS_HANDSHAKE_HEADER(data)->msg_type != DTLS_HT_CLIENT_HELLO
+      || dtls_handshake_fragmented(DTLS_HANDSHAKE_HEADER(data)))
+    return 0;
 
-    case DTLS_CT_ALERT:
-      if (peer) {
-        dtls_stop_retransmission(ctx, peer);
-      }
-      err = handle_alert(ctx, peer, msg, data, data_length);
-      if (err < 0 || err == 1) {
-         dtls_warn("received alert, peer has been invalidated\n");
-         /* handle alert has invalidated peer */
-         peer = NULL;
-         return err < 0 ?err:-1;
-      }
-      break;
+  len = dtls_cookie_parts(data, rlen - DTLS_RH_LENGTH, &head, &tail);
+  if (len < 0 || sizeof(key) + head + (len - tail) > buflen)
+    return 0;
 
-    case DTLS_CT_HANDSHAKE:
-      /* Handshake messages other than Finish must use the current
-       * epoch, Finish has epoch + 1. */
+  dtls_session_key(&msg->session, &key);
+  memcpy(buf, &key, sizeof(key));
+  buf += sizeof(key);
+  memcpy(buf, data + DTLS_HS_LENGTH, head);
+  memcpy(buf + head, data + DTLS_HS_LENGTH + tail, len - tail);
+  return sizeof(key) + head + (len - tail);
+}
 
-      if (peer) {
-	uint16_t expected_epoch = dtls_security_params(peer)->epoch;
-	uint16_t msg_epoch = 
-	  dtls_uint16_to_int(DTLS_RECORD_HEADER(msg)->epoch);
+/**
+ * Computes the cookies for all Client Hellos among the @p count
+ * datagrams in @p msgs, DTLS_COOKIE_BATCH_SIZE at a time with
+ * dtls_hmac_finalize_multi(). dtls_verify_peer() takes the cookies
+ * from @p batch instead of computing each of them on its own.
+ */
+static void
+dtls_prepare_cookies(dtls_context_t *ctx, dtls_message_t *msgs, size_t count,
+		     dtls_cookie_batch_t *batch) {
+  uint8 input[DTLS_COOKIE_BATCH_SIZE][DTLS_COOKIE_INPUT_MAX];
+  dtls_hmac_context_t hmac[DTLS_COOKIE_BATCH_SIZE];
+  dtls_hmac_context_t *hmacs[DTLS_COOKIE_BATCH_SIZE];
+  const unsigned char *inputs[DTLS_COOKIE_BATCH_SIZE];
+  size_t len[DTLS_COOKIE_BATCH_SIZE];
+  unsigned char mac[DTLS_COOKIE_BATCH_SIZE][DTLS_HMAC_MAX];
+  unsigned char *macs[DTLS_COOKIE_BATCH_SIZE];
+  size_t i, k, n = 0;
+
+  dtls_check_cookie_secret(ctx);
+  batch->secret_age = ctx->cookie_secret_age;
+  batch->count = 0;
+
+  for (i = 0; i < count; i++) {
+    len[n] = dtls_cookie_input(&msgs[i], input[n], sizeof(input[n]));
+    if (len[n]) {
+      dtls_hmac_clone(&hmac[n], &ctx->cookie_hmac[0]);
+      hmacs[n] = &hmac[n];
+      inputs[n] = input[n];
+      macs[n] = mac[n];
+      batch->hello[batch->count + n++] = msgs[i].msg + DTLS_RH_LENGTH;
+    }
 
-	/* The new security parameters must be used for all messages
-	 * that are sent after the ChangeCipherSpec message. This
-	 * means that the client's Finished message uses epoch + 1
-	 * while the server is still in the old epoch.
-	 */
-	if (role == DTLS_SERVER && state == DTLS_STATE_WAIT_FINISHED) {
-	  expected_epoch++;
-	}
+    if (n && (n == DTLS_COOKIE_BATCH_SIZE || i + 1 == count)) {
+      dtls_hmac_finalize_multi(hmacs, inputs, len, macs, n);
+      for (k = 0; k < n; k++)
+	memcpy(batch->cookie[batch->count++], mac[k], DTLS_COOKIE_LENGTH);
+      n = 0;
+    }
+  }
+}
+#endif /* DTLS_COOKIE_BATCH_SIZE > 0 */
 
-	if (expected_epoch != msg_epoch) {
-          if (hs_attempt_with_existing_peer(msg, rlen, peer)) {
-            state = DTLS_STATE_WAIT_CLIENTHELLO;
-            role = DTLS_SERVER;
-          } else {
-	    dtls_warn("Wrong epoch, expected %i, got: %i\n",
-		    expected_epoch, msg_epoch);
-	    break;
-	  }
-	}
+#if DTLS_RECORD_BATCH_SIZE > 0
+/**
+ * Decrypts the first record of each datagram among the @p count
+ * datagrams in @p msgs that belongs to a connected peer without
+ * ongoing handshake and passes dtls_record_check(),
+ * DTLS_RECORD_BATCH_SIZE records at a time with
+ * dtls_ccm_run(). @p hash holds the peer hash of each datagram.
+ * decrypt_verify() takes the results from @p batch.
+ */
+static void
+dtls_prepare_records(dtls_context_t *ctx, dtls_message_t *msgs,
+		     const uint64_t hash[], size_t count,
+		     dtls_record_batch_t *batch) {
+  unsigned char nonce[DTLS_RECORD_BATCH_SIZE][DTLS_CCM_BLOCKSIZE];
+  unsigned char aad[DTLS_RECORD_BATCH_SIZE][DTLS_A_DATA_MAX];
+  dtls_ccm_job_t job[DTLS_RECORD_BATCH_SIZE];
+  dtls_security_parameters_t *security[DTLS_RECORD_BATCH_SIZE];
+  dtls_peer_key_t key;
+  dtls_peer_t *peer;
+  uint8 *msg;
+  size_t i, k, n = 0, rlen;
+
+  batch->count = 0;
+  for (i = 0; i < count; i++) {
+    msg = msgs[i].msg;
+    rlen = msgs[i].length > 0 ? is_record(msg, msgs[i].length) : 0;
+    if (rlen) {
+#if DTLS_CID_LENGTH > 0
+      if (msg[0] == DTLS_CT_TLS12_CID) {
+	peer = dtls_get_peer_by_cid(ctx, msg + DTLS_RH_LENGTH - sizeof(uint16));
+      } else
+#endif /* DTLS_CID_LENGTH > 0 */
+      {
+	dtls_session_key(&msgs[i].session, &key);
+	peer = dtls_get_peer_by_key(ctx, &key, hash[i]);
       }
 
-      err = handle_handshake(ctx, peer, session, role, state, data, data_length);
-      if (err < 0) {
-	dtls_warn("error while handling handshake packet\n");
-	dtls_alert_send_from_err(ctx, peer, session, err);
-	return err;
-      }
-      if (peer && peer->state == DTLS_STATE_CONNECTED) {
-	/* stop retransmissions */
-	dtls_stop_retransmission(ctx, peer);
-	CALL(ctx, event, &peer->session, 0, DTLS_EVENT_CONNECTED);
+      /* the keys of other peers may still change during this burst */
+      if (peer && peer->state == DTLS_STATE_CONNECTED
+	  && !peer->handshake_params
+	  && dtls_record_check(peer, msg, rlen) < 0) {
+	security[n] = dtls_security_params_epoch(peer,
+			dtls_get_epoch(DTLS_RECORD_HEADER(msg)));
+	job[n].nonce = nonce[n];
+	job[n].aad = aad[n];
+	if (security[n] && security[n]->cipher != TLS_NULL_WITH_NULL_NULL
+	    && dtls_open_prepare(peer, security[n], msg, rlen, &job[n]) == 0)
+	  batch->record[batch->count + n++] = msg;
       }
-      break;
+    }
 
-    case DTLS_CT_APPLICATION_DATA:
-      dtls_info("** application data:\n");
-      if (!peer) {
-        dtls_warn("no peer available, send an alert\n");
-        // TODO: should we send a alert here?
-        return -1;
+    if (n && (n == DTLS_RECORD_BATCH_SIZE || i + 1 == count)) {
+      dtls_trace(ctx, DTLS_TRACE_CCM, 0);
+      dtls_ccm_run(security, job, n, 0);
+      dtls_trace(ctx, DTLS_TRACE_CCM, 1);
+      for (k = 0; k < n; k++) {
+	batch->security[batch->count] = security[k];
+	batch->result[batch->count++] = job[k].result;
       }
-      dtls_stop_retransmission(ctx, peer);
-      CALL(ctx, read, &peer->session, data, data_length);
-      break;
-    default:
-      dtls_info("dropped unknown message of type %d\n",msg[0]);
+      n = 0;
     }
+  }
+}
+#endif /* DTLS_RECORD_BATCH_SIZE > 0 */
 
-    /* advance msg by length of ciphertext */
-    msg += rlen;
-    msglen -= rlen;
+int
+dtls_handle_messages(dtls_context_t *ctx, dtls_message_t *msgs, size_t count) {
+  unsigned char done[DTLS_MESSAGE_BATCH_SIZE];
+  uint64_t hash[DTLS_MESSAGE_BATCH_SIZE];
+  dtls_peer_key_t key;
+  dtls_peer_t *peer;
+  unsigned int gen;
+  size_t i, j, n;
+  int failed = 0;
+#if DTLS_COOKIE_BATCH_SIZE > 0
+  dtls_cookie_batch_t cookies;
+#endif /* DTLS_COOKIE_BATCH_SIZE > 0 */
+#if DTLS_RECORD_BATCH_SIZE > 0
+  dtls_record_batch_t records;
+#endif /* DTLS_RECORD_BATCH_SIZE > 0 */
+
+  /* Datagrams from the same peer are handled in the order of arrival
+   * with a single peer lookup, unless a datagram has changed the peer
+   * table. Datagrams of different peers are independent of each
+   * other. */
+  for (; count; msgs += n, count -= n) {
+    n = min(count, DTLS_MESSAGE_BATCH_SIZE);
+    memset(done, 0, n);
+    for (i = 0; i < n; i++) {
+      dtls_session_key(&msgs[i].session, &key);
+      hash[i] = PEER_HASH(ctx->peers, &key);
+      if (msgs[i].length > 0)
+	DTLS_STATS_ADD(ctx, bytes_in, msgs[i].length);
+    }
+#if DTLS_COOKIE_BATCH_SIZE > 0
+    dtls_prepare_cookies(ctx, msgs, n, &cookies);
+    ctx->cookies = &cookies;
+#endif /* DTLS_COOKIE_BATCH_SIZE > 0 */
+#if DTLS_RECORD_BATCH_SIZE > 0
+    dtls_prepare_records(ctx, msgs, hash, n, &records);
+    ctx->records = &records;
+#endif /* DTLS_RECORD_BATCH_SIZE > 0 */
+
+    for (i = 0; i < n; i++) {
+      if (done[i])
+	continue;
+
+      dtls_session_key(&msgs[i].session, &key);
+      peer = dtls_get_peer_by_key(ctx, &key, hash[i]);
+      for (j = i; j < n; j++) {
+	if (done[j] || (j != i &&
+			(hash[j] != hash[i] ||
+			 !dtls_session_equals(&msgs[i].session, &msgs[j].session))))
+	  continue;
+
+	done[j] = 1;
+	gen = ctx->peer_gen;
+	msgs[j].result = dtls_handle_message_peer(ctx, &msgs[j].session, peer,
+						  msgs[j].msg, msgs[j].length);
+	if (msgs[j].result < 0)
+	  failed++;
+
+	/* The datagram may have created a new peer, or freed the
+	 * existing one after an alert, a new Client Hello or an
+	 * eviction. */
+	if (ctx->peer_gen != gen)
+	  peer = dtls_get_peer_by_key(ctx, &key, hash[i]);
+      }
+    }
+#if DTLS_COOKIE_BATCH_SIZE > 0
+    ctx->cookies = NULL;
+#endif /* DTLS_COOKIE_BATCH_SIZE > 0 */
+#if DTLS_RECORD_BATCH_SIZE > 0
+    ctx->records = NULL;
+#endif /* DTLS_RECORD_BATCH_SIZE > 0 */
   }
 
-  return 0;
+  /* the answers to the whole burst go out together */
+  dtls_flush(ctx);
+  return failed;
 }
 
 dtls_context_t *
@@ -3918,8 +7304,7 @@ dtls_new_context(void *app_data) {
   dtls_context_t *c;
   dtls_tick_t now;
 #ifndef WITH_CONTIKI
-  FILE *urandom = fopen("/dev/urandom", "r");
-  unsigned char buf[sizeof(unsigned long)];
+  unsigned char byte;
 #endif /* WITH_CONTIKI */
 
   dtls_ticks(&now);
@@ -3927,18 +7312,11 @@ dtls_new_context(void *app_data) {
   /* FIXME: need something better to init PRNG here */
   dtls_prng_init(now);
 #else /* WITH_CONTIKI */
-  if (!urandom) {
-    dtls_emerg("cannot initialize PRNG\n");
-    return NULL;
-  }
-
-  if (fread(buf, 1, sizeof(buf), urandom) != sizeof(buf)) {
+  /* the generator seeds itself, but fail early without entropy */
+  if (!dtls_prng(&byte, sizeof(byte))) {
     dtls_emerg("cannot initialize PRNG\n");
     return NULL;
   }
-
-  fclose(urandom);
-  dtls_prng_init((unsigned long)*buf);
 #endif /* WITH_CONTIKI */
 
   c = malloc_context();
@@ -3947,6 +7325,30 @@ dtls_new_context(void *app_data) {
 
   memset(c, 0, sizeof(dtls_context_t));
   c->app = app_data;
+  c->crypto = dtls_crypto_software;
+  c->peer_max = DTLS_PEER_MAX;
+  c->handshake_max = DTLS_HANDSHAKE_MAX;
+  c->idle_timeout = DTLS_PEER_IDLE_TIMEOUT * CLOCK_SECOND;
+  c->retransmit_min = DTLS_RETRANSMIT_TIMEOUT_MIN;
+  c->retransmit_max = DTLS_RETRANSMIT_TIMEOUT_MAX;
+#if DTLS_CID_LENGTH > 0
+  c->cid_prefix = -1;
+#endif /* DTLS_CID_LENGTH > 0 */
+
+#ifndef WITH_CONTIKI
+  c->pools.allocator = dtls_get_allocator();
+  if (dtls_set_pool_size(c, DTLS_POOL_PEERS, DTLS_POOL_HANDSHAKES) < 0)
+    goto error;
+#endif /* WITH_CONTIKI */
+
+#ifndef DTLS_PEERS_NOHASH
+  if (dtls_peer_table_init(&c->peers, DTLS_PEER_MAX, 0) < 0)
+    goto error;
+#if DTLS_CID_LENGTH > 0
+  if (dtls_peer_table_init(&c->cid_peers, DTLS_PEER_MAX, 1) < 0)
+    goto error;
+#endif /* DTLS_CID_LENGTH > 0 */
+#endif /* DTLS_PEERS_NOHASH */
   
 #ifdef WITH_CONTIKI
   process_start(&dtls_retransmit_process, (char *)c);
@@ -3956,9 +7358,10 @@ dtls_new_context(void *app_data) {
   PROCESS_CONTEXT_END(&coap_retransmit_process);
 #endif /* WITH_CONTIKI */
 
-  if (dtls_prng(c->cookie_secret, DTLS_COOKIE_SECRET_LENGTH))
-    c->cookie_secret_age = now;
-  else 
+  /* both states get a random secret, a cookie of the previous secret
+   * can be forged before the first rotation otherwise */
+  if (dtls_rotate_cookie_secret(c, now) < 0
+      || dtls_rotate_cookie_secret(c, now) < 0)
     goto error;
   
   return c;
@@ -3970,35 +7373,288 @@ dtls_new_context(void *app_data) {
   return NULL;
 }
 
+int
+dtls_set_crypto_provider(dtls_context_t *ctx,
+			 const dtls_crypto_provider_t *crypto) {
+  const dtls_crypto_provider_t *sw = &dtls_crypto_software;
+
+  /* the handshakes and keys of the peers point to ctx->crypto */
+  if (ctx->lru_count[0] || ctx->lru_count[1]) {
+    dtls_warn("cannot change the crypto provider while peers exist\n");
+    return -1;
+  }
+
+#if defined(DTLS_ECC) && DTLS_ECC_POOL_SIZE > 0
+  /* the precomputed values belong to the previous provider */
+  memset(ctx->ecc_keys, 0, sizeof(ctx->ecc_keys));
+  memset(ctx->ecc_nonces, 0, sizeof(ctx->ecc_nonces));
+  ctx->ecc_keys_len = ctx->ecc_nonces_len = 0;
+#endif /* DTLS_ECC && DTLS_ECC_POOL_SIZE > 0 */
+
+  if (!crypto) {
+    ctx->crypto = *sw;
+    return 0;
+  }
+
+  ctx->crypto = *crypto;
+#define DTLS_CRYPTO_DEFAULT(Member)		\
+  if (!ctx->crypto.Member)			\
+    ctx->crypto.Member = sw->Member
+
+  DTLS_CRYPTO_DEFAULT(ccm_set_key);
+  DTLS_CRYPTO_DEFAULT(ccm_seal);
+  DTLS_CRYPTO_DEFAULT(ccm_open);
+  DTLS_CRYPTO_DEFAULT(hash_init);
+  DTLS_CRYPTO_DEFAULT(hash_update);
+  DTLS_CRYPTO_DEFAULT(hash_finalize);
+#ifdef DTLS_ECC
+  DTLS_CRYPTO_DEFAULT(ecdsa_generate_key);
+  DTLS_CRYPTO_DEFAULT(ecdh);
+  DTLS_CRYPTO_DEFAULT(ecdsa_sign);
+  DTLS_CRYPTO_DEFAULT(ecdsa_verify);
+#endif /* DTLS_ECC */
+#if DTLS_GCM
+  /* GCM uses the key storage of the software only if the provider
+   * implements none of it */
+  if (!crypto->gcm_set_key && !crypto->gcm_seal && !crypto->gcm_open) {
+    DTLS_CRYPTO_DEFAULT(gcm_set_key);
+    DTLS_CRYPTO_DEFAULT(gcm_seal);
+    DTLS_CRYPTO_DEFAULT(gcm_open);
+  }
+#endif /* DTLS_GCM */
+#if DTLS_CHACHA20
+  if (!crypto->chacha20_set_key && !crypto->chacha20_seal
+      && !crypto->chacha20_open) {
+    DTLS_CRYPTO_DEFAULT(chacha20_set_key);
+    DTLS_CRYPTO_DEFAULT(chacha20_seal);
+    DTLS_CRYPTO_DEFAULT(chacha20_open);
+  }
+#endif /* DTLS_CHACHA20 */
+#undef DTLS_CRYPTO_DEFAULT
+
+  /* the batch operations of the software must not bypass the
+   * ccm_seal or ccm_open of the provider */
+  if (!crypto->ccm_seal && !crypto->ccm_seal_multi)
+    ctx->crypto.ccm_seal_multi = sw->ccm_seal_multi;
+  if (!crypto->ccm_open && !crypto->ccm_open_multi)
+    ctx->crypto.ccm_open_multi = sw->ccm_open_multi;
+  return 0;
+}
+
+int
+dtls_set_peer_max(dtls_context_t *ctx, size_t max) {
+  if (!max)
+    return -1;
+  if (ctx->lru_count[0] || ctx->lru_count[1]) {
+    dtls_warn("cannot change the size of the peer table while in use\n");
+    return -1;
+  }
+#ifndef DTLS_PEERS_NOHASH
+#if DTLS_CID_LENGTH > 0
+  if (dtls_peer_table_init(&ctx->cid_peers, max, 1) < 0)
+    return -1;
+#endif /* DTLS_CID_LENGTH > 0 */
+  if (dtls_peer_table_init(&ctx->peers, max, 0) < 0)
+    return -1;
+#endif /* DTLS_PEERS_NOHASH */
+  ctx->peer_max = max;
+  return 0;
+}
+
+int
+dtls_set_handshake_max(dtls_context_t *ctx, size_t max) {
+  if (!max)
+    return -1;
+
+  ctx->handshake_max = max;
+  return 0;
+}
+
+void
+dtls_set_idle_timeout(dtls_context_t *ctx, unsigned int seconds) {
+  ctx->idle_timeout = (clock_time_t)seconds * CLOCK_SECOND;
+}
+
+int
+dtls_set_cid_prefix(dtls_context_t *ctx, int prefix) {
+#if DTLS_CID_LENGTH > 0
+  if (prefix < -1 || prefix > 0xff)
+    return -1;
+  ctx->cid_prefix = prefix;
+  return 0;
+#else /* DTLS_CID_LENGTH > 0 */
+  (void)ctx; (void)prefix;
+  return -1;
+#endif /* DTLS_CID_LENGTH > 0 */
+}
+
+int
+dtls_set_retransmit_timeout(dtls_context_t *ctx, clock_time_t min,
+			    clock_time_t max) {
+  if (!min || min > max)
+    return -1;
+
+  ctx->retransmit_min = min;
+  ctx->retransmit_max = max;
+  return 0;
+}
+
+int
+dtls_set_ticket_key(dtls_context_t *ctx, const unsigned char *key) {
+#if DTLS_SESSION_TICKET_KEYS > 0
+  unsigned char buf[DTLS_TICKET_KEY_LENGTH];
+  unsigned char digest[DTLS_HMAC_DIGEST_SIZE];
+  dtls_hash_ctx hash;
+  dtls_ticket_key_t *newest = ctx->ticket_keys;
+
+  if (key)
+    memcpy(buf, key, DTLS_TICKET_KEY_LENGTH);
+  else if (!dtls_prng(buf, DTLS_TICKET_KEY_LENGTH))
+    return -1;
+
+  /* the oldest key is dropped when all slots are in use */
+  memmove(ctx->ticket_keys + 1, ctx->ticket_keys,
+	  (DTLS_SESSION_TICKET_KEYS - 1) * sizeof(dtls_ticket_key_t));
+
+  if (dtls_cipher_set_key(&newest->ccm, buf, DTLS_TICKET_KEY_LENGTH) < 0) {
+    memset(buf, 0, sizeof(buf));
+    return -1;
+  }
+
+  /* servers that share the key derive the same name */
+  dtls_hash_init(&hash);
+  dtls_hash_update(&hash, buf, DTLS_TICKET_KEY_LENGTH);
+  dtls_hash_finalize(digest, &hash);
+  memcpy(newest->name, digest, DTLS_TICKET_KEY_NAME_LENGTH);
+  memset(buf, 0, sizeof(buf));
+
+  dtls_ticks(&newest->created);
+  if (ctx->ticket_keys_len < DTLS_SESSION_TICKET_KEYS)
+    ctx->ticket_keys_len++;
+  ctx->ticket_key_rotate = (key == NULL);
+  return 0;
+#else /* DTLS_SESSION_TICKET_KEYS > 0 */
+  (void)ctx;
+  (void)key;
+  dtls_warn("session tickets are not supported\n");
+  return -1;
+#endif /* DTLS_SESSION_TICKET_KEYS > 0 */
+}
+
 void dtls_reset_peer(dtls_context_t *ctx, dtls_peer_t *peer)
 {
     dtls_stop_retransmission(ctx, peer);
     dtls_destroy_peer(ctx, peer, 1);
 }
+int
+dtls_set_pool_size(dtls_context_t *ctx, size_t peers, size_t handshakes) {
+#ifndef WITH_CONTIKI
+  dtls_pools_t *pools = &ctx->pools;
+
+  if (pools->peers.used || pools->handshakes.used || pools->security.used ||
+      pools->netq.used || pools->ecc_jobs.used) {
+    dtls_warn("cannot change the pools while in use\n");
+    return -1;
+  }
+
+  dtls_pool_release(&pools->peers);
+  dtls_pool_release(&pools->handshakes);
+  dtls_pool_release(&pools->security);
+  dtls_pool_release(&pools->netq);
+  dtls_pool_release(&pools->ecc_jobs);
+
+  if (dtls_pool_init(&pools->peers, sizeof(dtls_peer_t), peers,
+		     pools->allocator) < 0 ||
+      dtls_pool_init(&pools->handshakes, sizeof(dtls_handshake_parameters_t),
+		     handshakes, pools->allocator) < 0 ||
+      dtls_pool_init(&pools->security, sizeof(dtls_security_parameters_t),
+		     DTLS_POOL_SECURITY(peers, handshakes),
+		     pools->allocator) < 0 ||
+      dtls_pool_init(&pools->netq, sizeof(netq_t) + DTLS_MAX_BUF,
+		     DTLS_POOL_NETQ(handshakes), pools->allocator) < 0
+#ifdef DTLS_ECC
+      || dtls_pool_init(&pools->ecc_jobs, sizeof(dtls_ecc_job_t),
+			handshakes, pools->allocator) < 0
+#endif /* DTLS_ECC */
+      ) {
+    /* leave working, unbounded storage behind */
+    dtls_set_pool_size(ctx, 0, 0);
+    return -1;
+  }
+  return 0;
+#else /* WITH_CONTIKI */
+  (void)ctx;
+  (void)peers;
+  (void)handshakes;
+  return -1;
+#endif /* WITH_CONTIKI */
+}
 
 void
 dtls_free_context(dtls_context_t *ctx) {
+#ifdef DTLS_PEERS_NOHASH
   dtls_peer_t *p, *tmp;
+#else /* DTLS_PEERS_NOHASH */
+  size_t i;
+#endif /* DTLS_PEERS_NOHASH */
 
   if (!ctx) {
     return;
   }
 
-  if (ctx->peers) {
 #ifdef DTLS_PEERS_NOHASH
+  if (ctx->peers) {
     LL_FOREACH_SAFE(ctx->peers, p, tmp) {
-#else /* DTLS_PEERS_NOHASH */
-    HASH_ITER(hh, ctx->peers, p, tmp) {
-#endif /* DTLS_PEERS_NOHASH */
       dtls_destroy_peer(ctx, p, 1);
     }
   }
+#else /* DTLS_PEERS_NOHASH */
+  /* removing a peer moves the following ones into its slot */
+  for (i = 0; ctx->peers.count && i <= ctx->peers.mask; i++) {
+    while (ctx->peers.slots[i].peer)
+      dtls_destroy_peer(ctx, ctx->peers.slots[i].peer, 1);
+  }
+  dtls_peer_table_free(&ctx->peers);
+#if DTLS_CID_LENGTH > 0
+  dtls_peer_table_free(&ctx->cid_peers);
+#endif /* DTLS_CID_LENGTH > 0 */
+#endif /* DTLS_PEERS_NOHASH */
+
+#if DTLS_SESSION_CACHE_SIZE > 0
+  /* do not leave the master secrets in released memory */
+  memset(ctx->sessions, 0, sizeof(ctx->sessions));
+#endif /* DTLS_SESSION_CACHE_SIZE > 0 */
+#if DTLS_SESSION_TICKET_KEYS > 0
+  memset(ctx->ticket_keys, 0, sizeof(ctx->ticket_keys));
+#endif /* DTLS_SESSION_TICKET_KEYS > 0 */
+
+  netq_wheel_delete_all(&ctx->sendqueue);
+#ifndef WITH_CONTIKI
+  dtls_pool_release(&ctx->pools.peers);
+  dtls_pool_release(&ctx->pools.handshakes);
+  dtls_pool_release(&ctx->pools.security);
+  dtls_pool_release(&ctx->pools.netq);
+  dtls_pool_release(&ctx->pools.ecc_jobs);
+#endif /* WITH_CONTIKI */
 
   free_context(ctx);
 }
 
+void
+dtls_get_stats(const dtls_context_t *ctx, dtls_stats_t *stats) {
+#if DTLS_STATS
+  *stats = ctx->stats;
+#else /* DTLS_STATS */
+  memset(stats, 0, sizeof(*stats));
+#endif /* DTLS_STATS */
+  memcpy(stats->drops, ctx->drops, sizeof(stats->drops));
+  stats->peers = ctx->lru_count[0];
+  stats->handshakes = ctx->lru_count[1];
+}
+
 int
 dtls_connect_peer(dtls_context_t *ctx, dtls_peer_t *peer) {
+  session_t session;
   int res;
 
   assert(peer);
@@ -4006,9 +7662,14 @@ dtls_connect_peer(dtls_context_t *ctx, dtls_peer_t *peer) {
     return -1;
 
   /* check if the same peer is already in our list */
-  if (peer == dtls_get_peer(ctx, &peer->session)) {
+  if (peer == dtls_get_peer(ctx, dtls_peer_session(peer, &session))) {
     dtls_debug("found peer, try to re-connect\n");
-    return dtls_renegotiate(ctx, &peer->session);
+    return dtls_renegotiate(ctx, &session);
+  }
+
+  if (!DTLS_CLIENT_SUPPORT) {
+    dtls_warn("cannot connect, built without DTLS_CLIENT_SUPPORT\n");
+    return -1;
   }
     
   /* set local peer role to client, remote is server */
@@ -4020,7 +7681,7 @@ dtls_connect_peer(dtls_context_t *ctx, dtls_peer_t *peer) {
   }
 
   /* send ClientHello with empty Cookie */
-  peer->handshake_params = dtls_handshake_new();
+  peer->handshake_params = dtls_handshake_start(ctx);
       if (!peer->handshake_params)
         return -1;
 
@@ -4038,12 +7699,13 @@ dtls_connect_peer(dtls_context_t *ctx, dtls_peer_t *peer) {
 int
 dtls_connect(dtls_context_t *ctx, const session_t *dst) {
   dtls_peer_t *peer;
+  session_t session;
   int res;
 
   peer = dtls_get_peer(ctx, dst);
   
-  if (!peer)
-    peer = dtls_new_peer(dst);
+  if (!peer && DTLS_CLIENT_SUPPORT && dtls_make_room(ctx) == 0)
+    peer = dtls_new_peer(&ctx->pools, dst);
 
   if (!peer) {
     dtls_crit("cannot create new peer\n");
@@ -4051,13 +7713,16 @@ dtls_connect(dtls_context_t *ctx, const session_t *dst) {
   }
 
   res = dtls_connect_peer(ctx, peer);
+  dtls_flush(ctx);
 
   /* Invoke event callback to indicate connection attempt or
    * re-negotiation. */
   if (res > 0) {
-    CALL(ctx, event, &peer->session, 0, DTLS_EVENT_CONNECT);
+    CALL(ctx, event, dtls_peer_session(peer, &session), 0,
+	 DTLS_EVENT_CONNECT);
   } else if (res == 0) {
-    CALL(ctx, event, &peer->session, 0, DTLS_EVENT_RENEGOTIATE);
+    CALL(ctx, event, dtls_peer_session(peer, &session), 0,
+	 DTLS_EVENT_RENEGOTIATE);
   }
   
   return res;
@@ -4070,19 +7735,32 @@ dtls_retransmit(dtls_context_t *context, netq_t *node) {
 
   /* re-initialize timeout when maximum number of retransmissions are not reached yet */
   if (node->retransmit_cnt < DTLS_DEFAULT_MAX_RETRANSMIT) {
-      unsigned char sendbuf[DTLS_MAX_BUF];
-      size_t len = sizeof(sendbuf);
+      unsigned char *sendbuf;
+      session_t session;
+      size_t len;
       int err;
       unsigned char *data = node->data;
       size_t length = node->length;
+      clock_time_t timeout;
       dtls_tick_t now;
       dtls_security_parameters_t *security = dtls_security_params_epoch(node->peer, node->epoch);
 
       dtls_ticks(&now);
       node->retransmit_cnt++;
-      node->t = now + (node->timeout << node->retransmit_cnt);
-      netq_insert_node(&context->sendqueue, node);
+      timeout = node->timeout << node->retransmit_cnt;
+      if (timeout >> node->retransmit_cnt != node->timeout
+	  || timeout > context->retransmit_max)
+	timeout = context->retransmit_max;
+      node->t = now + timeout;
+      netq_wheel_insert(&context->sendqueue, node);
       
+#if DTLS_RETRANSMIT_SEALED
+      if (node->sealed) {
+	data += DTLS_RH_LENGTH;
+	length -= DTLS_RH_LENGTH;
+      }
+#endif /* DTLS_RETRANSMIT_SEALED */
+
       if (node->type == DTLS_CT_HANDSHAKE) {
 	dtls_handshake_header_t *hs_header = DTLS_HANDSHAKE_HEADER(data);
 
@@ -4092,17 +7770,43 @@ dtls_retransmit(dtls_context_t *context, netq_t *node) {
 	dtls_debug("** retransmit packet\n");
       }
       
+      /* records of the same flight that are due together are packed
+       * into one datagram again */
+      sendbuf = dtls_flight_buffer(context,
+				   dtls_peer_session(node->peer, &session),
+				   dtls_record_headroom(security) + length
+				   + dtls_record_tailroom(security),
+				   dtls_peer_pmtu(node->peer), &len);
+#if DTLS_RETRANSMIT_SEALED
+      if (node->sealed) {
+	if (len < node->length) {
+	  dtls_warn("can not retransmit packet, buffer too small\n");
+	  return;
+	}
+	memcpy(sendbuf, node->data, node->length);
+	dtls_set_record_seq(security, sendbuf);
+	dtls_debug_hexdump("retransmit record", sendbuf, node->length);
+	context->flight_len += node->length;
+	DTLS_STATS_ADD(context, records_out, 1);
+	DTLS_STATS_ADD(context, retransmissions, 1);
+	return;
+      }
+#endif /* DTLS_RETRANSMIT_SEALED */
+      dtls_trace(context, DTLS_TRACE_CCM, 0);
       err = dtls_prepare_record(node->peer, security, node->type, &data, &length,
 				1, sendbuf, &len);
+      dtls_trace(context, DTLS_TRACE_CCM, 1);
       if (err < 0) {
 	dtls_warn("can not retransmit packet, err: %i\n", err);
 	return;
       }
+      DTLS_STATS_ADD(context, records_out, 1);
+      DTLS_STATS_ADD(context, retransmissions, 1);
       dtls_debug_hexdump("retransmit header", sendbuf,
 			 sizeof(dtls_record_header_t));
       dtls_debug_hexdump("retransmit unencrypted", node->data, node->length);
 
-      (void)CALL(context, write, &node->peer->session, sendbuf, len);
+      context->flight_len += len;
       return;
   }
 
@@ -4114,36 +7818,98 @@ dtls_retransmit(dtls_context_t *context, netq_t *node) {
   netq_node_free(node);
 }
 
+/**
+ * Returns the timeout for the first transmission of a flight to @p
+ * peer, i.e. the retransmission timeout of RFC 6298, section 2.
+ */
+static clock_time_t
+dtls_retransmit_timeout(dtls_context_t *context, dtls_peer_t *peer) {
+  dtls_handshake_parameters_t *handshake = peer->handshake_params;
+  clock_time_t timeout = DTLS_RETRANSMIT_TIMEOUT;
+
+  if (handshake && handshake->srtt)
+    timeout = handshake->srtt + max(1, 4 * (clock_time_t)handshake->rttvar);
+
+  return max(context->retransmit_min, min(timeout, context->retransmit_max));
+}
+
+/**
+ * Updates the round-trip time estimate for @p peer when a response to
+ * the pending flight arrives. Like in RFC 6298, section 3, flights
+ * that have been retransmitted are not measured, as the response
+ * cannot be matched to one of the transmissions.
+ */
+static void
+dtls_update_rtt(dtls_peer_t *peer) {
+  dtls_handshake_parameters_t *handshake = peer->handshake_params;
+  netq_t *node;
+  clock_time_t rtt;
+  dtls_tick_t now;
+
+  if (!handshake || !peer->retransmit)
+    return;
+
+  for (node = peer->retransmit; node; node = node->peer_next) {
+    if (node->retransmit_cnt)
+      return;
+  }
+
+  dtls_ticks(&now);
+  node = peer->retransmit;
+  rtt = now - (node->t - node->timeout);
+  rtt = max(1, min(rtt, 0xffff));
+
+  if (!handshake->srtt) {
+    handshake->srtt = rtt;
+    handshake->rttvar = rtt / 2;
+  } else {
+    handshake->rttvar = (3 * handshake->rttvar
+			 + (handshake->srtt > rtt ? handshake->srtt - rtt
+			    : rtt - handshake->srtt)) / 4;
+    handshake->srtt = max(1, (7 * handshake->srtt + rtt) / 8);
+  }
+  dtls_debug("rtt %u, srtt %u, rttvar %u\n", (unsigned int)rtt,
+	     handshake->srtt, handshake->rttvar);
+}
+
 static void
 dtls_stop_retransmission(dtls_context_t *context, dtls_peer_t *peer) {
   netq_t *node;
-  node = netq_head(&context->sendqueue); 
 
+  while ((node = peer->retransmit)) {
+    netq_wheel_remove(&context->sendqueue, node);
+    netq_node_free(node);
+  }
+}
+
+/** Retransmits or drops the nodes that are due at @p now. */
+static void
+dtls_retransmit_expired(dtls_context_t *context, clock_time_t now) {
+  netq_t *node, *tmp;
+
+  /* records of the same flight are sent in their original order */
+  node = netq_wheel_expire(&context->sendqueue, now);
   while (node) {
-    if (dtls_session_equals(&node->peer->session, &peer->session)) {
-      netq_t *tmp = node;
-      node = netq_next(node);
-      netq_remove(&context->sendqueue, tmp);
-      netq_node_free(tmp);
-    } else
-      node = netq_next(node);    
+    tmp = node->next;
+    dtls_retransmit(context, node);
+    node = tmp;
   }
+  dtls_flush(context);
 }
 
 void
 dtls_check_retransmit(dtls_context_t *context, clock_time_t *next) {
   dtls_tick_t now;
-  netq_t *node = netq_head(&context->sendqueue);
+  clock_time_t expire;
 
   dtls_ticks(&now);
-  while (node && node->t <= now) {
-    netq_pop_first(&context->sendqueue);
-    dtls_retransmit(context, node);
-    node = netq_head(&context->sendqueue);
-  }
+  dtls_retransmit_expired(context, now);
+  expire = dtls_expire_peers(context, now);
 
   if (next) {
-    *next = node ? node->t : 0;
+    *next = netq_wheel_next(&context->sendqueue);
+    if (expire && (!*next || expire < *next))
+      *next = expire;
   }
 }
 
@@ -4153,8 +7919,7 @@ dtls_check_retransmit(dtls_context_t *context, clock_time_t *next) {
 /*---------------------------------------------------------------------------*/
 PROCESS_THREAD(dtls_retransmit_process, ev, data)
 {
-  clock_time_t now;
-  netq_t *node;
+  clock_time_t now, next, expire;
 
   PROCESS_BEGIN();
 
@@ -4165,19 +7930,18 @@ PROCESS_THREAD(dtls_retransmit_process, ev, data)
     if (ev == PROCESS_EVENT_TIMER) {
       if (etimer_expired(&the_dtls_context.retransmit_timer)) {
 	
-	node = netq_head(&the_dtls_context.sendqueue);
-	
 	now = clock_time();
-	if (node && node->t <= now) {
-	  netq_pop_first(&the_dtls_context.sendqueue);
-	  dtls_retransmit(&the_dtls_context, node);
-	  node = netq_head(&the_dtls_context.sendqueue);
-	}
+	/* send all records that are due in as few datagrams as possible */
+	dtls_retransmit_expired(&the_dtls_context, now);
+	expire = dtls_expire_peers(&the_dtls_context, now);
 
 	/* need to set timer to some value even if no nextpdu is available */
-	if (node) {
+	next = netq_wheel_next(&the_dtls_context.sendqueue);
+	if (expire && (!next || expire < next))
+	  next = expire;
+	if (next) {
 	  etimer_set(&the_dtls_context.retransmit_timer, 
-		     node->t <= now ? 1 : node->t - now);
+		     next <= now ? 1 : next - now);
 	} else {
 	  etimer_set(&the_dtls_context.retransmit_timer, 0xFFFF);
 	}
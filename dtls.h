@@ -28,8 +28,13 @@
 
 #include "tinydtls.h"
 
+#ifndef WITH_CONTIKI
+#include <sys/types.h>
+#endif /* WITH_CONTIKI */
+
 #include "state.h"
 #include "peer.h"
+#include "netq.h"
 
 #include "uthash.h"
 
@@ -60,8 +65,213 @@ typedef struct dtls_ecdsa_key_t {
 /** Length of the secret that is used for generating Hello Verify cookies. */
 #define DTLS_COOKIE_SECRET_LENGTH 12
 
+#ifndef DTLS_COOKIE_SECRET_LIFETIME
+/**
+ * Number of seconds after which a new secret for Hello Verify cookies
+ * is generated. Cookies created with the previous secret are still
+ * accepted, so a cookie is valid for at least this long.
+ */
+#define DTLS_COOKIE_SECRET_LIFETIME 60
+#endif /* DTLS_COOKIE_SECRET_LIFETIME */
+
 struct dtls_context_t;
 
+/**
+ * A datagram that is handed over in a batch, either received for
+ * dtls_handle_messages() or to be sent by the write_batch handler.
+ */
+typedef struct {
+  session_t session;		/**< the datagram's origin or destination */
+  uint8 *msg;			/**< the datagram's data */
+  int length;			/**< the actual length of @p msg */
+  int result;			/**< set to the result of the handling */
+} dtls_message_t;
+
+#ifndef DTLS_WRITE_BATCH_SIZE
+#ifdef WITH_CONTIKI
+#define DTLS_WRITE_BATCH_SIZE 0
+#else /* WITH_CONTIKI */
+/**
+ * Maximum number of outgoing datagrams that are queued for the
+ * write_batch handler. A value of @c 0 disables batched output.
+ */
+#define DTLS_WRITE_BATCH_SIZE 8
+#endif /* WITH_CONTIKI */
+#endif /* DTLS_WRITE_BATCH_SIZE */
+
+#ifndef DTLS_COOKIE_BATCH_SIZE
+#if defined(WITH_CONTIKI) || !DTLS_SERVER_SUPPORT
+#define DTLS_COOKIE_BATCH_SIZE 0
+#else /* WITH_CONTIKI || !DTLS_SERVER_SUPPORT */
+/**
+ * Maximum number of Client Hello cookies that dtls_handle_messages()
+ * computes side by side with multi-buffer SHA-256. A value of @c 0
+ * makes dtls_verify_peer() compute each cookie on its own.
+ */
+#define DTLS_COOKIE_BATCH_SIZE 8
+#endif /* WITH_CONTIKI || !DTLS_SERVER_SUPPORT */
+#endif /* DTLS_COOKIE_BATCH_SIZE */
+
+#ifndef DTLS_RECORD_BATCH_SIZE
+#ifdef WITH_CONTIKI
+#define DTLS_RECORD_BATCH_SIZE 0
+#else /* WITH_CONTIKI */
+/**
+ * Maximum number of records that dtls_write_messages() encrypts and
+ * dtls_handle_messages() decrypts together, see dtls_encrypt_multi().
+ * The records are sealed in the buffers of the write queue, so this
+ * must not exceed DTLS_WRITE_BATCH_SIZE. A value of @c 0 protects
+ * each record on its own.
+ */
+#define DTLS_RECORD_BATCH_SIZE DTLS_WRITE_BATCH_SIZE
+#endif /* WITH_CONTIKI */
+#endif /* DTLS_RECORD_BATCH_SIZE */
+
+#if DTLS_RECORD_BATCH_SIZE > DTLS_WRITE_BATCH_SIZE
+#error "DTLS_RECORD_BATCH_SIZE must not exceed DTLS_WRITE_BATCH_SIZE"
+#endif
+
+#ifndef DTLS_COOKIE_INPUT_MAX
+/**
+ * Maximum size of the address and Client Hello data covered by a
+ * cookie for the batched computation. Longer Client Hellos are
+ * handled by dtls_verify_peer() alone.
+ */
+#define DTLS_COOKIE_INPUT_MAX 384
+#endif /* DTLS_COOKIE_INPUT_MAX */
+
+#ifndef DTLS_ECC_POOL_SIZE
+#ifdef WITH_CONTIKI
+#define DTLS_ECC_POOL_SIZE 0
+#else /* WITH_CONTIKI */
+/**
+ * Number of ephemeral key pairs and ECDSA nonces that can be
+ * precomputed with dtls_ecc_precompute(). A value of @c 0 disables
+ * the precomputation.
+ */
+#define DTLS_ECC_POOL_SIZE 8
+#endif /* WITH_CONTIKI */
+#endif /* DTLS_ECC_POOL_SIZE */
+
+#ifndef DTLS_RETRANSMIT_TIMEOUT
+/**
+ * Initial retransmission timeout of a handshake flight, until the
+ * round-trip time to the peer has been measured.
+ */
+#define DTLS_RETRANSMIT_TIMEOUT (2 * CLOCK_SECOND)
+#endif /* DTLS_RETRANSMIT_TIMEOUT */
+
+#ifndef DTLS_RETRANSMIT_TIMEOUT_MIN
+/** Default lower bound of the retransmission timeout. */
+#define DTLS_RETRANSMIT_TIMEOUT_MIN (CLOCK_SECOND / 10)
+#endif /* DTLS_RETRANSMIT_TIMEOUT_MIN */
+
+#ifndef DTLS_RETRANSMIT_TIMEOUT_MAX
+/**
+ * Default upper bound of the retransmission timeout, including the
+ * exponential backoff (RFC 6347, section 4.2.4.1).
+ */
+#define DTLS_RETRANSMIT_TIMEOUT_MAX (60 * CLOCK_SECOND)
+#endif /* DTLS_RETRANSMIT_TIMEOUT_MAX */
+
+#ifndef DTLS_RETRANSMIT_SEALED
+/**
+ * When set to @c 1, records of a handshake flight that are not
+ * encrypted are queued for retransmission as they have been sent.
+ * A retransmission then only updates their sequence number instead
+ * of assembling and sealing them again. Encrypted records are always
+ * sealed again, as their nonce depends on the sequence number.
+ */
+#define DTLS_RETRANSMIT_SEALED 1
+#endif /* DTLS_RETRANSMIT_SEALED */
+
+#ifndef DTLS_SESSION_CACHE_SIZE
+#ifdef WITH_CONTIKI
+#define DTLS_SESSION_CACHE_SIZE 1
+#else /* WITH_CONTIKI */
+/**
+ * Number of sessions that are kept for abbreviated handshakes as
+ * described in RFC 5246, section 7.3. A server keeps the sessions it
+ * has established, a client the session of each server it has
+ * connected to. When the cache is full, the least recently used
+ * entry is replaced. A value of @c 0 disables session resumption.
+ */
+#define DTLS_SESSION_CACHE_SIZE 16
+#endif /* WITH_CONTIKI */
+#endif /* DTLS_SESSION_CACHE_SIZE */
+
+#ifndef DTLS_SESSION_LIFETIME
+/** Number of seconds after which a cached session is not resumed anymore. */
+#define DTLS_SESSION_LIFETIME (24 * 60 * 60)
+#endif /* DTLS_SESSION_LIFETIME */
+
+#ifndef DTLS_SESSION_TICKET_MAX_LENGTH
+/**
+ * Maximum length of a session ticket (RFC 5077) that a client stores
+ * in its session cache. Longer tickets are ignored. A value of @c 0
+ * disables session tickets for clients.
+ */
+#define DTLS_SESSION_TICKET_MAX_LENGTH 128
+#endif /* DTLS_SESSION_TICKET_MAX_LENGTH */
+
+#if DTLS_SESSION_CACHE_SIZE == 0
+/* clients keep their tickets in the session cache */
+#undef DTLS_SESSION_TICKET_MAX_LENGTH
+#define DTLS_SESSION_TICKET_MAX_LENGTH 0
+#endif /* DTLS_SESSION_CACHE_SIZE == 0 */
+
+#ifndef DTLS_SESSION_TICKET_KEYS
+#ifdef WITH_CONTIKI
+#define DTLS_SESSION_TICKET_KEYS 0
+#else /* WITH_CONTIKI */
+/**
+ * Number of keys a server keeps to decrypt session tickets, see
+ * dtls_set_ticket_key(). When a new key is installed, the oldest one
+ * is dropped. A value of @c 0 disables issuing session tickets.
+ */
+#define DTLS_SESSION_TICKET_KEYS 2
+#endif /* WITH_CONTIKI */
+#endif /* DTLS_SESSION_TICKET_KEYS */
+
+/** Length of the keys that protect session tickets. */
+#define DTLS_TICKET_KEY_LENGTH 16
+
+/** Length of the key name at the start of the tickets we issue. */
+#define DTLS_TICKET_KEY_NAME_LENGTH 4
+
+/** A session that can be resumed with an abbreviated handshake. */
+typedef struct {
+  session_t session;		/**< the server's address, only used by clients */
+  dtls_peer_type role;		/**< our role in the session */
+  uint8 id_length;		/**< length of @c id */
+  uint8 id[DTLS_SESSION_ID_LENGTH]; /**< the session id assigned by the server */
+  dtls_cipher_t cipher;		/**< the cipher suite, TLS_NULL_WITH_NULL_NULL if unused */
+  uint8 master_secret[DTLS_MASTER_SECRET_LENGTH];
+  dtls_tick_t created;		/**< the time of the full handshake */
+  dtls_tick_t last_used;	/**< the time of the last lookup */
+#if DTLS_SESSION_TICKET_MAX_LENGTH > 0
+  uint16_t ticket_length;	/**< length of @c ticket, @c 0 if none */
+  uint8 ticket[DTLS_SESSION_TICKET_MAX_LENGTH]; /**< the ticket for a client */
+#endif /* DTLS_SESSION_TICKET_MAX_LENGTH > 0 */
+} dtls_session_cache_entry_t;
+
+/** A key that protects the session tickets issued by a server. */
+typedef struct {
+  uint8 name[DTLS_TICKET_KEY_NAME_LENGTH]; /**< identifies the key in tickets */
+  aes128_ccm_t ccm;		/**< the expanded key */
+  dtls_tick_t created;		/**< the time the key was installed */
+} dtls_ticket_key_t;
+
+/**
+ * Operations that are reported to the trace handler of
+ * dtls_handler_t.
+ */
+typedef enum {
+  DTLS_TRACE_ECC = 0,	/**< an ECDH or ECDSA operation of a handshake */
+  DTLS_TRACE_CCM,	/**< sealing or opening one or more records */
+  DTLS_TRACE_PRF	/**< a key derivation or Finished computation */
+} dtls_trace_point_t;
+
 /**
  * This structure contains callback functions used by tinydtls to
  * communicate with the application. At least the write function must
@@ -92,7 +302,9 @@ typedef struct {
   /** 
    * Called from dtls_handle_message() deliver application data that was 
    * received on the given session. The data is delivered only after
-   * decryption and verification have succeeded. 
+   * decryption and verification have succeeded. Records are decrypted
+   * in place, so @p buf points into the datagram that was passed to
+   * dtls_handle_message() and is valid only during this call.
    *
    * @param ctx  The current DTLS context.
    * @param session The session object, including the address of the
@@ -207,27 +419,225 @@ typedef struct {
 			  const unsigned char *other_pub_y,
 			  size_t key_size);
 #endif /* DTLS_ECC */
+
+  /**
+   * Optional handler to send several datagrams at once, e.g. with
+   * sendmmsg(). When set, the records that are generated while
+   * tinydtls handles one call to dtls_handle_message(),
+   * dtls_handle_messages(), dtls_connect(), dtls_write() or
+   * dtls_check_retransmit() are collected and passed to this
+   * function at the end of that call instead of invoking @c write
+   * for each of them. The queue is also flushed when it is full (see
+   * DTLS_WRITE_BATCH_SIZE) or when dtls_flush() is called.
+   *
+   * The callback should set the @c result field of each datagram to
+   * the number of bytes sent or a value less than zero on error.
+   * Errors are treated like lost datagrams.
+   *
+   * @param ctx   The current DTLS context.
+   * @param msgs  The datagrams to send, in the order they were
+   *              generated.
+   * @param count The number of elements in @p msgs.
+   * @return The number of datagrams that have been sent, or a value
+   *         less than zero on error.
+   */
+  int (*write_batch)(struct dtls_context_t *ctx,
+		     dtls_message_t *msgs, size_t count);
+
+#ifdef DTLS_ECC
+  /**
+   * Optional handler to compute the ECDSA signatures, signature
+   * verifications and ECDH operations of handshakes outside of
+   * dtls_handle_message(), e.g. in a thread pool or on a crypto
+   * accelerator. The job can be executed with dtls_ecc_job_run() in
+   * any thread. The handshake of the peer that is identified by
+   * @p job->session is suspended until the job is passed back with
+   * dtls_ecc_job_complete(). Records that arrive for this peer in the
+   * meantime are queued, other peers are not affected.
+   *
+   * When this handler is not set or returns a value less than zero,
+   * the job is executed immediately, as if there was no handler.
+   *
+   * @param ctx The current DTLS context.
+   * @param job The job to execute. It must not be modified except for
+   *            its results.
+   * @return @c 0 if the job has been accepted, a value less than
+   *         zero otherwise.
+   */
+  int (*ecc_job)(struct dtls_context_t *ctx, dtls_ecc_job_t *job);
+#endif /* DTLS_ECC */
+
+  /**
+   * Optional handler that is called before and after the expensive
+   * operations of tinydtls, e.g. to measure their duration or to
+   * emit tracepoints. ECC jobs that are passed to the @c ecc_job
+   * handler are not reported. The calls are removed when tinydtls
+   * is built with DTLS_TRACE set to @c 0.
+   *
+   * @param ctx   The current DTLS context.
+   * @param point The operation.
+   * @param end   @c 0 before and @c 1 after the operation.
+   */
+  void (*trace)(struct dtls_context_t *ctx, dtls_trace_point_t point,
+		int end);
 } dtls_handler_t;
 
 struct netq_t;
 
+/**
+ * Reasons why a received record is dropped before it is decrypted,
+ * see dtls_get_drops().
+ */
+typedef enum {
+  DTLS_DROP_MALFORMED = 0,	/**< bad version, content type or length field */
+  DTLS_DROP_CID,		/**< unknown connection ID */
+  DTLS_DROP_EPOCH,		/**< no security parameters for the epoch */
+  DTLS_DROP_LENGTH,		/**< too short or too long for the cipher */
+  DTLS_DROP_CONTENTTYPE,	/**< unprotected record that must be protected */
+  DTLS_DROP_REPLAY,		/**< duplicate or outside the replay window */
+  DTLS_DROP_REASONS		/**< number of reasons */
+} dtls_drop_reason_t;
+
+#ifndef DTLS_STATS_HANDSHAKE_BUCKETS
+/** Number of buckets of the handshake duration histogram. */
+#define DTLS_STATS_HANDSHAKE_BUCKETS 12
+#endif /* DTLS_STATS_HANDSHAKE_BUCKETS */
+
+/** The key exchanges that handshakes are counted by in dtls_stats_t. */
+typedef enum {
+  DTLS_STATS_SUITE_NONE = 0,	/**< no cipher suite negotiated yet */
+  DTLS_STATS_SUITE_PSK,		/**< TLS_PSK_WITH_AES_128_CCM_8 or _GCM_SHA256 */
+  DTLS_STATS_SUITE_ECDHE_ECDSA,	/**< TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8 or _GCM_SHA256 */
+  DTLS_STATS_SUITES		/**< number of entries */
+} dtls_stats_suite_t;
+
+/**
+ * The counters of a context, see dtls_get_stats(). They are updated
+ * without synchronization, as a context is only used by one thread
+ * at a time. All counters but @c peers and @c handshakes only grow.
+ */
+typedef struct {
+  unsigned long records_in;	/**< records accepted from known peers */
+  unsigned long records_out;	/**< records sent, with retransmissions */
+  unsigned long bytes_in;	/**< bytes of all received datagrams */
+  unsigned long bytes_out;	/**< bytes of all sent datagrams */
+  unsigned long decrypt_failures; /**< records that failed authentication */
+  /** records dropped before decryption, see dtls_get_drops() */
+  unsigned long drops[DTLS_DROP_REASONS];
+  unsigned long cookies_issued;	/**< HelloVerifyRequests sent */
+  unsigned long cookies_verified; /**< Client Hellos with a valid cookie */
+  unsigned long handshakes_started; /**< including renegotiations */
+  /** handshakes that have finished, by key exchange */
+  unsigned long handshakes_completed[DTLS_STATS_SUITES];
+  /** handshakes that have been aborted, by key exchange */
+  unsigned long handshakes_failed[DTLS_STATS_SUITES];
+  /** completed handshakes that have resumed a session */
+  unsigned long handshakes_resumed;
+  unsigned long retransmissions; /**< records sent again after a timeout */
+  /**
+   * Completed handshakes by duration. Bucket @c 0 counts handshakes
+   * of less than 1 ms, bucket @c i those of at least 2^(i-1) and
+   * less than 2^i ms. The last bucket also counts all longer ones.
+   */
+  unsigned long handshake_ms[DTLS_STATS_HANDSHAKE_BUCKETS];
+  size_t peers;			/**< connected peers */
+  size_t handshakes;		/**< peers in a handshake */
+} dtls_stats_t;
+
 /** Holds global information of the DTLS engine. */
 typedef struct dtls_context_t {
-  unsigned char cookie_secret[DTLS_COOKIE_SECRET_LENGTH];
+  /**
+   * HMAC states for Hello Verify cookies, keyed with the current and
+   * the previous cookie secret, see DTLS_COOKIE_SECRET_LIFETIME.
+   */
+  dtls_hmac_context_t cookie_hmac[2];
   clock_time_t cookie_secret_age; /**< the time the secret has been generated */
-
-  dtls_peer_t *peers;		/**< peer hash map */
+#if DTLS_COOKIE_BATCH_SIZE > 0
+  /** cookies computed in advance by dtls_handle_messages() */
+  const struct dtls_cookie_batch_t *cookies;
+#endif /* DTLS_COOKIE_BATCH_SIZE > 0 */
+#if DTLS_RECORD_BATCH_SIZE > 0
+  /** records decrypted in advance by dtls_handle_messages() */
+  const struct dtls_record_batch_t *records;
+#endif /* DTLS_RECORD_BATCH_SIZE > 0 */
+
+#ifdef DTLS_PEERS_NOHASH
+  dtls_peer_t *peers;		/**< peer list */
+#else /* DTLS_PEERS_NOHASH */
+  dtls_peer_table_t peers;	/**< peer hash table */
+#if DTLS_CID_LENGTH > 0
+  dtls_peer_table_t cid_peers;	/**< peers by their connection ID */
+#endif /* DTLS_CID_LENGTH > 0 */
+#endif /* DTLS_PEERS_NOHASH */
+#if DTLS_CID_LENGTH > 0
+  int cid_prefix;		/**< first byte of assigned CIDs, or -1 */
+#endif /* DTLS_CID_LENGTH > 0 */
 #ifdef WITH_CONTIKI
   struct etimer retransmit_timer; /**< fires when the next packet must be sent */
 #endif /* WITH_CONTIKI */
 
-  struct netq_t *sendqueue;     /**< the packets to send */
+  /** connected peers and peers in a handshake, most recently active first */
+  dtls_peer_t *lru[2];
+  size_t lru_count[2];		/**< number of peers in each list */
+  size_t peer_max;		/**< maximum number of peers */
+  size_t handshake_max;		/**< maximum number of handshakes */
+  unsigned int peer_gen;	/**< changed when a peer is added, moved or removed */
+  clock_time_t idle_timeout;	/**< peers without records are removed, 0 for never */
+
+  netq_wheel_t sendqueue;	/**< the packets to retransmit */
+  clock_time_t retransmit_min;	/**< lower bound of the retransmission timeout */
+  clock_time_t retransmit_max;	/**< upper bound of the retransmission timeout */
 
   void *app;			/**< application-specific data */
 
   dtls_handler_t *h;		/**< callback handlers */
 
-  unsigned char readbuf[DTLS_MAX_BUF];
+  /** the number of records dropped before decryption, by reason */
+  unsigned long drops[DTLS_DROP_REASONS];
+#if DTLS_STATS
+  dtls_stats_t stats;		/**< counters, see dtls_get_stats() */
+#endif /* DTLS_STATS */
+
+  /** the primitives used for new handshakes and their keys */
+  dtls_crypto_provider_t crypto;
+
+  dtls_pools_t pools;		/**< storage for peers and their state */
+
+  /** handshake records for one peer that are sent as one datagram */
+  unsigned char flightbuf[DTLS_MAX_BUF];
+  size_t flight_len;		/**< number of bytes in the datagram */
+  session_t flight_session;	/**< the datagram's destination */
+
+#if DTLS_WRITE_BATCH_SIZE > 0
+  /** datagrams queued for the write_batch handler */
+  dtls_message_t writeq[DTLS_WRITE_BATCH_SIZE];
+  size_t writeq_len;		/**< number of queued datagrams */
+  unsigned char writebuf[DTLS_WRITE_BATCH_SIZE][DTLS_MAX_BUF];
+#endif /* DTLS_WRITE_BATCH_SIZE > 0 */
+
+#if defined(DTLS_ECC) && DTLS_ECC_POOL_SIZE > 0
+  /** precomputed ephemeral keys, see dtls_ecc_precompute() */
+  dtls_ecdh_key_pair_t ecc_keys[DTLS_ECC_POOL_SIZE];
+  size_t ecc_keys_len;		/**< number of available key pairs */
+  /** precomputed nonces for signatures */
+  dtls_ecdsa_nonce_t ecc_nonces[DTLS_ECC_POOL_SIZE];
+  size_t ecc_nonces_len;	/**< number of available nonces */
+#ifndef WITH_CONTIKI
+  pid_t ecc_pid;		/**< the process that has filled the pools */
+#endif /* WITH_CONTIKI */
+#endif /* DTLS_ECC && DTLS_ECC_POOL_SIZE > 0 */
+
+#if DTLS_SESSION_CACHE_SIZE > 0
+  /** sessions for abbreviated handshakes */
+  dtls_session_cache_entry_t sessions[DTLS_SESSION_CACHE_SIZE];
+#endif /* DTLS_SESSION_CACHE_SIZE > 0 */
+
+#if DTLS_SESSION_TICKET_KEYS > 0
+  /** keys for session tickets, the newest first */
+  dtls_ticket_key_t ticket_keys[DTLS_SESSION_TICKET_KEYS];
+  size_t ticket_keys_len;	/**< number of installed keys */
+  int ticket_key_rotate;	/**< replace generated keys periodically */
+#endif /* DTLS_SESSION_TICKET_KEYS > 0 */
 } dtls_context_t;
 
 /** 
@@ -238,7 +648,9 @@ void dtls_init(void);
 
 /** 
  * Creates a new context object. The storage allocated for the new
- * object must be released with dtls_free_context(). */
+ * object must be released with dtls_free_context(). Except on
+ * Contiki, the context and everything it allocates is taken from the
+ * allocator that is set with dtls_set_allocator() at this time. */
 dtls_context_t *dtls_new_context(void *app_data);
 
 /** Releases any storage that has been allocated for \p ctx. */
@@ -247,11 +659,150 @@ void dtls_free_context(dtls_context_t *ctx);
 #define dtls_set_app_data(CTX,DATA) ((CTX)->app = (DATA))
 #define dtls_get_app_data(CTX) ((CTX)->app)
 
+/**
+ * Returns the number of records from known peers, or datagram
+ * remainders, that @p CTX has dropped for the dtls_drop_reason_t
+ * @p REASON without decrypting them.
+ */
+#define dtls_get_drops(CTX,REASON) ((CTX)->drops[REASON])
+
+/**
+ * Copies the counters of @p ctx to @p stats. When tinydtls is built
+ * with DTLS_STATS set to @c 0, only @c drops, @c peers and
+ * @c handshakes are filled in, all other counters are @c 0.
+ *
+ * @param ctx   The DTLS context.
+ * @param stats Receives the counters.
+ */
+void dtls_get_stats(const dtls_context_t *ctx, dtls_stats_t *stats);
+
 /** Sets the callback handler object for @p ctx to @p h. */
 static inline void dtls_set_handler(dtls_context_t *ctx, dtls_handler_t *h) {
   ctx->h = h;
 }
 
+/**
+ * Sets the cryptographic primitives that @p ctx uses for handshakes
+ * and records. Members of @p crypto that are @c NULL are taken from
+ * dtls_crypto_software, so a provider can replace only the
+ * operations that an accelerator supports. Passing @c NULL restores
+ * the software implementation. Handshakes and records use the
+ * provider of @p ctx directly, so it can only be changed while
+ * @p ctx has no peers. ECC jobs carry their own copy.
+ *
+ * @param ctx    The DTLS context to configure.
+ * @param crypto The provider to use or @c NULL.
+ * @return @c 0 on success, @c -1 if @p ctx has peers.
+ */
+int dtls_set_crypto_provider(dtls_context_t *ctx,
+			     const dtls_crypto_provider_t *crypto);
+
+/**
+ * Changes the maximum number of peers of @p ctx from DTLS_PEER_MAX to
+ * @p max. The peer table is allocated once for this size, so that it
+ * never has to be resized. This can only be done while @p ctx has no
+ * peers. When a new peer would exceed @p max, the least recently
+ * active peer is removed, see dtls_set_handshake_max().
+ *
+ * @param ctx The DTLS context to configure.
+ * @param max The maximum number of peers, at least @c 1.
+ * @return @c 0 on success, a value less than zero on error.
+ */
+int dtls_set_peer_max(dtls_context_t *ctx, size_t max);
+
+/**
+ * Limits the number of peers of @p ctx that have not completed their
+ * handshake to @p max, replacing DTLS_HANDSHAKE_MAX. When a new
+ * handshake would exceed this limit, or the number of peers would
+ * exceed the maximum of dtls_set_peer_max(), the least recently
+ * active peer in a handshake is removed. Connected peers are only
+ * removed when no handshake is left, so a flood of new handshakes
+ * sheds handshake state before established sessions.
+ *
+ * @param ctx The DTLS context to configure.
+ * @param max The maximum number of handshakes, at least @c 1.
+ * @return @c 0 on success, a value less than zero on error.
+ */
+int dtls_set_handshake_max(dtls_context_t *ctx, size_t max);
+
+/**
+ * Removes peers of @p ctx that have not sent a record for @p seconds,
+ * replacing DTLS_PEER_IDLE_TIMEOUT. Idle peers are removed by
+ * dtls_check_retransmit(), at most DTLS_PEER_EXPIRE_BATCH per call.
+ * Connected peers are sent a close_notify alert. A value of @c 0 keeps
+ * idle peers until they are closed.
+ *
+ * @param ctx     The DTLS context to configure.
+ * @param seconds The idle timeout in seconds.
+ */
+void dtls_set_idle_timeout(dtls_context_t *ctx, unsigned int seconds);
+
+/**
+ * Makes @p prefix the first byte of all connection IDs that @p ctx
+ * assigns to its peers, the other bytes stay random. This lets a
+ * receiver that serves several contexts on one port find the context
+ * of a record with connection ID, see dtls_engine.h. A value of
+ * @c -1 makes the whole connection ID random again, which is the
+ * default.
+ *
+ * @param ctx    The DTLS context to configure.
+ * @param prefix The first byte of new connection IDs, or @c -1.
+ * @return @c 0 on success, a value less than zero if @p prefix is
+ *   out of range or tinydtls is built without connection IDs.
+ */
+int dtls_set_cid_prefix(dtls_context_t *ctx, int prefix);
+
+/**
+ * Preallocates the storage of @p ctx for @p peers peers and @p
+ * handshakes concurrent handshakes, replacing DTLS_POOL_PEERS and
+ * DTLS_POOL_HANDSHAKES. New peers and handshakes fail when the
+ * storage is exhausted. A value of @c 0 makes the respective storage
+ * come from malloc() on demand. This can only be done while no
+ * storage of the current pools is in use.
+ *
+ * @param ctx        The DTLS context to configure.
+ * @param peers      The maximum number of peers.
+ * @param handshakes The maximum number of concurrent handshakes.
+ * @return @c 0 on success, a value less than zero on error or on
+ *         Contiki, where MEMB storage is used.
+ */
+int dtls_set_pool_size(dtls_context_t *ctx, size_t peers, size_t handshakes);
+
+/**
+ * Sets the bounds of the retransmission timeout of handshake flights
+ * for @p ctx, replacing DTLS_RETRANSMIT_TIMEOUT_MIN and
+ * DTLS_RETRANSMIT_TIMEOUT_MAX. The timeout of each handshake is
+ * derived from the round-trip times that are measured between a
+ * flight and the peer's response, as described in RFC 6298. Until
+ * the first measurement, DTLS_RETRANSMIT_TIMEOUT is used. The
+ * timeout doubles with each retransmission of a flight, up to @p max.
+ *
+ * @param ctx The DTLS context to configure.
+ * @param min The lower bound in clock ticks, at least @c 1.
+ * @param max The upper bound in clock ticks, at least @p min.
+ * @return @c 0 on success, a value less than zero on error.
+ */
+int dtls_set_retransmit_timeout(dtls_context_t *ctx, clock_time_t min,
+				clock_time_t max);
+
+/**
+ * Installs a new key to protect the session tickets (RFC 5077) that
+ * are issued by @p ctx, allowing clients to resume their sessions
+ * without any state on the server. Tickets are issued once a key has
+ * been set. Tickets issued under the previous keys remain valid
+ * until DTLS_SESSION_TICKET_KEYS newer keys have been installed.
+ *
+ * Servers that share their tickets must use the same @p key. When
+ * @p key is @c NULL, a random key is generated and replaced every
+ * DTLS_SESSION_LIFETIME seconds.
+ *
+ * @param ctx The DTLS context to configure.
+ * @param key The key of DTLS_TICKET_KEY_LENGTH bytes or @c NULL.
+ * @return @c 0 on success, a value less than zero if session tickets
+ *         are not supported.
+ */
+int dtls_set_ticket_key(dtls_context_t *ctx, const unsigned char *key);
+
 /**
  * Establishes a DTLS channel with the specified remote peer @p dst.
  * This function returns @c 0 if that channel already exists, a value
@@ -261,6 +812,8 @@ static inline void dtls_set_handler(dtls_context_t *ctx, dtls_handler_t *h) {
  * @param ctx    The DTLS context to use.
  * @param dst    The remote party to connect to.
  * @return A value less than zero on error, greater or equal otherwise.
+ *         New channels cannot be established when the library has
+ *         been built with DTLS_CLIENT_SUPPORT set to @c 0.
  */
 int dtls_connect(dtls_context_t *ctx, const session_t *dst);
 
@@ -298,14 +851,117 @@ int dtls_renegotiate(dtls_context_t *ctx, const session_t *dst);
 int dtls_write(struct dtls_context_t *ctx, session_t *session, 
 	       uint8 *buf, size_t len);
 
+/**
+ * Writes the application data of @p count messages, each the
+ * @c length bytes at @c msg to the peer specified by @c session. The
+ * records for connected peers are encrypted together, so that the AES
+ * operations for different peers overlap, see dtls_encrypt_multi().
+ * The outcome of dtls_write() for each message is stored in its
+ * @c result field.
+ *
+ * @param ctx    The DTLS context to use.
+ * @param msgs   The messages to send.
+ * @param count  The number of elements in @p msgs.
+ * @return The number of messages that could not be sent because of
+ *         an error, i.e. @c 0 on success.
+ */
+int dtls_write_messages(dtls_context_t *ctx, dtls_message_t *msgs,
+			size_t count);
+
+/**
+ * Writes the same application data to each of the @p count peers in
+ * @p peers. Unlike dtls_write_messages(), the peers are not looked up
+ * and no handshakes are started, peers that are not connected are
+ * skipped. The records are built and encrypted
+ * DTLS_RECORD_BATCH_SIZE at a time and handed to the write_batch
+ * handler if there is one.
+ *
+ * @param ctx    The DTLS context to use.
+ * @param peers  The peers to send the data to.
+ * @param count  The number of elements in @p peers.
+ * @param buf    The data to write.
+ * @param len    The actual length of @p buf.
+ * @return The number of peers that the data could not be sent to
+ *         because of an error, i.e. @c 0 on success.
+ */
+int dtls_write_peers(dtls_context_t *ctx, dtls_peer_t *peers[],
+		     size_t count, uint8 *buf, size_t len);
+
+/**
+ * Writes the same application data to every connected peer of @p ctx
+ * for which @p select returns a value other than zero, or to all
+ * connected peers if @p select is NULL, see dtls_write_peers(). The
+ * peers are visited with the most recently active first. Neither
+ * @p select nor the write handlers must remove peers from @p ctx.
+ *
+ * @param ctx    The DTLS context to use.
+ * @param select Called with @p arg for each connected peer, or NULL.
+ * @param arg    Passed to @p select.
+ * @param buf    The data to write.
+ * @param len    The actual length of @p buf.
+ * @return The number of selected peers that the data could not be
+ *         sent to because of an error, i.e. @c 0 on success.
+ */
+int dtls_write_broadcast(dtls_context_t *ctx,
+			 int (*select)(dtls_context_t *ctx,
+				       const dtls_peer_t *peer, void *arg),
+			 void *arg, uint8 *buf, size_t len);
+
+/** Bytes to reserve in front of the payload for dtls_write_inplace(). */
+#define DTLS_RECORD_HEADROOM (sizeof(dtls_record_header_t) + 8)
+
+/**
+ * Bytes to reserve after the payload for dtls_write_inplace(), i.e.
+ * the MAC of AES-CCM-8 or the tag of AES-GCM and ChaCha20-Poly1305.
+ */
+#if DTLS_GCM || DTLS_CHACHA20
+#define DTLS_RECORD_TAILROOM 16
+#else /* DTLS_GCM || DTLS_CHACHA20 */
+#define DTLS_RECORD_TAILROOM 8
+#endif /* DTLS_GCM || DTLS_CHACHA20 */
+
+/**
+ * Additional bytes that the buffer of dtls_write_inplace() must
+ * provide for peers that have asked for a connection ID in our
+ * records.
+ */
+#define DTLS_RECORD_CID_ROOM (DTLS_CID_MAX_LENGTH + 1)
+
+/**
+ * Writes application data to the peer specified by @p session like
+ * dtls_write() but without copying it. The @p len bytes of data must
+ * start at @p buf + DTLS_RECORD_HEADROOM, and @p buf must hold at
+ * least DTLS_RECORD_TAILROOM more bytes after the data. Records with
+ * connection ID need up to DTLS_RECORD_CID_ROOM more bytes in @p buf,
+ * the data is moved accordingly. The record header is written to the
+ * headroom, the data is encrypted in place and @p buf itself is
+ * passed to the write callback. The contents of @p buf are undefined
+ * when this function returns.
+ *
+ * @param ctx      The DTLS context to use.
+ * @param session  The remote transport address and local interface.
+ * @param buf      The buffer holding headroom, data and tailroom.
+ * @param size     The total size of @p buf.
+ * @param len      The actual length of the data in @p buf.
+ *
+ * @return The number of bytes written or less than zero on error.
+ */
+int dtls_write_inplace(struct dtls_context_t *ctx, session_t *session,
+		       uint8 *buf, size_t size, size_t len);
+
 /**
  * Checks sendqueue of given DTLS context object for any outstanding
- * packets to be transmitted. 
+ * packets to be transmitted, and removes peers that have been idle
+ * for the time set with dtls_set_idle_timeout().
  *
  * @param context The DTLS context object to use.
  * @param next    If not NULL, @p next is filled with the timestamp
  *  of the next scheduled retransmission, or @c 0 when no packets are
- *  waiting.
+ *  waiting. When all retransmissions are farther ahead than one
+ *  revolution of the timer wheel (NETQ_WHEEL_SIZE * NETQ_WHEEL_TICK),
+ *  this is the end of that revolution instead. When peers are removed
+ *  after an idle timeout, @p next is not later than the time when the
+ *  next peer becomes idle.
  */
 void dtls_check_retransmit(dtls_context_t *context, clock_time_t *next);
 
@@ -315,6 +971,7 @@ void dtls_check_retransmit(dtls_context_t *context, clock_time_t *next);
 #define DTLS_CT_ALERT              21
 #define DTLS_CT_HANDSHAKE          22
 #define DTLS_CT_APPLICATION_DATA   23
+#define DTLS_CT_TLS12_CID          25 /**< record with connection ID, RFC 9146 */
 
 /** Generic header structure of the DTLS record layer. */
 typedef struct __attribute__((__packed__)) {
@@ -332,6 +989,7 @@ typedef struct __attribute__((__packed__)) {
 #define DTLS_HT_CLIENT_HELLO         1
 #define DTLS_HT_SERVER_HELLO         2
 #define DTLS_HT_HELLO_VERIFY_REQUEST 3
+#define DTLS_HT_NEW_SESSION_TICKET   4
 #define DTLS_HT_CERTIFICATE         11
 #define DTLS_HT_SERVER_KEY_EXCHANGE 12
 #define DTLS_HT_CERTIFICATE_REQUEST 13
@@ -392,6 +1050,74 @@ int dtls_record_read(dtls_state_t *state, uint8 *msg, int msglen);
 int dtls_handle_message(dtls_context_t *ctx, session_t *session,
 			uint8 *msg, int msglen);
 
+#ifndef DTLS_MESSAGE_BATCH_SIZE
+/** Number of datagrams dtls_handle_messages() groups by peer at once. */
+#define DTLS_MESSAGE_BATCH_SIZE 64
+#endif
+
+/**
+ * Handles a burst of received datagrams, e.g. as returned by
+ * recvmmsg(). Datagrams from the same peer are processed together in
+ * the order in which they were received, so that the peer is looked
+ * up only once per burst. The first records of datagrams from
+ * connected peers are decrypted together before, see
+ * DTLS_RECORD_BATCH_SIZE. The outcome of dtls_handle_message() for
+ * each datagram is stored in its @c result field.
+ *
+ * @param ctx    The dtls context to use.
+ * @param msgs   The received datagrams.
+ * @param count  The number of elements in @p msgs.
+ * @return The number of datagrams that could not be handled, i.e.
+ *         @c 0 if all datagrams were processed successfully.
+ */
+int dtls_handle_messages(dtls_context_t *ctx, dtls_message_t *msgs,
+			 size_t count);
+
+/**
+ * Passes all datagrams that have been queued for the write_batch
+ * handler of @p ctx to the application. This is done implicitly at
+ * the end of each API call that generates records, so applications
+ * only need to call this function to force out pending data earlier.
+ *
+ * @param ctx The dtls context to use.
+ */
+void dtls_flush(dtls_context_t *ctx);
+
+#ifdef DTLS_ECC
+/**
+ * Precomputes ephemeral ECDH key pairs and ECDSA signature nonces
+ * for the following handshakes of @p ctx, e.g. while the application
+ * is idle. A handshake takes its ephemeral key and the nonce for its
+ * signature from this pool while available and computes them on
+ * demand otherwise. Nonces are only used with the software ECDSA
+ * implementation of dtls_crypto_software. The pool is discarded in
+ * the child after fork(), so that parent and child never use the
+ * same nonce.
+ *
+ * @param ctx The DTLS context.
+ * @param max The maximum number of entries to compute in this call,
+ *            each one costs about one point multiplication.
+ * @return The number of entries that are still missing to fill the
+ *         pool of DTLS_ECC_POOL_SIZE entries each.
+ */
+int dtls_ecc_precompute(dtls_context_t *ctx, int max);
+
+/**
+ * Continues the handshake that waits for @p job after it has been
+ * executed with dtls_ecc_job_run(). This function must be called for
+ * every job that the ecc_job handler has accepted, from the thread
+ * that uses @p ctx and not from within the handler itself. The job is
+ * released afterwards. If the handshake has been aborted in the
+ * meantime, the job is only released.
+ *
+ * @param ctx The dtls context the job was passed for.
+ * @param job The executed job.
+ * @return A value less than zero if the handshake failed, @c 0
+ *         otherwise.
+ */
+int dtls_ecc_job_complete(dtls_context_t *ctx, dtls_ecc_job_t *job);
+#endif /* DTLS_ECC */
+
 /**
  * Check if @p session is associated with a peer object in @p context.
  * This function returns a pointer to the peer if found, NULL otherwise.
@@ -412,6 +1138,22 @@ dtls_peer_t *dtls_get_peer(const dtls_context_t *context,
  */
 void dtls_reset_peer(dtls_context_t *context, dtls_peer_t *peer);
 
+/**
+ * Sets the path MTU for the connection with @p session. Datagrams
+ * sent to this peer will not exceed @p pmtu bytes, larger handshake
+ * messages are fragmented. New peers start with DTLS_DEFAULT_PMTU.
+ *
+ * @param context  The active DTLS context.
+ * @param session  The remote address and local interface.
+ * @param pmtu     The maximum datagram size, at most DTLS_MAX_BUF and
+ *                 more than DTLS_RECORD_HEADROOM, DTLS_RECORD_CID_ROOM,
+ *                 DTLS_RECORD_TAILROOM and a handshake header.
+ * @return @c 0 on success, or a value less than zero if there is no
+ *         peer for @p session or @p pmtu is out of range.
+ */
+int dtls_set_pmtu(dtls_context_t *context, const session_t *session,
+		  size_t pmtu);
+
 #endif /* _DTLS_DTLS_H_ */
 
 /**
@@ -431,8 +1173,8 @@ void dtls_reset_peer(dtls_context_t *context, dtls_peer_t *peer);
  * 
  * @subsection uthash UTHash
  *
- * This library uses <a href="http://uthash.sourceforge.net/">uthash</a> to manage
- * its peers (not used for Contiki). @b uthash uses the <b>BSD revised license</b>, see
+ * This library ships <a href="http://uthash.sourceforge.net/">uthash</a> for
+ * applications that use it. @b uthash uses the <b>BSD revised license</b>, see
  * <a href="http://uthash.sourceforge.net/license.html">http://uthash.sourceforge.net/license.html</a>.
  *
  * @subsection sha256 Aaron D. Gifford's SHA256 Implementation
@@ -39,7 +39,7 @@
 #define min(a,b) ((a) < (b) ? (a) : (b))
 #endif
 
-static int maxlog = DTLS_LOG_WARN;	/* default maximum log level */
+int dtls_log_level = DTLS_LOG_WARN;	/* default maximum log level */
 
 const char *dtls_package_name() {
   return PACKAGE_NAME;
@@ -51,16 +51,12 @@ const char *dtls_package_version() {
 
 log_t 
 dtls_get_log_level() {
-  return maxlog;
+  return dtls_log_level;
 }
 
 void
 dtls_set_log_level(log_t level) {
-#ifdef NDEBUG
-  maxlog = min(level, DTLS_LOG_INFO);
-#else /* !NDEBUG */
-  maxlog = level;
-#endif /* NDEBUG */
+  dtls_log_level = min((int)level, (int)DTLS_LOG_MAX_LEVEL);
 }
 
 /* this array has the same order as the type log_t */
@@ -211,7 +207,7 @@ dsrv_log(log_t level, char *format, ...) {
   va_list ap;
   FILE *log_fd;
 
-  if (maxlog < (int)level)
+  if (dtls_log_level < (int)level)
     return;
 
   log_fd = level <= DTLS_LOG_CRIT ? stderr : stdout;
@@ -233,7 +229,7 @@ dsrv_log(log_t level, char *format, ...) {
   static char timebuf[32];
   va_list ap;
 
-  if (maxlog < level)
+  if (dtls_log_level < level)
     return;
 
   if (print_timestamp(timebuf,sizeof(timebuf), clock_time()))
@@ -280,6 +276,8 @@ void dtls_dsrv_log_addr(log_t level, const char *name, const session_t *addr)
   char addrbuf[73];
   int len;
 
+  if (!dtls_log_enabled(level))
+    return;
   len = dsrv_print_addr(addr, addrbuf, sizeof(addrbuf));
   if (!len)
     return;
@@ -293,7 +291,7 @@ dtls_dsrv_hexdump_log(log_t level, const char *name, const unsigned char *buf, s
   FILE *log_fd;
   int n = 0;
 
-  if (maxlog < (int)level)
+  if (dtls_log_level < (int)level)
     return;
 
   log_fd = level <= DTLS_LOG_CRIT ? stderr : stdout;
@@ -336,7 +334,7 @@ dtls_dsrv_hexdump_log(log_t level, const char *name, const unsigned char *buf, s
   static char timebuf[32];
   int n = 0;
 
-  if (maxlog < level)
+  if (dtls_log_level < level)
     return;
 
   if (print_timestamp(timebuf,sizeof(timebuf), clock_time()))
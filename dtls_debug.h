@@ -57,6 +57,20 @@ typedef enum { DTLS_LOG_EMERG=0, DTLS_LOG_ALERT, DTLS_LOG_CRIT, DTLS_LOG_WARN,
        DTLS_LOG_NOTICE, DTLS_LOG_INFO, DTLS_LOG_DEBUG
 } log_t;
 
+#ifndef DTLS_LOG_MAX_LEVEL
+/**
+ * The most verbose log level that is compiled in. Log statements
+ * above this level are removed together with the evaluation of their
+ * arguments. Builds with NDEBUG never log at DTLS_LOG_DEBUG, the
+ * level of all key and record dumps.
+ */
+#ifdef NDEBUG
+#define DTLS_LOG_MAX_LEVEL DTLS_LOG_INFO
+#else /* NDEBUG */
+#define DTLS_LOG_MAX_LEVEL DTLS_LOG_DEBUG
+#endif /* NDEBUG */
+#endif /* DTLS_LOG_MAX_LEVEL */
+
 /** Returns a zero-terminated string with the name of this library. */
 const char *dtls_package_name(void);
 
@@ -66,9 +80,23 @@ const char *dtls_package_version(void);
 /** Returns the current log level. */
 log_t dtls_get_log_level(void);
 
-/** Sets the log level to the specified value. */
+/**
+ * Sets the log level to the specified value. Levels above
+ * DTLS_LOG_MAX_LEVEL are reduced to DTLS_LOG_MAX_LEVEL.
+ */
 void dtls_set_log_level(log_t level);
 
+/** The current log level, use dtls_set_log_level() to change it. */
+extern int dtls_log_level;
+
+/**
+ * Whether messages of @p level are logged. The test is resolved at
+ * compile time for levels above DTLS_LOG_MAX_LEVEL, and compares
+ * against the current log level otherwise.
+ */
+#define dtls_log_enabled(level)					\
+  ((int)(level) <= (int)DTLS_LOG_MAX_LEVEL && (int)(level) <= dtls_log_level)
+
 /** 
  * Writes the given text to \c stdout. The text is output only when \p
  * level is below or equal to the log level that set by
@@ -108,15 +136,32 @@ dtls_dsrv_log_addr(log_t level, const char *name, const session_t *addr)
 
 #endif /* NDEBUG */
 
+/**
+ * Logs the message at @p level. The arguments are only evaluated when
+ * dtls_log_enabled() holds for @p level.
+ */
+#define dtls_log(level, ...)						\
+  do {									\
+    if (dtls_log_enabled(level))					\
+      dsrv_log((level), __VA_ARGS__);					\
+  } while (0)
+
+/** Like dtls_dsrv_hexdump_log(), but tests the level first. */
+#define dtls_log_hexdump(level, name, buf, length, extend)		\
+  do {									\
+    if (dtls_log_enabled(level))					\
+      dtls_dsrv_hexdump_log((level), (name), (buf), (length), (extend)); \
+  } while (0)
+
 /* A set of convenience macros for common log levels. */
-#define dtls_emerg(...) dsrv_log(DTLS_LOG_EMERG, __VA_ARGS__)
-#define dtls_alert(...) dsrv_log(DTLS_LOG_ALERT, __VA_ARGS__)
-#define dtls_crit(...) dsrv_log(DTLS_LOG_CRIT, __VA_ARGS__)
-#define dtls_warn(...) dsrv_log(DTLS_LOG_WARN, __VA_ARGS__)
-#define dtls_notice(...) dsrv_log(DTLS_LOG_NOTICE, __VA_ARGS__)
-#define dtls_info(...) dsrv_log(DTLS_LOG_INFO, __VA_ARGS__)
-#define dtls_debug(...) dsrv_log(DTLS_LOG_DEBUG, __VA_ARGS__)
-#define dtls_debug_hexdump(name, buf, length) dtls_dsrv_hexdump_log(DTLS_LOG_DEBUG, name, buf, length, 1)
-#define dtls_debug_dump(name, buf, length) dtls_dsrv_hexdump_log(DTLS_LOG_DEBUG, name, buf, length, 0)
+#define dtls_emerg(...) dtls_log(DTLS_LOG_EMERG, __VA_ARGS__)
+#define dtls_alert(...) dtls_log(DTLS_LOG_ALERT, __VA_ARGS__)
+#define dtls_crit(...) dtls_log(DTLS_LOG_CRIT, __VA_ARGS__)
+#define dtls_warn(...) dtls_log(DTLS_LOG_WARN, __VA_ARGS__)
+#define dtls_notice(...) dtls_log(DTLS_LOG_NOTICE, __VA_ARGS__)
+#define dtls_info(...) dtls_log(DTLS_LOG_INFO, __VA_ARGS__)
+#define dtls_debug(...) dtls_log(DTLS_LOG_DEBUG, __VA_ARGS__)
+#define dtls_debug_hexdump(name, buf, length) dtls_log_hexdump(DTLS_LOG_DEBUG, name, buf, length, 1)
+#define dtls_debug_dump(name, buf, length) dtls_log_hexdump(DTLS_LOG_DEBUG, name, buf, length, 0)
 
 #endif /* _DTLS_DEBUG_H_ */
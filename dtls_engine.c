@@ -0,0 +1,665 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2011, 2012, 2013, 2014, 2015 Olaf Bergmann (TZI) and others.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v. 1.0 which accompanies this distribution.
+ *
+ * The Eclipse Public License is available at http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Olaf Bergmann  - initial API and implementation
+ *
+ *******************************************************************************/
+
+/* recvmmsg(), sendmmsg() and SO_REUSEPORT are GNU extensions */
+#define _GNU_SOURCE
+
+#include "tinydtls.h"
+
+#ifdef DTLS_ENGINE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+
+#include "dtls_engine.h"
+#include "dtls_debug.h"
+
+#ifndef DTLS_ENGINE_MAX_SHARDS
+/** The shards are told apart by one byte of the connection ID. */
+#define DTLS_ENGINE_MAX_SHARDS 256
+#endif /* DTLS_ENGINE_MAX_SHARDS */
+
+#ifndef DTLS_ENGINE_READ_BATCH
+/** The number of datagrams a shard reads with one system call. */
+#define DTLS_ENGINE_READ_BATCH 32
+#endif /* DTLS_ENGINE_READ_BATCH */
+
+#ifndef DTLS_ENGINE_QUEUE_MAX
+/**
+ * The number of items in the queue of a shard above which datagrams
+ * that other shards forward to it are dropped.
+ */
+#define DTLS_ENGINE_QUEUE_MAX 1024
+#endif /* DTLS_ENGINE_QUEUE_MAX */
+
+#if DTLS_ENGINE_READ_BATCH > DTLS_MESSAGE_BATCH_SIZE
+#error "DTLS_ENGINE_READ_BATCH must not exceed DTLS_MESSAGE_BATCH_SIZE"
+#endif
+
+/** What a queued item asks the shard to do. */
+typedef enum {
+  ENGINE_WRITE,			/**< dtls_write() the data */
+  ENGINE_DATAGRAM,		/**< handle a datagram read by another shard */
+  ENGINE_CALL			/**< call a function */
+} engine_item_type_t;
+
+/** An entry of the queue of a shard, with its data behind it. */
+typedef struct engine_item_t {
+  struct engine_item_t *next;
+  engine_item_type_t type;
+  session_t session;
+  void (*fn)(dtls_context_t *ctx, void *arg);
+  void *arg;
+  uint8 *data;
+  size_t length;
+} engine_item_t;
+
+/**
+ * Queue with many producers and one consumer after D. Vyukov. Items
+ * are appended by swapping @c head, the shard takes them from
+ * @c tail. @c pending counts the items that have not been handled,
+ * the producer that makes it non-zero wakes the shard up.
+ */
+typedef struct {
+  engine_item_t *head;
+  engine_item_t *tail;
+  engine_item_t stub;
+  unsigned int pending;
+} engine_queue_t;
+
+typedef struct {
+  dtls_engine_t *engine;
+  unsigned int index;
+  dtls_context_t *ctx;
+  dtls_handler_t handler;
+  int fd;			/**< the UDP socket */
+  int epfd;
+  int timerfd;			/**< fires at the next retransmission */
+  int eventfd;			/**< signals new items in the queue */
+  clock_time_t timer;		/**< when timerfd fires, @c 0 if not armed */
+  engine_queue_t queue;
+  pthread_t thread;
+  int running;
+  dtls_message_t msgs[DTLS_ENGINE_READ_BATCH];
+  uint8 bufs[DTLS_ENGINE_READ_BATCH][DTLS_MAX_BUF];
+} engine_shard_t;
+
+struct dtls_engine_t {
+  unsigned int count;		/**< the number of shards */
+  int stopping;
+  void *app;
+  engine_shard_t *shards[DTLS_ENGINE_MAX_SHARDS];
+};
+
+/** The shard that runs in this thread, if any. */
+static DTLS_THREAD_LOCAL engine_shard_t *engine_current;
+
+static void
+queue_init(engine_queue_t *q) {
+  q->stub.next = NULL;
+  q->head = q->tail = &q->stub;
+  q->pending = 0;
+}
+
+static void
+queue_push(engine_queue_t *q, engine_item_t *item) {
+  engine_item_t *prev;
+
+  __atomic_store_n(&item->next, NULL, __ATOMIC_RELAXED);
+  prev = __atomic_exchange_n(&q->head, item, __ATOMIC_ACQ_REL);
+  __atomic_store_n(&prev->next, item, __ATOMIC_RELEASE);
+}
+
+/**
+ * Takes the oldest item from @p q. This returns @c NULL if @p q is
+ * empty, or if a producer has not yet linked the next item.
+ */
+static engine_item_t *
+queue_pop(engine_queue_t *q) {
+  engine_item_t *tail = q->tail;
+  engine_item_t *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+  if (tail == &q->stub) {
+    if (!next)
+      return NULL;
+    q->tail = tail = next;
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+  }
+  if (next) {
+    q->tail = next;
+    return tail;
+  }
+  if (tail != __atomic_load_n(&q->head, __ATOMIC_ACQUIRE))
+    return NULL;
+
+  /* tail is the last item, the stub keeps the queue linked */
+  queue_push(q, &q->stub);
+  next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+  if (next) {
+    q->tail = next;
+    return tail;
+  }
+  return NULL;
+}
+
+/** Appends @p item to the queue of @p shard and wakes it up. */
+static void
+engine_enqueue(engine_shard_t *shard, engine_item_t *item) {
+  uint64_t one = 1;
+
+  queue_push(&shard->queue, item);
+  if (__atomic_fetch_add(&shard->queue.pending, 1, __ATOMIC_ACQ_REL) == 0
+      && write(shard->eventfd, &one, sizeof(one)) < 0)
+    dtls_warn("engine: cannot wake up shard %u\n", shard->index);
+}
+
+static engine_item_t *
+engine_item_new(engine_item_type_t type, const session_t *session,
+		const uint8 *data, size_t length) {
+  engine_item_t *item = malloc(sizeof(engine_item_t) + length);
+
+  if (!item)
+    return NULL;
+  memset(item, 0, sizeof(engine_item_t));
+  item->type = type;
+  if (session)
+    item->session = *session;
+  item->data = (uint8 *)(item + 1);
+  item->length = length;
+  if (length)
+    memcpy(item->data, data, length);
+  return item;
+}
+
+/** Handles all items in the queue of @p shard. */
+static void
+engine_drain(engine_shard_t *shard) {
+  engine_item_t *item;
+  unsigned int n;
+  uint64_t count;
+
+  if (read(shard->eventfd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+    dtls_warn("engine: cannot read eventfd: %s\n", strerror(errno));
+
+  do {
+    n = 0;
+    while ((item = queue_pop(&shard->queue))) {
+      switch (item->type) {
+      case ENGINE_WRITE:
+	dtls_write(shard->ctx, &item->session, item->data, item->length);
+	break;
+      case ENGINE_DATAGRAM:
+	dtls_handle_message(shard->ctx, &item->session, item->data,
+			    item->length);
+	break;
+      case ENGINE_CALL:
+	item->fn(shard->ctx, item->arg);
+	break;
+      default:
+	break;
+      }
+      free(item);
+      n++;
+    }
+    /* a producer may not have linked its item yet */
+    if (!n)
+      sched_yield();
+  } while (__atomic_sub_fetch(&shard->queue.pending, n, __ATOMIC_ACQ_REL));
+}
+
+static int
+engine_write(struct dtls_context_t *ctx, session_t *session,
+	     uint8 *buf, size_t len) {
+  engine_shard_t *shard = dtls_get_app_data(ctx);
+
+  return sendto(shard->fd, buf, len, MSG_DONTWAIT,
+		&session->addr.sa, session->size);
+}
+
+#if defined(HAVE_SENDMMSG) && DTLS_WRITE_BATCH_SIZE > 0
+/* Sends all records of a flight with a single system call. */
+static int
+engine_write_batch(struct dtls_context_t *ctx,
+		   dtls_message_t *msgs, size_t count) {
+  engine_shard_t *shard = dtls_get_app_data(ctx);
+  struct mmsghdr hdrs[DTLS_WRITE_BATCH_SIZE];
+  struct iovec iov[DTLS_WRITE_BATCH_SIZE];
+  size_t i;
+  int n;
+
+  if (count > DTLS_WRITE_BATCH_SIZE)
+    count = DTLS_WRITE_BATCH_SIZE;
+
+  memset(hdrs, 0, sizeof(hdrs));
+  for (i = 0; i < count; i++) {
+    iov[i].iov_base = msgs[i].msg;
+    iov[i].iov_len = msgs[i].length;
+    hdrs[i].msg_hdr.msg_iov = &iov[i];
+    hdrs[i].msg_hdr.msg_iovlen = 1;
+    hdrs[i].msg_hdr.msg_name = &msgs[i].session.addr.sa;
+    hdrs[i].msg_hdr.msg_namelen = msgs[i].session.size;
+  }
+
+  n = sendmmsg(shard->fd, hdrs, count, MSG_DONTWAIT);
+  if (n < 0)
+    return -1;
+
+  for (i = 0; i < count; i++)
+    msgs[i].result = i < (size_t)n ? (int)hdrs[i].msg_len : -1;
+  return n;
+}
+#endif /* HAVE_SENDMMSG && DTLS_WRITE_BATCH_SIZE > 0 */
+
+/**
+ * Returns the shard that owns the record with connection ID at the
+ * start of @p msg, or @c NULL if it is not another shard than
+ * @p shard.
+ */
+static engine_shard_t *
+engine_steer(engine_shard_t *shard, const uint8 *msg, int length) {
+#if DTLS_CID_LENGTH > 0
+  /* content type, version, epoch and sequence number precede the CID */
+  const int offset = 1 + 2 + 2 + 6;
+  unsigned int owner;
+
+  /* the CID is chosen by the sender, forward only complete headers */
+  if (length >= (int)(sizeof(dtls_record_header_t) + DTLS_CID_LENGTH)
+      && msg[0] == DTLS_CT_TLS12_CID) {
+    owner = msg[offset];
+    if (owner != shard->index && owner < shard->engine->count)
+      return shard->engine->shards[owner];
+  }
+#else /* DTLS_CID_LENGTH > 0 */
+  (void)shard; (void)msg; (void)length;
+#endif /* DTLS_CID_LENGTH > 0 */
+  return NULL;
+}
+
+/**
+ * Reads the datagrams that are waiting at the socket of @p shard and
+ * hands them to its context, or to the shard that owns them.
+ */
+static void
+engine_read(engine_shard_t *shard) {
+  engine_shard_t *owner;
+  engine_item_t *item;
+  dtls_message_t *msg;
+  int i, k, n;
+#ifdef HAVE_RECVMMSG
+  struct mmsghdr hdrs[DTLS_ENGINE_READ_BATCH];
+  struct iovec iov[DTLS_ENGINE_READ_BATCH];
+
+  memset(hdrs, 0, sizeof(hdrs));
+  for (i = 0; i < DTLS_ENGINE_READ_BATCH; i++) {
+    memset(&shard->msgs[i].session, 0, sizeof(session_t));
+    iov[i].iov_base = shard->bufs[i];
+    iov[i].iov_len = sizeof(shard->bufs[i]);
+    hdrs[i].msg_hdr.msg_iov = &iov[i];
+    hdrs[i].msg_hdr.msg_iovlen = 1;
+    hdrs[i].msg_hdr.msg_name = &shard->msgs[i].session.addr;
+    hdrs[i].msg_hdr.msg_namelen = sizeof(shard->msgs[i].session.addr);
+  }
+
+  n = recvmmsg(shard->fd, hdrs, DTLS_ENGINE_READ_BATCH, MSG_DONTWAIT, NULL);
+  if (n < 0)
+    return;
+  for (i = 0; i < n; i++) {
+    shard->msgs[i].session.size = hdrs[i].msg_hdr.msg_namelen;
+    shard->msgs[i].length = hdrs[i].msg_len;
+  }
+#else /* HAVE_RECVMMSG */
+  int len;
+
+  for (n = 0; n < DTLS_ENGINE_READ_BATCH; n++) {
+    msg = &shard->msgs[n];
+    memset(&msg->session, 0, sizeof(session_t));
+    msg->session.size = sizeof(msg->session.addr);
+    len = recvfrom(shard->fd, shard->bufs[n], DTLS_MAX_BUF, MSG_DONTWAIT,
+		   &msg->session.addr.sa, &msg->session.size);
+    if (len < 0)
+      break;
+    msg->length = len;
+  }
+#endif /* HAVE_RECVMMSG */
+
+  /* datagrams of other shards are copied to their queues */
+  for (i = k = 0; i < n; i++) {
+    msg = &shard->msgs[i];
+    msg->msg = shard->bufs[i];
+    owner = engine_steer(shard, msg->msg, msg->length);
+    if (owner) {
+      /* spoofed records must not let the queue of the owner grow */
+      if (__atomic_load_n(&owner->queue.pending, __ATOMIC_RELAXED)
+	  >= DTLS_ENGINE_QUEUE_MAX)
+	continue;
+      item = engine_item_new(ENGINE_DATAGRAM, &msg->session, msg->msg,
+			     msg->length);
+      if (item)
+	engine_enqueue(owner, item);
+      continue;
+    }
+    if (k != i) {
+      memcpy(shard->bufs[k], msg->msg, msg->length);
+      shard->msgs[k].session = msg->session;
+      shard->msgs[k].length = msg->length;
+      shard->msgs[k].msg = shard->bufs[k];
+    }
+    k++;
+  }
+
+  if (k)
+    dtls_handle_messages(shard->ctx, shard->msgs, k);
+}
+
+/** Arms the timer of @p shard for the next retransmission. */
+static void
+engine_schedule(engine_shard_t *shard) {
+  struct itimerspec spec;
+  clock_time_t next;
+  dtls_tick_t now;
+
+  dtls_check_retransmit(shard->ctx, &next);
+  if (next == shard->timer)
+    return;
+
+  memset(&spec, 0, sizeof(spec));
+  if (next) {
+    dtls_ticks(&now);
+    next = next > now ? next - now : 1;
+    spec.it_value.tv_sec = next / DTLS_TICKS_PER_SECOND;
+    spec.it_value.tv_nsec = (long)(next % DTLS_TICKS_PER_SECOND)
+      * (1000000000L / DTLS_TICKS_PER_SECOND);
+    if (!spec.it_value.tv_sec && !spec.it_value.tv_nsec)
+      spec.it_value.tv_nsec = 1;
+    next += now;
+  }
+  if (timerfd_settime(shard->timerfd, 0, &spec, NULL) == 0)
+    shard->timer = next;
+}
+
+static void *
+engine_run(void *arg) {
+  engine_shard_t *shard = arg;
+  struct epoll_event events[3];
+  uint64_t expirations;
+  int i, n;
+
+  engine_current = shard;
+  while (!__atomic_load_n(&shard->engine->stopping, __ATOMIC_ACQUIRE)) {
+    n = epoll_wait(shard->epfd, events, 3, -1);
+    /* one clock read for the whole batch */
+    dtls_ticks_refresh(NULL);
+    for (i = 0; i < n; i++) {
+      if (events[i].data.fd == shard->fd)
+	engine_read(shard);
+      else if (events[i].data.fd == shard->eventfd)
+	engine_drain(shard);
+      else if (read(shard->timerfd, &expirations, sizeof(expirations)) > 0)
+	shard->timer = 0;
+    }
+    engine_schedule(shard);
+  }
+  engine_current = NULL;
+  return NULL;
+}
+
+static void
+engine_shard_free(engine_shard_t *shard) {
+  engine_item_t *item;
+
+  if (!shard)
+    return;
+  while ((item = queue_pop(&shard->queue)))
+    if (item != &shard->queue.stub)
+      free(item);
+  dtls_free_context(shard->ctx);
+  if (shard->fd >= 0)
+    close(shard->fd);
+  if (shard->epfd >= 0)
+    close(shard->epfd);
+  if (shard->timerfd >= 0)
+    close(shard->timerfd);
+  if (shard->eventfd >= 0)
+    close(shard->eventfd);
+  free(shard);
+}
+
+/**
+ * Creates shard @p index of @p engine. When @p port_of is set, the
+ * socket is bound to the port that the socket of @p port_of has, as
+ * the configured port may be @c 0.
+ */
+static engine_shard_t *
+engine_shard_new(dtls_engine_t *engine, unsigned int index,
+		 const dtls_engine_config_t *config, engine_shard_t *port_of) {
+  engine_shard_t *shard = calloc(1, sizeof(engine_shard_t));
+  struct sockaddr_storage addr;
+  socklen_t addr_len = config->addr_len;
+  struct epoll_event ev;
+  int on = 1, i;
+  int *fds[3];
+
+  if (!shard)
+    return NULL;
+  shard->engine = engine;
+  shard->index = index;
+  shard->fd = shard->epfd = shard->timerfd = shard->eventfd = -1;
+  queue_init(&shard->queue);
+
+  if (addr_len > sizeof(addr))
+    goto error;
+  memcpy(&addr, config->addr, addr_len);
+  if (port_of && getsockname(port_of->fd, (struct sockaddr *)&addr,
+			     &addr_len) < 0)
+    goto error;
+
+  shard->fd = socket(config->addr->sa_family,
+		     SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (shard->fd < 0
+      || setsockopt(shard->fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0
+      || bind(shard->fd, (struct sockaddr *)&addr, addr_len) < 0) {
+    dtls_crit("engine: cannot bind socket: %s\n", strerror(errno));
+    goto error;
+  }
+
+  shard->epfd = epoll_create1(EPOLL_CLOEXEC);
+  shard->timerfd = timerfd_create(CLOCK_MONOTONIC,
+				  TFD_NONBLOCK | TFD_CLOEXEC);
+  shard->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  fds[0] = &shard->fd;
+  fds[1] = &shard->timerfd;
+  fds[2] = &shard->eventfd;
+  for (i = 0; i < 3; i++) {
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = *fds[i];
+    if (shard->epfd < 0 || *fds[i] < 0
+	|| epoll_ctl(shard->epfd, EPOLL_CTL_ADD, *fds[i], &ev) < 0) {
+      dtls_crit("engine: cannot set up epoll: %s\n", strerror(errno));
+      goto error;
+    }
+  }
+
+  shard->ctx = dtls_new_context(shard);
+  if (!shard->ctx)
+    goto error;
+  shard->handler = *config->handler;
+  shard->handler.write = engine_write;
+#if defined(HAVE_SENDMMSG) && DTLS_WRITE_BATCH_SIZE > 0
+  shard->handler.write_batch = engine_write_batch;
+#endif /* HAVE_SENDMMSG && DTLS_WRITE_BATCH_SIZE > 0 */
+  dtls_set_handler(shard->ctx, &shard->handler);
+  /* without connection IDs, peers never change their shard */
+  if (engine->count > 1)
+    (void)dtls_set_cid_prefix(shard->ctx, index);
+
+  if (config->setup && config->setup(engine, index, shard->ctx) < 0)
+    goto error;
+  return shard;
+
+ error:
+  engine_shard_free(shard);
+  return NULL;
+}
+
+dtls_engine_t *
+dtls_engine_new(const dtls_engine_config_t *config) {
+  dtls_engine_t *engine;
+  long cpus;
+  unsigned int i;
+
+  if (!config || !config->addr || !config->handler)
+    return NULL;
+
+  engine = calloc(1, sizeof(dtls_engine_t));
+  if (!engine)
+    return NULL;
+  engine->app = config->app;
+  engine->count = config->shards;
+  if (!engine->count) {
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    engine->count = cpus > 0 ? (unsigned int)cpus : 1;
+  }
+  if (engine->count > DTLS_ENGINE_MAX_SHARDS)
+    engine->count = DTLS_ENGINE_MAX_SHARDS;
+
+  for (i = 0; i < engine->count; i++) {
+    engine->shards[i] = engine_shard_new(engine, i, config,
+					 i ? engine->shards[0] : NULL);
+    if (!engine->shards[i]) {
+      dtls_engine_free(engine);
+      return NULL;
+    }
+  }
+  return engine;
+}
+
+int
+dtls_engine_start(dtls_engine_t *engine) {
+  engine_shard_t *shard;
+  unsigned int i;
+
+  for (i = 0; i < engine->count; i++) {
+    shard = engine->shards[i];
+    if (shard->running)
+      continue;
+    if (pthread_create(&shard->thread, NULL, engine_run, shard) != 0) {
+      dtls_crit("engine: cannot start shard %u\n", i);
+      return -1;
+    }
+    shard->running = 1;
+  }
+  return 0;
+}
+
+void
+dtls_engine_free(dtls_engine_t *engine) {
+  uint64_t one = 1;
+  unsigned int i;
+
+  if (!engine)
+    return;
+
+  __atomic_store_n(&engine->stopping, 1, __ATOMIC_RELEASE);
+  for (i = 0; i < engine->count; i++)
+    if (engine->shards[i] && engine->shards[i]->running
+	&& write(engine->shards[i]->eventfd, &one, sizeof(one)) < 0)
+      dtls_warn("engine: cannot stop shard %u\n", i);
+  for (i = 0; i < engine->count; i++)
+    if (engine->shards[i] && engine->shards[i]->running)
+      pthread_join(engine->shards[i]->thread, NULL);
+  for (i = 0; i < engine->count; i++)
+    engine_shard_free(engine->shards[i]);
+  free(engine);
+}
+
+unsigned int
+dtls_engine_shards(const dtls_engine_t *engine) {
+  return engine->count;
+}
+
+dtls_context_t *
+dtls_engine_context(dtls_engine_t *engine, unsigned int shard) {
+  return shard < engine->count ? engine->shards[shard]->ctx : NULL;
+}
+
+void *
+dtls_engine_get_app(const dtls_engine_t *engine) {
+  return engine->app;
+}
+
+dtls_engine_t *
+dtls_engine_of(const dtls_context_t *ctx) {
+  return ((engine_shard_t *)dtls_get_app_data(ctx))->engine;
+}
+
+unsigned int
+dtls_engine_shard_of(const dtls_context_t *ctx) {
+  return ((engine_shard_t *)dtls_get_app_data(ctx))->index;
+}
+
+int
+dtls_engine_write(dtls_engine_t *engine, unsigned int shard,
+		  const session_t *session, const uint8 *data, size_t len) {
+  engine_item_t *item;
+  session_t dst;
+
+  if (shard >= engine->count)
+    return -1;
+  if (engine_current == engine->shards[shard]) {
+    dst = *session;
+    return dtls_write(engine_current->ctx, &dst, (uint8 *)data, len);
+  }
+
+  item = engine_item_new(ENGINE_WRITE, session, data, len);
+  if (!item)
+    return -1;
+  engine_enqueue(engine->shards[shard], item);
+  return 0;
+}
+
+int
+dtls_engine_call(dtls_engine_t *engine, unsigned int shard,
+		 void (*fn)(dtls_context_t *ctx, void *arg), void *arg) {
+  engine_item_t *item;
+
+  if (shard >= engine->count)
+    return -1;
+  if (engine_current == engine->shards[shard]) {
+    fn(engine_current->ctx, arg);
+    return 0;
+  }
+
+  item = engine_item_new(ENGINE_CALL, NULL, NULL, 0);
+  if (!item)
+    return -1;
+  item->fn = fn;
+  item->arg = arg;
+  engine_enqueue(engine->shards[shard], item);
+  return 0;
+}
+
+#else /* DTLS_ENGINE */
+/* ISO C does not allow an empty translation unit */
+typedef int dtls_engine_unused_t;
+#endif /* DTLS_ENGINE */
@@ -0,0 +1,155 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2011, 2012, 2013, 2014, 2015 Olaf Bergmann (TZI) and others.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v. 1.0 which accompanies this distribution.
+ *
+ * The Eclipse Public License is available at http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Olaf Bergmann  - initial API and implementation
+ *
+ *******************************************************************************/
+
+/**
+ * @file dtls_engine.h
+ * @brief Multi-threaded DTLS server on one UDP port
+ */
+
+#ifndef _DTLS_ENGINE_H_
+#define _DTLS_ENGINE_H_
+
+#include "tinydtls.h"
+#include "dtls.h"
+
+/**
+ * @defgroup engine Server engine
+ *
+ * The engine runs a DTLS server on several worker threads, the
+ * shards. Each shard owns a dtls_context_t, a UDP socket that is
+ * bound to the common address with SO_REUSEPORT, and an epoll loop
+ * that also drives dtls_check_retransmit() with a timerfd. As the
+ * kernel distributes datagrams by their addresses, a peer stays with
+ * the shard that has received its first datagram. Records with
+ * connection ID carry the index of their shard in the first byte of
+ * the connection ID, see dtls_set_cid_prefix(), so they are passed on
+ * to that shard after the address of the peer has changed. Such
+ * records are dropped while the queue of that shard holds more than
+ * DTLS_ENGINE_QUEUE_MAX items.
+ *
+ * All callbacks of a context are called in the thread of its shard,
+ * and a context must not be used from any other thread once the
+ * engine has been started. Other threads hand data over to a shard
+ * with dtls_engine_write() or dtls_engine_call(), which append to a
+ * lock-free queue of the shard.
+ *
+ * The engine is available on Linux, where configure defines
+ * DTLS_ENGINE unless it is run with --without-engine.
+ * @{
+ */
+
+#ifdef DTLS_ENGINE
+
+typedef struct dtls_engine_t dtls_engine_t;
+
+/** The parameters of dtls_engine_new(). */
+typedef struct {
+  const struct sockaddr *addr;	/**< the address to listen on */
+  socklen_t addr_len;		/**< the size of @c addr */
+  /** the number of shards, @c 0 for one per online CPU */
+  unsigned int shards;
+  /**
+   * The handler of all contexts. Its @c write and @c write_batch
+   * functions are replaced by the engine.
+   */
+  const dtls_handler_t *handler;
+  /**
+   * Optional function that is called for the context of each shard
+   * before the engine is started, e.g. to set limits or keys. A
+   * value less than zero makes dtls_engine_new() fail.
+   */
+  int (*setup)(dtls_engine_t *engine, unsigned int shard,
+	       dtls_context_t *ctx);
+  void *app;			/**< application data, see dtls_engine_get_app() */
+} dtls_engine_config_t;
+
+/**
+ * Creates the shards of a new engine and binds their sockets. The
+ * worker threads are started with dtls_engine_start(). dtls_init()
+ * must have been called before.
+ *
+ * @param config The parameters of the engine.
+ * @return The new engine, or @c NULL on error.
+ */
+dtls_engine_t *dtls_engine_new(const dtls_engine_config_t *config);
+
+/**
+ * Starts the worker threads of @p engine.
+ *
+ * @return @c 0 on success, a value less than zero on error.
+ */
+int dtls_engine_start(dtls_engine_t *engine);
+
+/**
+ * Stops the worker threads of @p engine if they are running, and
+ * releases the engine with all contexts and sockets. Data that is
+ * still queued for a shard is dropped.
+ */
+void dtls_engine_free(dtls_engine_t *engine);
+
+/** Returns the number of shards of @p engine. */
+unsigned int dtls_engine_shards(const dtls_engine_t *engine);
+
+/**
+ * Returns the context of @p shard. It may only be used before the
+ * engine is started or in the thread of the shard.
+ */
+dtls_context_t *dtls_engine_context(dtls_engine_t *engine,
+				    unsigned int shard);
+
+/** Returns the application data of @p engine. */
+void *dtls_engine_get_app(const dtls_engine_t *engine);
+
+/**
+ * Returns the engine of @p ctx, which must have been created by
+ * dtls_engine_new(). The application data of such a context belongs
+ * to the engine, dtls_engine_get_app() replaces dtls_get_app_data().
+ */
+dtls_engine_t *dtls_engine_of(const dtls_context_t *ctx);
+
+/** Returns the index of the shard that owns @p ctx. */
+unsigned int dtls_engine_shard_of(const dtls_context_t *ctx);
+
+/**
+ * Sends @p len bytes of application data to the peer at @p session,
+ * which belongs to @p shard, e.g. as recorded in the event handler.
+ * In the thread of @p shard, this is dtls_write(). Other threads
+ * pass a copy of the data to the shard, which writes it later.
+ *
+ * @return The result of dtls_write() in the thread of @p shard, @c 0
+ *   when the data has been queued, or a value less than zero on
+ *   error.
+ */
+int dtls_engine_write(dtls_engine_t *engine, unsigned int shard,
+		      const session_t *session, const uint8 *data,
+		      size_t len);
+
+/**
+ * Calls @p fn with the context of @p shard and @p arg in the thread of
+ * @p shard, e.g. to close a peer or to read its state. In that thread,
+ * @p fn is called right away.
+ *
+ * @return @c 0 on success, a value less than zero if the call cannot
+ *   be queued.
+ */
+int dtls_engine_call(dtls_engine_t *engine, unsigned int shard,
+		     void (*fn)(dtls_context_t *ctx, void *arg), void *arg);
+
+#endif /* DTLS_ENGINE */
+
+/** @} */
+
+#endif /* _DTLS_ENGINE_H_ */
@@ -19,9 +19,20 @@
  * @brief Clock Handling
  */
 
+/* for clock_gettime() */
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200112L
+#endif
+
 #include "tinydtls.h"
+#include "global.h"
 #include "dtls_time.h"
 
+/* the value of dtls_ticks() while ticks_cached is set */
+static DTLS_THREAD_LOCAL dtls_tick_t cached_ticks;
+static DTLS_THREAD_LOCAL int ticks_cached;
+static DTLS_THREAD_LOCAL int ticks_simulated; /* set by dtls_ticks_set() */
+
 #ifdef WITH_CONTIKI
 clock_time_t dtls_clock_offset;
 
@@ -31,18 +42,41 @@ dtls_clock_init(void) {
   dtls_clock_offset = clock_time();
 }
 
-void
-dtls_ticks(dtls_tick_t *t) {
+static inline void
+dtls_clock_read(dtls_tick_t *t) {
   *t = clock_time();
 }
 
 #else /* WITH_CONTIKI */
 
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+#define DTLS_CLOCK_MONOTONIC 1
+
+#ifndef DTLS_CLOCK_MAX_RESOLUTION
+/** The coarse clock is used if it is at least this precise, in
+ *  nanoseconds. Retransmissions are scheduled in seconds, so a few
+ *  milliseconds do not matter. */
+#define DTLS_CLOCK_MAX_RESOLUTION 10000000L
+#endif /* DTLS_CLOCK_MAX_RESOLUTION */
+
+/* the clock that is read by dtls_ticks(), set by dtls_clock_init() */
+static clockid_t dtls_clock_id = CLOCK_MONOTONIC;
+#endif /* HAVE_CLOCK_GETTIME && CLOCK_MONOTONIC */
+
 time_t dtls_clock_offset;
 
 void
 dtls_clock_init(void) {
-#ifdef HAVE_TIME_H
+#ifdef DTLS_CLOCK_MONOTONIC
+  struct timespec ts;
+
+#ifdef CLOCK_MONOTONIC_COARSE
+  if (clock_getres(CLOCK_MONOTONIC_COARSE, &ts) == 0 && !ts.tv_sec
+      && ts.tv_nsec <= DTLS_CLOCK_MAX_RESOLUTION)
+    dtls_clock_id = CLOCK_MONOTONIC_COARSE;
+#endif /* CLOCK_MONOTONIC_COARSE */
+  dtls_clock_offset = clock_gettime(dtls_clock_id, &ts) == 0 ? ts.tv_sec : 0;
+#elif defined(HAVE_TIME_H)
   dtls_clock_offset = time(NULL);
 #else
 #  ifdef __GNUC__
@@ -54,8 +88,15 @@ dtls_clock_init(void) {
 #endif
 }
 
-void dtls_ticks(dtls_tick_t *t) {
-#ifdef HAVE_SYS_TIME_H
+static inline void
+dtls_clock_read(dtls_tick_t *t) {
+#ifdef DTLS_CLOCK_MONOTONIC
+  struct timespec ts;
+  clock_gettime(dtls_clock_id, &ts);
+  *t = (ts.tv_sec - dtls_clock_offset) * DTLS_TICKS_PER_SECOND
+    + (dtls_tick_t)((uint64_t)ts.tv_nsec * DTLS_TICKS_PER_SECOND / 1000000000UL);
+#elif defined(HAVE_SYS_TIME_H)
+  /* the wall clock, which jumps when it is set */
   struct timeval tv;
   gettimeofday(&tv, NULL);
   *t = (tv.tv_sec - dtls_clock_offset) * DTLS_TICKS_PER_SECOND 
@@ -67,4 +108,37 @@ void dtls_ticks(dtls_tick_t *t) {
 
 #endif /* WITH_CONTIKI */
 
+void
+dtls_ticks(dtls_tick_t *t) {
+  if (ticks_cached)
+    *t = cached_ticks;
+  else
+    dtls_clock_read(t);
+}
+
+void
+dtls_ticks_refresh(dtls_tick_t *t) {
+  dtls_clock_read(&cached_ticks);
+  ticks_cached = 1;
+  ticks_simulated = 0;
+  if (t)
+    *t = cached_ticks;
+}
 
+void
+dtls_ticks_set(dtls_tick_t t) {
+  cached_ticks = t;
+  ticks_cached = 1;
+  ticks_simulated = 1;
+}
+
+void
+dtls_ticks_release(void) {
+  ticks_cached = 0;
+  ticks_simulated = 0;
+}
+
+int
+dtls_ticks_simulated(void) {
+  return ticks_simulated;
+}
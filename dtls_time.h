@@ -30,7 +30,7 @@
 /**
  * @defgroup clock Clock Handling
  * Default implementation of internal clock. You should redefine this if
- * you do not have time() and gettimeofday().
+ * you do not have clock_gettime(), time() or gettimeofday().
  * @{
  */
 
@@ -53,8 +53,45 @@ typedef clock_time_t dtls_tick_t;
 #endif /* DTLS_TICKS_PER_SECOND */
 
 void dtls_clock_init(void);
+
+/**
+ * Stores the current time in @p t. Unless WITH_CONTIKI is defined,
+ * this is a monotonic clock if the system has clock_gettime(), so
+ * retransmissions are not disturbed when the wall clock is set. After
+ * dtls_ticks_refresh() or dtls_ticks_set(), the time is taken from a
+ * cache of the calling thread instead of the clock.
+ */
 void dtls_ticks(dtls_tick_t *t);
 
+/**
+ * Reads the clock once and makes dtls_ticks() return that time in the
+ * calling thread until the next call of dtls_ticks_refresh(),
+ * dtls_ticks_set() or dtls_ticks_release(). An event loop calls this
+ * before it handles a batch of datagrams and timers, so that the batch
+ * costs one clock read and sees a single point in time.
+ *
+ * @param t Receives the time that has been read if not @c NULL.
+ */
+void dtls_ticks_refresh(dtls_tick_t *t);
+
+/**
+ * Makes dtls_ticks() return @p t in the calling thread, like
+ * dtls_ticks_refresh() without reading the clock. This is useful to
+ * run timers in tests with a simulated time.
+ */
+void dtls_ticks_set(dtls_tick_t t);
+
+/** Makes dtls_ticks() read the clock again in the calling thread. */
+void dtls_ticks_release(void);
+
+/**
+ * Returns @c 1 if dtls_ticks() returns a time that has been set with
+ * dtls_ticks_set() in the calling thread, @c 0 otherwise. Timestamps
+ * that are usually taken from the wall clock follow the simulated
+ * time then.
+ */
+int dtls_ticks_simulated(void);
+
 /** @} */
 
 #endif /* _DTLS_DTLS_TIME_H_ */
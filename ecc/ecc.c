@@ -40,6 +40,10 @@
 #include "ecc.h"
 #include <string.h>
 
+#if ECC_COMB_TEETH > 0
+#include "ecc_comb.h"
+#endif
+
 static uint32_t add( const uint32_t *x, const uint32_t *y, uint32_t *result, uint8_t length){
 	uint64_t d = 0; //carry
 	int v = 0;
@@ -93,6 +97,9 @@ static const uint32_t ecc_order_m[9] = {0xFC632551, 0xF3B9CAC2, 0xA7179E84, 0xBC
 static const uint32_t ecc_order_r[8] = {0x039CDAAF, 0x0C46353D, 0x58E8617B, 0x43190552,
 					0x00000000, 0x00000000, 0xFFFFFFFF, 0x00000000};
 
+static const uint32_t ecc_order_minus_four[8] = {0xFC63254D, 0xF3B9CAC2, 0xA7179E84, 0xBCE6FAAD,
+						 0xFFFFFFFF, 0xFFFFFFFF, 0x00000000, 0xFFFFFFFF};
+
 static const uint32_t ecc_order_mu[9] = {0xEEDF9BFE, 0x012FFD85, 0xDF1A6C21, 0x43190552,
 					 0xFFFFFFFF, 0xFFFFFFFE, 0xFFFFFFFF, 0x00000000,
 					 0x00000001};
@@ -134,47 +141,204 @@ static int isGreater(const uint32_t *A, const uint32_t *B, uint8_t length){
 }
 
 
-static int fieldAdd(const uint32_t *x, const uint32_t *y, const uint32_t *reducer, uint32_t *result){
-	if(add(x, y, result, arrayLength)){ //add prime if carry is still set!
-		uint32_t tempas[8];
-		setZero(tempas, 8);
-		add(result, reducer, tempas, arrayLength);
-		copy(tempas, result, arrayLength);
+//result = flag ? x : result, flag is 0 or 1 and is not branched on
+static void fieldSelect(uint32_t *result, const uint32_t *x, uint32_t flag){
+	uint32_t mask = -flag;
+	uint8_t i;
+	for (i = 0; i < arrayLength; i++)
+		result[i] ^= (result[i] ^ x[i]) & mask;
+}
+
+//swaps A and B if flag is 1, flag is not branched on
+static void fieldSwap(uint32_t *A, uint32_t *B, uint32_t flag){
+	uint32_t mask = -flag;
+	uint32_t t;
+	uint8_t i;
+	for (i = 0; i < arrayLength; i++){
+		t = (A[i] ^ B[i]) & mask;
+		A[i] ^= t;
+		B[i] ^= t;
 	}
+}
+
+//the correction for the carry is masked instead of branched, so that
+//the running time does not depend on the operands
+static int fieldAdd(const uint32_t *x, const uint32_t *y, const uint32_t *reducer, uint32_t *result){
+	uint32_t tempas[8];
+	uint32_t mask = -add(x, y, result, arrayLength); //add prime if carry is still set!
+	uint8_t i;
+	for (i = 0; i < arrayLength; i++)
+		tempas[i] = reducer[i] & mask;
+	add(result, tempas, result, arrayLength);
 	return 0;
 }
 
 static int fieldSub(const uint32_t *x, const uint32_t *y, const uint32_t *modulus, uint32_t *result){
-	if(sub(x, y, result, arrayLength)){ //add modulus if carry is set
-		uint32_t tempas[8];
-		setZero(tempas, 8);
-		add(result, modulus, tempas, arrayLength);
-		copy(tempas, result, arrayLength);
-	}
+	uint32_t tempas[8];
+	uint32_t mask = -sub(x, y, result, arrayLength); //add modulus if carry is set
+	uint8_t i;
+	for (i = 0; i < arrayLength; i++)
+		tempas[i] = modulus[i] & mask;
+	add(result, tempas, result, arrayLength);
 	return 0;
 }
 
+/*
+ * The limb size used by fieldMult() and fieldSquare() for 256 bit
+ * numbers. Hosts with a 64 x 64 -> 128 bit multiplier need only a
+ * quarter of the partial products. Define ECC_LIMB64 to 0 to force
+ * 32 bit limbs.
+ */
+#if !defined(ECC_LIMB64) && defined(__SIZEOF_INT128__)
+#define ECC_LIMB64 1
+#endif
+
+#if ECC_LIMB64
+__extension__ typedef unsigned __int128 ecc_uint128_t;
+
+static void load64(const uint32_t *x, uint64_t *out){
+	uint8_t i;
+	for (i = 0; i < arrayLength / 2; i++)
+		out[i] = (uint64_t)x[2 * i] | ((uint64_t)x[2 * i + 1] << 32);
+}
+
+static void store64(const uint64_t *in, uint32_t *result){
+	uint8_t i;
+	for (i = 0; i < arrayLength; i++){
+		result[2 * i] = (uint32_t)in[i];
+		result[2 * i + 1] = (uint32_t)(in[i] >> 32);
+	}
+}
+
+//product scanning over 4 limbs of 64 bit, the column sum is kept in acc + (hi << 128)
+static void fieldMult64(const uint32_t *x, const uint32_t *y, uint32_t *result){
+	uint64_t a[arrayLength / 2];
+	uint64_t b[arrayLength / 2];
+	uint64_t r[arrayLength];
+	ecc_uint128_t acc = 0, p;
+	uint64_t hi = 0;
+	int i, k;
+
+	load64(x, a);
+	load64(y, b);
+	for (k = 0; k < arrayLength - 1; k++){
+		for (i = k < arrayLength / 2 ? 0 : k - arrayLength / 2 + 1; i <= k && i < arrayLength / 2; i++){
+			p = (ecc_uint128_t)a[i] * b[k - i];
+			acc += p;
+			hi += acc < p;
+		}
+		r[k] = (uint64_t)acc;
+		acc = (acc >> 64) | ((ecc_uint128_t)hi << 64);
+		hi = 0;
+	}
+	r[arrayLength - 1] = (uint64_t)acc;
+	store64(r, result);
+}
+
+//like fieldMult64(), but the products a[i] * a[j] with i != j are only computed once
+static void fieldSquare64(const uint32_t *x, uint32_t *result){
+	uint64_t a[arrayLength / 2];
+	uint64_t r[arrayLength];
+	ecc_uint128_t acc = 0, cross, p;
+	uint64_t hi = 0, crosshi;
+	int i, k;
+
+	load64(x, a);
+	for (k = 0; k < arrayLength - 1; k++){
+		cross = 0;
+		crosshi = 0;
+		for (i = k < arrayLength / 2 ? 0 : k - arrayLength / 2 + 1; 2 * i < k; i++){
+			p = (ecc_uint128_t)a[i] * a[k - i];
+			cross += p;
+			crosshi += cross < p;
+		}
+		crosshi = (crosshi << 1) | (uint64_t)(cross >> 127);
+		cross <<= 1;
+		if (!(k & 1)){
+			p = (ecc_uint128_t)a[k / 2] * a[k / 2];
+			cross += p;
+			crosshi += cross < p;
+		}
+		acc += cross;
+		hi += crosshi + (acc < cross);
+		r[k] = (uint64_t)acc;
+		acc = (acc >> 64) | ((ecc_uint128_t)hi << 64);
+		hi = 0;
+	}
+	r[arrayLength - 1] = (uint64_t)acc;
+	store64(r, result);
+}
+#endif /* ECC_LIMB64 */
+
 //finite Field multiplication
-//32bit * 32bit = 64bit
+//product scanning (Comba): every column of partial products is summed
+//up in a 96 bit accumulator acc + (hi << 64) before it is stored
 static int fieldMult(const uint32_t *x, const uint32_t *y, uint32_t *result, uint8_t length){
-	uint32_t temp[length * 2];
-	setZero(temp, length * 2);
-	setZero(result, length * 2);
-	uint8_t k, n;
-	uint64_t l;
-	for (k = 0; k < length; k++){
-		for (n = 0; n < length; n++){ 
-			l = (uint64_t)x[n]*(uint64_t)y[k];
-			temp[n+k] = l&0xFFFFFFFF;
-			temp[n+k+1] = l>>32;
-			add(&temp[n+k], &result[n+k], &result[n+k], (length * 2) - (n + k));
-
-			setZero(temp, length * 2);
+	uint64_t acc = 0, p;
+	uint32_t hi = 0;
+	int i, k;
+
+#if ECC_LIMB64
+	if (length == arrayLength) {
+		fieldMult64(x, y, result);
+		return 0;
+	}
+#endif
+	for (k = 0; k < 2 * length - 1; k++){
+		for (i = k < length ? 0 : k - length + 1; i <= k && i < length; i++){
+			p = (uint64_t)x[i] * y[k - i];
+			acc += p;
+			hi += acc < p;
 		}
+		result[k] = (uint32_t)acc;
+		acc = (acc >> 32) | ((uint64_t)hi << 32);
+		hi = 0;
 	}
+	result[2 * length - 1] = (uint32_t)acc;
 	return 0;
 }
 
+//result = x * x with 2 * arrayLength words, about half the partial
+//products of fieldMult()
+static void fieldSquare(const uint32_t *x, uint32_t *result){
+#if ECC_LIMB64
+	fieldSquare64(x, result);
+#else
+	uint64_t acc = 0, cross, p;
+	uint32_t hi = 0, crosshi;
+	int i, k;
+
+	for (k = 0; k < 2 * arrayLength - 1; k++){
+		cross = 0;
+		crosshi = 0;
+		for (i = k < arrayLength ? 0 : k - arrayLength + 1; 2 * i < k; i++){
+			p = (uint64_t)x[i] * x[k - i];
+			cross += p;
+			crosshi += cross < p;
+		}
+		crosshi = (crosshi << 1) | (uint32_t)(cross >> 63);
+		cross <<= 1;
+		if (!(k & 1)){
+			p = (uint64_t)x[k / 2] * x[k / 2];
+			cross += p;
+			crosshi += cross < p;
+		}
+		acc += cross;
+		hi += crosshi + (acc < cross);
+		result[k] = (uint32_t)acc;
+		acc = (acc >> 32) | ((uint64_t)hi << 32);
+		hi = 0;
+	}
+	result[2 * arrayLength - 1] = (uint32_t)acc;
+#endif
+}
+
+//A = A mod p for A < 2 * p
+static void fieldReduceP(uint32_t *A){
+	uint32_t temp[8];
+	fieldSelect(A, temp, !sub(A, ecc_prime_m, temp, arrayLength));
+}
+
 //TODO: maximum:
 //fffffffe00000002fffffffe0000000100000001fffffffe00000001fffffffe00000001fffffffefffffffffffffffffffffffe000000000000000000000001_16
 static void fieldModP(uint32_t *A, const uint32_t *B)
@@ -245,10 +409,7 @@ static void fieldModP(uint32_t *A, const uint32_t *B)
 	for(n=7;n<8;n++) tempm[n]=B[n+6];
 	/* A=T+S1+S1+S2+S2+S3+S4-D1-D2-D3-D4 */ 
 	fieldSub(tempm2,tempm,ecc_prime_m,A);
-	if(isGreater(A, ecc_prime_m, arrayLength) >= 0){
-		fieldSub(A, ecc_prime_m, ecc_prime_m, tempm);
-		copy(tempm, A, arrayLength);
-	}
+	fieldReduceP(A);
 }
 
 /**
@@ -420,7 +581,7 @@ void static ec_double(const uint32_t *px, const uint32_t *py, uint32_t *Dx, uint
 		return;
 	}
 
-	fieldMult(px, px, tempD, arrayLength);
+	fieldSquare(px, tempD);
 	fieldModP(tempA, tempD);
 	setZero(tempB, 8);
 	tempB[0] = 0x00000001;
@@ -433,7 +594,7 @@ void static ec_double(const uint32_t *px, const uint32_t *py, uint32_t *Dx, uint
 	fieldMult(tempA, tempC, tempD, arrayLength); //tempB = lambda = (3*(qx^2-1))/(2*qy)
 	fieldModP(tempB, tempD);
 
-	fieldMult(tempB, tempB, tempD, arrayLength); //tempC = lambda^2
+	fieldSquare(tempB, tempD); //tempC = lambda^2
 	fieldModP(tempC, tempD);
 	fieldSub(tempC, px, ecc_prime_m, tempA); //lambda^2 - Px
 	fieldSub(tempA, px, ecc_prime_m, Dx); //lambda^2 - Px - Qx
@@ -477,7 +638,7 @@ void static ec_add(const uint32_t *px, const uint32_t *py, const uint32_t *qx, c
 	fieldMult(tempA, tempB, tempD, arrayLength); 
 	fieldModP(tempC, tempD); //tempC = lambda
 
-	fieldMult(tempC, tempC, tempD, arrayLength); //tempA = lambda^2
+	fieldSquare(tempC, tempD); //tempA = lambda^2
 	fieldModP(tempA, tempD);
 	fieldSub(tempA, px, ecc_prime_m, tempB); //lambda^2 - Px
 	fieldSub(tempB, qx, ecc_prime_m, Sx); //lambda^2 - Px - Qx
@@ -488,60 +649,484 @@ void static ec_add(const uint32_t *px, const uint32_t *py, const uint32_t *qx, c
 	fieldSub(tempC, qy, ecc_prime_m, Sy);
 }
 
-void ecc_ec_mult(const uint32_t *px, const uint32_t *py, const uint32_t *secret, uint32_t *resultx, uint32_t *resulty){
-	uint32_t Qx[8];
-	uint32_t Qy[8];
-	setZero(Qx, 8);
-	setZero(Qy, 8);
+/*
+ * The scalar multiplication works on points in Jacobian coordinates
+ * (X, Y, Z), which represent the affine point (X/Z^2, Y/Z^3). Z = 0
+ * denotes the point at infinity. This way, doubling and adding need
+ * no field inversion and only the final result has to be converted
+ * back with a single call to fieldInv().
+ */
+
+//result = x * y mod p
+static void fieldMultP(const uint32_t *x, const uint32_t *y, uint32_t *result){
+	uint32_t temp[16];
+	fieldMult(x, y, temp, arrayLength);
+	fieldModP(result, temp);
+}
+
+//result = x^2 mod p, x and result may overlap
+static void fieldSquareP(const uint32_t *x, uint32_t *result){
+	uint32_t temp[16];
+	fieldSquare(x, temp);
+	fieldModP(result, temp);
+}
+
+//result = x + y mod p, fully reduced to allow comparisons
+static void fieldAddP(const uint32_t *x, const uint32_t *y, uint32_t *result){
+	fieldAdd(x, y, ecc_prime_r, result);
+	fieldReduceP(result);
+}
+
+//(X, Y, Z) = 2 * (X, Y, Z), using a = -3 (dbl-2001-b)
+static void ec_double_jacobian(uint32_t *X, uint32_t *Y, uint32_t *Z){
+	uint32_t delta[8];
+	uint32_t gamma[8];
+	uint32_t beta[8];
+	uint32_t alpha[8];
+	uint32_t temp[8];
+
+	if(isZero(Z))
+		return;
+
+	fieldSquareP(Z, delta); //delta = Z^2
+	fieldSquareP(Y, gamma); //gamma = Y^2
+	fieldMultP(X, gamma, beta); //beta = X * gamma
+
+	fieldSub(X, delta, ecc_prime_m, temp);
+	fieldAddP(X, delta, alpha);
+	fieldMultP(temp, alpha, temp); //temp = (X - delta) * (X + delta)
+	fieldAddP(temp, temp, alpha);
+	fieldAddP(alpha, temp, alpha); //alpha = 3 * (X - delta) * (X + delta)
+
+	fieldMultP(Y, Z, temp);
+	fieldAddP(temp, temp, Z); //Z3 = 2 * Y * Z
+
+	fieldAddP(beta, beta, beta);
+	fieldAddP(beta, beta, beta); //beta = 4 * beta
+	fieldSquareP(alpha, X);
+	fieldSub(X, beta, ecc_prime_m, X);
+	fieldSub(X, beta, ecc_prime_m, X); //X3 = alpha^2 - 8 * beta
+
+	fieldSub(beta, X, ecc_prime_m, temp);
+	fieldMultP(alpha, temp, Y); //Y = alpha * (4 * beta - X3)
+	fieldSquareP(gamma, temp);
+	fieldAddP(temp, temp, temp);
+	fieldAddP(temp, temp, temp);
+	fieldAddP(temp, temp, temp); //temp = 8 * gamma^2
+	fieldSub(Y, temp, ecc_prime_m, Y); //Y3 = alpha * (4 * beta - X3) - 8 * gamma^2
+}
+
+//(X, Y, Z) = (X, Y, Z) + (qx, qy), where (qx, qy) is an affine point
+static void ec_add_jacobian(uint32_t *X, uint32_t *Y, uint32_t *Z, const uint32_t *qx, const uint32_t *qy){
+	uint32_t zz[8];
+	uint32_t u2[8];
+	uint32_t s2[8];
+	uint32_t h[8];
+	uint32_t r[8];
+	uint32_t temp[8];
+
+	if(isZero(qx) && isZero(qy))
+		return;
+
+	if(isZero(Z)){
+		copy(qx, X, arrayLength);
+		copy(qy, Y, arrayLength);
+		setZero(Z, 8);
+		Z[0] = 0x00000001;
+		return;
+	}
+
+	fieldSquareP(Z, zz); //zz = Z^2
+	fieldMultP(qx, zz, u2); //u2 = qx * Z^2
+	fieldMultP(Z, zz, temp);
+	fieldMultP(qy, temp, s2); //s2 = qy * Z^3
+	fieldSub(u2, X, ecc_prime_m, h); //h = u2 - X
+	fieldSub(s2, Y, ecc_prime_m, r); //r = s2 - Y
+
+	if(isZero(h)){
+		if(isZero(r)){
+			ec_double_jacobian(X, Y, Z);
+		} else {
+			setZero(Z, 8);
+		}
+		return;
+	}
+
+	fieldMultP(Z, h, Z); //Z3 = Z * h
+	fieldSquareP(h, zz); //zz = h^2
+	fieldMultP(h, zz, s2); //s2 = h^3
+	fieldMultP(X, zz, u2); //u2 = X * h^2
+
+	fieldSquareP(r, X);
+	fieldSub(X, s2, ecc_prime_m, X);
+	fieldSub(X, u2, ecc_prime_m, X);
+	fieldSub(X, u2, ecc_prime_m, X); //X3 = r^2 - h^3 - 2 * X * h^2
+
+	fieldSub(u2, X, ecc_prime_m, temp);
+	fieldMultP(r, temp, temp); //temp = r * (X * h^2 - X3)
+	fieldMultP(Y, s2, s2);
+	fieldSub(temp, s2, ecc_prime_m, Y); //Y3 = r * (X * h^2 - X3) - Y * h^3
+}
+
+//converts (X, Y, Z) back to affine coordinates
+static void ec_jacobian_to_affine(const uint32_t *X, const uint32_t *Y, const uint32_t *Z, uint32_t *resultx, uint32_t *resulty){
+	uint32_t zinv[8];
+	uint32_t zinv2[8];
+
+	if(isZero(Z)){
+		setZero(resultx, 8);
+		setZero(resulty, 8);
+		return;
+	}
+
+	fieldInv(Z, ecc_prime_m, ecc_prime_r, zinv);
+	fieldSquareP(zinv, zinv2);
+	fieldMultP(X, zinv2, resultx); //x = X / Z^2
+	fieldMultP(zinv, zinv2, zinv2);
+	fieldMultP(Y, zinv2, resulty); //y = Y / Z^3
+}
+
+//X = X * Z^2, Y = Y * Z^3
+static void ec_apply_z(uint32_t *X, uint32_t *Y, const uint32_t *Z){
+	uint32_t t[8];
+
+	fieldSquareP(Z, t);
+	fieldMultP(X, t, X);
+	fieldMultP(t, Z, t);
+	fieldMultP(Y, t, Y);
+}
+
+/*
+ * Co-Z addition: takes P = (X1, Y1) and Q = (X2, Y2) that share the
+ * same Z and leaves P + Q in (X2, Y2) and P in (X1, Y1), both with the
+ * new common Z.
+ */
+static void ec_xycz_add(uint32_t *X1, uint32_t *Y1, uint32_t *X2, uint32_t *Y2){
+	uint32_t t5[8];
+
+	fieldSub(X2, X1, ecc_prime_m, t5);
+	fieldSquareP(t5, t5); //t5 = (x2 - x1)^2 = A
+	fieldMultP(X1, t5, X1); //X1 = x1 * A = B
+	fieldMultP(X2, t5, X2); //X2 = x2 * A = C
+	fieldSub(Y2, Y1, ecc_prime_m, Y2);
+	fieldSquareP(Y2, t5); //t5 = (y2 - y1)^2 = D
+
+	fieldSub(t5, X1, ecc_prime_m, t5);
+	fieldSub(t5, X2, ecc_prime_m, t5); //t5 = D - B - C = x3
+	fieldSub(X2, X1, ecc_prime_m, X2);
+	fieldMultP(Y1, X2, Y1); //Y1 = y1 * (C - B)
+	fieldSub(X1, t5, ecc_prime_m, X2);
+	fieldMultP(Y2, X2, Y2); //Y2 = (y2 - y1) * (B - x3)
+	fieldSub(Y2, Y1, ecc_prime_m, Y2); //y3
+
+	copy(t5, X2, arrayLength);
+}
+
+/*
+ * Conjugate co-Z addition: like ec_xycz_add(), but leaves P - Q in
+ * (X1, Y1).
+ */
+static void ec_xycz_addc(uint32_t *X1, uint32_t *Y1, uint32_t *X2, uint32_t *Y2){
+	uint32_t t5[8];
+	uint32_t t6[8];
+	uint32_t t7[8];
+
+	fieldSub(X2, X1, ecc_prime_m, t5);
+	fieldSquareP(t5, t5); //t5 = (x2 - x1)^2 = A
+	fieldMultP(X1, t5, X1); //X1 = x1 * A = B
+	fieldMultP(X2, t5, X2); //X2 = x2 * A = C
+	fieldAddP(Y2, Y1, t5); //t5 = y2 + y1
+	fieldSub(Y2, Y1, ecc_prime_m, Y2); //Y2 = y2 - y1
+
+	fieldSub(X2, X1, ecc_prime_m, t6);
+	fieldMultP(Y1, t6, Y1); //Y1 = y1 * (C - B) = E
+	fieldAddP(X1, X2, t6); //t6 = B + C
+	fieldSquareP(Y2, X2);
+	fieldSub(X2, t6, ecc_prime_m, X2); //X2 = (y2 - y1)^2 - (B + C) = x3
+
+	fieldSub(X1, X2, ecc_prime_m, t7);
+	fieldMultP(Y2, t7, Y2);
+	fieldSub(Y2, Y1, ecc_prime_m, Y2); //Y2 = (y2 - y1) * (B - x3) - E = y3
+
+	fieldSquareP(t5, t7);
+	fieldSub(t7, t6, ecc_prime_m, t7); //t7 = (y2 + y1)^2 - (B + C) = x3'
+	fieldSub(t7, X1, ecc_prime_m, t6);
+	fieldMultP(t6, t5, t6);
+	fieldSub(t6, Y1, ecc_prime_m, Y1); //Y1 = (y2 + y1) * (x3' - B) - E = y3'
+
+	copy(t7, X1, arrayLength);
+}
+
+//B = A^(p - 2) = 1 / A mod p, with a running time independent of A
+static void fieldInvP(const uint32_t *A, uint32_t *B){
+	static const uint32_t exponent[8] = {0xfffffffd, 0xffffffff, 0xffffffff, 0x00000000,
+					     0x00000000, 0x00000000, 0x00000001, 0xffffffff};
+	uint32_t result[8];
+	int i;
+
+	copy(A, result, arrayLength);
+	for (i = 254; i >= 0; i--){
+		fieldSquareP(result, result);
+		if (exponent[i / 32] & ((uint32_t)1 << (i % 32)))
+			fieldMultP(result, A, result);
+	}
+	copy(result, B, arrayLength);
+}
+
+void ecc_ec_mult_ladder(const uint32_t *px, const uint32_t *py, const uint32_t *secret, uint32_t *resultx, uint32_t *resulty){
+	uint32_t Rx[2][8];
+	uint32_t Ry[2][8];
+	uint32_t z[8];
+	uint32_t zneg[8];
+	uint32_t k0[9];
+	uint32_t k1[9];
+	uint32_t b;
+	int i;
+
+	//k = 1, n - 2 and n - 1 run into the point at infinity in the last
+	//step of the ladder, these are detected by (k - 2) mod 2^256 >= n - 4
+	//and use the generic multiplication
+	setZero(z, 8);
+	z[0] = 2;
+	sub(secret, z, k0, arrayLength);
+	if (!sub(k0, ecc_order_minus_four, k1, arrayLength)) {
+		ecc_ec_mult(px, py, secret, resultx, resulty);
+		return;
+	}
+
+	//k + n or k + 2n, whichever has bit 256 set, fixes the number of
+	//ladder steps and does not change the result
+	copy(secret, k0, arrayLength);
+	k0[8] = 0;
+	add(k0, ecc_order_m, k0, 9);
+	add(k0, ecc_order_m, k1, 9);
+	b = k0[8] & 1;
+	fieldSelect(k1, k0, b);
+	k1[8] = 1;
+
+	//R0 = P, R1 = 2P with the same Z
+	copy(px, Rx[1], arrayLength);
+	copy(py, Ry[1], arrayLength);
+	z[0] = 1;
+	ec_double_jacobian(Rx[1], Ry[1], z);
+	copy(px, Rx[0], arrayLength);
+	copy(py, Ry[0], arrayLength);
+	ec_apply_z(Rx[0], Ry[0], z);
+
+	//R[1 - b] = R[0] + R[1], R[b] = 2 * R[b]
+	for (i = 255; i > 0; i--){
+		b = !((k1[i / 32] >> (i % 32)) & 1);
+		fieldSwap(Rx[0], Rx[1], b);
+		fieldSwap(Ry[0], Ry[1], b);
+		ec_xycz_addc(Rx[1], Ry[1], Rx[0], Ry[0]);
+		ec_xycz_add(Rx[0], Ry[0], Rx[1], Ry[1]);
+		fieldSwap(Rx[0], Rx[1], b);
+		fieldSwap(Ry[0], Ry[1], b);
+	}
+
+	b = !(k1[0] & 1);
+	fieldSwap(Rx[0], Rx[1], b);
+	fieldSwap(Ry[0], Ry[1], b);
+	ec_xycz_addc(Rx[1], Ry[1], Rx[0], Ry[0]);
+
+	//1 / Z = Xb * yP / (xP * Yb * (X1 - X0)) with b being the last bit
+	fieldSub(Rx[1], Rx[0], ecc_prime_m, z);
+	fieldSub(Rx[0], Rx[1], ecc_prime_m, zneg);
+	fieldSelect(z, zneg, b);
+	fieldMultP(z, Ry[1], z);
+	fieldMultP(z, px, z);
+	fieldInvP(z, z);
+	fieldMultP(z, py, z);
+	fieldMultP(z, Rx[1], z);
+
+	ec_xycz_add(Rx[0], Ry[0], Rx[1], Ry[1]);
+	fieldSwap(Rx[0], Rx[1], b);
+	fieldSwap(Ry[0], Ry[1], b);
+
+	ec_apply_z(Rx[0], Ry[0], z);
+	copy(Rx[0], resultx, arrayLength);
+	copy(Ry[0], resulty, arrayLength);
+}
 
-	uint32_t tempx[8];
-	uint32_t tempy[8];
+void ecc_ec_mult(const uint32_t *px, const uint32_t *py, const uint32_t *secret, uint32_t *resultx, uint32_t *resulty){
+	uint32_t X[8];
+	uint32_t Y[8];
+	uint32_t Z[8];
+	setZero(X, 8);
+	setZero(Y, 8);
+	setZero(Z, 8);
 
 	int i;
 	for (i = 256;i--;){
-		ec_double(Qx, Qy, tempx, tempy);
-		copy(tempx, Qx,arrayLength);
-		copy(tempy, Qy,arrayLength);
+		ec_double_jacobian(X, Y, Z);
 		if (((secret[i / 32]) & ((uint32_t)1 << (i % 32)))) {
-			ec_add(Qx, Qy, px, py, tempx, tempy); //eccAdd
-			copy(tempx, Qx,arrayLength);
-			copy(tempy, Qy,arrayLength);
+			ec_add_jacobian(X, Y, Z, px, py);
 		}
 	}
-	copy(Qx, resultx,arrayLength);
-	copy(Qy, resulty,arrayLength);
+	ec_jacobian_to_affine(X, Y, Z, resultx, resulty);
+}
+
+#if ECC_COMB_TEETH > 0
+/*
+ * Fixed-base comb multiplication (Lim-Lee): the scalar is written as
+ * ECC_COMB_TEETH rows of ECC_COMB_SPACING bits. Column i selects the
+ * table entry that combines bit i of every row, so the whole scalar
+ * is processed with ECC_COMB_SPACING doublings and additions.
+ */
+void ecc_ec_mult_base(const uint32_t *secret, uint32_t *resultx, uint32_t *resulty){
+	uint32_t X[8];
+	uint32_t Y[8];
+	uint32_t Z[8];
+	int i, j, bit;
+	unsigned int idx;
+	setZero(X, 8);
+	setZero(Y, 8);
+	setZero(Z, 8);
+
+	for (i = ECC_COMB_SPACING; i--;){
+		ec_double_jacobian(X, Y, Z);
+		idx = 0;
+		for (j = ECC_COMB_TEETH; j--;){
+			bit = j * ECC_COMB_SPACING + i;
+			idx <<= 1;
+			if (bit < 256 && (secret[bit / 32] & ((uint32_t)1 << (bit % 32))))
+				idx |= 1;
+		}
+		if (idx)
+			ec_add_jacobian(X, Y, Z, ecc_comb_table[idx - 1][0], ecc_comb_table[idx - 1][1]);
+	}
+	ec_jacobian_to_affine(X, Y, Z, resultx, resulty);
+}
+#else /* ECC_COMB_TEETH > 0 */
+void ecc_ec_mult_base(const uint32_t *secret, uint32_t *resultx, uint32_t *resulty){
+	ecc_ec_mult(ecc_g_point_x, ecc_g_point_y, secret, resultx, resulty);
+}
+#endif /* ECC_COMB_TEETH > 0 */
+
+/* width of the NAF used by ec_mult_joint() */
+#define ECC_WNAF_WIDTH 4
+#define ECC_WNAF_POINTS (1 << (ECC_WNAF_WIDTH - 2))
+
+/*
+ * Computes the width-w non-adjacent form of the 256 bit scalar k. Each
+ * digit is either zero or odd with an absolute value below 2^(w-1),
+ * and of any w consecutive digits at most one is non-zero. Returns
+ * the number of digits, which is at most 257.
+ */
+static int ec_wnaf(const uint32_t *k, int8_t *naf){
+	uint32_t d[9];
+	uint32_t z[9];
+	int i, len = 0, digit;
+
+	copy(k, d, arrayLength);
+	d[8] = 0;
+	setZero(z, 9);
+
+	while (!isZero(d) || d[8]) {
+		digit = 0;
+		if (d[0] & 1) {
+			digit = d[0] & ((1 << ECC_WNAF_WIDTH) - 1);
+			if (digit >= (1 << (ECC_WNAF_WIDTH - 1)))
+				digit -= 1 << ECC_WNAF_WIDTH;
+			if (digit > 0) {
+				z[0] = digit;
+				sub(d, z, d, 9);
+			} else {
+				z[0] = -digit;
+				add(d, z, d, 9);
+			}
+		}
+		naf[len++] = digit;
+
+		for (i = 0; i < 8; i++)
+			d[i] = (d[i] >> 1) | (d[i + 1] << 31);
+		d[8] >>= 1;
+	}
+	return len;
+}
+
+//points[i] = (2 * i + 1) * (px, py) in affine coordinates
+static void ec_odd_multiples(const uint32_t *px, const uint32_t *py, uint32_t points[ECC_WNAF_POINTS][2][8]){
+	uint32_t twox[8];
+	uint32_t twoy[8];
+	int i;
+
+	copy(px, points[0][0], arrayLength);
+	copy(py, points[0][1], arrayLength);
+	ec_double(px, py, twox, twoy);
+	for (i = 1; i < ECC_WNAF_POINTS; i++)
+		ec_add(points[i - 1][0], points[i - 1][1], twox, twoy, points[i][0], points[i][1]);
+}
+
+//(X, Y, Z) = (X, Y, Z) + digit * P, where points holds the odd multiples of P
+static void ec_add_digit(uint32_t *X, uint32_t *Y, uint32_t *Z, uint32_t points[ECC_WNAF_POINTS][2][8], int digit){
+	uint32_t negy[8];
+
+	if (digit > 0) {
+		ec_add_jacobian(X, Y, Z, points[digit / 2][0], points[digit / 2][1]);
+	} else if (digit < 0) {
+		fieldSub(ecc_prime_m, points[-digit / 2][1], ecc_prime_m, negy);
+		ec_add_jacobian(X, Y, Z, points[-digit / 2][0], negy);
+	}
+}
+
+/*
+ * Computes u1 * G + u2 * (qx, qy) with a single chain of doublings
+ * (Straus-Shamir trick) over the wNAF representations of both
+ * scalars.
+ */
+static void ec_mult_joint(const uint32_t *u1, const uint32_t *u2, const uint32_t *qx, const uint32_t *qy, uint32_t *resultx, uint32_t *resulty){
+	uint32_t gpoints[ECC_WNAF_POINTS][2][8];
+	uint32_t qpoints[ECC_WNAF_POINTS][2][8];
+	int8_t naf1[257];
+	int8_t naf2[257];
+	uint32_t X[8];
+	uint32_t Y[8];
+	uint32_t Z[8];
+	int i, len1, len2;
+
+	ec_odd_multiples(ecc_g_point_x, ecc_g_point_y, gpoints);
+	ec_odd_multiples(qx, qy, qpoints);
+	len1 = ec_wnaf(u1, naf1);
+	len2 = ec_wnaf(u2, naf2);
+
+	setZero(X, 8);
+	setZero(Y, 8);
+	setZero(Z, 8);
+	for (i = len1 > len2 ? len1 : len2; i--;){
+		ec_double_jacobian(X, Y, Z);
+		if (i < len1)
+			ec_add_digit(X, Y, Z, gpoints, naf1[i]);
+		if (i < len2)
+			ec_add_digit(X, Y, Z, qpoints, naf2[i]);
+	}
+	ec_jacobian_to_affine(X, Y, Z, resultx, resulty);
 }
 
 /**
- * Calculate the ecdsa signature.
- *
- * For a description of this algorithm see
- * https://en.wikipedia.org/wiki/Elliptic_Curve_DSA#Signature_generation_algorithm
+ * Calculate the part of an ecdsa signature that does not depend on
+ * the key and the hash, so it can be done ahead of time.
  *
  * input:
- *  d: private key on the curve secp256r1 (32 bytes)
- *  e: hash to sign (32 bytes)
  *  k: random data, this must be changed for every signature (32 bytes)
  *
  * output:
  *  r: r value of the signature (36 bytes)
- *  s: s value of the signature (36 bytes)
+ *  k_inv: k^{-1} mod n (32 bytes)
  *
  * return:
  *   0: everything is ok
  *  -1: can not create signature, try again with different k.
  */
-int ecc_ecdsa_sign(const uint32_t *d, const uint32_t *e, const uint32_t *k, uint32_t *r, uint32_t *s)
+int ecc_ecdsa_precompute(const uint32_t *k, uint32_t *r, uint32_t *k_inv)
 {
-	uint32_t tmp1[16];
-	uint32_t tmp2[9];
-	uint32_t tmp3[9];
+	uint32_t tmp[8];
 
 	if (isZero(k))
 		return -1;
 
 	// 4. Calculate the curve point (x_1, y_1) = k * G.
-	ecc_ec_mult(ecc_g_point_x, ecc_g_point_y, k, r, tmp1);
+	ecc_ec_mult_base(k, r, tmp);
 
 	// 5. Calculate r = x_1 \pmod{n}.
 	fieldModO(r, r, 8);
@@ -550,6 +1135,35 @@ int ecc_ecdsa_sign(const uint32_t *d, const uint32_t *e, const uint32_t *k, uint
 	if (isZero(r))
 		return -1;
 
+	// 6. k^{-1}
+	fieldInv(k, ecc_order_m, ecc_order_r, k_inv);
+
+	return 0;
+}
+
+/**
+ * Calculate an ecdsa signature with the r value and k^{-1} from
+ * ecc_ecdsa_precompute(). Both must be used for one signature only.
+ *
+ * input:
+ *  d: private key on the curve secp256r1 (32 bytes)
+ *  e: hash to sign (32 bytes)
+ *  r: r value of the signature (32 bytes)
+ *  k_inv: k^{-1} mod n (32 bytes)
+ *
+ * output:
+ *  s: s value of the signature (36 bytes)
+ *
+ * return:
+ *   0: everything is ok
+ *  -1: can not create signature, try again with different k.
+ */
+int ecc_ecdsa_sign_precomputed(const uint32_t *d, const uint32_t *e, const uint32_t *r, const uint32_t *k_inv, uint32_t *s)
+{
+	uint32_t tmp1[16];
+	uint32_t tmp2[9];
+	uint32_t tmp3[9];
+
 	// 6. Calculate s = k^{-1}(z + r d_A) \pmod{n}.
 	// 6. r * d
 	fieldMult(r, d, tmp1, arrayLength);
@@ -559,11 +1173,8 @@ int ecc_ecdsa_sign(const uint32_t *d, const uint32_t *e, const uint32_t *k, uint
 	tmp1[8] = add(e, tmp2, tmp1, 8);
 	fieldModO(tmp1, tmp3, 9);
 
-	// 6. k^{-1}
-	fieldInv(k, ecc_order_m, ecc_order_r, tmp2);
-
 	// 6. (k^{-1}) (z + (r d))
-	fieldMult(tmp2, tmp3, tmp1, arrayLength);
+	fieldMult(k_inv, tmp3, tmp1, arrayLength);
 	fieldModO(tmp1, s, 16);
 
 	// 6. If s = 0, go back to step 3.
@@ -573,6 +1184,35 @@ int ecc_ecdsa_sign(const uint32_t *d, const uint32_t *e, const uint32_t *k, uint
 	return 0;
 }
 
+/**
+ * Calculate the ecdsa signature.
+ *
+ * For a description of this algorithm see
+ * https://en.wikipedia.org/wiki/Elliptic_Curve_DSA#Signature_generation_algorithm
+ *
+ * input:
+ *  d: private key on the curve secp256r1 (32 bytes)
+ *  e: hash to sign (32 bytes)
+ *  k: random data, this must be changed for every signature (32 bytes)
+ *
+ * output:
+ *  r: r value of the signature (36 bytes)
+ *  s: s value of the signature (36 bytes)
+ *
+ * return:
+ *   0: everything is ok
+ *  -1: can not create signature, try again with different k.
+ */
+int ecc_ecdsa_sign(const uint32_t *d, const uint32_t *e, const uint32_t *k, uint32_t *r, uint32_t *s)
+{
+	uint32_t k_inv[8];
+
+	if (ecc_ecdsa_precompute(k, r, k_inv))
+		return -1;
+
+	return ecc_ecdsa_sign_precomputed(d, e, r, k_inv, s);
+}
+
 /**
  * Verifies a ecdsa signature.
  *
@@ -596,12 +1236,8 @@ int ecc_ecdsa_validate(const uint32_t *x, const uint32_t *y, const uint32_t *e,
 	uint32_t tmp[16];
 	uint32_t u1[9];
 	uint32_t u2[9];
-	uint32_t tmp1_x[8];
-	uint32_t tmp1_y[8];
-	uint32_t tmp2_x[8];
-	uint32_t tmp2_y[8];
-	uint32_t tmp3_x[8];
-	uint32_t tmp3_y[8];
+	uint32_t tmp_x[8];
+	uint32_t tmp_y[8];
 
 	if (isZero(r) || isZero(s))
 		return -1;
@@ -618,17 +1254,9 @@ int ecc_ecdsa_validate(const uint32_t *x, const uint32_t *y, const uint32_t *e,
 	fieldModO(tmp, u2, 16);
 
 	// 5. Calculate the curve point (x_1, y_1) = u_1 * G + u_2 * Q_A.
-	// tmp1 = u_1 * G
-	ecc_ec_mult(ecc_g_point_x, ecc_g_point_y, u1, tmp1_x, tmp1_y);
-
-	// tmp2 = u_2 * Q_A
-	ecc_ec_mult(x, y, u2, tmp2_x, tmp2_y);
+	ec_mult_joint(u1, u2, x, y, tmp_x, tmp_y);
 
-	// tmp3 = tmp1 + tmp2
-	ec_add(tmp1_x, tmp1_y, tmp2_x, tmp2_y, tmp3_x, tmp3_y);
-	// TODO: this u_1 * G + u_2 * Q_A  could be optimiced with Straus's algorithm.
-
-	return isSame(tmp3_x, r, arrayLength) ? 0 : -1;
+	return isSame(tmp_x, r, arrayLength) ? 0 : -1;
 }
 
 int ecc_is_valid_key(const uint32_t * priv_key)
@@ -661,6 +1289,10 @@ int ecc_fieldMult(const uint32_t *x, const uint32_t *y, uint32_t *result, uint8_
 {
 	return fieldMult(x, y, result, length);
 }
+void ecc_fieldSquare(const uint32_t *x, uint32_t *result)
+{
+	fieldSquare(x, result);
+}
 void ecc_fieldModP(uint32_t *A, const uint32_t *B)
 {
 	fieldModP(A, B);
@@ -43,19 +43,39 @@
 extern const uint32_t ecc_g_point_x[8];
 extern const uint32_t ecc_g_point_y[8];
 
+#ifndef ECC_COMB_TEETH
+/* Number of teeth of the fixed-base comb that is used for
+ * multiplications with the generator. 4, 6 and 8 teeth need a
+ * constant table of 960, 4032 and 16320 bytes, 0 disables the table. */
+#ifdef WITH_CONTIKI
+#define ECC_COMB_TEETH 4
+#else
+#define ECC_COMB_TEETH 6
+#endif
+#endif
+
 //ec Functions
 void ecc_ec_mult(const uint32_t *px, const uint32_t *py, const uint32_t *secret, uint32_t *resultx, uint32_t *resulty);
+//result = secret * G, faster than ecc_ec_mult() with ecc_g_point_x/y
+void ecc_ec_mult_base(const uint32_t *secret, uint32_t *resultx, uint32_t *resulty);
+
+//result = secret * (px, py) with a co-Z Montgomery ladder, the
+//sequence of operations does not depend on secret
+void ecc_ec_mult_ladder(const uint32_t *px, const uint32_t *py, const uint32_t *secret, uint32_t *resultx, uint32_t *resulty);
 
 static inline void ecc_ecdh(const uint32_t *px, const uint32_t *py, const uint32_t *secret, uint32_t *resultx, uint32_t *resulty) {
-	ecc_ec_mult(px, py, secret, resultx, resulty);
+	ecc_ec_mult_ladder(px, py, secret, resultx, resulty);
 }
 int ecc_ecdsa_validate(const uint32_t *x, const uint32_t *y, const uint32_t *e, const uint32_t *r, const uint32_t *s);
 int ecc_ecdsa_sign(const uint32_t *d, const uint32_t *e, const uint32_t *k, uint32_t *r, uint32_t *s);
+//ecc_ecdsa_sign() in two steps, the first one only depends on k
+int ecc_ecdsa_precompute(const uint32_t *k, uint32_t *r, uint32_t *k_inv);
+int ecc_ecdsa_sign_precomputed(const uint32_t *d, const uint32_t *e, const uint32_t *r, const uint32_t *k_inv, uint32_t *s);
 
 int ecc_is_valid_key(const uint32_t * priv_key);
 static inline void ecc_gen_pub_key(const uint32_t *priv_key, uint32_t *pub_x, uint32_t *pub_y)
 {
-	ecc_ec_mult(ecc_g_point_x, ecc_g_point_y, priv_key, pub_x, pub_y);
+	ecc_ec_mult_base(priv_key, pub_x, pub_y);
 }
 
 #ifdef TEST_INCLUDE
@@ -71,6 +91,7 @@ uint32_t ecc_sub( const uint32_t *x, const uint32_t *y, uint32_t *result, uint8_
 int ecc_fieldAdd(const uint32_t *x, const uint32_t *y, const uint32_t *reducer, uint32_t *result);
 int ecc_fieldSub(const uint32_t *x, const uint32_t *y, const uint32_t *modulus, uint32_t *result);
 int ecc_fieldMult(const uint32_t *x, const uint32_t *y, uint32_t *result, uint8_t length);
+void ecc_fieldSquare(const uint32_t *x, uint32_t *result);
 void ecc_fieldModP(uint32_t *A, const uint32_t *B);
 void ecc_fieldModO(const uint32_t *A, uint32_t *result, uint8_t length);
 void ecc_fieldInv(const uint32_t *A, const uint32_t *modulus, const uint32_t *reducer, uint32_t *B);
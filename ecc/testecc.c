@@ -43,6 +43,9 @@
 
 #include "ecc.h"
 #include "test_helper.h"
+#if ECC_COMB_TEETH > 0
+#include "ecc_comb.h"
+#endif
 
 #ifdef CONTIKI
 #include "contiki.h"
@@ -142,6 +145,123 @@ void multTest(){
 	assert(ecc_isSame(tempy, resultMulty, arrayLength));
 }
 
+//reference implementation of ecc_ec_mult() in affine coordinates
+static void multAffine(const uint32_t *px, const uint32_t *py, const uint32_t *k, uint32_t *rx, uint32_t *ry){
+	uint32_t tempx[8];
+	uint32_t tempy[8];
+	int i;
+
+	ecc_setZero(rx, 8);
+	ecc_setZero(ry, 8);
+	for (i = 256; i--;){
+		ecc_ec_double(rx, ry, tempx, tempy);
+		ecc_copy(tempx, rx, arrayLength);
+		ecc_copy(tempy, ry, arrayLength);
+		if (k[i / 32] & ((uint32_t)1 << (i % 32))) {
+			ecc_ec_add(rx, ry, px, py, tempx, tempy);
+			ecc_copy(tempx, rx, arrayLength);
+			ecc_copy(tempy, ry, arrayLength);
+		}
+	}
+}
+
+void multJacobianTest(){
+	uint32_t tempx[8];
+	uint32_t tempy[8];
+	uint32_t refx[8];
+	uint32_t refy[8];
+	uint32_t k[8];
+	int i;
+
+	//k = 1 and k = 2 hit the special cases of the point addition
+	ecc_setZero(k, 8);
+	k[0] = 1;
+	ecc_ec_mult(Sx, Sy, k, tempx, tempy);
+	assert(ecc_isSame(tempx, Sx, arrayLength));
+	assert(ecc_isSame(tempy, Sy, arrayLength));
+	k[0] = 2;
+	ecc_ec_mult(Sx, Sy, k, tempx, tempy);
+	assert(ecc_isSame(tempx, resultDoublex, arrayLength));
+	assert(ecc_isSame(tempy, resultDoubley, arrayLength));
+
+	for (i = 0; i < 8; i++) {
+		ecc_setRandom(k);
+		ecc_ec_mult(BasePointx, BasePointy, k, tempx, tempy);
+		multAffine(BasePointx, BasePointy, k, refx, refy);
+		assert(ecc_isSame(tempx, refx, arrayLength));
+		assert(ecc_isSame(tempy, refy, arrayLength));
+	}
+}
+
+void multBaseTest(){
+	uint32_t tempx[8];
+	uint32_t tempy[8];
+	uint32_t refx[8];
+	uint32_t refy[8];
+	uint32_t k[8];
+	int i;
+
+#if ECC_COMB_TEETH > 0
+	//every table entry j is the multiple of G with bit i * spacing set for each bit i of j
+	int j, bit;
+	for (j = 1; j < (1 << ECC_COMB_TEETH); j++) {
+		ecc_setZero(k, 8);
+		for (i = 0; i < ECC_COMB_TEETH; i++) {
+			bit = i * ECC_COMB_SPACING;
+			if ((j & (1 << i)) && bit < 256)
+				k[bit / 32] |= (uint32_t)1 << (bit % 32);
+		}
+		ecc_ec_mult(BasePointx, BasePointy, k, tempx, tempy);
+		assert(ecc_isSame(tempx, ecc_comb_table[j - 1][0], arrayLength));
+		assert(ecc_isSame(tempy, ecc_comb_table[j - 1][1], arrayLength));
+	}
+#endif /* ECC_COMB_TEETH > 0 */
+
+	for (i = 0; i < 8; i++) {
+		ecc_setRandom(k);
+		ecc_ec_mult_base(k, tempx, tempy);
+		ecc_ec_mult(BasePointx, BasePointy, k, refx, refy);
+		assert(ecc_isSame(tempx, refx, arrayLength));
+		assert(ecc_isSame(tempy, refy, arrayLength));
+	}
+}
+
+void multLadderTest(){
+	//n - 1, the largest valid secret
+	static const uint32_t orderMinusOne[8] = {0xFC632550, 0xF3B9CAC2, 0xA7179E84, 0xBCE6FAAD,
+						  0xFFFFFFFF, 0xFFFFFFFF, 0x00000000, 0xFFFFFFFF};
+	uint32_t tempx[8];
+	uint32_t tempy[8];
+	uint32_t refx[8];
+	uint32_t refy[8];
+	uint32_t k[8];
+	int i;
+
+	ecc_setZero(k, 8);
+	k[0] = 1;
+	ecc_ec_mult_ladder(Sx, Sy, k, tempx, tempy);
+	assert(ecc_isSame(tempx, Sx, arrayLength));
+	assert(ecc_isSame(tempy, Sy, arrayLength));
+	k[0] = 2;
+	ecc_ec_mult_ladder(Sx, Sy, k, tempx, tempy);
+	assert(ecc_isSame(tempx, resultDoublex, arrayLength));
+	assert(ecc_isSame(tempy, resultDoubley, arrayLength));
+
+	//(n - 1) * G = -G
+	ecc_ec_mult_ladder(BasePointx, BasePointy, orderMinusOne, tempx, tempy);
+	ecc_ec_mult(BasePointx, BasePointy, orderMinusOne, refx, refy);
+	assert(ecc_isSame(tempx, refx, arrayLength));
+	assert(ecc_isSame(tempy, refy, arrayLength));
+
+	for (i = 0; i < 8; i++) {
+		ecc_setRandom(k);
+		ecc_ec_mult_ladder(Sx, Sy, k, tempx, tempy);
+		ecc_ec_mult(Sx, Sy, k, refx, refy);
+		assert(ecc_isSame(tempx, refx, arrayLength));
+		assert(ecc_isSame(tempy, refy, arrayLength));
+	}
+}
+
 void eccdhTest(){
 	uint32_t tempx[8];
 	uint32_t tempy[8];
@@ -160,8 +280,8 @@ void eccdhTest(){
 	ecc_ec_mult(BasePointx, BasePointy, secretA, tempx, tempy);
 	ecc_ec_mult(BasePointx, BasePointy, secretB, tempBx1, tempBy1);
 	//public key exchange
-	ecc_ec_mult(tempBx1, tempBy1, secretA, tempAx2, tempAy2);
-	ecc_ec_mult(tempx, tempy, secretB, tempBx2, tempBy2);
+	ecc_ecdh(tempBx1, tempBy1, secretA, tempAx2, tempAy2);
+	ecc_ecdh(tempx, tempy, secretB, tempBx2, tempBy2);
 	assert(ecc_isSame(tempAx2, tempBx2, arrayLength));
 	assert(ecc_isSame(tempAy2, tempBy2, arrayLength));
 
@@ -173,6 +293,10 @@ void ecdsaTest() {
 	uint32_t tempy[9];
 	uint32_t pub_x[8];
 	uint32_t pub_y[8];
+	uint32_t secret[8];
+	uint32_t hash[8];
+	uint32_t rand[8];
+	int i;
 
 	ecc_ec_mult(BasePointx, BasePointy, ecdsaTestSecret, pub_x, pub_y);
 
@@ -192,6 +316,35 @@ void ecdsaTest() {
 
 	ret = ecc_ecdsa_validate(pub_x, pub_y, ecdsaTestMessage, tempx, tempy);
 	assert(!ret);
+
+	//the signature in two steps must be the same
+	ret = ecc_ecdsa_precompute(ecdsaTestRand1, tempx, rand);
+	assert(ret == 0);
+	assert(ecc_isSame(tempx, ecdsaTestresultR1, arrayLength));
+	ret = ecc_ecdsa_sign_precomputed(ecdsaTestSecret, ecdsaTestMessage, tempx, rand, tempy);
+	assert(ret == 0);
+	assert(ecc_isSame(tempy, ecdsaTestresultS1, arrayLength));
+
+	//a modified hash must not match the signature
+	ecc_copy(ecdsaTestMessage, hash, arrayLength);
+	hash[0] ^= 1;
+	ret = ecc_ecdsa_validate(pub_x, pub_y, hash, tempx, tempy);
+	assert(ret);
+
+	//random keys, hashes and nonces
+	for (i = 0; i < 8; i++) {
+		ecc_setRandom(secret);
+		ecc_setRandom(hash);
+		ecc_setRandom(rand);
+		ecc_gen_pub_key(secret, pub_x, pub_y);
+		if (ecc_ecdsa_sign(secret, hash, rand, tempx, tempy))
+			continue;
+		ret = ecc_ecdsa_validate(pub_x, pub_y, hash, tempx, tempy);
+		assert(!ret);
+		tempy[3] ^= 0x100;
+		ret = ecc_ecdsa_validate(pub_x, pub_y, hash, tempx, tempy);
+		assert(ret);
+	}
 }
 
 #ifdef CONTIKI
@@ -205,6 +358,9 @@ PROCESS_THREAD(ecc_test, ev, d)
 	addTest();
 	doubleTest();
 	multTest();
+	multJacobianTest();
+	multBaseTest();
+	multLadderTest();
 	eccdhTest();
 	ecdsaTest();
 	printf("%s\n", "All Tests successful.");
@@ -218,6 +374,9 @@ int main(int argc, char const *argv[])
 	addTest();
 	doubleTest();
 	multTest();
+	multJacobianTest();
+	multBaseTest();
+	multLadderTest();
 	eccdhTest();
 	ecdsaTest();
 	printf("%s\n", "All Tests successful.");
@@ -35,6 +35,8 @@
  * architectures. It provides basic operations on the secp256r1 curve and support
  * for ECDH and ECDSA.
  */
+#define _POSIX_C_SOURCE 199309L
+
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
@@ -43,6 +45,20 @@
 
 #ifdef CONTIKI
 #include "contiki.h"
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define CYCLE_UNIT "cycles"
+static uint64_t cycles(void){
+	return __rdtsc();
+}
+#else
+#include <time.h>
+#define CYCLE_UNIT "ns"
+static uint64_t cycles(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 #endif /* CONTIKI */
 
 //arbitrary test values and results
@@ -114,7 +130,7 @@ void fieldAddTest(){
 	ecc_fieldAdd(one, one, ecc_prime_r, temp);
 	assert(ecc_isSame(temp, two, arrayLength));
 	nullEverything();
-	ecc_add(full, one, temp, 32);
+	ecc_add(full, one, temp, arrayLength);
 	assert(ecc_isSame(null, temp, arrayLength));
 	nullEverything();
 	ecc_fieldAdd(full, one, ecc_prime_r, temp);
@@ -152,6 +168,24 @@ void fieldMultTest(){
 	assert(ecc_isSame(temp, one, arrayLength));
 }
 
+void fieldSquareTest(){
+	uint32_t x[8];
+	uint32_t squared[16];
+	int i;
+
+	ecc_fieldSquare(primeMinusOne, temp2);
+	assert(ecc_isSame(temp2, resultQuadMod, arrayLength * 2));
+	ecc_fieldSquare(full, temp2);
+	ecc_fieldMult(full, full, squared, arrayLength);
+	assert(ecc_isSame(temp2, squared, arrayLength * 2));
+	for (i = 0; i < 100; i++) {
+		ecc_setRandom(x);
+		ecc_fieldSquare(x, temp2);
+		ecc_fieldMult(x, x, squared, arrayLength);
+		assert(ecc_isSame(temp2, squared, arrayLength * 2));
+	}
+}
+
 void fieldModPTest(){
 	ecc_fieldMult(primeMinusOne, primeMinusOne, temp2, arrayLength);
 	ecc_fieldModP(temp, temp2);
@@ -232,6 +266,43 @@ void fieldInvTest(){
 	assert(ecc_isSame(one, temp, arrayLength));
 }
 
+#ifndef CONTIKI
+#define BENCH_ROUNDS 100000
+
+//prints the average cost of the field operations used by the point arithmetic
+void fieldMultBench(){
+	uint32_t x[8];
+	uint32_t y[8];
+	uint32_t product[16];
+	uint64_t start;
+	int i;
+
+	ecc_setRandom(x);
+	ecc_setRandom(y);
+
+	start = cycles();
+	for (i = 0; i < BENCH_ROUNDS; i++) {
+		ecc_fieldMult(x, y, product, arrayLength);
+		x[0] ^= product[15];
+	}
+	printf("fieldMult:   %4u %s\n", (unsigned)((cycles() - start) / BENCH_ROUNDS), CYCLE_UNIT);
+
+	start = cycles();
+	for (i = 0; i < BENCH_ROUNDS; i++) {
+		ecc_fieldSquare(x, product);
+		x[0] ^= product[15];
+	}
+	printf("fieldSquare: %4u %s\n", (unsigned)((cycles() - start) / BENCH_ROUNDS), CYCLE_UNIT);
+
+	start = cycles();
+	for (i = 0; i < BENCH_ROUNDS; i++) {
+		ecc_fieldModP(x, product);
+		product[0] ^= x[7];
+	}
+	printf("fieldModP:   %4u %s\n", (unsigned)((cycles() - start) / BENCH_ROUNDS), CYCLE_UNIT);
+}
+#endif /* CONTIKI */
+
 // void randomStuff(){
 
 // }
@@ -252,6 +323,8 @@ PROCESS_THREAD(ecc_field_test, ev, d)
 	nullEverything();
 	fieldMultTest();
 	nullEverything();
+	fieldSquareTest();
+	nullEverything();
 	fieldModPTest();
 	nullEverything();
 	fieldModOTest();
@@ -276,6 +349,8 @@ int main(int argc, char const *argv[])
 	nullEverything();
 	fieldMultTest();
 	nullEverything();
+	fieldSquareTest();
+	nullEverything();
 	fieldModPTest();
 	nullEverything();
 	fieldModOTest();
@@ -285,6 +360,7 @@ int main(int argc, char const *argv[])
 	//rShiftTest();
 	//isOneTest();
 	printf("%s\n", "All Tests succesfull!");
+	fieldMultBench();
 	return 0;
 }
 #endif /* CONTIKI */
@@ -0,0 +1,290 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2011, 2012, 2013, 2014, 2015 Olaf Bergmann (TZI) and others.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v. 1.0 which accompanies this distribution.
+ *
+ * The Eclipse Public License is available at http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Olaf Bergmann  - initial API and implementation
+ *
+ *******************************************************************************/
+
+#include <string.h>
+
+#include "tinydtls.h"
+#include "global.h"
+#include "numeric.h"
+#include "gcm.h"
+#ifdef WITH_AES_HW
+#include "aes/ghash_hw.h"
+#endif /* WITH_AES_HW */
+
+/* keystream blocks that are encrypted with one call of
+ * rijndael_encrypt_blocks() */
+#define GCM_STRIDE 8
+
+static inline uint64_t
+get64(const unsigned char *p) {
+  return ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48)
+    | ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32)
+    | ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16)
+    | ((uint64_t)p[6] << 8) | (uint64_t)p[7];
+}
+
+static inline void
+put64(unsigned char *p, uint64_t v) {
+  int i;
+
+  for (i = 7; i >= 0; i--, v >>= 8)
+    p[i] = (unsigned char)v;
+}
+
+/* The products of H with all 4-bit values for the portable GHASH. */
+typedef struct {
+  uint64_t hl[16];		/* low halves of the multiples of H */
+  uint64_t hh[16];		/* high halves of the multiples of H */
+} ghash_table_t;
+
+/* Builds the table of the products of H with all 4-bit values, see
+ * Shoup's method in section 4.1 of the GCM specification by McGrew
+ * and Viega. Bit 0 of the field element is the most significant bit
+ * of the first byte. */
+static void
+ghash_table(ghash_table_t *t, const unsigned char key[DTLS_GCM_BLOCKSIZE]) {
+  uint64_t *hl = t->hl, *hh = t->hh;
+  uint64_t vh = get64(key), vl = get64(key + 8), r;
+  int i, j;
+
+  hl[0] = hh[0] = 0;
+  hl[8] = vl;
+  hh[8] = vh;
+
+  /* the multiples with a single bit set, i.e. H times x, x^2, x^3 */
+  for (i = 4; i > 0; i >>= 1) {
+    r = (vl & 1) * 0xe1000000U;
+    vl = (vh << 63) | (vl >> 1);
+    vh = (vh >> 1) ^ (r << 32);
+    hl[i] = vl;
+    hh[i] = vh;
+  }
+
+  for (i = 2; i <= 8; i *= 2) {
+    for (j = 1; j < i; j++) {
+      hh[i + j] = hh[i] ^ hh[j];
+      hl[i + j] = hl[i] ^ hl[j];
+    }
+  }
+}
+
+/* the reduction of the four bits that are shifted out in ghash_mult() */
+static const uint64_t last4[16] = {
+  0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+  0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+/* Multiplies @p x by H with the table @p t of ghash_table(). */
+static void
+ghash_mult(const ghash_table_t *t, unsigned char x[DTLS_GCM_BLOCKSIZE]) {
+  const uint64_t *hl = t->hl, *hh = t->hh;
+  uint64_t zh, zl;
+  unsigned char lo, hi, rem;
+  int i;
+
+  lo = x[15] & 0x0f;
+  zh = hh[lo];
+  zl = hl[lo];
+
+  for (i = 15; i >= 0; i--) {
+    lo = x[i] & 0x0f;
+    hi = x[i] >> 4;
+
+    if (i != 15) {
+      rem = (unsigned char)zl & 0x0f;
+      zl = (zh << 60) | (zl >> 4);
+      zh = (zh >> 4) ^ (last4[rem] << 48);
+      zh ^= hh[lo];
+      zl ^= hl[lo];
+    }
+
+    rem = (unsigned char)zl & 0x0f;
+    zl = (zh << 60) | (zl >> 4);
+    zh = (zh >> 4) ^ (last4[rem] << 48);
+    zh ^= hh[hi];
+    zl ^= hl[hi];
+  }
+
+  put64(x, zh);
+  put64(x + 8, zl);
+}
+
+/* Adds @p len bytes of @p data to the GHASH state @p x, using the
+ * table @p t unless @p h is set up for ghash_hw_update(). A partial
+ * last block is padded with zeros. */
+static void
+ghash_update(const dtls_ghash_key_t *h, const ghash_table_t *t,
+	     unsigned char x[DTLS_GCM_BLOCKSIZE],
+	     const unsigned char *data, size_t len) {
+  unsigned char last[DTLS_GCM_BLOCKSIZE];
+  size_t n = len / DTLS_GCM_BLOCKSIZE, rest = len % DTLS_GCM_BLOCKSIZE;
+  size_t i;
+
+  if (rest) {
+    memset(last, 0, sizeof(last));
+    memcpy(last, data + n * DTLS_GCM_BLOCKSIZE, rest);
+  }
+
+#ifdef WITH_AES_HW
+  if (h->hw) {
+    if (n)
+      ghash_hw_update(h->hpow, x, data, n);
+    if (rest)
+      ghash_hw_update(h->hpow, x, last, 1);
+    return;
+  }
+#else /* WITH_AES_HW */
+  (void)h;
+#endif /* WITH_AES_HW */
+
+  for (; n; n--, data += DTLS_GCM_BLOCKSIZE) {
+    for (i = 0; i < DTLS_GCM_BLOCKSIZE; i++)
+      x[i] ^= data[i];
+    ghash_mult(t, x);
+  }
+  if (rest) {
+    for (i = 0; i < DTLS_GCM_BLOCKSIZE; i++)
+      x[i] ^= last[i];
+    ghash_mult(t, x);
+  }
+}
+
+int
+dtls_gcm_accelerated(void) {
+#ifdef WITH_AES_HW
+  return ghash_hw_available();
+#else /* WITH_AES_HW */
+  return 0;
+#endif /* WITH_AES_HW */
+}
+
+void
+dtls_gcm_set_key(rijndael_ctx *ctx, dtls_ghash_key_t *h) {
+#ifdef WITH_AES_HW
+  ghash_table_t t;
+  int i;
+#endif /* WITH_AES_HW */
+
+  memset(h, 0, sizeof(*h));
+  rijndael_encrypt(ctx, h->hpow[0], h->hpow[0]);
+
+#ifdef WITH_AES_HW
+  if (ghash_hw_available()) {
+    ghash_table(&t, h->hpow[0]);
+    for (i = 1; i < DTLS_GHASH_POWERS; i++) {
+      memcpy(h->hpow[i], h->hpow[i - 1], DTLS_GCM_BLOCKSIZE);
+      ghash_mult(&t, h->hpow[i]);
+    }
+    memset(&t, 0, sizeof(t));
+    h->hw = 1;
+  }
+#endif /* WITH_AES_HW */
+}
+
+/* Encrypts or decrypts @p lm bytes at @p msg in place with the
+ * keystream of the counter blocks that follow the first one, which
+ * is used for the tag. */
+static void
+gcm_ctr(rijndael_ctx *ctx, const unsigned char nonce[DTLS_GCM_NONCE_SIZE],
+	unsigned char *msg, size_t lm) {
+  unsigned char in[GCM_STRIDE * DTLS_GCM_BLOCKSIZE];
+  unsigned char out[GCM_STRIDE * DTLS_GCM_BLOCKSIZE];
+  uint32_t counter = 2;
+  size_t i, n, len;
+
+  while (lm) {
+    n = (lm + DTLS_GCM_BLOCKSIZE - 1) / DTLS_GCM_BLOCKSIZE;
+    if (n > GCM_STRIDE)
+      n = GCM_STRIDE;
+
+    for (i = 0; i < n; i++, counter++) {
+      memcpy(in + i * DTLS_GCM_BLOCKSIZE, nonce, DTLS_GCM_NONCE_SIZE);
+      dtls_int_to_uint32(in + i * DTLS_GCM_BLOCKSIZE + DTLS_GCM_NONCE_SIZE,
+			 counter);
+    }
+    rijndael_encrypt_blocks(ctx, in, out, n);
+
+    len = n * DTLS_GCM_BLOCKSIZE < lm ? n * DTLS_GCM_BLOCKSIZE : lm;
+    for (i = 0; i < len; i++)
+      msg[i] ^= out[i];
+    msg += len;
+    lm -= len;
+  }
+  memset(out, 0, sizeof(out));
+}
+
+/* Calculates the tag of the ciphertext @p c into @p tag. */
+static void
+gcm_tag(rijndael_ctx *ctx, const dtls_ghash_key_t *h,
+	const unsigned char nonce[DTLS_GCM_NONCE_SIZE],
+	const unsigned char *c, size_t lc,
+	const unsigned char *aad, size_t la,
+	unsigned char tag[DTLS_GCM_TAG_LENGTH]) {
+  unsigned char x[DTLS_GCM_BLOCKSIZE], j0[DTLS_GCM_BLOCKSIZE];
+  ghash_table_t t;
+  size_t i;
+
+#ifdef WITH_AES_HW
+  if (!h->hw)
+#endif /* WITH_AES_HW */
+    ghash_table(&t, h->hpow[0]);
+
+  memset(x, 0, sizeof(x));
+  if (la)
+    ghash_update(h, &t, x, aad, la);
+  ghash_update(h, &t, x, c, lc);
+
+  /* the block with the lengths in bits */
+  put64(j0, (uint64_t)la * 8);
+  put64(j0 + 8, (uint64_t)lc * 8);
+  ghash_update(h, &t, x, j0, sizeof(j0));
+
+  memcpy(j0, nonce, DTLS_GCM_NONCE_SIZE);
+  dtls_int_to_uint32(j0 + DTLS_GCM_NONCE_SIZE, 1);
+  rijndael_encrypt(ctx, j0, j0);
+  for (i = 0; i < DTLS_GCM_TAG_LENGTH; i++)
+    tag[i] = x[i] ^ j0[i];
+}
+
+long int
+dtls_gcm_encrypt_message(rijndael_ctx *ctx, const dtls_ghash_key_t *h,
+			 const unsigned char nonce[DTLS_GCM_NONCE_SIZE],
+			 unsigned char *msg, size_t lm,
+			 const unsigned char *aad, size_t la) {
+  gcm_ctr(ctx, nonce, msg, lm);
+  gcm_tag(ctx, h, nonce, msg, lm, aad, la, msg + lm);
+  return lm + DTLS_GCM_TAG_LENGTH;
+}
+
+long int
+dtls_gcm_decrypt_message(rijndael_ctx *ctx, const dtls_ghash_key_t *h,
+			 const unsigned char nonce[DTLS_GCM_NONCE_SIZE],
+			 unsigned char *msg, size_t lm,
+			 const unsigned char *aad, size_t la) {
+  unsigned char tag[DTLS_GCM_TAG_LENGTH];
+
+  if (lm < DTLS_GCM_TAG_LENGTH)
+    return -1;
+  lm -= DTLS_GCM_TAG_LENGTH;
+
+  /* the ciphertext is only decrypted when it is authentic */
+  gcm_tag(ctx, h, nonce, msg, lm, aad, la, tag);
+  if (!equals(tag, msg + lm, DTLS_GCM_TAG_LENGTH))
+    return -1;
+
+  gcm_ctr(ctx, nonce, msg, lm);
+  return lm;
+}
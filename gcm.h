@@ -0,0 +1,100 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2011, 2012, 2013, 2014, 2015 Olaf Bergmann (TZI) and others.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v. 1.0 which accompanies this distribution.
+ *
+ * The Eclipse Public License is available at http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Olaf Bergmann  - initial API and implementation
+ *
+ *******************************************************************************/
+
+#ifndef _DTLS_GCM_H_
+#define _DTLS_GCM_H_
+
+#include <stdint.h>
+
+#include "aes/rijndael.h"
+
+/* implementation of the Galois/Counter Mode, NIST SP 800-38D */
+
+#define DTLS_GCM_BLOCKSIZE  16	/**< size of the GHASH blocks */
+#define DTLS_GCM_TAG_LENGTH 16	/**< size of the authentication tag */
+#define DTLS_GCM_NONCE_SIZE 12	/**< size of the nonce */
+
+#ifdef WITH_AES_HW
+#define DTLS_GHASH_POWERS 4	/**< H to H^4 for ghash_hw_update() */
+#else /* WITH_AES_HW */
+#define DTLS_GHASH_POWERS 1	/**< only H for the portable GHASH */
+#endif /* WITH_AES_HW */
+
+/**
+ * The hash key H of GHASH, which is derived from the AES key by
+ * dtls_gcm_set_key(). If the CPU has carry-less multiplication, the
+ * powers of H that ghash_hw_update() combines four blocks with are
+ * kept as well. The portable GHASH builds its table from H for each
+ * message instead of keeping it, as that is cheap compared to the
+ * multiplications but would add 256 bytes to each cipher context.
+ */
+typedef struct {
+  unsigned char hpow[DTLS_GHASH_POWERS][DTLS_GCM_BLOCKSIZE]; /**< H, H^2, ... */
+#ifdef WITH_AES_HW
+  int hw;			/**< @c 1 if ghash_hw_update() is used */
+#endif /* WITH_AES_HW */
+} dtls_ghash_key_t;
+
+/**
+ * Checks if GHASH uses the carry-less multiplication of the CPU.
+ *
+ * @return @c 1 if dtls_gcm_set_key() sets up the hardware GHASH,
+ *         @c 0 if the portable implementation is used.
+ */
+int dtls_gcm_accelerated(void);
+
+/**
+ * Derives the GHASH key @p h for the AES key @p ctx, which must have
+ * been set up with rijndael_set_key_enc_only().
+ */
+void dtls_gcm_set_key(rijndael_ctx *ctx, dtls_ghash_key_t *h);
+
+/**
+ * Authenticates and encrypts a message using AES in GCM mode with a
+ * tag of DTLS_GCM_TAG_LENGTH bytes.
+ *
+ * \param ctx   The AES key.
+ * \param h     The GHASH key that belongs to \p ctx.
+ * \param nonce The DTLS_GCM_NONCE_SIZE bytes of nonce.
+ * \param msg   The message to encrypt in place. The buffer must have
+ *              room for DTLS_GCM_TAG_LENGTH more bytes for the tag.
+ * \param lm    The actual length of \p msg.
+ * \param aad   The additional authentication data (can be \c NULL if
+ *              \p la is zero).
+ * \param la    The number of additional authentication octets.
+ * \return The length of the encrypted message including the tag.
+ */
+long int
+dtls_gcm_encrypt_message(rijndael_ctx *ctx, const dtls_ghash_key_t *h,
+			 const unsigned char nonce[DTLS_GCM_NONCE_SIZE],
+			 unsigned char *msg, size_t lm,
+			 const unsigned char *aad, size_t la);
+
+/**
+ * Verifies and decrypts a message that has been encrypted by
+ * dtls_gcm_encrypt_message(). The parameters have the same meaning,
+ * but \p lm includes the tag at the end of \p msg.
+ *
+ * \return The length of the decrypted message, or \c -1 if \p msg is
+ *         too short or has been modified.
+ */
+long int
+dtls_gcm_decrypt_message(rijndael_ctx *ctx, const dtls_ghash_key_t *h,
+			 const unsigned char nonce[DTLS_GCM_NONCE_SIZE],
+			 unsigned char *msg, size_t lm,
+			 const unsigned char *aad, size_t la);
+
+#endif /* _DTLS_GCM_H_ */
@@ -19,6 +19,8 @@
 #define _DTLS_GLOBAL_H_
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <sys/types.h>
 
 #include "tinydtls.h"
@@ -57,16 +59,102 @@ typedef unsigned char uint48[6];
 #endif /* WITH_CONTIKI */
 #endif
 
+#ifndef DTLS_DEFAULT_PMTU
+/** Maximum size of the datagrams sent to a peer unless changed with
+    dtls_set_pmtu(). Handshake messages that do not fit are split into
+    fragments. */
+#define DTLS_DEFAULT_PMTU DTLS_MAX_BUF
+#endif
+
+#ifndef DTLS_MAX_HS_LENGTH
+/** Maximum size of a received handshake message that is reassembled
+    from fragments. */
+#define DTLS_MAX_HS_LENGTH 1024
+#endif
+
 #ifndef DTLS_DEFAULT_MAX_RETRANSMIT
 /** Number of message retransmissions. */
 #define DTLS_DEFAULT_MAX_RETRANSMIT 7
 #endif
 
+#ifndef DTLS_CLIENT_SUPPORT
+/** Set to @c 0 to build only the server side of the handshake. */
+#define DTLS_CLIENT_SUPPORT 1
+#endif
+
+#ifndef DTLS_SERVER_SUPPORT
+/** Set to @c 0 to build only the client side of the handshake. */
+#define DTLS_SERVER_SUPPORT 1
+#endif
+
+#if !DTLS_CLIENT_SUPPORT && !DTLS_SERVER_SUPPORT
+#error "DTLS_CLIENT_SUPPORT and DTLS_SERVER_SUPPORT must not both be 0"
+#endif
+
+#ifndef DTLS_STATS
+#ifdef WITH_CONTIKI
+#define DTLS_STATS 0
+#else /* WITH_CONTIKI */
+/** Set to @c 0 to build without the counters of dtls_get_stats(). */
+#define DTLS_STATS 1
+#endif /* WITH_CONTIKI */
+#endif /* DTLS_STATS */
+
+#ifndef DTLS_TRACE
+#ifdef WITH_CONTIKI
+#define DTLS_TRACE 0
+#else /* WITH_CONTIKI */
+/** Set to @c 0 to build without calls to the trace handler. */
+#define DTLS_TRACE 1
+#endif /* WITH_CONTIKI */
+#endif /* DTLS_TRACE */
+
+#ifndef DTLS_GCM
+#ifdef WITH_CONTIKI
+#define DTLS_GCM 0
+#else /* WITH_CONTIKI */
+/** Set to @c 0 to build without the AES_128_GCM_SHA256 cipher suites. */
+#define DTLS_GCM 1
+#endif /* WITH_CONTIKI */
+#endif /* DTLS_GCM */
+
+#ifndef DTLS_CHACHA20
+#ifdef WITH_CONTIKI
+#define DTLS_CHACHA20 0
+#else /* WITH_CONTIKI */
+/**
+ * Set to @c 0 to build without the CHACHA20_POLY1305_SHA256 cipher
+ * suites. They are cheaper than AES-CCM on devices without an AES
+ * engine. Contiki builds for such devices can enable them with
+ * -DDTLS_CHACHA20=1.
+ */
+#define DTLS_CHACHA20 1
+#endif /* WITH_CONTIKI */
+#endif /* DTLS_CHACHA20 */
+
+#ifndef DTLS_THREAD_LOCAL
+#if defined(WITH_CONTIKI)
+#define DTLS_THREAD_LOCAL
+#elif defined(__GNUC__)
+#define DTLS_THREAD_LOCAL __thread
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define DTLS_THREAD_LOCAL _Thread_local
+#else
+/* without thread-local storage, state that is meant to be kept per
+ * thread is shared by all threads */
+#define DTLS_THREAD_LOCAL
+#endif
+#endif /* DTLS_THREAD_LOCAL */
+
 /** Known cipher suites.*/
 typedef enum { 
   TLS_NULL_WITH_NULL_NULL = 0x0000,   /**< NULL cipher  */
   TLS_PSK_WITH_AES_128_CCM_8 = 0xC0A8, /**< see RFC 6655 */
-  TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8 = 0xC0AE /**< see RFC 7251 */
+  TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8 = 0xC0AE, /**< see RFC 7251 */
+  TLS_PSK_WITH_AES_128_GCM_SHA256 = 0x00A8, /**< see RFC 5487 */
+  TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256 = 0xC02B, /**< see RFC 5289 */
+  TLS_PSK_WITH_CHACHA20_POLY1305_SHA256 = 0xCCAB, /**< see RFC 7905 */
+  TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256 = 0xCCA9 /**< see RFC 7905 */
 } dtls_cipher_t;
 
 /** Known compression suites.*/
@@ -80,6 +168,8 @@ typedef enum {
 #define TLS_EXT_CLIENT_CERTIFICATE_TYPE	19 /* see RFC 7250 */
 #define TLS_EXT_SERVER_CERTIFICATE_TYPE	20 /* see RFC 7250 */
 #define TLS_EXT_ENCRYPT_THEN_MAC	22 /* see RFC 7366 */
+#define TLS_EXT_SESSION_TICKET		35 /* see RFC 5077 */
+#define TLS_EXT_CONNECTION_ID		54 /* see RFC 9146 */
 
 #define TLS_CERT_TYPE_RAW_PUBLIC_KEY	2 /* see RFC 7250 */
 
@@ -94,11 +184,24 @@ typedef enum {
 #define TLS_EXT_SIG_HASH_ALGO_SHA256		4 /* see RFC 5246 */
 #define TLS_EXT_SIG_HASH_ALGO_ECDSA		3 /* see RFC 5246 */
 
-/** 
- * XORs \p n bytes byte-by-byte starting at \p y to the memory area
- * starting at \p x. */
+/**
+ * XORs \p n bytes starting at \p y to the memory area starting at
+ * \p x. The bulk of the data is processed one machine word at a
+ * time, memcpy() is used for the word accesses so that \p x and \p y
+ * need not be aligned. */
 static inline void
 memxor(unsigned char *x, const unsigned char *y, size_t n) {
+  uintptr_t wx, wy;
+
+  while (n >= sizeof(uintptr_t)) {
+    memcpy(&wx, x, sizeof(wx));
+    memcpy(&wy, y, sizeof(wy));
+    wx ^= wy;
+    memcpy(x, &wx, sizeof(wx));
+    x += sizeof(uintptr_t); y += sizeof(uintptr_t);
+    n -= sizeof(uintptr_t);
+  }
+
   while(n--) {
     *x ^= *y;
     x++; y++;
@@ -108,7 +211,8 @@ memxor(unsigned char *x, const unsigned char *y, size_t n) {
 /**
  * Compares \p len bytes from @p a with @p b in constant time. This
  * functions always traverses the entire length to prevent timing
- * attacks.
+ * attacks. The differences are collected word by word without any
+ * data-dependent branches.
  *
  * \param a Byte sequence to compare
  * \param b Byte sequence to compare
@@ -116,12 +220,21 @@ memxor(unsigned char *x, const unsigned char *y, size_t n) {
  * \return \c 1 if \p a and \p b are equal, \c 0 otherwise.
  */
 static inline int
-equals(unsigned char *a, unsigned char *b, size_t len) {
-  int result = 1;
+equals(const unsigned char *a, const unsigned char *b, size_t len) {
+  uintptr_t wa, wb, diff = 0;
+
+  while (len >= sizeof(uintptr_t)) {
+    memcpy(&wa, a, sizeof(wa));
+    memcpy(&wb, b, sizeof(wb));
+    diff |= wa ^ wb;
+    a += sizeof(uintptr_t); b += sizeof(uintptr_t);
+    len -= sizeof(uintptr_t);
+  }
+
   while (len--) {
-    result &= (*a++ == *b++);
+    diff |= *a++ ^ *b++;
   }
-  return result;
+  return diff == 0;
 }
 
 #ifdef HAVE_FLS
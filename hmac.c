@@ -28,18 +28,19 @@
 #include "dtls_debug.h"
 #include "hmac.h"
 
-/* use malloc()/free() on platforms other than Contiki */
+/* use the allocator from dtls_set_allocator() on platforms other than Contiki */
 #ifndef WITH_CONTIKI
-#include <stdlib.h>
+#include "pool.h"
 
 static inline dtls_hmac_context_t *
 dtls_hmac_context_new(void) {
-  return (dtls_hmac_context_t *)malloc(sizeof(dtls_hmac_context_t));
+  return (dtls_hmac_context_t *)
+    dtls_pool_alloc(NULL, sizeof(dtls_hmac_context_t));
 }
 
 static inline void
 dtls_hmac_context_free(dtls_hmac_context_t *ctx) {
-  free(ctx);
+  dtls_pool_free(ctx);
 }
 
 void
@@ -86,29 +87,36 @@ dtls_hmac_new(const unsigned char *key, size_t klen) {
 
 void
 dtls_hmac_init(dtls_hmac_context_t *ctx, const unsigned char *key, size_t klen) {
+  unsigned char pad[DTLS_HMAC_BLOCKSIZE];
   int i;
 
   assert(ctx);
 
   memset(ctx, 0, sizeof(dtls_hmac_context_t));
+  memset(pad, 0, sizeof(pad));
 
   if (klen > DTLS_HMAC_BLOCKSIZE) {
     dtls_hash_init(&ctx->data);
     dtls_hash_update(&ctx->data, key, klen);
-    dtls_hash_finalize(ctx->pad, &ctx->data);
+    dtls_hash_finalize(pad, &ctx->data);
   } else
-    memcpy(ctx->pad, key, klen);
+    memcpy(pad, key, klen);
 
   /* create ipad: */
   for (i=0; i < DTLS_HMAC_BLOCKSIZE; ++i)
-    ctx->pad[i] ^= 0x36;
+    pad[i] ^= 0x36;
 
   dtls_hash_init(&ctx->data);
-  dtls_hmac_update(ctx, ctx->pad, DTLS_HMAC_BLOCKSIZE);
+  dtls_hash_update(&ctx->data, pad, DTLS_HMAC_BLOCKSIZE);
 
   /* create opad by xor-ing pad[i] with 0x36 ^ 0x5C: */
   for (i=0; i < DTLS_HMAC_BLOCKSIZE; ++i)
-    ctx->pad[i] ^= 0x6A;
+    pad[i] ^= 0x6A;
+
+  dtls_hash_init(&ctx->outer);
+  dtls_hash_update(&ctx->outer, pad, DTLS_HMAC_BLOCKSIZE);
+
+  memset(pad, 0, sizeof(pad));
 }
 
 void
@@ -127,12 +135,47 @@ dtls_hmac_finalize(dtls_hmac_context_t *ctx, unsigned char *result) {
   
   len = dtls_hash_finalize(buf, &ctx->data);
 
-  dtls_hash_init(&ctx->data);
-  dtls_hash_update(&ctx->data, ctx->pad, DTLS_HMAC_BLOCKSIZE);
-  dtls_hash_update(&ctx->data, buf, len);
+  /* the outer hash continues after the opad block */
+  dtls_hash_update(&ctx->outer, buf, len);
+
+  len = dtls_hash_finalize(result, &ctx->outer);
 
-  len = dtls_hash_finalize(result, &ctx->data);
+  return len;
+}
+
+/* number of MACs that dtls_hmac_finalize_multi() computes at once */
+#define DTLS_HMAC_MULTI 16
+
+int
+dtls_hmac_finalize_multi(dtls_hmac_context_t *ctx[],
+			 const unsigned char *input[], const size_t ilen[],
+			 unsigned char *result[], size_t count) {
+  unsigned char inner[DTLS_HMAC_MULTI][DTLS_HMAC_DIGEST_SIZE];
+  unsigned char *buf[DTLS_HMAC_MULTI];
+  const unsigned char *digest[DTLS_HMAC_MULTI];
+  size_t dlen[DTLS_HMAC_MULTI];
+  dtls_hash_t hash[DTLS_HMAC_MULTI];
+  size_t i, n, len = DTLS_HMAC_DIGEST_SIZE;
+
+  for (; count; count -= n, ctx += n, input += n, ilen += n, result += n) {
+    n = count < DTLS_HMAC_MULTI ? count : DTLS_HMAC_MULTI;
+
+    for (i = 0; i < n; i++) {
+      hash[i] = &ctx[i]->data;
+      buf[i] = inner[i];
+    }
+    len = dtls_hash_finalize_multi(buf, hash, input, ilen, n);
+
+    /* the outer hashes continue after the opad block */
+    for (i = 0; i < n; i++) {
+      hash[i] = &ctx[i]->outer;
+      digest[i] = inner[i];
+      dlen[i] = len;
+    }
+    len = dtls_hash_finalize_multi(result, hash, digest, dlen, n);
+  }
 
+  memset(inner, 0, sizeof(inner));
   return len;
 }
 
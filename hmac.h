@@ -47,6 +47,20 @@ dtls_hash_finalize(unsigned char *buf, dtls_hash_t ctx) {
   dtls_sha256_final(buf, (dtls_sha256_ctx *)ctx);
   return DTLS_SHA256_DIGEST_LENGTH;
 }
+
+/**
+ * Continues each of the @p count hash contexts @p ctx[i] with the
+ * @p len[i] bytes from @p input[i] and writes its digest to
+ * @p buf[i]. Independent messages are hashed side by side where the
+ * CPU allows.
+ */
+static inline size_t
+dtls_hash_finalize_multi(unsigned char *buf[], dtls_hash_t ctx[],
+			 const unsigned char *input[], const size_t len[],
+			 size_t count) {
+  dtls_sha256_final_multi(ctx, input, len, buf, count);
+  return DTLS_SHA256_DIGEST_LENGTH;
+}
 #endif /* WITH_SHA256 */
 
 void dtls_hmac_storage_init(void);
@@ -79,10 +93,15 @@ typedef enum {
  * dtls_hmac_finalize(). Once, finalized, the component \c H is
  * invalid and must be initialized again with dtls_hmac_init() before
  * the structure can be used again. 
+ *
+ * The hash states after the key xor ipad and opad blocks are kept, so
+ * an initialized context can be copied with dtls_hmac_clone() to
+ * compute several MACs with the same key without hashing the key
+ * blocks again.
  */
 typedef struct {
-  unsigned char pad[DTLS_HMAC_BLOCKSIZE]; /**< ipad and opad storage */
-  dtls_hash_ctx data;		          /**< context for hash function */
+  dtls_hash_ctx outer;		/**< hash state after the opad block */
+  dtls_hash_ctx data;		/**< hash state, starting after the ipad block */
 } dtls_hmac_context_t;
 
 /**
@@ -94,6 +113,19 @@ typedef struct {
  */
 void dtls_hmac_init(dtls_hmac_context_t *ctx, const unsigned char *key, size_t klen);
 
+/**
+ * Initializes @p ctx with the key of @p key, which has been
+ * initialized with dtls_hmac_init() but not updated yet. This is
+ * cheaper than dtls_hmac_init() as the key is not hashed again.
+ *
+ * @param ctx The HMAC context to initialize.
+ * @param key The HMAC context to take the key from.
+ */
+static inline void
+dtls_hmac_clone(dtls_hmac_context_t *ctx, const dtls_hmac_context_t *key) {
+  *ctx = *key;
+}
+
 /**
  * Allocates a new HMAC context \p ctx with the given secret key.
  * This function returns \c 1 if \c ctx has been set correctly, or \c
@@ -137,6 +169,24 @@ void dtls_hmac_update(dtls_hmac_context_t *ctx,
  */
 int dtls_hmac_finalize(dtls_hmac_context_t *ctx, unsigned char *result);
 
+/**
+ * Computes the MACs of @p count independent messages at once. This
+ * is the same as calling dtls_hmac_update() with @p input[i] of
+ * @p ilen[i] bytes and dtls_hmac_finalize() for each context
+ * @p ctx[i], but makes use of the multi-buffer hashing of
+ * dtls_hash_finalize_multi().
+ *
+ * \param ctx    The HMAC contexts.
+ * \param input  The remaining input data of each context.
+ * \param ilen   The sizes of the elements of \p input.
+ * \param result Output parameters where the MACs are written to.
+ * \param count  The number of elements in each array.
+ * \return Length of each MAC written to \p result.
+ */
+int dtls_hmac_finalize_multi(dtls_hmac_context_t *ctx[],
+			     const unsigned char *input[], const size_t ilen[],
+			     unsigned char *result[], size_t count);
+
 /**@}*/
 
 #endif /* _DTLS_HMAC_H_ */
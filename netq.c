@@ -15,6 +15,8 @@
  *
  *******************************************************************************/
 
+#include <stddef.h>
+
 #include "dtls_debug.h"
 #include "netq.h"
 #include "utlist.h"
@@ -29,16 +31,15 @@
 #endif
 
 #ifndef WITH_CONTIKI
-#include <stdlib.h>
-
 static inline netq_t *
-netq_malloc_node(size_t size) {
-  return (netq_t *)malloc(sizeof(netq_t) + size);
+netq_malloc_node(dtls_pools_t *pools, size_t size) {
+  return (netq_t *)dtls_pool_alloc(pools ? &pools->netq : NULL,
+				   sizeof(netq_t) + size);
 }
 
 static inline void
 netq_free_node(netq_t *node) {
-  free(node);
+  dtls_pool_free(node);
 }
 
 #else /* WITH_CONTIKI */
@@ -47,18 +48,31 @@ netq_free_node(netq_t *node) {
 MEMB(netq_storage, netq_t, NETQ_MAXCNT);
 
 static inline netq_t *
-netq_malloc_node(size_t size) {
-  return (netq_t *)memb_alloc(&netq_storage);
+netq_malloc_node(dtls_pools_t *pools, size_t size) {
+  netq_t *node;
+  (void)pools;
+
+  node = (netq_t *)memb_alloc(&netq_storage);
+  if (node) {
+    node->data = dtls_buffer_alloc(size);
+    if (!node->data) {
+      memb_free(&netq_storage, node);
+      return NULL;
+    }
+  }
+  return node;
 }
 
 static inline void
 netq_free_node(netq_t *node) {
+  dtls_buffer_free(node->data);
   memb_free(&netq_storage, node);
 }
 
 void
 netq_init() {
   memb_init(&netq_storage);
+  dtls_buffer_init();
 }
 #endif /* WITH_CONTIKI */
 
@@ -116,17 +130,18 @@ netq_t *netq_pop_first(netq_t **queue) {
 }
 
 netq_t *
-netq_node_new(size_t size) {
+netq_node_new(dtls_pools_t *pools, size_t size) {
   netq_t *node;
-  node = netq_malloc_node(size);
+  node = netq_malloc_node(pools, size);
 
 #ifndef NDEBUG
   if (!node)
     dtls_warn("netq_node_new: malloc\n");
 #endif
 
+  /* the data, or on Contiki the pointer to it, is kept */
   if (node)
-    memset(node, 0, sizeof(netq_t));
+    memset(node, 0, offsetof(netq_t, data));
 
   return node;
 }
@@ -148,3 +163,116 @@ netq_delete_all(netq_t **queue) {
     *queue = NULL;
   }
 }
+
+/** Returns the slot for time @p t. */
+static inline uint16_t
+netq_wheel_slot(clock_time_t t) {
+  return (t / NETQ_WHEEL_TICK) & (NETQ_WHEEL_SIZE - 1);
+}
+
+void
+netq_wheel_insert(netq_wheel_t *wheel, netq_t *node) {
+  assert(wheel);
+  assert(node && node->peer);
+
+  if (!wheel->count)
+    wheel->time = node->t - node->t % NETQ_WHEEL_TICK;
+
+  /* nodes that are overdue are handled with the current slot */
+  node->slot = netq_wheel_slot(node->t < wheel->time + NETQ_WHEEL_TICK
+			       ? wheel->time : node->t);
+  DL_APPEND(wheel->slots[node->slot], node);
+  wheel->count++;
+
+  node->peer_next = node->peer->retransmit;
+  node->peer->retransmit = node;
+}
+
+void
+netq_wheel_remove(netq_wheel_t *wheel, netq_t *node) {
+  netq_t **p;
+
+  assert(wheel);
+  assert(node && node->peer);
+
+  DL_DELETE(wheel->slots[node->slot], node);
+  wheel->count--;
+
+  /* the list of a peer holds a single flight */
+  for (p = &node->peer->retransmit; *p; p = &(*p)->peer_next) {
+    if (*p == node) {
+      *p = node->peer_next;
+      break;
+    }
+  }
+  node->next = node->prev = node->peer_next = NULL;
+}
+
+netq_t *
+netq_wheel_expire(netq_wheel_t *wheel, clock_time_t now) {
+  netq_t *expired = NULL, *last = NULL, *node, *tmp;
+  unsigned int i;
+
+  assert(wheel);
+
+  /* visit each slot at most once, even after a long idle period */
+  for (i = 0; wheel->count && i < NETQ_WHEEL_SIZE; i++) {
+    DL_FOREACH_SAFE(wheel->slots[netq_wheel_slot(wheel->time)], node, tmp) {
+      if (node->t <= now) {
+	netq_wheel_remove(wheel, node);
+	if (last)
+	  last->next = node;
+	else
+	  expired = node;
+	last = node;
+      }
+    }
+
+    if (wheel->time + NETQ_WHEEL_TICK > now)
+      return expired;
+    wheel->time += NETQ_WHEEL_TICK;
+  }
+
+  wheel->time = now - now % NETQ_WHEEL_TICK;
+  return expired;
+}
+
+clock_time_t
+netq_wheel_next(const netq_wheel_t *wheel) {
+  clock_time_t start, next = 0;
+  netq_t *node;
+  unsigned int i;
+  int found = 0;
+
+  assert(wheel);
+  if (!wheel->count)
+    return 0;
+
+  for (i = 0; i < NETQ_WHEEL_SIZE; i++) {
+    start = wheel->time + i * NETQ_WHEEL_TICK;
+    DL_FOREACH(wheel->slots[netq_wheel_slot(start)], node) {
+      /* skip nodes that are due in a later revolution */
+      if (node->t < start + NETQ_WHEEL_TICK && (!found || node->t < next)) {
+	next = node->t;
+	found = 1;
+      }
+    }
+    if (found)
+      return next;
+  }
+  return wheel->time + NETQ_WHEEL_SIZE * NETQ_WHEEL_TICK;
+}
+
+void
+netq_wheel_delete_all(netq_wheel_t *wheel) {
+  netq_t *node;
+  unsigned int i;
+
+  assert(wheel);
+  for (i = 0; i < NETQ_WHEEL_SIZE; i++) {
+    while ((node = wheel->slots[i])) {
+      netq_wheel_remove(wheel, node);
+      netq_free_node(node);
+    }
+  }
+}
@@ -20,7 +20,7 @@
 
 #include "tinydtls.h"
 #include "global.h"
-#include "dtls.h"
+#include "peer.h"
 #include "dtls_time.h"
 
 /**
@@ -40,12 +40,15 @@
 #endif
 
 /** 
- * Datagrams in the netq_t structure have a fixed maximum size of
- * DTLS_MAX_BUF to simplify memory management on constrained nodes. */ 
+ * Datagrams in the netq_t structure have a maximum size of
+ * DTLS_MAX_BUF. On Contiki, shorter ones take a small buffer from
+ * dtls_buffer_alloc(). */
 typedef unsigned char netq_packet_t[DTLS_MAX_BUF];
 
 typedef struct netq_t {
   struct netq_t *next;
+  struct netq_t *prev;		/**< previous node in a netq_wheel_t slot */
+  struct netq_t *peer_next;	/**< next node of @c peer in a netq_wheel_t */
 
   clock_time_t t;	        /**< when to send PDU for the next time */
   unsigned int timeout;		/**< randomized timeout value */
@@ -54,12 +57,14 @@ typedef struct netq_t {
   uint16_t epoch;
   uint8_t type;
   unsigned char retransmit_cnt;	/**< retransmission counter, will be removed when zero */
+  uint8_t sealed;		/**< data is a record that is sent as is */
+  uint16_t slot;		/**< slot in a netq_wheel_t */
 
   size_t length;		/**< actual length of data */
 #ifndef WITH_CONTIKI
   unsigned char data[];		/**< the datagram to send */
 #else
-  netq_packet_t data;		/**< the datagram to send */
+  unsigned char *data;		/**< the datagram, from dtls_buffer_alloc() */
 #endif
 } netq_t;
 
@@ -88,8 +93,12 @@ void netq_node_free(netq_t *node);
 /** Removes all items from given queue and frees the allocated storage */
 void netq_delete_all(netq_t **queue);
 
-/** Creates a new node suitable for adding to a netq_t queue. */
-netq_t *netq_node_new(size_t size);
+/**
+ * Creates a new node suitable for adding to a netq_t queue, with
+ * room for @p size bytes of data. The node is taken from @p pools,
+ * or from malloc() if @p pools is @c NULL.
+ */
+netq_t *netq_node_new(dtls_pools_t *pools, size_t size);
 
 /**
  * Returns a pointer to the first item in given queue or NULL if
@@ -107,6 +116,56 @@ void netq_remove(netq_t **queue, netq_t *p);
  */
 netq_t *netq_pop_first(netq_t **queue);
 
+#ifndef NETQ_WHEEL_SIZE
+#ifndef WITH_CONTIKI
+#define NETQ_WHEEL_SIZE 64 /**< number of slots of a netq_wheel_t, a power of 2 */
+#else /* WITH_CONTIKI */
+#define NETQ_WHEEL_SIZE 8  /**< number of slots of a netq_wheel_t, a power of 2 */
+#endif /* WITH_CONTIKI */
+#endif /* NETQ_WHEEL_SIZE */
+
+#ifndef NETQ_WHEEL_TICK
+/** Period of time that is covered by one slot of a netq_wheel_t. */
+#define NETQ_WHEEL_TICK (CLOCK_SECOND / 4)
+#endif /* NETQ_WHEEL_TICK */
+
+/**
+ * A hashed timer wheel that orders nodes by their time-stamp t. Each
+ * slot covers NETQ_WHEEL_TICK, and nodes that are due after a full
+ * revolution share the slot with earlier ones. Adding and removing a
+ * node takes constant time. The nodes of each peer are linked through
+ * @c peer_next, starting at the @c retransmit member of the peer. The
+ * storage of a wheel is zeroed before its first use.
+ */
+typedef struct netq_wheel_t {
+  netq_t *slots[NETQ_WHEEL_SIZE]; /**< nodes in the order they were added */
+  clock_time_t time;		/**< start of the current slot */
+  size_t count;			/**< number of nodes in the wheel */
+} netq_wheel_t;
+
+/** Adds @p node to @p wheel and to the list of @c node->peer. */
+void netq_wheel_insert(netq_wheel_t *wheel, netq_t *node);
+
+/** Removes @p node from @p wheel and from the list of its peer. */
+void netq_wheel_remove(netq_wheel_t *wheel, netq_t *node);
+
+/**
+ * Removes all nodes that are due at @p now from @p wheel and returns
+ * them as a list that is linked via @c next, in the order they are
+ * due, with nodes that share a slot in the order they were added.
+ */
+netq_t *netq_wheel_expire(netq_wheel_t *wheel, clock_time_t now);
+
+/**
+ * Returns the time when netq_wheel_expire() must be called next, or
+ * @c 0 if @p wheel is empty. This is the due time of the next node,
+ * or the end of the current revolution if no node is due before.
+ */
+clock_time_t netq_wheel_next(const netq_wheel_t *wheel);
+
+/** Removes all nodes from @p wheel and releases their storage. */
+void netq_wheel_delete_all(netq_wheel_t *wheel);
+
 /**@}*/
 
 #endif /* _DTLS_NETQ_H_ */
@@ -17,6 +17,7 @@
 
 #include "global.h"
 #include "peer.h"
+#include "prng.h"
 #include "dtls_debug.h"
 
 #ifndef WITH_CONTIKI
@@ -25,8 +26,9 @@ void peer_init(void)
 }
 
 static inline dtls_peer_t *
-dtls_malloc_peer(void) {
-  return (dtls_peer_t *)malloc(sizeof(dtls_peer_t));
+dtls_malloc_peer(dtls_pools_t *pools) {
+  return (dtls_peer_t *)dtls_pool_alloc(pools ? &pools->peers : NULL,
+					sizeof(dtls_peer_t));
 }
 
 void
@@ -34,7 +36,7 @@ dtls_free_peer(dtls_peer_t *peer) {
   dtls_handshake_free(peer->handshake_params);
   dtls_security_free(peer->security_params[0]);
   dtls_security_free(peer->security_params[1]);
-  free(peer);
+  dtls_pool_free(peer);
 }
 #else /* WITH_CONTIKI */
 
@@ -47,7 +49,8 @@ peer_init(void) {
 }
 
 static inline dtls_peer_t *
-dtls_malloc_peer(void) {
+dtls_malloc_peer(dtls_pools_t *pools) {
+  (void)pools;
   return memb_alloc(&peer_storage);
 }
 
@@ -61,14 +64,16 @@ dtls_free_peer(dtls_peer_t *peer) {
 #endif /* WITH_CONTIKI */
 
 dtls_peer_t *
-dtls_new_peer(const session_t *session) {
+dtls_new_peer(dtls_pools_t *pools, const session_t *session) {
   dtls_peer_t *peer;
 
-  peer = dtls_malloc_peer();
+  peer = dtls_malloc_peer(pools);
   if (peer) {
     memset(peer, 0, sizeof(dtls_peer_t));
-    memcpy(&peer->session, session, sizeof(session_t));
-    peer->security_params[0] = dtls_security_new();
+    peer->pools = pools;
+    dtls_peer_set_session(peer, session);
+    peer->pmtu = DTLS_DEFAULT_PMTU;
+    peer->security_params[0] = dtls_security_new(pools);
 
     if (!peer->security_params[0]) {
       dtls_free_peer(peer);
@@ -80,3 +85,198 @@ dtls_new_peer(const session_t *session) {
 
   return peer;
 }
+
+session_t *
+dtls_peer_session(const dtls_peer_t *peer, session_t *session) {
+  dtls_session_from_key(&peer->key, session);
+#ifndef WITH_CONTIKI
+  session->size = peer->size;
+  if (peer->key.family == AF_INET6)
+    session->addr.sin6.sin6_scope_id = peer->scope_id;
+#endif /* WITH_CONTIKI */
+  return session;
+}
+
+void
+dtls_peer_set_session(dtls_peer_t *peer, const session_t *session) {
+  dtls_session_key(session, &peer->key);
+#ifndef WITH_CONTIKI
+  peer->size = session->size;
+  peer->scope_id = session->addr.sa.sa_family == AF_INET6
+    ? session->addr.sin6.sin6_scope_id : 0;
+#endif /* WITH_CONTIKI */
+}
+
+size_t
+dtls_peer_footprint(const dtls_peer_t *peer) {
+  size_t size = sizeof(dtls_peer_t);
+
+  if (peer->security_params[0])
+    size += sizeof(dtls_security_parameters_t);
+  if (peer->security_params[1])
+    size += sizeof(dtls_security_parameters_t);
+  if (peer->handshake_params)
+    size += sizeof(dtls_handshake_parameters_t);
+  return size;
+}
+
+#ifndef DTLS_PEERS_NOHASH
+/* slot index and tag are taken from different halves of the hash */
+#define DTLS_PEER_TAG(Hash) ((uint32_t)((Hash) >> 32) | 1)
+
+/** Returns the key of @p peer in @p table and sets @p length to its size. */
+static inline const void *
+dtls_peer_table_key(const dtls_peer_table_t *table, const dtls_peer_t *peer,
+		    size_t *length) {
+#if DTLS_CID_LENGTH > 0
+  if (table->by_cid) {
+    *length = DTLS_CID_LENGTH;
+    return peer->cid;
+  }
+#else /* DTLS_CID_LENGTH > 0 */
+  (void)table;
+#endif /* DTLS_CID_LENGTH > 0 */
+  *length = sizeof(dtls_peer_key_t);
+  return &peer->key;
+}
+
+static inline uint64_t
+dtls_peer_table_hash(const dtls_peer_table_t *table, const dtls_peer_t *peer) {
+#if DTLS_CID_LENGTH > 0
+  if (table->by_cid)
+    return dtls_cid_hash(peer->cid, table->secret);
+#endif /* DTLS_CID_LENGTH > 0 */
+  return dtls_peer_key_hash(&peer->key, table->secret);
+}
+
+int
+dtls_peer_table_init(dtls_peer_table_t *table, size_t max, int by_cid) {
+  size_t size = 8;
+
+  /* keep the load below 80% so that probe sequences stay short */
+  while (size < max + max / 4)
+    size <<= 1;
+
+  dtls_peer_table_free(table);
+  table->slots = (dtls_peer_slot_t *)calloc(size, sizeof(dtls_peer_slot_t));
+  if (!table->slots) {
+    dtls_warn("cannot allocate peer table\n");
+    return -1;
+  }
+
+  /* without the secret, colliding keys could be chosen to make
+   * lookups visit DTLS_PEER_PROBE_MAX slots */
+  if (!dtls_prng((unsigned char *)&table->secret, sizeof(table->secret)))
+    dtls_warn("cannot generate the secret of the peer table\n");
+
+  table->mask = size - 1;
+  table->max = max;
+  table->by_cid = by_cid;
+  return 0;
+}
+
+void
+dtls_peer_table_free(dtls_peer_table_t *table) {
+  free(table->slots);
+  memset(table, 0, sizeof(dtls_peer_table_t));
+}
+
+dtls_peer_t *
+dtls_peer_table_find(const dtls_peer_table_t *table,
+		     const void *key, uint64_t hash) {
+  uint32_t tag = DTLS_PEER_TAG(hash);
+  size_t i, dist, length;
+  dtls_peer_slot_t *slot;
+
+  if (!table->count)
+    return NULL;
+
+  /* A slot that is closer to its preferred slot than we are to ours
+   * ends the search, as the key would have been placed before it. */
+  for (i = hash & table->mask, dist = 0; dist <= DTLS_PEER_PROBE_MAX;
+       i = (i + 1) & table->mask, dist++) {
+    slot = &table->slots[i];
+    if (!slot->tag || slot->dist < dist)
+      return NULL;
+    if (slot->tag == tag) {
+      const void *k = dtls_peer_table_key(table, slot->peer, &length);
+      if (memcmp(k, key, length) == 0)
+	return slot->peer;
+    }
+  }
+  return NULL;
+}
+
+int
+dtls_peer_table_add(dtls_peer_table_t *table, dtls_peer_t *peer) {
+  dtls_peer_slot_t entry, tmp, *slot;
+  uint64_t hash;
+  size_t i, dist;
+
+  if (table->count >= table->max)
+    return -1;
+
+  hash = dtls_peer_table_hash(table, peer);
+
+  /* The entry that is moved on takes over the distance of the entry
+   * it displaces. None of them must end up too far away. */
+  for (i = hash & table->mask, dist = 0; table->slots[i].tag;
+       i = (i + 1) & table->mask, dist++) {
+    if (table->slots[i].dist < dist)
+      dist = table->slots[i].dist;
+    if (dist >= DTLS_PEER_PROBE_MAX) {
+      dtls_warn("too many collisions in the peer table\n");
+      return -1;
+    }
+  }
+
+  entry.tag = DTLS_PEER_TAG(hash);
+  entry.dist = 0;
+  entry.peer = peer;
+
+  /* take the slot of entries that are closer to their preferred slot */
+  for (i = hash & table->mask; ; i = (i + 1) & table->mask, entry.dist++) {
+    slot = &table->slots[i];
+    if (!slot->tag) {
+      *slot = entry;
+      break;
+    }
+    if (slot->dist < entry.dist) {
+      tmp = *slot;
+      *slot = entry;
+      entry = tmp;
+    }
+  }
+
+  table->count++;
+  return 0;
+}
+
+void
+dtls_peer_table_remove(dtls_peer_table_t *table, dtls_peer_t *peer) {
+  uint64_t hash;
+  size_t i, next, dist;
+
+  if (!table->count)
+    return;
+
+  hash = dtls_peer_table_hash(table, peer);
+  for (i = hash & table->mask, dist = 0; ; i = (i + 1) & table->mask, dist++) {
+    if (!table->slots[i].tag || table->slots[i].dist < dist
+	|| dist > DTLS_PEER_PROBE_MAX)
+      return;
+    if (table->slots[i].peer == peer)
+      break;
+  }
+
+  /* shift the following entries back, so no tombstones are needed */
+  for (next = (i + 1) & table->mask;
+       table->slots[next].tag && table->slots[next].dist > 0;
+       i = next, next = (next + 1) & table->mask) {
+    table->slots[i] = table->slots[next];
+    table->slots[i].dist--;
+  }
+  memset(&table->slots[i], 0, sizeof(dtls_peer_slot_t));
+  table->count--;
+}
+#endif /* DTLS_PEERS_NOHASH */
@@ -31,32 +31,191 @@
 
 #include "state.h"
 #include "crypto.h"
+#include "dtls_time.h"
 
-#ifndef DTLS_PEERS_NOHASH
-#include "uthash.h"
-#endif /* DTLS_PEERS_NOHASH */
+#ifndef DTLS_PEER_MAX
+/**
+ * The maximum number of peers of a context, unless changed with
+ * dtls_set_peer_max(). The peer table is allocated for this number
+ * of peers when the context is created.
+ */
+#define DTLS_PEER_MAX 1024
+#endif /* DTLS_PEER_MAX */
+
+#ifndef DTLS_HANDSHAKE_MAX
+/**
+ * The maximum number of peers of a context that have not completed
+ * their handshake, unless changed with dtls_set_handshake_max().
+ */
+#define DTLS_HANDSHAKE_MAX DTLS_PEER_MAX
+#endif /* DTLS_HANDSHAKE_MAX */
+
+#ifndef DTLS_PEER_IDLE_TIMEOUT
+/**
+ * Number of seconds without a record from a peer after which the
+ * peer is removed, unless changed with dtls_set_idle_timeout(). A
+ * value of @c 0 keeps idle peers until they are closed.
+ */
+#define DTLS_PEER_IDLE_TIMEOUT 0
+#endif /* DTLS_PEER_IDLE_TIMEOUT */
+
+#ifndef DTLS_PEER_EXPIRE_BATCH
+/** Maximum number of idle peers that are removed in one call. */
+#define DTLS_PEER_EXPIRE_BATCH 16
+#endif /* DTLS_PEER_EXPIRE_BATCH */
 
 typedef enum { DTLS_CLIENT=0, DTLS_SERVER } dtls_peer_type;
 
+/**
+ * Returns @c 1 if @p Role is DTLS_CLIENT. The result is a constant
+ * when only one side of the handshake is built, which removes the
+ * code of the other side.
+ */
+#if !DTLS_SERVER_SUPPORT
+#define dtls_role_is_client(Role) ((void)(Role), 1)
+#elif !DTLS_CLIENT_SUPPORT
+#define dtls_role_is_client(Role) ((void)(Role), 0)
+#else
+#define dtls_role_is_client(Role) ((Role) == DTLS_CLIENT)
+#endif
+
 /** 
  * Holds security parameters, local state and the transport address
- * for each peer. */
+ * for each peer. The address is kept in the compact form of the peer
+ * table, dtls_peer_session() restores the session_t. Once the
+ * handshake is complete, only the security parameters of the current
+ * epoch remain, see DTLS_PEER_CONNECTED_SIZE. */
 typedef struct dtls_peer_t {
 #ifdef DTLS_PEERS_NOHASH
   struct dtls_peer_t *next;
-#else /* DTLS_PEERS_NOHASH */
-  UT_hash_handle hh;
 #endif /* DTLS_PEERS_NOHASH */
 
-  session_t session;	     /**< peer address and local interface */
+  dtls_peer_key_t key;	     /**< peer address and local interface */
+#ifndef WITH_CONTIKI
+  uint32_t scope_id;	     /**< scope of an IPv6 link-local address */
+#endif /* WITH_CONTIKI */
+  uint16_t pmtu;             /**< maximum size of datagrams to this peer */
+#ifndef WITH_CONTIKI
+  uint8 size;		     /**< @c size of the peer's session_t */
+#endif /* WITH_CONTIKI */
+  uint8 half_open;	     /**< in the handshake list of the context */
+#if DTLS_CID_LENGTH > 0
+  uint8 has_cid;	     /**< @c cid is valid */
+  uint8 cid[DTLS_CID_LENGTH]; /**< connection ID we have assigned to the peer */
+#endif /* DTLS_CID_LENGTH > 0 */
+  dtls_pools_t *pools;	     /**< storage for the parameters, may be @c NULL */
 
   dtls_peer_type role;       /**< denotes if this host is DTLS_CLIENT or DTLS_SERVER */
   dtls_state_t state;        /**< DTLS engine state */
+  clock_time_t last_seen;    /**< when the last record has been received */
 
   dtls_security_parameters_t *security_params[2];
   dtls_handshake_parameters_t *handshake_params;
+  struct netq_t *retransmit;   /**< our packets that wait for retransmission */
+  struct dtls_peer_t *lru_prev; /**< more recently active peer, the
+				     least recent one at the head */
+  struct dtls_peer_t *lru_next; /**< less recently active peer */
 } dtls_peer_t;
 
+/**
+ * The number of bytes that a peer in DTLS_STATE_CONNECTED occupies,
+ * i.e. the peer and the security parameters of its current epoch,
+ * without the overhead of the allocator and the peer table. With the
+ * default configuration on a 64-bit Linux host, these are 112 + 688
+ * bytes (112 + 608 without WITH_AES_HW, 48 or 80 bytes less without
+ * DTLS_CHACHA20). The handshake parameters are
+ * released when the handshake is complete. The previous epoch is kept
+ * to retransmit our last flight until a record of the new epoch has
+ * been received, see dtls_peer_footprint().
+ */
+#define DTLS_PEER_CONNECTED_SIZE \
+  (sizeof(dtls_peer_t) + sizeof(dtls_security_parameters_t))
+
+#ifndef DTLS_PEERS_NOHASH
+#ifndef DTLS_PEER_PROBE_MAX
+/**
+ * Maximum distance of a peer from its preferred slot in the peer
+ * table. A peer that would have to be placed further away is not
+ * added, which bounds the number of slots that a lookup visits.
+ */
+#define DTLS_PEER_PROBE_MAX 32
+#endif /* DTLS_PEER_PROBE_MAX */
+
+/**
+ * A slot of the peer table. The slot stores a part of the hash value
+ * of the peer's key, so that only matching peers are accessed.
+ */
+typedef struct {
+  uint32_t tag;		     /**< upper half of the hash value, @c 0 if unused */
+  uint32_t dist;	     /**< distance from the preferred slot */
+  dtls_peer_t *peer;
+} dtls_peer_slot_t;
+
+/**
+ * Open-addressing hash table of peers with Robin Hood probing. The
+ * slots are allocated once for a maximum number of peers and the
+ * table is never resized while it is in use.
+ */
+typedef struct {
+  dtls_peer_slot_t *slots;
+  size_t mask;		     /**< number of slots - 1 */
+  size_t count;		     /**< number of peers in the table */
+  size_t max;		     /**< maximum number of peers */
+  uint64_t secret;	     /**< random input of the hash values */
+  int by_cid;		     /**< keyed on the peers' @c cid instead of @c key */
+} dtls_peer_table_t;
+
+/**
+ * Allocates the slots of @p table for at most @p max peers. Any
+ * previous slots of @p table are released. The peers are looked up
+ * by their address key, or by their connection ID if @p by_cid is
+ * set. A new secret for the hash values is taken from dtls_prng().
+ *
+ * @return @c 0 on success, a value less than zero on error.
+ */
+int dtls_peer_table_init(dtls_peer_table_t *table, size_t max, int by_cid);
+
+/** Releases the slots of @p table. The peers are not freed. */
+void dtls_peer_table_free(dtls_peer_table_t *table);
+
+/**
+ * Returns the peer with @p key from @p table, or @c NULL if not
+ * found. @p key is a dtls_peer_key_t and @p hash its
+ * dtls_peer_key_hash(), or a connection ID and its dtls_cid_hash(),
+ * both with the @c secret of @p table.
+ */
+dtls_peer_t *dtls_peer_table_find(const dtls_peer_table_t *table,
+				  const void *key, uint64_t hash);
+
+/**
+ * Adds @p peer to @p table.
+ *
+ * @return @c 0 on success, a value less than zero if the table is
+ *         full or @p peer would be placed more than
+ *         DTLS_PEER_PROBE_MAX slots away from its preferred slot.
+ */
+int dtls_peer_table_add(dtls_peer_table_t *table, dtls_peer_t *peer);
+
+/** Removes @p peer from @p table if present. */
+void dtls_peer_table_remove(dtls_peer_table_t *table, dtls_peer_t *peer);
+#endif /* DTLS_PEERS_NOHASH */
+
+#if DTLS_CID_LENGTH > 0
+/**
+ * Returns a 64-bit hash value for the connection ID @p cid, see
+ * dtls_peer_key_hash().
+ */
+static inline uint64_t
+dtls_cid_hash(const uint8 *cid, uint64_t secret) {
+  dtls_peer_key_t key;
+
+  /* connection IDs are random, a part of longer ones is sufficient */
+  memset(&key, 0, sizeof(key));
+  memcpy(key.addr, cid, min(DTLS_CID_LENGTH, sizeof(key.addr)));
+  return dtls_peer_key_hash(&key, secret);
+}
+#endif /* DTLS_CID_LENGTH > 0 */
+
 static inline dtls_security_parameters_t *dtls_security_params_epoch(dtls_peer_t *peer, uint16_t epoch)
 {
   if (peer->security_params[0] && peer->security_params[0]->epoch == epoch) {
@@ -78,7 +237,7 @@ static inline dtls_security_parameters_t *dtls_security_params_next(dtls_peer_t
   if (peer->security_params[1])
     dtls_security_free(peer->security_params[1]);
 
-  peer->security_params[1] = dtls_security_new();
+  peer->security_params[1] = dtls_security_new(peer->pools);
   if (!peer->security_params[1]) {
     return NULL;
   }
@@ -115,15 +274,33 @@ void peer_init(void);
  * peer or NULL on error. The caller is responsible for releasing the
  * storage allocated for this peer using dtls_free_peer().
  *
+ * @param pools    The storage for the peer and its parameters, or
+ *                 @c NULL to use malloc().
  * @param session  The remote peer's address and local interface index.
  * @return A pointer to a newly created and initialized peer object
  * or NULL on error.
  */
-dtls_peer_t *dtls_new_peer(const session_t *session);
+dtls_peer_t *dtls_new_peer(dtls_pools_t *pools, const session_t *session);
 
 /** Releases the storage allocated to @p peer. */
 void dtls_free_peer(dtls_peer_t *peer);
 
+/**
+ * Fills @p session with the address of @p peer and returns @p session.
+ * The flow label of an IPv6 address is not restored.
+ */
+session_t *dtls_peer_session(const dtls_peer_t *peer, session_t *session);
+
+/** Changes the address of @p peer to @p session. */
+void dtls_peer_set_session(dtls_peer_t *peer, const session_t *session);
+
+/**
+ * Returns the number of bytes that are currently allocated for @p
+ * peer and its parameters, which is DTLS_PEER_CONNECTED_SIZE for a
+ * connected peer.
+ */
+size_t dtls_peer_footprint(const dtls_peer_t *peer);
+
 /** Returns the current state of @p peer. */
 static inline dtls_state_t dtls_peer_state(const dtls_peer_t *peer) {
   return peer->state;
@@ -0,0 +1,201 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2011, 2012, 2013, 2014, 2015 Olaf Bergmann (TZI) and others.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v. 1.0 which accompanies this distribution.
+ *
+ * The Eclipse Public License is available at http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Olaf Bergmann  - initial API and implementation
+ *
+ *******************************************************************************/
+
+#include "pool.h"
+
+#ifndef WITH_CONTIKI
+#include <stdlib.h>
+#include <string.h>
+
+#include "dtls_debug.h"
+
+#ifdef HAVE_ASSERT_H
+#include <assert.h>
+#else
+#ifndef assert
+#warning "assertions are disabled"
+#  define assert(x)
+#endif
+#endif
+
+/**
+ * The header in front of each object. It is large enough to keep the
+ * objects suitably aligned.
+ */
+typedef union dtls_pool_block_t {
+  struct {
+    dtls_pool_t *pool;		   /**< owner, @c NULL for the heap */
+    const dtls_allocator_t *allocator; /**< heap, @c NULL for malloc() */
+  } owner;
+  union dtls_pool_block_t *next;   /**< next free block */
+  uint64_t align_u64;
+  double align_double;
+  void *align_ptr;
+} dtls_pool_block_t;
+
+/** The allocator for storage without a context. */
+static const dtls_allocator_t *dtls_allocator = NULL;
+
+static inline void *
+dtls_heap_alloc(const dtls_allocator_t *allocator, size_t size) {
+  return allocator ? allocator->alloc(size, allocator->arg) : malloc(size);
+}
+
+static inline void
+dtls_heap_free(const dtls_allocator_t *allocator, void *ptr) {
+  if (allocator)
+    allocator->dealloc(ptr, allocator->arg);
+  else
+    free(ptr);
+}
+
+void
+dtls_set_allocator(const dtls_allocator_t *allocator) {
+  dtls_allocator = allocator;
+}
+
+const dtls_allocator_t *
+dtls_get_allocator(void) {
+  return dtls_allocator;
+}
+
+/** Returns the size of one block of @p pool, including its header. */
+static inline size_t
+dtls_pool_block_size(const dtls_pool_t *pool) {
+  return sizeof(dtls_pool_block_t) +
+    (pool->size + sizeof(dtls_pool_block_t) - 1)
+    / sizeof(dtls_pool_block_t) * sizeof(dtls_pool_block_t);
+}
+
+int
+dtls_pool_init(dtls_pool_t *pool, size_t size, size_t count,
+	       const dtls_allocator_t *allocator) {
+  dtls_pool_block_t *block;
+  size_t i;
+
+  memset(pool, 0, sizeof(dtls_pool_t));
+  pool->allocator = allocator;
+  pool->size = size;
+  if (!count)
+    return 0;
+
+  if (count > SIZE_MAX / dtls_pool_block_size(pool))
+    return -1;
+  pool->storage = (unsigned char *)
+    dtls_heap_alloc(allocator, count * dtls_pool_block_size(pool));
+  if (!pool->storage) {
+    dtls_warn("cannot allocate pool of %zu objects\n", count);
+    return -1;
+  }
+  memset(pool->storage, 0, count * dtls_pool_block_size(pool));
+  pool->count = count;
+
+  for (i = count; i > 0; i--) {
+    block = (dtls_pool_block_t *)
+      (pool->storage + (i - 1) * dtls_pool_block_size(pool));
+    block->next = pool->free;
+    pool->free = block;
+  }
+  return 0;
+}
+
+void
+dtls_pool_release(dtls_pool_t *pool) {
+  if (pool->storage)
+    dtls_heap_free(pool->allocator, pool->storage);
+  memset(pool, 0, sizeof(dtls_pool_t));
+}
+
+void *
+dtls_pool_alloc(dtls_pool_t *pool, size_t size) {
+  const dtls_allocator_t *allocator;
+  dtls_pool_block_t *block;
+
+  if (!pool || !pool->count) {
+    allocator = pool ? pool->allocator : dtls_allocator;
+    block = (dtls_pool_block_t *)
+      dtls_heap_alloc(allocator, sizeof(dtls_pool_block_t) + size);
+    if (!block)
+      return NULL;
+    block->owner.pool = NULL;
+    block->owner.allocator = allocator;
+    return block + 1;
+  }
+
+  if (size > pool->size || !pool->free)
+    return NULL;
+
+  block = pool->free;
+  pool->free = block->next;
+  pool->used++;
+  block->owner.pool = pool;
+  return block + 1;
+}
+
+void
+dtls_pool_free(void *ptr) {
+  dtls_pool_block_t *block;
+  dtls_pool_t *pool;
+
+  if (!ptr)
+    return;
+
+  block = (dtls_pool_block_t *)ptr - 1;
+  pool = block->owner.pool;
+  if (!pool) {
+    dtls_heap_free(block->owner.allocator, block);
+    return;
+  }
+
+  assert(pool->used);
+  block->next = pool->free;
+  pool->free = block;
+  pool->used--;
+}
+#else /* WITH_CONTIKI */
+#include "memb.h"
+
+typedef unsigned char dtls_small_buffer_t[DTLS_BUFFER_SMALL_SIZE];
+typedef unsigned char dtls_large_buffer_t[DTLS_MAX_BUF];
+
+MEMB(small_buffer_storage, dtls_small_buffer_t, DTLS_BUFFER_SMALL_COUNT);
+MEMB(large_buffer_storage, dtls_large_buffer_t, DTLS_BUFFER_LARGE_COUNT);
+
+void
+dtls_buffer_init(void) {
+  memb_init(&small_buffer_storage);
+  memb_init(&large_buffer_storage);
+}
+
+unsigned char *
+dtls_buffer_alloc(size_t size) {
+  unsigned char *buf = NULL;
+
+  if (size <= DTLS_BUFFER_SMALL_SIZE)
+    buf = memb_alloc(&small_buffer_storage);
+  if (!buf && size <= DTLS_MAX_BUF)
+    buf = memb_alloc(&large_buffer_storage);
+  return buf;
+}
+
+void
+dtls_buffer_free(unsigned char *buf) {
+  if (memb_inmemb(&small_buffer_storage, buf))
+    memb_free(&small_buffer_storage, buf);
+  else if (buf)
+    memb_free(&large_buffer_storage, buf);
+}
+#endif /* WITH_CONTIKI */
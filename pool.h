@@ -0,0 +1,186 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2011, 2012, 2013, 2014, 2015 Olaf Bergmann (TZI) and others.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v. 1.0 which accompanies this distribution.
+ *
+ * The Eclipse Public License is available at http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Olaf Bergmann  - initial API and implementation
+ *
+ *******************************************************************************/
+
+/**
+ * @file pool.h
+ * @brief Fixed-size object pools for the storage of a DTLS context
+ *
+ * On Contiki, peers, handshakes, security parameters and queued
+ * packets are taken from static MEMB storage. Other platforms use
+ * malloc() by default, or preallocated pools that are owned by a
+ * dtls_context_t when DTLS_POOL_PEERS is set. Objects from a pool
+ * can be released without knowing the context, as each block records
+ * the pool it belongs to. The memory that is not from MEMB storage can
+ * be taken from an application-defined dtls_allocator_t instead of
+ * malloc(), e.g. from an arena per thread.
+ *
+ * On Contiki, the datagrams of queued packets are borrowed from two
+ * classes of buffers, see dtls_buffer_alloc(), so that most short
+ * handshake messages do not occupy DTLS_MAX_BUF bytes.
+ */
+
+#ifndef _DTLS_POOL_H_
+#define _DTLS_POOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tinydtls.h"
+#include "global.h"
+
+#ifndef DTLS_POOL_PEERS
+/**
+ * Number of peers that each context preallocates together with their
+ * handshakes, security parameters and packet queue nodes. With a
+ * value of @c 0, this storage is taken from malloc() on demand.
+ * When a pool is exhausted, the allocation fails like on Contiki.
+ * Not used on Contiki.
+ */
+#define DTLS_POOL_PEERS 0
+#endif /* DTLS_POOL_PEERS */
+
+#ifndef DTLS_POOL_HANDSHAKES
+/** Number of concurrent handshakes in the pools of a context. */
+#define DTLS_POOL_HANDSHAKES DTLS_POOL_PEERS
+#endif /* DTLS_POOL_HANDSHAKES */
+
+/** Number of security parameters for @p Peers and @p Handshakes. */
+#define DTLS_POOL_SECURITY(Peers, Handshakes) ((Peers) + (Handshakes))
+
+/**
+ * Number of packet queue nodes for @p Handshakes, i.e. a flight to
+ * retransmit and some out-of-order messages per handshake.
+ */
+#define DTLS_POOL_NETQ(Handshakes) (8 * (Handshakes))
+
+#ifndef WITH_CONTIKI
+/**
+ * An allocator that replaces malloc() and free() for the storage of
+ * tinydtls. Both functions receive @c arg as their last argument.
+ * The allocator must remain valid until all memory that has been
+ * taken from it has been released.
+ */
+typedef struct dtls_allocator_t {
+  /** Returns @p size bytes of memory, or @c NULL on error. */
+  void *(*alloc)(size_t size, void *arg);
+  /** Releases @p ptr that has been returned by alloc(). */
+  void (*dealloc)(void *ptr, void *arg);
+  void *arg;			/**< application data for the functions */
+} dtls_allocator_t;
+#endif /* WITH_CONTIKI */
+
+/** A pool of @c count objects of at most @c size bytes. */
+typedef struct dtls_pool_t {
+#ifndef WITH_CONTIKI
+  const dtls_allocator_t *allocator; /**< @c NULL for malloc() */
+#endif /* WITH_CONTIKI */
+  size_t size;			/**< maximum size of the objects */
+  size_t count;			/**< number of objects, @c 0 for the heap */
+  size_t used;			/**< number of allocated objects */
+  union dtls_pool_block_t *free; /**< list of free blocks */
+  unsigned char *storage;	/**< the memory of all blocks */
+} dtls_pool_t;
+
+/** The pools that hold the storage of a dtls_context_t. */
+typedef struct dtls_pools_t {
+#ifndef WITH_CONTIKI
+  const dtls_allocator_t *allocator; /**< heap of the context */
+  dtls_pool_t peers;		/**< dtls_peer_t */
+  dtls_pool_t handshakes;	/**< dtls_handshake_parameters_t */
+  dtls_pool_t security;		/**< dtls_security_parameters_t */
+  dtls_pool_t netq;		/**< netq_t with its datagram */
+  dtls_pool_t ecc_jobs;		/**< dtls_ecc_job_t */
+#else /* WITH_CONTIKI */
+  int unused;			/**< MEMB storage is used instead */
+#endif /* WITH_CONTIKI */
+} dtls_pools_t;
+
+#ifndef WITH_CONTIKI
+/**
+ * Sets the allocator that is used for storage which does not belong
+ * to a context, and by the contexts that are created afterwards with
+ * dtls_new_context(). Each context keeps its allocator for its whole
+ * lifetime, so different contexts can use different allocators by
+ * changing the allocator before creating them. Passing @c NULL
+ * restores malloc(). This must not be called concurrently with
+ * dtls_new_context() or the creation of HMAC contexts.
+ *
+ * @param allocator The allocator to use or @c NULL.
+ */
+void dtls_set_allocator(const dtls_allocator_t *allocator);
+
+/** Returns the allocator set with dtls_set_allocator() or @c NULL. */
+const dtls_allocator_t *dtls_get_allocator(void);
+
+/**
+ * Allocates the storage for @p count objects of at most @p size
+ * bytes in @p pool from @p allocator. A @p count of @c 0 makes @p
+ * pool hand out memory from @p allocator on demand. An @p allocator
+ * of @c NULL stands for malloc().
+ *
+ * @return @c 0 on success, a value less than zero on error.
+ */
+int dtls_pool_init(dtls_pool_t *pool, size_t size, size_t count,
+		   const dtls_allocator_t *allocator);
+
+/**
+ * Releases the storage of @p pool. Objects that have not been
+ * returned with dtls_pool_free() become invalid.
+ */
+void dtls_pool_release(dtls_pool_t *pool);
+
+/**
+ * Returns an object of @p size bytes from @p pool, or @c NULL if
+ * @p pool is exhausted or @p size exceeds its object size. If @p pool
+ * has no storage, the object is taken from its allocator. If @p pool
+ * is @c NULL, the allocator set with dtls_set_allocator() is used.
+ */
+void *dtls_pool_alloc(dtls_pool_t *pool, size_t size);
+
+/** Returns @p ptr from dtls_pool_alloc() to the pool it belongs to. */
+void dtls_pool_free(void *ptr);
+#else /* WITH_CONTIKI */
+
+#ifndef DTLS_BUFFER_SMALL_SIZE
+/** Size of the small buffers of dtls_buffer_alloc(). */
+#define DTLS_BUFFER_SMALL_SIZE 64
+#endif /* DTLS_BUFFER_SMALL_SIZE */
+
+#ifndef DTLS_BUFFER_SMALL_COUNT
+/** Number of small buffers that are shared by all contexts. */
+#define DTLS_BUFFER_SMALL_COUNT 4
+#endif /* DTLS_BUFFER_SMALL_COUNT */
+
+#ifndef DTLS_BUFFER_LARGE_COUNT
+/** Number of buffers of DTLS_MAX_BUF bytes shared by all contexts. */
+#define DTLS_BUFFER_LARGE_COUNT 2
+#endif /* DTLS_BUFFER_LARGE_COUNT */
+
+/** Initializes the storage of dtls_buffer_alloc(). */
+void dtls_buffer_init(void);
+
+/**
+ * Returns a buffer of at least @p size bytes, a small one if @p size
+ * does not exceed DTLS_BUFFER_SMALL_SIZE and one is left, or @c NULL
+ * if @p size exceeds DTLS_MAX_BUF or all fitting buffers are in use.
+ */
+unsigned char *dtls_buffer_alloc(size_t size);
+
+/** Returns @p buf from dtls_buffer_alloc() to its class. */
+void dtls_buffer_free(unsigned char *buf);
+#endif /* WITH_CONTIKI */
+
+#endif /* _DTLS_POOL_H_ */
@@ -0,0 +1,236 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2011, 2012, 2013, 2014, 2015 Olaf Bergmann (TZI) and others.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v. 1.0 which accompanies this distribution.
+ *
+ * The Eclipse Public License is available at http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Olaf Bergmann  - initial API and implementation
+ *
+ *******************************************************************************/
+
+#include "tinydtls.h"
+
+#ifndef WITH_CONTIKI
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef HAVE_SYS_RANDOM_H
+#include <sys/random.h>
+#endif /* HAVE_SYS_RANDOM_H */
+#ifdef HAVE_PTHREAD_ATFORK
+#include <pthread.h>
+#endif /* HAVE_PTHREAD_ATFORK */
+
+#include "global.h"
+#include "prng.h"
+#include "aes/rijndael.h"
+
+#ifndef DTLS_PRNG_BUFFER_SIZE
+/** Bytes of keystream that are generated at once, a multiple of 16. */
+#define DTLS_PRNG_BUFFER_SIZE 256
+#endif /* DTLS_PRNG_BUFFER_SIZE */
+
+#ifndef DTLS_PRNG_RESEED_INTERVAL
+/** Bytes that are output before a new seed is read. */
+#define DTLS_PRNG_RESEED_INTERVAL (1UL << 20)
+#endif /* DTLS_PRNG_RESEED_INTERVAL */
+
+/**
+ * The generator of one thread. The keystream of AES-128 in counter
+ * mode is generated in blocks of DTLS_PRNG_BUFFER_SIZE bytes, and the
+ * first 16 bytes of each block replace the key, so that earlier output
+ * cannot be recovered from the state. Bytes are cleared when they are
+ * handed out.
+ */
+typedef struct {
+  rijndael_ctx aes;
+  unsigned char counter[16];
+  unsigned char buf[DTLS_PRNG_BUFFER_SIZE];
+  size_t avail;			/**< unused bytes at the end of buf */
+  unsigned long output;		/**< bytes handed out since the seed */
+#ifdef HAVE_PTHREAD_ATFORK
+  unsigned int forks;		/**< value of forks when seeded */
+#else /* HAVE_PTHREAD_ATFORK */
+  pid_t pid;			/**< the process that has seeded */
+#endif /* HAVE_PTHREAD_ATFORK */
+  int seeded;
+  int fixed;			/**< seeded by dtls_prng_set_seed() */
+} dtls_prng_state_t;
+
+static DTLS_THREAD_LOCAL dtls_prng_state_t prng;
+
+/** Set by dtls_prng_set_entropy() to replace prng_entropy(). */
+static int (*prng_entropy_hook)(unsigned char *buf, size_t len);
+
+#ifdef HAVE_PTHREAD_ATFORK
+/* A child process must not continue the generator of its parent, so
+ * each fork() invalidates the state of all threads. */
+static volatile unsigned int forks;
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+static void
+prng_forked(void) {
+  forks++;
+}
+
+static void
+prng_register_atfork(void) {
+  (void)pthread_atfork(NULL, NULL, prng_forked);
+}
+#endif /* HAVE_PTHREAD_ATFORK */
+
+/** Reads @p len bytes of entropy from the operating system. */
+static int
+prng_entropy(unsigned char *buf, size_t len) {
+  FILE *urandom;
+  size_t n;
+
+#ifdef HAVE_GETRANDOM
+  ssize_t res;
+
+  while (len) {
+    res = getrandom(buf, len, 0);
+    if (res < 0) {
+      if (errno == EINTR)
+	continue;
+      break;
+    }
+    buf += res;
+    len -= res;
+  }
+  if (!len)
+    return 1;
+#endif /* HAVE_GETRANDOM */
+
+  urandom = fopen("/dev/urandom", "r");
+  if (!urandom)
+    return 0;
+  n = fread(buf, 1, len, urandom);
+  fclose(urandom);
+  return n == len;
+}
+
+/** Keys @p p with the 32 bytes of @p seed. */
+static void
+prng_key(dtls_prng_state_t *p, const unsigned char *seed) {
+  rijndael_set_key_enc_only(&p->aes, seed, 128);
+  memcpy(p->counter, seed + 16, sizeof(p->counter));
+  p->avail = 0;
+  p->output = 0;
+#ifdef HAVE_PTHREAD_ATFORK
+  pthread_once(&atfork_once, prng_register_atfork);
+  p->forks = forks;
+#else /* HAVE_PTHREAD_ATFORK */
+  p->pid = getpid();
+#endif /* HAVE_PTHREAD_ATFORK */
+  p->seeded = 1;
+}
+
+static int
+prng_seed(dtls_prng_state_t *p) {
+  unsigned char seed[32];
+  int ok;
+
+  ok = prng_entropy_hook ? prng_entropy_hook(seed, sizeof(seed))
+    : prng_entropy(seed, sizeof(seed));
+  if (!ok)
+    return 0;
+
+  prng_key(p, seed);
+  memset(seed, 0, sizeof(seed));
+  return 1;
+}
+
+/** Whether @p p has been seeded in the parent of this process. */
+static inline int
+prng_inherited(const dtls_prng_state_t *p) {
+#ifdef HAVE_PTHREAD_ATFORK
+  return p->forks != forks;
+#else /* HAVE_PTHREAD_ATFORK */
+  return p->pid != getpid();
+#endif /* HAVE_PTHREAD_ATFORK */
+}
+
+/** Whether @p p must be seeded before it is used. */
+static inline int
+prng_stale(const dtls_prng_state_t *p) {
+  if (!p->seeded)
+    return 1;
+  if (p->fixed)
+    return 0;
+  return p->output >= DTLS_PRNG_RESEED_INTERVAL || prng_inherited(p);
+}
+
+static void
+prng_refill(dtls_prng_state_t *p) {
+  unsigned char in[16 + DTLS_PRNG_BUFFER_SIZE];
+  unsigned char out[16 + DTLS_PRNG_BUFFER_SIZE];
+  size_t i;
+  int k;
+
+  for (i = 0; i < sizeof(in); i += 16) {
+    memcpy(in + i, p->counter, 16);
+    for (k = 15; k >= 0 && ++p->counter[k] == 0; k--)
+      ;
+  }
+  rijndael_encrypt_blocks(&p->aes, in, out, sizeof(in) / 16);
+
+  rijndael_set_key_enc_only(&p->aes, out, 128);
+  memcpy(p->buf, out + 16, DTLS_PRNG_BUFFER_SIZE);
+  memset(out, 0, sizeof(out));
+  p->avail = DTLS_PRNG_BUFFER_SIZE;
+}
+
+int
+dtls_prng(unsigned char *buf, size_t len) {
+  dtls_prng_state_t *p = &prng;
+  unsigned char *src;
+  size_t n;
+
+  /* When only the periodic reseed fails, the current key is still
+   * good, and the seed is read again on the next call. */
+  if (prng_stale(p) && !prng_seed(p) && (!p->seeded || prng_inherited(p)))
+    return 0;
+
+  p->output += len;
+  while (len) {
+    if (!p->avail)
+      prng_refill(p);
+    n = len < p->avail ? len : p->avail;
+    src = p->buf + DTLS_PRNG_BUFFER_SIZE - p->avail;
+    memcpy(buf, src, n);
+    memset(src, 0, n);
+    p->avail -= n;
+    buf += n;
+    len -= n;
+  }
+  return 1;
+}
+
+void
+dtls_prng_init(unsigned short seed) {
+  (void)seed;
+  /* the generator of this thread is seeded again on its next use */
+  memset(&prng, 0, sizeof(prng));
+}
+
+void
+dtls_prng_set_entropy(int (*entropy)(unsigned char *buf, size_t len)) {
+  prng_entropy_hook = entropy;
+}
+
+void
+dtls_prng_set_seed(const unsigned char seed[DTLS_PRNG_SEED_LENGTH]) {
+  memset(&prng, 0, sizeof(prng));
+  prng_key(&prng, seed);
+  prng.fixed = 1;
+}
+
+#endif /* WITH_CONTIKI */
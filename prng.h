@@ -31,24 +31,50 @@
  */
 
 #ifndef WITH_CONTIKI
-#include <stdlib.h>
+#include <stddef.h>
 
 /**
- * Fills \p buf with \p len random bytes. This is the default
- * implementation for prng().  You might want to change prng() to use
- * a better PRNG on your specific platform.
+ * Fills \p buf with \p len random bytes. The bytes are taken from a
+ * buffered AES-128-CTR generator of the calling thread, which is
+ * seeded from getrandom() or /dev/urandom on first use, after
+ * DTLS_PRNG_RESEED_INTERVAL bytes and in the child after fork(). If
+ * only the reseed after DTLS_PRNG_RESEED_INTERVAL bytes fails, the
+ * current state is used further and the seed is read again with the
+ * next call.
+ *
+ * \return 1 on success, 0 if the generator of the calling thread has
+ *         never been seeded or has been seeded before fork(), and no
+ *         new seed could be obtained. \p buf must not be used then.
  */
-static inline int
-dtls_prng(unsigned char *buf, size_t len) {
-  while (len--)
-    *buf++ = rand() & 0xFF;
-  return 1;
-}
+int dtls_prng(unsigned char *buf, size_t len);
 
-static inline void
-dtls_prng_init(unsigned short seed) {
-	srand(seed);
-}
+/**
+ * Replaces the source of the seeds of dtls_prng(), e.g. with a
+ * hardware generator. \p entropy fills \p buf with \p len bytes and
+ * returns 1, or 0 on failure. \c NULL restores getrandom() and
+ * /dev/urandom. This applies to all threads.
+ */
+void dtls_prng_set_entropy(int (*entropy)(unsigned char *buf, size_t len));
+
+/**
+ * Discards the generator of the calling thread, so that the next
+ * call of dtls_prng() reads a new seed. The value of \p seed is not
+ * used, the operating system provides all entropy.
+ */
+void dtls_prng_init(unsigned short seed);
+
+/** Length of the seed of dtls_prng_set_seed(). */
+#define DTLS_PRNG_SEED_LENGTH 32
+
+/**
+ * Seeds the generator of the calling thread with \p seed, so that
+ * dtls_prng() returns the same bytes after each call with the same
+ * seed. The generator is neither reseeded after
+ * DTLS_PRNG_RESEED_INTERVAL bytes nor after fork() until
+ * dtls_prng_init() is called. This is only meant for tests and
+ * benchmarks that must be reproducible.
+ */
+void dtls_prng_set_seed(const unsigned char seed[DTLS_PRNG_SEED_LENGTH]);
 #else /* WITH_CONTIKI */
 #include <string.h>
 #include "random.h"
@@ -0,0 +1,50 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2011, 2012, 2013, 2014, 2015 Olaf Bergmann (TZI) and others.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v. 1.0 which accompanies this distribution.
+ *
+ * The Eclipse Public License is available at http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Olaf Bergmann  - initial API and implementation
+ *
+ *******************************************************************************/
+
+#include "replay.h"
+
+/** The word of @p window that holds the bit for @p seq. */
+#define REPLAY_WORD(window, seq) \
+  ((window)->bitfield[((seq) >> 6) % DTLS_REPLAY_WORDS])
+
+/** The bit for @p seq in its word. */
+#define REPLAY_BIT(seq) ((uint64_t)1 << ((seq) & 63))
+
+int
+dtls_replay_check(const seqnum_t *window, uint64_t seq) {
+  if (seq > window->cseq)
+    return 1;
+  if (window->cseq - seq >= DTLS_REPLAY_WINDOW)
+    return 0;
+  return !(REPLAY_WORD(window, seq) & REPLAY_BIT(seq));
+}
+
+void
+dtls_replay_update(seqnum_t *window, uint64_t seq) {
+  uint64_t words, n;
+
+  if (seq > window->cseq) {
+    /* The words that the window enters are cleared, the bits after
+     * the newest record in its own word are still zero. */
+    words = (seq >> 6) - (window->cseq >> 6);
+    if (words > DTLS_REPLAY_WORDS)
+      words = DTLS_REPLAY_WORDS;
+    for (n = 1; n <= words; n++)
+      window->bitfield[((window->cseq >> 6) + n) % DTLS_REPLAY_WORDS] = 0;
+    window->cseq = seq;
+  }
+  REPLAY_WORD(window, seq) |= REPLAY_BIT(seq);
+}
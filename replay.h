@@ -0,0 +1,80 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2011, 2012, 2013, 2014, 2015 Olaf Bergmann (TZI) and others.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v. 1.0 which accompanies this distribution.
+ *
+ * The Eclipse Public License is available at http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Olaf Bergmann  - initial API and implementation
+ *
+ *******************************************************************************/
+
+/**
+ * @file replay.h
+ * @brief Anti-replay window for received records
+ *
+ * The sequence numbers of the records that have been received in an
+ * epoch are kept in a ring of 64-bit words as described in RFC 6479.
+ * Advancing the window clears whole words, so that neither the check
+ * nor the update depends on the distance to the last record bit by
+ * bit.
+ */
+
+#ifndef _DTLS_REPLAY_H_
+#define _DTLS_REPLAY_H_
+
+#include <stdint.h>
+
+#include "tinydtls.h"
+
+#ifndef DTLS_REPLAY_WINDOW
+#ifdef WITH_CONTIKI
+#define DTLS_REPLAY_WINDOW 64
+#else /* WITH_CONTIKI */
+/**
+ * Number of records before the newest one that are accepted if they
+ * arrive out of order, see RFC 6347, Section 4.1.2.6. Must be a
+ * multiple of 64. Each epoch keeps DTLS_REPLAY_WINDOW / 8 + 16 bytes.
+ */
+#define DTLS_REPLAY_WINDOW 256
+#endif /* WITH_CONTIKI */
+#endif /* DTLS_REPLAY_WINDOW */
+
+#if DTLS_REPLAY_WINDOW < 64 || DTLS_REPLAY_WINDOW % 64
+#error "DTLS_REPLAY_WINDOW must be a positive multiple of 64"
+#endif
+
+/**
+ * Number of words in the ring. The word of the newest record is only
+ * partially in use, hence one more word than the window needs.
+ */
+#define DTLS_REPLAY_WORDS (DTLS_REPLAY_WINDOW / 64 + 1)
+
+typedef struct {
+  uint64_t cseq;		/**< newest sequence number received */
+  /** bit @c n % 64 of word (@c n / 64) % DTLS_REPLAY_WORDS is set if
+   * the record with sequence number @c n has been received */
+  uint64_t bitfield[DTLS_REPLAY_WORDS];
+} seqnum_t;
+
+/**
+ * Returns @c 1 if the record with sequence number @p seq has not been
+ * received yet and is recent enough to be checked, @c 0 if it is a
+ * duplicate or older than the window allows. A window that is all
+ * zero has not seen any record yet.
+ */
+int dtls_replay_check(const seqnum_t *window, uint64_t seq);
+
+/**
+ * Marks the record with sequence number @p seq as received. This must
+ * only be called for records that have passed dtls_replay_check() and
+ * have been authenticated.
+ */
+void dtls_replay_update(seqnum_t *window, uint64_t seq);
+
+#endif /* _DTLS_REPLAY_H_ */
@@ -59,6 +59,65 @@ _dtls_address_equals_impl(const session_t *a,
 }
 #endif /* WITH_CONTIKI */
 
+/* dtls_peer_key_hash() reads the key as three 64-bit words */
+typedef char dtls_peer_key_size_check[sizeof(dtls_peer_key_t) == 24 ? 1 : -1];
+
+void
+dtls_session_key(const session_t *session, dtls_peer_key_t *key) {
+  assert(session); assert(key);
+  memset(key, 0, sizeof(dtls_peer_key_t));
+
+#ifdef WITH_CONTIKI
+  memcpy(key->addr, &session->addr, sizeof(uip_ipaddr_t));
+  key->port = session->port;
+  key->family = session->size;
+#else /* WITH_CONTIKI */
+  key->family = session->addr.sa.sa_family;
+  switch (session->addr.sa.sa_family) {
+  case AF_INET:
+    memcpy(key->addr, &session->addr.sin.sin_addr, sizeof(struct in_addr));
+    key->port = session->addr.sin.sin_port;
+    break;
+  case AF_INET6:
+    memcpy(key->addr, &session->addr.sin6.sin6_addr, sizeof(struct in6_addr));
+    key->port = session->addr.sin6.sin6_port;
+    break;
+  default:
+    ;
+  }
+#endif /* WITH_CONTIKI */
+  key->ifindex = session->ifindex;
+}
+
+void
+dtls_session_from_key(const dtls_peer_key_t *key, session_t *session) {
+  assert(key); assert(session);
+  memset(session, 0, sizeof(session_t));
+
+#ifdef WITH_CONTIKI
+  memcpy(&session->addr, key->addr, sizeof(uip_ipaddr_t));
+  session->port = key->port;
+  session->size = key->family;
+#else /* WITH_CONTIKI */
+  session->addr.sa.sa_family = key->family;
+  switch (key->family) {
+  case AF_INET:
+    memcpy(&session->addr.sin.sin_addr, key->addr, sizeof(struct in_addr));
+    session->addr.sin.sin_port = key->port;
+    session->size = sizeof(struct sockaddr_in);
+    break;
+  case AF_INET6:
+    memcpy(&session->addr.sin6.sin6_addr, key->addr, sizeof(struct in6_addr));
+    session->addr.sin6.sin6_port = key->port;
+    session->size = sizeof(struct sockaddr_in6);
+    break;
+  default:
+    session->size = sizeof(session->addr);
+  }
+#endif /* WITH_CONTIKI */
+  session->ifindex = key->ifindex;
+}
+
 void
 dtls_session_init(session_t *sess) {
   assert(sess);
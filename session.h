@@ -49,6 +49,49 @@ typedef struct {
 } session_t;
 #endif /* WITH_CONTIKI */
 
+/**
+ * Compact, normalized form of a session_t that identifies a peer in
+ * the peer table. Only the relevant parts of the address are copied
+ * and all other bytes are zero, so that keys can be hashed and
+ * compared bytewise.
+ */
+typedef struct {
+  uint8_t addr[16];		/**< IPv4 or IPv6 address */
+  uint32_t ifindex;		/**< local interface */
+  uint16_t port;		/**< port in network byte order */
+  uint8_t family;		/**< address family */
+  uint8_t reserved;		/**< always zero */
+} dtls_peer_key_t;
+
+/**
+ * Returns a 64-bit hash value for @p key. The @p secret is chosen at
+ * random for each peer table, so that remote peers cannot pick
+ * addresses whose hash values collide.
+ */
+static inline uint64_t
+dtls_peer_key_hash(const dtls_peer_key_t *key, uint64_t secret) {
+  uint64_t w[3], h;
+
+  memcpy(w, key, sizeof(w));
+  h = (w[0] ^ secret ^ 0x9e3779b97f4a7c15ULL) * 0xbf58476d1ce4e5b9ULL;
+  h = (h ^ (h >> 31) ^ w[1]) * 0x94d049bb133111ebULL;
+  h = (h ^ (h >> 29) ^ w[2]) * 0xbf58476d1ce4e5b9ULL;
+  return h ^ (h >> 32);
+}
+
+/**
+ * Fills @p key with the normalized form of @p session.
+ */
+void dtls_session_key(const session_t *session, dtls_peer_key_t *key);
+
+/**
+ * Fills @p session with the address of @p key, which is the reverse
+ * of dtls_session_key(). On platforms other than Contiki, @c size is
+ * set to the size of the socket address of the respective family and
+ * the parts of the address that are not part of @p key are zero.
+ */
+void dtls_session_from_key(const dtls_peer_key_t *key, session_t *session);
+
 /** 
  * Resets the given session_t object @p sess to its default
  * values.  In particular, the member rlen must be initialized to the
@@ -43,6 +43,9 @@
 #endif
 #endif
 #include "sha2.h"
+#ifdef WITH_SHA2_HW
+#include "sha2_hw.h"
+#endif
 
 /*
  * ASSERT NOTE:
@@ -550,8 +553,21 @@ void dtls_sha256_transform(dtls_sha256_ctx* context, const sha2_word32* data) {
 
 #endif /* SHA2_UNROLL_TRANSFORM */
 
+/* Process complete blocks, with SHA instructions where available: */
+static void dtls_sha256_blocks(dtls_sha256_ctx* context, const sha2_byte *data, size_t blocks) {
+#ifdef WITH_SHA2_HW
+	if (sha256_hw_transform(context->state, data, blocks)) {
+		return;
+	}
+#endif
+	for (; blocks > 0; blocks--, data += DTLS_SHA256_BLOCK_LENGTH) {
+		dtls_sha256_transform(context, (const sha2_word32*)data);
+	}
+}
+
 void dtls_sha256_update(dtls_sha256_ctx* context, const sha2_byte *data, size_t len) {
 	unsigned int	freespace, usedspace;
+	size_t		blocks;
 
 	if (len == 0) {
 		/* Calling with no data is valid - we do nothing */
@@ -572,7 +588,7 @@ void dtls_sha256_update(dtls_sha256_ctx* context, const sha2_byte *data, size_t
 			context->bitcount += freespace << 3;
 			len -= freespace;
 			data += freespace;
-			dtls_sha256_transform(context, (sha2_word32*)context->buffer);
+			dtls_sha256_blocks(context, context->buffer, 1);
 		} else {
 			/* The buffer is not yet full */
 			MEMCPY_BCOPY(&context->buffer[usedspace], data, len);
@@ -582,12 +598,14 @@ void dtls_sha256_update(dtls_sha256_ctx* context, const sha2_byte *data, size_t
 			return;
 		}
 	}
-	while (len >= DTLS_SHA256_BLOCK_LENGTH) {
+	if (len >= DTLS_SHA256_BLOCK_LENGTH) {
 		/* Process as many complete blocks as we can */
-		dtls_sha256_transform(context, (sha2_word32*)data);
-		context->bitcount += DTLS_SHA256_BLOCK_LENGTH << 3;
-		len -= DTLS_SHA256_BLOCK_LENGTH;
-		data += DTLS_SHA256_BLOCK_LENGTH;
+		blocks = len / DTLS_SHA256_BLOCK_LENGTH;
+		dtls_sha256_blocks(context, data, blocks);
+		blocks *= DTLS_SHA256_BLOCK_LENGTH;
+		context->bitcount += (sha2_word64)blocks << 3;
+		len -= blocks;
+		data += blocks;
 	}
 	if (len > 0) {
 		/* There's left-overs, so save 'em */
@@ -624,7 +642,7 @@ void dtls_sha256_final(sha2_byte digest[], dtls_sha256_ctx* context) {
 					MEMSET_BZERO(&context->buffer[usedspace], DTLS_SHA256_BLOCK_LENGTH - usedspace);
 				}
 				/* Do second-to-last transform: */
-				dtls_sha256_transform(context, (sha2_word32*)context->buffer);
+				dtls_sha256_blocks(context, context->buffer, 1);
 
 				/* And set-up for the last transform: */
 				MEMSET_BZERO(context->buffer, DTLS_SHA256_SHORT_BLOCK_LENGTH);
@@ -640,7 +658,7 @@ void dtls_sha256_final(sha2_byte digest[], dtls_sha256_ctx* context) {
                 *(sha2_word64*)(context->buffer+DTLS_SHA256_SHORT_BLOCK_LENGTH) = context->bitcount;
 
 		/* Final transform: */
-		dtls_sha256_transform(context, (sha2_word32*)context->buffer);
+		dtls_sha256_blocks(context, context->buffer, 1);
 
 #if BYTE_ORDER == LITTLE_ENDIAN
 		{
@@ -691,6 +709,139 @@ char* dtls_sha256_data(const sha2_byte* data, size_t len, char digest[DTLS_SHA25
 	dtls_sha256_update(&context, data, len);
 	return dtls_sha256_end(&context, digest);
 }
+
+/*
+ * MULTI-BUFFER NOTE:
+ * dtls_sha256_final_multi() is the same as calling dtls_sha256_update()
+ * and dtls_sha256_final() for each of count contexts, with data[i] of
+ * len[i] bytes for context[i]. When the CPU can hash several messages
+ * side by side (see sha256_hw_lanes()), the contexts advance in
+ * lock-step, one block of each per step, until the shorter messages
+ * drop out.
+ */
+#ifdef WITH_SHA2_HW
+#define SHA256_MULTI_BATCH	(2 * SHA256_HW_LANES_MAX)
+
+typedef struct {
+	const sha2_byte	*data;		/* complete blocks of the input */
+	size_t		blocks;		/* number of blocks in data */
+	size_t		total;		/* blocks including the tail */
+	sha2_byte	tail[2 * DTLS_SHA256_BLOCK_LENGTH]; /* rest and padding */
+} dtls_sha256_lane;
+
+/* Moves all input that is still needed into lane->data and lane->tail: */
+static void dtls_sha256_lane_init(dtls_sha256_lane* lane, dtls_sha256_ctx* context, const sha2_byte *data, size_t len) {
+	unsigned int	usedspace, rest;
+	sha2_word64	bitcount;
+
+	/* Complete a partial block first: */
+	usedspace = (context->bitcount >> 3) % DTLS_SHA256_BLOCK_LENGTH;
+	if (usedspace > 0 && len > 0) {
+		rest = DTLS_SHA256_BLOCK_LENGTH - usedspace;
+		if (rest > len) {
+			rest = len;
+		}
+		dtls_sha256_update(context, data, rest);
+		data += rest;
+		len -= rest;
+		usedspace = (context->bitcount >> 3) % DTLS_SHA256_BLOCK_LENGTH;
+	}
+
+	/* Now either the buffer or the input is empty: */
+	lane->data = data;
+	lane->blocks = len / DTLS_SHA256_BLOCK_LENGTH;
+	rest = len % DTLS_SHA256_BLOCK_LENGTH;
+	MEMCPY_BCOPY(lane->tail, context->buffer, usedspace);
+	MEMCPY_BCOPY(lane->tail + usedspace, data + len - rest, rest);
+	usedspace += rest;
+	bitcount = context->bitcount + ((sha2_word64)len << 3);
+
+	/* Padding, as in dtls_sha256_final(): */
+	lane->tail[usedspace++] = 0x80;
+	rest = usedspace <= DTLS_SHA256_SHORT_BLOCK_LENGTH ? DTLS_SHA256_BLOCK_LENGTH : 2 * DTLS_SHA256_BLOCK_LENGTH;
+	MEMSET_BZERO(lane->tail + usedspace, rest - 8 - usedspace);
+	for (usedspace = rest; usedspace > rest - 8; usedspace--) {
+		lane->tail[usedspace - 1] = (sha2_byte)bitcount;
+		bitcount >>= 8;
+	}
+	lane->total = lane->blocks + rest / DTLS_SHA256_BLOCK_LENGTH;
+}
+
+static void dtls_sha256_final_lanes(dtls_sha256_ctx* context[], const sha2_byte *data[], const size_t len[], sha2_byte *digest[], size_t count, size_t lanes) {
+	dtls_sha256_lane	lane[SHA256_MULTI_BATCH];
+	dtls_sha256_ctx		*active[SHA256_HW_LANES_MAX];
+	sha2_word32		*state[SHA256_HW_LANES_MAX];
+	const sha2_byte		*block[SHA256_HW_LANES_MAX];
+	size_t			i, n, step, steps = 0;
+	int			j;
+
+	for (i = 0; i < count; i++) {
+		dtls_sha256_lane_init(&lane[i], context[i], data[i], len[i]);
+		if (lane[i].total > steps) {
+			steps = lane[i].total;
+		}
+	}
+
+	for (step = 0; step < steps; step++) {
+		n = 0;
+		for (i = 0; i < count; i++) {
+			if (step >= lane[i].total) {
+				continue;
+			}
+			active[n] = context[i];
+			state[n] = context[i]->state;
+			block[n++] = step < lane[i].blocks ?
+				lane[i].data + step * DTLS_SHA256_BLOCK_LENGTH :
+				lane[i].tail + (step - lane[i].blocks) * DTLS_SHA256_BLOCK_LENGTH;
+			if (n == lanes) {
+				sha256_hw_transform_lanes(state, block, n);
+				n = 0;
+			}
+		}
+		if (n == 1) {
+			/* Not worth the lanes: */
+			dtls_sha256_blocks(active[0], block[0], 1);
+		} else if (n > 0) {
+			sha256_hw_transform_lanes(state, block, n);
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		for (j = 0; j < 8; j++) {
+			digest[i][4 * j] = (sha2_byte)(context[i]->state[j] >> 24);
+			digest[i][4 * j + 1] = (sha2_byte)(context[i]->state[j] >> 16);
+			digest[i][4 * j + 2] = (sha2_byte)(context[i]->state[j] >> 8);
+			digest[i][4 * j + 3] = (sha2_byte)context[i]->state[j];
+		}
+		MEMSET_BZERO(context[i], sizeof(*context[i]));
+	}
+	MEMSET_BZERO(lane, sizeof(lane));
+}
+#endif /* WITH_SHA2_HW */
+
+void dtls_sha256_final_multi(dtls_sha256_ctx* context[], const sha2_byte *data[], const size_t len[], sha2_byte *digest[], size_t count) {
+	size_t	i;
+
+#ifdef WITH_SHA2_HW
+	size_t	n = sha256_hw_lanes();
+
+	if (n > 1) {
+		for (; count > 0; count -= i) {
+			i = count < SHA256_MULTI_BATCH ? count : SHA256_MULTI_BATCH;
+			dtls_sha256_final_lanes(context, data, len, digest, i, n);
+			context += i;
+			data += i;
+			len += i;
+			digest += i;
+		}
+		return;
+	}
+#endif
+	for (i = 0; i < count; i++) {
+		dtls_sha256_update(context[i], data[i], len[i]);
+		dtls_sha256_final(digest[i], context[i]);
+	}
+}
 #endif
 
 /*** SHA-512: *********************************************************/
@@ -134,6 +134,7 @@ void dtls_sha256_update(dtls_sha256_ctx*, const uint8_t*, size_t);
 void dtls_sha256_final(uint8_t[DTLS_SHA256_DIGEST_LENGTH], dtls_sha256_ctx*);
 char* dtls_sha256_end(dtls_sha256_ctx*, char[DTLS_SHA256_DIGEST_STRING_LENGTH]);
 char* dtls_sha256_data(const uint8_t*, size_t, char[DTLS_SHA256_DIGEST_STRING_LENGTH]);
+void dtls_sha256_final_multi(dtls_sha256_ctx*[], const uint8_t*[], const size_t[], uint8_t*[], size_t);
 #endif
 
 #ifdef WITH_SHA384
@@ -160,6 +161,7 @@ void dtls_sha256_update(dtls_sha256_ctx*, const u_int8_t*, size_t);
 void dtls_sha256_final(u_int8_t[DTLS_SHA256_DIGEST_LENGTH], dtls_sha256_ctx*);
 char* dtls_sha256_end(dtls_sha256_ctx*, char[DTLS_SHA256_DIGEST_STRING_LENGTH]);
 char* dtls_sha256_data(const u_int8_t*, size_t, char[DTLS_SHA256_DIGEST_STRING_LENGTH]);
+void dtls_sha256_final_multi(dtls_sha256_ctx*[], const u_int8_t*[], const size_t[], u_int8_t*[], size_t);
 #endif
 
 #ifdef WITH_SHA384
@@ -188,6 +190,7 @@ void dtls_sha256_update();
 void dtls_sha256_final();
 char* dtls_sha256_end();
 char* dtls_sha256_data();
+void dtls_sha256_final_multi();
 #endif
 
 #ifdef WITH_SHA384
@@ -0,0 +1,651 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2011, 2012, 2013, 2014, 2015 Olaf Bergmann (TZI) and others.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v. 1.0 which accompanies this distribution.
+ *
+ * The Eclipse Public License is available at http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Olaf Bergmann  - initial API and implementation
+ *
+ *******************************************************************************/
+
+/**
+ * @file sha2_hw.c
+ * @brief SHA-256 compression using SHA Extensions, ARMv8 SHA2
+ * instructions or SIMD message schedules
+ */
+
+#include "sha2_hw.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SHA2_HW_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#define SHA2_HW_SSE2_TARGET __attribute__((target("sse2")))
+#define SHA2_HW_AVX2_TARGET __attribute__((target("avx2")))
+#define SHA2_HW_SHANI_TARGET __attribute__((target("sse4.1,sha")))
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__linux__)
+#define SHA2_HW_ARM 1
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#include <arm_neon.h>
+#ifdef __clang__
+#define SHA2_HW_TARGET __attribute__((target("crypto")))
+#else
+#define SHA2_HW_TARGET __attribute__((target("+crypto")))
+#endif
+#endif
+
+static const char * const sha256_hw_names[SHA256_HW_BACKENDS] = {
+  "portable", "sse2", "avx2", "sha-ni", "armv8"
+};
+
+const char *
+sha256_hw_name(sha256_hw_backend_t backend) {
+  return backend < SHA256_HW_BACKENDS ? sha256_hw_names[backend] : "unknown";
+}
+
+#if defined(SHA2_HW_X86) || defined(SHA2_HW_ARM)
+
+static const uint32_t K256[64] = {
+  0x428a2f98UL, 0x71374491UL, 0xb5c0fbcfUL, 0xe9b5dba5UL,
+  0x3956c25bUL, 0x59f111f1UL, 0x923f82a4UL, 0xab1c5ed5UL,
+  0xd807aa98UL, 0x12835b01UL, 0x243185beUL, 0x550c7dc3UL,
+  0x72be5d74UL, 0x80deb1feUL, 0x9bdc06a7UL, 0xc19bf174UL,
+  0xe49b69c1UL, 0xefbe4786UL, 0x0fc19dc6UL, 0x240ca1ccUL,
+  0x2de92c6fUL, 0x4a7484aaUL, 0x5cb0a9dcUL, 0x76f988daUL,
+  0x983e5152UL, 0xa831c66dUL, 0xb00327c8UL, 0xbf597fc7UL,
+  0xc6e00bf3UL, 0xd5a79147UL, 0x06ca6351UL, 0x14292967UL,
+  0x27b70a85UL, 0x2e1b2138UL, 0x4d2c6dfcUL, 0x53380d13UL,
+  0x650a7354UL, 0x766a0abbUL, 0x81c2c92eUL, 0x92722c85UL,
+  0xa2bfe8a1UL, 0xa81a664bUL, 0xc24b8b70UL, 0xc76c51a3UL,
+  0xd192e819UL, 0xd6990624UL, 0xf40e3585UL, 0x106aa070UL,
+  0x19a4c116UL, 0x1e376c08UL, 0x2748774cUL, 0x34b0bcb5UL,
+  0x391c0cb3UL, 0x4ed8aa4aUL, 0x5b9cca4fUL, 0x682e6ff3UL,
+  0x748f82eeUL, 0x78a5636fUL, 0x84c87814UL, 0x8cc70208UL,
+  0x90befffaUL, 0xa4506cebUL, 0xbef9a3f7UL, 0xc67178f2UL
+};
+
+/* The selected backend: -1 if the CPU has not been checked yet. */
+static int sha256_hw_backend = -1;
+
+#ifdef SHA2_HW_X86
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/* Runs the 64 rounds on a message schedule to which the round
+ * constants have already been added. This is used by the SSE2 and
+ * AVX2 backends that only compute the message schedule in vector
+ * registers. */
+static inline void
+sha256_hw_rounds(uint32_t state[8], const uint32_t wk[64]) {
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+  uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+  uint32_t t1, t2;
+  int j;
+
+  for (j = 0; j < 64; j++) {
+    t1 = h + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25))
+      + ((e & f) ^ (~e & g)) + wk[j];
+    t2 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22))
+      + ((a & b) ^ (a & c) ^ (b & c));
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+}
+
+/* The message schedule computes four words per step. The words
+ * W[t..t+3] are derived from the registers x0..x3 that hold
+ * W[t-16..t-1]. As W[t+2] and W[t+3] depend on W[t] and W[t+1],
+ * sigma1 is applied twice: first to W[t-2..t-1], then to
+ * W[t-2..t+1]. */
+#define SSE2_ROTR(x, n) \
+  _mm_or_si128(_mm_srli_epi32((x), (n)), _mm_slli_epi32((x), 32 - (n)))
+#define SSE2_SIGMA0(x) _mm_xor_si128(_mm_xor_si128(SSE2_ROTR((x), 7), \
+  SSE2_ROTR((x), 18)), _mm_srli_epi32((x), 3))
+#define SSE2_SIGMA1(x) _mm_xor_si128(_mm_xor_si128(SSE2_ROTR((x), 17), \
+  SSE2_ROTR((x), 19)), _mm_srli_epi32((x), 10))
+#define SSE2_BSWAP(x) \
+  _mm_or_si128(_mm_slli_epi16((x), 8), _mm_srli_epi16((x), 8))
+#define SSE2_LOAD(p) SSE2_BSWAP(_mm_shufflehi_epi16( \
+  _mm_shufflelo_epi16(_mm_loadu_si128((const __m128i *)(p)), 0xb1), 0xb1))
+
+SHA2_HW_SSE2_TARGET static void
+sha256_sse2(uint32_t state[8], const uint8_t *data, size_t blocks) {
+  uint32_t wk[64];
+  __m128i x0, x1, x2, x3, w, lo;
+  int t;
+
+  for (; blocks; blocks--, data += 64) {
+    x0 = SSE2_LOAD(data);
+    x1 = SSE2_LOAD(data + 16);
+    x2 = SSE2_LOAD(data + 32);
+    x3 = SSE2_LOAD(data + 48);
+    _mm_storeu_si128((__m128i *)wk,
+      _mm_add_epi32(x0, _mm_loadu_si128((const __m128i *)K256)));
+    _mm_storeu_si128((__m128i *)(wk + 4),
+      _mm_add_epi32(x1, _mm_loadu_si128((const __m128i *)(K256 + 4))));
+    _mm_storeu_si128((__m128i *)(wk + 8),
+      _mm_add_epi32(x2, _mm_loadu_si128((const __m128i *)(K256 + 8))));
+    _mm_storeu_si128((__m128i *)(wk + 12),
+      _mm_add_epi32(x3, _mm_loadu_si128((const __m128i *)(K256 + 12))));
+
+    for (t = 16; t < 64; t += 4) {
+      /* W[t-16] + sigma0(W[t-15]) + W[t-7] */
+      w = _mm_add_epi32(_mm_add_epi32(x0,
+	SSE2_SIGMA0(_mm_or_si128(_mm_srli_si128(x0, 4),
+				 _mm_slli_si128(x1, 12)))),
+	_mm_or_si128(_mm_srli_si128(x2, 4), _mm_slli_si128(x3, 12)));
+      lo = _mm_add_epi32(w, SSE2_SIGMA1(_mm_srli_si128(x3, 8)));
+      w = _mm_add_epi32(w, SSE2_SIGMA1(_mm_castpd_si128(
+	_mm_shuffle_pd(_mm_castsi128_pd(x3), _mm_castsi128_pd(lo), 1))));
+      _mm_storeu_si128((__m128i *)(wk + t),
+	_mm_add_epi32(w, _mm_loadu_si128((const __m128i *)(K256 + t))));
+      x0 = x1;
+      x1 = x2;
+      x2 = x3;
+      x3 = w;
+    }
+
+    sha256_hw_rounds(state, wk);
+  }
+}
+
+/* The same message schedule for two blocks at once, one in each
+ * 128-bit lane. AVX2 byte shifts and shuffles work within lanes. */
+#define AVX2_ROTR(x, n) _mm256_or_si256(_mm256_srli_epi32((x), (n)), \
+  _mm256_slli_epi32((x), 32 - (n)))
+#define AVX2_SIGMA0(x) _mm256_xor_si256(_mm256_xor_si256( \
+  AVX2_ROTR((x), 7), AVX2_ROTR((x), 18)), _mm256_srli_epi32((x), 3))
+#define AVX2_SIGMA1(x) _mm256_xor_si256(_mm256_xor_si256( \
+  AVX2_ROTR((x), 17), AVX2_ROTR((x), 19)), _mm256_srli_epi32((x), 10))
+#define AVX2_LOAD(p, mask) _mm256_shuffle_epi8(_mm256_inserti128_si256( \
+  _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(p))), \
+  _mm_loadu_si128((const __m128i *)((p) + 64)), 1), (mask))
+#define AVX2_STORE(a, b, w, t) do { \
+  __m256i v = _mm256_add_epi32((w), _mm256_broadcastsi128_si256( \
+    _mm_loadu_si128((const __m128i *)(K256 + (t))))); \
+  _mm_storeu_si128((__m128i *)((a) + (t)), _mm256_castsi256_si128(v)); \
+  _mm_storeu_si128((__m128i *)((b) + (t)), _mm256_extracti128_si256(v, 1)); \
+} while (0)
+
+SHA2_HW_AVX2_TARGET static void
+sha256_avx2(uint32_t state[8], const uint8_t *data, size_t blocks) {
+  uint32_t wka[64], wkb[64];
+  const __m256i mask = _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11,
+				       4, 5, 6, 7, 0, 1, 2, 3,
+				       12, 13, 14, 15, 8, 9, 10, 11,
+				       4, 5, 6, 7, 0, 1, 2, 3);
+  __m256i x0, x1, x2, x3, w, lo;
+  int t;
+
+  for (; blocks >= 2; blocks -= 2, data += 128) {
+    x0 = AVX2_LOAD(data, mask);
+    x1 = AVX2_LOAD(data + 16, mask);
+    x2 = AVX2_LOAD(data + 32, mask);
+    x3 = AVX2_LOAD(data + 48, mask);
+    AVX2_STORE(wka, wkb, x0, 0);
+    AVX2_STORE(wka, wkb, x1, 4);
+    AVX2_STORE(wka, wkb, x2, 8);
+    AVX2_STORE(wka, wkb, x3, 12);
+
+    for (t = 16; t < 64; t += 4) {
+      w = _mm256_add_epi32(_mm256_add_epi32(x0,
+	AVX2_SIGMA0(_mm256_or_si256(_mm256_srli_si256(x0, 4),
+				    _mm256_slli_si256(x1, 12)))),
+	_mm256_or_si256(_mm256_srli_si256(x2, 4),
+			_mm256_slli_si256(x3, 12)));
+      lo = _mm256_add_epi32(w, AVX2_SIGMA1(_mm256_srli_si256(x3, 8)));
+      w = _mm256_add_epi32(w, AVX2_SIGMA1(_mm256_castpd_si256(
+	_mm256_shuffle_pd(_mm256_castsi256_pd(x3),
+			  _mm256_castsi256_pd(lo), 5))));
+      AVX2_STORE(wka, wkb, w, t);
+      x0 = x1;
+      x1 = x2;
+      x2 = x3;
+      x3 = w;
+    }
+
+    sha256_hw_rounds(state, wka);
+    sha256_hw_rounds(state, wkb);
+  }
+
+  if (blocks)
+    sha256_sse2(state, data, blocks);
+}
+
+/* Four rounds with the SHA Extensions. SHANI_MSG2 completes the next
+ * four message words, SHANI_MSG1 starts the words needed three
+ * groups later. @p c holds the words of the current group. */
+#define SHANI_RNDS(g, c, sched) do { \
+  msg = _mm_add_epi32((c), _mm_loadu_si128((const __m128i *)(K256 + 4 * (g)))); \
+  s1 = _mm_sha256rnds2_epu32(s1, s0, msg); \
+  sched; \
+  msg = _mm_shuffle_epi32(msg, 0x0e); \
+  s0 = _mm_sha256rnds2_epu32(s0, s1, msg); \
+} while (0)
+#define SHANI_MSG2(c, n, p) \
+  (n) = _mm_sha256msg2_epu32(_mm_add_epi32((n), _mm_alignr_epi8((c), (p), 4)), (c))
+#define SHANI_MSG1(c, p) (p) = _mm_sha256msg1_epu32((p), (c))
+
+SHA2_HW_SHANI_TARGET static void
+sha256_shani(uint32_t state[8], const uint8_t *data, size_t blocks) {
+  const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+				      0x0405060700010203ULL);
+  __m128i s0, s1, tmp, msg, m0, m1, m2, m3, abef, cdgh;
+
+  /* the instructions keep the state as ABEF and CDGH */
+  tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0xb1);
+  s1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(state + 4)), 0x1b);
+  s0 = _mm_alignr_epi8(tmp, s1, 8);
+  s1 = _mm_blend_epi16(s1, tmp, 0xf0);
+
+  for (; blocks; blocks--, data += 64) {
+    abef = s0;
+    cdgh = s1;
+    m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)data), mask);
+    m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16)), mask);
+    m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 32)), mask);
+    m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 48)), mask);
+
+    SHANI_RNDS(0, m0, (void)0);
+    SHANI_RNDS(1, m1, (void)0);
+    SHANI_MSG1(m1, m0);
+    SHANI_RNDS(2, m2, (void)0);
+    SHANI_MSG1(m2, m1);
+    SHANI_RNDS(3, m3, SHANI_MSG2(m3, m0, m2));
+    SHANI_MSG1(m3, m2);
+    SHANI_RNDS(4, m0, SHANI_MSG2(m0, m1, m3));
+    SHANI_MSG1(m0, m3);
+    SHANI_RNDS(5, m1, SHANI_MSG2(m1, m2, m0));
+    SHANI_MSG1(m1, m0);
+    SHANI_RNDS(6, m2, SHANI_MSG2(m2, m3, m1));
+    SHANI_MSG1(m2, m1);
+    SHANI_RNDS(7, m3, SHANI_MSG2(m3, m0, m2));
+    SHANI_MSG1(m3, m2);
+    SHANI_RNDS(8, m0, SHANI_MSG2(m0, m1, m3));
+    SHANI_MSG1(m0, m3);
+    SHANI_RNDS(9, m1, SHANI_MSG2(m1, m2, m0));
+    SHANI_MSG1(m1, m0);
+    SHANI_RNDS(10, m2, SHANI_MSG2(m2, m3, m1));
+    SHANI_MSG1(m2, m1);
+    SHANI_RNDS(11, m3, SHANI_MSG2(m3, m0, m2));
+    SHANI_MSG1(m3, m2);
+    SHANI_RNDS(12, m0, SHANI_MSG2(m0, m1, m3));
+    SHANI_MSG1(m0, m3);
+    SHANI_RNDS(13, m1, SHANI_MSG2(m1, m2, m0));
+    SHANI_RNDS(14, m2, SHANI_MSG2(m2, m3, m1));
+    SHANI_RNDS(15, m3, (void)0);
+
+    s0 = _mm_add_epi32(s0, abef);
+    s1 = _mm_add_epi32(s1, cdgh);
+  }
+
+  tmp = _mm_shuffle_epi32(s0, 0x1b);
+  s1 = _mm_shuffle_epi32(s1, 0xb1);
+  _mm_storeu_si128((__m128i *)state, _mm_blend_epi16(tmp, s1, 0xf0));
+  _mm_storeu_si128((__m128i *)(state + 4), _mm_alignr_epi8(s1, tmp, 8));
+}
+
+/* Eight independent messages, one in each 32-bit lane. The states
+ * and message words are transposed on the way into the registers. */
+#define LOAD32BE(p) ((uint32_t)(p)[0] << 24 | (uint32_t)(p)[1] << 16 \
+		     | (uint32_t)(p)[2] << 8 | (uint32_t)(p)[3])
+#define AVX2_GATHER(p, o) _mm256_set_epi32( \
+  LOAD32BE((p)[7] + (o)), LOAD32BE((p)[6] + (o)), \
+  LOAD32BE((p)[5] + (o)), LOAD32BE((p)[4] + (o)), \
+  LOAD32BE((p)[3] + (o)), LOAD32BE((p)[2] + (o)), \
+  LOAD32BE((p)[1] + (o)), LOAD32BE((p)[0] + (o)))
+#define AVX2_BSIG0(x) _mm256_xor_si256(_mm256_xor_si256( \
+  AVX2_ROTR((x), 2), AVX2_ROTR((x), 13)), AVX2_ROTR((x), 22))
+#define AVX2_BSIG1(x) _mm256_xor_si256(_mm256_xor_si256( \
+  AVX2_ROTR((x), 6), AVX2_ROTR((x), 11)), AVX2_ROTR((x), 25))
+#define AVX2_CH(x, y, z) _mm256_xor_si256(_mm256_and_si256((x), (y)), \
+  _mm256_andnot_si256((x), (z)))
+#define AVX2_MAJ(x, y, z) _mm256_or_si256(_mm256_and_si256((x), (y)), \
+  _mm256_and_si256((z), _mm256_or_si256((x), (y))))
+
+SHA2_HW_AVX2_TARGET static void
+sha256_avx2_lanes(uint32_t *state[], const uint8_t *block[], size_t lanes) {
+  uint32_t st[8][8];
+  const uint8_t *p[8];
+  __m256i a, b, c, d, e, f, g, h, t1, t2, w[16];
+  size_t i;
+  int j;
+
+  /* unused lanes repeat the first message */
+  for (i = 0; i < 8; i++) {
+    p[i] = block[i < lanes ? i : 0];
+    for (j = 0; j < 8; j++)
+      st[j][i] = state[i < lanes ? i : 0][j];
+  }
+
+  a = _mm256_loadu_si256((const __m256i *)st[0]);
+  b = _mm256_loadu_si256((const __m256i *)st[1]);
+  c = _mm256_loadu_si256((const __m256i *)st[2]);
+  d = _mm256_loadu_si256((const __m256i *)st[3]);
+  e = _mm256_loadu_si256((const __m256i *)st[4]);
+  f = _mm256_loadu_si256((const __m256i *)st[5]);
+  g = _mm256_loadu_si256((const __m256i *)st[6]);
+  h = _mm256_loadu_si256((const __m256i *)st[7]);
+
+  for (j = 0; j < 64; j++) {
+    if (j < 16)
+      w[j] = AVX2_GATHER(p, 4 * j);
+    else
+      w[j & 15] = _mm256_add_epi32(
+	_mm256_add_epi32(AVX2_SIGMA1(w[(j - 2) & 15]), w[(j - 7) & 15]),
+	_mm256_add_epi32(AVX2_SIGMA0(w[(j - 15) & 15]), w[j & 15]));
+    t1 = _mm256_add_epi32(_mm256_add_epi32(h, AVX2_BSIG1(e)),
+	   _mm256_add_epi32(AVX2_CH(e, f, g),
+	     _mm256_add_epi32(_mm256_set1_epi32((int)K256[j]), w[j & 15])));
+    t2 = _mm256_add_epi32(AVX2_BSIG0(a), AVX2_MAJ(a, b, c));
+    h = g;
+    g = f;
+    f = e;
+    e = _mm256_add_epi32(d, t1);
+    d = c;
+    c = b;
+    b = a;
+    a = _mm256_add_epi32(t1, t2);
+  }
+
+  _mm256_storeu_si256((__m256i *)st[0], a);
+  _mm256_storeu_si256((__m256i *)st[1], b);
+  _mm256_storeu_si256((__m256i *)st[2], c);
+  _mm256_storeu_si256((__m256i *)st[3], d);
+  _mm256_storeu_si256((__m256i *)st[4], e);
+  _mm256_storeu_si256((__m256i *)st[5], f);
+  _mm256_storeu_si256((__m256i *)st[6], g);
+  _mm256_storeu_si256((__m256i *)st[7], h);
+  for (i = 0; i < lanes; i++)
+    for (j = 0; j < 8; j++)
+      state[i][j] += st[j][i];
+}
+
+int
+sha256_hw_supported(sha256_hw_backend_t backend) {
+  unsigned int eax, ebx, ecx, edx;
+
+  __builtin_cpu_init();
+  switch (backend) {
+  case SHA256_HW_PORTABLE:
+    return 1;
+  case SHA256_HW_SSE2:
+    return __builtin_cpu_supports("sse2") ? 1 : 0;
+  case SHA256_HW_AVX2:
+    return __builtin_cpu_supports("avx2") ? 1 : 0;
+  case SHA256_HW_SHANI:
+    /* CPUID.(EAX=7,ECX=0):EBX[29] */
+    if (!__builtin_cpu_supports("sse4.1")
+	|| !__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+      return 0;
+    return (ebx >> 29) & 1;
+  default:
+    return 0;
+  }
+}
+
+#else /* SHA2_HW_ARM */
+
+/* Four rounds with the ARMv8 SHA2 instructions. Until the last four
+ * groups, @p c is then replaced by the message words needed four
+ * groups later. */
+#define ARMV8_RNDS(g, c, n1, n2, n3) do { \
+  tmp = vaddq_u32((c), vld1q_u32(K256 + 4 * (g))); \
+  if ((g) < 12) \
+    (c) = vsha256su0q_u32((c), (n1)); \
+  abcd = s0; \
+  s0 = vsha256hq_u32(s0, s1, tmp); \
+  s1 = vsha256h2q_u32(s1, abcd, tmp); \
+  if ((g) < 12) \
+    (c) = vsha256su1q_u32((c), (n2), (n3)); \
+} while (0)
+
+SHA2_HW_TARGET static void
+sha256_armv8(uint32_t state[8], const uint8_t *data, size_t blocks) {
+  uint32x4_t s0, s1, m0, m1, m2, m3, tmp, abcd, save0, save1;
+
+  s0 = vld1q_u32(state);
+  s1 = vld1q_u32(state + 4);
+
+  for (; blocks; blocks--, data += 64) {
+    save0 = s0;
+    save1 = s1;
+    m0 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data)));
+    m1 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16)));
+    m2 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 32)));
+    m3 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 48)));
+
+    ARMV8_RNDS(0, m0, m1, m2, m3);
+    ARMV8_RNDS(1, m1, m2, m3, m0);
+    ARMV8_RNDS(2, m2, m3, m0, m1);
+    ARMV8_RNDS(3, m3, m0, m1, m2);
+    ARMV8_RNDS(4, m0, m1, m2, m3);
+    ARMV8_RNDS(5, m1, m2, m3, m0);
+    ARMV8_RNDS(6, m2, m3, m0, m1);
+    ARMV8_RNDS(7, m3, m0, m1, m2);
+    ARMV8_RNDS(8, m0, m1, m2, m3);
+    ARMV8_RNDS(9, m1, m2, m3, m0);
+    ARMV8_RNDS(10, m2, m3, m0, m1);
+    ARMV8_RNDS(11, m3, m0, m1, m2);
+    ARMV8_RNDS(12, m0, m1, m2, m3);
+    ARMV8_RNDS(13, m1, m2, m3, m0);
+    ARMV8_RNDS(14, m2, m3, m0, m1);
+    ARMV8_RNDS(15, m3, m0, m1, m2);
+
+    s0 = vaddq_u32(s0, save0);
+    s1 = vaddq_u32(s1, save1);
+  }
+
+  vst1q_u32(state, s0);
+  vst1q_u32(state + 4, s1);
+}
+
+/* Four independent messages, one in each 32-bit lane, for CPUs
+ * without the SHA2 instructions. */
+#define NEON_ROTR(x, n) vsriq_n_u32(vshlq_n_u32((x), 32 - (n)), (x), (n))
+#define NEON_SIGMA0(x) veorq_u32(veorq_u32(NEON_ROTR((x), 7), \
+  NEON_ROTR((x), 18)), vshrq_n_u32((x), 3))
+#define NEON_SIGMA1(x) veorq_u32(veorq_u32(NEON_ROTR((x), 17), \
+  NEON_ROTR((x), 19)), vshrq_n_u32((x), 10))
+#define NEON_BSIG0(x) veorq_u32(veorq_u32(NEON_ROTR((x), 2), \
+  NEON_ROTR((x), 13)), NEON_ROTR((x), 22))
+#define NEON_BSIG1(x) veorq_u32(veorq_u32(NEON_ROTR((x), 6), \
+  NEON_ROTR((x), 11)), NEON_ROTR((x), 25))
+
+static void
+sha256_neon_lanes(uint32_t *state[], const uint8_t *block[], size_t lanes) {
+  uint32_t st[8][4], m[4];
+  const uint8_t *p[4];
+  uint32x4_t s[8], t1, t2, w[16];
+  size_t i;
+  int j;
+
+  /* unused lanes repeat the first message */
+  for (i = 0; i < 4; i++) {
+    p[i] = block[i < lanes ? i : 0];
+    for (j = 0; j < 8; j++)
+      st[j][i] = state[i < lanes ? i : 0][j];
+  }
+  for (j = 0; j < 8; j++)
+    s[j] = vld1q_u32(st[j]);
+
+  for (j = 0; j < 64; j++) {
+    if (j < 16) {
+      for (i = 0; i < 4; i++)
+	m[i] = (uint32_t)p[i][4 * j] << 24 | (uint32_t)p[i][4 * j + 1] << 16
+	  | (uint32_t)p[i][4 * j + 2] << 8 | (uint32_t)p[i][4 * j + 3];
+      w[j] = vld1q_u32(m);
+    } else {
+      w[j & 15] = vaddq_u32(vaddq_u32(NEON_SIGMA1(w[(j - 2) & 15]),
+				      w[(j - 7) & 15]),
+			    vaddq_u32(NEON_SIGMA0(w[(j - 15) & 15]),
+				      w[j & 15]));
+    }
+    /* s[0..7] hold a..h, Ch and Maj are bit selections */
+    t1 = vaddq_u32(vaddq_u32(s[7], NEON_BSIG1(s[4])),
+		   vaddq_u32(vbslq_u32(s[4], s[5], s[6]),
+			     vaddq_u32(vdupq_n_u32(K256[j]), w[j & 15])));
+    t2 = vaddq_u32(NEON_BSIG0(s[0]),
+		   vbslq_u32(veorq_u32(s[0], s[1]), s[2], s[1]));
+    s[7] = s[6];
+    s[6] = s[5];
+    s[5] = s[4];
+    s[4] = vaddq_u32(s[3], t1);
+    s[3] = s[2];
+    s[2] = s[1];
+    s[1] = s[0];
+    s[0] = vaddq_u32(t1, t2);
+  }
+
+  for (j = 0; j < 8; j++)
+    vst1q_u32(st[j], s[j]);
+  for (i = 0; i < lanes; i++)
+    for (j = 0; j < 8; j++)
+      state[i][j] += st[j][i];
+}
+
+int
+sha256_hw_supported(sha256_hw_backend_t backend) {
+  switch (backend) {
+  case SHA256_HW_PORTABLE:
+    return 1;
+  case SHA256_HW_ARMV8:
+    return (getauxval(AT_HWCAP) & HWCAP_SHA2) ? 1 : 0;
+  default:
+    return 0;
+  }
+}
+
+#endif /* SHA2_HW_X86 */
+
+sha256_hw_backend_t
+sha256_hw_selected(void) {
+  /* sorted by preference */
+  static const sha256_hw_backend_t order[] = {
+    SHA256_HW_SHANI, SHA256_HW_ARMV8, SHA256_HW_AVX2, SHA256_HW_SSE2
+  };
+  size_t i;
+
+  if (sha256_hw_backend < 0) {
+    sha256_hw_backend = SHA256_HW_PORTABLE;
+    for (i = 0; i < sizeof(order) / sizeof(order[0]); i++) {
+      if (sha256_hw_supported(order[i])) {
+	sha256_hw_backend = order[i];
+	break;
+      }
+    }
+  }
+  return (sha256_hw_backend_t)sha256_hw_backend;
+}
+
+int
+sha256_hw_select(sha256_hw_backend_t backend) {
+  if (!sha256_hw_supported(backend))
+    return -1;
+  sha256_hw_backend = backend;
+  return 0;
+}
+
+int
+sha256_hw_transform(uint32_t state[8], const uint8_t *data, size_t blocks) {
+  switch (sha256_hw_selected()) {
+#ifdef SHA2_HW_X86
+  case SHA256_HW_SSE2:
+    sha256_sse2(state, data, blocks);
+    return 1;
+  case SHA256_HW_AVX2:
+    sha256_avx2(state, data, blocks);
+    return 1;
+  case SHA256_HW_SHANI:
+    sha256_shani(state, data, blocks);
+    return 1;
+#else /* SHA2_HW_ARM */
+  case SHA256_HW_ARMV8:
+    sha256_armv8(state, data, blocks);
+    return 1;
+#endif /* SHA2_HW_X86 */
+  default:
+    return 0;
+  }
+}
+
+size_t
+sha256_hw_lanes(void) {
+#ifdef SHA2_HW_X86
+  return sha256_hw_selected() == SHA256_HW_AVX2 ? 8 : 0;
+#else /* SHA2_HW_ARM */
+  return sha256_hw_selected() == SHA256_HW_ARMV8 ? 0 : 4;
+#endif /* SHA2_HW_X86 */
+}
+
+void
+sha256_hw_transform_lanes(uint32_t *state[], const uint8_t *block[],
+			  size_t lanes) {
+#ifdef SHA2_HW_X86
+  sha256_avx2_lanes(state, block, lanes);
+#else /* SHA2_HW_ARM */
+  sha256_neon_lanes(state, block, lanes);
+#endif /* SHA2_HW_X86 */
+}
+
+#else /* no SHA-256 instructions for this platform */
+
+int
+sha256_hw_supported(sha256_hw_backend_t backend) {
+  return backend == SHA256_HW_PORTABLE;
+}
+
+sha256_hw_backend_t
+sha256_hw_selected(void) {
+  return SHA256_HW_PORTABLE;
+}
+
+int
+sha256_hw_select(sha256_hw_backend_t backend) {
+  return backend == SHA256_HW_PORTABLE ? 0 : -1;
+}
+
+int
+sha256_hw_transform(uint32_t state[8], const uint8_t *data, size_t blocks) {
+  (void)state;
+  (void)data;
+  (void)blocks;
+  return 0;
+}
+
+size_t
+sha256_hw_lanes(void) {
+  return 0;
+}
+
+void
+sha256_hw_transform_lanes(uint32_t *state[], const uint8_t *block[],
+			  size_t lanes) {
+  (void)state;
+  (void)block;
+  (void)lanes;
+}
+
+#endif /* SHA2_HW_X86 || SHA2_HW_ARM */
@@ -0,0 +1,98 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2011, 2012, 2013, 2014, 2015 Olaf Bergmann (TZI) and others.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v. 1.0 which accompanies this distribution.
+ *
+ * The Eclipse Public License is available at http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Olaf Bergmann  - initial API and implementation
+ *
+ *******************************************************************************/
+
+/**
+ * @file sha2_hw.h
+ * @brief SHA-256 compression using CPU instructions
+ *
+ * These backends are used by dtls_sha256_update() and
+ * dtls_sha256_final() when the library is built with WITH_SHA2_HW.
+ * The fastest backend the CPU supports is selected at runtime, the
+ * portable code in sha2.c remains the fallback otherwise.
+ */
+
+#ifndef _SHA2_HW_H_
+#define _SHA2_HW_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** The implementations of the SHA-256 compression function. */
+typedef enum {
+  SHA256_HW_PORTABLE = 0,  /**< the portable code in sha2.c */
+  SHA256_HW_SSE2,          /**< message schedule with SSE2 (x86) */
+  SHA256_HW_AVX2,          /**< two message schedules with AVX2 (x86) */
+  SHA256_HW_SHANI,         /**< Intel SHA Extensions (x86) */
+  SHA256_HW_ARMV8,         /**< ARMv8 SHA2 instructions (aarch64) */
+  SHA256_HW_BACKENDS       /**< number of backends */
+} sha256_hw_backend_t;
+
+/**
+ * Returns @c 1 if @p backend can be used on this CPU, @c 0
+ * otherwise. SHA256_HW_PORTABLE is always available.
+ */
+int sha256_hw_supported(sha256_hw_backend_t backend);
+
+/** Returns a short name of @p backend for diagnostic output. */
+const char *sha256_hw_name(sha256_hw_backend_t backend);
+
+/**
+ * Returns the backend that is used by sha256_hw_transform(). Unless
+ * sha256_hw_select() has been called, this is the fastest backend
+ * that the CPU supports.
+ */
+sha256_hw_backend_t sha256_hw_selected(void);
+
+/**
+ * Makes sha256_hw_transform() use @p backend. This is meant for
+ * benchmarks and tests and must not be called while other threads
+ * compute hashes.
+ *
+ * @return @c 0 on success, @c -1 if @p backend is not supported.
+ */
+int sha256_hw_select(sha256_hw_backend_t backend);
+
+/**
+ * Applies the SHA-256 compression function for @p blocks consecutive
+ * 64-byte blocks from @p data to @p state using the selected backend.
+ *
+ * @return @c 1 if the blocks have been processed, @c 0 if the
+ *         portable implementation must be used.
+ */
+int sha256_hw_transform(uint32_t state[8], const uint8_t *data,
+			size_t blocks);
+
+/** Maximum number of lanes of sha256_hw_transform_lanes(). */
+#define SHA256_HW_LANES_MAX 8
+
+/**
+ * Returns the number of independent messages that
+ * sha256_hw_transform_lanes() hashes side by side with the selected
+ * backend, or @c 0 if hashing them one after another is faster. This
+ * is @c 8 for SHA256_HW_AVX2, @c 4 on aarch64 CPUs without SHA2
+ * instructions, and @c 0 otherwise.
+ */
+size_t sha256_hw_lanes(void);
+
+/**
+ * Applies the SHA-256 compression function to @p lanes independent
+ * states, @p state[i] with the 64-byte block @p block[i]. @p lanes
+ * must not exceed sha256_hw_lanes().
+ */
+void sha256_hw_transform_lanes(uint32_t *state[], const uint8_t *block[],
+			       size_t lanes);
+
+#endif /* _SHA2_HW_H_ */
@@ -38,6 +38,13 @@
 #include <sys/time.h>
 
 #include "sha2.h"
+#ifdef WITH_SHA2_HW
+#include "sha2_hw.h"
+
+/* Many short messages, like the cookies of a burst of ClientHellos: */
+#define MULTICOUNT	16
+#define MULTILEN	192
+#endif
 
 #define BUFSIZE	16384
 
@@ -69,6 +76,16 @@ int main(int argc, char **argv) {
 	struct timeval	start, end;
 	double		t, ave256, ave384, ave512;
 	double		best256, best384, best512;
+#ifdef WITH_SHA2_HW
+	char		ref[DTLS_SHA256_DIGEST_STRING_LENGTH];
+	char		caption[32];
+	double		besthw;
+	int		b, k;
+	dtls_sha256_ctx	cm[MULTICOUNT], *cmp[MULTICOUNT];
+	const unsigned char	*dm[MULTICOUNT];
+	size_t		lm[MULTICOUNT];
+	unsigned char	om[MULTICOUNT][DTLS_SHA256_DIGEST_LENGTH], *omp[MULTICOUNT];
+#endif
 
 	if (argc > 4) {
 		usage(argv[0]);
@@ -149,6 +166,66 @@ int main(int argc, char **argv) {
 		}
 		printf("SHA-512[%d] (%.4f/%.4f/%.4f seconds) = 0x%s\n", i+1, t, ave512/(i+1), best512, md);
 	}
+#ifdef WITH_SHA2_HW
+	/* Compare the SHA-256 backends on the same data: */
+	printf("\nSHA-256 BACKENDS:\n");
+	for (b = 0; b < SHA256_HW_BACKENDS; b++) {
+		if (sha256_hw_select((sha256_hw_backend_t)b) < 0) {
+			printf("%-8s not supported by this CPU\n", sha256_hw_name((sha256_hw_backend_t)b));
+			continue;
+		}
+		besthw = 100000;
+		for (i = 0; i < rep; i++) {
+			dtls_sha256_init(&c256);
+			gettimeofday(&start, (struct timezone*)0);
+			for (j = 0; j < blocks; j++) {
+				dtls_sha256_update(&c256, (unsigned char*)buf, BUFSIZE);
+			}
+			if (bytes % BUFSIZE) {
+				dtls_sha256_update(&c256, (unsigned char*)buf, bytes % BUFSIZE);
+			}
+			dtls_sha256_end(&c256, md);
+			gettimeofday(&end, (struct timezone*)0);
+			t = ((end.tv_sec - start.tv_sec) * 1000000.0 + (end.tv_usec - start.tv_usec)) / 1000000.0;
+			if (t < besthw) {
+				besthw = t;
+			}
+		}
+		if (b == SHA256_HW_PORTABLE) {
+			strcpy(ref, md);
+		} else if (strcmp(ref, md) != 0) {
+			printf("%-8s WRONG DIGEST 0x%s\n", sha256_hw_name((sha256_hw_backend_t)b), md);
+			continue;
+		}
+		sprintf(caption, "%-8s best:", sha256_hw_name((sha256_hw_backend_t)b));
+		printspeed(caption, bytes, besthw);
+
+		for (k = 0; k < MULTICOUNT; k++) {
+			cmp[k] = &cm[k];
+			dm[k] = (unsigned char*)buf + k;
+			lm[k] = MULTILEN;
+			omp[k] = om[k];
+		}
+		besthw = 100000;
+		for (i = 0; i < rep; i++) {
+			gettimeofday(&start, (struct timezone*)0);
+			for (j = 0; j < bytes / (MULTICOUNT * MULTILEN); j++) {
+				for (k = 0; k < MULTICOUNT; k++) {
+					dtls_sha256_init(&cm[k]);
+				}
+				dtls_sha256_final_multi(cmp, dm, lm, omp, MULTICOUNT);
+			}
+			gettimeofday(&end, (struct timezone*)0);
+			t = ((end.tv_sec - start.tv_sec) * 1000000.0 + (end.tv_usec - start.tv_usec)) / 1000000.0;
+			if (t < besthw) {
+				besthw = t;
+			}
+		}
+		sprintf(caption, "%-8s %dx%d:", sha256_hw_name((sha256_hw_backend_t)b), MULTICOUNT, MULTILEN);
+		printspeed(caption, bytes, besthw);
+	}
+#endif
+
 	ave256 /= rep;
 	ave384 /= rep;
 	ave512 /= rep;
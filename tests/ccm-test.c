@@ -40,6 +40,54 @@ dump(unsigned char *buf, size_t len) {
   printf("\n");
 }
 
+#define VECTORS (sizeof(data)/sizeof(struct test_vector))
+
+/* Encrypts and decrypts all vectors with the M and L of vector first
+ * in one batch each, every vector with its own key. */
+static int
+test_batch(int first) {
+  static rijndael_ctx ctx[VECTORS];
+  dtls_ccm_record_t rec[VECTORS];
+  size_t i, n = 0;
+  int failed = 0;
+
+  for (i = 0; i < VECTORS; i++) {
+    if (data[i].M != data[first].M || data[i].L != data[first].L)
+      continue;
+    rijndael_set_key_enc_only(&ctx[n], data[i].key, 8*sizeof(data[i].key));
+    rec[n].ctx = &ctx[n];
+    rec[n].nonce = data[i].nonce;
+    rec[n].msg = data[i].msg + data[i].la;
+    rec[n].lm = data[i].lm - data[i].la;
+    rec[n].aad = data[i].msg;
+    rec[n].la = data[i].la;
+    n++;
+  }
+
+  dtls_ccm_encrypt_messages(data[first].M, data[first].L, rec, n);
+  for (i = n = 0; i < VECTORS; i++) {
+    if (data[i].M != data[first].M || data[i].L != data[first].L)
+      continue;
+    if (rec[n].result + data[i].la != data[i].r_lm ||
+	memcmp(data[i].msg, data[i].result, data[i].r_lm))
+      failed = 1;
+    rec[n].lm = rec[n].result;
+    n++;
+  }
+
+  dtls_ccm_decrypt_messages(data[first].M, data[first].L, rec, n);
+  for (i = n = 0; i < VECTORS; i++) {
+    if (data[i].M != data[first].M || data[i].L != data[first].L)
+      continue;
+    if (rec[n++].result + data[i].la != data[i].lm)
+      failed = 1;
+  }
+
+  printf("Batch of %zu vectors with M=%zu, L=%zu %s\n", n,
+	 data[first].M, data[first].L, failed ? "FAILED" : "OK");
+  return failed;
+}
+
 #ifdef WITH_CONTIKI
 PROCESS(ccm_test_process, "CCM test process");
 AUTOSTART_PROCESSES(&ccm_test_process);
@@ -49,7 +97,7 @@ PROCESS_THREAD(ccm_test_process, ev, d)
 int main(int argc, char **argv) {
 #endif /* WITH_CONTIKI */
   long int len;
-  int n;
+  int n, failed = 0;
 
   rijndael_ctx ctx;
 
@@ -89,9 +137,19 @@ int main(int argc, char **argv) {
       printf("\t*** MAC verified (total length = %lu) ***\n", len + data[n].la);
   }
 
+  /* the decryption has restored the cleartext of all vectors */
+  for (n = 0; n < VECTORS; ++n) {
+    int k;
+    for (k = 0; k < n; k++)
+      if (data[k].M == data[n].M && data[k].L == data[n].L)
+	break;
+    if (k == n)
+      failed |= test_batch(n);
+  }
+
 #ifdef WITH_CONTIKI
   PROCESS_END();
 #else /* WITH_CONTIKI */
-  return 0;
+  return failed ? EXIT_FAILURE : 0;
 #endif /* WITH_CONTIKI */
 }
@@ -0,0 +1,135 @@
+/* Checks ChaCha20-Poly1305 of chachapoly.c with the AEAD test vector
+ * of RFC 8439, section 2.8.2, and a message of 600 bytes that spans
+ * several groups of vector blocks.
+ *
+ * usage: chachapoly-test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tinydtls.h"
+#include "chachapoly.h"
+
+struct test_vector {
+  const char *key, *nonce, *p, *a, *c, *t;
+};
+
+static const struct test_vector data[] = {
+  { "808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f",
+    "070000004041424344454647",
+    "4c616469657320616e642047656e746c656d656e206f662074686520636c6173"
+    "73206f66202739393a204966204920636f756c64206f6666657220796f75206f"
+    "6e6c79206f6e652074697020666f7220746865206675747572652c2073756e73"
+    "637265656e20776f756c642062652069742e",
+    "50515253c0c1c2c3c4c5c6c7",
+    "d31a8d34648e60db7b86afbc53ef7ec2a4aded51296e08fea9e2b5a736ee62d6"
+    "3dbea45e8ca9671282fafb69da92728b1a71de0a9e060b2905d6a5b67ecd3b36"
+    "92ddbd7f2d778b8c9803aee328091b58fab324e4fad675945585808b4831d7bc"
+    "3ff4def08e4b7a9de576d26586cec64b6116",
+    "1ae10b594f09e26a7e902ecbd0600691" },
+};
+
+#define VECTORS (sizeof(data) / sizeof(data[0]))
+
+/* the long message, its bytes are (13 * i + 7) mod 256 */
+#define LONG_LENGTH 600
+#define LONG_KEY    "01080f161d242b323940474e555c636a71787f868d949ba2a9b0b7bec5ccd3da"
+#define LONG_NONCE  "05080b0e1114171a1d202326"
+#define LONG_AAD    "00000000000000011703fefd01"
+#define LONG_TAG    "38a5310b57b5baff448098a0a6e47f72"
+
+static size_t
+from_hex(const char *hex, unsigned char *buf) {
+  size_t n;
+  unsigned int b;
+
+  for (n = 0; hex[2 * n]; n++) {
+    sscanf(hex + 2 * n, "%2x", &b);
+    buf[n] = b;
+  }
+  return n;
+}
+
+static int
+check_vector(const struct test_vector *v) {
+  unsigned char key[DTLS_CHACHAPOLY_KEY_SIZE];
+  unsigned char nonce[DTLS_CHACHAPOLY_NONCE_SIZE];
+  unsigned char p[128], a[16], c[128], t[DTLS_CHACHAPOLY_TAG_LENGTH];
+  unsigned char msg[128 + DTLS_CHACHAPOLY_TAG_LENGTH];
+  size_t lp, la;
+  long int len;
+
+  from_hex(v->key, key);
+  from_hex(v->nonce, nonce);
+  lp = from_hex(v->p, p);
+  la = from_hex(v->a, a);
+  from_hex(v->c, c);
+  from_hex(v->t, t);
+
+  memcpy(msg, p, lp);
+  len = dtls_chachapoly_encrypt_message(key, nonce, msg, lp, a, la);
+  if (len != (long int)(lp + sizeof(t))
+      || memcmp(msg, c, lp) || memcmp(msg + lp, t, sizeof(t)))
+    return 1;
+
+  if (dtls_chachapoly_decrypt_message(key, nonce, msg, len, a, la)
+      != (long int)lp || memcmp(msg, p, lp))
+    return 1;
+
+  /* a modified tag is rejected */
+  memcpy(msg, c, lp);
+  memcpy(msg + lp, t, sizeof(t));
+  msg[lp] ^= 1;
+  return dtls_chachapoly_decrypt_message(key, nonce, msg, len, a, la) != -1;
+}
+
+/* As the tag covers the ciphertext, it is only compared for the long
+ * message. */
+static int
+check_long(void) {
+  static unsigned char msg[LONG_LENGTH + DTLS_CHACHAPOLY_TAG_LENGTH];
+  unsigned char key[DTLS_CHACHAPOLY_KEY_SIZE];
+  unsigned char nonce[DTLS_CHACHAPOLY_NONCE_SIZE];
+  unsigned char a[13], t[DTLS_CHACHAPOLY_TAG_LENGTH];
+  size_t i;
+
+  from_hex(LONG_KEY, key);
+  from_hex(LONG_NONCE, nonce);
+  from_hex(LONG_AAD, a);
+  from_hex(LONG_TAG, t);
+  for (i = 0; i < LONG_LENGTH; i++)
+    msg[i] = (unsigned char)(13 * i + 7);
+
+  dtls_chachapoly_encrypt_message(key, nonce, msg, LONG_LENGTH, a, sizeof(a));
+  if (memcmp(msg + LONG_LENGTH, t, sizeof(t)))
+    return 1;
+
+  if (dtls_chachapoly_decrypt_message(key, nonce, msg, sizeof(msg),
+				      a, sizeof(a)) != LONG_LENGTH)
+    return 1;
+  for (i = 0; i < LONG_LENGTH; i++)
+    if (msg[i] != (unsigned char)(13 * i + 7))
+      return 1;
+  return 0;
+}
+
+int
+main(int argc, char **argv) {
+  size_t n;
+  int failed = 0, res;
+  (void)argc; (void)argv;
+
+  for (n = 0; n < VECTORS; n++) {
+    res = check_vector(&data[n]);
+    printf("Test Case %zu %s\n", n + 1, res ? "FAILED" : "OK");
+    failed |= res;
+  }
+
+  res = check_long();
+  printf("Test Case %zu %s\n", n + 1, res ? "FAILED" : "OK");
+  failed |= res;
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
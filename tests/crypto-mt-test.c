@@ -0,0 +1,177 @@
+/* Stress test for concurrent record encryption.
+ *
+ * Every thread encrypts and decrypts its own stream of records with
+ * its own key through dtls_encrypt() and dtls_decrypt(). The results
+ * are compared against a checksum computed single-threaded up front,
+ * so any state shared between threads shows up as a mismatch. The
+ * throughput for one thread and for all threads is printed to show
+ * how record crypto scales.
+ *
+ * usage: crypto-mt-test [threads] [records]
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "tinydtls.h"
+#include "crypto.h"
+
+#define MAX_THREADS 64
+#define RECORD_SIZE 64		/* typical small CoAP payload */
+#define A_DATA_LEN 13
+
+struct worker {
+  pthread_t thread;
+  int id;
+  unsigned long records;
+  unsigned long checksum;
+  int failed;
+};
+
+static void
+fill(unsigned char *buf, size_t len, unsigned long seed) {
+  size_t i;
+  for (i = 0; i < len; i++)
+    buf[i] = (unsigned char)((seed * 131 + i * 7) >> (i % 3));
+}
+
+static void *
+run_worker(void *arg) {
+  struct worker *w = (struct worker *)arg;
+  aes128_ccm_t ctx;
+  unsigned char key[DTLS_KEY_LENGTH];
+  unsigned char nonce[DTLS_CCM_BLOCKSIZE];
+  unsigned char A_DATA[A_DATA_LEN];
+  unsigned char plain[RECORD_SIZE];
+  unsigned char buf[RECORD_SIZE + DTLS_CCM_BLOCKSIZE];
+  unsigned long n;
+  size_t i;
+  int len;
+
+  fill(key, sizeof(key), w->id);
+  if (dtls_cipher_set_key(&ctx, key, sizeof(key)) < 0) {
+    w->failed = 1;
+    return NULL;
+  }
+
+  w->checksum = 0;
+  for (n = 0; n < w->records; n++) {
+    memset(nonce, 0, sizeof(nonce));
+    fill(nonce, DTLS_CCM_NONCE_SIZE, n);
+    fill(A_DATA, sizeof(A_DATA), n + 1);
+    fill(plain, sizeof(plain), n + w->id);
+
+    len = dtls_encrypt(&ctx, plain, sizeof(plain), buf, nonce,
+		       A_DATA, sizeof(A_DATA));
+    if (len != RECORD_SIZE + 8) {
+      w->failed = 1;
+      break;
+    }
+
+    for (i = 0; i < (size_t)len; i++)
+      w->checksum = w->checksum * 31 + buf[i];
+
+    len = dtls_decrypt(&ctx, buf, len, buf, nonce, A_DATA, sizeof(A_DATA));
+    if (len != RECORD_SIZE || memcmp(buf, plain, RECORD_SIZE) != 0) {
+      w->failed = 1;
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+static double
+now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Runs the first nthreads workers concurrently and returns the
+ * elapsed time in seconds, or a negative value on error. */
+static double
+run_threads(struct worker *workers, int nthreads) {
+  double start = now();
+  int i;
+
+  for (i = 0; i < nthreads; i++) {
+    if (pthread_create(&workers[i].thread, NULL, run_worker, &workers[i])) {
+      fprintf(stderr, "E: cannot create thread #%d\n", i);
+      return -1.0;
+    }
+  }
+
+  for (i = 0; i < nthreads; i++)
+    pthread_join(workers[i].thread, NULL);
+
+  return now() - start;
+}
+
+int
+main(int argc, char **argv) {
+  static struct worker workers[MAX_THREADS];
+  unsigned long expected[MAX_THREADS];
+  unsigned long records = 200000;
+  int nthreads = 4;
+  double t1, tn;
+  int i, result = EXIT_SUCCESS;
+
+  if (argc > 1)
+    nthreads = atoi(argv[1]);
+  if (argc > 2)
+    records = strtoul(argv[2], NULL, 10);
+  if (nthreads < 1 || nthreads > MAX_THREADS) {
+    fprintf(stderr, "E: number of threads must be between 1 and %d\n",
+	    MAX_THREADS);
+    return EXIT_FAILURE;
+  }
+
+  /* reference results, one worker at a time */
+  for (i = 0; i < nthreads; i++) {
+    workers[i].id = i;
+    workers[i].records = records / 10;
+    run_worker(&workers[i]);
+    if (workers[i].failed) {
+      fprintf(stderr, "E: worker #%d failed in single-threaded run\n", i);
+      return EXIT_FAILURE;
+    }
+    expected[i] = workers[i].checksum;
+  }
+
+  /* concurrent run with the same parameters as the reference */
+  if (run_threads(workers, nthreads) < 0)
+    return EXIT_FAILURE;
+  for (i = 0; i < nthreads; i++) {
+    if (workers[i].failed || workers[i].checksum != expected[i]) {
+      fprintf(stderr, "E: worker #%d produced wrong records\n", i);
+      result = EXIT_FAILURE;
+    }
+  }
+
+  for (i = 0; i < nthreads; i++)
+    workers[i].records = records;
+  t1 = run_threads(workers, 1);
+  tn = run_threads(workers, nthreads);
+  if (t1 <= 0 || tn <= 0)
+    return EXIT_FAILURE;
+
+  for (i = 0; i < nthreads; i++) {
+    if (workers[i].failed) {
+      fprintf(stderr, "E: worker #%d failed\n", i);
+      result = EXIT_FAILURE;
+    }
+  }
+
+  printf("1 thread:   %.0f records/s\n", records / t1);
+  printf("%d threads: %.0f records/s (%.2fx)\n", nthreads,
+	 nthreads * records / tn, (nthreads * records / tn) / (records / t1));
+  printf(result == EXIT_SUCCESS ? "OK\n" : "FAILED\n");
+
+  return result;
+}
@@ -0,0 +1,467 @@
+/* End-to-end benchmark of handshakes and records.
+ *
+ * A client and a server context exchange their datagrams through an
+ * in-memory link, so that the measurements contain the processing of
+ * both sides but no network. The benchmark runs full and resumed
+ * handshakes for each cipher suite that is built in, ECDHE-ECDSA with
+ * client authentication, and then seals and opens application data
+ * records of different payload sizes on a connection with AES-128-CCM-8
+ * and, if built in, AES-128-GCM.
+ *
+ * The results are printed as comma-separated values, one line per
+ * measurement after a header line. The rate is in operations per
+ * second, latencies are in microseconds. For handshakes, the latency
+ * runs from dtls_connect() until the client is connected, for records
+ * it is the time for dtls_write() or dtls_handle_message() of one
+ * record.
+ *
+ * usage: dtls-bench [seconds]
+ *
+ * Each measurement runs for the given number of seconds, 1 by default.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tinydtls.h"
+#include "dtls.h"
+#include "dtls_debug.h"
+
+#define MAX_DATAGRAMS 16
+#define MAX_SAMPLES 200000
+#define SERVER_PORT 20220
+#define CLIENT_PORT 20221
+#define SERVER_PORTS 1024	/* more than the client's session cache */
+
+struct link {
+  int count;
+  session_t session[MAX_DATAGRAMS];
+  size_t length[MAX_DATAGRAMS];
+  uint8 data[MAX_DATAGRAMS][DTLS_MAX_BUF];
+};
+
+static dtls_context_t *server, *client;
+static struct link to_server, to_client;
+static session_t server_addr, client_addr;
+static int connected;
+static double samples[MAX_SAMPLES];
+
+static const size_t payloads[] = { 16, 64, 256, 1024 };
+
+static double
+now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+set_address(session_t *session, unsigned short port) {
+  dtls_session_init(session);
+  session->size = sizeof(session->addr.sin);
+  session->addr.sin.sin_family = AF_INET;
+  session->addr.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  session->addr.sin.sin_port = htons(port);
+}
+
+static int
+send_to_peer(struct dtls_context_t *ctx, session_t *session,
+	     uint8 *data, size_t len) {
+  struct link *link = ctx == server ? &to_client : &to_server;
+  (void)session;
+
+  if (link->count == MAX_DATAGRAMS || len > DTLS_MAX_BUF)
+    return -1;
+  /* the datagram arrives from the address of the sender */
+  link->session[link->count] = ctx == server ? server_addr : client_addr;
+  memcpy(link->data[link->count], data, len);
+  link->length[link->count++] = len;
+  return len;
+}
+
+static int
+read_from_peer(struct dtls_context_t *ctx, session_t *session,
+	       uint8 *data, size_t len) {
+  (void)ctx; (void)session; (void)data; (void)len;
+  return 0;
+}
+
+static int
+handle_event(struct dtls_context_t *ctx, session_t *session,
+	     dtls_alert_level_t level, unsigned short code) {
+  (void)session; (void)level;
+
+  if (ctx == client && code == DTLS_EVENT_CONNECTED)
+    connected = 1;
+  return 0;
+}
+
+/* Delivers the queued datagrams until both links are idle. */
+static void
+pump(void) {
+  int i, busy;
+
+  do {
+    busy = to_server.count | to_client.count;
+    for (i = 0; i < to_server.count; i++)
+      dtls_handle_message(server, &to_server.session[i],
+			  to_server.data[i], to_server.length[i]);
+    to_server.count = 0;
+    for (i = 0; i < to_client.count; i++)
+      dtls_handle_message(client, &to_client.session[i],
+			  to_client.data[i], to_client.length[i]);
+    to_client.count = 0;
+  } while (busy);
+}
+
+#ifdef DTLS_PSK
+static int
+get_psk_info(struct dtls_context_t *ctx, const session_t *session,
+	     dtls_credentials_type_t type,
+	     const unsigned char *id, size_t id_len,
+	     unsigned char *result, size_t result_length) {
+  (void)ctx; (void)session; (void)id; (void)id_len;
+
+  switch (type) {
+  case DTLS_PSK_IDENTITY:
+    if (result_length < 15)
+      return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+    memcpy(result, "Client_identity", 15);
+    return 15;
+  case DTLS_PSK_KEY:
+    if (result_length < 9)
+      return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+    memcpy(result, "secretPSK", 9);
+    return 9;
+  default:
+    return 0;
+  }
+}
+
+static dtls_handler_t psk_cb = {
+  .write = send_to_peer,
+  .read  = read_from_peer,
+  .event = handle_event,
+  .get_psk_info = get_psk_info,
+};
+#endif /* DTLS_PSK */
+
+#ifdef DTLS_ECC
+static const unsigned char ecdsa_priv_key[] = {
+			0xD9, 0xE2, 0x70, 0x7A, 0x72, 0xDA, 0x6A, 0x05,
+			0x04, 0x99, 0x5C, 0x86, 0xED, 0xDB, 0xE3, 0xEF,
+			0xC7, 0xF1, 0xCD, 0x74, 0x83, 0x8F, 0x75, 0x70,
+			0xC8, 0x07, 0x2D, 0x0A, 0x76, 0x26, 0x1B, 0xD4};
+
+static const unsigned char ecdsa_pub_key_x[] = {
+			0xD0, 0x55, 0xEE, 0x14, 0x08, 0x4D, 0x6E, 0x06,
+			0x15, 0x59, 0x9D, 0xB5, 0x83, 0x91, 0x3E, 0x4A,
+			0x3E, 0x45, 0x26, 0xA2, 0x70, 0x4D, 0x61, 0xF2,
+			0x7A, 0x4C, 0xCF, 0xBA, 0x97, 0x58, 0xEF, 0x9A};
+
+static const unsigned char ecdsa_pub_key_y[] = {
+			0xB4, 0x18, 0xB6, 0x4A, 0xFE, 0x80, 0x30, 0xDA,
+			0x1D, 0xDC, 0xF4, 0xF4, 0x2E, 0x2F, 0x26, 0x31,
+			0xD0, 0x43, 0xB1, 0xFB, 0x03, 0xE2, 0x2F, 0x4D,
+			0x17, 0xDE, 0x43, 0xF9, 0xF9, 0xAD, 0xEE, 0x70};
+
+static int
+get_ecdsa_key(struct dtls_context_t *ctx, const session_t *session,
+	      const dtls_ecdsa_key_t **result) {
+  static const dtls_ecdsa_key_t ecdsa_key = {
+    .curve = DTLS_ECDH_CURVE_SECP256R1,
+    .priv_key = ecdsa_priv_key,
+    .pub_key_x = ecdsa_pub_key_x,
+    .pub_key_y = ecdsa_pub_key_y
+  };
+  (void)ctx; (void)session;
+
+  *result = &ecdsa_key;
+  return 0;
+}
+
+static int
+verify_ecdsa_key(struct dtls_context_t *ctx, const session_t *session,
+		 const unsigned char *other_pub_x,
+		 const unsigned char *other_pub_y, size_t key_size) {
+  (void)ctx; (void)session; (void)other_pub_x; (void)other_pub_y;
+  (void)key_size;
+  return 0;
+}
+
+static dtls_handler_t ecc_cb = {
+  .write = send_to_peer,
+  .read  = read_from_peer,
+  .event = handle_event,
+  .get_ecdsa_key = get_ecdsa_key,
+  .verify_ecdsa_key = verify_ecdsa_key,
+};
+#endif /* DTLS_ECC */
+
+static int
+compare_samples(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+/* Prints a result line for @p count operations that took @p seconds,
+ * with the percentiles of the first MAX_SAMPLES latencies. */
+static void
+report(const char *benchmark, const char *suite, size_t payload,
+       unsigned long count, double seconds) {
+  size_t n = count < MAX_SAMPLES ? count : MAX_SAMPLES;
+  double rate = seconds > 0 ? count / seconds : 0;
+
+  qsort(samples, n, sizeof(samples[0]), compare_samples);
+  printf("%s,%s,%s,%zu,%lu,%.1f,%.2f,%.3f,%.3f\n", dtls_package_version(),
+	 benchmark, suite, payload, count, rate, rate * payload / 1e6,
+	 n ? samples[n / 2] * 1e6 : 0, n ? samples[n * 99 / 100] * 1e6 : 0);
+  fflush(stdout);
+}
+
+static int
+open_contexts(dtls_handler_t *cb) {
+  connected = 0;
+  to_server.count = to_client.count = 0;
+  server = dtls_new_context(NULL);
+  client = dtls_new_context(NULL);
+  if (!server || !client) {
+    fprintf(stderr, "E: cannot create contexts\n");
+    return -1;
+  }
+  dtls_set_handler(server, cb);
+  dtls_set_handler(client, cb);
+  return 0;
+}
+
+static void
+close_contexts(void) {
+  dtls_free_context(client);
+  dtls_free_context(server);
+  client = server = NULL;
+}
+
+/* Connects the client to the server at @p port. */
+static int
+handshake(unsigned short port) {
+  set_address(&server_addr, port);
+  connected = 0;
+  if (dtls_connect(client, &server_addr) < 0)
+    return -1;
+  pump();
+  return connected ? 0 : -1;
+}
+
+/* Removes the connection from both contexts, the close_notify alerts
+ * are dropped. */
+static void
+reset(void) {
+  dtls_peer_t *peer;
+
+  if ((peer = dtls_get_peer(client, &server_addr)))
+    dtls_reset_peer(client, peer);
+  if ((peer = dtls_get_peer(server, &client_addr)))
+    dtls_reset_peer(server, peer);
+  to_server.count = to_client.count = 0;
+}
+
+/* Runs handshakes for @p duration seconds. A full handshake goes to
+ * a new server port each time, so that the client has no session to
+ * resume, a resumed handshake always goes to the same port. */
+static int
+bench_handshakes(const char *suite, dtls_handler_t *cb, int resume,
+		 double duration) {
+  unsigned long count = 0;
+  double start, t;
+
+  if (open_contexts(cb) < 0)
+    return -1;
+  if (resume && handshake(SERVER_PORT) == 0)
+    reset();
+
+  start = now();
+  do {
+    t = now();
+    if (handshake(resume ? SERVER_PORT : SERVER_PORT + count % SERVER_PORTS)) {
+      fprintf(stderr, "E: %s handshake %lu has failed\n", suite, count);
+      close_contexts();
+      return -1;
+    }
+    if (count < MAX_SAMPLES)
+      samples[count] = now() - t;
+    count++;
+    reset();
+  } while (now() - start < duration);
+
+#if DTLS_STATS
+  if (resume) {
+    dtls_stats_t stats;
+
+    dtls_get_stats(server, &stats);
+    if (stats.handshakes_resumed != count) {
+      fprintf(stderr, "E: %s: %lu of %lu handshakes have been resumed\n",
+	      suite, stats.handshakes_resumed, count);
+      close_contexts();
+      return -1;
+    }
+  }
+#endif /* DTLS_STATS */
+
+  report(resume ? "handshake-resumed" : "handshake", suite, 0, count,
+	 now() - start);
+  close_contexts();
+  return 0;
+}
+
+/* the AEAD that bench_records() forces */
+enum { BENCH_CCM_8, BENCH_GCM, BENCH_CHACHA20 };
+
+#if DTLS_GCM
+/* A GCM operation that the library does not recognize as the software
+ * one, so that the client offers the GCM suites first. */
+static int
+bench_gcm_seal(aes128_ccm_t *ctx, const unsigned char *src, size_t length,
+	       unsigned char *buf, unsigned char *nonce,
+	       const unsigned char *aad, size_t aad_length) {
+  return dtls_encrypt_gcm(ctx, src, length, buf, nonce, aad, aad_length);
+}
+#endif /* DTLS_GCM */
+
+#if DTLS_CHACHA20
+/* The same for the ChaCha20-Poly1305 suites. */
+static int
+bench_chacha20_seal(aes128_ccm_t *ctx, const unsigned char *src,
+		    size_t length, unsigned char *buf, unsigned char *nonce,
+		    const unsigned char *aad, size_t aad_length) {
+  return dtls_encrypt_chacha20(ctx, src, length, buf, nonce,
+			       aad, aad_length);
+}
+#endif /* DTLS_CHACHA20 */
+
+/* Seals and opens records of each payload size for @p duration
+ * seconds with the AEAD @p aead. The time spent in dtls_write() and
+ * dtls_handle_message() is measured separately. */
+static int
+bench_records(const char *suite, dtls_handler_t *cb, int aead,
+	      double duration) {
+  static uint8 payload[1024];
+  static double open_samples[MAX_SAMPLES];
+  dtls_crypto_provider_t crypto = dtls_crypto_software;
+  unsigned long count;
+  double start, t, sealing, opening;
+  size_t i;
+
+  /* without gcm_open or chacha20_open these suites are not negotiated */
+#if DTLS_GCM
+  if (aead == BENCH_GCM)
+    crypto.gcm_seal = bench_gcm_seal;
+  else
+    crypto.gcm_open = NULL;
+#endif /* DTLS_GCM */
+#if DTLS_CHACHA20
+  if (aead == BENCH_CHACHA20)
+    crypto.chacha20_seal = bench_chacha20_seal;
+  else
+    crypto.chacha20_open = NULL;
+#endif /* DTLS_CHACHA20 */
+
+  if (open_contexts(cb) == 0) {
+    dtls_set_crypto_provider(client, &crypto);
+    dtls_set_crypto_provider(server, &crypto);
+  }
+  if (!client || !server || handshake(SERVER_PORT) < 0) {
+    fprintf(stderr, "E: %s handshake has failed\n", suite);
+    close_contexts();
+    return -1;
+  }
+
+  for (i = 0; i < sizeof(payloads) / sizeof(payloads[0]); i++) {
+    count = 0;
+    sealing = opening = 0;
+    start = now();
+    do {
+      t = now();
+      if (dtls_write(client, &server_addr, payload, payloads[i])
+	  != (int)payloads[i] || to_server.count != 1) {
+	fprintf(stderr, "E: cannot write %zu bytes\n", payloads[i]);
+	close_contexts();
+	return -1;
+      }
+      t = now() - t;
+      sealing += t;
+      if (count < MAX_SAMPLES)
+	samples[count] = t;
+
+      t = now();
+      dtls_handle_message(server, &to_server.session[0],
+			  to_server.data[0], to_server.length[0]);
+      t = now() - t;
+      opening += t;
+      if (count < MAX_SAMPLES)
+	open_samples[count] = t;
+      to_server.count = 0;
+      count++;
+    } while (now() - start < duration);
+
+    report("record-seal", suite, payloads[i], count, sealing);
+    memcpy(samples, open_samples,
+	   (count < MAX_SAMPLES ? count : MAX_SAMPLES) * sizeof(samples[0]));
+    report("record-open", suite, payloads[i], count, opening);
+  }
+
+  close_contexts();
+  return 0;
+}
+
+int
+main(int argc, char **argv) {
+  double duration = argc > 1 ? atof(argv[1]) : 1;
+  int failed = 0;
+
+  if (duration <= 0) {
+    fprintf(stderr, "usage: %s [seconds]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  dtls_init();
+  dtls_set_log_level(DTLS_LOG_EMERG);
+  set_address(&client_addr, CLIENT_PORT);
+
+  printf("version,benchmark,suite,payload,count,rate,mbytes_per_s,"
+	 "p50_us,p99_us\n");
+#ifdef DTLS_PSK
+  failed |= bench_handshakes("psk", &psk_cb, 0, duration);
+  failed |= bench_handshakes("psk", &psk_cb, 1, duration);
+#endif /* DTLS_PSK */
+#ifdef DTLS_ECC
+  failed |= bench_handshakes("ecdhe-ecdsa", &ecc_cb, 0, duration);
+  failed |= bench_handshakes("ecdhe-ecdsa", &ecc_cb, 1, duration);
+#endif /* DTLS_ECC */
+
+  /* the record protection does not depend on the key exchange */
+#ifdef DTLS_PSK
+  failed |= bench_records("aes-128-ccm-8", &psk_cb, BENCH_CCM_8, duration);
+#if DTLS_GCM
+  failed |= bench_records("aes-128-gcm", &psk_cb, BENCH_GCM, duration);
+#endif /* DTLS_GCM */
+#if DTLS_CHACHA20
+  failed |= bench_records("chacha20-poly1305", &psk_cb, BENCH_CHACHA20,
+			  duration);
+#endif /* DTLS_CHACHA20 */
+#else /* DTLS_PSK */
+  failed |= bench_records("aes-128-ccm-8", &ecc_cb, BENCH_CCM_8, duration);
+#if DTLS_GCM
+  failed |= bench_records("aes-128-gcm", &ecc_cb, BENCH_GCM, duration);
+#endif /* DTLS_GCM */
+#if DTLS_CHACHA20
+  failed |= bench_records("chacha20-poly1305", &ecc_cb, BENCH_CHACHA20,
+			  duration);
+#endif /* DTLS_CHACHA20 */
+#endif /* DTLS_PSK */
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
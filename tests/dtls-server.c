@@ -2,6 +2,9 @@
 /* This is needed for apple */
 #define __APPLE_USE_RFC_3542
 
+/* recvmmsg() and sendmmsg() are GNU extensions */
+#define _GNU_SOURCE
+
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
@@ -147,6 +150,42 @@ send_to_peer(struct dtls_context_t *ctx,
 		&session->addr.sa, session->size);
 }
 
+#ifdef HAVE_SENDMMSG
+/* Sends all records of a flight with a single system call. */
+static int
+send_batch_to_peers(struct dtls_context_t *ctx,
+		    dtls_message_t *msgs, size_t count) {
+  struct mmsghdr hdrs[DTLS_WRITE_BATCH_SIZE];
+  struct iovec iov[DTLS_WRITE_BATCH_SIZE];
+  int fd = *(int *)dtls_get_app_data(ctx);
+  size_t i;
+  int n;
+
+  if (count > DTLS_WRITE_BATCH_SIZE)
+    count = DTLS_WRITE_BATCH_SIZE;
+
+  memset(hdrs, 0, sizeof(hdrs));
+  for (i = 0; i < count; i++) {
+    iov[i].iov_base = msgs[i].msg;
+    iov[i].iov_len = msgs[i].length;
+    hdrs[i].msg_hdr.msg_iov = &iov[i];
+    hdrs[i].msg_hdr.msg_iovlen = 1;
+    hdrs[i].msg_hdr.msg_name = &msgs[i].session.addr.sa;
+    hdrs[i].msg_hdr.msg_namelen = msgs[i].session.size;
+  }
+
+  n = sendmmsg(fd, hdrs, count, MSG_DONTWAIT);
+  if (n < 0) {
+    perror("sendmmsg");
+    return -1;
+  }
+
+  for (i = 0; i < count; i++)
+    msgs[i].result = i < (size_t)n ? (int)hdrs[i].msg_len : -1;
+  return n;
+}
+#endif /* HAVE_SENDMMSG */
+
 static int
 dtls_handle_read(struct dtls_context_t *ctx) {
   int *fd;
@@ -177,6 +216,62 @@ dtls_handle_read(struct dtls_context_t *ctx) {
   return dtls_handle_message(ctx, &session, buf, len);
 }    
 
+#ifdef HAVE_RECVMMSG
+/* maximum number of datagrams fetched with one recvmmsg() call */
+#define MAX_READ_BATCH 32
+
+static unsigned long batch_calls, batch_datagrams;
+
+/* Reads up to batch_size datagrams with one system call and hands
+ * them over to dtls_handle_messages(). */
+static int
+dtls_handle_read_batch(struct dtls_context_t *ctx, int batch_size) {
+  static uint8 bufs[MAX_READ_BATCH][DTLS_MAX_BUF];
+  static dtls_message_t msgs[MAX_READ_BATCH];
+  struct mmsghdr hdrs[MAX_READ_BATCH];
+  struct iovec iov[MAX_READ_BATCH];
+  int *fd;
+  int i, n;
+
+  fd = dtls_get_app_data(ctx);
+
+  assert(fd);
+
+  memset(hdrs, 0, sizeof(hdrs));
+  for (i = 0; i < batch_size; i++) {
+    memset(&msgs[i].session, 0, sizeof(session_t));
+    iov[i].iov_base = bufs[i];
+    iov[i].iov_len = sizeof(bufs[i]);
+    hdrs[i].msg_hdr.msg_iov = &iov[i];
+    hdrs[i].msg_hdr.msg_iovlen = 1;
+    hdrs[i].msg_hdr.msg_name = &msgs[i].session.addr;
+    hdrs[i].msg_hdr.msg_namelen = sizeof(msgs[i].session.addr);
+  }
+
+  /* select() has signalled at least one datagram, take whatever else
+   * is queued without blocking */
+  n = recvmmsg(*fd, hdrs, batch_size, MSG_DONTWAIT, NULL);
+  if (n < 0) {
+    perror("recvmmsg");
+    return -1;
+  }
+
+  for (i = 0; i < n; i++) {
+    msgs[i].session.size = hdrs[i].msg_hdr.msg_namelen;
+    msgs[i].msg = bufs[i];
+    msgs[i].length = hdrs[i].msg_len;
+    if (hdrs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+      dtls_warn("packet was truncated\n");
+    }
+  }
+
+  batch_calls++;
+  batch_datagrams += n;
+
+  return dtls_handle_messages(ctx, msgs, n);
+}
+#endif /* HAVE_RECVMMSG */
+
 static int
 resolve_address(const char *server, struct sockaddr *dst) {
   
@@ -228,8 +323,10 @@ usage(const char *program, const char *version) {
 
   fprintf(stderr, "%s v%s -- DTLS server implementation\n"
 	  "(c) 2011-2014 Olaf Bergmann <bergmann@tzi.org>\n\n"
-	  "usage: %s [-A address] [-p port] [-v num]\n"
+	  "usage: %s [-A address] [-b num] [-p port] [-v num]\n"
 	  "\t-A address\t\tlisten on specified address (default is ::)\n"
+	  "\t-b num\t\treceive up to num datagrams per system call\n"
+	  "\t      \t\t(default: 1, needs recvmmsg())\n"
 	  "\t-p port\t\tlisten on specified port (default is %d)\n"
 	  "\t-v num\t\tverbosity level (default: 3)\n",
 	   program, version, program, DEFAULT_PORT);
@@ -244,8 +341,11 @@ static dtls_handler_t cb = {
 #endif /* DTLS_PSK */
 #ifdef DTLS_ECC
   .get_ecdsa_key = get_ecdsa_key,
-  .verify_ecdsa_key = verify_ecdsa_key
+  .verify_ecdsa_key = verify_ecdsa_key,
 #endif /* DTLS_ECC */
+#ifdef HAVE_SENDMMSG
+  .write_batch = send_batch_to_peers,
+#endif /* HAVE_SENDMMSG */
 };
 
 int 
@@ -256,6 +356,7 @@ main(int argc, char **argv) {
   struct timeval timeout;
   int fd, opt, result;
   int on = 1;
+  int batch_size = 1;
   struct sockaddr_in6 listen_addr;
 
   memset(&listen_addr, 0, sizeof(struct sockaddr_in6));
@@ -269,7 +370,7 @@ main(int argc, char **argv) {
   listen_addr.sin6_port = htons(DEFAULT_PORT);
   listen_addr.sin6_addr = in6addr_any;
 
-  while ((opt = getopt(argc, argv, "A:p:v:")) != -1) {
+  while ((opt = getopt(argc, argv, "A:b:p:v:")) != -1) {
     switch (opt) {
     case 'A' :
       if (resolve_address(optarg, (struct sockaddr *)&listen_addr) < 0) {
@@ -277,6 +378,20 @@ main(int argc, char **argv) {
 	exit(-1);
       }
       break;
+    case 'b' :
+      batch_size = atoi(optarg);
+#ifdef HAVE_RECVMMSG
+      if (batch_size < 1 || batch_size > MAX_READ_BATCH) {
+	fprintf(stderr, "batch size must be between 1 and %d\n",
+		MAX_READ_BATCH);
+	exit(1);
+      }
+#else /* HAVE_RECVMMSG */
+      if (batch_size != 1)
+	fprintf(stderr, "no recvmmsg(), batch size ignored\n");
+      batch_size = 1;
+#endif /* HAVE_RECVMMSG */
+      break;
     case 'p' :
       listen_addr.sin6_port = htons(atoi(optarg));
       break;
@@ -340,15 +455,28 @@ main(int argc, char **argv) {
     timeout.tv_usec = 0;
     
     result = select( fd+1, &rfds, &wfds, 0, &timeout);
-    
+    /* the datagrams of this round share one reading of the clock */
+    dtls_ticks_refresh(NULL);
+
     if (result < 0) {		/* error */
       if (errno != EINTR)
 	perror("select");
     } else if (result == 0) {	/* timeout */
+#ifdef HAVE_RECVMMSG
+      if (batch_calls) {
+	dtls_info("%lu datagrams in %lu calls to recvmmsg()\n",
+		  batch_datagrams, batch_calls);
+      }
+#endif /* HAVE_RECVMMSG */
     } else {			/* ok */
       if (FD_ISSET(fd, &wfds))
 	;
       else if (FD_ISSET(fd, &rfds)) {
+#ifdef HAVE_RECVMMSG
+	if (batch_size > 1)
+	  dtls_handle_read_batch(the_context, batch_size);
+	else
+#endif /* HAVE_RECVMMSG */
 	dtls_handle_read(the_context);
       }
     }
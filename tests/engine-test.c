@@ -0,0 +1,310 @@
+/* Checks the server engine of dtls_engine.h.
+ *
+ * An engine with two shards listens on the loopback interface. Some
+ * clients in the main thread perform a PSK handshake with it over
+ * real UDP sockets and send a record, which the shard that has the
+ * peer echoes back with dtls_engine_write(). Then the main thread
+ * writes to each peer through the queue of its shard, and runs a
+ * function in each shard with dtls_engine_call().
+ *
+ * usage: engine-test
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "tinydtls.h"
+#include "dtls.h"
+#include "dtls_debug.h"
+#include "dtls_engine.h"
+
+#if defined(DTLS_ENGINE) && defined(DTLS_PSK)
+
+#define SERVER_PORT 20240
+#define CLIENTS 4
+#define SHARDS 2
+
+static dtls_engine_t *engine;
+static dtls_context_t *clients[CLIENTS];
+static int fds[CLIENTS];
+static session_t server_addr;
+
+/* what the shards have learned about the peers */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static session_t peer_session[CLIENTS];
+static int peer_shard[CLIENTS];		/* -1 until connected */
+static int calls[SHARDS];
+
+static char received[CLIENTS][64];	/* application data of each client */
+
+static int
+get_psk_info(struct dtls_context_t *ctx, const session_t *session,
+	     dtls_credentials_type_t type,
+	     const unsigned char *id, size_t id_len,
+	     unsigned char *result, size_t result_length) {
+  (void)ctx; (void)session; (void)id; (void)id_len;
+
+  switch (type) {
+  case DTLS_PSK_IDENTITY:
+    if (result_length < 15)
+      return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+    memcpy(result, "Client_identity", 15);
+    return 15;
+  case DTLS_PSK_KEY:
+    if (result_length < 9)
+      return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+    memcpy(result, "secretPSK", 9);
+    return 9;
+  default:
+    return 0;
+  }
+}
+
+/* The index of the client that uses the port of @p session. */
+static int
+client_of(const session_t *session) {
+  int port = ntohs(session->addr.sin.sin_port);
+
+  return port > SERVER_PORT && port <= SERVER_PORT + CLIENTS
+    ? port - SERVER_PORT - 1 : -1;
+}
+
+static int
+server_event(struct dtls_context_t *ctx, session_t *session,
+	     dtls_alert_level_t level, unsigned short code) {
+  int i = client_of(session);
+  (void)level;
+
+  if (code == DTLS_EVENT_CONNECTED && i >= 0) {
+    pthread_mutex_lock(&lock);
+    peer_session[i] = *session;
+    peer_shard[i] = dtls_engine_shard_of(ctx);
+    pthread_mutex_unlock(&lock);
+  }
+  return 0;
+}
+
+/* echoes all application data in the thread of the shard */
+static int
+server_read(struct dtls_context_t *ctx, session_t *session,
+	    uint8 *data, size_t len) {
+  return dtls_engine_write(dtls_engine_of(ctx), dtls_engine_shard_of(ctx),
+			   session, data, len) < 0 ? -1 : 0;
+}
+
+static dtls_handler_t server_cb = {
+  .read  = server_read,
+  .event = server_event,
+  .get_psk_info = get_psk_info,
+};
+
+static int
+client_write(struct dtls_context_t *ctx, session_t *session,
+	     uint8 *data, size_t len) {
+  return sendto(*(int *)dtls_get_app_data(ctx), data, len, 0,
+		&session->addr.sa, session->size);
+}
+
+static int
+client_read(struct dtls_context_t *ctx, session_t *session,
+	    uint8 *data, size_t len) {
+  int i;
+  (void)session;
+
+  for (i = 0; i < CLIENTS; i++)
+    if (ctx == clients[i]
+	&& strlen(received[i]) + len < sizeof(received[i]))
+      strncat(received[i], (char *)data, len);
+  return 0;
+}
+
+static dtls_handler_t client_cb = {
+  .write = client_write,
+  .read  = client_read,
+  .get_psk_info = get_psk_info,
+};
+
+static void
+set_address(session_t *session, unsigned short port) {
+  dtls_session_init(session);
+  session->size = sizeof(session->addr.sin);
+  session->addr.sin.sin_family = AF_INET;
+  session->addr.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  session->addr.sin.sin_port = htons(port);
+}
+
+/* Handles the datagrams of the clients for @p ms milliseconds, or
+ * until @p done returns true. */
+static void
+run_clients(int ms, int (*done)(void)) {
+  struct pollfd pfd[CLIENTS];
+  uint8 buf[DTLS_MAX_BUF];
+  session_t session;
+  int i, len;
+
+  for (; ms > 0 && !(done && done()); ms -= 10) {
+    for (i = 0; i < CLIENTS; i++) {
+      pfd[i].fd = fds[i];
+      pfd[i].events = POLLIN;
+    }
+    if (poll(pfd, CLIENTS, 10) < 0 && errno != EINTR)
+      return;
+    for (i = 0; i < CLIENTS; i++) {
+      if (!(pfd[i].revents & POLLIN))
+	continue;
+      set_address(&session, 0);
+      session.size = sizeof(session.addr);
+      len = recvfrom(fds[i], buf, sizeof(buf), 0, &session.addr.sa,
+		     &session.size);
+      if (len > 0)
+	dtls_handle_message(clients[i], &session, buf, len);
+    }
+    for (i = 0; i < CLIENTS; i++)
+      dtls_check_retransmit(clients[i], NULL);
+  }
+}
+
+static int
+all_connected(void) {
+  int i, n = 0;
+
+  pthread_mutex_lock(&lock);
+  for (i = 0; i < CLIENTS; i++)
+    n += peer_shard[i] >= 0 && dtls_get_peer(clients[i], &server_addr)
+      && dtls_peer_is_connected(dtls_get_peer(clients[i], &server_addr));
+  pthread_mutex_unlock(&lock);
+  return n == CLIENTS;
+}
+
+static int
+all_received(const char *text) {
+  int i;
+
+  for (i = 0; i < CLIENTS; i++)
+    if (strcmp(received[i], text))
+      return 0;
+  return 1;
+}
+
+static int
+all_echoed(void) {
+  return all_received("ping");
+}
+
+static int
+all_pushed(void) {
+  return all_received("pingpush");
+}
+
+static void
+count_call(dtls_context_t *ctx, void *arg) {
+  (void)arg;
+  pthread_mutex_lock(&lock);
+  calls[dtls_engine_shard_of(ctx)]++;
+  pthread_mutex_unlock(&lock);
+}
+
+int
+main(int argc, char **argv) {
+  dtls_engine_config_t config;
+  session_t local;
+  int n[SHARDS] = { 0 };
+  int i, failed = 0;
+  (void)argc; (void)argv;
+
+  dtls_init();
+  dtls_set_log_level(DTLS_LOG_EMERG);
+
+  set_address(&server_addr, SERVER_PORT);
+  memset(&config, 0, sizeof(config));
+  config.addr = &server_addr.addr.sa;
+  config.addr_len = server_addr.size;
+  config.shards = SHARDS;
+  config.handler = &server_cb;
+  engine = dtls_engine_new(&config);
+  if (!engine || dtls_engine_shards(engine) != SHARDS
+      || dtls_engine_start(engine) < 0) {
+    fprintf(stderr, "E: cannot start the engine\n");
+    return EXIT_FAILURE;
+  }
+
+  for (i = 0; i < CLIENTS; i++) {
+    peer_shard[i] = -1;
+    set_address(&local, SERVER_PORT + 1 + i);
+    fds[i] = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fds[i] < 0 || bind(fds[i], &local.addr.sa, local.size) < 0) {
+      fprintf(stderr, "E: cannot bind client %d\n", i);
+      return EXIT_FAILURE;
+    }
+    clients[i] = dtls_new_context(&fds[i]);
+    dtls_set_handler(clients[i], &client_cb);
+    dtls_connect(clients[i], &server_addr);
+  }
+
+  run_clients(5000, all_connected);
+  if (!all_connected()) {
+    fprintf(stderr, "E: not all clients are connected\n");
+    failed = 1;
+  }
+
+  /* the peers answer from their own shard */
+  for (i = 0; i < CLIENTS; i++)
+    dtls_write(clients[i], &server_addr, (uint8 *)"ping", 4);
+  run_clients(5000, all_echoed);
+  if (!all_echoed()) {
+    fprintf(stderr, "E: the records have not been echoed\n");
+    failed = 1;
+  }
+
+  /* the main thread hands data to the shards */
+  for (i = 0; i < CLIENTS && !failed; i++)
+    if (dtls_engine_write(engine, peer_shard[i], &peer_session[i],
+			  (uint8 *)"push", 4) < 0)
+      failed = 1;
+  run_clients(5000, all_pushed);
+  if (!all_pushed()) {
+    fprintf(stderr, "E: the queued data has not been sent\n");
+    failed = 1;
+  }
+
+  for (i = 0; i < SHARDS; i++)
+    dtls_engine_call(engine, i, count_call, NULL);
+  for (i = 0; i < 500 && !(n[0] && n[1]); i++) {
+    usleep(1000);
+    pthread_mutex_lock(&lock);
+    memcpy(n, calls, sizeof(n));
+    pthread_mutex_unlock(&lock);
+  }
+  if (n[0] != 1 || n[1] != 1) {
+    fprintf(stderr, "E: the shards have run %d and %d calls\n", n[0], n[1]);
+    failed = 1;
+  }
+
+  printf("%d clients on %u shards: %s\n", CLIENTS,
+	 dtls_engine_shards(engine), failed ? "FAILED" : "OK");
+
+  dtls_engine_free(engine);
+  for (i = 0; i < CLIENTS; i++) {
+    dtls_free_context(clients[i]);
+    close(fds[i]);
+  }
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#else /* DTLS_ENGINE && DTLS_PSK */
+
+int
+main(int argc, char **argv) {
+  (void)argc; (void)argv;
+  printf("engine-test needs the engine and PSK support, skipped\n");
+  return 0;
+}
+
+#endif /* DTLS_ENGINE && DTLS_PSK */
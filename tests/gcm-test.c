@@ -0,0 +1,145 @@
+/* Checks AES-128-GCM of gcm.c with the test cases 1 to 4 of "The
+ * Galois/Counter Mode of Operation (GCM)" by McGrew and Viega. When
+ * the CPU supports carry-less multiplication, every case is also run
+ * with the portable GHASH, and both are compared on a long message.
+ *
+ * usage: gcm-test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tinydtls.h"
+#include "gcm.h"
+
+struct test_vector {
+  const char *key, *iv, *p, *a, *c, *t;
+};
+
+static const struct test_vector data[] = {
+  { "00000000000000000000000000000000", "000000000000000000000000",
+    "", "", "", "58e2fccefa7e3061367f1d57a4e7455a" },
+  { "00000000000000000000000000000000", "000000000000000000000000",
+    "00000000000000000000000000000000", "",
+    "0388dace60b6a392f328c2b971b2fe78", "ab6e47d42cec13bdf53a67b21257bddf" },
+  { "feffe9928665731c6d6a8f9467308308", "cafebabefacedbaddecaf888",
+    "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+    "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b391aafd255",
+    "",
+    "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e"
+    "21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091473f5985",
+    "4d5c2af327cd64a62cf35abd2ba6fab4" },
+  { "feffe9928665731c6d6a8f9467308308", "cafebabefacedbaddecaf888",
+    "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+    "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39",
+    "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+    "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e"
+    "21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091",
+    "5bc94fbc3221a5db94fae95ae7121a47" },
+};
+
+#define VECTORS (sizeof(data) / sizeof(data[0]))
+
+static size_t
+from_hex(const char *hex, unsigned char *buf) {
+  size_t n;
+  unsigned int b;
+
+  for (n = 0; hex[2 * n]; n++) {
+    sscanf(hex + 2 * n, "%2x", &b);
+    buf[n] = b;
+  }
+  return n;
+}
+
+/* Runs vector @p v with the GHASH key @p h of @p ctx. */
+static int
+check_vector(const struct test_vector *v, rijndael_ctx *ctx,
+	     const dtls_ghash_key_t *h) {
+  unsigned char iv[DTLS_GCM_NONCE_SIZE], p[64], a[32], c[64], t[16];
+  unsigned char msg[64 + DTLS_GCM_TAG_LENGTH];
+  size_t lp, la;
+  long int len;
+
+  from_hex(v->iv, iv);
+  lp = from_hex(v->p, p);
+  la = from_hex(v->a, a);
+  from_hex(v->c, c);
+  from_hex(v->t, t);
+
+  memcpy(msg, p, lp);
+  len = dtls_gcm_encrypt_message(ctx, h, iv, msg, lp, a, la);
+  if (len != (long int)(lp + DTLS_GCM_TAG_LENGTH)
+      || memcmp(msg, c, lp) || memcmp(msg + lp, t, sizeof(t)))
+    return 1;
+
+  if (dtls_gcm_decrypt_message(ctx, h, iv, msg, len, a, la) != (long int)lp
+      || memcmp(msg, p, lp))
+    return 1;
+
+  /* a modified tag is rejected */
+  memcpy(msg, c, lp);
+  memcpy(msg + lp, t, sizeof(t));
+  msg[lp] ^= 1;
+  return dtls_gcm_decrypt_message(ctx, h, iv, msg, len, a, la) != -1;
+}
+
+#ifdef WITH_AES_HW
+/* Compares the hardware GHASH with the portable one on messages that
+ * do not end on a block boundary. */
+static int
+check_hw(rijndael_ctx *ctx, dtls_ghash_key_t *h) {
+  static unsigned char msg_hw[1000 + DTLS_GCM_TAG_LENGTH];
+  static unsigned char msg_sw[1000 + DTLS_GCM_TAG_LENGTH];
+  unsigned char iv[DTLS_GCM_NONCE_SIZE], aad[13];
+  size_t i, lm;
+
+  for (i = 0; i < sizeof(msg_hw); i++)
+    msg_hw[i] = (unsigned char)(i * 7 + 3);
+  memset(iv, 0x5a, sizeof(iv));
+  memset(aad, 0xa5, sizeof(aad));
+
+  for (lm = 0; lm < 1000; lm += 111) {
+    memcpy(msg_sw, msg_hw, lm);
+    h->hw = 1;
+    dtls_gcm_encrypt_message(ctx, h, iv, msg_hw, lm, aad, sizeof(aad));
+    h->hw = 0;
+    dtls_gcm_encrypt_message(ctx, h, iv, msg_sw, lm, aad, sizeof(aad));
+    if (memcmp(msg_hw, msg_sw, lm + DTLS_GCM_TAG_LENGTH))
+      return 1;
+  }
+  return 0;
+}
+#endif /* WITH_AES_HW */
+
+int
+main(int argc, char **argv) {
+  unsigned char key[16];
+  rijndael_ctx ctx;
+  dtls_ghash_key_t h;
+  size_t n;
+  int failed = 0, res;
+  (void)argc; (void)argv;
+
+  for (n = 0; n < VECTORS; n++) {
+    from_hex(data[n].key, key);
+    if (rijndael_set_key_enc_only(&ctx, key, 8 * sizeof(key)) < 0) {
+      fprintf(stderr, "cannot set key\n");
+      return EXIT_FAILURE;
+    }
+    dtls_gcm_set_key(&ctx, &h);
+    res = check_vector(&data[n], &ctx, &h);
+#ifdef WITH_AES_HW
+    if (h.hw) {
+      h.hw = 0;
+      res |= check_vector(&data[n], &ctx, &h);
+      res |= check_hw(&ctx, &h);
+    }
+#endif /* WITH_AES_HW */
+    printf("Test Case %zu %s\n", n + 1, res ? "FAILED" : "OK");
+    failed |= res;
+  }
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -18,6 +18,92 @@ dump_queue(struct netq_t *queue) {
   }
 }
 
+/* Adds a node for @p peer that is due at @p t to @p wheel. */
+static netq_t *
+wheel_add(netq_wheel_t *wheel, dtls_peer_t *peer, clock_time_t t) {
+  netq_t *node = netq_node_new(NULL, 0);
+
+  if (!node) {
+    fprintf(stderr, "E: cannot create node\n");
+    exit(EXIT_FAILURE);
+  }
+  node->peer = peer;
+  node->t = t;
+  netq_wheel_insert(wheel, node);
+  return node;
+}
+
+/* Checks that @p list holds the nodes due at @p t in this order. */
+static void
+wheel_check(netq_t *list, const clock_time_t t[], size_t n) {
+  netq_t *node;
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    assert(list && list->t == t[i]);
+    if (!list || list->t != t[i]) {
+      fprintf(stderr, "E: expected node #%zu to be due at %u\n",
+	      i, (unsigned int)t[i]);
+      exit(EXIT_FAILURE);
+    }
+    node = list;
+    list = list->next;
+    netq_node_free(node);
+  }
+  assert(list == NULL);
+}
+
+static void
+test_wheel(void) {
+  static netq_wheel_t wheel;
+  static dtls_peer_t a, b;
+  const clock_time_t revolution = NETQ_WHEEL_SIZE * NETQ_WHEEL_TICK;
+  const clock_time_t first[] = { 2000, 2000, 2001 };
+  const clock_time_t late[] = { 2000 + 2 * revolution };
+  const clock_time_t overdue[] = { 4000, 100 };
+  netq_t *node;
+
+  printf("------------------------------------------------------------------------\n");
+  printf("timer wheel:\n");
+
+  wheel_add(&wheel, &a, 2000);
+  wheel_add(&wheel, &b, 2000);
+  wheel_add(&wheel, &a, 2001);
+  wheel_add(&wheel, &b, 4000);
+  wheel_add(&wheel, &a, 2000 + 2 * revolution);
+  wheel_add(&wheel, &b, 6000);
+  assert(wheel.count == 6);
+  assert(netq_wheel_next(&wheel) == 2000);
+
+  assert(netq_wheel_expire(&wheel, 1999) == NULL);
+  wheel_check(netq_wheel_expire(&wheel, 2001), first, 3);
+  assert(netq_wheel_next(&wheel) == 4000);
+
+  /* cancel all nodes of one peer */
+  while ((node = b.retransmit)) {
+    netq_wheel_remove(&wheel, node);
+    netq_node_free(node);
+  }
+  assert(wheel.count == 1);
+
+  /* the remaining node is beyond the current revolution */
+  assert(netq_wheel_next(&wheel) > 2001);
+  assert(netq_wheel_next(&wheel) <= 2000 + 2 * revolution);
+  assert(netq_wheel_expire(&wheel, 2000 + revolution) == NULL);
+  wheel_check(netq_wheel_expire(&wheel, 2000 + 3 * revolution), late, 1);
+  assert(wheel.count == 0 && a.retransmit == NULL);
+  assert(netq_wheel_next(&wheel) == 0);
+
+  /* overdue nodes are sent with the current slot */
+  wheel_add(&wheel, &a, 4000);
+  wheel_add(&wheel, &a, 100);
+  assert(netq_wheel_next(&wheel) == 100);
+  wheel_check(netq_wheel_expire(&wheel, 4000), overdue, 2);
+
+  netq_wheel_delete_all(&wheel);
+  printf("timer wheel ok\n");
+}
+
 int main(int argc, char **argv) {
   struct netq_t *nq = NULL, *node;
   int i;
@@ -25,7 +111,7 @@ int main(int argc, char **argv) {
   clock_time_t timestamps[] = { 300, 100, 200, 400, 500 };
 
   for (i = 0; i < sizeof(timestamps)/sizeof(clock_time_t); i++) {
-    node = netq_node_new(0);
+    node = netq_node_new(NULL, 0);
 
     if (!node) {
       fprintf(stderr, "E: cannot create node #%d\n", i);
@@ -78,7 +164,7 @@ int main(int argc, char **argv) {
 
   printf("------------------------------------------------------------------------\n");
   printf("insert new item (timeout 50):\n");
-  node = netq_node_new(0);
+  node = netq_node_new(NULL, 0);
 
   assert(node);
   node->t = 50;
@@ -88,7 +174,7 @@ int main(int argc, char **argv) {
 
   printf("------------------------------------------------------------------------\n");
   printf("insert new item (timeout 350):\n");
-  node = netq_node_new(0);
+  node = netq_node_new(NULL, 0);
 
   assert(node);
   node->t = 350;
@@ -98,7 +184,7 @@ int main(int argc, char **argv) {
 
   printf("------------------------------------------------------------------------\n");
   printf("insert new item (timeout 1000):\n");
-  node = netq_node_new(0);
+  node = netq_node_new(NULL, 0);
 
   assert(node);
   node->t = 1000;
@@ -119,5 +205,6 @@ int main(int argc, char **argv) {
   assert(node == NULL);
   dump_queue(nq);
 
+  test_wheel();
   return 0;
 }
@@ -1,478 +1,1436 @@
+/* Replays the DTLS traffic of a packet capture against a tinydtls
+ * server to measure its performance with a real traffic mix.
+ *
+ * The records of a capture cannot be fed to another server as they
+ * are, because their keys depend on the random values of the server
+ * that has been captured. Instead, the capture is reduced to the
+ * workload of each device: when it starts a full or resumed
+ * handshake with which cipher suite, when it sends or receives
+ * application data records of which length, and when it closes the
+ * connection. This workload is then run once with simulated devices,
+ * which are client contexts in the same process, and everything the
+ * server context receives or has to send is recorded. Finally, the
+ * recorded datagrams are handed to dtls_handle_message() of a new
+ * server context, and the application data to dtls_write(), as fast
+ * as possible and without the devices.
+ *
+ * Both runs of the server see the same times, which are taken from
+ * the capture with dtls_ticks_set(), and the same random numbers, as
+ * the generator is seeded with dtls_prng_set_seed() before each call.
+ * The replayed server must therefore send exactly what it has sent in
+ * the recorded run, which is checked at the end. The replayed server
+ * allocates its memory from a counting allocator.
+ *
+ * The results are printed as comma-separated values, one metric per
+ * line after a header line, so that the output of two builds can be
+ * compared line by line. Times are CPU times of the replayed server
+ * in microseconds. With several runs, the fastest one of each
+ * measurement is reported.
+ *
+ * usage: pcap [-s port] [-c cid_length] [-n runs] [-S seed] [-t] [-v level]
+ *             file
+ *
+ *   -s  UDP port of the server in the capture, 20220 by default
+ *   -c  length of the connection IDs of the captured server, 6 by
+ *       default, to parse records with connection ID
+ *   -n  number of replays, 1 by default
+ *   -S  seed of the random numbers, 1 by default
+ *   -t  issue session tickets, so that devices can resume sessions
+ *       that have been dropped from the session cache of the server
+ *   -v  log level of tinydtls
+ *
+ * The file must be in the classic pcap format of libpcap, pcapng is
+ * not supported. Ethernet, Linux cooked, loopback and raw IP captures
+ * of UDP over IPv4 and IPv6 are read, IP fragments are ignored. The
+ * server of the replay accepts the PSK "Client_identity" and
+ * ECDHE-ECDSA with client authentication, using the keys of
+ * dtls-server, whatever the captured devices have used.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <getopt.h>
-#include <pcap/pcap.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "tinydtls.h"
-#include "dtls_debug.h"
 #include "dtls.h"
+#include "dtls_debug.h"
+#include "dtls_time.h"
+#include "prng.h"
+#include "pool.h"
+
+#define DTLS_RH_LENGTH sizeof(dtls_record_header_t)
+#define DTLS_HS_LENGTH sizeof(dtls_handshake_header_t)
+
+#define DEFAULT_PORT 20220
+#define DEFAULT_CID_LENGTH 6
+#define MAX_DATAGRAMS 32
+#define MAX_PAYLOAD (DTLS_MAX_BUF - DTLS_RECORD_HEADROOM \
+		     - DTLS_RECORD_TAILROOM - DTLS_RECORD_CID_ROOM)
+
+/* pcap file format */
+#define PCAP_MAGIC_US 0xa1b2c3d4
+#define PCAP_MAGIC_NS 0xa1b23c4d
+#define PCAP_HEADER_LENGTH 24
+#define PCAP_RECORD_LENGTH 16
+#define PCAP_SNAPLEN 65536
+
+#define LINKTYPE_NULL 0
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+#define LINKTYPE_LINUX_SLL 113
+
+/* the cipher suites that the devices can use */
+enum { KX_PSK, KX_ECDSA };
+enum { AEAD_CCM_8, AEAD_GCM, AEAD_CHACHA20 };
+
+static const struct suite {
+  dtls_cipher_t cipher;
+  int kx, aead;
+} suites[] = {
+#ifdef DTLS_PSK
+  { TLS_PSK_WITH_AES_128_CCM_8, KX_PSK, AEAD_CCM_8 },
+#if DTLS_GCM
+  { TLS_PSK_WITH_AES_128_GCM_SHA256, KX_PSK, AEAD_GCM },
+#endif /* DTLS_GCM */
+#if DTLS_CHACHA20
+  { TLS_PSK_WITH_CHACHA20_POLY1305_SHA256, KX_PSK, AEAD_CHACHA20 },
+#endif /* DTLS_CHACHA20 */
+#endif /* DTLS_PSK */
+#ifdef DTLS_ECC
+  { TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8, KX_ECDSA, AEAD_CCM_8 },
+#if DTLS_GCM
+  { TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256, KX_ECDSA, AEAD_GCM },
+#endif /* DTLS_GCM */
+#if DTLS_CHACHA20
+  { TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256, KX_ECDSA, AEAD_CHACHA20 },
+#endif /* DTLS_CHACHA20 */
+#endif /* DTLS_ECC */
+};
+
+#define SUITES (sizeof(suites) / sizeof(suites[0]))
+
+/* the workload of the devices */
+typedef enum {
+  EV_HANDSHAKE,			/* a ClientHello without cookie */
+  EV_DATA_UP,			/* application data to the server */
+  EV_DATA_DOWN,			/* application data from the server */
+  EV_CLOSE			/* an alert from the device */
+} event_type_t;
+
+typedef struct {
+  dtls_tick_t time;
+  unsigned int device;
+  unsigned char type;
+  unsigned char full;		/* EV_HANDSHAKE: not resumed */
+  uint16_t value;		/* the cipher suite or the payload length */
+} event_t;
+
+/* the calls of the server */
+typedef enum {
+  ACT_HANDSHAKE,		/* a datagram with handshake messages */
+  ACT_RECORDS,			/* a datagram with application data */
+  ACT_OTHER,			/* any other datagram */
+  ACT_SEND,			/* dtls_write() */
+  ACTION_TYPES
+} action_type_t;
+
+typedef struct {
+  dtls_tick_t time;
+  unsigned int device;
+  unsigned char type;
+  unsigned char records;	/* application data records in the datagram */
+  uint16_t length;		/* length of the datagram or the payload */
+  size_t offset;		/* position of the datagram in datagrams */
+} action_t;
+
+typedef struct {
+  session_t session;
+  int family;
+  unsigned char addr[16];
+  uint16_t port;		/* in network byte order */
+  dtls_cipher_t cipher;		/* the captured cipher suite */
+  long pending;			/* the current EV_HANDSHAKE, -1 if none */
+  int client;			/* the client context with the peer, or -1 */
+  int connected;
+#if DTLS_SESSION_CACHE_SIZE > 0
+  dtls_session_cache_entry_t *cached; /* the session of the device */
+#endif /* DTLS_SESSION_CACHE_SIZE > 0 */
+} device_t;
+
+/* a growing array */
+typedef struct {
+  void *data;
+  size_t count, capacity, size;
+} array_t;
+
+static array_t events = { NULL, 0, 0, sizeof(event_t) };
+static array_t actions = { NULL, 0, 0, sizeof(action_t) };
+static array_t devices = { NULL, 0, 0, sizeof(device_t) };
+static array_t datagrams = { NULL, 0, 0, 1 };
+
+/* index of devices by address, open addressing */
+static unsigned int *device_index;
+static size_t device_index_size;
+
+static struct {
+  unsigned long datagrams, skipped, full, resumed;
+  unsigned long records_up, records_down, closes, clamped;
+} capture;
+
+static struct {
+  unsigned long full, implicit, substituted, failed, records_dropped;
+} synthesis;
+
+struct link {
+  int count;
+  session_t session[MAX_DATAGRAMS];
+  size_t length[MAX_DATAGRAMS];
+  uint8 data[MAX_DATAGRAMS][DTLS_MAX_BUF];
+};
+
+static dtls_context_t *server, *clients[SUITES];
+static dtls_crypto_provider_t client_crypto[SUITES];
+static struct link to_server, to_client;
+static int replaying;		/* the server output is not delivered */
+static unsigned long connected;	/* handshakes the server has finished */
+static dtls_tick_t start_time;	/* creation of the server */
+static uint8 payload[MAX_PAYLOAD];
+
+/* what the server has sent, to compare the runs */
+static struct {
+  unsigned long datagrams;
+  uint64_t hash;
+} output;
+
+static unsigned long seed = 1;
+static unsigned int server_port = DEFAULT_PORT;
+static size_t cid_length = DEFAULT_CID_LENGTH;
+static int tickets;		/* the server issues session tickets */
+
+static double
+now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-#define TRANSPORT_HEADER_SIZE (14+20+8) /* Ethernet + IP + UDP */
-
-/* the pre_master_secret is generated from the PSK at startup */
-unsigned char pre_master_secret[60];
-size_t pre_master_len = 0;
+static void *
+append(array_t *a, size_t count) {
+  void *p;
 
-unsigned char master_secret[DTLS_MASTER_SECRET_LENGTH];
-size_t master_secret_len = 0;
+  if (a->count + count > a->capacity) {
+    size_t capacity = a->capacity ? 2 * a->capacity : 1024;
 
-dtls_security_parameters_t security_params[2]; 
-int config = 0;
-unsigned int epoch[2] = { 0, 0 };
+    while (capacity < a->count + count)
+      capacity *= 2;
+    p = realloc(a->data, capacity * a->size);
+    if (!p) {
+      fprintf(stderr, "E: out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+    a->data = p;
+    a->capacity = capacity;
+  }
+  p = (unsigned char *)a->data + a->count * a->size;
+  a->count += count;
+  return p;
+}
 
-#if DTLS_VERSION == 0xfeff
-dtls_hash_t hs_hash[2];
-#elif DTLS_VERSION == 0xfefd
-dtls_hash_t hs_hash[1];
-#endif
+#define EVENT(I) (((event_t *)events.data)[I])
+#define ACTION(I) (((action_t *)actions.data)[I])
+#define DEVICE(I) (((device_t *)devices.data)[I])
 
-static inline void
-update_hash(uint8 *record, size_t rlength, 
-	    uint8 *data, size_t data_length) {
+/* Seeds the random numbers for the server call @p index. */
+static void
+reseed(unsigned long index) {
+  unsigned char s[DTLS_PRNG_SEED_LENGTH];
   int i;
 
-  if (!hs_hash[0])
-    return;
-
-  for (i = 0; i < sizeof(hs_hash) / sizeof(dtls_hash_t *); ++i) {
-    dtls_hash_update(hs_hash[i], data, data_length);
+  memset(s, 0, sizeof(s));
+  for (i = 0; i < 8; i++) {
+    s[i] = (unsigned char)(seed >> (8 * i));
+    s[16 + i] = (unsigned char)(index >> (8 * i));
   }
+  dtls_prng_set_seed(s);
 }
 
-static inline void
-finalize_hash(uint8 *buf) {
-#if DTLS_VERSION == 0xfeff
-  unsigned char statebuf[sizeof(md5_state_t) + sizeof(SHA_CTX)];
-#elif DTLS_VERSION == 0xfefd
-  unsigned char statebuf[sizeof(dtls_sha256_ctx)];
-#endif
+/* the devices */
 
-  if (!hs_hash[0])
-    return;
+static size_t
+device_hash(int family, const unsigned char *addr, uint16_t port) {
+  size_t h = 2166136261U ^ family ^ port, i;
 
-  /* temporarily store hash status for roll-back after finalize */
-#if DTLS_VERSION == 0xfeff
-  memcpy(statebuf, hs_hash[0], sizeof(md5_state_t));
-  memcpy(statebuf + sizeof(md5_state_t), 
-	 hs_hash[1], 
-	 sizeof(SHA_CTX));
-#elif DTLS_VERSION == 0xfefd
-  memcpy(statebuf, hs_hash[0], sizeof(statebuf));
-#endif
-
-  dtls_hash_finalize(buf, hs_hash[0]);
-#if DTLS_VERSION == 0xfeff
-  dtls_hash_finalize(buf + 16, hs_hash[1]);
-#endif
-
-  /* restore hash status */
-#if DTLS_VERSION == 0xfeff
-  memcpy(hs_hash[0], statebuf, sizeof(md5_state_t));
-  memcpy(hs_hash[1], 
-	 statebuf + sizeof(md5_state_t), 
-	 sizeof(SHA_CTX));
-#elif DTLS_VERSION == 0xfefd
-  memcpy(hs_hash[0], statebuf, sizeof(statebuf));
-#endif
-}
-
-static inline void
-clear_hash() {
-  int i;
+  for (i = 0; i < 16; i++)
+    h = (h ^ addr[i]) * 16777619U;
+  return h;
+}
+
+static void
+device_index_add(unsigned int n) {
+  const device_t *d = &DEVICE(n);
+  size_t i = device_hash(d->family, d->addr, d->port);
 
-  for (i = 0; i < sizeof(hs_hash) / sizeof(dtls_hash_t *); ++i)
-    free(hs_hash[i]);
-  memset(hs_hash, 0, sizeof(hs_hash));
+  for (i &= device_index_size - 1; device_index[i];
+       i = (i + 1) & (device_index_size - 1))
+    ;
+  device_index[i] = n + 1;
 }
 
-#undef CURRENT_CONFIG
-#undef OTHER_CONFIG
-#undef SWITCH_CONFIG
-#define CURRENT_CONFIG (&security_params[config])
-#define OTHER_CONFIG   (&security_params[!(config & 0x01)])
-#define SWITCH_CONFIG  (config = !(config & 0x01))
+/* Returns the device with the address, or creates it if @p create is
+ * set. The address has 4 bytes for IPv4 and 16 bytes for IPv6. */
+static long
+find_device(int family, const unsigned char *addr, uint16_t port,
+	    int create) {
+  unsigned char key[16];
+  device_t *d;
+  size_t i, n;
+
+  memset(key, 0, sizeof(key));
+  memcpy(key, addr, family == AF_INET ? 4 : 16);
+
+  if (device_index_size) {
+    i = device_hash(family, key, port) & (device_index_size - 1);
+    for (; device_index[i]; i = (i + 1) & (device_index_size - 1)) {
+      d = &DEVICE(device_index[i] - 1);
+      if (d->family == family && d->port == port
+	  && !memcmp(d->addr, key, sizeof(key)))
+	return device_index[i] - 1;
+    }
+  }
+  if (!create)
+    return -1;
 
-int
-pcap_verify(dtls_security_parameters_t *sec,
-	    int is_client, 
-	    const unsigned char *record, size_t record_length,
-	    const unsigned char *cleartext, size_t cleartext_length) {
+  if (2 * (devices.count + 1) > device_index_size) {
+    free(device_index);
+    device_index_size = device_index_size ? 2 * device_index_size : 1024;
+    device_index = calloc(device_index_size, sizeof(device_index[0]));
+    if (!device_index) {
+      fprintf(stderr, "E: out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+    for (n = 0; n < devices.count; n++)
+      device_index_add(n);
+  }
 
-  unsigned char mac[DTLS_HMAC_MAX];
-  dtls_hmac_context_t hmac_ctx;
-  int ok;
+  d = append(&devices, 1);
+  memset(d, 0, sizeof(*d));
+  d->family = family;
+  memcpy(d->addr, key, sizeof(key));
+  d->port = port;
+  d->cipher = TLS_NULL_WITH_NULL_NULL;
+  d->pending = -1;
+  d->client = -1;
+
+  dtls_session_init(&d->session);
+  if (family == AF_INET) {
+    d->session.size = sizeof(d->session.addr.sin);
+    d->session.addr.sin.sin_family = AF_INET;
+    memcpy(&d->session.addr.sin.sin_addr, key, 4);
+    d->session.addr.sin.sin_port = port;
+  } else {
+    d->session.size = sizeof(d->session.addr.sin6);
+    d->session.addr.sin6.sin6_family = AF_INET6;
+    memcpy(&d->session.addr.sin6.sin6_addr, key, 16);
+    d->session.addr.sin6.sin6_port = port;
+  }
+  device_index_add(devices.count - 1);
+  return devices.count - 1;
+}
 
-  if (cleartext_length < dtls_kb_digest_size(sec))
-    return 0;
+static long
+session_device(const session_t *session) {
+  if (session->addr.sa.sa_family == AF_INET)
+    return find_device(AF_INET,
+		       (const unsigned char *)&session->addr.sin.sin_addr,
+		       session->addr.sin.sin_port, 0);
+  return find_device(AF_INET6,
+		     (const unsigned char *)&session->addr.sin6.sin6_addr,
+		     session->addr.sin6.sin6_port, 0);
+}
 
-  dtls_hmac_init(&hmac_ctx, 
-		 is_client 
-		 ? dtls_kb_client_mac_secret(sec)
-		 : dtls_kb_server_mac_secret(sec),
-		 dtls_kb_mac_secret_size(sec));
-
-  cleartext_length -= dtls_kb_digest_size(sec);
-
-  /* calculate MAC even if padding is wrong */
-  dtls_mac(&hmac_ctx, 
-	   record, 		/* the pre-filled record header */
-	   cleartext, cleartext_length,
-	   mac);
-
-  ok = memcmp(mac, cleartext + cleartext_length, 
-	      dtls_kb_digest_size(sec)) == 0;
-#ifndef NDEBUG
-  printf("MAC (%s): ", ok ? "valid" : "invalid");
-  dump(mac, dtls_kb_digest_size(sec));
-  printf("\n");
-#endif
-  return ok;
-}
-		    
-int
-decrypt_verify(int is_client, const uint8 *packet, size_t length,
-	       uint8 **cleartext, size_t *clen) {
-  int res, ok = 0;
-  dtls_cipher_context_t *cipher;
-
-  static unsigned char buf[1000];
-  
-  switch (CURRENT_CONFIG->cipher) {
-  case AES128:			/* TLS_PSK_WITH_AES128_CBC_SHA */
-    *cleartext = buf;
-    *clen = length - sizeof(dtls_record_header_t);
-
-    if (is_client)
-      cipher = CURRENT_CONFIG->read_cipher;
-    else 
-      cipher = CURRENT_CONFIG->write_cipher; 
-
-    res = dtls_decrypt(cipher,
-		       (uint8 *)packet + sizeof(dtls_record_header_t), *clen, 
-		       buf, NULL, 0);
-
-    if (res < 0) {
-      warn("decryption failed!\n");
-    } else {
-      ok = pcap_verify(CURRENT_CONFIG, is_client, (uint8 *)packet, length, 
-		       *cleartext, res);  
-
-      if (ok)
-	*clen = res - dtls_kb_digest_size(CURRENT_CONFIG);
-    }
-    break;
-  default:			/* no cipher suite selected */
-    *cleartext = (uint8 *)packet + sizeof(dtls_record_header_t);
-    *clen = length - sizeof(dtls_record_header_t);
-    
-    ok = 1;
-  }
-  
-  if (ok)
-    printf("verify OK\n");
-  else
-    printf("verification failed!\n");
-  return ok;
-}
-
-#define SKIP_ETH_HEADER(M,L) 			\
-  if ((L) < 14)					\
-    return;					\
-  else {					\
-    (M) += 14;					\
-    (L) -= 14;					\
-  }
-
-#define SKIP_IP_HEADER(M,L)				\
-  if (((M)[0] & 0xF0) == 0x40) {	/* IPv4 */	\
-    (M) += (M[0] & 0x0F) * 4;				\
-    (L) -= (M[0] & 0x0F) * 4;				\
-  } else						\
-    if (((M)[0] & 0xF0) == 0x60) { /* IPv6 */		\
-      (M) += 40;					\
-      (L) -= 40;					\
-    } 
-
-#define SKIP_UDP_HEADER(M,L) {			\
-    (M) += 8;					\
-    (L) -= 8;					\
-  }
-
-void
-handle_packet(const u_char *packet, int length) {
-  static int n = 0;
-  static unsigned char initial_hello[] = { 
-    0x16, 0xfe, 0xff, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 
-  };
-  uint8 *data; 
-  size_t data_length, rlen;
-  int i, res;
-#if DTLS_VERSION == 0xfeff
-#ifndef SHA1_DIGEST_LENGTH
-#define SHA1_DIGEST_LENGTH 20
-#endif
-  uint8 hash_buf[16 + SHA1_DIGEST_LENGTH];
-#elif DTLS_VERSION == 0xfefd
-  uint8 hash_buf[DTLS_SHA256_DIGEST_LENGTH];
-#endif
-#define verify_data_length 12
-  int is_client;
-  n++;
-
-  SKIP_ETH_HEADER(packet, length);
-  SKIP_IP_HEADER(packet, length);
-
-  /* determine from port if this is a client */
-  is_client = dtls_uint16_to_int(packet) != 20220;
-
-  SKIP_UDP_HEADER(packet, length);
-
-  while (length) {
-    rlen = dtls_uint16_to_int(packet + 11) + sizeof(dtls_record_header_t);
-
-    if (!rlen) {
-      fprintf(stderr, "invalid length!\n");
+static int
+find_suite(dtls_cipher_t cipher) {
+  size_t i;
+
+  for (i = 0; i < SUITES; i++)
+    if (suites[i].cipher == cipher)
+      return i;
+  return -1;
+}
+
+/* Returns the key exchange of @p cipher, also of the suites that
+ * tinydtls does not implement. */
+static int
+key_exchange(dtls_cipher_t cipher) {
+  /* the PSK suites of RFC 5487, RFC 6655 and RFC 7905 */
+  if (cipher < 0xc000 || (cipher >= 0xc0a4 && cipher <= 0xc0ab)
+      || cipher == 0xccab)
+    return KX_PSK;
+  return KX_ECDSA;
+}
+
+/* Returns the bytes that the record protection of @p cipher adds to
+ * the payload, that of AES-128-GCM for unknown suites. */
+static size_t
+overhead(dtls_cipher_t cipher) {
+  /* AES-CCM-8 with PSK or ECDHE-ECDSA */
+  if ((cipher >= 0xc0a8 && cipher <= 0xc0a9)
+      || (cipher >= 0xc0ae && cipher <= 0xc0af))
+    return 8 + 8;
+  /* ChaCha20-Poly1305 has an implicit nonce */
+  if (cipher >= 0xcca8 && cipher <= 0xccae)
+    return 16;
+  return 8 + 16;
+}
+
+/* reading the capture */
+
+static uint32_t
+get32(const unsigned char *p, int big_endian) {
+  if (big_endian)
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+      | ((uint32_t)p[2] << 8) | p[3];
+  return ((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16)
+    | ((uint32_t)p[1] << 8) | p[0];
+}
+
+/* Looks at the handshake messages of a record in epoch 0. */
+static void
+parse_handshake(const unsigned char *p, size_t len, long dev,
+		int to_server, dtls_tick_t time) {
+  device_t *d = &DEVICE(dev);
+  size_t fragment, body;
+  event_t *e;
+
+  for (; len >= DTLS_HS_LENGTH; p += DTLS_HS_LENGTH + fragment,
+	 len -= DTLS_HS_LENGTH + fragment) {
+    fragment = dtls_uint24_to_int(p + 9);
+    if (fragment > len - DTLS_HS_LENGTH)
       return;
+    /* only the first fragment has the fields we need */
+    if (dtls_uint24_to_int(p + 6) != 0)
+      continue;
+    body = DTLS_HS_LENGTH + 2 + DTLS_RANDOM_LENGTH;
+
+    if (to_server && p[0] == DTLS_HT_CLIENT_HELLO) {
+      /* the second ClientHello carries the cookie */
+      if (fragment < body + 1 - DTLS_HS_LENGTH
+	  || body + 1 + p[body] >= DTLS_HS_LENGTH + fragment)
+	continue;
+      if (p[body + 1 + p[body]] != 0 && d->pending >= 0)
+	continue;
+      e = append(&events, 1);
+      e->time = time;
+      e->device = dev;
+      e->type = EV_HANDSHAKE;
+      e->full = 0;
+      e->value = TLS_NULL_WITH_NULL_NULL;
+      d = &DEVICE(dev);
+      d->pending = events.count - 1;
+    } else if (!to_server && p[0] == DTLS_HT_SERVER_HELLO && d->pending >= 0) {
+      if (fragment < body + 1 - DTLS_HS_LENGTH
+	  || body + 3 + p[body] > DTLS_HS_LENGTH + fragment)
+	continue;
+      EVENT(d->pending).value = dtls_uint16_to_int(p + body + 1 + p[body]);
+      d->cipher = EVENT(d->pending).value;
+    } else if (!to_server && p[0] == DTLS_HT_SERVER_HELLO_DONE
+	       && d->pending >= 0) {
+      EVENT(d->pending).full = 1;
     }
+  }
+}
 
-    /* skip packet if it is from a different epoch */
-    if (dtls_uint16_to_int(packet + 3) != epoch[is_client])
-      goto next;
-
-    res = decrypt_verify(is_client, packet, rlen,
-			 &data, &data_length);
-
-    if (res <= 0)
-      goto next;
-    
-    printf("packet %d (from %s):\n", n, is_client ? "client" : "server");
-    hexdump(packet, sizeof(dtls_record_header_t));
-    printf("\n");
-    hexdump(data, data_length);
-    printf("\n");
-    
-    if (packet[0] == 22 && data[0] == 1) { /* ClientHello */
-      if (memcmp(packet, initial_hello, sizeof(initial_hello)) == 0)
-	goto next;
-	
-      memcpy(dtls_kb_client_iv(OTHER_CONFIG), data + 14, 32);
-
-	clear_hash();
-#if DTLS_VERSION == 0xfeff
-      hs_hash[0] = dtls_new_hash(HASH_MD5);
-      hs_hash[1] = dtls_new_hash(HASH_SHA1);
-
-      hs_hash[0]->init(hs_hash[0]->data);
-      hs_hash[1]->init(hs_hash[1]->data);
-#elif DTLS_VERSION == 0xfefd
-      dtls_hash_init(hs_hash[0]);
-#endif
-    }
-    
-    if (packet[0] == 22 && data[0] == 2) { /* ServerHello */
-      memcpy(dtls_kb_server_iv(OTHER_CONFIG), data + 14, 32);
-      /* FIXME: search in ciphers */
-      OTHER_CONFIG->cipher = TLS_PSK_WITH_AES_128_CCM_8;
+/* Adds the events of a UDP datagram from or to the server. */
+static void
+parse_datagram(const unsigned char *p, size_t len, long dev,
+	       int to_server, dtls_tick_t time) {
+  size_t header, rlen;
+  unsigned int epoch;
+  long length;
+  event_t *e;
+  int type;
+
+  if (len < DTLS_RH_LENGTH || p[1] != 0xfe) {
+    capture.skipped++;
+    return;
+  }
+  capture.datagrams++;
+
+  for (; len >= DTLS_RH_LENGTH; p += header + rlen, len -= header + rlen) {
+    type = p[0];
+    epoch = dtls_uint16_to_int(p + 3);
+    header = type == DTLS_CT_TLS12_CID && to_server
+      ? DTLS_RH_LENGTH + cid_length : DTLS_RH_LENGTH;
+    if (len < header)
+      return;
+    rlen = dtls_uint16_to_int(p + header - 2);
+    if (rlen > len - header)
+      return;
+
+    if (epoch == 0) {
+      if (type == DTLS_CT_HANDSHAKE)
+	parse_handshake(p + header, rlen, dev, to_server, time);
+      continue;
     }
-    
-    if (packet[0] == 20 && data[0] == 1) { /* ChangeCipherSpec */
-      printf("client random: ");
-      dump(dtls_kb_client_iv(OTHER_CONFIG), 32);
-      printf("\nserver random: ");
-      dump(dtls_kb_server_iv(OTHER_CONFIG), 32);
-      printf("\n");
-      master_secret_len = 
-	dtls_prf(pre_master_secret, pre_master_len,
-		 (unsigned char *)"master secret", 13,
-		 dtls_kb_client_iv(OTHER_CONFIG), 32,
-		 dtls_kb_server_iv(OTHER_CONFIG), 32,
-		 master_secret, DTLS_MASTER_SECRET_LENGTH);
-  
-      printf("master_secret:\n  ");
-      for(i = 0; i < master_secret_len; i++) 
-	printf("%02x", master_secret[i]);
-      printf("\n");
-
-      /* create key_block from master_secret
-       * key_block = PRF(master_secret,
-                     "key expansion" + server_random + client_random) */
-      dtls_prf(master_secret, master_secret_len,
-	       (unsigned char *)"key expansion", 13,
-	       dtls_kb_server_iv(OTHER_CONFIG), 32,
-	       dtls_kb_client_iv(OTHER_CONFIG), 32,
-	       OTHER_CONFIG->key_block, 
-	       dtls_kb_size(OTHER_CONFIG));
-
-      OTHER_CONFIG->read_cipher = 
-	dtls_cipher_new(OTHER_CONFIG->cipher,
-			dtls_kb_client_write_key(OTHER_CONFIG),
-			dtls_kb_key_size(OTHER_CONFIG));
-
-      if (!OTHER_CONFIG->read_cipher) {
-	warn("cannot create read cipher\n");
-      } else {
-	dtls_cipher_set_iv(OTHER_CONFIG->read_cipher,
-			   dtls_kb_client_iv(OTHER_CONFIG),
-			   dtls_kb_iv_size(OTHER_CONFIG));
-      }
 
-      OTHER_CONFIG->write_cipher = 
-	dtls_cipher_new(OTHER_CONFIG->cipher, 
-			dtls_kb_server_write_key(OTHER_CONFIG),
-			dtls_kb_key_size(OTHER_CONFIG));
-      
-      if (!OTHER_CONFIG->write_cipher) {
-	warn("cannot create write cipher\n");
-      } else {
-	dtls_cipher_set_iv(OTHER_CONFIG->write_cipher,
-			   dtls_kb_server_iv(OTHER_CONFIG),
-			   dtls_kb_iv_size(OTHER_CONFIG));
+    if (type == DTLS_CT_ALERT && to_server) {
+      e = append(&events, 1);
+      e->time = time;
+      e->device = dev;
+      e->type = EV_CLOSE;
+      e->full = 0;
+      e->value = 0;
+      capture.closes++;
+    } else if (type == DTLS_CT_APPLICATION_DATA || type == DTLS_CT_TLS12_CID) {
+      /* the inner content type of records with connection ID */
+      length = rlen - overhead(DEVICE(dev).cipher)
+	- (type == DTLS_CT_TLS12_CID);
+      if (length < 1)
+	length = 1;
+      if (length > MAX_PAYLOAD) {
+	length = MAX_PAYLOAD;
+	capture.clamped++;
       }
-
-      /* if (is_client) */
-	SWITCH_CONFIG;
-      epoch[is_client]++;
-
-      printf("key_block:\n");
-      printf("  client_MAC_secret:\t");  
-      dump(dtls_kb_client_mac_secret(CURRENT_CONFIG), 
-	   dtls_kb_mac_secret_size(CURRENT_CONFIG));
-      printf("\n");
-
-      printf("  server_MAC_secret:\t");  
-      dump(dtls_kb_server_mac_secret(CURRENT_CONFIG), 
-	   dtls_kb_mac_secret_size(CURRENT_CONFIG));
-      printf("\n");
-
-      printf("  client_write_key:\t");  
-      dump(dtls_kb_client_write_key(CURRENT_CONFIG), 
-	   dtls_kb_key_size(CURRENT_CONFIG));
-      printf("\n");
-
-      printf("  server_write_key:\t");  
-      dump(dtls_kb_server_write_key(CURRENT_CONFIG), 
-	   dtls_kb_key_size(CURRENT_CONFIG));
-      printf("\n");
-
-      printf("  client_IV:\t\t");  
-      dump(dtls_kb_client_iv(CURRENT_CONFIG), 
-	   dtls_kb_iv_size(CURRENT_CONFIG));
-      printf("\n");
-      
-      printf("  server_IV:\t\t");  
-      dump(dtls_kb_server_iv(CURRENT_CONFIG), 
-	   dtls_kb_iv_size(CURRENT_CONFIG));
-      printf("\n");
-      
+      e = append(&events, 1);
+      e->time = time;
+      e->device = dev;
+      e->type = to_server ? EV_DATA_UP : EV_DATA_DOWN;
+      e->full = 0;
+      e->value = (uint16_t)length;
+      if (to_server)
+	capture.records_up++;
+      else
+	capture.records_down++;
     }
+  }
+}
 
-    if (packet[0] == 22) {
-      if (data[0] == 20) { /* Finished */
-	finalize_hash(hash_buf);
-	/* clear_hash(); */
-
-	update_hash((unsigned char *)packet, sizeof(dtls_record_header_t),
-		    data, data_length);
-
-	dtls_prf(master_secret, master_secret_len,
-		 is_client 
-		 ? (unsigned char *)"client finished" 
-		 : (unsigned char *)"server finished" 
-		 , 15,
-		 hash_buf, sizeof(hash_buf),
-		 NULL, 0,
-		 data + sizeof(dtls_handshake_header_t),
-		 verify_data_length);
-	printf("verify_data:\n");
-	dump(data, data_length);
-	printf("\n");
-      } else {
-	update_hash((unsigned char *)packet, sizeof(dtls_record_header_t),
-		    data, data_length);
-      }
+/* Finds the UDP datagram in a captured frame of @p linktype. */
+static void
+parse_frame(const unsigned char *p, size_t len, uint32_t linktype,
+	    dtls_tick_t time) {
+  const unsigned char *addr;
+  unsigned int ethertype = 0, sport, dport;
+  size_t header, ulen;
+  int family, to_server;
+
+  switch (linktype) {
+  case LINKTYPE_ETHERNET:
+    if (len < 14)
+      goto skip;
+    ethertype = (p[12] << 8) | p[13];
+    p += 14;
+    len -= 14;
+    /* 802.1Q tags */
+    while (ethertype == 0x8100 && len >= 4) {
+      ethertype = (p[2] << 8) | p[3];
+      p += 4;
+      len -= 4;
     }
+    if (ethertype != 0x0800 && ethertype != 0x86dd)
+      goto skip;
+    break;
+  case LINKTYPE_LINUX_SLL:
+    if (len < 16)
+      goto skip;
+    p += 16;
+    len -= 16;
+    break;
+  case LINKTYPE_NULL:
+    if (len < 4)
+      goto skip;
+    p += 4;
+    len -= 4;
+    break;
+  case LINKTYPE_RAW:
+    break;
+  default:
+    goto skip;
+  }
+
+  if (len < 1)
+    goto skip;
+  if (p[0] >> 4 == 4) {
+    header = (p[0] & 0x0f) * 4;
+    /* UDP, not fragmented */
+    if (len < 20 || header < 20 || len < header + 8 || p[9] != 17
+	|| (((p[6] << 8) | p[7]) & 0x3fff))
+      goto skip;
+    family = AF_INET;
+  } else if (p[0] >> 4 == 6) {
+    header = 40;
+    if (len < header + 8 || p[6] != 17)
+      goto skip;
+    family = AF_INET6;
+  } else {
+    goto skip;
+  }
+
+  sport = (p[header] << 8) | p[header + 1];
+  dport = (p[header + 2] << 8) | p[header + 3];
+  ulen = (p[header + 4] << 8) | p[header + 5];
+  if (ulen < 8 || ulen > len - header)
+    goto skip;
 
-    if (packet[0] == 23) {	/* Application Data */
-      printf("Application Data:\n");
-      dump(data, data_length);
-      printf("\n");
+  if (dport == server_port)
+    to_server = 1;
+  else if (sport == server_port)
+    to_server = 0;
+  else
+    goto skip;
+
+  /* the device is the source or destination address */
+  if (family == AF_INET)
+    addr = p + (to_server ? 12 : 16);
+  else
+    addr = p + (to_server ? 8 : 24);
+  parse_datagram(p + header + 8, ulen - 8,
+		 find_device(family, addr,
+			     htons(to_server ? sport : dport), 1),
+		 to_server, time);
+  return;
+
+ skip:
+  capture.skipped++;
+}
+
+static int
+read_capture(const char *filename) {
+  static unsigned char frame[PCAP_SNAPLEN];
+  unsigned char h[PCAP_HEADER_LENGTH];
+  uint32_t magic, linktype, caplen;
+  dtls_tick_t time, last = 0;
+  double start = -1, t;
+  int big_endian, ns;
+  FILE *f;
+
+  if (!(f = fopen(filename, "rb"))) {
+    perror(filename);
+    return -1;
+  }
+  if (fread(h, sizeof(h), 1, f) != 1) {
+    fprintf(stderr, "E: %s: no pcap header\n", filename);
+    goto error;
+  }
+
+  magic = get32(h, 0);
+  big_endian = magic != PCAP_MAGIC_US && magic != PCAP_MAGIC_NS;
+  if (big_endian)
+    magic = get32(h, 1);
+  if (magic != PCAP_MAGIC_US && magic != PCAP_MAGIC_NS) {
+    fprintf(stderr, "E: %s: not a pcap file\n", filename);
+    goto error;
+  }
+  ns = magic == PCAP_MAGIC_NS;
+  linktype = get32(h + 20, big_endian) & 0xffff;
+
+  while (fread(h, PCAP_RECORD_LENGTH, 1, f) == 1) {
+    caplen = get32(h + 8, big_endian);
+    if (caplen > sizeof(frame) || fread(frame, caplen, 1, f) != 1) {
+      fprintf(stderr, "E: %s: truncated packet\n", filename);
+      goto error;
     }
 
-  next:
-    length -= rlen;
-    packet += rlen;
+    /* the ticks start at one second, the order of the packets is kept
+     * if the capture goes back in time */
+    t = get32(h, big_endian) + get32(h + 4, big_endian) / (ns ? 1e9 : 1e6);
+    if (start < 0)
+      start = t;
+    time = (dtls_tick_t)((t - start + 1) * DTLS_TICKS_PER_SECOND);
+    if (time < last)
+      time = last;
+    last = time;
+
+    parse_frame(frame, caplen, linktype, time);
   }
+
+  fclose(f);
+  return 0;
+
+ error:
+  fclose(f);
+  return -1;
 }
 
-void init() {
-  memset(security_params, 0, sizeof(security_params));
-  CURRENT_CONFIG->cipher = -1;
+/* the callbacks of all contexts */
+
+static void
+hash_output(const uint8 *data, size_t len) {
+  uint64_t h = output.hash ^ len;
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    h = (h ^ data[i]) * 0x100000001b3ULL;
+  output.hash = h;
+  output.datagrams++;
+}
 
-  memset(hs_hash, 0, sizeof(hs_hash));
+/* Whether a datagram of the server contains a ServerHelloDone, i.e.
+ * a full handshake has been started. */
+static int
+is_full(const uint8 *p, size_t len) {
+  size_t rlen;
+
+  for (; len >= DTLS_RH_LENGTH; p += DTLS_RH_LENGTH + rlen,
+	 len -= DTLS_RH_LENGTH + rlen) {
+    rlen = dtls_uint16_to_int(p + DTLS_RH_LENGTH - 2);
+    if (rlen > len - DTLS_RH_LENGTH)
+      return 0;
+    if (p[0] == DTLS_CT_HANDSHAKE && dtls_uint16_to_int(p + 3) == 0
+	&& rlen >= DTLS_HS_LENGTH
+	&& p[DTLS_RH_LENGTH] == DTLS_HT_SERVER_HELLO_DONE)
+      return 1;
+  }
+  return 0;
+}
 
-  /* set pre_master_secret to default if no PSK was given */
-  if (!pre_master_len) {
-    /* unsigned char psk[] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06 }; */
-    pre_master_len =
-      dtls_pre_master_secret((unsigned char *)"secretPSK", 9,
-    			     pre_master_secret);
+static int
+send_to_peer(struct dtls_context_t *ctx, session_t *session,
+	     uint8 *data, size_t len) {
+  struct link *link = ctx == server ? &to_client : &to_server;
+
+  if (ctx == server) {
+    hash_output(data, len);
+    if (replaying)
+      return len;
+    if (is_full(data, len))
+      synthesis.full++;
   }
+
+  if (link->count == MAX_DATAGRAMS || len > DTLS_MAX_BUF)
+    return -1;
+  /* the device is the peer of both contexts */
+  link->session[link->count] = *session;
+  memcpy(link->data[link->count], data, len);
+  link->length[link->count++] = len;
+  return len;
+}
+
+static int
+read_from_peer(struct dtls_context_t *ctx, session_t *session,
+	       uint8 *data, size_t len) {
+  (void)ctx; (void)session; (void)data; (void)len;
+  return 0;
 }
 
-int main(int argc, char **argv) {
-  pcap_t *pcap;
-  char errbuf[PCAP_ERRBUF_SIZE];
-  struct pcap_pkthdr *pkthdr;
-  const u_char *packet;
-  int res = 0;
-  int c, option_index = 0;
+static int
+handle_event(struct dtls_context_t *ctx, session_t *session,
+	     dtls_alert_level_t level, unsigned short code) {
+  long dev;
+  (void)level;
 
-  static struct option opts[] = {
-    { "psk",  1, 0, 'p' },
-    { 0, 0, 0, 0 }
+  if (code != DTLS_EVENT_CONNECTED)
+    return 0;
+  if (ctx == server)
+    connected++;
+  else if ((dev = session_device(session)) >= 0)
+    DEVICE(dev).connected = 1;
+  return 0;
+}
+
+/* the time the replayed server spends in the expensive operations */
+static struct {
+  double start, ecc, prf;
+} trace;
+
+static void
+trace_point(struct dtls_context_t *ctx, dtls_trace_point_t point, int end) {
+  (void)ctx;
+
+  if (!replaying || point == DTLS_TRACE_CCM)
+    return;
+  if (!end) {
+    trace.start = now();
+  } else if (point == DTLS_TRACE_ECC) {
+    trace.ecc += now() - trace.start;
+  } else {
+    trace.prf += now() - trace.start;
+  }
+}
+
+#ifdef DTLS_PSK
+static int
+get_psk_info(struct dtls_context_t *ctx, const session_t *session,
+	     dtls_credentials_type_t type,
+	     const unsigned char *id, size_t id_len,
+	     unsigned char *result, size_t result_length) {
+  (void)ctx; (void)session; (void)id; (void)id_len;
+
+  switch (type) {
+  case DTLS_PSK_IDENTITY:
+    if (result_length < 15)
+      return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+    memcpy(result, "Client_identity", 15);
+    return 15;
+  case DTLS_PSK_KEY:
+    if (result_length < 9)
+      return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+    memcpy(result, "secretPSK", 9);
+    return 9;
+  default:
+    return 0;
+  }
+}
+#endif /* DTLS_PSK */
+
+#ifdef DTLS_ECC
+static const unsigned char ecdsa_priv_key[] = {
+			0xD9, 0xE2, 0x70, 0x7A, 0x72, 0xDA, 0x6A, 0x05,
+			0x04, 0x99, 0x5C, 0x86, 0xED, 0xDB, 0xE3, 0xEF,
+			0xC7, 0xF1, 0xCD, 0x74, 0x83, 0x8F, 0x75, 0x70,
+			0xC8, 0x07, 0x2D, 0x0A, 0x76, 0x26, 0x1B, 0xD4};
+
+static const unsigned char ecdsa_pub_key_x[] = {
+			0xD0, 0x55, 0xEE, 0x14, 0x08, 0x4D, 0x6E, 0x06,
+			0x15, 0x59, 0x9D, 0xB5, 0x83, 0x91, 0x3E, 0x4A,
+			0x3E, 0x45, 0x26, 0xA2, 0x70, 0x4D, 0x61, 0xF2,
+			0x7A, 0x4C, 0xCF, 0xBA, 0x97, 0x58, 0xEF, 0x9A};
+
+static const unsigned char ecdsa_pub_key_y[] = {
+			0xB4, 0x18, 0xB6, 0x4A, 0xFE, 0x80, 0x30, 0xDA,
+			0x1D, 0xDC, 0xF4, 0xF4, 0x2E, 0x2F, 0x26, 0x31,
+			0xD0, 0x43, 0xB1, 0xFB, 0x03, 0xE2, 0x2F, 0x4D,
+			0x17, 0xDE, 0x43, 0xF9, 0xF9, 0xAD, 0xEE, 0x70};
+
+static int
+get_ecdsa_key(struct dtls_context_t *ctx, const session_t *session,
+	      const dtls_ecdsa_key_t **result) {
+  static const dtls_ecdsa_key_t ecdsa_key = {
+    .curve = DTLS_ECDH_CURVE_SECP256R1,
+    .priv_key = ecdsa_priv_key,
+    .pub_key_x = ecdsa_pub_key_x,
+    .pub_key_y = ecdsa_pub_key_y
   };
+  (void)ctx; (void)session;
 
-  /* handle command line options */
-  while (1) {
-    c = getopt_long(argc, argv, "p:", opts, &option_index);
-    if (c == -1)
-      break;
+  *result = &ecdsa_key;
+  return 0;
+}
 
-    switch (c) {
-    case 'p':
-      pre_master_len = dtls_pre_master_secret((unsigned char *)optarg, 
-	      			      strlen(optarg), pre_master_secret);
-      break;
+static int
+verify_ecdsa_key(struct dtls_context_t *ctx, const session_t *session,
+		 const unsigned char *other_pub_x,
+		 const unsigned char *other_pub_y, size_t key_size) {
+  (void)ctx; (void)session; (void)other_pub_x; (void)other_pub_y;
+  (void)key_size;
+  return 0;
+}
+#endif /* DTLS_ECC */
+
+static dtls_handler_t server_cb = {
+  .write = send_to_peer,
+  .read  = read_from_peer,
+  .event = handle_event,
+#ifdef DTLS_PSK
+  .get_psk_info = get_psk_info,
+#endif /* DTLS_PSK */
+#ifdef DTLS_ECC
+  .get_ecdsa_key = get_ecdsa_key,
+  .verify_ecdsa_key = verify_ecdsa_key,
+#endif /* DTLS_ECC */
+  .trace = trace_point,
+};
+
+#ifdef DTLS_PSK
+static dtls_handler_t psk_cb = {
+  .write = send_to_peer,
+  .read  = read_from_peer,
+  .event = handle_event,
+  .get_psk_info = get_psk_info,
+};
+#endif /* DTLS_PSK */
+
+#ifdef DTLS_ECC
+static dtls_handler_t ecc_cb = {
+  .write = send_to_peer,
+  .read  = read_from_peer,
+  .event = handle_event,
+  .get_ecdsa_key = get_ecdsa_key,
+  .verify_ecdsa_key = verify_ecdsa_key,
+};
+#endif /* DTLS_ECC */
+
+/* the allocator of the replayed server */
+
+typedef union {
+  size_t size;
+  long double align_ld;
+  void *align_p;
+} block_header_t;
+
+static struct {
+  unsigned long allocs, frees;
+  size_t bytes, in_use, peak;
+} heap;
+
+static void *
+counting_alloc(size_t size, void *arg) {
+  block_header_t *b = malloc(sizeof(*b) + size);
+  (void)arg;
+
+  if (!b)
+    return NULL;
+  b->size = size;
+  heap.allocs++;
+  heap.bytes += size;
+  heap.in_use += size;
+  if (heap.in_use > heap.peak)
+    heap.peak = heap.in_use;
+  return b + 1;
+}
+
+static void
+counting_dealloc(void *ptr, void *arg) {
+  block_header_t *b = (block_header_t *)ptr - 1;
+  (void)arg;
+
+  if (!ptr)
+    return;
+  heap.frees++;
+  heap.in_use -= b->size;
+  free(b);
+}
+
+static const dtls_allocator_t counting_allocator = {
+  counting_alloc, counting_dealloc, NULL
+};
+
+/* the recorded run */
+
+#if DTLS_GCM
+/* A GCM operation that the library does not recognize as the software
+ * one, so that a client offers the GCM suites first. */
+static int
+preferred_gcm_seal(aes128_ccm_t *ctx, const unsigned char *src, size_t length,
+		   unsigned char *buf, unsigned char *nonce,
+		   const unsigned char *aad, size_t aad_length) {
+  return dtls_encrypt_gcm(ctx, src, length, buf, nonce, aad, aad_length);
+}
+#endif /* DTLS_GCM */
+
+#if DTLS_CHACHA20
+/* The same for the ChaCha20-Poly1305 suites. */
+static int
+preferred_chacha20_seal(aes128_ccm_t *ctx, const unsigned char *src,
+			size_t length, unsigned char *buf,
+			unsigned char *nonce,
+			const unsigned char *aad, size_t aad_length) {
+  return dtls_encrypt_chacha20(ctx, src, length, buf, nonce,
+			       aad, aad_length);
+}
+#endif /* DTLS_CHACHA20 */
+
+/* Returns the client context for the devices that use @p suite. Its
+ * ClientHello offers the AEAD of the suite first, followed by
+ * AES-128-CCM-8, which the server always supports. */
+static dtls_context_t *
+client_context(int suite) {
+  dtls_crypto_provider_t *crypto = &client_crypto[suite];
+
+  if (clients[suite])
+    return clients[suite];
+
+  *crypto = dtls_crypto_software;
+#if DTLS_GCM
+  if (suites[suite].aead == AEAD_GCM)
+    crypto->gcm_seal = preferred_gcm_seal;
+  else
+    crypto->gcm_open = NULL;
+#endif /* DTLS_GCM */
+#if DTLS_CHACHA20
+  if (suites[suite].aead == AEAD_CHACHA20)
+    crypto->chacha20_seal = preferred_chacha20_seal;
+  else
+    crypto->chacha20_open = NULL;
+#endif /* DTLS_CHACHA20 */
+
+  if (!(clients[suite] = dtls_new_context(NULL))) {
+    fprintf(stderr, "E: cannot create a client context\n");
+    exit(EXIT_FAILURE);
+  }
+#ifdef DTLS_PSK
+  if (suites[suite].kx == KX_PSK)
+    dtls_set_handler(clients[suite], &psk_cb);
+#endif /* DTLS_PSK */
+#ifdef DTLS_ECC
+  if (suites[suite].kx == KX_ECDSA)
+    dtls_set_handler(clients[suite], &ecc_cb);
+#endif /* DTLS_ECC */
+  dtls_set_crypto_provider(clients[suite], crypto);
+  return clients[suite];
+}
+
+/* Classifies a datagram for the server by its records. */
+static void
+classify(action_t *a, const uint8 *p, size_t len) {
+  size_t header, rlen;
+
+  a->type = ACT_OTHER;
+  a->records = 0;
+  for (; len >= DTLS_RH_LENGTH; p += header + rlen, len -= header + rlen) {
+    header = p[0] == DTLS_CT_TLS12_CID
+      ? DTLS_RH_LENGTH + DTLS_CID_LENGTH : DTLS_RH_LENGTH;
+    if (len < header
+	|| (rlen = dtls_uint16_to_int(p + header - 2)) > len - header)
+      return;
+    if (p[0] == DTLS_CT_HANDSHAKE || p[0] == DTLS_CT_CHANGE_CIPHER_SPEC)
+      a->type = ACT_HANDSHAKE;
+    else if (p[0] == DTLS_CT_APPLICATION_DATA || p[0] == DTLS_CT_TLS12_CID)
+      a->records++;
+  }
+  if (a->type == ACT_OTHER && a->records)
+    a->type = ACT_RECORDS;
+}
+
+/* Records a server call and performs it. */
+static void
+server_receive(session_t *session, uint8 *data, size_t len,
+	       dtls_tick_t time) {
+  action_t *a = append(&actions, 1);
+
+  a->time = time;
+  a->device = session_device(session);
+  a->length = len;
+  a->offset = datagrams.count;
+  classify(a, data, len);
+  memcpy(append(&datagrams, len), data, len);
+
+  reseed(actions.count);
+  dtls_handle_message(server, session, data, len);
+}
+
+static void
+server_send(long dev, size_t len, dtls_tick_t time) {
+  action_t *a = append(&actions, 1);
+
+  a->time = time;
+  a->device = dev;
+  a->type = ACT_SEND;
+  a->records = 1;
+  a->length = len;
+  a->offset = 0;
+
+  reseed(actions.count);
+  dtls_write(server, &DEVICE(dev).session, payload, len);
+}
+
+/* Delivers the queued datagrams until both links are idle. */
+static void
+pump(dtls_tick_t time) {
+  int i, busy;
+  long dev;
+
+  do {
+    busy = to_server.count | to_client.count;
+    for (i = 0; i < to_server.count; i++)
+      server_receive(&to_server.session[i], to_server.data[i],
+		     to_server.length[i], time);
+    to_server.count = 0;
+    for (i = 0; i < to_client.count; i++) {
+      dev = session_device(&to_client.session[i]);
+      if (dev >= 0 && DEVICE(dev).client >= 0)
+	dtls_handle_message(clients[DEVICE(dev).client],
+			    &to_client.session[i],
+			    to_client.data[i], to_client.length[i]);
     }
+    to_client.count = 0;
+  } while (busy);
+}
+
+/* Removes the peer of the device from its client context, as if the
+ * device had been restarted. */
+static void
+forget_peer(device_t *d) {
+  dtls_peer_t *peer;
+  int count = to_server.count;
+
+  if (d->client >= 0
+      && (peer = dtls_get_peer(clients[d->client], &d->session))) {
+    /* the close_notify is not sent */
+    dtls_reset_peer(clients[d->client], peer);
+    to_server.count = count;
+  }
+  d->connected = 0;
+}
+
+#if DTLS_SESSION_CACHE_SIZE > 0
+/* Returns the entry of the device in the session cache of @p ctx, or
+ * the least recently used one if @p any is set. */
+static dtls_session_cache_entry_t *
+cache_entry(dtls_context_t *ctx, const device_t *d, int any) {
+  dtls_session_cache_entry_t *victim = &ctx->sessions[0];
+  size_t i;
+
+  for (i = 0; i < DTLS_SESSION_CACHE_SIZE; i++) {
+    if (ctx->sessions[i].cipher != TLS_NULL_WITH_NULL_NULL
+	&& dtls_session_equals(&ctx->sessions[i].session, &d->session))
+      return &ctx->sessions[i];
+    if (ctx->sessions[i].cipher == TLS_NULL_WITH_NULL_NULL
+	|| ctx->sessions[i].last_used < victim->last_used)
+      victim = &ctx->sessions[i];
+  }
+  return any ? victim : NULL;
+}
+#endif /* DTLS_SESSION_CACHE_SIZE > 0 */
+
+/* Puts the session of the last handshake of the device into the cache
+ * of @p ctx, or removes it for a full handshake. A client context only
+ * caches a few sessions, so each device keeps a copy of its own. */
+static void
+load_session(dtls_context_t *ctx, const device_t *d, int full) {
+#if DTLS_SESSION_CACHE_SIZE > 0
+  dtls_session_cache_entry_t *entry = cache_entry(ctx, d, !full);
+
+  if (full) {
+    if (entry)
+      entry->cipher = TLS_NULL_WITH_NULL_NULL;
+  } else if (d->cached) {
+    *entry = *d->cached;
   }
+#else /* DTLS_SESSION_CACHE_SIZE > 0 */
+  (void)ctx; (void)d; (void)full;
+#endif /* DTLS_SESSION_CACHE_SIZE > 0 */
+}
 
-  if (argc <= optind) {
-    fprintf(stderr, "usage: %s [-p|--psk PSK] pcapfile\n", argv[0]);
-    return -1;
+static void
+save_session(dtls_context_t *ctx, device_t *d) {
+#if DTLS_SESSION_CACHE_SIZE > 0
+  dtls_session_cache_entry_t *entry = cache_entry(ctx, d, 0);
+
+  if (!entry)
+    return;
+  if (!d->cached && !(d->cached = malloc(sizeof(*d->cached)))) {
+    fprintf(stderr, "E: out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  *d->cached = *entry;
+#else /* DTLS_SESSION_CACHE_SIZE > 0 */
+  (void)ctx; (void)d;
+#endif /* DTLS_SESSION_CACHE_SIZE > 0 */
+}
+
+static void
+device_handshake(long dev, dtls_cipher_t cipher, int full,
+		 dtls_tick_t time) {
+  device_t *d = &DEVICE(dev);
+  int suite = find_suite(cipher);
+  dtls_context_t *ctx;
+
+  if (suite < 0) {
+    /* a suite that is not built in, or none for an implicit handshake */
+    if (cipher != TLS_NULL_WITH_NULL_NULL)
+      synthesis.substituted++;
+    for (suite = SUITES - 1; suite > 0; suite--)
+      if (suites[suite].aead == AEAD_CCM_8
+	  && suites[suite].kx == key_exchange(cipher))
+	break;
+  }
+
+  forget_peer(d);
+  d->client = suite;
+  ctx = client_context(suite);
+  load_session(ctx, d, full);
+  if (dtls_connect(ctx, &d->session) < 0) {
+    synthesis.failed++;
+    return;
   }
+  pump(time);
+  if (d->connected)
+    save_session(ctx, d);
+  else
+    synthesis.failed++;
+}
+
+static void
+run_event(const event_t *e) {
+  device_t *d = &DEVICE(e->device);
 
-  init();
+  dtls_ticks_set(e->time);
+  switch (e->type) {
+  case EV_HANDSHAKE:
+    device_handshake(e->device, e->value, e->full, e->time);
+    break;
+  case EV_DATA_UP:
+  case EV_DATA_DOWN:
+    if (!d->connected) {
+      synthesis.implicit++;
+      device_handshake(e->device,
+		       d->cipher, 1, e->time);
+      d = &DEVICE(e->device);
+      if (!d->connected) {
+	synthesis.records_dropped++;
+	break;
+      }
+    }
+    if (e->type == EV_DATA_UP)
+      dtls_write(clients[d->client], &d->session, payload, e->value);
+    else
+      server_send(e->device, e->value, e->time);
+    pump(e->time);
+    break;
+  case EV_CLOSE:
+    if (d->connected) {
+      dtls_close(clients[d->client], &d->session);
+      pump(e->time);
+      forget_peer(&DEVICE(e->device));
+    }
+    break;
+  }
+}
 
-  pcap = pcap_open_offline(argv[optind], errbuf);
-  if (!pcap) {
-    fprintf(stderr, "pcap_open_offline: %s\n", errbuf);
-    return -2;
+static int
+new_server(dtls_tick_t time) {
+  dtls_ticks_set(time);
+  reseed(0);
+  if (!(server = dtls_new_context(NULL))) {
+    fprintf(stderr, "E: cannot create the server context\n");
+    return -1;
+  }
+  dtls_set_handler(server, &server_cb);
+  if (tickets && dtls_set_ticket_key(server, NULL) < 0) {
+    fprintf(stderr, "E: session tickets are not supported\n");
+    return -1;
   }
+  return 0;
+}
 
-  for (;;) {
-    res = pcap_next_ex(pcap, &pkthdr, &packet);
-    
-    switch(res) {
-    case -2: goto done;
-    case -1: pcap_perror(pcap, "read packet"); break;
-    case  1: handle_packet(packet, pkthdr->caplen); break;
-    default: 
-      ;
-    }      
+static int
+synthesize(void) {
+  size_t i;
+
+  start_time = events.count ? EVENT(0).time : DTLS_TICKS_PER_SECOND;
+  if (new_server(start_time) < 0)
+    return -1;
+  for (i = 0; i < events.count; i++)
+    run_event(&EVENT(i));
+
+  dtls_free_context(server);
+  server = NULL;
+  for (i = 0; i < SUITES; i++) {
+    dtls_free_context(clients[i]);
+    clients[i] = NULL;
   }
- done:
+  return 0;
+}
 
-  pcap_close(pcap);
+/* the measured run */
+
+typedef struct {
+  double seconds[ACTION_TYPES];
+  unsigned long records[ACTION_TYPES];
+  double ecc, prf;
+  unsigned long handshakes, handshakes_failed, decrypt_failures, drops;
+} result_t;
+
+static int
+replay(result_t *r) {
+  static uint8 buf[DTLS_MAX_BUF];
+  const uint8 *data = datagrams.data;
+  action_t *a;
+  double t;
+  size_t i;
+#if DTLS_STATS
+  dtls_stats_t stats;
+#endif /* DTLS_STATS */
+
+  memset(r, 0, sizeof(*r));
+  memset(&heap, 0, sizeof(heap));
+  memset(&trace, 0, sizeof(trace));
+  output.datagrams = 0;
+  output.hash = 0;
+  replaying = 1;
+
+  dtls_set_allocator(&counting_allocator);
+  connected = 0;
+  if (new_server(start_time) < 0) {
+    dtls_set_allocator(NULL);
+    return -1;
+  }
 
+  for (i = 0; i < actions.count; i++) {
+    a = &ACTION(i);
+    dtls_ticks_set(a->time);
+    reseed(i + 1);
+    /* records are decrypted in place */
+    if (a->type != ACT_SEND)
+      memcpy(buf, data + a->offset, a->length);
+    t = now();
+    if (a->type == ACT_SEND)
+      dtls_write(server, &DEVICE(a->device).session, payload, a->length);
+    else
+      dtls_handle_message(server, &DEVICE(a->device).session,
+			  buf, a->length);
+    r->seconds[a->type] += now() - t;
+    r->records[a->type] += a->records;
+  }
+  r->ecc = trace.ecc;
+  r->prf = trace.prf;
+  r->handshakes = connected;
+
+#if DTLS_STATS
+  dtls_get_stats(server, &stats);
+  /* the event is also raised when a connected peer starts a new
+   * handshake, the statistics are more precise */
+  r->handshakes = 0;
+  for (i = 0; i < DTLS_STATS_SUITES; i++) {
+    r->handshakes += stats.handshakes_completed[i];
+    r->handshakes_failed += stats.handshakes_failed[i];
+  }
+  r->decrypt_failures = stats.decrypt_failures;
+  for (i = 0; i < DTLS_DROP_REASONS; i++)
+    r->drops += stats.drops[i];
+#endif /* DTLS_STATS */
+
+  dtls_free_context(server);
+  server = NULL;
+  dtls_set_allocator(NULL);
+  replaying = 0;
   return 0;
 }
+
+static void
+metric(const char *name, double value) {
+  printf("%s,%s,%.*f\n", dtls_package_version(), name,
+	 value == (unsigned long)value ? 0 : 3, value);
+}
+
+static double
+per(double value, double count) {
+  return count > 0 ? value / count : 0;
+}
+
+static void
+usage(const char *program) {
+  fprintf(stderr, "usage: %s [-s port] [-c cid_length] [-n runs] "
+	  "[-S seed] [-t] [-v level] file\n", program);
+  exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char **argv) {
+  unsigned long expected_datagrams;
+  uint64_t expected_hash;
+  result_t r, best;
+  int runs = 1, n, opt, i, failed = 0;
+  log_t log_level = DTLS_LOG_EMERG;
+  char hash[17];
+
+  memset(&best, 0, sizeof(best));
+  while ((opt = getopt(argc, argv, "s:c:n:S:tv:")) != -1) {
+    switch (opt) {
+    case 's':
+      server_port = strtoul(optarg, NULL, 10);
+      break;
+    case 'c':
+      cid_length = strtoul(optarg, NULL, 10);
+      break;
+    case 'n':
+      runs = atoi(optarg);
+      break;
+    case 'S':
+      seed = strtoul(optarg, NULL, 10);
+      break;
+    case 't':
+      tickets = 1;
+      break;
+    case 'v':
+      log_level = strtol(optarg, NULL, 10);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind != argc - 1 || runs < 1 || cid_length > DTLS_CID_MAX_LENGTH
+      || !server_port || server_port > 0xffff)
+    usage(argv[0]);
+
+  dtls_init();
+  dtls_set_log_level(log_level);
+
+  if (read_capture(argv[optind]) < 0)
+    return EXIT_FAILURE;
+  for (n = 0; (size_t)n < events.count; n++)
+    if (EVENT(n).type == EV_HANDSHAKE) {
+      if (EVENT(n).full)
+	capture.full++;
+      else
+	capture.resumed++;
+    }
+
+  if (synthesize() < 0)
+    return EXIT_FAILURE;
+  expected_datagrams = output.datagrams;
+  expected_hash = output.hash;
+
+  for (n = 0; n < runs; n++) {
+    if (replay(&r) < 0)
+      return EXIT_FAILURE;
+    if (output.datagrams != expected_datagrams || output.hash != expected_hash) {
+      fprintf(stderr, "E: run %d differs from the recorded run, it has "
+	      "sent %lu instead of %lu datagrams\n", n + 1,
+	      output.datagrams, expected_datagrams);
+      failed = 1;
+    }
+    if (n == 0) {
+      best = r;
+      continue;
+    }
+    for (i = 0; i < ACTION_TYPES; i++)
+      if (r.seconds[i] < best.seconds[i])
+	best.seconds[i] = r.seconds[i];
+    if (r.ecc < best.ecc)
+      best.ecc = r.ecc;
+    if (r.prf < best.prf)
+      best.prf = r.prf;
+  }
+  dtls_ticks_release();
+  dtls_prng_init(0);
+
+  printf("version,metric,value\n");
+  metric("capture-datagrams", capture.datagrams);
+  metric("capture-skipped", capture.skipped);
+  metric("capture-devices", devices.count);
+  metric("capture-handshakes-full", capture.full);
+  metric("capture-handshakes-resumed", capture.resumed);
+  metric("capture-records-in", capture.records_up);
+  metric("capture-records-out", capture.records_down);
+  metric("capture-closes", capture.closes);
+  metric("capture-records-clamped", capture.clamped);
+  metric("synthesis-implicit-handshakes", synthesis.implicit);
+  metric("synthesis-substituted-suites", synthesis.substituted);
+  metric("synthesis-failed-handshakes", synthesis.failed);
+  metric("synthesis-dropped-records", synthesis.records_dropped);
+  metric("replay-runs", runs);
+  metric("replay-server-calls", actions.count);
+  metric("handshakes", best.handshakes);
+  metric("handshakes-full", synthesis.full);
+  metric("handshakes-failed", best.handshakes_failed);
+  metric("handshake-us", per(best.seconds[ACT_HANDSHAKE] * 1e6,
+			     best.handshakes));
+  metric("handshake-ecc-us", per(best.ecc * 1e6, best.handshakes));
+  metric("handshake-prf-us", per(best.prf * 1e6, best.handshakes));
+  metric("records-in", best.records[ACT_RECORDS]);
+  metric("records-in-per-s", per(best.records[ACT_RECORDS],
+				 best.seconds[ACT_RECORDS]));
+  metric("records-out", best.records[ACT_SEND]);
+  metric("records-out-per-s", per(best.records[ACT_SEND],
+				  best.seconds[ACT_SEND]));
+  metric("other-us", best.seconds[ACT_OTHER] * 1e6);
+  metric("decrypt-failures", best.decrypt_failures);
+  metric("drops", best.drops);
+  metric("allocs", heap.allocs);
+  metric("frees", heap.frees);
+  metric("alloc-bytes", heap.bytes);
+  metric("alloc-peak-bytes", heap.peak);
+  metric("allocs-per-handshake", per(heap.allocs, best.handshakes));
+  metric("output-datagrams", output.datagrams);
+  snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)output.hash);
+  printf("%s,output-hash,%s\n", dtls_package_version(), hash);
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,1581 @@
+/* Checks the memory that a connected peer keeps.
+ *
+ * A client and a server context perform a PSK handshake through an
+ * in-memory link. The handshake parameters must be gone once both
+ * sides are connected. After each side has received a record of the
+ * new epoch, which ends the retransmission of the last flight, a peer
+ * must only hold its security parameters for the current epoch, i.e.
+ * DTLS_PEER_CONNECTED_SIZE bytes. The byte count is printed, and
+ * compared against the value documented in peer.h for the default
+ * configuration on 64-bit hosts. A record that the server receives
+ * twice must be dropped before decryption, and the counters of
+ * dtls_get_stats() and the calls of the trace handler must reflect
+ * the handshake and the exchanged records. Finally, the server is limited to two
+ * peers: a pending handshake must be evicted before a connected peer,
+ * data that the server broadcasts must reach the selected peers, and
+ * idle peers must be removed after the idle timeout. Peers whose
+ * hash values collide must only be added to the peer table up to
+ * DTLS_PEER_PROBE_MAX slots from their preferred slot. A batch of
+ * datagrams must be handled correctly when its first datagram frees
+ * the peer of the sender. With ECC support, ECDHE-ECDSA handshakes
+ * must use the keys and nonces of dtls_ecc_precompute(), which a
+ * child process must not inherit, and must complete when their ECC
+ * jobs are deferred by an ecc_job handler. A job whose peer has been
+ * reset or evicted in the meantime must only be released. A client
+ * must accept signatures whose r or s is shorter than 32 bytes in
+ * DER, and reject an r of zero bytes with a decode_error. Records
+ * of each AEAD must be written by dtls_write_inplace() in buffers
+ * without spare room, with and without connection ID, and the crypto
+ * provider must not be replaced while the peers are connected.
+ * dtls_write_messages() must send a batch of messages to connected
+ * peers, and start handshakes with unknown ones. The server must
+ * reassemble a Certificate that a client with a small PMTU sends in
+ * fragments, which the test reorders, duplicates and overlaps. A
+ * peer with connection ID must move to the new port of its client,
+ * but not back when an older record arrives from the old port. A
+ * client must resume its session in a second handshake, unless it
+ * no longer offers its cipher suite or the session has expired, and
+ * a fatal alert must remove the session at both sides. Session
+ * tickets must let the client resume without a session at the
+ * server, and be rejected when their key has been dropped, when they
+ * have been changed or when they have expired.
+ *
+ * usage: peer-test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "tinydtls.h"
+#include "dtls.h"
+#include "dtls_debug.h"
+
+#ifdef DTLS_PSK
+
+#define MAX_DATAGRAMS 16
+
+/* the value that is documented for DTLS_PEER_CONNECTED_SIZE */
+#if defined(__LP64__) && !defined(WITH_AES_DECRYPT) \
+  && !defined(DTLS_PEERS_NOHASH) && DTLS_CID_LENGTH == 6 \
+  && DTLS_CID_MAX_LENGTH == 16
+#if DTLS_CHACHA20
+#if defined(WITH_AES_HW) && DTLS_GCM
+#define PEER_CONNECTED_SIZE (112 + 688)
+#elif defined(WITH_AES_HW)
+#define PEER_CONNECTED_SIZE (112 + 616)
+#else
+#define PEER_CONNECTED_SIZE (112 + 608)
+#endif
+#else /* DTLS_CHACHA20 */
+#if defined(WITH_AES_HW) && DTLS_GCM
+#define PEER_CONNECTED_SIZE (112 + 640)
+#elif DTLS_GCM
+#define PEER_CONNECTED_SIZE (112 + 528)
+#elif defined(WITH_AES_HW)
+#define PEER_CONNECTED_SIZE (112 + 504)
+#else
+#define PEER_CONNECTED_SIZE (112 + 496)
+#endif
+#endif /* DTLS_CHACHA20 */
+#endif
+
+#define CLIENTS 3
+
+struct link {
+  int count;
+  int from[MAX_DATAGRAMS];	/* the client that has sent a datagram */
+  size_t length[MAX_DATAGRAMS];
+  uint8 data[MAX_DATAGRAMS][DTLS_MAX_BUF];
+};
+
+static dtls_context_t *server, *clients[CLIENTS];
+static struct link to_server, to_client[CLIENTS];
+static session_t server_addr, client_addr[CLIENTS];
+static size_t received[CLIENTS];	/* application data of each client */
+static uint8 server_read[DTLS_MAX_BUF];	/* the last data the server has read */
+static size_t server_read_length;
+static int traced[3][2];		/* trace handler calls by point */
+
+static void
+set_address(session_t *session, unsigned short port) {
+  dtls_session_init(session);
+  session->size = sizeof(session->addr.sin);
+  session->addr.sin.sin_family = AF_INET;
+  session->addr.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  session->addr.sin.sin_port = htons(port);
+}
+
+static int
+send_to_peer(struct dtls_context_t *ctx, session_t *session,
+	     uint8 *data, size_t len) {
+  struct link *link = &to_server;
+  int i, from = 0;
+
+  for (i = 0; i < CLIENTS; i++) {
+    if (ctx == server && dtls_session_equals(session, &client_addr[i]))
+      link = &to_client[i];
+    if (ctx == clients[i])
+      from = i;
+  }
+
+  if (link->count == MAX_DATAGRAMS || len > DTLS_MAX_BUF)
+    return -1;
+  memcpy(link->data[link->count], data, len);
+  link->from[link->count] = from;
+  link->length[link->count++] = len;
+  return len;
+}
+
+static int
+read_from_peer(struct dtls_context_t *ctx, session_t *session,
+	       uint8 *data, size_t len) {
+  int i;
+  (void)session;
+
+  for (i = 0; i < CLIENTS; i++)
+    if (ctx == clients[i])
+      received[i] += len;
+  if (ctx == server && len <= sizeof(server_read)) {
+    memcpy(server_read, data, len);
+    server_read_length = len;
+  }
+  return 0;
+}
+
+static int
+get_psk_info(struct dtls_context_t *ctx, const session_t *session,
+	     dtls_credentials_type_t type,
+	     const unsigned char *id, size_t id_len,
+	     unsigned char *result, size_t result_length) {
+  (void)ctx; (void)session; (void)id; (void)id_len;
+
+  switch (type) {
+  case DTLS_PSK_IDENTITY:
+    if (result_length < 15)
+      return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+    memcpy(result, "Client_identity", 15);
+    return 15;
+  case DTLS_PSK_KEY:
+    if (result_length < 9)
+      return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+    memcpy(result, "secretPSK", 9);
+    return 9;
+  default:
+    return 0;
+  }
+}
+
+static void
+trace(struct dtls_context_t *ctx, dtls_trace_point_t point, int end) {
+  if (ctx == server)
+    traced[point][end]++;
+}
+
+static dtls_handler_t cb = {
+  .write = send_to_peer,
+  .read  = read_from_peer,
+  .event = NULL,
+  .get_psk_info = get_psk_info,
+  .trace = trace,
+};
+
+#ifdef DTLS_ECC
+static const unsigned char ecdsa_priv_key[] = {
+			0xD9, 0xE2, 0x70, 0x7A, 0x72, 0xDA, 0x6A, 0x05,
+			0x04, 0x99, 0x5C, 0x86, 0xED, 0xDB, 0xE3, 0xEF,
+			0xC7, 0xF1, 0xCD, 0x74, 0x83, 0x8F, 0x75, 0x70,
+			0xC8, 0x07, 0x2D, 0x0A, 0x76, 0x26, 0x1B, 0xD4};
+
+static const unsigned char ecdsa_pub_key_x[] = {
+			0xD0, 0x55, 0xEE, 0x14, 0x08, 0x4D, 0x6E, 0x06,
+			0x15, 0x59, 0x9D, 0xB5, 0x83, 0x91, 0x3E, 0x4A,
+			0x3E, 0x45, 0x26, 0xA2, 0x70, 0x4D, 0x61, 0xF2,
+			0x7A, 0x4C, 0xCF, 0xBA, 0x97, 0x58, 0xEF, 0x9A};
+
+static const unsigned char ecdsa_pub_key_y[] = {
+			0xB4, 0x18, 0xB6, 0x4A, 0xFE, 0x80, 0x30, 0xDA,
+			0x1D, 0xDC, 0xF4, 0xF4, 0x2E, 0x2F, 0x26, 0x31,
+			0xD0, 0x43, 0xB1, 0xFB, 0x03, 0xE2, 0x2F, 0x4D,
+			0x17, 0xDE, 0x43, 0xF9, 0xF9, 0xAD, 0xEE, 0x70};
+
+static int
+get_ecdsa_key(struct dtls_context_t *ctx, const session_t *session,
+	      const dtls_ecdsa_key_t **result) {
+  static const dtls_ecdsa_key_t ecdsa_key = {
+    .curve = DTLS_ECDH_CURVE_SECP256R1,
+    .priv_key = ecdsa_priv_key,
+    .pub_key_x = ecdsa_pub_key_x,
+    .pub_key_y = ecdsa_pub_key_y
+  };
+  (void)ctx; (void)session;
+
+  *result = &ecdsa_key;
+  return 0;
+}
+
+static int
+verify_ecdsa_key(struct dtls_context_t *ctx, const session_t *session,
+		 const unsigned char *other_pub_x,
+		 const unsigned char *other_pub_y, size_t key_size) {
+  (void)ctx; (void)session; (void)other_pub_x; (void)other_pub_y;
+  (void)key_size;
+  return 0;
+}
+
+static dtls_handler_t ecc_cb = {
+  .write = send_to_peer,
+  .read  = read_from_peer,
+  .event = NULL,
+  .get_ecdsa_key = get_ecdsa_key,
+  .verify_ecdsa_key = verify_ecdsa_key,
+};
+
+#define MAX_JOBS 8
+
+/* the ECC jobs that wait for run_ecc_jobs() */
+static struct {
+  dtls_context_t *ctx;
+  dtls_ecc_job_t *job;
+} jobs[MAX_JOBS];
+static int jobs_len, jobs_deferred;
+
+static int
+defer_ecc_job(struct dtls_context_t *ctx, dtls_ecc_job_t *job) {
+  if (jobs_len == MAX_JOBS)
+    return -1;
+  jobs[jobs_len].ctx = ctx;
+  jobs[jobs_len++].job = job;
+  jobs_deferred++;
+  return 0;
+}
+
+static dtls_handler_t ecc_job_cb = {
+  .write = send_to_peer,
+  .read  = read_from_peer,
+  .event = NULL,
+  .get_ecdsa_key = get_ecdsa_key,
+  .verify_ecdsa_key = verify_ecdsa_key,
+  .ecc_job = defer_ecc_job,
+};
+
+/* what sign_short() does to the signatures of the server */
+static enum { SIG_SHORT_R, SIG_SHORT_S, SIG_EMPTY_R } sig_kind;
+static int server_alert;	/* the last alert the server has received */
+
+/* Signs until r or s has less than DTLS_EC_KEY_SIZE bytes in DER, i.e.
+ * its most significant word is below 0x00800000, or sends r as an
+ * integer of zero bytes. */
+static int
+sign_short(const unsigned char *priv_key, size_t key_size,
+	   const unsigned char *sign_hash, size_t sign_hash_size,
+	   uint32_t point_r[9], uint32_t point_s[9]) {
+  const uint32_t *point = sig_kind == SIG_SHORT_S ? point_s : point_r;
+
+  do {
+    if (dtls_ecdsa_create_sig_hash(priv_key, key_size, sign_hash,
+				   sign_hash_size, point_r, point_s) < 0)
+      return -1;
+  } while (sig_kind != SIG_EMPTY_R && point[7] >= 0x00800000);
+  if (sig_kind == SIG_EMPTY_R)
+    memset(point_r, 0, 9 * sizeof(uint32_t));
+  return 0;
+}
+
+static int
+record_alert(struct dtls_context_t *ctx, session_t *session,
+	     dtls_alert_level_t level, unsigned short code) {
+  (void)session; (void)level;
+  if (ctx == server && code < DTLS_EVENT_CONNECT)
+    server_alert = code;
+  return 0;
+}
+
+static dtls_handler_t sig_cb = {
+  .write = send_to_peer,
+  .read  = read_from_peer,
+  .event = record_alert,
+  .get_ecdsa_key = get_ecdsa_key,
+  .verify_ecdsa_key = verify_ecdsa_key,
+};
+#endif /* DTLS_ECC */
+
+/* Replaces the server and the clients with new contexts that use
+ * @p handler, the server is limited to two peers. */
+static int
+renew_contexts(dtls_handler_t *handler) {
+  int i;
+
+  dtls_free_context(server);
+  server = dtls_new_context(NULL);
+  if (!server || dtls_set_peer_max(server, 2) < 0) {
+    fprintf(stderr, "E: cannot create server\n");
+    return -1;
+  }
+  dtls_set_handler(server, handler);
+
+  for (i = 0; i < CLIENTS; i++) {
+    dtls_free_context(clients[i]);
+    clients[i] = dtls_new_context(NULL);
+    if (!clients[i]) {
+      fprintf(stderr, "E: cannot create client\n");
+      return -1;
+    }
+    dtls_set_handler(clients[i], handler);
+    to_client[i].count = 0;
+  }
+  to_server.count = 0;
+  memset(received, 0, sizeof(received));
+  return 0;
+}
+
+/* Whether the peers of @p client at both sides are connected. */
+static int
+is_connected(int client) {
+  dtls_peer_t *s = dtls_get_peer(server, &client_addr[client]);
+  dtls_peer_t *c = dtls_get_peer(clients[client], &server_addr);
+
+  return s && dtls_peer_is_connected(s) && c && dtls_peer_is_connected(c);
+}
+
+/* Delivers the queued datagrams once, returns 0 if there were none. */
+static int
+pump_once(void) {
+  int i, j, busy = to_server.count;
+
+  for (i = 0; i < to_server.count; i++)
+    dtls_handle_message(server, &client_addr[to_server.from[i]],
+			to_server.data[i], to_server.length[i]);
+  to_server.count = 0;
+  for (j = 0; j < CLIENTS; j++) {
+    busy |= to_client[j].count;
+    for (i = 0; i < to_client[j].count; i++)
+      dtls_handle_message(clients[j], &server_addr,
+			  to_client[j].data[i], to_client[j].length[i]);
+    to_client[j].count = 0;
+  }
+  return busy;
+}
+
+/* Delivers the queued datagrams until all links are idle. */
+static void
+pump(void) {
+  while (pump_once())
+    ;
+}
+
+/* Checks that the peer for @p session keeps at most @p max bytes. */
+static int
+check_peer(const char *name, dtls_context_t *ctx, session_t *session,
+	   size_t max) {
+  dtls_peer_t *peer = dtls_get_peer(ctx, session);
+
+  if (!peer || !dtls_peer_is_connected(peer)) {
+    fprintf(stderr, "E: %s is not connected\n", name);
+    return 1;
+  }
+
+  printf("%s: %zu bytes per connected peer\n", name,
+	 dtls_peer_footprint(peer));
+  if (dtls_peer_footprint(peer) > max) {
+    fprintf(stderr, "E: %s keeps %zu bytes instead of %zu\n", name,
+	    dtls_peer_footprint(peer), max);
+    return 1;
+  }
+  return 0;
+}
+
+/* Checks the counters of the server after the first handshake and
+ * the exchange of one record in each direction. */
+static int
+check_stats(void) {
+  dtls_stats_t stats;
+  int point, failed = 0;
+
+  dtls_get_stats(server, &stats);
+  if (stats.peers != 1 || stats.handshakes
+      || stats.drops[DTLS_DROP_REPLAY] != 1) {
+    fprintf(stderr, "E: %zu peers, %zu handshakes, %lu replays\n",
+	    stats.peers, stats.handshakes, stats.drops[DTLS_DROP_REPLAY]);
+    failed = 1;
+  }
+#if DTLS_STATS
+  if (stats.handshakes_started != 1
+      || stats.handshakes_completed[DTLS_STATS_SUITE_PSK] != 1
+      || stats.cookies_issued != 1 || stats.cookies_verified != 1) {
+    fprintf(stderr, "E: %lu handshakes started, %lu completed, "
+	    "%lu cookies issued, %lu verified\n", stats.handshakes_started,
+	    stats.handshakes_completed[DTLS_STATS_SUITE_PSK],
+	    stats.cookies_issued, stats.cookies_verified);
+    failed = 1;
+  }
+  /* ClientKeyExchange, ChangeCipherSpec, Finished and "ping", the
+   * Client Hellos arrive before there is a peer */
+  if (stats.records_in != 4 || stats.decrypt_failures
+      || stats.records_out < 6 || !stats.bytes_in || !stats.bytes_out) {
+    fprintf(stderr, "E: %lu records in, %lu out, %lu failed\n",
+	    stats.records_in, stats.records_out, stats.decrypt_failures);
+    failed = 1;
+  }
+#endif /* DTLS_STATS */
+#if DTLS_TRACE
+  for (point = DTLS_TRACE_CCM; point <= DTLS_TRACE_PRF; point++)
+    if (!traced[point][0] || traced[point][0] != traced[point][1]) {
+      fprintf(stderr, "E: trace point %d: %d starts, %d ends\n", point,
+	      traced[point][0], traced[point][1]);
+      failed = 1;
+    }
+#endif /* DTLS_TRACE */
+  (void)point;
+  return failed;
+}
+
+/* Selects the peer of client 2 for dtls_write_broadcast(). */
+static int
+is_client_2(dtls_context_t *ctx, const dtls_peer_t *peer, void *arg) {
+  session_t session;
+  (void)ctx; (void)arg;
+
+  return dtls_session_equals(dtls_peer_session(peer, &session),
+			     &client_addr[2]);
+}
+
+/* Checks that handshakes are evicted before connected peers, and
+ * that idle peers are removed. */
+static int
+check_limits(void) {
+  dtls_peer_t *peer;
+  clock_time_t next;
+  dtls_tick_t now;
+  int failed = 0;
+
+  /* the handshake of client 1 stops when the next flight of the
+   * client is lost */
+  dtls_connect(clients[1], &server_addr);
+  pump_once();
+  pump_once();
+  to_server.count = 0;
+  peer = dtls_get_peer(server, &client_addr[1]);
+  if (!peer || dtls_peer_is_connected(peer)) {
+    fprintf(stderr, "E: no pending handshake for client 1\n");
+    return 1;
+  }
+
+  /* client 2 takes the place of that handshake */
+  dtls_connect(clients[2], &server_addr);
+  pump();
+  if (dtls_get_peer(server, &client_addr[1])) {
+    fprintf(stderr, "E: the handshake of client 1 has not been evicted\n");
+    failed = 1;
+  }
+  failed |= check_peer("client 0 at server", server, &client_addr[0],
+		       DTLS_PEER_CONNECTED_SIZE);
+  failed |= check_peer("client 2 at server", server, &client_addr[2],
+		       DTLS_PEER_CONNECTED_SIZE
+		       + sizeof(dtls_security_parameters_t));
+
+  memset(received, 0, sizeof(received));
+  if (dtls_write_broadcast(server, NULL, NULL, (uint8 *)"news", 4)
+      || dtls_write_broadcast(server, is_client_2, NULL, (uint8 *)"more", 4))
+    failed = 1;
+  pump();
+  if (received[0] != 4 || received[1] || received[2] != 8) {
+    fprintf(stderr, "E: the clients received %zu, %zu and %zu bytes\n",
+	    received[0], received[1], received[2]);
+    failed = 1;
+  }
+
+  dtls_set_idle_timeout(server, 1);
+  dtls_check_retransmit(server, &next);
+  if (!next || !dtls_get_peer(server, &client_addr[0])) {
+    fprintf(stderr, "E: the idle timeout has not been scheduled\n");
+    failed = 1;
+  }
+
+  /* a simulated time lets the timeout expire without waiting */
+  dtls_ticks_refresh(&now);
+  dtls_ticks_set(now + DTLS_TICKS_PER_SECOND + DTLS_TICKS_PER_SECOND / 10);
+  dtls_check_retransmit(server, &next);
+  pump();
+  dtls_ticks_release();
+  if (dtls_get_peer(server, &client_addr[0])
+      || dtls_get_peer(server, &client_addr[2])) {
+    fprintf(stderr, "E: idle peers have not been removed\n");
+    failed = 1;
+  }
+  if (dtls_get_peer(clients[0], &server_addr)
+      && dtls_peer_is_connected(dtls_get_peer(clients[0], &server_addr))) {
+    fprintf(stderr, "E: client 0 has not been closed\n");
+    failed = 1;
+  }
+  return failed;
+}
+
+/* Checks that peers with colliding hash values are only added up to
+ * DTLS_PEER_PROBE_MAX slots away from their preferred slot. */
+static int
+check_table(void) {
+#ifndef DTLS_PEERS_NOHASH
+  dtls_peer_table_t table;
+  dtls_peer_t *peers[DTLS_PEER_PROBE_MAX + 2];
+  dtls_peer_key_t key;
+  int i, failed = 0;
+
+  memset(&table, 0, sizeof(table));
+  if (dtls_peer_table_init(&table, 4 * DTLS_PEER_PROBE_MAX, 0) < 0) {
+    fprintf(stderr, "E: cannot create the peer table\n");
+    return 1;
+  }
+
+  /* peers for the same address collide in every slot */
+  for (i = 0; i < DTLS_PEER_PROBE_MAX + 2; i++) {
+    peers[i] = dtls_new_peer(NULL, &client_addr[0]);
+    if (!peers[i]) {
+      fprintf(stderr, "E: cannot create peer\n");
+      return 1;
+    }
+    if ((dtls_peer_table_add(&table, peers[i]) < 0)
+	!= (i > DTLS_PEER_PROBE_MAX)) {
+      fprintf(stderr, "E: peer %d has %sbeen added to the table\n",
+	      i, i > DTLS_PEER_PROBE_MAX ? "" : "not ");
+      failed = 1;
+    }
+  }
+
+  dtls_session_key(&client_addr[0], &key);
+  if (dtls_peer_table_find(&table, &key,
+			   dtls_peer_key_hash(&key, table.secret)) != peers[0]) {
+    fprintf(stderr, "E: the first peer has not been found\n");
+    failed = 1;
+  }
+
+  for (i = 0; i < DTLS_PEER_PROBE_MAX + 2; i++) {
+    dtls_peer_table_remove(&table, peers[i]);
+    dtls_free_peer(peers[i]);
+  }
+  if (table.count) {
+    fprintf(stderr, "E: %zu peers are left in the table\n", table.count);
+    failed = 1;
+  }
+  dtls_peer_table_free(&table);
+  return failed;
+#else /* DTLS_PEERS_NOHASH */
+  return 0;
+#endif /* DTLS_PEERS_NOHASH */
+}
+
+/* Checks that ECDHE-ECDSA handshakes take their ephemeral key and
+ * nonce from the pool of dtls_ecc_precompute(), and that the pool is
+ * discarded in a child process. */
+static int
+check_ecc_pool(void) {
+#if defined(DTLS_ECC) && DTLS_ECC_POOL_SIZE > 0
+  int status;
+  pid_t pid;
+
+  if (renew_contexts(&ecc_cb) < 0)
+    return 1;
+  if (dtls_ecc_precompute(server, 4 * DTLS_ECC_POOL_SIZE)
+      || server->ecc_keys_len != DTLS_ECC_POOL_SIZE
+      || server->ecc_nonces_len != DTLS_ECC_POOL_SIZE) {
+    fprintf(stderr, "E: the ECC pool has not been filled\n");
+    return 1;
+  }
+
+  dtls_connect(clients[0], &server_addr);
+  pump();
+  if (!is_connected(0)) {
+    fprintf(stderr, "E: no ECDHE-ECDSA handshake with the ECC pool\n");
+    return 1;
+  }
+  if (server->ecc_keys_len != DTLS_ECC_POOL_SIZE - 1
+      || server->ecc_nonces_len != DTLS_ECC_POOL_SIZE - 1) {
+    fprintf(stderr, "E: %zu keys and %zu nonces are left in the pool\n",
+	    server->ecc_keys_len, server->ecc_nonces_len);
+    return 1;
+  }
+
+  /* the child must not sign with the nonces of its parent */
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return 1;
+  }
+  if (pid == 0)
+    _exit(dtls_ecc_precompute(server, 0) == 2 * DTLS_ECC_POOL_SIZE
+	  ? EXIT_SUCCESS : EXIT_FAILURE);
+  if (waitpid(pid, &status, 0) != pid
+      || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+    fprintf(stderr, "E: the child has kept the ECC pool of its parent\n");
+    return 1;
+  }
+  if (dtls_ecc_precompute(server, 0) != 2) {
+    fprintf(stderr, "E: the parent has lost its ECC pool\n");
+    return 1;
+  }
+#endif /* DTLS_ECC && DTLS_ECC_POOL_SIZE > 0 */
+  return 0;
+}
+
+#ifdef DTLS_ECC
+/* Executes and completes the deferred ECC jobs, returns their number. */
+static int
+run_ecc_jobs(void) {
+  int i, n = jobs_len;
+
+  jobs_len = 0;
+  for (i = 0; i < n; i++) {
+    dtls_ecc_job_run(jobs[i].job);
+    dtls_ecc_job_complete(jobs[i].ctx, jobs[i].job);
+  }
+  return n;
+}
+
+/* Delivers datagrams and completes jobs until nothing is left. */
+static void
+pump_jobs(void) {
+  while (pump_once() | run_ecc_jobs())
+    ;
+}
+
+/* Starts the handshake of @p client and delivers its datagrams until
+ * the server has deferred a job, which is returned. */
+static dtls_ecc_job_t *
+wait_for_server_job(int client) {
+  int i, n;
+
+  dtls_connect(clients[client], &server_addr);
+  for (n = 0; n < 8; n++) {
+    for (i = 0; i < jobs_len; i++)
+      if (jobs[i].ctx == server) {
+	dtls_ecc_job_t *job = jobs[i].job;
+
+	jobs[i] = jobs[--jobs_len];
+	return job;
+      }
+    pump_once();
+  }
+  return NULL;
+}
+#endif /* DTLS_ECC */
+
+/* Checks ECDHE-ECDSA handshakes whose ECC jobs are completed later
+ * by dtls_ecc_job_complete(), also after the peer of a pending job
+ * has been reset or evicted. */
+static int
+check_ecc_jobs(void) {
+#ifdef DTLS_ECC
+  dtls_ecc_job_t *job;
+  int failed = 0;
+
+  if (renew_contexts(&ecc_job_cb) < 0)
+    return 1;
+  jobs_len = jobs_deferred = 0;
+  dtls_connect(clients[0], &server_addr);
+  pump_jobs();
+  if (!is_connected(0) || jobs_deferred < 4) {
+    fprintf(stderr, "E: no handshake with %d deferred ECC jobs\n",
+	    jobs_deferred);
+    return 1;
+  }
+
+  /* the peer is reset while the server signs for it */
+  job = wait_for_server_job(1);
+  if (!job || !dtls_get_peer(server, &client_addr[1])) {
+    fprintf(stderr, "E: no pending ECC job for client 1\n");
+    return 1;
+  }
+  dtls_reset_peer(server, dtls_get_peer(server, &client_addr[1]));
+  dtls_ecc_job_run(job);
+  if (dtls_ecc_job_complete(server, job) < 0
+      || dtls_get_peer(server, &client_addr[1])) {
+    fprintf(stderr, "E: the job of a reset peer has been continued\n");
+    failed = 1;
+  }
+
+  /* the handshake of client 2 evicts the one that waits for a job */
+  dtls_reset_peer(clients[1], dtls_get_peer(clients[1], &server_addr));
+  /* the alerts of both resets are lost */
+  to_server.count = to_client[1].count = 0;
+  job = wait_for_server_job(1);
+  if (!job) {
+    fprintf(stderr, "E: no second pending ECC job for client 1\n");
+    return 1;
+  }
+  dtls_connect(clients[2], &server_addr);
+  pump_jobs();
+  if (!is_connected(2) || dtls_get_peer(server, &client_addr[1])) {
+    fprintf(stderr, "E: the pending handshake has not been evicted\n");
+    failed = 1;
+  }
+  dtls_ecc_job_run(job);
+  if (dtls_ecc_job_complete(server, job) < 0
+      || dtls_get_peer(server, &client_addr[1]) || !is_connected(0)) {
+    fprintf(stderr, "E: the job of an evicted peer has been continued\n");
+    failed = 1;
+  }
+  return failed;
+#else /* DTLS_ECC */
+  return 0;
+#endif /* DTLS_ECC */
+}
+
+/* Checks that a client accepts the Server Key Exchange when r or s of
+ * its signature is shorter than DTLS_EC_KEY_SIZE bytes, and rejects
+ * it with a decode_error when r has no bytes at all. */
+static int
+check_ecdsa_signatures(void) {
+#ifdef DTLS_ECC
+  static const dtls_crypto_provider_t short_sigs = {
+    .ecdsa_sign = sign_short,
+  };
+  static const char *names[] = { "short r", "short s", "empty r" };
+  int failed = 0;
+
+  for (sig_kind = SIG_SHORT_R; sig_kind <= SIG_EMPTY_R; sig_kind++) {
+    if (renew_contexts(&sig_cb) < 0)
+      return 1;
+    dtls_set_crypto_provider(server, &short_sigs);
+    server_alert = 0;
+    dtls_connect(clients[0], &server_addr);
+    pump();
+    if (sig_kind != SIG_EMPTY_R && !is_connected(0)) {
+      fprintf(stderr, "E: no handshake with a %s in the signature\n",
+	      names[sig_kind]);
+      failed = 1;
+    } else if (sig_kind == SIG_EMPTY_R
+	       && (is_connected(0) || server_alert != DTLS_ALERT_DECODE_ERROR)) {
+      fprintf(stderr, "E: a signature with an empty r gave alert %d\n",
+	      server_alert);
+      failed = 1;
+    }
+  }
+  return failed;
+#else /* DTLS_ECC */
+  return 0;
+#endif /* DTLS_ECC */
+}
+
+#if DTLS_GCM
+/* A GCM operation that the library does not recognize as the software
+ * one, so that the client offers the GCM suites first. */
+static int
+other_gcm_seal(aes128_ccm_t *ctx, const unsigned char *src, size_t length,
+	       unsigned char *buf, unsigned char *nonce,
+	       const unsigned char *aad, size_t aad_length) {
+  return dtls_encrypt_gcm(ctx, src, length, buf, nonce, aad, aad_length);
+}
+#endif /* DTLS_GCM */
+
+#if DTLS_CHACHA20
+/* The same for the ChaCha20-Poly1305 suites. */
+static int
+other_chacha20_seal(aes128_ccm_t *ctx, const unsigned char *src,
+		    size_t length, unsigned char *buf, unsigned char *nonce,
+		    const unsigned char *aad, size_t aad_length) {
+  return dtls_encrypt_chacha20(ctx, src, length, buf, nonce,
+			       aad, aad_length);
+}
+#endif /* DTLS_CHACHA20 */
+
+/* Fills @p crypto with the software provider changed so that the
+ * PSK suite @p cipher is negotiated. Without gcm_open or
+ * chacha20_open the GCM or ChaCha20-Poly1305 suites are not
+ * offered at all. */
+static void
+suite_provider(dtls_crypto_provider_t *crypto, dtls_cipher_t cipher) {
+  *crypto = dtls_crypto_software;
+#if DTLS_GCM
+  if (cipher == TLS_PSK_WITH_AES_128_GCM_SHA256)
+    crypto->gcm_seal = other_gcm_seal;
+  else
+    crypto->gcm_open = NULL;
+#endif /* DTLS_GCM */
+#if DTLS_CHACHA20
+  if (cipher == TLS_PSK_WITH_CHACHA20_POLY1305_SHA256)
+    crypto->chacha20_seal = other_chacha20_seal;
+  else
+    crypto->chacha20_open = NULL;
+#endif /* DTLS_CHACHA20 */
+  (void)cipher;
+}
+
+/* Writes @p len bytes with dtls_write_inplace() from @p ctx to
+ * @p session in a buffer of @p room bytes besides the data. If
+ * @p exact is set, a buffer that is one byte shorter must be
+ * rejected. */
+static int
+write_inplace(const char *name, dtls_context_t *ctx, session_t *session,
+	      size_t room, size_t len, int exact) {
+  uint8 *buf = malloc(room + len);
+  size_t i;
+  int res, failed = 0;
+
+  if (!buf)
+    return 1;
+  for (i = 0; i < len; i++)
+    buf[DTLS_RECORD_HEADROOM + i] = (uint8)i;
+  if (exact && dtls_write_inplace(ctx, session, buf, room + len - 1, len) >= 0) {
+    fprintf(stderr, "E: %s: a buffer one byte too short is accepted\n", name);
+    failed = 1;
+  }
+  if ((res = dtls_write_inplace(ctx, session, buf, room + len, len))
+      != (int)len) {
+    fprintf(stderr, "E: %s: dtls_write_inplace() returns %d\n", name, res);
+    failed = 1;
+  }
+  free(buf);
+  return failed;
+}
+
+/* Checks dtls_write_inplace() with each AEAD. The buffers have just
+ * DTLS_RECORD_HEADROOM and DTLS_RECORD_TAILROOM bytes around the data,
+ * and DTLS_RECORD_CID_ROOM more for the records of the client, which
+ * carry the connection ID that the server has assigned. */
+static int
+check_write_inplace(void) {
+  static const struct {
+    const char *name;
+    dtls_cipher_t cipher;
+  } suites[] = {
+    { "AES-128-CCM-8", TLS_PSK_WITH_AES_128_CCM_8 },
+#if DTLS_GCM
+    { "AES-128-GCM", TLS_PSK_WITH_AES_128_GCM_SHA256 },
+#endif /* DTLS_GCM */
+#if DTLS_CHACHA20
+    { "ChaCha20-Poly1305", TLS_PSK_WITH_CHACHA20_POLY1305_SHA256 },
+#endif /* DTLS_CHACHA20 */
+  };
+  const size_t len = 100;
+  dtls_crypto_provider_t crypto;
+  dtls_peer_t *peer;
+  size_t i, k;
+  int failed = 0;
+
+  for (i = 0; i < sizeof(suites) / sizeof(suites[0]); i++) {
+    suite_provider(&crypto, suites[i].cipher);
+    if (renew_contexts(&cb) < 0)
+      return 1;
+    dtls_set_crypto_provider(server, &crypto);
+    dtls_set_crypto_provider(clients[0], &crypto);
+    dtls_connect(clients[0], &server_addr);
+    pump();
+    peer = dtls_get_peer(server, &client_addr[0]);
+    if (!is_connected(0)
+	|| dtls_security_params(peer)->cipher != suites[i].cipher) {
+      fprintf(stderr, "E: no %s handshake\n", suites[i].name);
+      failed = 1;
+      continue;
+    }
+    if (dtls_set_crypto_provider(server, NULL) == 0) {
+      fprintf(stderr, "E: %s: provider replaced while connected\n",
+	      suites[i].name);
+      failed = 1;
+    }
+
+    failed |= write_inplace(suites[i].name, server, &client_addr[0],
+			    DTLS_RECORD_HEADROOM + DTLS_RECORD_TAILROOM, len, 1);
+    pump();
+    if (received[0] != len) {
+      fprintf(stderr, "E: %s: the client has read %zu bytes\n",
+	      suites[i].name, received[0]);
+      failed = 1;
+    }
+
+    server_read_length = 0;
+    failed |= write_inplace(suites[i].name, clients[0], &server_addr,
+			    DTLS_RECORD_HEADROOM + DTLS_RECORD_CID_ROOM
+			    + DTLS_RECORD_TAILROOM, len, 0);
+    pump();
+    for (k = 0; k < server_read_length && server_read[k] == (uint8)k; k++)
+      ;
+    if (server_read_length != len || k != len) {
+      fprintf(stderr, "E: %s: the server has read %zu bytes\n",
+	      suites[i].name, server_read_length);
+      failed = 1;
+    }
+  }
+  return failed;
+}
+
+#ifdef DTLS_ECC
+#define RH_LENGTH sizeof(dtls_record_header_t)
+#define HS_LENGTH sizeof(dtls_handshake_header_t)
+
+/* A fragment of the Certificate of client 0 that replace_certificate()
+ * sends instead of the original ones, in eighths of the message. */
+struct fragment {
+  size_t from, to;
+  int bad_length;		/* the message length is off by one */
+};
+
+/* Appends a plaintext record to the link to the server. */
+static void
+put_record(uint8 type, const uint8 *version, uint64_t seq,
+	   const uint8 *data, size_t length) {
+  uint8 *p = to_server.data[to_server.count];
+
+  p += dtls_int_to_uint8(p, type);
+  memcpy(p, version, 2);
+  p += 2;
+  p += dtls_int_to_uint16(p, 0);
+  p += dtls_int_to_uint48(p, seq);
+  p += dtls_int_to_uint16(p, length);
+  memcpy(p, data, length);
+  to_server.from[to_server.count] = 0;
+  to_server.length[to_server.count++] = RH_LENGTH + length;
+}
+
+/* Delivers the handshake of client 0 until its Certificate is on the
+ * way to the server, and replaces the records of that flight by the
+ * @p count fragments in @p frags, followed by the other records. The
+ * records of epoch 0 are numbered again. Returns the message_seq of
+ * the Certificate, or -1 if it has not been sent. */
+static int
+replace_certificate(const struct fragment *frags, size_t count) {
+  static uint8 msg[DTLS_MAX_BUF], rest[MAX_DATAGRAMS][DTLS_MAX_BUF];
+  static size_t rest_length[MAX_DATAGRAMS];
+  uint8 header[HS_LENGTH], version[2], frag[DTLS_MAX_BUF];
+  size_t i, n, pos, rlen, length = 0, rests = 0;
+  uint64_t seq = 0;
+  int k, found = 0;
+
+  for (k = 0; k < 8 && !found; k++) {
+    for (i = 0; i < (size_t)to_server.count; i++) {
+      for (pos = 0; pos + RH_LENGTH <= to_server.length[i]; pos += rlen) {
+	uint8 *r = to_server.data[i] + pos;
+	/* the connection ID precedes the length */
+	size_t cid = r[0] == DTLS_CT_TLS12_CID ? DTLS_CID_LENGTH : 0;
+
+	rlen = RH_LENGTH + cid + dtls_uint16_to_int(r + 11 + cid);
+	if (pos + rlen > to_server.length[i])
+	  break;
+	if (r[0] == DTLS_CT_HANDSHAKE && dtls_uint16_to_int(r + 3) == 0
+	    && r[RH_LENGTH] == DTLS_HT_CERTIFICATE) {
+	  uint8 *h = r + RH_LENGTH;
+
+	  if (!found++) {
+	    memcpy(header, h, sizeof(header));
+	    memcpy(version, r + 1, 2);
+	    seq = dtls_uint48_to_int(r + 5);
+	    length = dtls_uint24_to_int(h + 1);
+	  }
+	  memcpy(msg + dtls_uint24_to_int(h + 6), h + HS_LENGTH,
+		 dtls_uint24_to_int(h + 9));
+	} else if (found && rests < MAX_DATAGRAMS) {
+	  memcpy(rest[rests], r, rlen);
+	  rest_length[rests++] = rlen;
+	}
+      }
+    }
+    if (!found)
+      pump_once();
+  }
+  if (!found)
+    return -1;
+
+  to_server.count = 0;
+  for (i = 0; i < count; i++) {
+    size_t offset = length * frags[i].from / 8;
+    size_t n = length * frags[i].to / 8 - offset;
+
+    memcpy(frag, header, HS_LENGTH);
+    dtls_int_to_uint24(frag + 1, length + frags[i].bad_length);
+    dtls_int_to_uint24(frag + 6, offset);
+    dtls_int_to_uint24(frag + 9, n);
+    if (frags[i].bad_length)
+      memset(frag + HS_LENGTH, 0xff, n);
+    else
+      memcpy(frag + HS_LENGTH, msg + offset, n);
+    put_record(DTLS_CT_HANDSHAKE, version, seq++, frag, HS_LENGTH + n);
+  }
+  for (n = 0; n < rests; n++) {
+    if (dtls_uint16_to_int(rest[n] + 3) == 0)
+      dtls_int_to_uint48(rest[n] + 5, seq++);
+    memcpy(to_server.data[to_server.count], rest[n], rest_length[n]);
+    to_server.from[to_server.count] = 0;
+    to_server.length[to_server.count++] = rest_length[n];
+  }
+  return dtls_uint16_to_int(header + 4);
+}
+
+/* Delivers the first @p n datagrams of client 0 to the server. */
+static void
+deliver_to_server(int n) {
+  int i;
+
+  for (i = 0; i < n; i++)
+    dtls_handle_message(server, &client_addr[0],
+			to_server.data[i], to_server.length[i]);
+  to_server.count -= n;
+  memmove(to_server.from, to_server.from + n,
+	  to_server.count * sizeof(to_server.from[0]));
+  memmove(to_server.length, to_server.length + n,
+	  to_server.count * sizeof(to_server.length[0]));
+  memmove(to_server.data, to_server.data + n,
+	  to_server.count * sizeof(to_server.data[0]));
+}
+
+/* Whether the server has buffered fragments of message @p seq of
+ * client 0. */
+static int
+is_buffered(int seq) {
+  dtls_peer_t *peer = dtls_get_peer(server, &client_addr[0]);
+  netq_t *node;
+
+  if (!peer || !peer->handshake_params)
+    return 0;
+  for (node = netq_head(&peer->handshake_params->reorder_queue);
+       node; node = netq_next(node))
+    if (dtls_uint16_to_int(node->data + 4) == seq)
+      return 1;
+  return 0;
+}
+#endif /* DTLS_ECC */
+
+/* Checks that dtls_set_pmtu() rejects a PMTU without room for a
+ * handshake fragment in a record with connection ID, and that the
+ * server reassembles the fragments of a Certificate that the client
+ * sends with a small PMTU: out of order, overlapping, twice and mixed
+ * with a fragment of a different message length. A message that
+ * arrives whole must replace the fragments of an earlier copy. */
+static int
+check_fragments(void) {
+#ifdef DTLS_ECC
+  const size_t pmtu = DTLS_RECORD_HEADROOM + DTLS_RECORD_CID_ROOM
+    + DTLS_RECORD_TAILROOM + HS_LENGTH;
+  static const struct fragment reordered[] = {
+    { 4, 8, 0 }, { 0, 1, 1 }, { 2, 6, 0 }, { 4, 8, 0 }, { 0, 3, 0 }
+  };
+  static const struct fragment whole[] = {
+    { 0, 1, 0 }, { 0, 8, 0 }
+  };
+  int seq, failed = 0;
+
+  if (renew_contexts(&ecc_cb) < 0)
+    return 1;
+  dtls_connect(clients[0], &server_addr);
+  if (dtls_set_pmtu(clients[0], &server_addr, pmtu) == 0
+      || dtls_set_pmtu(clients[0], &server_addr, pmtu + 1) < 0) {
+    fprintf(stderr, "E: wrong lower bound of the PMTU\n");
+    return 1;
+  }
+  seq = replace_certificate(reordered,
+			    sizeof(reordered) / sizeof(reordered[0]));
+  pump();
+  if (seq < 0 || !is_connected(0)) {
+    fprintf(stderr, "E: no handshake with a reordered Certificate\n");
+    failed = 1;
+  }
+
+  if (renew_contexts(&ecc_cb) < 0)
+    return 1;
+  dtls_connect(clients[0], &server_addr);
+  dtls_set_pmtu(clients[0], &server_addr, pmtu + 1);
+  seq = replace_certificate(whole, sizeof(whole) / sizeof(whole[0]));
+  deliver_to_server(2);
+  if (seq < 0 || is_buffered(seq)) {
+    fprintf(stderr, "E: the fragments of a whole Certificate are kept\n");
+    failed = 1;
+  }
+  pump();
+  if (!is_connected(0)) {
+    fprintf(stderr, "E: no handshake with a whole Certificate\n");
+    failed = 1;
+  }
+  return failed;
+#else /* DTLS_ECC */
+  return 0;
+#endif /* DTLS_ECC */
+}
+
+/* Checks that the server follows client 0 to a new port by the
+ * connection ID of its records, and that neither a replayed nor a
+ * delayed record from the old port moves the peer back. */
+static int
+check_migration(void) {
+#if DTLS_CID_LENGTH > 0
+  uint8 replayed[DTLS_MAX_BUF], delayed[DTLS_MAX_BUF];
+  size_t replayed_length, delayed_length;
+  session_t old_addr;
+  int failed = 0;
+
+  if (renew_contexts(&cb) < 0)
+    return 1;
+  dtls_connect(clients[0], &server_addr);
+  pump();
+  if (!is_connected(0)) {
+    fprintf(stderr, "E: client 0 is not connected\n");
+    return 1;
+  }
+
+  dtls_write(clients[0], &server_addr, (uint8 *)"one", 3);
+  replayed_length = to_server.length[0];
+  memcpy(replayed, to_server.data[0], replayed_length);
+  pump();
+  dtls_write(clients[0], &server_addr, (uint8 *)"two", 3);
+  delayed_length = to_server.length[0];
+  memcpy(delayed, to_server.data[0], delayed_length);
+  to_server.count = 0;
+
+  /* a NAT in front of client 0 assigns a new port */
+  old_addr = client_addr[0];
+  set_address(&client_addr[0], 20231);
+  dtls_write(clients[0], &server_addr, (uint8 *)"three", 5);
+  pump();
+  if (server_read_length != 5 || !dtls_get_peer(server, &client_addr[0])
+      || dtls_get_peer(server, &old_addr)) {
+    fprintf(stderr, "E: the peer has not moved to the new port\n");
+    failed = 1;
+  }
+  received[0] = 0;
+  dtls_write(server, &client_addr[0], (uint8 *)"four", 4);
+  pump();
+  if (received[0] != 4) {
+    fprintf(stderr, "E: client 0 has read %zu bytes at the new port\n",
+	    received[0]);
+    failed = 1;
+  }
+
+  /* only the newest record may move the peer */
+  server_read_length = 0;
+  dtls_handle_message(server, &old_addr, replayed, replayed_length);
+  if (dtls_get_drops(server, DTLS_DROP_REPLAY) != 1 || server_read_length) {
+    fprintf(stderr, "E: the replayed record has not been dropped\n");
+    failed = 1;
+  }
+  dtls_handle_message(server, &old_addr, delayed, delayed_length);
+  if (server_read_length != 3) {
+    fprintf(stderr, "E: the delayed record has not been read\n");
+    failed = 1;
+  }
+  if (!dtls_get_peer(server, &client_addr[0])
+      || dtls_get_peer(server, &old_addr)) {
+    fprintf(stderr, "E: an older record has moved the peer back\n");
+    failed = 1;
+  }
+
+  client_addr[0] = old_addr;
+  return failed;
+#else /* DTLS_CID_LENGTH > 0 */
+  return 0;
+#endif /* DTLS_CID_LENGTH > 0 */
+}
+
+/* more than DTLS_RECORD_BATCH_SIZE, less than MAX_DATAGRAMS */
+#define WRITE_MESSAGES 10
+
+/* Checks dtls_write_messages() with more messages than one batch
+ * holds: the messages for a connected peer must all be sent, except
+ * for one that is too long, and a message for an unknown peer must
+ * start a handshake. */
+static int
+check_write_messages(void) {
+  static uint8 data[WRITE_MESSAGES][DTLS_MAX_BUF];
+  dtls_message_t msgs[WRITE_MESSAGES];
+  const int too_long = 3, unknown = WRITE_MESSAGES - 1;
+  size_t expected = 0;
+  int i, res, failed = 0;
+
+  if (renew_contexts(&cb) < 0)
+    return 1;
+  dtls_connect(clients[0], &server_addr);
+  pump();
+  if (!is_connected(0)) {
+    fprintf(stderr, "E: client 0 is not connected\n");
+    return 1;
+  }
+
+  for (i = 0; i < WRITE_MESSAGES; i++) {
+    memset(data[i], i, sizeof(data[i]));
+    msgs[i].session = client_addr[0];
+    msgs[i].msg = data[i];
+    msgs[i].length = 10 + i;
+  }
+  msgs[too_long].length = DTLS_MAX_BUF;
+  msgs[unknown].session = client_addr[1];
+
+  res = dtls_write_messages(server, msgs, WRITE_MESSAGES);
+  if (res != 1 || msgs[too_long].result >= 0 || msgs[unknown].result != 0) {
+    fprintf(stderr, "E: dtls_write_messages() returns %d\n", res);
+    failed = 1;
+  }
+  for (i = 0; i < WRITE_MESSAGES; i++) {
+    if (i == too_long || i == unknown)
+      continue;
+    expected += msgs[i].length;
+    if (msgs[i].result != msgs[i].length) {
+      fprintf(stderr, "E: message %d: %d bytes of %d written\n",
+	      i, msgs[i].result, msgs[i].length);
+      failed = 1;
+    }
+  }
+  if (to_client[0].count != WRITE_MESSAGES - 2) {
+    fprintf(stderr, "E: %d records for %d messages\n",
+	    to_client[0].count, WRITE_MESSAGES - 2);
+    failed = 1;
+  }
+
+  pump();
+  if (received[0] != expected) {
+    fprintf(stderr, "E: client 0 has read %zu of %zu bytes\n",
+	    received[0], expected);
+    failed = 1;
+  }
+  if (!is_connected(1)) {
+    fprintf(stderr, "E: no handshake with the unknown peer\n");
+    failed = 1;
+  }
+  return failed;
+}
+
+#if DTLS_SESSION_CACHE_SIZE > 0 && DTLS_STATS
+/* Closes the connection of client 0 and connects it again, returns
+ * whether the client is connected afterwards. */
+static int
+reconnect(void) {
+  dtls_close(clients[0], &server_addr);
+  pump();
+  dtls_connect(clients[0], &server_addr);
+  pump();
+  return is_connected(0);
+}
+
+/* The number of handshakes of @p ctx that have resumed a session. */
+static unsigned long
+resumed(dtls_context_t *ctx) {
+  dtls_stats_t stats;
+
+  dtls_get_stats(ctx, &stats);
+  return stats.handshakes_resumed;
+}
+
+/* The first session in the cache of @p ctx, or NULL if it is empty. */
+static dtls_session_cache_entry_t *
+cached_session(dtls_context_t *ctx) {
+  size_t i;
+
+  for (i = 0; i < DTLS_SESSION_CACHE_SIZE; i++)
+    if (ctx->sessions[i].cipher != TLS_NULL_WITH_NULL_NULL)
+      return &ctx->sessions[i];
+  return NULL;
+}
+#endif /* DTLS_SESSION_CACHE_SIZE > 0 && DTLS_STATS */
+
+/* Checks that client 0 resumes its session with the server after a
+ * full handshake, but not when the client no longer offers the
+ * cipher suite of the session, when the session has expired or when
+ * a fatal alert has ended the connection. */
+static int
+check_resumption(void) {
+#if DTLS_SESSION_CACHE_SIZE > 0 && DTLS_STATS
+  dtls_session_cache_entry_t *entry;
+  dtls_tick_t now;
+  int connected, failed = 0;
+#if DTLS_GCM || DTLS_CHACHA20
+  dtls_crypto_provider_t crypto;
+  dtls_peer_t *peer;
+#if DTLS_GCM
+  const dtls_cipher_t cipher = TLS_PSK_WITH_AES_128_GCM_SHA256;
+#else /* DTLS_GCM */
+  const dtls_cipher_t cipher = TLS_PSK_WITH_CHACHA20_POLY1305_SHA256;
+#endif /* DTLS_GCM */
+#endif /* DTLS_GCM || DTLS_CHACHA20 */
+
+  if (renew_contexts(&cb) < 0)
+    return 1;
+  dtls_connect(clients[0], &server_addr);
+  pump();
+  if (!is_connected(0) || resumed(server)) {
+    fprintf(stderr, "E: no full handshake before the resumption\n");
+    return 1;
+  }
+  if (!reconnect() || resumed(server) != 1 || resumed(clients[0]) != 1) {
+    fprintf(stderr, "E: %lu handshakes resumed at the server, %lu at "
+	    "the client\n", resumed(server), resumed(clients[0]));
+    failed = 1;
+  }
+
+  /* the client rejects the Server Hello with an illegal_parameter
+   * alert if its session has another cipher suite than the one the
+   * server resumes */
+  if ((entry = cached_session(clients[0])))
+    entry->cipher = TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8;
+  if (!entry || reconnect()) {
+    fprintf(stderr, "E: a session with another cipher suite is resumed\n");
+    failed = 1;
+  }
+  if (cached_session(clients[0]) || cached_session(server)) {
+    fprintf(stderr, "E: a session is kept after a fatal alert\n");
+    failed = 1;
+  }
+
+  if (renew_contexts(&cb) < 0)
+    return 1;
+  dtls_connect(clients[0], &server_addr);
+  pump();
+  dtls_ticks_refresh(&now);
+  dtls_ticks_set(now + DTLS_SESSION_LIFETIME * DTLS_TICKS_PER_SECOND
+		 + DTLS_TICKS_PER_SECOND);
+  connected = reconnect();
+  dtls_ticks_release();
+  if (!connected || resumed(server)) {
+    fprintf(stderr, "E: an expired session is resumed\n");
+    failed = 1;
+  }
+
+#if DTLS_GCM || DTLS_CHACHA20
+  /* a session of the preferred AEAD, then the client drops it */
+  if (renew_contexts(&cb) < 0)
+    return 1;
+  suite_provider(&crypto, cipher);
+  dtls_set_crypto_provider(server, &crypto);
+  dtls_set_crypto_provider(clients[0], &crypto);
+  dtls_connect(clients[0], &server_addr);
+  pump();
+  dtls_close(clients[0], &server_addr);
+  pump();
+  suite_provider(&crypto, TLS_PSK_WITH_AES_128_CCM_8);
+  if (dtls_set_crypto_provider(clients[0], &crypto) < 0) {
+    fprintf(stderr, "E: the client keeps its peer after dtls_close()\n");
+    return 1;
+  }
+  dtls_connect(clients[0], &server_addr);
+  pump();
+  peer = dtls_get_peer(server, &client_addr[0]);
+  if (!is_connected(0) || resumed(server)
+      || dtls_security_params(peer)->cipher != TLS_PSK_WITH_AES_128_CCM_8) {
+    fprintf(stderr, "E: a session is resumed with a cipher suite that "
+	    "the client does not offer\n");
+    failed = 1;
+  }
+#endif /* DTLS_GCM || DTLS_CHACHA20 */
+  return failed;
+#else /* DTLS_SESSION_CACHE_SIZE > 0 && DTLS_STATS */
+  return 0;
+#endif /* DTLS_SESSION_CACHE_SIZE > 0 && DTLS_STATS */
+}
+
+/* Checks that client 0 resumes its session with the session ticket
+ * that the server has issued, while the server caches no session.
+ * The ticket must still be accepted after the server has installed
+ * one new ticket key, and be rejected when its key has been dropped,
+ * when it has been changed or when it has expired. */
+static int
+check_tickets(void) {
+#if DTLS_SESSION_CACHE_SIZE > 0 && DTLS_STATS \
+  && DTLS_SESSION_TICKET_KEYS == 2 && DTLS_SESSION_TICKET_MAX_LENGTH > 0
+  unsigned char key[DTLS_TICKET_KEY_LENGTH];
+  dtls_session_cache_entry_t *entry;
+  dtls_tick_t now;
+  int failed = 0;
+
+  if (renew_contexts(&cb) < 0)
+    return 1;
+  /* tickets take their time from the simulated clock */
+  dtls_ticks_refresh(&now);
+  dtls_ticks_set(now);
+  memset(key, 1, sizeof(key));
+  dtls_set_ticket_key(server, key);
+  dtls_connect(clients[0], &server_addr);
+  pump();
+  entry = cached_session(clients[0]);
+  if (!is_connected(0) || !entry || !entry->ticket_length
+      || cached_session(server)) {
+    fprintf(stderr, "E: no session ticket has been issued\n");
+    dtls_ticks_release();
+    return 1;
+  }
+  if (!reconnect() || resumed(server) != 1) {
+    fprintf(stderr, "E: the session ticket has not been accepted\n");
+    failed = 1;
+  }
+
+  /* the previous key is kept */
+  memset(key, 2, sizeof(key));
+  dtls_set_ticket_key(server, key);
+  if (!reconnect() || resumed(server) != 2) {
+    fprintf(stderr, "E: a ticket of the previous key is rejected\n");
+    failed = 1;
+  }
+
+  /* the key of the ticket is dropped, the server issues a new one */
+  memset(key, 3, sizeof(key));
+  dtls_set_ticket_key(server, key);
+  if (!reconnect() || resumed(server) != 2) {
+    fprintf(stderr, "E: a ticket of a dropped key is accepted\n");
+    failed = 1;
+  }
+  if (!reconnect() || resumed(server) != 3) {
+    fprintf(stderr, "E: the ticket of the new key is rejected\n");
+    failed = 1;
+  }
+
+  if ((entry = cached_session(clients[0])))
+    entry->ticket[entry->ticket_length - 1] ^= 1;
+  if (!entry || !reconnect() || resumed(server) != 3) {
+    fprintf(stderr, "E: a changed ticket is accepted\n");
+    failed = 1;
+  }
+
+  /* the client's session is kept alive to offer the expired ticket */
+  now += DTLS_SESSION_LIFETIME * DTLS_TICKS_PER_SECOND + DTLS_TICKS_PER_SECOND;
+  dtls_ticks_set(now);
+  if ((entry = cached_session(clients[0])))
+    entry->created = now;
+  if (!entry || !entry->ticket_length || !reconnect()
+      || resumed(server) != 3) {
+    fprintf(stderr, "E: an expired ticket is accepted\n");
+    failed = 1;
+  }
+  dtls_ticks_release();
+  return failed;
+#else /* DTLS_SESSION_CACHE_SIZE > 0 && DTLS_STATS && ... */
+  return 0;
+#endif /* DTLS_SESSION_CACHE_SIZE > 0 && DTLS_STATS && ... */
+}
+
+/* Checks a batch of two datagrams of client 0 of which the first
+ * one replaces the peer of the client at the server. */
+static int
+check_batch(void) {
+  uint8 hello[2][DTLS_MAX_BUF];
+  dtls_message_t msgs[2];
+  dtls_peer_t *peer;
+  int i;
+
+  dtls_set_idle_timeout(server, 0);
+  for (i = 0; i < 2; i++) {
+    /* the client starts over without sending a close_notify */
+    if ((peer = dtls_get_peer(clients[0], &server_addr)))
+      dtls_reset_peer(clients[0], peer);
+    to_server.count = 0;
+    dtls_connect(clients[0], &server_addr);
+    if (i == 0)
+      pump();
+  }
+  /* the Hello Verify Request lets the client repeat its Client Hello */
+  pump_once();
+
+  /* the Client Hello with the cookie arrives twice, the first copy
+   * frees the connected peer and creates a new one */
+  if (to_server.count != 1 || !dtls_get_peer(server, &client_addr[0])) {
+    fprintf(stderr, "E: no second Client Hello of client 0\n");
+    return 1;
+  }
+  for (i = 0; i < 2; i++) {
+    memcpy(hello[i], to_server.data[0], to_server.length[0]);
+    msgs[i].session = client_addr[0];
+    msgs[i].msg = hello[i];
+    msgs[i].length = to_server.length[0];
+  }
+  to_server.count = 0;
+  if (dtls_handle_messages(server, msgs, 2)) {
+    fprintf(stderr, "E: the batch has failed with %d and %d\n",
+	    msgs[0].result, msgs[1].result);
+    return 1;
+  }
+  pump();
+
+  return check_peer("client 0 after the batch", server, &client_addr[0],
+		    DTLS_PEER_CONNECTED_SIZE
+		    + sizeof(dtls_security_parameters_t));
+}
+
+int
+main(int argc, char **argv) {
+  uint8 replay[DTLS_MAX_BUF];
+  size_t replay_length;
+  int i, failed = 0;
+  (void)argc; (void)argv;
+
+  dtls_init();
+  dtls_set_log_level(DTLS_LOG_EMERG);
+
+  set_address(&server_addr, 20220);
+  server = dtls_new_context(NULL);
+  if (!server || dtls_set_peer_max(server, 2) < 0) {
+    fprintf(stderr, "E: cannot create server\n");
+    return EXIT_FAILURE;
+  }
+  dtls_set_handler(server, &cb);
+
+  for (i = 0; i < CLIENTS; i++) {
+    set_address(&client_addr[i], 20221 + i);
+    clients[i] = dtls_new_context(NULL);
+    if (!clients[i]) {
+      fprintf(stderr, "E: cannot create client\n");
+      return EXIT_FAILURE;
+    }
+    dtls_set_handler(clients[i], &cb);
+  }
+
+  dtls_connect(clients[0], &server_addr);
+  pump();
+
+  /* the server may still have to retransmit its Finished */
+  failed |= check_peer("client", clients[0], &server_addr,
+		       DTLS_PEER_CONNECTED_SIZE
+		       + sizeof(dtls_security_parameters_t));
+  failed |= check_peer("server", server, &client_addr[0],
+		       DTLS_PEER_CONNECTED_SIZE
+		       + sizeof(dtls_security_parameters_t));
+
+  dtls_write(clients[0], &server_addr, (uint8 *)"ping", 4);
+  dtls_write(server, &client_addr[0], (uint8 *)"pong", 4);
+  replay_length = to_server.length[to_server.count - 1];
+  memcpy(replay, to_server.data[to_server.count - 1], replay_length);
+  pump();
+
+  /* a record that arrives again is dropped before decryption */
+  dtls_handle_message(server, &client_addr[0], replay, replay_length);
+  if (dtls_get_drops(server, DTLS_DROP_REPLAY) != 1) {
+    fprintf(stderr, "E: the replayed record has not been dropped\n");
+    failed = 1;
+  }
+  failed |= check_stats();
+
+  failed |= check_peer("client", clients[0], &server_addr,
+		       DTLS_PEER_CONNECTED_SIZE);
+  failed |= check_peer("server", server, &client_addr[0],
+		       DTLS_PEER_CONNECTED_SIZE);
+
+#ifdef PEER_CONNECTED_SIZE
+  if (DTLS_PEER_CONNECTED_SIZE != PEER_CONNECTED_SIZE) {
+    fprintf(stderr, "E: a connected peer takes %zu bytes, update peer.h\n",
+	    (size_t)DTLS_PEER_CONNECTED_SIZE);
+    failed = 1;
+  }
+#endif /* PEER_CONNECTED_SIZE */
+
+  failed |= check_limits();
+  failed |= check_table();
+  failed |= check_batch();
+  failed |= check_ecc_pool();
+  failed |= check_ecc_jobs();
+  failed |= check_ecdsa_signatures();
+  failed |= check_write_inplace();
+  failed |= check_write_messages();
+  failed |= check_fragments();
+  failed |= check_migration();
+  failed |= check_resumption();
+  failed |= check_tickets();
+
+  for (i = 0; i < CLIENTS; i++)
+    dtls_free_context(clients[i]);
+  dtls_free_context(server);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#else /* DTLS_PSK */
+
+int
+main(int argc, char **argv) {
+  (void)argc; (void)argv;
+  printf("peer-test needs PSK support, skipped\n");
+  return 0;
+}
+
+#endif /* DTLS_PSK */
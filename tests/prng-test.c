@@ -0,0 +1,146 @@
+/* Checks how dtls_prng() of prng.h behaves when no seed can be read.
+ *
+ * The entropy source is replaced with dtls_prng_set_entropy(). A
+ * generator that has never been seeded must fail. A generator whose
+ * periodic reseed fails must go on with its current state, and try
+ * again on each call. In the child after fork(), the state of the
+ * parent must not be used without a new seed.
+ *
+ * usage: prng-test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "tinydtls.h"
+#include "prng.h"
+
+/* the output after which a failed reseed must have been noticed */
+#define MAX_OUTPUT (64UL << 20)
+
+static unsigned int calls;		/* calls of the entropy source */
+
+static int
+entropy_ok(unsigned char *buf, size_t len) {
+  calls++;
+  memset(buf, 0x5a, len);
+  buf[0] = (unsigned char)calls;
+  return 1;
+}
+
+static int
+entropy_failed(unsigned char *buf, size_t len) {
+  (void)buf; (void)len;
+  calls++;
+  return 0;
+}
+
+static int
+is_zero(const unsigned char *buf, size_t len) {
+  while (len--)
+    if (*buf++)
+      return 0;
+  return 1;
+}
+
+static int
+test_unseeded(void) {
+  unsigned char buf[32];
+
+  dtls_prng_set_entropy(entropy_failed);
+  dtls_prng_init(0);
+  if (dtls_prng(buf, sizeof(buf))) {
+    fprintf(stderr, "E: the generator works without a seed\n");
+    return 1;
+  }
+  return 0;
+}
+
+static int
+test_reseed(void) {
+  unsigned char buf[4096];
+  unsigned long output;
+
+  dtls_prng_set_entropy(entropy_ok);
+  dtls_prng_init(0);
+  calls = 0;
+  if (!dtls_prng(buf, sizeof(buf)) || calls != 1) {
+    fprintf(stderr, "E: the generator has not been seeded\n");
+    return 1;
+  }
+
+  /* the reseed fails, the output must go on */
+  dtls_prng_set_entropy(entropy_failed);
+  calls = 0;
+  for (output = 0; !calls && output < MAX_OUTPUT; output += sizeof(buf)) {
+    memset(buf, 0, sizeof(buf));
+    if (!dtls_prng(buf, sizeof(buf)) || is_zero(buf, sizeof(buf))) {
+      fprintf(stderr, "E: no output after %lu bytes\n", output);
+      return 1;
+    }
+  }
+  if (!calls) {
+    fprintf(stderr, "E: no reseed within %lu bytes\n", MAX_OUTPUT);
+    return 1;
+  }
+
+  /* each call tries to reseed, the first success is used */
+  if (!dtls_prng(buf, sizeof(buf)) || calls != 2) {
+    fprintf(stderr, "E: %u seeds have been requested instead of 2\n", calls);
+    return 1;
+  }
+  dtls_prng_set_entropy(entropy_ok);
+  calls = 0;
+  if (!dtls_prng(buf, sizeof(buf)) || calls != 1
+      || !dtls_prng(buf, sizeof(buf)) || calls != 1) {
+    fprintf(stderr, "E: the generator has not been seeded again\n");
+    return 1;
+  }
+  return 0;
+}
+
+static int
+test_fork(void) {
+  unsigned char buf[32];
+  int status;
+  pid_t pid;
+
+  dtls_prng_set_entropy(entropy_ok);
+  dtls_prng_init(0);
+  if (!dtls_prng(buf, sizeof(buf))) {
+    fprintf(stderr, "E: the generator has not been seeded\n");
+    return 1;
+  }
+
+  dtls_prng_set_entropy(entropy_failed);
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return 1;
+  }
+  if (pid == 0)
+    _exit(dtls_prng(buf, sizeof(buf)) ? EXIT_FAILURE : EXIT_SUCCESS);
+
+  if (waitpid(pid, &status, 0) != pid
+      || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+    fprintf(stderr, "E: the child has used the generator of its parent\n");
+    return 1;
+  }
+  return 0;
+}
+
+int
+main(int argc, char **argv) {
+  int failed = 0;
+  (void)argc; (void)argv;
+
+  failed |= test_unseeded();
+  failed |= test_reseed();
+  failed |= test_fork();
+
+  dtls_prng_set_entropy(NULL);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
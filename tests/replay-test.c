@@ -0,0 +1,140 @@
+/* Checks the anti-replay window of replay.h.
+ *
+ * Records are passed to the window in order, reordered within and
+ * beyond DTLS_REPLAY_WINDOW, duplicated and after large gaps. Each
+ * check is compared to a list of all sequence numbers that have been
+ * accepted so far.
+ *
+ * usage: replay-test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "replay.h"
+
+#define RECORDS (8 * DTLS_REPLAY_WINDOW)
+
+static seqnum_t window;
+static unsigned char seen[RECORDS + 1];	/* the accepted records */
+static uint64_t newest;			/* the newest accepted record */
+static int failed;
+
+/* Whether a window of the configured size must accept @p seq. */
+static int
+expected(uint64_t seq) {
+  if (seq > newest)
+    return 1;
+  return newest - seq < DTLS_REPLAY_WINDOW && !seen[seq];
+}
+
+/* Passes the record @p seq to the window, like dtls_handle_message()
+ * does for a record that can be authenticated. */
+static void
+receive(const char *pattern, uint64_t seq) {
+  int accepted = dtls_replay_check(&window, seq);
+
+  if (accepted != expected(seq)) {
+    fprintf(stderr, "E: %s: record %lu has been %s\n", pattern,
+	    (unsigned long)seq, accepted ? "accepted" : "rejected");
+    failed = 1;
+  }
+  if (accepted) {
+    dtls_replay_update(&window, seq);
+    seen[seq] = 1;
+    if (seq > newest)
+      newest = seq;
+  }
+}
+
+static void
+reset(void) {
+  memset(&window, 0, sizeof(window));
+  memset(seen, 0, sizeof(seen));
+  newest = 0;
+}
+
+static void
+test_in_order(void) {
+  uint64_t seq;
+
+  reset();
+  for (seq = 0; seq < RECORDS; seq++)
+    receive("in order", seq);
+  receive("in order", RECORDS - 1);
+}
+
+/* Sends the records in blocks of @p block records in reverse order. */
+static void
+test_reverse(uint64_t block) {
+  uint64_t start, seq;
+
+  reset();
+  for (start = 0; start + block <= RECORDS; start += block)
+    for (seq = start + block; seq-- > start; )
+      receive("reverse", seq);
+}
+
+static void
+test_duplicates(void) {
+  uint64_t seq;
+
+  reset();
+  for (seq = 0; seq < RECORDS / 2; seq++) {
+    receive("duplicates", seq);
+    receive("duplicates", seq);
+    if (seq >= DTLS_REPLAY_WINDOW - 1)
+      receive("duplicates", seq - (DTLS_REPLAY_WINDOW - 1));
+    if (seq >= DTLS_REPLAY_WINDOW)
+      receive("duplicates", seq - DTLS_REPLAY_WINDOW);
+  }
+}
+
+static void
+test_gaps(void) {
+  static const uint64_t seq[] = {
+    0, 1, 63, 64, 65, 2, 127, 200, 130, 199, 72,
+    DTLS_REPLAY_WINDOW + 200, 201, DTLS_REPLAY_WINDOW + 199,
+    RECORDS, RECORDS - DTLS_REPLAY_WINDOW + 1,
+    RECORDS - DTLS_REPLAY_WINDOW, RECORDS - 64, RECORDS - 1
+  };
+  size_t i;
+
+  reset();
+  for (i = 0; i < sizeof(seq) / sizeof(seq[0]); i++)
+    receive("gaps", seq[i]);
+}
+
+/* Delays each record by up to @p spread records at random. */
+static void
+test_random(uint64_t spread) {
+  uint64_t base, seq;
+
+  reset();
+  srand(spread);
+  for (base = 0; base + spread < RECORDS; base++) {
+    seq = base + (uint64_t)rand() % (spread + 1);
+    receive("random", seq);
+    if (rand() % 8 == 0)
+      receive("random", seq);
+  }
+}
+
+int
+main(int argc, char **argv) {
+  (void)argc; (void)argv;
+
+  test_in_order();
+  test_reverse(DTLS_REPLAY_WINDOW / 2);
+  test_reverse(DTLS_REPLAY_WINDOW);
+  test_reverse(DTLS_REPLAY_WINDOW + 1);
+  test_duplicates();
+  test_gaps();
+  test_random(DTLS_REPLAY_WINDOW / 4);
+  test_random(DTLS_REPLAY_WINDOW + 32);
+
+  printf("replay window of %d records %s\n", DTLS_REPLAY_WINDOW,
+	 failed ? "FAILED" : "OK");
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,236 @@
+/* Checks SHA-256 of sha2.c with each backend of sha2_hw.c that the
+ * CPU supports: the test vectors of FIPS 180-2, appendix B, and
+ * messages of up to MAX_LENGTH bytes, fed in two pieces, against the
+ * digests of the portable code. dtls_sha256_final_multi() and
+ * dtls_hmac_finalize_multi() are run with 1 to MAX_COUNT messages of
+ * mixed lengths, part of which has been hashed before, and compared
+ * against the portable digests and MACs as well.
+ *
+ * usage: sha256-test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tinydtls.h"
+#include "hmac.h"
+#ifdef WITH_SHA2_HW
+#include "sha2/sha2_hw.h"
+#endif /* WITH_SHA2_HW */
+
+struct test_vector {
+  const char *m;		/* the message */
+  size_t repeat;		/* number of times m is hashed */
+  const char *digest;
+};
+
+static const struct test_vector data[] = {
+  { "", 1,
+    "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+  { "abc", 1,
+    "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+  { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+    "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+  { "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", 25000,
+    "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" },
+};
+
+#define VECTORS (sizeof(data) / sizeof(data[0]))
+
+/* the messages are prefixes of msg, its bytes are (29 * i + 3) mod 256 */
+#define MAX_LENGTH 300
+
+/* more than one batch of dtls_sha256_final_multi() */
+#define MAX_COUNT  17
+
+static const unsigned char key[] = "the key of the MACs";
+
+static unsigned char msg[MAX_LENGTH];
+static unsigned char ref[MAX_LENGTH + 1][DTLS_SHA256_DIGEST_LENGTH];
+static unsigned char ref_mac[MAX_LENGTH + 1][DTLS_HMAC_DIGEST_SIZE];
+
+static size_t
+from_hex(const char *hex, unsigned char *buf) {
+  size_t n;
+  unsigned int b;
+
+  for (n = 0; hex[2 * n]; n++) {
+    sscanf(hex + 2 * n, "%2x", &b);
+    buf[n] = b;
+  }
+  return n;
+}
+
+static void
+sha256(const unsigned char *m, size_t len, size_t split,
+       unsigned char digest[DTLS_SHA256_DIGEST_LENGTH]) {
+  dtls_sha256_ctx ctx;
+
+  dtls_sha256_init(&ctx);
+  dtls_sha256_update(&ctx, m, split);
+  dtls_sha256_update(&ctx, m + split, len - split);
+  dtls_sha256_final(digest, &ctx);
+}
+
+static void
+hmac(const unsigned char *m, size_t len,
+     unsigned char mac[DTLS_HMAC_DIGEST_SIZE]) {
+  dtls_hmac_context_t ctx;
+
+  dtls_hmac_init(&ctx, key, sizeof(key) - 1);
+  dtls_hmac_update(&ctx, m, len);
+  dtls_hmac_finalize(&ctx, mac);
+}
+
+/* Length of message i out of count and the number of its bytes that
+ * are hashed before the multi-buffer call. */
+static size_t
+multi_length(size_t i, size_t count) {
+  return (97 * i + 31 * count) % (MAX_LENGTH + 1);
+}
+
+static size_t
+multi_prefix(size_t i, size_t count) {
+  return (i % 3 == 0) ? 0 : (13 * i + count) % (multi_length(i, count) + 1);
+}
+
+static int
+check_vector(const struct test_vector *v) {
+  unsigned char expected[DTLS_SHA256_DIGEST_LENGTH];
+  unsigned char digest[DTLS_SHA256_DIGEST_LENGTH];
+  dtls_sha256_ctx ctx;
+  size_t n;
+
+  from_hex(v->digest, expected);
+  dtls_sha256_init(&ctx);
+  for (n = 0; n < v->repeat; n++)
+    dtls_sha256_update(&ctx, (const unsigned char *)v->m, strlen(v->m));
+  dtls_sha256_final(digest, &ctx);
+  return memcmp(digest, expected, sizeof(digest)) != 0;
+}
+
+/* Compares each message, split at a different point depending on its
+ * length, against the reference digests. */
+static int
+check_lengths(void) {
+  unsigned char digest[DTLS_SHA256_DIGEST_LENGTH];
+  size_t len;
+
+  for (len = 0; len <= MAX_LENGTH; len++) {
+    sha256(msg, len, (len * 7) % (len + 1), digest);
+    if (memcmp(digest, ref[len], sizeof(digest))) {
+      fprintf(stderr, "E: digest of %zu bytes differs\n", len);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int
+check_multi(void) {
+  dtls_sha256_ctx ctx[MAX_COUNT], *ctxp[MAX_COUNT];
+  dtls_hmac_context_t hmac_key, hmac_ctx[MAX_COUNT], *hmac_ctxp[MAX_COUNT];
+  unsigned char digest[MAX_COUNT][DTLS_SHA256_DIGEST_LENGTH];
+  unsigned char *digestp[MAX_COUNT];
+  const unsigned char *data[MAX_COUNT];
+  size_t len[MAX_COUNT], count, i, pre;
+
+  dtls_hmac_init(&hmac_key, key, sizeof(key) - 1);
+  for (count = 1; count <= MAX_COUNT; count++) {
+    for (i = 0; i < count; i++) {
+      pre = multi_prefix(i, count);
+      dtls_sha256_init(&ctx[i]);
+      dtls_sha256_update(&ctx[i], msg, pre);
+      ctxp[i] = &ctx[i];
+      data[i] = msg + pre;
+      len[i] = multi_length(i, count) - pre;
+      digestp[i] = digest[i];
+    }
+    dtls_sha256_final_multi(ctxp, data, len, digestp, count);
+    for (i = 0; i < count; i++) {
+      if (memcmp(digest[i], ref[multi_length(i, count)], sizeof(digest[i]))) {
+	fprintf(stderr, "E: digest %zu of %zu differs\n", i + 1, count);
+	return 1;
+      }
+    }
+
+    for (i = 0; i < count; i++) {
+      dtls_hmac_clone(&hmac_ctx[i], &hmac_key);
+      dtls_hmac_update(&hmac_ctx[i], msg, multi_prefix(i, count));
+      hmac_ctxp[i] = &hmac_ctx[i];
+    }
+    memset(digest, 0, sizeof(digest));
+    if (dtls_hmac_finalize_multi(hmac_ctxp, data, len, digestp, count)
+	!= DTLS_HMAC_DIGEST_SIZE) {
+      fprintf(stderr, "E: wrong MAC length\n");
+      return 1;
+    }
+    for (i = 0; i < count; i++) {
+      if (memcmp(digest[i], ref_mac[multi_length(i, count)],
+		 sizeof(digest[i]))) {
+	fprintf(stderr, "E: MAC %zu of %zu differs\n", i + 1, count);
+	return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+static int
+check_backend(const char *name) {
+  size_t n;
+  int failed = 0, res;
+
+  for (n = 0; n < VECTORS; n++) {
+    res = check_vector(&data[n]);
+    printf("%s: Test Case %zu %s\n", name, n + 1, res ? "FAILED" : "OK");
+    failed |= res;
+  }
+
+  res = check_lengths();
+  printf("%s: Test Case %zu %s\n", name, n + 1, res ? "FAILED" : "OK");
+  failed |= res;
+
+  res = check_multi();
+  printf("%s: Test Case %zu %s\n", name, n + 2, res ? "FAILED" : "OK");
+  failed |= res;
+
+  return failed;
+}
+
+int
+main(int argc, char **argv) {
+  size_t n;
+  int failed = 0;
+#ifdef WITH_SHA2_HW
+  sha256_hw_backend_t backend, selected = sha256_hw_selected();
+#endif /* WITH_SHA2_HW */
+  (void)argc; (void)argv;
+
+  for (n = 0; n < MAX_LENGTH; n++)
+    msg[n] = (unsigned char)(29 * n + 3);
+
+#ifdef WITH_SHA2_HW
+  sha256_hw_select(SHA256_HW_PORTABLE);
+#endif /* WITH_SHA2_HW */
+  for (n = 0; n <= MAX_LENGTH; n++) {
+    sha256(msg, n, n, ref[n]);
+    hmac(msg, n, ref_mac[n]);
+  }
+
+#ifdef WITH_SHA2_HW
+  for (backend = SHA256_HW_PORTABLE; backend < SHA256_HW_BACKENDS; backend++) {
+    if (sha256_hw_select(backend) < 0) {
+      printf("%s: not supported\n", sha256_hw_name(backend));
+      continue;
+    }
+    failed |= check_backend(sha256_hw_name(backend));
+  }
+  sha256_hw_select(selected);
+#else /* WITH_SHA2_HW */
+  failed |= check_backend("portable");
+#endif /* WITH_SHA2_HW */
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}